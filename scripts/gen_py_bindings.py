@@ -30,16 +30,16 @@ from pybind.writer import Writer
 from pybind import Module, Class
 from pybind.parameters import (StringParameter, ClassParameter,
                                NumericParameter, ArgvObjects, IntegralArgv,
-                               ListOfStringsParameter)
+                               ListOfStringsParameter, BufferParameter)
 from pybind.retval import (StringViewRetVal, StringRetVal, ListOfStringsRetVal,
                            NumericRetVal, ObjCopyRetval, ObjOwnerRetval,
-                           ObjTupleRetVal, IntegralTupleRetVal)
+                           ObjTupleRetVal, IntegralTupleRetVal,
+                           ArrayViewRetVal)
 from pybind.exceptions import CppException
 
 # Module
 mod = Module('backends')
 mod.AddInclude('python/weights.h')
-mod.AddInitialization('lczero::InitializeMagicBitboards();')
 ex = mod.AddException(
     CppException('LczeroException', cpp_name='lczero::Exception'))
 
@@ -84,6 +84,28 @@ output.AddMethod('p_raw').AddParameter(IntegralArgv('samples', 'i')).AddRetVal(
 output.AddMethod('p_softmax').AddParameter(IntegralArgv(
     'samples', 'i')).AddRetVal(IntegralTupleRetVal('f32')).AddEx(ex)
 
+# BatchOutput class
+batch_output = mod.AddClass(
+    Class('BatchOutput',
+          cpp_name='lczero::python::BatchOutput',
+          disable_constructor=True))
+batch_output.AddMethod('size').AddRetVal(NumericRetVal('i'))
+batch_output.AddMethod('q').AddRetVal(ArrayViewRetVal('f32'))
+batch_output.AddMethod('d').AddRetVal(ArrayViewRetVal('f32'))
+batch_output.AddMethod('m').AddRetVal(ArrayViewRetVal('f32'))
+batch_output.AddMethod('p').AddRetVal(ArrayViewRetVal('f32', columns=1858))
+
+# PendingEvaluation class
+pending = mod.AddClass(
+    Class('PendingEvaluation',
+          cpp_name='lczero::python::PendingEvaluation',
+          disable_constructor=True))
+pending.AddMethod('is_ready').AddRetVal(NumericRetVal('i'))
+pending.AddMethod('wait').AddRetVal(
+    ObjTupleRetVal(output)).AddEx(ex).ReleaseGil()
+pending.AddMethod('wait_batch').AddRetVal(
+    ObjOwnerRetval(batch_output)).AddEx(ex).ReleaseGil()
+
 # Backend capabilities class
 backend_caps = mod.AddClass(
     Class('BackendCapabilities',
@@ -100,7 +122,23 @@ backend.constructor.AddParameter(
     StringParameter('backend', optional=True, can_be_none=True),
     StringParameter('options', optional=True, can_be_none=True)).AddEx(ex)
 backend.AddMethod('evaluate').AddParameter(ArgvObjects(
-    'inputs', input)).AddRetVal(ObjTupleRetVal(output)).AddEx(ex)
+    'inputs', input)).AddRetVal(ObjTupleRetVal(output)).AddEx(ex).ReleaseGil()
+backend.AddMethod('evaluate_planes').AddParameter(
+    BufferParameter('masks', type='u64'),
+    BufferParameter('values', type='f32')).AddRetVal(
+        ObjOwnerRetval(batch_output)).AddEx(ex).ReleaseGil()
+backend.AddMethod('evaluate_fens').AddParameter(
+    ListOfStringsParameter('fens')).AddRetVal(
+        ObjOwnerRetval(batch_output)).AddEx(ex).ReleaseGil()
+backend.AddMethod('evaluate_async').AddParameter(ArgvObjects(
+    'inputs', input)).AddRetVal(ObjOwnerRetval(pending)).AddEx(ex)
+backend.AddMethod('evaluate_planes_async').AddParameter(
+    BufferParameter('masks', type='u64'),
+    BufferParameter('values', type='f32')).AddRetVal(
+        ObjOwnerRetval(pending)).AddEx(ex)
+backend.AddMethod('evaluate_fens_async').AddParameter(
+    ListOfStringsParameter('fens')).AddRetVal(
+        ObjOwnerRetval(pending)).AddEx(ex)
 backend.AddMethod('capabilities').AddRetVal(ObjCopyRetval(backend_caps))
 
 # PositionHistory class
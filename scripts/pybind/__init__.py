@@ -188,6 +188,7 @@ class Module(FunctionContainer):
             w.Write(f'#include "{x}"')
 
         w.Write('\nnamespace {')
+        self._generate_helpers(w)
         for cls in self.exceptions:
             cls.Generate(w)
         for cls in self.classes:
@@ -200,6 +201,77 @@ class Module(FunctionContainer):
 
         self._generate_main_func(w)
 
+    def _generate_helpers(self, w):
+        # Holder of a buffer received from Python, see BufferParameter.
+        w.Open('struct BufferHolder {')
+        w.Write('Py_buffer view{};')
+        w.Write('bool acquired = false;')
+        w.Write('~BufferHolder() { if (acquired) PyBuffer_Release(&view); }')
+        w.Close('};\n')
+        # Releases the interpreter lock for its lifetime, see ReleaseGil().
+        w.Open('struct GilReleaser {')
+        w.Write('GilReleaser() : state(PyEval_SaveThread()) {}')
+        w.Write('~GilReleaser() { PyEval_RestoreThread(state); }')
+        w.Write('PyThreadState* state;')
+        w.Close('};\n')
+        # Read-only array view of memory owned by another object, exposed via
+        # the buffer protocol, see ArrayViewRetVal.
+        w.Open('struct TArrayView {')
+        w.Write('PyObject_HEAD')
+        w.Write('PyObject* owner;')
+        w.Write('void* data;')
+        w.Write('Py_ssize_t itemsize;')
+        w.Write('const char* format;')
+        w.Write('int ndim;')
+        w.Write('Py_ssize_t shape[2];')
+        w.Write('Py_ssize_t strides[2];')
+        w.Close('};\n')
+        w.Open('int FArrayViewGetBuffer(TArrayView* self, Py_buffer* view, '
+               'int flags) {')
+        w.Open('if (flags & PyBUF_WRITABLE) {')
+        w.Write('PyErr_SetString(PyExc_BufferError, '
+                '"The array is read-only.");')
+        w.Write('return -1;')
+        w.Close('}')
+        w.Write('view->obj = &self->ob_base;')
+        w.Write('Py_INCREF(view->obj);')
+        w.Write('view->buf = self->data;')
+        w.Write('view->len = self->itemsize;')
+        w.Write('for (int i = 0; i < self->ndim; ++i) '
+                'view->len *= self->shape[i];')
+        w.Write('view->readonly = 1;')
+        w.Write('view->itemsize = self->itemsize;')
+        w.Write('view->format = (flags & PyBUF_FORMAT) ? '
+                'const_cast<char*>(self->format) : nullptr;')
+        w.Write('view->ndim = self->ndim;')
+        w.Write('view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;')
+        w.Write('view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES '
+                '? self->strides : nullptr;')
+        w.Write('view->suboffsets = nullptr;')
+        w.Write('view->internal = nullptr;')
+        w.Write('return 0;')
+        w.Close('}\n')
+        w.Open('void FArrayViewDestructor(TArrayView* self) {')
+        w.Write('Py_XDECREF(self->owner);')
+        w.Write('Py_TYPE(self)->tp_free(&self->ob_base);')
+        w.Close('}\n')
+        w.Open('PyBufferProcs rgArrayViewBufferProcs = {')
+        w.Write('.bf_getbuffer = reinterpret_cast<getbufferproc>'
+                '(FArrayViewGetBuffer),')
+        w.Write('.bf_releasebuffer = nullptr,')
+        w.Close('};\n')
+        w.Open('PyTypeObject objArrayViewType = {')
+        w.Write('.ob_base = PyVarObject_HEAD_INIT(NULL, 0)')
+        w.Write(f'.tp_name = "{self.name}.ArrayView",')
+        w.Write('.tp_basicsize = sizeof(TArrayView),')
+        w.Write('.tp_dealloc = reinterpret_cast<destructor>'
+                '(FArrayViewDestructor),')
+        w.Write('.tp_as_buffer = &rgArrayViewBufferProcs,')
+        w.Write('.tp_flags = Py_TPFLAGS_DEFAULT,')
+        w.Write('.tp_doc = "Read-only array, use numpy.asarray() or '
+                'memoryview() to access.",')
+        w.Close('};\n')
+
     def struct_name(self):
         return f'T{self.name}Module'
 
@@ -226,5 +298,6 @@ class Module(FunctionContainer):
             x.GenerateRegister(w, self)
         for x in self.classes:
             x.GenerateRegister(w)
+        w.Write('if (PyType_Ready(&objArrayViewType) != 0) return nullptr;')
         w.Write('return module;')
         w.Close('}')
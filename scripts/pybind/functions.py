@@ -52,6 +52,7 @@ class Function(PyObject):
         self.self_type = self_type
         self.param_typ = param_type
         self.retval = NoneRetVal()
+        self.release_gil = False
 
     def AddParameter(self, *params):
         for param in params:
@@ -70,6 +71,19 @@ class Function(PyObject):
         self.exceptions.append(ex)
         return self
 
+    def ReleaseGil(self):
+        '''Releases the interpreter lock while the C++ function runs, so that
+        other Python threads can proceed.'''
+        self.release_gil = True
+        return self
+
+    def _wrap_call(self, call):
+        if not self.release_gil:
+            return call
+        if isinstance(self.retval, NoneRetVal):
+            return f'{{ GilReleaser nogil; {call}; }}'
+        return f'[&]() {{ GilReleaser nogil; return {call}; }}()'
+
     def Generate(self, w):
         w.Open(f'{self._return_cpp_type()} '
                f'{self.gen_function_name}({self._generate_params()}) {{')
@@ -213,13 +227,13 @@ class MemberFunction(Function):
         super().__init__(name, *args, **kwargs)
 
     def _generate_call(self, w):
+        call = self._wrap_call(f'self->value->{self.cpp_name}'
+                               f'({self._list_caller_params()})')
         if isinstance(self.retval, NoneRetVal):
-            w.Write(
-                f'self->value->{self.cpp_name}({self._list_caller_params()});')
+            w.Write(f'{call};')
         else:
             w.Write(f'{self.retval.cpp_type()} '
-                    f'{self.retval.cpp_val()} = self->value->'
-                    f'{self.cpp_name}({self._list_caller_params()});')
+                    f'{self.retval.cpp_val()} = {call};')
 
 
 class StaticFunction(Function):
@@ -232,14 +246,13 @@ class StaticFunction(Function):
         return super().function_meth_flags() + '| METH_STATIC'
 
     def _generate_call(self, w):
+        call = self._wrap_call(f'{self.cpp_type_name}::{self.cpp_name}'
+                               f'({self._list_caller_params()})')
         if isinstance(self.retval, NoneRetVal):
-            w.Write(f'{self.cpp_type_name}::{self.cpp_name}'
-                    f'({self._list_caller_params()});')
+            w.Write(f'{call};')
         else:
             w.Write(f'{self.retval.cpp_type()} '
-                    f'{self.retval.cpp_val()} = '
-                    f'{self.cpp_type_name}::'
-                    f'{self.cpp_name}({self._list_caller_params()});')
+                    f'{self.retval.cpp_val()} = {call};')
 
 
 class Constructor(Function):
@@ -271,6 +284,19 @@ class DisabledConstructor(Function):
                          gen_function_name=gen_function_name,
                          param_type=FunctionType.METH_KEYWORDS)
 
+    def ReleaseGil(self):
+        '''Releases the interpreter lock while the C++ function runs, so that
+        other Python threads can proceed.'''
+        self.release_gil = True
+        return self
+
+    def _wrap_call(self, call):
+        if not self.release_gil:
+            return call
+        if isinstance(self.retval, NoneRetVal):
+            return f'{{ GilReleaser nogil; {call}; }}'
+        return f'[&]() {{ GilReleaser nogil; return {call}; }}()'
+
     def Generate(self, w):
         w.Open(f'{self._return_cpp_type()} '
                f'{self.gen_function_name}({self._generate_params()}) {{')
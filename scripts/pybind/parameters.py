@@ -206,3 +206,61 @@ class IntegralArgv(ArgvParameter):
                 f'&& PyErr_Occurred() != nullptr) return {func._failure()};')
         w.Write(f'{self.name}[i] = tmp;')
         w.Close('}')
+
+
+class BufferParameter(Parameter):
+    '''C-contiguous buffer (e.g. numpy array), passed to C++ as std::span
+    without copying.'''
+    def __init__(self, *args, type='f32', **kwargs):
+        self.type = type
+        super().__init__(*args, **kwargs)
+
+    def item_cpp_type(self):
+        return {
+            'u64': 'uint64_t',
+            'f32': 'float',
+        }[self.type]
+
+    def item_formats(self):
+        # Buffer protocol format characters accepted for the type.
+        return {
+            'u64': 'QLK',
+            'f32': 'f',
+        }[self.type]
+
+    def GenerateParseTupleSinkDeclaration(self, w):
+        w.Write(f'PyObject* {self.name} = nullptr;')
+
+    def parse_tuple_format(self):
+        return 'O'
+
+    def parse_tuple_sink_list(self):
+        return [f'&{self.name}']
+
+    def GenerateCppParamInitialization(self, w, func):
+        buf = f'{self.name}_buf'
+        w.Write(f'BufferHolder {buf};')
+        w.Open(f'if (PyObject_GetBuffer({self.name}, &{buf}.view, '
+               'PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {')
+        w.Write(f'return {func._failure()};')
+        w.Close('}')
+        w.Write(f'{buf}.acquired = true;')
+        w.Write(f'const char* {self.name}_fmt = {buf}.view.format;')
+        w.Write(f'if ({self.name}_fmt[0] == \'<\' || {self.name}_fmt[0] == '
+                f'\'=\' || {self.name}_fmt[0] == \'@\') ++{self.name}_fmt;')
+        w.Open(f'if ({buf}.view.itemsize != sizeof({self.item_cpp_type()}) '
+               f'|| {self.name}_fmt[0] == \'\\0\' || {self.name}_fmt[1] != '
+               f'\'\\0\' || std::string_view("{self.item_formats()}").find('
+               f'{self.name}_fmt[0]) == std::string_view::npos) {{')
+        w.Write('PyErr_SetString(PyExc_TypeError, "Argument '
+                f'\'{self.name}\' must be a buffer of '
+                f'{self.item_cpp_type()}.");')
+        w.Write(f'return {func._failure()};')
+        w.Close('}')
+        w.Write(f'std::span<const {self.item_cpp_type()}> '
+                f'{self.name_at_caller()}('
+                f'static_cast<const {self.item_cpp_type()}*>({buf}.view.buf), '
+                f'{buf}.view.len / sizeof({self.item_cpp_type()}));')
+
+    def name_at_caller(self):
+        return f'{self.cpp_name}_cpp'
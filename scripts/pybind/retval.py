@@ -198,3 +198,52 @@ class IntegralTupleRetVal(RetVal):
         w.Write(f'PyTuple_SetItem({self.py_val()}, i, Py_BuildValue('
                 f'"{self.parse_tuple_format()}", {self.cpp_val()}[i]));')
         w.Close('}')
+
+
+class ArrayViewRetVal(RetVal):
+    '''Returns std::span into memory owned by self as a read-only buffer, so
+    numpy.asarray() can wrap it without copying. When columns is set, the
+    buffer is two-dimensional.'''
+    def __init__(self, type, columns=None):
+        self.type = type
+        self.columns = columns
+
+    def cpp_item_type(self):
+        return {
+            'f32': 'float',
+        }[self.type]
+
+    def buffer_format(self):
+        return {
+            'f32': 'f',
+        }[self.type]
+
+    def cpp_type(self):
+        return f'std::span<const {self.cpp_item_type()}>'
+
+    def ret_val(self):
+        return f'&{self.py_val()}->ob_base'
+
+    def GenerateDeclaration(self, w):
+        w.Write(f'TArrayView *{self.py_val()};')
+
+    def GenerateConversion(self, w):
+        r = self.py_val()
+        item = self.cpp_item_type()
+        w.Write(f'{r} = PyObject_New(TArrayView, &objArrayViewType);')
+        w.Write(f'{r}->owner = &self->ob_base;')
+        w.Write(f'Py_INCREF({r}->owner);')
+        w.Write(f'{r}->data = const_cast<{item}*>({self.cpp_val()}.data());')
+        w.Write(f'{r}->itemsize = sizeof({item});')
+        w.Write(f'{r}->format = "{self.buffer_format()}";')
+        if self.columns is None:
+            w.Write(f'{r}->ndim = 1;')
+            w.Write(f'{r}->shape[0] = {self.cpp_val()}.size();')
+            w.Write(f'{r}->strides[0] = sizeof({item});')
+        else:
+            w.Write(f'{r}->ndim = 2;')
+            w.Write(f'{r}->shape[0] = {self.cpp_val()}.size() / '
+                    f'{self.columns};')
+            w.Write(f'{r}->shape[1] = {self.columns};')
+            w.Write(f'{r}->strides[0] = sizeof({item}) * {self.columns};')
+            w.Write(f'{r}->strides[1] = sizeof({item});')
@@ -0,0 +1,397 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "analysis_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+#include "engine.h"
+#include "neural/coalesce.h"
+#include "neural/memcache.h"
+#include "neural/register.h"
+#include "neural/remote/protocol.h"
+#include "neural/shared_params.h"
+#include "utils/configfile.h"
+
+namespace lczero {
+namespace {
+
+using remote::Socket;
+
+const OptionId kHostId{"host", "",
+                       "Address to listen on, all interfaces if empty."};
+const OptionId kPortId{"port", "", "TCP port to listen on."};
+const OptionId kMaxSessionsId{
+    "max-sessions", "",
+    "Maximum number of connected sessions, further connections are refused."};
+const OptionId kMaxSearchesId{
+    "max-searches", "",
+    "Maximum number of searches running at the same time. Further go "
+    "commands wait for a free slot in the order they arrived."};
+const OptionId kSessionNodesId{
+    "session-max-nodes", "",
+    "Node limit of every search of a session, also of the infinite ones. 0 "
+    "means no limit."};
+const OptionId kSessionMoveTimeId{
+    "session-max-movetime", "",
+    "Time limit of every search of a session in milliseconds, also of the "
+    "infinite ones. 0 means no limit."};
+
+constexpr int kDefaultPort = 17836;
+
+void PopulateOptions(OptionsParser* options, SearchFactory* factory) {
+  ConfigFile::PopulateOptions(options);
+  Engine::PopulateOptions(options);
+  factory->PopulateParams(options);
+  SharedBackendParams::Populate(options);
+  options->Add<StringOption>(kHostId) = "";
+  options->Add<IntOption>(kPortId, 1, 65535) = kDefaultPort;
+  options->Add<IntOption>(kMaxSessionsId, 1, 10000) = 64;
+  options->Add<IntOption>(kMaxSearchesId, 1, 1024) = 4;
+  options->Add<IntOption>(kSessionNodesId, 0, 999999999) = 0;
+  options->Add<IntOption>(kSessionMoveTimeId, 0, 999999999) = 0;
+}
+
+class Session;
+
+// Admits the searches of all the sessions, at most max-searches at a time and
+// the rest in FIFO order. Queued searches are started by a dispatcher thread,
+// so that no session is started from a thread of another session.
+class SearchScheduler {
+ public:
+  explicit SearchScheduler(size_t max_searches)
+      : max_searches_(max_searches), dispatcher_([this]() { Dispatch(); }) {}
+
+  ~SearchScheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    dispatcher_.join();
+  }
+
+  // Returns true if the search of the session may start right away, otherwise
+  // it's queued and started by the dispatcher.
+  bool Submit(Session* session, const GoParams& params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_.count(session) || running_.size() < max_searches_) {
+      running_.insert(session);
+      return true;
+    }
+    queue_.push_back({session, params});
+    return false;
+  }
+
+  // Takes the queued search of the session out of the queue, letting it run
+  // above the limit. Returns the parameters if it was queued.
+  std::optional<GoParams> Promote(Session* session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto iter = queue_.begin(); iter != queue_.end(); ++iter) {
+      if (iter->session != session) continue;
+      const GoParams params = iter->params;
+      queue_.erase(iter);
+      running_.insert(session);
+      return params;
+    }
+    return std::nullopt;
+  }
+
+  // Frees the slot of the session when its search is over. Idempotent.
+  void Release(Session* session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_.erase(session)) cv_.notify_all();
+  }
+
+  // Forgets the session, and waits until the dispatcher doesn't use it.
+  void Remove(Session* session) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::erase_if(queue_,
+                  [&](const Queued& q) { return q.session == session; });
+    if (running_.erase(session)) cv_.notify_all();
+    cv_.wait(lock, [&]() { return starting_ != session; });
+  }
+
+ private:
+  void Dispatch();
+
+  struct Queued {
+    Session* session;
+    GoParams params;
+  };
+
+  const size_t max_searches_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Queued> queue_;
+  std::unordered_set<Session*> running_;
+  // Session which the dispatcher is starting the search of.
+  Session* starting_ = nullptr;
+  bool stop_ = false;
+  std::thread dispatcher_;
+};
+
+struct SessionLimits {
+  int nodes = 0;
+  int movetime = 0;
+};
+
+// One connection: reads UCI commands from the socket in its own thread, and
+// writes the responses back. Is both the engine controller of the UCI loop,
+// forwarding to its Engine, and the UCI responder of that engine.
+class Session : public StringUciResponder, public EngineControllerBase {
+ public:
+  Session(Socket socket, SearchFactory* factory, CachingBackend* backend,
+          SearchScheduler* scheduler)
+      : socket_(std::move(socket)), scheduler_(scheduler) {
+    PopulateOptions(&options_, factory);
+    PopulateParams(&options_);
+    // Validated by the server already.
+    options_.ProcessAllFlags();
+    const OptionsDict& dict = options_.GetOptionsDict();
+    limits_ = {dict.Get<int>(kSessionNodesId),
+               dict.Get<int>(kSessionMoveTimeId)};
+    engine_ = std::make_unique<Engine>(*factory, dict, backend);
+    loop_ = std::make_unique<UciLoop>(this, &options_, this);
+    thread_ = std::thread([this]() { ReadLoop(); });
+  }
+
+  ~Session() {
+    socket_.Shutdown();
+    thread_.join();
+    loop_.reset();
+    scheduler_->Remove(this);
+    engine_.reset();
+  }
+
+  bool finished() const { return finished_; }
+
+  // Called by the scheduler to start the queued search.
+  void StartSearch(const GoParams& params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    engine_->Go(params);
+  }
+
+  // StringUciResponder.
+  void OutputBestMove(BestMoveInfo* info) override {
+    // Before the client sees the bestmove and sends the next go.
+    scheduler_->Release(this);
+    StringUciResponder::OutputBestMove(info);
+  }
+
+  void SendRawResponses(const std::vector<std::string>& responses) override {
+    std::string text;
+    for (const auto& response : responses) text += response + '\n';
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    try {
+      socket_.WriteAll(text.data(), text.size());
+    } catch (const Exception&) {
+      // The client is gone, the read loop notices.
+    }
+  }
+
+  // EngineControllerBase.
+  void EnsureReady() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    engine_->EnsureReady();
+  }
+  void NewGame() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      engine_->NewGame();
+    }
+    scheduler_->Release(this);
+  }
+  void SetPosition(const std::string& fen,
+                   const std::vector<std::string>& moves) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Aborts the search without the bestmove.
+      engine_->SetPosition(fen, moves);
+    }
+    scheduler_->Release(this);
+  }
+  void Go(const GoParams& params) override {
+    const GoParams limited = ApplyLimits(params);
+    if (scheduler_->Submit(this, limited)) StartSearch(limited);
+  }
+  void PonderHit() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    engine_->PonderHit();
+  }
+  void Wait() override { engine_->Wait(); }
+  void Stop() override {
+    // The client expects a bestmove, so a queued search is started to be
+    // stopped right away.
+    if (auto params = scheduler_->Promote(this)) StartSearch(*params);
+    std::lock_guard<std::mutex> lock(mutex_);
+    engine_->Stop();
+  }
+  void RegisterUciResponder(UciResponder* responder) override {
+    engine_->RegisterUciResponder(responder);
+  }
+  void UnregisterUciResponder(UciResponder* responder) override {
+    engine_->UnregisterUciResponder(responder);
+  }
+
+ private:
+  GoParams ApplyLimits(GoParams params) const {
+    if (params.ponder) return params;
+    if (limits_.nodes > 0) {
+      params.nodes = std::min(params.nodes.value_or(limits_.nodes),
+                              limits_.nodes);
+      params.infinite = false;
+    }
+    if (limits_.movetime > 0) {
+      params.movetime = std::min<int64_t>(
+          params.movetime.value_or(limits_.movetime), limits_.movetime);
+      params.infinite = false;
+    }
+    return params;
+  }
+
+  void ReadLoop() {
+    std::string buffer;
+    char data[4096];
+    try {
+      while (size_t size = socket_.ReadSome(data, sizeof(data))) {
+        buffer.append(data, size);
+        size_t eol;
+        while ((eol = buffer.find('\n')) != std::string::npos) {
+          std::string line = buffer.substr(0, eol);
+          buffer.erase(0, eol + 1);
+          if (!line.empty() && line.back() == '\r') line.pop_back();
+          if (!ProcessLine(line)) throw Exception("quit");
+        }
+      }
+    } catch (const Exception&) {
+      // Connection closed or quit.
+    }
+    finished_ = true;
+  }
+
+  bool ProcessLine(const std::string& line) {
+    LOGFILE << ">> " << line;
+    try {
+      return loop_->ProcessLine(line);
+    } catch (Exception& ex) {
+      SendRawResponse(std::string("error ") + ex.what());
+    }
+    return true;
+  }
+
+  Socket socket_;
+  SearchScheduler* const scheduler_;
+  OptionsParser options_;
+  SessionLimits limits_;
+  // Serializes the engine calls of the session thread and the dispatcher.
+  std::mutex mutex_;
+  std::mutex write_mutex_;
+  std::unique_ptr<Engine> engine_;
+  std::unique_ptr<UciLoop> loop_;
+  std::atomic<bool> finished_ = false;
+  std::thread thread_;
+};
+
+void SearchScheduler::Dispatch() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() {
+      return stop_ || (!queue_.empty() && running_.size() < max_searches_);
+    });
+    if (stop_) return;
+    const Queued next = queue_.front();
+    queue_.pop_front();
+    running_.insert(next.session);
+    starting_ = next.session;
+    lock.unlock();
+    next.session->StartSearch(next.params);
+    lock.lock();
+    starting_ = nullptr;
+    cv_.notify_all();
+  }
+}
+
+}  // namespace
+
+void RunAnalysisServer(SearchFactory* factory) {
+  OptionsParser options;
+  PopulateOptions(&options, factory);
+  // Only to accept the UCI responder flags, the sessions have their own.
+  StdoutUciResponder uci_options;
+  uci_options.PopulateParams(&options);
+  // Merging the requests of the sessions is the point of a shared backend.
+  options.GetMutableDefaultsOptions()->Set(
+      SharedBackendParams::kNNCoalesceDeadlineId, 1000);
+  if (!ConfigFile::Init() || !options.ProcessAllFlags()) return;
+
+  try {
+    const OptionsDict& dict = options.GetOptionsDict();
+    std::unique_ptr<CachingBackend> backend = CreateMemCache(
+        CreateCoalescingBackend(BackendManager::Get()->CreateFromParams(dict),
+                                dict),
+        dict);
+    SearchScheduler scheduler(dict.Get<int>(kMaxSearchesId));
+
+    const int port = dict.Get<int>(kPortId);
+    Socket listener = Socket::Listen(dict.Get<std::string>(kHostId), port);
+    CERR << "Serving " << factory->GetName() << " search sessions on port "
+         << port << ".";
+
+    const size_t max_sessions = dict.Get<int>(kMaxSessionsId);
+    std::list<std::unique_ptr<Session>> sessions;
+    while (true) {
+      Socket socket = listener.Accept();
+      sessions.remove_if(
+          [](const std::unique_ptr<Session>& s) { return s->finished(); });
+      if (sessions.size() >= max_sessions) {
+        const std::string_view error = "error Too many sessions\n";
+        try {
+          socket.WriteAll(error.data(), error.size());
+        } catch (const Exception&) {
+        }
+        continue;
+      }
+      sessions.push_back(std::make_unique<Session>(
+          std::move(socket), factory, backend.get(), &scheduler));
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
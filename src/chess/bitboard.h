@@ -48,7 +48,7 @@ class BitBoard {
     return BitBoard(1ULL << square.as_idx());
   }
 
-  std::uint64_t as_int() const { return board_; }
+  constexpr std::uint64_t as_int() const { return board_; }
   void clear() { board_ = 0; }
 
   // Counts the number of set bits in the BitBoard.
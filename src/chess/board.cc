@@ -28,6 +28,7 @@
 #include "chess/board.h"
 
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <charconv>
 #include <cstdlib>
@@ -71,10 +72,10 @@ namespace {
 static const std::pair<int, int> kKingMoves[] = {
     {-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
 
-static const std::pair<int, int> kRookDirections[] = {
+static constexpr std::pair<int, int> kRookDirections[] = {
     {1, 0}, {-1, 0}, {0, 1}, {0, -1}};
 
-static const std::pair<int, int> kBishopDirections[] = {
+static constexpr std::pair<int, int> kBishopDirections[] = {
     {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
 
 // Which squares can rook attack from every of squares.
@@ -179,25 +180,11 @@ static constexpr PieceType kPromotions[] = {kQueen, kRook, kBishop, kKnight};
 // Magic bitboard routines and structures.
 // We use so-called "fancy" magic bitboards.
 
-// Structure holding all relevant magic parameters per square.
-struct MagicParams {
-  // Relevant occupancy mask.
-  uint64_t mask_;
-  // Pointer to lookup table.
-  BitBoard* attacks_table_;
-#if defined(NO_PEXT)
-  // Magic number.
-  uint64_t magic_number_;
-  // Number of bits to shift.
-  uint8_t shift_bits_;
-#endif
-};
-
 #if defined(NO_PEXT)
 // Magic numbers determined via trial and error with random number generator
 // such that the number of relevant occupancy bits suffice to index the attacks
 // tables with only constructive collisions.
-static const BitBoard kRookMagicNumbers[] = {
+static constexpr BitBoard kRookMagicNumbers[] = {
     0x088000102088C001ULL, 0x10C0200040001000ULL, 0x83001041000B2000ULL,
     0x0680280080041000ULL, 0x488004000A080080ULL, 0x0100180400010002ULL,
     0x040001C401021008ULL, 0x02000C04A980C302ULL, 0x0000800040082084ULL,
@@ -220,7 +207,7 @@ static const BitBoard kRookMagicNumbers[] = {
     0x2001008440001021ULL, 0x2002008830204082ULL, 0x0010145000082101ULL,
     0x01A2001004200842ULL, 0x1007000608040041ULL, 0x000A08100203028CULL,
     0x02D4048040290402ULL};
-static const BitBoard kBishopMagicNumbers[] = {
+static constexpr BitBoard kBishopMagicNumbers[] = {
     0x0008201802242020ULL, 0x0021040424806220ULL, 0x4006360602013080ULL,
     0x0004410020408002ULL, 0x2102021009001140ULL, 0x08C2021004000001ULL,
     0x6001031120200820ULL, 0x1018310402201410ULL, 0x401CE00210820484ULL,
@@ -245,129 +232,142 @@ static const BitBoard kBishopMagicNumbers[] = {
     0x0240080802809010ULL};
 #endif
 
-// Magic parameters for rooks/bishops.
-static MagicParams rook_magic_params[64];
-static MagicParams bishop_magic_params[64];
-
-// Precomputed attacks bitboard tables.
-static BitBoard rook_attacks_table[102400];
-static BitBoard bishop_attacks_table[5248];
-
 namespace {
 constexpr bool IsOnBoard(int x) { return x >= 0 && x < 8; }
 constexpr bool IsOnBoard(int x, int y) { return IsOnBoard(x) && IsOnBoard(y); }
 }  // namespace
 
-// Builds rook or bishop attacks table.
-static void BuildAttacksTable(MagicParams* magic_params,
-                              BitBoard* attacks_table,
-                              const std::pair<int, int>* directions) {
-  // Offset into lookup table.
-  uint32_t table_offset = 0;
-
-  // Initialize for all board squares.
-  for (unsigned square = 0; square < 64; square++) {
-    const Square b_sq = Square::FromIdx(square);
-
-    // Calculate relevant occupancy masks.
-    BitBoard mask = {0};
+// The tables are built at compile time, so they live in the read-only data of
+// the binary and there is no work to do at startup.
+
+// Relevant occupancy mask of a rook or bishop on the square, i.e. the squares
+// on its rays without the board's edge.
+static constexpr uint64_t SlidingMask(int square,
+                                      const std::pair<int, int>* directions) {
+  uint64_t mask = 0;
+  for (int j = 0; j < 4; j++) {
+    const auto direction = directions[j];
+    int dst_row = square / 8 + direction.first;
+    int dst_col = square % 8 + direction.second;
+    // If the next square in this direction is invalid, the current square is
+    // at the board's edge and should not be added.
+    while (IsOnBoard(dst_row + direction.first, dst_col + direction.second)) {
+      mask |= 1ULL << (dst_row * 8 + dst_col);
+      dst_row += direction.first;
+      dst_col += direction.second;
+    }
+  }
+  return mask;
+}
 
-    for (int j = 0; j < 4; j++) {
-      auto direction = directions[j];
-      auto dst_row = b_sq.rank().idx;
-      auto dst_col = b_sq.file().idx;
-      while (true) {
-        dst_row += direction.first;
-        dst_col += direction.second;
-        // If the next square in this direction is invalid, the current square
-        // is at the board's edge and should not be added.
-        if (!IsOnBoard(dst_row + direction.first, dst_col + direction.second))
-          break;
-        const Square destination(File::FromIdx(dst_col),
-                                 Rank::FromIdx(dst_row));
-        mask.set(destination);
-      }
+// Attacks of a rook or bishop on the square for the given occupancy.
+static constexpr uint64_t SlidingAttacks(int square, uint64_t occupancy,
+                                         const std::pair<int, int>* directions) {
+  uint64_t attacks = 0;
+  for (int j = 0; j < 4; j++) {
+    const auto direction = directions[j];
+    int dst_row = square / 8 + direction.first;
+    int dst_col = square % 8 + direction.second;
+    while (IsOnBoard(dst_row, dst_col)) {
+      const uint64_t destination = 1ULL << (dst_row * 8 + dst_col);
+      attacks |= destination;
+      if (occupancy & destination) break;
+      dst_row += direction.first;
+      dst_col += direction.second;
     }
+  }
+  return attacks;
+}
 
-    // Set mask.
-    magic_params[square].mask_ = mask.as_int();
+static constexpr int CountBits(uint64_t x) {
+  int count = 0;
+  for (; x != 0; x &= x - 1) ++count;
+  return count;
+}
 
-    // Cache relevant occupancy board squares.
-    std::vector<Square> occupancy_squares;
+// Spreads the low bits of index over the set bits of mask, the inverse of
+// pext.
+static constexpr uint64_t DepositBits(uint64_t index, uint64_t mask) {
+  uint64_t result = 0;
+  for (uint64_t bit = 1; mask != 0; bit <<= 1, mask &= mask - 1) {
+    if (index & bit) result |= mask & -mask;
+  }
+  return result;
+}
 
-    for (auto occ_sq : BitBoard(magic_params[square].mask_)) {
-      occupancy_squares.emplace_back(occ_sq);
-    }
+static constexpr const std::pair<int, int>* SlidingDirections(bool rook) {
+  return rook ? kRookDirections : kBishopDirections;
+}
 
+// Builds the attacks table of a rook or bishop on the square, indexed by the
+// magic index of the relevant occupancy.
+template <bool kRook, int kSquare>
+static constexpr auto BuildAttacksTable() {
+  constexpr uint64_t kMask = SlidingMask(kSquare, SlidingDirections(kRook));
+  constexpr int kBits = CountBits(kMask);
+  std::array<uint64_t, 1 << kBits> attacks_table{};
+  for (uint64_t i = 0; i < attacks_table.size(); i++) {
+    const uint64_t occupancy = DepositBits(i, kMask);
+    const uint64_t attacks =
+        SlidingAttacks(kSquare, occupancy, SlidingDirections(kRook));
 #if defined(NO_PEXT)
-    // Set number of shifted bits. The magic numbers have been chosen such that
-    // the number of relevant occupancy bits suffice to index the attacks table.
-    magic_params[square].shift_bits_ = 64 - occupancy_squares.size();
-#endif
-
-    // Set pointer to lookup table.
-    magic_params[square].attacks_table_ = &attacks_table[table_offset];
-
-    // Clear attacks table (used for sanity check later on).
-    for (int i = 0; i < (1 << occupancy_squares.size()); i++) {
-      attacks_table[table_offset + i] = 0;
+    // The magic numbers have been chosen such that the number of relevant
+    // occupancy bits suffice to index the attacks table, with only
+    // constructive collisions.
+    const uint64_t magic = kRook ? kRookMagicNumbers[kSquare].as_int()
+                                 : kBishopMagicNumbers[kSquare].as_int();
+    const uint64_t index = (occupancy * magic) >> (64 - kBits);
+    if (attacks_table[index] != 0 && attacks_table[index] != attacks) {
+      throw Exception("Invalid magic number!");
     }
+#else
+    // Deposit and pext are inverse, the pext index is i itself.
+    const uint64_t index = i;
+#endif
+    attacks_table[index] = attacks;
+  }
+  return attacks_table;
+}
 
-    // Build square attacks table for every possible relevant occupancy
-    // bitboard.
-    for (int i = 0; i < (1 << occupancy_squares.size()); i++) {
-      BitBoard occupancy(0);
-
-      for (size_t bit = 0; bit < occupancy_squares.size(); bit++) {
-        occupancy.set_if(occupancy_squares[bit], (1 << bit) & i);
-      }
-
-      // Calculate attacks bitboard corresponding to this occupancy bitboard.
-      BitBoard attacks(0);
-
-      for (int j = 0; j < 4; j++) {
-        auto direction = directions[j];
-        auto dst_row = b_sq.rank().idx;
-        auto dst_col = b_sq.file().idx;
-        while (true) {
-          dst_row += direction.first;
-          dst_col += direction.second;
-          if (!IsOnBoard(dst_row, dst_col)) break;
-          const Square destination(File::FromIdx(dst_col),
-                                   Rank::FromIdx(dst_row));
-          attacks.set(destination);
-          if (occupancy.get(destination)) break;
-        }
-      }
+// Precomputed attacks bitboard tables, one per square.
+template <bool kRook, int kSquare>
+static constexpr auto kAttacksTable = BuildAttacksTable<kRook, kSquare>();
 
+// Structure holding all relevant magic parameters per square.
+struct MagicParams {
+  // Relevant occupancy mask.
+  uint64_t mask_;
+  // Pointer to lookup table.
+  const uint64_t* attacks_table_;
 #if defined(NO_PEXT)
-      // Calculate magic index.
-      uint64_t index = occupancy.as_int();
-      index *= magic_params[square].magic_number_;
-      index >>= magic_params[square].shift_bits_;
-
-      // Sanity check. The magic numbers have been chosen such that
-      // the number of relevant occupancy bits suffice to index the attacks
-      // table. If the table already contains an attacks bitboard, possible
-      // collisions should be constructive.
-      if (attacks_table[table_offset + index] != 0 &&
-          attacks_table[table_offset + index] != attacks) {
-        throw Exception("Invalid magic number!");
-      }
-#else
-      uint64_t index =
-          _pext_u64(occupancy.as_int(), magic_params[square].mask_);
+  // Magic number.
+  uint64_t magic_number_;
+  // Number of bits to shift.
+  uint8_t shift_bits_;
 #endif
+};
 
-      // Update table.
-      attacks_table[table_offset + index] = attacks;
-    }
-
-    // Update table offset.
-    table_offset += (1 << occupancy_squares.size());
-  }
+template <bool kRook, int... kSquares>
+static constexpr std::array<MagicParams, 64> BuildMagicParams(
+    std::integer_sequence<int, kSquares...>) {
+  return {MagicParams{
+      SlidingMask(kSquares, SlidingDirections(kRook)),
+      kAttacksTable<kRook, kSquares>.data(),
+#if defined(NO_PEXT)
+      kRook ? kRookMagicNumbers[kSquares].as_int()
+            : kBishopMagicNumbers[kSquares].as_int(),
+      static_cast<uint8_t>(
+          64 - CountBits(SlidingMask(kSquares, SlidingDirections(kRook)))),
+#endif
+  }...};
 }
 
+// Magic parameters for rooks/bishops.
+static constexpr std::array<MagicParams, 64> rook_magic_params =
+    BuildMagicParams<true>(std::make_integer_sequence<int, 64>());
+static constexpr std::array<MagicParams, 64> bishop_magic_params =
+    BuildMagicParams<false>(std::make_integer_sequence<int, 64>());
+
 // Returns the rook attacks bitboard for the given rook board square and the
 // given occupied piece bitboard.
 static inline BitBoard GetRookAttacks(const Square rook_square,
@@ -384,7 +384,7 @@ static inline BitBoard GetRookAttacks(const Square rook_square,
 #endif
 
   // Return attacks bitboard.
-  return rook_magic_params[square].attacks_table_[index];
+  return BitBoard(rook_magic_params[square].attacks_table_[index]);
 }
 
 // Returns the bishop attacks bitboard for the given bishop board square and
@@ -404,28 +404,11 @@ static inline BitBoard GetBishopAttacks(const Square bishop_square,
 #endif
 
   // Return attacks bitboard.
-  return bishop_magic_params[square].attacks_table_[index];
+  return BitBoard(bishop_magic_params[square].attacks_table_[index]);
 }
 
 }  // namespace
 
-void InitializeMagicBitboards() {
-#if defined(NO_PEXT)
-  // Set magic numbers for all board squares.
-  for (unsigned square = 0; square < 64; square++) {
-    rook_magic_params[square].magic_number_ =
-        kRookMagicNumbers[square].as_int();
-    bishop_magic_params[square].magic_number_ =
-        kBishopMagicNumbers[square].as_int();
-  }
-#endif
-
-  // Build attacks tables.
-  BuildAttacksTable(rook_magic_params, rook_attacks_table, kRookDirections);
-  BuildAttacksTable(bishop_magic_params, bishop_attacks_table,
-                    kBishopDirections);
-}
-
 MoveList ChessBoard::GeneratePseudolegalMoves() const {
   MoveList result;
   result.reserve(60);
@@ -589,6 +572,8 @@ bool ChessBoard::ApplyMove(Move move) {
     auto do_castling = [this](File king_dst, Square rook_src, File rook_dst) {
       // Remove en passant flags.
       pawns_ &= kPawnMask;
+      TogglePiece(our_king_, kKing, false);
+      TogglePiece(rook_src, kRook, false);
       our_pieces_.reset(our_king_);
       our_pieces_.reset(rook_src);
       rooks_.reset(rook_src);
@@ -597,6 +582,8 @@ bool ChessBoard::ApplyMove(Move move) {
       Square rook_dst_sq(rook_dst, kRank1);
       our_pieces_.set(rook_dst_sq);
       rooks_.set(rook_dst_sq);
+      TogglePiece(our_king_, kKing, false);
+      TogglePiece(rook_dst_sq, kRook, false);
     };
     if (move.is_castling()) {
       // Castling.
@@ -611,6 +598,10 @@ bool ChessBoard::ApplyMove(Move move) {
     }
   }
 
+  const PieceType piece = GetPieceAt(from);
+  TogglePiece(from, piece, false);
+  TogglePiece(to, move.is_promotion() ? move.promotion() : piece, false);
+
   // Move in our pieces.
   our_pieces_.reset(from);
   our_pieces_.set(to);
@@ -618,6 +609,7 @@ bool ChessBoard::ApplyMove(Move move) {
   // Remove captured piece.
   bool reset_50_moves = their_pieces_.get(to);
   if (reset_50_moves) {
+    TogglePiece(to, GetPieceAt(to), true);
     their_pieces_.reset(to);
     rooks_.reset(to);
     bishops_.reset(to);
@@ -635,6 +627,7 @@ bool ChessBoard::ApplyMove(Move move) {
     const Square ep_pawn(to_file, kRank5);
     pawns_.reset(ep_pawn);
     their_pieces_.reset(ep_pawn);
+    TogglePiece(ep_pawn, kPawn, true);
   }
 
   // Remove en passant flags.
@@ -697,6 +690,10 @@ bool ChessBoard::ApplyMove(Move move) {
 }
 
 bool ChessBoard::IsUnderAttack(Square square) const {
+  return IsUnderAttack(square, our_pieces_ | their_pieces_);
+}
+
+bool ChessBoard::IsUnderAttack(Square square, BitBoard occupied) const {
   const Rank rank = square.rank();
   const File file = square.file();
   // Check king.
@@ -706,13 +703,11 @@ bool ChessBoard::IsUnderAttack(Square square) const {
     if (std::abs(krank - rank) <= 1 && std::abs(kfile - file) <= 1) return true;
   }
   // Check rooks (and queens).
-  if (GetRookAttacks(square, our_pieces_ | their_pieces_)
-          .intersects(their_pieces_ & rooks_)) {
+  if (GetRookAttacks(square, occupied).intersects(their_pieces_ & rooks_)) {
     return true;
   }
   // Check bishops.
-  if (GetBishopAttacks(square, our_pieces_ | their_pieces_)
-          .intersects(their_pieces_ & bishops_)) {
+  if (GetBishopAttacks(square, occupied).intersects(their_pieces_ & bishops_)) {
     return true;
   }
   // Check pawns.
@@ -927,22 +922,259 @@ bool ChessBoard::IsLegalMove(Move move,
   }
 }
 
+namespace {
+// Squares strictly between two squares on the same line.
+BitBoard GetSquaresBetween(Square a, Square b) {
+  const BitBoard a_board = BitBoard::FromSquare(a);
+  const BitBoard b_board = BitBoard::FromSquare(b);
+  if (a.rank() == b.rank() || a.file() == b.file()) {
+    return GetRookAttacks(a, b_board) & GetRookAttacks(b, a_board);
+  }
+  return GetBishopAttacks(a, b_board) & GetBishopAttacks(b, a_board);
+}
+
+class MoveListSink {
+ public:
+  explicit MoveListSink(MoveList* moves) : moves_(moves) {}
+  void Add(Move move) { moves_->emplace_back(move); }
+  void AddAll(Square from, BitBoard to) {
+    for (const auto destination : to) {
+      moves_->emplace_back(Move::White(from, destination));
+    }
+  }
+
+ private:
+  MoveList* const moves_;
+};
+
+class MoveCountSink {
+ public:
+  void Add(Move) { ++count_; }
+  void AddAll(Square, BitBoard to) { count_ += to.count(); }
+  int count() const { return count_; }
+
+ private:
+  int count_ = 0;
+};
+}  // namespace
+
+// Unlike GeneratePseudolegalMoves() followed by IsLegalMove(), restricts the
+// destinations by the check and pin masks while generating. Moves which are
+// left unchecked by the masks (en passant and castling) are applied to a copy
+// of the board, as in IsLegalMove().
+template <class Sink>
+void ChessBoard::EmitLegalMoves(Sink* sink) const {
+  const BitBoard occupied = our_pieces_ | their_pieces_;
+
+  // Squares the checking pieces are on, and the lines they give check along.
+  BitBoard checkers = ((kKnightAttacks[our_king_.as_idx()] & knights()) |
+                       (kPawnAttacks[our_king_.as_idx()] & pawns())) &
+                      their_pieces_;
+  BitBoard check_lines = 0;
+  // Pinned pieces, and the lines along which each of them can still move.
+  BitBoard pinned = 0;
+  struct Pin {
+    Square square;
+    BitBoard line;
+  };
+  Pin pins[8];
+  int num_pins = 0;
+  const BitBoard snipers =
+      ((GetRookAttacks(our_king_, their_pieces_) & rooks_) |
+       (GetBishopAttacks(our_king_, their_pieces_) & bishops_)) &
+      their_pieces_;
+  for (const auto sniper : snipers) {
+    const BitBoard between = GetSquaresBetween(our_king_, sniper);
+    const BitBoard blockers = between & occupied;
+    if (blockers.empty()) {
+      checkers.set(sniper);
+      check_lines = check_lines | between;
+    } else if (blockers.count_few() == 1) {
+      pinned = pinned | blockers;
+      pins[num_pins++] = {*blockers.begin(),
+                          between | BitBoard::FromSquare(sniper)};
+    }
+  }
+  const int num_checkers = checkers.count_few();
+  // Destinations which don't leave the king in check, for the pieces which
+  // are not pinned.
+  const BitBoard targets =
+      num_checkers == 0 ? BitBoard(~our_pieces_.as_int())
+                        : checkers | check_lines;
+
+  auto is_legal_after = [this](Move move) {
+    ChessBoard board(*this);
+    board.ApplyMove(move);
+    return !board.IsUnderCheck();
+  };
+
+  for (auto source : our_pieces_) {
+    // King
+    if (source == our_king_) {
+      // Sliders attack through the squares the king leaves.
+      const BitBoard occupied_without_king = occupied - our_king_;
+      for (const auto& delta : kKingMoves) {
+        const Rank dst_rank = source.rank() + delta.first;
+        if (!dst_rank.IsValid()) continue;
+        const File dst_file = source.file() + delta.second;
+        if (!dst_file.IsValid()) continue;
+        const Square destination(dst_file, dst_rank);
+        if (our_pieces_.get(destination)) continue;
+        if (IsUnderAttack(destination, occupied_without_king)) continue;
+        sink->Add(Move::White(source, destination));
+      }
+      if (num_checkers > 0) continue;
+      // Castlings.
+      auto walk_free = [this](File from, File to, File rook, File king) {
+        for (File i = from; i <= to; ++i) {
+          if (i == rook || i == king) continue;
+          if (our_pieces_.get({i, kRank1}) || their_pieces_.get({i, kRank1})) {
+            return false;
+          }
+        }
+        return true;
+      };
+      // @To is not included in check unless it is the same with @from.
+      auto range_attacked = [this](File from, File to) {
+        if (from == to) return IsUnderAttack(Square(from, kRank1));
+        const int increment = from < to ? 1 : -1;
+        while (from != to) {
+          if (IsUnderAttack(Square(from, kRank1))) return true;
+          from += increment;
+        }
+        return false;
+      };
+      const File king = source.file();
+      if (castlings_.we_can_000()) {
+        const File qrook = castlings_.our_queenside_rook;
+        const Move move = Move::WhiteCastling(king, qrook);
+        if (walk_free(std::min(kFileC, qrook), std::max(kFileD, king), qrook,
+                      king) &&
+            !range_attacked(king, kFileC) && is_legal_after(move)) {
+          sink->Add(move);
+        }
+      }
+      if (castlings_.we_can_00()) {
+        const File krook = castlings_.our_kingside_rook;
+        const Move move = Move::WhiteCastling(king, krook);
+        if (walk_free(std::min(kFileF, king), std::max(kFileG, krook), krook,
+                      king) &&
+            !range_attacked(king, kFileG) && is_legal_after(move)) {
+          sink->Add(move);
+        }
+      }
+      continue;
+    }
+    // Only the king can move out of a double check.
+    if (num_checkers > 1) continue;
+    BitBoard allowed = targets;
+    if (pinned.get(source)) {
+      for (int i = 0; i < num_pins; ++i) {
+        if (pins[i].square == source) allowed &= pins[i].line;
+      }
+    }
+    bool processed_piece = false;
+    // Rook (and queen)
+    if (rooks_.get(source)) {
+      processed_piece = true;
+      sink->AddAll(source, GetRookAttacks(source, occupied) & allowed);
+    }
+    // Bishop (and queen)
+    if (bishops_.get(source)) {
+      processed_piece = true;
+      sink->AddAll(source, GetBishopAttacks(source, occupied) & allowed);
+    }
+    if (processed_piece) continue;
+    // Pawns.
+    if (pawns().get(source)) {
+      // Moves forward.
+      {
+        const Rank dst_rank = source.rank() + 1;
+        const File dst_file = source.file();
+        const Square destination(dst_file, dst_rank);
+
+        if (!occupied.get(destination)) {
+          if (dst_rank != kRank8) {
+            if (allowed.get(destination)) {
+              sink->Add(Move::White(source, destination));
+            }
+            if (dst_rank == kRank3) {
+              // Maybe it'll be possible to move two squares.
+              const Square jump_dst(dst_file, kRank4);
+              if (!occupied.get(jump_dst) && allowed.get(jump_dst)) {
+                sink->Add(Move::White(source, jump_dst));
+              }
+            }
+          } else if (allowed.get(destination)) {
+            // Promotions
+            for (auto promotion : kPromotions) {
+              sink->Add(Move::WhitePromotion(source, destination, promotion));
+            }
+          }
+        }
+      }
+      // Captures.
+      {
+        for (auto direction : {-1, 1}) {
+          const auto dst_rank = source.rank() + 1;
+          const auto dst_file = source.file() + direction;
+          if (!dst_file.IsValid()) continue;
+          const Square destination(dst_file, dst_rank);
+          if (their_pieces_.get(destination)) {
+            if (!allowed.get(destination)) continue;
+            if (dst_rank == kRank8) {
+              // Promotion.
+              for (auto promotion : kPromotions) {
+                sink->Add(Move::WhitePromotion(source, destination, promotion));
+              }
+            } else {
+              // Ordinary capture.
+              sink->Add(Move::White(source, destination));
+            }
+          } else if (dst_rank == kRank6 &&
+                     pawns_.get(Square(dst_file, kRank8))) {
+            // En passant. Complex but rare, so just apply.
+            const Move move = Move::WhiteEnPassant(source, destination);
+            if (is_legal_after(move)) sink->Add(move);
+          }
+        }
+      }
+      continue;
+    }
+    // Knight.
+    sink->AddAll(source, kKnightAttacks[source.as_idx()] & allowed);
+  }
+}
+
 MoveList ChessBoard::GenerateLegalMoves() const {
-  const KingAttackInfo king_attack_info = GenerateKingAttackInfo();
-  MoveList result = GeneratePseudolegalMoves();
-  result.erase(
-      std::remove_if(result.begin(), result.end(),
-                     [&](Move m) { return !IsLegalMove(m, king_attack_info); }),
-      result.end());
+  MoveList result;
+  result.reserve(60);
+  MoveListSink sink(&result);
+  EmitLegalMoves(&sink);
   return result;
 }
 
+int ChessBoard::CountLegalMoves() const {
+  MoveCountSink sink;
+  EmitLegalMoves(&sink);
+  return sink.count();
+}
+
 void ChessBoard::PutPiece(Square square, PieceType piece, bool is_theirs) {
   (is_theirs ? their_pieces_ : our_pieces_).set(square);
   if (piece == kKing) (is_theirs ? their_king_ : our_king_) = square;
   if (piece == kPawn) pawns_.set(square);
   if (piece == kRook || piece == kQueen) rooks_.set(square);
   if (piece == kBishop || piece == kQueen) bishops_.set(square);
+  TogglePiece(square, piece, is_theirs);
+}
+
+PieceType ChessBoard::GetPieceAt(Square square) const {
+  if (square == our_king_ || square == their_king_) return kKing;
+  if (rooks_.get(square)) return bishops_.get(square) ? kQueen : kRook;
+  if (bishops_.get(square)) return kBishop;
+  if (pawns().get(square)) return kPawn;
+  return kKnight;
 }
 
 void ChessBoard::SetFromFen(std::string_view fen, int* rule50_ply, int* moves) {
@@ -32,13 +32,10 @@
 
 #include "chess/bitboard.h"
 #include "chess/types.h"
-#include "utils/hashcat.h"
+#include "chess/zobrist.h"
 
 namespace lczero {
 
-// Initializes internal magic bitboard structures.
-void InitializeMagicBitboards();
-
 // Represents king attack info used during legal move detection.
 class KingAttackInfo {
  public:
@@ -98,8 +95,10 @@ class ChessBoard {
 
   // Checks whether at least one of the sides has mating material.
   bool HasMatingMaterial() const;
-  // Generates legal moves.
+  // Generates legal moves, in the same order as GeneratePseudolegalMoves().
   MoveList GenerateLegalMoves() const;
+  // Returns the number of legal moves, without generating them.
+  int CountLegalMoves() const;
   // Check whether pseudolegal move is legal.
   bool IsLegalMove(Move move, const KingAttackInfo& king_attack_info) const;
 
@@ -111,13 +110,14 @@ class ChessBoard {
   // soon.
   Move ParseMove(std::string_view move_str) const;
 
+  // Zobrist hash of the board. The piece part is updated incrementally.
   uint64_t Hash() const {
-    return HashCat({our_pieces_.as_int(), their_pieces_.as_int(),
-                    rooks_.as_int(), bishops_.as_int(), pawns_.as_int(),
-                    (static_cast<uint32_t>(our_king_.as_idx()) << 24) |
-                        (static_cast<uint32_t>(their_king_.as_idx()) << 16) |
-                        (static_cast<uint32_t>(castlings_.as_int()) << 8) |
-                        static_cast<uint32_t>(flipped_)});
+    uint64_t hash = zobrist_ ^ kZobristKeys.castlings[castlings_.as_int()];
+    if (flipped_) hash ^= kZobristKeys.black_to_move;
+    if (!en_passant().empty()) {
+      hash ^= kZobristKeys.en_passant[(*en_passant().begin()).file().idx];
+    }
+    return hash;
   }
 
   class Castlings {
@@ -231,6 +231,21 @@ class ChessBoard {
  private:
   // Sets the piece on the square.
   void PutPiece(Square square, PieceType piece, bool is_theirs);
+  // Checks if the square is under attack from "theirs", with @occupied pieces
+  // blocking the sliders.
+  bool IsUnderAttack(Square square, BitBoard occupied) const;
+  // Passes the legal moves to @sink, which has Add(Move) and
+  // AddAll(Square from, BitBoard to) methods.
+  template <class Sink>
+  void EmitLegalMoves(Sink* sink) const;
+  // Returns the type of the piece on the square, which must be occupied.
+  PieceType GetPieceAt(Square square) const;
+  // Adds the piece to the Zobrist key, or removes it if it's there.
+  void TogglePiece(Square square, PieceType piece, bool is_theirs) {
+    if (flipped_) square.Flip();
+    zobrist_ ^= kZobristKeys.pieces[is_theirs != flipped_][piece.idx]
+                                   [square.as_idx()];
+  }
 
   // All white pieces.
   BitBoard our_pieces_;
@@ -250,6 +265,9 @@ class ChessBoard {
   Square their_king_;
   Castlings castlings_;
   bool flipped_ = false;  // aka "Black to move".
+  // Zobrist key of the pieces, from the white's point of view, so that it
+  // doesn't change on Mirror().
+  uint64_t zobrist_ = 0;
 };
 
 // Converts the board to FEN string.
@@ -75,6 +75,7 @@ int Perft(const ChessBoard& board, int max_depth, bool dump = false,
   auto moves = board.GeneratePseudolegalMoves();
 
   auto legal_moves = board.GenerateLegalMoves();
+  EXPECT_EQ(board.CountLegalMoves(), static_cast<int>(legal_moves.size()));
   auto iter = legal_moves.begin();
 
   for (const auto& move : moves) {
@@ -2236,10 +2237,32 @@ TEST(ChessBoard, InvalidEnPassantFromKnightPromotion) {
   EXPECT_TRUE(board.en_passant().empty());
 }
 
+// The incrementally updated hash must match the one of the same board set up
+// from scratch.
+TEST(ChessBoard, IncrementalHash) {
+  const std::vector<std::pair<std::string, std::vector<std::string>>> games = {
+      // Castlings both ways, en passant.
+      {ChessBoard::kStartposFen,
+       {"e2e4", "d7d5", "e4e5", "f7f5", "e5f6", "b8c6", "g1f3", "c8e6", "f1c4",
+        "d8d7", "e1g1", "e8c8"}},
+      // Captures of the castling rooks, promotions with capture.
+      {"r2nkn1r/1P4P1/8/8/8/8/1p4p1/R2NKN1R w KQkq - 0 1",
+       {"b7a8q", "g2h1n", "g7h8r", "b2a1b"}},
+  };
+  for (const auto& [fen, moves] : games) {
+    ChessBoard board(fen);
+    for (const auto& move_str : moves) {
+      board.ApplyMove(board.ParseMove(move_str));
+      board.Mirror();
+      const ChessBoard from_fen(BoardToFen(board) + " 0 1");
+      EXPECT_EQ(board.Hash(), from_fen.Hash()) << move_str;
+    }
+  }
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
@@ -133,6 +133,10 @@ struct TournamentInfo {
   int results[3][2] = {{0, 0}, {0, 0}, {0, 0}};
   int move_count_ = 0;
   uint64_t nodes_total_ = 0;
+  // NN cache hits and lookups of player1 and player2. Players sharing the
+  // backend have the same counts.
+  uint64_t nn_cache_hits[2] = {0, 0};
+  uint64_t nn_cache_lookups[2] = {0, 0};
 
   using Callback = std::function<void(const TournamentInfo&)>;
 };
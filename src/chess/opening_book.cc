@@ -0,0 +1,480 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/opening_book.h"
+
+#include <zlib.h>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "utils/exception.h"
+#include "utils/files.h"
+
+namespace lczero {
+namespace {
+
+constexpr char kMagic[8] = {'L', 'C', '0', 'B', 'O', 'O', 'K', '1'};
+constexpr size_t kHeaderSize = sizeof(kMagic) + sizeof(uint64_t);
+// Pieces of text smaller than this are not worth a thread.
+constexpr size_t kMinPieceSize = 1 << 20;
+
+template <typename T>
+T Read(const uint8_t* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void Append(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Splits @text into up to @threads pieces at the positions returned by
+// @next_start(pos), which finds the first piece start at or after pos, and
+// parses them in parallel with @parse(piece).
+template <typename NextStart, typename Parse>
+std::vector<Opening> ParseInParallel(std::string_view text, int threads,
+                                     NextStart next_start, Parse parse) {
+  if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t pieces =
+      std::min<size_t>(threads, text.size() / kMinPieceSize + 1);
+  std::vector<size_t> starts = {0};
+  for (size_t i = 1; i < pieces; ++i) {
+    const size_t start =
+        std::min(text.size(), next_start(text.size() * i / pieces));
+    if (start > starts.back()) starts.push_back(start);
+  }
+  starts.push_back(text.size());
+
+  std::vector<std::vector<Opening>> results(starts.size() - 1);
+  std::vector<std::exception_ptr> errors(results.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < results.size(); ++i) {
+    workers.emplace_back([&, i]() {
+      try {
+        results[i] = parse(text.substr(starts[i], starts[i + 1] - starts[i]));
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  for (const auto& error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+
+  std::vector<Opening> openings = std::move(results[0]);
+  for (size_t i = 1; i < results.size(); ++i) {
+    openings.insert(openings.end(), std::make_move_iterator(results[i].begin()),
+                    std::make_move_iterator(results[i].end()));
+  }
+  return openings;
+}
+
+bool EndsWith(std::string_view str, std::string_view suffix) {
+  return str.size() >= suffix.size() &&
+         str.substr(str.size() - suffix.size()) == suffix;
+}
+
+bool IsEpdFile(std::string_view filename) {
+  return EndsWith(filename, ".epd") || EndsWith(filename, ".epd.gz") ||
+         EndsWith(filename, ".epd.zst");
+}
+
+// Parses one EPD line, reusing @board. Returns false for empty lines.
+bool ParseEpdLine(const std::string& line, ChessBoard* board,
+                  Opening* opening) {
+  std::istringstream fields(line);
+  std::string field;
+  std::string fen;
+  for (int i = 0; i < 4 && fields >> field; ++i) {
+    fen += field + ' ';
+  }
+  if (fen.empty()) return false;
+  fen += "0 1";
+  // Throws on malformed positions.
+  board->SetFromFen(fen);
+  *opening = {fen, {}};
+  return true;
+}
+
+}  // namespace
+
+OpeningBook::OpeningBook(const std::string& filename)
+    : file_(std::make_unique<MappedFile>(filename)) {
+  Attach(file_->data(), filename);
+}
+
+OpeningBook::OpeningBook(const std::vector<Opening>& openings) {
+  std::string records;
+  buffer_.append(kMagic, sizeof(kMagic));
+  Append<uint64_t>(&buffer_, openings.size());
+  for (const auto& opening : openings) {
+    Append<uint64_t>(&buffer_, records.size());
+    const std::string_view fen = opening.start_fen == ChessBoard::kStartposFen
+                                     ? std::string_view()
+                                     : opening.start_fen;
+    if (fen.size() > 255) throw Exception("Opening FEN is too long.");
+    if (opening.moves.size() > 65535) {
+      throw Exception("Opening has too many moves.");
+    }
+    Append<uint8_t>(&records, fen.size());
+    records.append(fen);
+    Append<uint16_t>(&records, opening.moves.size());
+    for (const Move move : opening.moves) {
+      Append<uint16_t>(&records, move.raw_data());
+    }
+  }
+  Append<uint64_t>(&buffer_, records.size());
+  buffer_ += records;
+  Attach({reinterpret_cast<const uint8_t*>(buffer_.data()), buffer_.size()},
+         "in-memory book");
+}
+
+void OpeningBook::Attach(std::span<const uint8_t> data,
+                         const std::string& name) {
+  if (data.size() < kHeaderSize ||
+      std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    throw Exception(name + " is not an opening book.");
+  }
+  const uint64_t size = Read<uint64_t>(data.data() + sizeof(kMagic));
+  const size_t offsets_size = (size + 1) * sizeof(uint64_t);
+  if ((data.size() - kHeaderSize) / sizeof(uint64_t) <= size) {
+    throw Exception(name + " is truncated.");
+  }
+  data_ = data;
+  offsets_ = data.data() + kHeaderSize;
+  records_ = data.subspan(kHeaderSize + offsets_size);
+  size_ = size;
+  if (Read<uint64_t>(offsets_ + size_ * sizeof(uint64_t)) != records_.size()) {
+    throw Exception(name + " is truncated.");
+  }
+}
+
+bool OpeningBook::IsBookFile(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  return file.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+Opening OpeningBook::Get(size_t idx) const {
+  if (idx >= size_) throw Exception("Opening index out of range.");
+  const uint64_t begin = Read<uint64_t>(offsets_ + idx * sizeof(uint64_t));
+  const uint64_t end = Read<uint64_t>(offsets_ + (idx + 1) * sizeof(uint64_t));
+  if (begin >= end || end > records_.size()) {
+    throw Exception("Corrupt opening book record.");
+  }
+  const uint8_t* record = records_.data() + begin;
+  const size_t fen_size = record[0];
+  if (1 + fen_size + sizeof(uint16_t) > end - begin) {
+    throw Exception("Corrupt opening book record.");
+  }
+  Opening opening;
+  if (fen_size > 0) {
+    opening.start_fen.assign(reinterpret_cast<const char*>(record + 1),
+                             fen_size);
+  }
+  record += 1 + fen_size;
+  const size_t num_moves = Read<uint16_t>(record);
+  record += sizeof(uint16_t);
+  if (1 + fen_size + (num_moves + 1) * sizeof(uint16_t) != end - begin) {
+    throw Exception("Corrupt opening book record.");
+  }
+  opening.moves.reserve(num_moves);
+  for (size_t i = 0; i < num_moves; ++i) {
+    opening.moves.push_back(
+        Move::FromRawData(Read<uint16_t>(record + i * sizeof(uint16_t))));
+  }
+  return opening;
+}
+
+void OpeningBook::Save(const std::string& filename) const {
+  WriteStringToFile(filename, std::string_view(
+                                  reinterpret_cast<const char*>(data_.data()),
+                                  data_.size()));
+}
+
+GameState OpeningToGameState(const Opening& opening) {
+  GameState state{Position::FromFen(opening.start_fen), {}};
+  Position position = state.startpos;
+  for (Move move : opening.moves) {
+    if (position.IsBlackToMove()) move.Flip();
+    state.moves.push_back(move);
+    position = Position(position, move);
+  }
+  return state;
+}
+
+std::vector<Opening> ParsePgnOpenings(std::string_view text, int threads) {
+  // A game starts with a tag line after an empty line.
+  auto next_game = [text](size_t pos) {
+    while ((pos = text.find("\n[", pos)) != std::string_view::npos) {
+      if (pos > 0 && (text[pos - 1] == '\n' ||
+                      (text[pos - 1] == '\r' && pos > 1 &&
+                       text[pos - 2] == '\n'))) {
+        return pos + 1;
+      }
+      ++pos;
+    }
+    return text.size();
+  };
+  return ParseInParallel(text, threads, next_game, [](std::string_view piece) {
+    PgnReader reader;
+    reader.AddPgnText(piece);
+    return reader.ReleaseGames();
+  });
+}
+
+std::vector<Opening> ParseEpdOpenings(std::string_view text, int threads) {
+  auto next_line = [text](size_t pos) {
+    pos = text.find('\n', pos);
+    return pos == std::string_view::npos ? text.size() : pos + 1;
+  };
+  return ParseInParallel(text, threads, next_line, [](std::string_view piece) {
+    std::vector<Opening> openings;
+    std::istringstream lines{std::string(piece)};
+    std::string line;
+    ChessBoard board;
+    Opening opening;
+    while (std::getline(lines, line)) {
+      if (ParseEpdLine(line, &board, &opening)) {
+        openings.push_back(std::move(opening));
+      }
+    }
+    return openings;
+  });
+}
+
+std::vector<Opening> ReadOpeningFile(const std::string& filename,
+                                     int threads) {
+  if (threads == 1 || EndsWith(filename, ".zst")) {
+    std::vector<Opening> openings;
+    OpeningStream stream(filename);
+    Opening opening;
+    while (stream.Next(&opening)) openings.push_back(std::move(opening));
+    return openings;
+  }
+  const std::string text = ReadFileToString(filename);
+  if (IsEpdFile(filename)) return ParseEpdOpenings(text, threads);
+  return ParsePgnOpenings(text, threads);
+}
+
+// Decompressed bytes of the file.
+class OpeningStream::Source {
+ public:
+  virtual ~Source() = default;
+  // Returns the number of bytes read, 0 at the end of the file.
+  virtual size_t Read(char* data, size_t size) = 0;
+};
+
+namespace {
+
+// Plain and gzipped files.
+class GzSource : public OpeningStream::Source {
+ public:
+  explicit GzSource(const std::string& filename)
+      : file_(gzopen(filename.c_str(), "rb")) {
+    if (!file_) {
+      throw Exception(errno == ENOENT ? "Opening book file not found."
+                                      : "Error opening opening book file.");
+    }
+    gzbuffer(file_, 1 << 16);
+  }
+  ~GzSource() override { gzclose(file_); }
+
+  size_t Read(char* data, size_t size) override {
+    const int read = gzread(file_, data, size);
+    if (read < 0) throw Exception("Error reading opening book file.");
+    return read;
+  }
+
+ private:
+  const gzFile file_;
+};
+
+#ifdef USE_ZSTD
+class ZstdSource : public OpeningStream::Source {
+ public:
+  explicit ZstdSource(const std::string& filename)
+      : file_(std::fopen(filename.c_str(), "rb")),
+        stream_(ZSTD_createDStream()),
+        input_buffer_(ZSTD_DStreamInSize()) {
+    if (!file_) {
+      ZSTD_freeDStream(stream_);
+      throw Exception(errno == ENOENT ? "Opening book file not found."
+                                      : "Error opening opening book file.");
+    }
+    ZSTD_initDStream(stream_);
+  }
+  ~ZstdSource() override {
+    ZSTD_freeDStream(stream_);
+    std::fclose(file_);
+  }
+
+  size_t Read(char* data, size_t size) override {
+    ZSTD_outBuffer output{data, size, 0};
+    while (output.pos == 0) {
+      if (input_.pos == input_.size) {
+        const size_t read = std::fread(input_buffer_.data(), 1,
+                                       input_buffer_.size(), file_);
+        if (read == 0) {
+          if (std::ferror(file_)) {
+            throw Exception("Error reading opening book file.");
+          }
+          return 0;
+        }
+        input_ = {input_buffer_.data(), read, 0};
+      }
+      const size_t ret = ZSTD_decompressStream(stream_, &output, &input_);
+      if (ZSTD_isError(ret)) {
+        throw Exception(std::string("Corrupt zstd opening book file: ") +
+                        ZSTD_getErrorName(ret));
+      }
+    }
+    return output.pos;
+  }
+
+ private:
+  std::FILE* const file_;
+  ZSTD_DStream* const stream_;
+  std::vector<char> input_buffer_;
+  ZSTD_inBuffer input_{nullptr, 0, 0};
+};
+#endif
+
+// Bytes read from the file at once.
+constexpr size_t kStreamReadSize = 1 << 16;
+
+bool HasText(std::string_view text) {
+  return text.find_first_not_of(" \t\r\n") != std::string_view::npos;
+}
+
+}  // namespace
+
+OpeningStream::OpeningStream(const std::string& filename, int shard,
+                             int num_shards)
+    : epd_(IsEpdFile(filename)), shard_(shard), num_shards_(num_shards) {
+  if (num_shards_ < 1 || shard_ < 0 || shard_ >= num_shards_) {
+    throw Exception("Invalid opening file shard.");
+  }
+  if (EndsWith(filename, ".zst")) {
+#ifdef USE_ZSTD
+    source_ = std::make_unique<ZstdSource>(filename);
+#else
+    throw Exception("Reading " + filename + " needs a build with zstd.");
+#endif
+  } else {
+    source_ = std::make_unique<GzSource>(filename);
+  }
+}
+
+OpeningStream::~OpeningStream() = default;
+
+bool OpeningStream::GetLine(std::string* line) {
+  line->clear();
+  while (true) {
+    const size_t eol = buffer_.find('\n', buffer_pos_);
+    if (eol != std::string::npos) {
+      line->append(buffer_, buffer_pos_, eol - buffer_pos_);
+      buffer_pos_ = eol + 1;
+      return true;
+    }
+    line->append(buffer_, buffer_pos_);
+    buffer_.resize(kStreamReadSize);
+    buffer_.resize(eof_ ? 0 : source_->Read(buffer_.data(), buffer_.size()));
+    buffer_pos_ = 0;
+    if (buffer_.empty()) {
+      eof_ = true;
+      // The last line may have no line break.
+      return !line->empty();
+    }
+  }
+}
+
+bool OpeningStream::ReadPiece() {
+  std::string line;
+  const bool in_shard =
+      static_cast<int>(piece_index_ % num_shards_) == shard_;
+  if (epd_) {
+    if (!GetLine(&line)) return false;
+    ++piece_index_;
+    ChessBoard board;
+    Opening opening;
+    if (in_shard && ParseEpdLine(line, &board, &opening)) {
+      pending_.push_back(std::move(opening));
+    }
+    return true;
+  }
+  // Same split as in ParsePgnOpenings(): a game starts with a tag line after
+  // an empty line.
+  std::string game = std::move(next_game_);
+  next_game_.clear();
+  bool has_text = HasText(game);
+  while (GetLine(&line)) {
+    if (after_empty_line_ && !line.empty() && line[0] == '[' && has_text) {
+      next_game_ = line + '\n';
+      after_empty_line_ = false;
+      break;
+    }
+    after_empty_line_ = line.empty() || line == "\r";
+    has_text = has_text || HasText(line);
+    // Skipped games only have to be split, not kept.
+    if (in_shard) game += line + '\n';
+  }
+  if (!has_text) return false;
+  ++piece_index_;
+  if (in_shard) {
+    PgnReader reader;
+    reader.AddPgnText(game);
+    for (Opening& opening : reader.ReleaseGames()) {
+      pending_.push_back(std::move(opening));
+    }
+  }
+  return true;
+}
+
+bool OpeningStream::Next(Opening* opening) {
+  while (pending_.empty()) {
+    if (!ReadPiece()) return false;
+  }
+  *opening = std::move(pending_.front());
+  pending_.pop_front();
+  return true;
+}
+
+}  // namespace lczero
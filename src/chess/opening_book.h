@@ -0,0 +1,138 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chess/gamestate.h"
+#include "chess/pgn.h"
+#include "utils/filesystem.h"
+
+namespace lczero {
+
+// Openings in a compact binary form, which can be memory mapped and sampled
+// from without parsing the text book or materializing all the openings.
+// The file layout (little endian) is:
+//   "LC0BOOK1", uint64 number of openings N,
+//   uint64 offsets[N + 1] of the opening records from the first record,
+//   records: uint8 length of the start FEN (0 for the starting position), the
+//   FEN, uint16 number of moves, uint16 moves (see Move::raw_data()).
+class OpeningBook {
+ public:
+  // Memory maps the book file. Throws if it's not a valid book.
+  explicit OpeningBook(const std::string& filename);
+  // Builds the book in memory.
+  explicit OpeningBook(const std::vector<Opening>& openings);
+  // Points into its own buffer, so can't be copied or moved.
+  OpeningBook(const OpeningBook&) = delete;
+  OpeningBook& operator=(const OpeningBook&) = delete;
+
+  // Returns whether the file starts with the book signature.
+  static bool IsBookFile(const std::string& filename);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  // Decodes the opening number @idx.
+  Opening Get(size_t idx) const;
+  // Writes the book to a file.
+  void Save(const std::string& filename) const;
+
+ private:
+  void Attach(std::span<const uint8_t> data, const std::string& name);
+
+  std::unique_ptr<MappedFile> file_;
+  std::string buffer_;
+  std::span<const uint8_t> data_;
+  const uint8_t* offsets_ = nullptr;
+  std::span<const uint8_t> records_;
+  size_t size_ = 0;
+};
+
+// Returns the position after the opening moves, with the moves converted from
+// white's perspective to the perspective of the side to move.
+GameState OpeningToGameState(const Opening& opening);
+
+// Parses PGN text into openings using @threads threads. The text is split at
+// game boundaries, the openings are returned in the order of the text.
+std::vector<Opening> ParsePgnOpenings(std::string_view text, int threads);
+
+// Parses EPD text, one position per line, into openings without moves. The
+// opcodes after the four FEN fields are ignored.
+std::vector<Opening> ParseEpdOpenings(std::string_view text, int threads);
+
+// Reads a (possibly gzipped) PGN or, if the name ends with .epd or .epd.gz,
+// EPD opening file. Files compressed with zstd (.zst) are supported in the
+// builds with zstd. With one thread, the file is streamed (see OpeningStream)
+// instead of being read into memory first.
+std::vector<Opening> ReadOpeningFile(const std::string& filename, int threads);
+
+// Reads the openings of a file in the formats of ReadOpeningFile() one at a
+// time, decompressing it on the fly, so that the memory used doesn't depend on
+// the size of the file. Of the games (or EPD lines), only the ones with
+// index % num_shards == shard are parsed and returned, so that streams of the
+// same file on several threads split the work. Each of them still reads and
+// decompresses the whole file.
+class OpeningStream {
+ public:
+  explicit OpeningStream(const std::string& filename, int shard = 0,
+                         int num_shards = 1);
+  ~OpeningStream();
+
+  // Reads the next opening. Returns false at the end of the file. Throws on
+  // read errors and malformed games.
+  bool Next(Opening* opening);
+
+  // Decompressed contents of the file.
+  class Source;
+
+ private:
+  bool GetLine(std::string* line);
+  // Reads the next game or EPD line, and parses it if it's in the shard.
+  // Returns false at the end of the file.
+  bool ReadPiece();
+
+  std::unique_ptr<Source> source_;
+  const bool epd_;
+  const int shard_;
+  const int num_shards_;
+  std::string buffer_;
+  size_t buffer_pos_ = 0;
+  bool eof_ = false;
+  // The first line of the next game, read with the previous one.
+  std::string next_game_;
+  bool after_empty_line_ = true;
+  size_t piece_index_ = 0;
+  std::deque<Opening> pending_;
+};
+
+}  // namespace lczero
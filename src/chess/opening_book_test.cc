@@ -0,0 +1,147 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/opening_book.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "utils/exception.h"
+#include "utils/files.h"
+
+namespace lczero {
+namespace {
+
+constexpr const char* kFen =
+    "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3";
+
+std::string MakePgn(int repeats) {
+  std::string pgn;
+  for (int i = 0; i < repeats; ++i) {
+    pgn += "[Event \"a\"]\n\n1. e4 e5 2. Nf3 {comment} Nc6 *\n\n";
+    pgn += "[Event \"b\"]\n[FEN \"" + std::string(kFen) + "\"]\n\n";
+    pgn += "3. Bb5 a6 4. Ba4 Nf6 5. O-O 1-0\n\n";
+  }
+  return pgn;
+}
+
+void ExpectSameOpenings(const std::vector<Opening>& a,
+                        const std::vector<Opening>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].start_fen, b[i].start_fen) << i;
+    EXPECT_EQ(a[i].moves, b[i].moves) << i;
+  }
+}
+
+}  // namespace
+
+TEST(OpeningBook, ParallelParseKeepsOrder) {
+  // Large enough to be split between the threads.
+  const std::string pgn = MakePgn(20000);
+  const auto serial = ParsePgnOpenings(pgn, 1);
+  ASSERT_EQ(serial.size(), 40000u);
+  EXPECT_EQ(serial[0].start_fen, ChessBoard::kStartposFen);
+  EXPECT_EQ(serial[0].moves.size(), 4u);
+  EXPECT_EQ(serial[1].start_fen, kFen);
+  EXPECT_EQ(serial[1].moves.size(), 5u);
+  ExpectSameOpenings(serial, ParsePgnOpenings(pgn, 4));
+}
+
+TEST(OpeningBook, SaveAndLoad) {
+  const auto openings = ParsePgnOpenings(MakePgn(3), 1);
+  const std::string filename = testing::TempDir() + "opening_book_test";
+  OpeningBook(openings).Save(filename);
+  ASSERT_TRUE(OpeningBook::IsBookFile(filename));
+  OpeningBook book(filename);
+  ASSERT_EQ(book.size(), openings.size());
+  std::vector<Opening> loaded;
+  for (size_t i = 0; i < book.size(); ++i) loaded.push_back(book.Get(i));
+  ExpectSameOpenings(openings, loaded);
+  EXPECT_THROW(book.Get(book.size()), Exception);
+  std::remove(filename.c_str());
+}
+
+TEST(OpeningBook, ParseEpd) {
+  const auto openings = ParseEpdOpenings(
+      "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 id \"a\";\r\n"
+      "\n"
+      "8/8/8/4k3/8/8/4P3/4K3 w - - bm e4;\n",
+      2);
+  ASSERT_EQ(openings.size(), 2u);
+  EXPECT_EQ(openings[0].start_fen,
+            "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+  EXPECT_EQ(openings[1].start_fen, "8/8/8/4k3/8/8/4P3/4K3 w - - 0 1");
+  EXPECT_TRUE(openings[1].moves.empty());
+  EXPECT_THROW(ParseEpdOpenings("not a position\n", 1), Exception);
+}
+
+TEST(OpeningBook, StreamMatchesParse) {
+  const std::string pgn = MakePgn(5);
+  const std::string filename =
+      testing::TempDir() + "opening_stream_test.pgn.gz";
+  WriteStringToGzFile(filename, pgn);
+  const auto openings = ParsePgnOpenings(pgn, 1);
+  ExpectSameOpenings(openings, ReadOpeningFile(filename, 1));
+
+  // The shards split the games between them.
+  std::vector<Opening> sharded(openings.size());
+  for (int shard = 0; shard < 3; ++shard) {
+    OpeningStream stream(filename, shard, 3);
+    Opening opening;
+    for (size_t i = shard; stream.Next(&opening); i += 3) {
+      ASSERT_LT(i, sharded.size());
+      sharded[i] = opening;
+    }
+  }
+  ExpectSameOpenings(openings, sharded);
+  std::remove(filename.c_str());
+}
+
+TEST(OpeningBook, StreamEpd) {
+  const std::string filename = testing::TempDir() + "opening_stream_test.epd";
+  WriteStringToFile(filename,
+                    "8/8/8/4k3/8/8/4P3/4K3 w - - bm e4;\n\n"
+                    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3");
+  OpeningStream stream(filename);
+  Opening opening;
+  ASSERT_TRUE(stream.Next(&opening));
+  EXPECT_EQ(opening.start_fen, "8/8/8/4k3/8/8/4P3/4K3 w - - 0 1");
+  ASSERT_TRUE(stream.Next(&opening));
+  EXPECT_EQ(opening.start_fen,
+            "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+  EXPECT_FALSE(stream.Next(&opening));
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -34,6 +34,7 @@
 #include <cerrno>
 #include <fstream>
 #include <optional>
+#include <string_view>
 
 #include "chess/bitboard.h"
 #include "chess/board.h"
@@ -73,98 +74,115 @@ class PgnReader {
     }
 
     std::string line;
-    bool in_comment = false;
-    bool started = false;
-    while (GzGetLine(file, line)) {
-      // Check if we have a UTF-8 BOM. If so, just ignore it.
-      // Only supposed to exist in the first line, but should not matter.
-      if (line.substr(0, 3) == "\xEF\xBB\xBF") line = line.substr(3);
-      if (!line.empty() && line.back() == '\r') line.pop_back();
-      // TODO: support line breaks in tags to ensure they are properly ignored.
-      if (line.empty() || line[0] == '[') {
-        if (started) {
-          Flush();
-          started = false;
-        }
-        auto uc_line = line;
-        std::transform(
-            uc_line.begin(), uc_line.end(), uc_line.begin(),
-            [](unsigned char c) { return std::toupper(c); }  // correct
-        );
-        if (uc_line.find("[FEN \"", 0) == 0) {
-          auto start_trimmed = line.substr(6);
-          cur_startpos_ = start_trimmed.substr(0, start_trimmed.find('"'));
-          cur_board_.SetFromFen(cur_startpos_);
-        }
-        continue;
-      }
-      // Must have at least one non-tag non-empty line in order to be considered
-      // a game.
-      started = true;
-      // Handle braced comments.
-      int cur_offset = 0;
-      while ((in_comment && line.find('}', cur_offset) != std::string::npos) ||
-             (!in_comment && line.find('{', cur_offset) != std::string::npos)) {
-        if (in_comment && line.find('}', cur_offset) != std::string::npos) {
-          line = line.substr(0, cur_offset) +
-                 line.substr(line.find('}', cur_offset) + 1);
-          in_comment = false;
-        } else {
-          cur_offset = line.find('{', cur_offset);
-          in_comment = true;
-        }
+    while (GzGetLine(file, line)) AddLine(line);
+    FinishGame();
+    gzclose(file);
+  }
+
+  // Same as AddPgnFile(), for PGN text already in memory.
+  void AddPgnText(std::string_view text) {
+    std::string line;
+    while (!text.empty()) {
+      const size_t eol = std::min(text.find('\n'), text.size());
+      line.assign(text.substr(0, eol));
+      text.remove_prefix(std::min(eol + 1, text.size()));
+      AddLine(line);
+    }
+    FinishGame();
+  }
+
+  std::vector<Opening> GetGames() const { return games_; }
+  std::vector<Opening>&& ReleaseGames() { return std::move(games_); }
+
+ private:
+  void AddLine(std::string& line) {
+    // Check if we have a UTF-8 BOM. If so, just ignore it.
+    // Only supposed to exist in the first line, but should not matter.
+    if (line.substr(0, 3) == "\xEF\xBB\xBF") line = line.substr(3);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    // TODO: support line breaks in tags to ensure they are properly ignored.
+    if (line.empty() || line[0] == '[') {
+      if (started_) {
+        Flush();
+        started_ = false;
       }
-      if (in_comment) {
-        line = line.substr(0, cur_offset);
+      auto uc_line = line;
+      std::transform(
+          uc_line.begin(), uc_line.end(), uc_line.begin(),
+          [](unsigned char c) { return std::toupper(c); }  // correct
+      );
+      if (uc_line.find("[FEN \"", 0) == 0) {
+        auto start_trimmed = line.substr(6);
+        cur_startpos_ = start_trimmed.substr(0, start_trimmed.find('"'));
+        cur_board_.SetFromFen(cur_startpos_);
       }
-      // Trim trailing comment.
-      if (line.find(';') != std::string::npos) {
-        line = line.substr(0, line.find(';'));
+      return;
+    }
+    // Must have at least one non-tag non-empty line in order to be considered
+    // a game.
+    started_ = true;
+    // Handle braced comments.
+    int cur_offset = 0;
+    while ((in_comment_ && line.find('}', cur_offset) != std::string::npos) ||
+           (!in_comment_ && line.find('{', cur_offset) != std::string::npos)) {
+      if (in_comment_ && line.find('}', cur_offset) != std::string::npos) {
+        line = line.substr(0, cur_offset) +
+               line.substr(line.find('}', cur_offset) + 1);
+        in_comment_ = false;
+      } else {
+        cur_offset = line.find('{', cur_offset);
+        in_comment_ = true;
       }
-      if (line.empty()) continue;
-      std::istringstream iss(line);
-      std::string word;
-      while (!iss.eof()) {
-        word.clear();
-        iss >> word;
-        if (word.size() < 2) continue;
-        // Trim move numbers from front.
-        const auto idx = word.find('.');
-        if (idx != std::string::npos) {
-          bool all_nums = true;
-          for (size_t i = 0; i < idx; i++) {
-            if (word[i] < '0' || word[i] > '9') {
-              all_nums = false;
-              break;
-            }
-          }
-          if (all_nums) {
-            word = word.substr(idx + 1);
+    }
+    if (in_comment_) {
+      line = line.substr(0, cur_offset);
+    }
+    // Trim trailing comment.
+    if (line.find(';') != std::string::npos) {
+      line = line.substr(0, line.find(';'));
+    }
+    if (line.empty()) return;
+    std::istringstream iss(line);
+    std::string word;
+    while (!iss.eof()) {
+      word.clear();
+      iss >> word;
+      if (word.size() < 2) continue;
+      // Trim move numbers from front.
+      const auto idx = word.find('.');
+      if (idx != std::string::npos) {
+        bool all_nums = true;
+        for (size_t i = 0; i < idx; i++) {
+          if (word[i] < '0' || word[i] > '9') {
+            all_nums = false;
+            break;
           }
         }
-        // Pure move numbers can be skipped.
-        if (word.size() < 2) continue;
-        // Ignore score line.
-        if (word == "1/2-1/2" || word == "1-0" || word == "0-1" || word == "*")
-          continue;
-        cur_game_.push_back(SanToMove(word, cur_board_));
-        cur_board_.ApplyMove(cur_game_.back());
-        // Board ApplyMove wants mirrored for black, but outside code wants
-        // normal, so mirror it back again.
-        // Check equal to 0 since we've already added the position.
-        if ((cur_game_.size() % 2) == 0) cur_game_.back().Flip();
-        cur_board_.Mirror();
+        if (all_nums) {
+          word = word.substr(idx + 1);
+        }
       }
+      // Pure move numbers can be skipped.
+      if (word.size() < 2) continue;
+      // Ignore score line.
+      if (word == "1/2-1/2" || word == "1-0" || word == "0-1" || word == "*")
+        continue;
+      cur_game_.push_back(SanToMove(word, cur_board_));
+      cur_board_.ApplyMove(cur_game_.back());
+      // Board ApplyMove wants mirrored for black, but outside code wants
+      // normal, so mirror it back again.
+      // Check equal to 0 since we've already added the position.
+      if ((cur_game_.size() % 2) == 0) cur_game_.back().Flip();
+      cur_board_.Mirror();
     }
-    if (started) {
-      Flush();
-    }
-    gzclose(file);
   }
-  std::vector<Opening> GetGames() const { return games_; }
-  std::vector<Opening>&& ReleaseGames() { return std::move(games_); }
 
- private:
+  void FinishGame() {
+    if (started_) Flush();
+    started_ = false;
+    in_comment_ = false;
+  }
+
   void Flush() {
     games_.push_back({cur_startpos_, cur_game_});
     cur_game_.clear();
@@ -334,6 +352,8 @@ class PgnReader {
   MoveList cur_game_;
   std::string cur_startpos_ = ChessBoard::kStartposFen;
   std::vector<Opening> games_;
+  bool in_comment_ = false;
+  bool started_ = false;
 };
 
 }  // namespace lczero
@@ -34,6 +34,7 @@
 #include <cstring>
 
 #include "chess/types.h"
+#include "utils/hashcat.h"
 
 namespace lczero {
 
@@ -74,8 +75,7 @@ GameResult operator-(const GameResult& res) {
 
 GameResult PositionHistory::ComputeGameResult() const {
   const auto& board = Last().GetBoard();
-  auto legal_moves = board.GenerateLegalMoves();
-  if (legal_moves.empty()) {
+  if (board.CountLegalMoves() == 0) {
     if (board.IsUnderCheck()) {
       // Checkmate.
       return IsBlackToMove() ? GameResult::WHITE_WON : GameResult::BLACK_WON;
@@ -91,46 +91,148 @@ GameResult PositionHistory::ComputeGameResult() const {
   return GameResult::UNDECIDED;
 }
 
+namespace {
+// Smallest number of slots allocated at once.
+constexpr int kMinHistoryCapacity = 32;
+}  // namespace
+
+PositionHistory::PositionHistory(const PositionHistory& other)
+    : storage_(other.storage_),
+      length_(other.length_),
+      claimed_(other.length_) {
+  other.Freeze();
+}
+
+PositionHistory::PositionHistory(PositionHistory&& other) noexcept
+    : storage_(std::move(other.storage_)),
+      length_(other.length_),
+      claimed_(other.claimed_) {
+  other.length_ = 0;
+  other.claimed_ = 0;
+}
+
+PositionHistory::PositionHistory(std::span<const Position> positions)
+    : storage_(std::make_shared<Storage>(
+          std::max<int>(kMinHistoryCapacity, positions.size()))),
+      length_(positions.size()),
+      claimed_(positions.size()) {
+  std::copy(positions.begin(), positions.end(), storage_->positions.begin());
+  for (int i = 0; i < length_; ++i) {
+    storage_->hashes[i] = positions[i].GetBoard().Hash();
+  }
+  storage_->size.store(length_, std::memory_order_relaxed);
+}
+
+PositionHistory& PositionHistory::operator=(const PositionHistory& other) {
+  if (this == &other) return *this;
+  other.Freeze();
+  storage_ = other.storage_;
+  length_ = other.length_;
+  claimed_ = other.length_;
+  return *this;
+}
+
+PositionHistory& PositionHistory::operator=(PositionHistory&& other) noexcept {
+  if (this == &other) return *this;
+  storage_ = std::move(other.storage_);
+  length_ = other.length_;
+  claimed_ = other.claimed_;
+  other.length_ = 0;
+  other.claimed_ = 0;
+  return *this;
+}
+
+void PositionHistory::Freeze() const {
+  if (!storage_) return;
+  int frozen = storage_->frozen.load(std::memory_order_relaxed);
+  while (frozen < length_ && !storage_->frozen.compare_exchange_weak(
+                                 frozen, length_, std::memory_order_release,
+                                 std::memory_order_relaxed)) {
+  }
+}
+
+void PositionHistory::ClaimNextSlot(int min_capacity) {
+  if (storage_ && length_ < static_cast<int>(storage_->positions.size()) &&
+      min_capacity <= static_cast<int>(storage_->positions.size()) &&
+      storage_->frozen.load(std::memory_order_acquire) <= length_) {
+    // Either this history is at the end of the storage, or the slots past it
+    // were claimed by this history and nobody has taken them since.
+    int expected = claimed_;
+    if (storage_->size.compare_exchange_strong(expected, length_ + 1,
+                                               std::memory_order_acq_rel)) {
+      claimed_ = length_ + 1;
+      return;
+    }
+  }
+  auto storage = std::make_shared<Storage>(
+      std::max({kMinHistoryCapacity, 2 * (length_ + 1), min_capacity}));
+  if (storage_) {
+    std::copy_n(storage_->positions.begin(), length_,
+                storage->positions.begin());
+    std::copy_n(storage_->hashes.begin(), length_, storage->hashes.begin());
+  }
+  storage->size.store(length_ + 1, std::memory_order_relaxed);
+  storage_ = std::move(storage);
+  claimed_ = length_ + 1;
+}
+
+void PositionHistory::Reserve(int size) {
+  if (storage_ && static_cast<int>(storage_->positions.size()) >= size) return;
+  // Claims the next slot in new storage which is large enough, and gives it
+  // back so that the following append starts there.
+  ClaimNextSlot(size);
+  storage_->size.store(length_, std::memory_order_relaxed);
+  claimed_ = length_;
+}
+
 void PositionHistory::Reset(const ChessBoard& board, int rule50_ply,
                             int game_ply) {
-  positions_.clear();
-  positions_.emplace_back(board, rule50_ply, game_ply);
+  Reset(Position(board, rule50_ply, game_ply));
 }
 
 void PositionHistory::Reset(const Position& pos) {
-  positions_.clear();
-  positions_.push_back(pos);
+  length_ = 0;
+  ClaimNextSlot();
+  storage_->positions[0] = pos;
+  storage_->hashes[0] = pos.GetBoard().Hash();
+  length_ = 1;
 }
 
 void PositionHistory::Append(Move m) {
-  // TODO(mooskagh) That should be emplace_back(Last(), m), but MSVS STL
-  //                has a bug in implementation of emplace_back, when
-  //                reallocation happens. (it also reallocates Last())
-  positions_.push_back(Position(Last(), m));
+  const Position pos(Last(), m);
+  ClaimNextSlot();
+  storage_->positions[length_] = pos;
+  storage_->hashes[length_] = pos.GetBoard().Hash();
+  ++length_;
   int cycle_length;
   int repetitions = ComputeLastMoveRepetitions(&cycle_length);
-  positions_.back().SetRepetitions(repetitions, cycle_length);
+  storage_->positions[length_ - 1].SetRepetitions(repetitions, cycle_length);
 }
 
 int PositionHistory::ComputeLastMoveRepetitions(int* cycle_length) const {
   *cycle_length = 0;
-  const auto& last = positions_.back();
-  // TODO(crem) implement hash/cache based solution.
+  const auto& last = Last();
   if (last.GetRule50Ply() < 4) return 0;
 
-  for (int idx = positions_.size() - 5; idx >= 0; idx -= 2) {
-    const auto& pos = positions_[idx];
+  // Positions before the last zeroing move can't repeat.
+  const int last_idx = length_ - 1;
+  const int first_idx = std::max(0, last_idx - last.GetRule50Ply());
+  const uint64_t* hashes = storage_->hashes.data();
+  const uint64_t hash = hashes[last_idx];
+  for (int idx = last_idx - 4; idx >= first_idx; idx -= 2) {
+    if (hashes[idx] != hash) continue;
+    const auto& pos = storage_->positions[idx];
     if (pos.GetBoard() == last.GetBoard()) {
-      *cycle_length = positions_.size() - 1 - idx;
+      *cycle_length = last_idx - idx;
       return 1 + pos.GetRepetitions();
     }
-    if (pos.GetRule50Ply() < 2) return 0;
   }
   return 0;
 }
 
 bool PositionHistory::DidRepeatSinceLastZeroingMove() const {
-  for (auto iter = positions_.rbegin(), end = positions_.rend(); iter != end;
+  const auto positions = GetPositions();
+  for (auto iter = positions.rbegin(), end = positions.rend(); iter != end;
        ++iter) {
     if (iter->GetRepetitions() > 0) return true;
     if (iter->GetRule50Ply() == 0) return false;
@@ -140,7 +242,8 @@ bool PositionHistory::DidRepeatSinceLastZeroingMove() const {
 
 uint64_t PositionHistory::HashLast(int positions) const {
   uint64_t hash = positions;
-  for (auto iter = positions_.rbegin(), end = positions_.rend(); iter != end;
+  const auto history = GetPositions();
+  for (auto iter = history.rbegin(), end = history.rend(); iter != end;
        ++iter) {
     if (!positions--) break;
     hash = HashCat(hash, iter->Hash());
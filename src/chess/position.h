@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <span>
 #include <string>
 #include <string_view>
@@ -96,37 +98,41 @@ std::string PositionToFen(const Position& pos);
 enum class GameResult : uint8_t { UNDECIDED, BLACK_WON, DRAW, WHITE_WON };
 GameResult operator-(const GameResult& res);
 
+// History of the positions of a game. Copies share the underlying storage, so
+// taking a snapshot is O(1), and an append only copies the positions when the
+// next slot is already taken by another history sharing the storage (or one of
+// its snapshots needs it). Histories sharing storage can be used from
+// different threads, a single history can't.
 class PositionHistory {
  public:
   PositionHistory() = default;
-  PositionHistory(const PositionHistory& other) = default;
-  PositionHistory(PositionHistory&& other) = default;
-  PositionHistory(std::span<const Position> positions)
-      : positions_(positions.begin(), positions.end()) {}
+  PositionHistory(const PositionHistory& other);
+  PositionHistory(PositionHistory&& other) noexcept;
+  PositionHistory(std::span<const Position> positions);
 
-  PositionHistory& operator=(const PositionHistory& other) = default;
-  PositionHistory& operator=(PositionHistory&& other) = default;
+  PositionHistory& operator=(const PositionHistory& other);
+  PositionHistory& operator=(PositionHistory&& other) noexcept;
 
   // Returns first position of the game (or fen from which it was initialized).
-  const Position& Starting() const { return positions_.front(); }
+  const Position& Starting() const { return storage_->positions[0]; }
 
   // Returns the latest position of the game.
-  const Position& Last() const { return positions_.back(); }
+  const Position& Last() const { return storage_->positions[length_ - 1]; }
 
   // N-th position of the game, 0-based.
-  const Position& GetPositionAt(int idx) const { return positions_[idx]; }
+  const Position& GetPositionAt(int idx) const {
+    return storage_->positions[idx];
+  }
 
   // Trims position to a given size.
-  void Trim(int size) {
-    positions_.erase(positions_.begin() + size, positions_.end());
-  }
+  void Trim(int size) { length_ = size; }
 
   // Can be used to reduce allocation cost while performing a sequence of moves
   // in succession.
-  void Reserve(int size) { positions_.reserve(size); }
+  void Reserve(int size);
 
   // Number of positions in history.
-  int GetLength() const { return positions_.size(); }
+  int GetLength() const { return length_; }
 
   // Resets the position to a given state.
   void Reset(const ChessBoard& board, int rule50_ply, int game_ply);
@@ -136,7 +142,7 @@ class PositionHistory {
   void Append(Move m);
 
   // Pops last move from history.
-  void Pop() { positions_.pop_back(); }
+  void Pop() { --length_; }
 
   // Finds the endgame state (win/lose/draw/nothing) for the last position.
   GameResult ComputeGameResult() const;
@@ -150,12 +156,39 @@ class PositionHistory {
   // Checks for any repetitions since the last time 50 move rule was reset.
   bool DidRepeatSinceLastZeroingMove() const;
 
-  std::span<const Position> GetPositions() const { return positions_; }
+  std::span<const Position> GetPositions() const {
+    if (!storage_) return {};
+    return {storage_->positions.data(), static_cast<size_t>(length_)};
+  }
 
  private:
-  int ComputeLastMoveRepetitions(int* cycle_length) const;
+  // Slots of the positions, allocated once with a fixed capacity so that the
+  // positions never move.
+  struct Storage {
+    explicit Storage(int capacity) : positions(capacity), hashes(capacity) {}
+    std::vector<Position> positions;
+    // Board hashes of the positions, so that repetitions are looked up
+    // without touching the positions themselves.
+    std::vector<uint64_t> hashes;
+    // Number of slots claimed by the histories sharing the storage.
+    std::atomic<int> size = 0;
+    // Number of slots which snapshots may read, and so can't be rewritten.
+    std::atomic<int> frozen = 0;
+  };
 
-  std::vector<Position> positions_;
+  int ComputeLastMoveRepetitions(int* cycle_length) const;
+  // Makes the slot at length_ writable by this history, moving to new storage
+  // with at least the given capacity when the slot can't be claimed.
+  void ClaimNextSlot(int min_capacity = 0);
+  // Marks the positions of this history as shared with a snapshot.
+  void Freeze() const;
+
+  std::shared_ptr<Storage> storage_;
+  int length_ = 0;
+  // Size of the storage when this history last claimed a slot. The slots
+  // between length_ and claimed_ are reused while no other history or
+  // snapshot took them.
+  int claimed_ = 0;
 };
 
 }  // namespace lczero
@@ -89,6 +89,54 @@ TEST(PositionHistory, ComputeLastMoveRepetitionsWithLegalEnPassant) {
   EXPECT_EQ(repeated_position.GetRepetitions(), 0);
 }
 
+TEST(PositionHistory, ComputeLastMoveRepetitionsAfterPop) {
+  PositionHistory history;
+  history.Reset(ChessBoard(ChessBoard::kStartposFen), 0, 0);
+  for (const char* move : {"g1f3", "g8f6", "f3g1", "f6g8", "g1f3"}) {
+    history.Append(history.Last().GetBoard().ParseMove(move));
+  }
+  EXPECT_EQ(history.Last().GetRepetitions(), 1);
+  EXPECT_EQ(history.Last().GetPliesSincePrevRepetition(), 4);
+  history.Pop();
+  history.Append(history.Last().GetBoard().ParseMove("b1c3"));
+  EXPECT_EQ(history.Last().GetRepetitions(), 0);
+  history.Trim(3);
+  for (const char* move :
+       {"f3g1", "f6g8", "g1f3", "g8f6", "f3g1", "f6g8"}) {
+    history.Append(history.Last().GetBoard().ParseMove(move));
+  }
+  EXPECT_EQ(history.Last().GetRepetitions(), 2);
+}
+
+TEST(PositionHistory, SnapshotsKeepTheirPositions) {
+  PositionHistory history;
+  history.Reset(ChessBoard(ChessBoard::kStartposFen), 0, 0);
+  for (const char* move : {"e2e4", "e7e5", "g1f3"}) {
+    history.Append(history.Last().GetBoard().ParseMove(move));
+  }
+  PositionHistory snapshot = history;
+  history.Trim(2);
+  history.Append(history.Last().GetBoard().ParseMove("d7d5"));
+  PositionHistory branch = snapshot;
+  branch.Append(branch.Last().GetBoard().ParseMove("b8c6"));
+  snapshot.Append(snapshot.Last().GetBoard().ParseMove("g8f6"));
+
+  PositionHistory expected;
+  expected.Reset(ChessBoard(ChessBoard::kStartposFen), 0, 0);
+  for (const char* move : {"e2e4", "e7e5", "g1f3", "g8f6"}) {
+    expected.Append(expected.Last().GetBoard().ParseMove(move));
+  }
+  ASSERT_EQ(snapshot.GetLength(), 5);
+  EXPECT_EQ(branch.GetLength(), 5);
+  EXPECT_EQ(history.GetLength(), 3);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(snapshot.GetPositionAt(i), expected.GetPositionAt(i));
+  }
+  EXPECT_EQ(branch.GetPositionAt(3), expected.GetPositionAt(3));
+  EXPECT_NE(branch.Last(), snapshot.Last());
+  EXPECT_NE(history.Last(), expected.GetPositionAt(3));
+}
+
 TEST(PositionHistory, DidRepeatSinceLastZeroingMoveCurent) {
   ChessBoard board;
   PositionHistory history;
@@ -165,6 +213,5 @@ TEST(PositionHistory, DidRepeatSinceLastZeroingMoveNeverRepeated) {
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
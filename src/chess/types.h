@@ -31,6 +31,8 @@
 #include <string>
 #include <vector>
 
+#include "utils/inline_vector.h"
+
 namespace lczero {
 
 struct PieceType {
@@ -173,6 +175,8 @@ class Move {
   bool is_null() const { return data_ == 0; }
 
   uint16_t raw_data() const { return data_; }
+  // Inverse of raw_data(), e.g. for moves received over the network.
+  static constexpr Move FromRawData(uint16_t data) { return Move(data); }
 
  private:
   explicit constexpr Move(uint16_t data) : data_(data) {}
@@ -237,6 +241,8 @@ inline std::string Move::ToString(bool is_chess960) const {
          (is_promotion() ? promotion().ToString(false) : "");
 }
 
-using MoveList = std::vector<Move>;
+// Legal move lists fit inline (a position has at most 218 legal moves), longer
+// lists such as the moves of a game spill to the heap.
+using MoveList = InlineVector<Move, 256>;
 
 }  // namespace lczero
\ No newline at end of file
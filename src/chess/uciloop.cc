@@ -151,9 +151,30 @@ UciLoop::UciLoop(StringUciResponder* uci_responder, OptionsParser* options,
 
 UciLoop::~UciLoop() { engine_->UnregisterUciResponder(uci_responder_); }
 
+void UciLoop::ApplyPendingOptions() {
+  if (pending_options_.empty()) return;
+  // Waits for the engine initialization to finish.
+  engine_->EnsureReady();
+  auto options = std::move(pending_options_);
+  pending_options_.clear();
+  for (const auto& params : options) {
+    options_->SetUciOption(GetOrEmpty(params, "name"),
+                           GetOrEmpty(params, "value"),
+                           GetOrEmpty(params, "context"));
+  }
+}
+
 bool UciLoop::DispatchCommand(
     const std::string& command,
     const std::unordered_map<std::string, std::string>& params) {
+  if (command == "setoption" &&
+      (engine_->IsInitializing() || !pending_options_.empty())) {
+    // The options are being read by the engine initialization, so apply the
+    // change (in order) before the next command.
+    pending_options_.push_back(params);
+    return true;
+  }
+  if (command != "setoption" && command != "quit") ApplyPendingOptions();
   if (command == "uci") {
     uci_responder_->SendId();
     for (const auto& option : options_->ListOptionsUci()) {
@@ -80,6 +80,10 @@ class EngineControllerBase {
   // Blocks.
   virtual void EnsureReady() = 0;
 
+  // Returns true while the engine is initializing in background, UCI options
+  // must not be changed then. Must not block.
+  virtual bool IsInitializing() const { return false; }
+
   // Must not block.
   virtual void NewGame() = 0;
 
@@ -117,6 +121,13 @@ class UciLoop {
   StringUciResponder* uci_responder_;  // absl_nonnull
   OptionsParser* options_;             // absl_notnull
   EngineControllerBase* engine_;       // absl_notnull
+
+ private:
+  // Applies the setoption commands received during the engine
+  // initialization.
+  void ApplyPendingOptions();
+
+  std::vector<std::unordered_map<std::string, std::string>> pending_options_;
 };
 
 class StdoutUciResponder : public StringUciResponder {
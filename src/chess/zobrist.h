@@ -0,0 +1,68 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace lczero {
+
+// Random keys for Zobrist hashing of the board, generated at compile time.
+struct ZobristKeys {
+  // Indexed by [is_black][PieceType::idx][Square::as_idx()].
+  uint64_t pieces[2][6][64] = {};
+  // Indexed by the castling rights bits.
+  uint64_t castlings[16] = {};
+  // Indexed by the file of the pawn which can be taken en passant.
+  uint64_t en_passant[8] = {};
+  uint64_t black_to_move = 0;
+};
+
+constexpr ZobristKeys MakeZobristKeys() {
+  ZobristKeys keys;
+  // SplitMix64.
+  uint64_t state = 0x4c63305a6f627269ULL;
+  auto next = [&state]() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  };
+  for (auto& color : keys.pieces) {
+    for (auto& piece : color) {
+      for (auto& key : piece) key = next();
+    }
+  }
+  for (auto& key : keys.castlings) key = next();
+  for (auto& key : keys.en_passant) key = next();
+  keys.black_to_move = next();
+  return keys;
+}
+
+inline constexpr ZobristKeys kZobristKeys = MakeZobristKeys();
+
+}  // namespace lczero
@@ -28,13 +28,21 @@
 #include "engine.h"
 
 #include <algorithm>
+#include <chrono>
+#include <sstream>
 
 #include "chess/position.h"
 #include "neural/backend.h"
+#include "neural/coalesce.h"
 #include "neural/memcache.h"
+#include "neural/memory_budget.h"
 #include "neural/register.h"
 #include "neural/shared_params.h"
 #include "syzygy/syzygy.h"
+#include "utils/large_pages.h"
+#include "utils/logging.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace {
@@ -46,6 +54,33 @@ const OptionId kSyzygyTablebaseId{
          "system separator (\";\" for Windows, \":\" for Linux).",
      .short_flag = 's',
      .visibility = OptionId::kAlwaysVisible}};
+const OptionId kSyzygyProbeCacheSizeId{
+    {.long_flag = "syzygy-cache-size",
+     .uci_option = "SyzygyCacheSize",
+     .help_text = "Number of Syzygy probe results to cache, shared between the "
+                  "search threads. 0 disables the cache.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kSyzygyRootThreadsId{
+    {.long_flag = "syzygy-root-threads",
+     .uci_option = "SyzygyRootThreads",
+     .help_text = "Number of threads that probe the root moves in the DTZ "
+                  "tables before the search starts.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kSyzygyRootTimeLimitId{
+    {.long_flag = "syzygy-root-time-limit",
+     .uci_option = "SyzygyRootTimeLimit",
+     .help_text = "Time in milliseconds after which the DTZ probes of the root "
+                  "moves are abandoned and the root moves are filtered using "
+                  "the WDL tables only. 0 means no limit.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kSyzygyPreloadPiecesId{
+    {.long_flag = "syzygy-preload-pieces",
+     .uci_option = "SyzygyPreloadPieces",
+     .help_text = "Read the WDL and DTZ tables with up to this many pieces "
+                  "into memory in the background after loading, so that the "
+                  "first probes don't wait for the disk. 0 disables "
+                  "preloading.",
+     .visibility = OptionId::kProOnly}};
 const OptionId kStrictUciTiming{
     {.long_flag = "strict-uci-timing",
      .uci_option = "StrictTiming",
@@ -62,13 +97,147 @@ const OptionId kPonderId{
 
 const OptionId kPreload{"preload", "",
                         "Initialize backend and load net on engine startup."};
+const OptionId kBackgroundPreload{
+    "background-preload", "",
+    "Initialize backend, load net and tablebases on engine startup in "
+    "background, while the UCI commands are already being processed. The "
+    "backend does a warmup evaluation after that."};
+const OptionId kNNCacheFileId{
+    {.long_flag = "nncache-file",
+     .uci_option = "NNCacheFile",
+     .help_text =
+         "File to keep the NN cache in between engine runs. The cache is "
+         "loaded from it in background when the network is loaded, and saved "
+         "to it when the engine quits or SaveNNCache is pressed. The file is "
+         "ignored if it was saved for a different network.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kNewGameClearsCacheId{
+    {.long_flag = "new-game-clears-cache",
+     .uci_option = "NewGameClearsCache",
+     .help_text = "Clears the NN cache on ucinewgame. When disabled, the cache "
+                  "is kept between the games and only dropped when the "
+                  "network or the backend changes, so that the positions of "
+                  "overlapping openings don't have to be evaluated again.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kResidentNetworksId{
+    {.long_flag = "resident-networks",
+     .uci_option = "ResidentNetworks",
+     .help_text = "Number of networks kept loaded. Switching WeightsFile or "
+                  "Backend back to a network which is still loaded is "
+                  "instant, and its NN cache is kept. The least recently "
+                  "used networks are unloaded first.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kResidentNetworksMemoryId{
+    {.long_flag = "resident-networks-memory",
+     .uci_option = "ResidentNetworksMemory",
+     .help_text = "Device memory in MiB the loaded networks may use, the "
+                  "least recently used ones are unloaded to stay within it. "
+                  "Only counts the backends which report their device "
+                  "memory. 0 means no limit.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kSaveNNCacheId{
+    {.long_flag = "",
+     .uci_option = "SaveNNCache",
+     .help_text = "Saves the NN cache to NNCacheFile.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kBackendStatsId{
+    {.long_flag = "",
+     .uci_option = "BackendStats",
+     .help_text = "Outputs the backend and NN cache statistics as info "
+                  "strings.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kBackendStatsFileId{
+    {.long_flag = "backend-stats-file",
+     .uci_option = "BackendStatsFile",
+     .help_text = "File to periodically write the backend and NN cache "
+                  "statistics to, in the Prometheus text format.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kBackendStatsIntervalId{
+    {.long_flag = "backend-stats-interval",
+     .uci_option = "BackendStatsInterval",
+     .help_text = "How often to write the statistics to BackendStatsFile, in "
+                  "seconds.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kMetricsId{
+    {.long_flag = "",
+     .uci_option = "Metrics",
+     .help_text = "Outputs the values of all metrics as info strings.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kResetMetricsId{
+    {.long_flag = "",
+     .uci_option = "ResetMetrics",
+     .help_text = "Sets all metrics to zero.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kMetricsFileId{
+    {.long_flag = "metrics-file",
+     .uci_option = "MetricsFile",
+     .help_text = "File to periodically write all metrics to, in the "
+                  "Prometheus text format.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kMetricsIntervalId{
+    {.long_flag = "metrics-interval",
+     .uci_option = "MetricsInterval",
+     .help_text = "How often to write the metrics to MetricsFile, in seconds.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kMetricsHostId{
+    {.long_flag = "metrics-host",
+     .uci_option = "MetricsHost",
+     .help_text = "Address to serve the metrics endpoint on.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kMetricsPortId{
+    {.long_flag = "metrics-port",
+     .uci_option = "MetricsPort",
+     .help_text = "TCP port to serve the metrics over HTTP on, for Prometheus "
+                  "scrapers. 0 disables the endpoint.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kTraceFileId{
+    {.long_flag = "trace-file",
+     .uci_option = "TraceFile",
+     .help_text =
+         "Enables timeline tracing of the search and the backend, and writes "
+         "the trace to this file in the Chrome trace JSON format (open it in "
+         "ui.perfetto.dev or chrome://tracing). The trace is written on exit, "
+         "when the file changes, or when SaveTrace is pressed.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kTraceBufferEventsId{
+    {.long_flag = "trace-buffer-events",
+     .uci_option = "TraceBufferEvents",
+     .help_text = "Number of most recent trace events kept for every thread.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kSaveTraceId{
+    {.long_flag = "",
+     .uci_option = "SaveTrace",
+     .help_text = "Writes the trace collected so far to TraceFile.",
+     .visibility = OptionId::kProOnly}};
 }  // namespace
 
 void Engine::PopulateOptions(OptionsParser* options) {
   options->Add<BoolOption>(kPonderId) = false;
   options->Add<StringOption>(kSyzygyTablebaseId);
+  options->Add<IntOption>(kSyzygyProbeCacheSizeId, 0, 100000000) = 200000;
+  options->Add<IntOption>(kSyzygyRootThreadsId, 1, 64) = 4;
+  options->Add<IntOption>(kSyzygyRootTimeLimitId, 0, 100000) = 0;
+  options->Add<IntOption>(kSyzygyPreloadPiecesId, 0, 7) = 0;
   options->Add<BoolOption>(kStrictUciTiming) = false;
   options->Add<BoolOption>(kPreload) = false;
+  options->Add<BoolOption>(kBackgroundPreload) = false;
+  options->Add<StringOption>(kNNCacheFileId);
+  options->Add<BoolOption>(kNewGameClearsCacheId) = true;
+  options->Add<IntOption>(kResidentNetworksId, 1, 16) = 1;
+  options->Add<IntOption>(kResidentNetworksMemoryId, 0, 1000000) = 0;
+  options->Add<ButtonOption>(kSaveNNCacheId);
+  options->Add<ButtonOption>(kBackendStatsId);
+  options->Add<StringOption>(kBackendStatsFileId);
+  options->Add<IntOption>(kBackendStatsIntervalId, 1, 86400) = 10;
+  options->Add<ButtonOption>(kMetricsId);
+  options->Add<ButtonOption>(kResetMetricsId);
+  options->Add<StringOption>(kMetricsFileId);
+  options->Add<IntOption>(kMetricsIntervalId, 1, 86400) = 10;
+  options->Add<StringOption>(kMetricsHostId) = "127.0.0.1";
+  options->Add<IntOption>(kMetricsPortId, 0, 65535) = 0;
+  options->Add<StringOption>(kTraceFileId);
+  options->Add<IntOption>(kTraceBufferEventsId, 1000, 10000000) = 100000;
+  options->Add<ButtonOption>(kSaveTraceId);
 }
 
 namespace {
@@ -126,6 +295,14 @@ class Engine::UciPonderForwarder : public UciResponder {
     wrapped_->OutputThinkingInfo(infos);
   }
 
+  // Outputs info strings, not subject to the ponder rewriting.
+  void OutputInfoStrings(const std::vector<std::string>& lines) {
+    if (!wrapped_) return;
+    std::vector<ThinkingInfo> infos(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) infos[i].comment = lines[i];
+    wrapped_->OutputThinkingInfo(&infos);
+  }
+
   void Register(UciResponder* wrapped) {
     if (wrapped_) {
       throw Exception("UciPonderForwarder already has a wrapped responder");
@@ -145,16 +322,73 @@ class Engine::UciPonderForwarder : public UciResponder {
 };
 
 Engine::Engine(const SearchFactory& factory, const OptionsDict& opts)
+    : Engine(factory, opts, nullptr) {}
+
+Engine::Engine(const SearchFactory& factory, const OptionsDict& opts,
+               CachingBackend* shared_backend)
     : uci_forwarder_(std::make_unique<UciPonderForwarder>(this)),
       options_(opts),
-      search_(factory.CreateSearch(uci_forwarder_.get(), &options_)) {
-  if (options_.Get<bool>(kPreload)) {
+      search_(factory.CreateSearch(uci_forwarder_.get(), &options_)),
+      shared_backend_(shared_backend) {
+  if (shared_backend_) search_->SetBackend(shared_backend_);
+  if (options_.Get<bool>(kBackgroundPreload)) {
+    preload_ = std::async(std::launch::async, [this]() {
+      UpdateBackendConfig();
+      EnsureSyzygyTablebasesLoaded();
+      WarmupBackend();
+    });
+  } else if (options_.Get<bool>(kPreload)) {
     UpdateBackendConfig();
     EnsureSyzygyTablebasesLoaded();
   }
 }
 
-Engine::~Engine() { EnsureSearchStopped(); }
+Engine::~Engine() {
+  try {
+    WaitForPreload();
+  } catch (const Exception& e) {
+    CERR << e.what();
+  }
+  EnsureSearchStopped();
+  try {
+    SaveNNCache();
+  } catch (const Exception& e) {
+    CERR << e.what();
+  }
+  SaveTrace();
+}
+
+bool Engine::IsInitializing() const {
+  return preload_.valid() && preload_.wait_for(std::chrono::seconds(0)) !=
+                                 std::future_status::ready;
+}
+
+void Engine::WaitForPreload() {
+  // get() rethrows the exception if the preload has failed.
+  if (preload_.valid()) preload_.get();
+}
+
+void Engine::WarmupBackend() {
+  // The first evaluation is often much slower than the rest (lazy allocations,
+  // kernel tuning etc.), so do it before the first search.
+  if (!backend_) return;
+  const Position position = Position::FromFen(ChessBoard::kStartposFen);
+  const MoveList legal_moves = position.GetBoard().GenerateLegalMoves();
+  auto computation = backend_->CreateComputation();
+  computation->AddInput(EvalPosition{.pos = {&position, 1},
+                                     .legal_moves = legal_moves},
+                        EvalResultPtr{});
+  computation->ComputeBlocking();
+}
+
+void Engine::EnsureReady() {
+  WaitForPreload();
+  SaveNNCacheIfRequested();
+
+  OutputBackendStatsIfRequested();
+  OutputMetricsIfRequested();
+  UpdateTraceConfig();
+}
 
 void Engine::EnsureSearchStopped() {
   search_->AbortSearch();
@@ -162,23 +396,174 @@ void Engine::EnsureSearchStopped() {
 }
 
 void Engine::UpdateBackendConfig() {
+  if (shared_backend_) return;
+  // Before the cache is (re)created, and the tree grows.
+  SetLargePagesEnabled(options_.Get<bool>(SharedBackendParams::kLargePagesId));
   const std::string backend_name =
       options_.Get<std::string>(SharedBackendParams::kBackendId);
+  const std::string weights =
+      options_.Get<std::string>(SharedBackendParams::kWeightsId);
+  // With several resident networks, the weights are not updated in place so
+  // that the old network stays loaded.
+  if (backend_ && options_.Get<int>(kResidentNetworksId) > 1 &&
+      (backend_name != backend_name_ || weights != backend_weights_)) {
+    SwitchResidentBackend(backend_name, weights);
+  }
   if (!backend_ || backend_name != backend_name_ ||
       backend_->UpdateConfiguration(options_) == Backend::NEED_RESTART) {
     backend_name_ = backend_name;
-    backend_ = CreateMemCache(BackendManager::Get()->CreateFromParams(options_),
-                              options_);
+    backend_weights_ = weights;
+    auto telemetry = CreateTelemetryBackend(CreateMemCache(
+        CreateCoalescingBackend(
+            BackendManager::Get()->CreateFromParams(options_), options_),
+        options_));
+    telemetry_ = telemetry.get();
+    backend_ = std::move(telemetry);
     search_->SetBackend(backend_.get());
+    const std::string cache_file = options_.Get<std::string>(kNNCacheFileId);
+    if (!cache_file.empty()) backend_->LoadCache(cache_file);
   } else {
-    backend_->SetCacheSize(
-        options_.Get<int>(SharedBackendParams::kNNCacheSizeId));
+    backend_->SetCacheSize(GetMemoryBudget(options_).nn_cache_entries);
+  }
+  EvictResidentBackends();
+  const MemoryBudget budget = GetMemoryBudget(options_);
+  const std::string report = budget.IsSet() ? budget.ToString() : "";
+  if (report != memory_budget_report_) {
+    memory_budget_report_ = report;
+    if (!report.empty()) uci_forwarder_->OutputInfoStrings({report});
+  }
+  telemetry_->SetDumpFile(
+      options_.Get<std::string>(kBackendStatsFileId),
+      std::chrono::seconds(options_.Get<int>(kBackendStatsIntervalId)));
+  metrics_exporter_.SetDumpFile(
+      options_.Get<std::string>(kMetricsFileId),
+      std::chrono::seconds(options_.Get<int>(kMetricsIntervalId)));
+  metrics_exporter_.SetHttpPort(options_.Get<std::string>(kMetricsHostId),
+                                options_.Get<int>(kMetricsPortId));
+  SaveNNCacheIfRequested();
+  OutputBackendStatsIfRequested();
+  OutputMetricsIfRequested();
+  UpdateTraceConfig();
+}
+
+void Engine::SwitchResidentBackend(const std::string& backend_name,
+                                   const std::string& weights) {
+  resident_backends_.push_front(
+      {backend_name_, backend_weights_, std::move(backend_), telemetry_});
+  telemetry_ = nullptr;
+  auto iter = std::find_if(resident_backends_.begin(), resident_backends_.end(),
+                           [&](const ResidentBackend& resident) {
+                             return resident.backend_name == backend_name &&
+                                    resident.weights == weights;
+                           });
+  if (iter == resident_backends_.end()) return;
+  backend_name_ = backend_name;
+  backend_weights_ = weights;
+  backend_ = std::move(iter->backend);
+  telemetry_ = iter->telemetry;
+  resident_backends_.erase(iter);
+  search_->SetBackend(backend_.get());
+  LOGFILE << "Switched to the resident network " << weights;
+}
+
+void Engine::EvictResidentBackends() {
+  const size_t max_backends = options_.Get<int>(kResidentNetworksId);
+  const size_t memory_budget =
+      static_cast<size_t>(options_.Get<int>(kResidentNetworksMemoryId)) << 20;
+  size_t memory = backend_->GetAttributes().device_memory.total();
+  for (const ResidentBackend& resident : resident_backends_) {
+    memory += resident.backend->GetAttributes().device_memory.total();
+  }
+  while (!resident_backends_.empty() &&
+         (resident_backends_.size() + 1 > max_backends ||
+          (memory_budget > 0 && memory > memory_budget))) {
+    const ResidentBackend& resident = resident_backends_.back();
+    memory -= resident.backend->GetAttributes().device_memory.total();
+    LOGFILE << "Unloading the resident network " << resident.weights;
+    resident_backends_.pop_back();
+  }
+}
+
+void Engine::SaveNNCache() {
+  const std::string cache_file = options_.Get<std::string>(kNNCacheFileId);
+  if (!backend_ || cache_file.empty()) return;
+  backend_->SaveCache(cache_file);
+}
+
+void Engine::SaveNNCacheIfRequested() {
+  if (options_.Get<Button>(kSaveNNCacheId).TestAndReset()) SaveNNCache();
+}
+
+void Engine::OutputBackendStatsIfRequested() {
+  if (!options_.Get<Button>(kBackendStatsId).TestAndReset()) return;
+  if (syzygy_tb_) {
+    const auto stats = syzygy_tb_->probe_cache_stats();
+    std::ostringstream out;
+    out << "Syzygy probe cache: " << stats.size << "/" << stats.capacity
+        << " entries, " << stats.probes << " lookups, " << stats.hits
+        << " hits";
+    if (stats.probes) out << " (" << 100 * stats.hits / stats.probes << "%)";
+    const auto memory = syzygy_tb_->memory_stats();
+    std::ostringstream memory_out;
+    memory_out << "Syzygy tables: " << memory.mapped_bytes / (1024 * 1024)
+               << " MiB mapped, " << memory.resident_bytes / (1024 * 1024)
+               << " MiB resident";
+    uci_forwarder_->OutputInfoStrings({out.str(), memory_out.str()});
+  }
+  if (!telemetry_) return;
+  uci_forwarder_->OutputInfoStrings(telemetry_->GetReport());
+}
+
+void Engine::OutputMetricsIfRequested() {
+  if (options_.Get<Button>(kResetMetricsId).TestAndReset()) {
+    MetricsRegistry::Get().Reset();
+  }
+  if (!options_.Get<Button>(kMetricsId).TestAndReset()) return;
+  uci_forwarder_->OutputInfoStrings(
+      MetricsRegistry::Get().Snapshot().ToInfoStrings());
+}
+
+void Engine::UpdateTraceConfig() {
+  const std::string file = options_.Get<std::string>(kTraceFileId);
+  const int buffer_events = options_.Get<int>(kTraceBufferEventsId);
+  const bool save_requested = options_.Get<Button>(kSaveTraceId).TestAndReset();
+  if (file == trace_file_ && buffer_events == trace_buffer_events_) {
+    if (save_requested) SaveTrace();
+    return;
+  }
+  // The trace of the previous configuration is not lost.
+  SaveTrace();
+  trace_file_ = file;
+  trace_buffer_events_ = buffer_events;
+  if (trace_file_.empty()) {
+    Tracer::Disable();
+  } else {
+    Tracer::Enable(trace_buffer_events_);
+  }
+}
+
+void Engine::SaveTrace() {
+  if (trace_file_.empty()) return;
+  try {
+    Tracer::WriteChromeTrace(trace_file_);
+  } catch (const Exception& e) {
+    CERR << e.what();
   }
 }
 
 void Engine::EnsureSyzygyTablebasesLoaded() {
   const std::string tb_paths = options_.Get<std::string>(kSyzygyTablebaseId);
-  if (tb_paths == previous_tb_paths_) return;
+  auto configure = [this]() {
+    syzygy_tb_->set_probe_cache_size(
+        options_.Get<int>(kSyzygyProbeCacheSizeId));
+    syzygy_tb_->set_root_probe_limits(
+        options_.Get<int>(kSyzygyRootThreadsId),
+        options_.Get<int>(kSyzygyRootTimeLimitId));
+  };
+  if (tb_paths == previous_tb_paths_) {
+    if (syzygy_tb_) configure();
+    return;
+  }
   previous_tb_paths_ = tb_paths;
 
   if (tb_paths.empty()) {
@@ -189,6 +574,9 @@ void Engine::EnsureSyzygyTablebasesLoaded() {
     if (!syzygy_tb_->init(tb_paths)) {
       CERR << "Failed to load Syzygy tablebases!";
       syzygy_tb_.reset();
+    } else {
+      configure();
+      syzygy_tb_->start_preload(options_.Get<int>(kSyzygyPreloadPiecesId));
     }
   }
 
@@ -214,6 +602,7 @@ void Engine::InitializeSearchPosition(bool for_ponder) {
 
 void Engine::SetPosition(const std::string& fen,
                          const std::vector<std::string>& moves) {
+  WaitForPreload();
   EnsureSearchStopped();
   ponder_enabled_ = options_.Get<bool>(kPonderId);
   strict_uci_timing_ = options_.Get<bool>(kStrictUciTiming);
@@ -225,7 +614,12 @@ void Engine::SetPosition(const std::string& fen,
 }
 
 void Engine::NewGame() {
-  if (backend_) backend_->ClearCache();
+  WaitForPreload();
+  // The backend itself (with its buffers and graphs) is kept, and the old tree
+  // is freed by the search in background where it can.
+  if (backend_ && options_.Get<bool>(kNewGameClearsCacheId)) {
+    backend_->ClearCache();
+  }
   search_->NewGame();
   SetPosition(ChessBoard::kStartposFen, {});
 }
@@ -27,11 +27,15 @@
 
 #pragma once
 
+#include <future>
+#include <list>
 #include <vector>
 
 #include "chess/gamestate.h"
 #include "engine_loop.h"
+#include "metrics_exporter.h"
 #include "neural/memcache.h"
+#include "neural/telemetry.h"
 #include "search/search.h"
 #include "syzygy/syzygy.h"
 
@@ -40,11 +44,17 @@ namespace lczero {
 class Engine : public EngineControllerBase {
  public:
   Engine(const SearchFactory&, const OptionsDict&);
+  // Uses the backend owned by the caller, shared with other engines, instead
+  // of creating its own. The backend options and the NN cache file are
+  // ignored then, and NewGame() keeps the cache.
+  Engine(const SearchFactory&, const OptionsDict&,
+         CachingBackend* shared_backend);
   ~Engine() override;
 
   static void PopulateOptions(OptionsParser*);
 
-  void EnsureReady() override {};
+  void EnsureReady() override;
+  bool IsInitializing() const override;
   void NewGame() override;
   void SetPosition(const std::string& fen,
                    const std::vector<std::string>& moves) override;
@@ -58,9 +68,24 @@ class Engine : public EngineControllerBase {
 
  private:
   void UpdateBackendConfig();
+  // Moves the active backend to the resident ones, and activates the resident
+  // backend with the given name and weights if there is one.
+  void SwitchResidentBackend(const std::string& backend_name,
+                             const std::string& weights);
+  // Unloads the least recently used resident backends above the
+  // ResidentNetworks count or the ResidentNetworksMemory budget.
+  void EvictResidentBackends();
+  void SaveNNCache();
+  void SaveNNCacheIfRequested();
+  void OutputBackendStatsIfRequested();
+  void OutputMetricsIfRequested();
+  void UpdateTraceConfig();
+  void SaveTrace();
   void EnsureSearchStopped();
   void EnsureSyzygyTablebasesLoaded();
   void InitializeSearchPosition(bool for_ponder);
+  void WaitForPreload();
+  void WarmupBackend();
 
   class UciPonderForwarder;
   std::unique_ptr<UciPonderForwarder> uci_forwarder_;
@@ -68,6 +93,24 @@ class Engine : public EngineControllerBase {
   std::unique_ptr<SearchBase> search_;  // absl_notnull
   std::string backend_name_;  // Remember the backend name to track changes.
   std::unique_ptr<CachingBackend> backend_;  // absl_nullable
+  CachingBackend* const shared_backend_ = nullptr;  // absl_nullable
+  TelemetryBackend* telemetry_ = nullptr;    // Points into backend_.
+  std::string backend_weights_;  // Weights file of backend_.
+  // Loaded backends which are not in use, see ResidentNetworks option.
+  struct ResidentBackend {
+    std::string backend_name;
+    std::string weights;
+    std::unique_ptr<CachingBackend> backend;
+    TelemetryBackend* telemetry;
+  };
+  // Most recently used first.
+  std::list<ResidentBackend> resident_backends_;
+  // Last reported split of the memory budget, to report only the changes.
+  std::string memory_budget_report_;
+  MetricsExporter metrics_exporter_;
+  // Current trace file and buffer size, empty file when tracing is off.
+  std::string trace_file_;
+  int trace_buffer_events_ = 0;
 
   // Remember previous tablebase paths to detect when to reload them.
   std::string previous_tb_paths_;
@@ -83,6 +126,8 @@ class Engine : public EngineControllerBase {
   std::optional<GameState> last_position_ = std::nullopt;
   // Go parameters for the last search. Used on ponder.
   std::optional<GoParams> last_go_params_ = std::nullopt;
+  // Backend initialization running in background, with --background-preload.
+  std::future<void> preload_;
 };
 
 }  // namespace lczero
\ No newline at end of file
@@ -42,6 +42,15 @@ const OptionId kLogFileId{
                   "output the log to the console.",
      .short_flag = 'l',
      .visibility = OptionId::kAlwaysVisible}};
+const OptionId kLogAsyncBufferId{
+    "log-async-buffer", "",
+    "If non-zero, log lines are queued in a buffer of that many lines and "
+    "written by a background thread, so that the search doesn't wait for the "
+    "log file."};
+const OptionId kLogAsyncDropId{
+    "log-async-drop", "",
+    "Drop the log lines when the async log buffer is full, rather than wait "
+    "for space."};
 }  // namespace
 
 void RunEngine(SearchFactory* factory) {
@@ -51,6 +60,8 @@ void RunEngine(SearchFactory* factory) {
   // Populate options from various sources.
   OptionsParser options_parser;
   options_parser.Add<StringOption>(kLogFileId);
+  options_parser.Add<IntOption>(kLogAsyncBufferId, 0, 1000000) = 0;
+  options_parser.Add<BoolOption>(kLogAsyncDropId) = false;
   ConfigFile::PopulateOptions(&options_parser);
   Engine::PopulateOptions(&options_parser);
   if (factory) factory->PopulateParams(&options_parser);  // Search params.
@@ -61,6 +72,8 @@ void RunEngine(SearchFactory* factory) {
   if (!ConfigFile::Init() || !options_parser.ProcessAllFlags()) return;
   const auto options = options_parser.GetOptionsDict();
   Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
+  Logging::Get().StartAsync(options.Get<int>(kLogAsyncBufferId),
+                            options.Get<bool>(kLogAsyncDropId));
 
   // Create engine.
   Engine engine(*factory, options);
@@ -132,6 +132,39 @@ TEST_F(EngineTest, BackendReloadByUpdateBackendConfig) {
   EXPECT_NE(backend_, prev_backend);  // Backend recreated.
 }
 
+TEST_F(EngineTest, ResidentNetworksSwitchWithoutReload) {
+  WaitingUciResponder uci_responder;
+  Engine engine(search_factory_, *options_);
+  engine.RegisterUciResponder(&uci_responder);
+  EXPECT_CALL(*search_, StartSearch(_)).WillRepeatedly([&](const GoParams&) {
+    static BestMoveInfo bestmove_info(Move::White(kSquareE1, kSquareA1));
+    search_->GetUciResponder()->OutputBestMove(&bestmove_info);
+  });
+  options_parser_.SetUciOption("ResidentNetworks", "2");
+  auto switch_to = [&](const std::string& weights) {
+    options_->Set<std::string>(SharedBackendParams::kWeightsId, weights);
+    engine.NewGame();
+  };
+  // Networks "a", "b" and "c" are loaded, the least recently used "a" is
+  // unloaded to keep two.
+  EXPECT_CALL(*backend_factory_, Create(_)).Times(3);
+  options_->Set<std::string>(SharedBackendParams::kWeightsId, "a");
+  engine.Go(GoParams{.nodes = 10});
+  uci_responder.Wait();
+  MockBackend* backend_a = backend_;
+  switch_to("b");
+  MockBackend* backend_b = backend_;
+  EXPECT_NE(backend_b, backend_a);
+  switch_to("c");
+  EXPECT_CALL(*backend_b, UpdateConfiguration(_))
+      .WillRepeatedly(Return(Backend::UPDATE_OK));
+  switch_to("b");
+  testing::Mock::VerifyAndClearExpectations(backend_factory_);
+  // Loading "a" again unloads "c".
+  EXPECT_CALL(*backend_factory_, Create(_)).Times(1);
+  switch_to("a");
+}
+
 }  // namespace
 }  // namespace lczero
 
@@ -25,15 +25,22 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "analysis_server.h"
 #include "chess/board.h"
 #include "engine.h"
 #include "search/register.h"
 #include "selfplay/loop.h"
 #include "tools/backendbench.h"
+#include "tools/backendserver.h"
+#include "tools/batchanalysis.h"
+#include "tools/bulkeval.h"
 #include "tools/benchmark.h"
+#include "tools/benchsuite.h"
+#include "tools/compilebook.h"
 #include "tools/describenet.h"
 #include "tools/leela2onnx.h"
 #include "tools/onnx2leela.h"
+#include "tools/perft.h"
 #include "utils/commandline.h"
 #include "utils/esc_codes.h"
 #include "utils/logging.h"
@@ -89,20 +96,34 @@ int main(int argc, const char** argv) {
        << " built " << __DATE__;
 
   try {
-    InitializeMagicBitboards();
-
     CommandLine::Init(argc, argv);
     if (CommandLine::BinaryName().find("simple") == std::string::npos) {
       CommandLine::RegisterMode("selfplay", "Play games with itself");
       CommandLine::RegisterMode("benchmark", "Quick benchmark");
       CommandLine::RegisterMode("bench", "Very quick benchmark");
+      CommandLine::RegisterMode(
+          "benchsuite",
+          "Repeated benchmark sweeps, compared with a baseline run.");
       CommandLine::RegisterMode("backendbench",
                                 "Quick benchmark of backend only");
+      CommandLine::RegisterMode("perft",
+                                "Benchmark of the move generation only");
+      CommandLine::RegisterMode("serve",
+                                "Serve backend evaluations to remote hosts.");
+      CommandLine::RegisterMode(
+          "analysisserver",
+          "Serve UCI search sessions over TCP, sharing one backend.");
       CommandLine::RegisterMode("leela2onnx", "Convert Leela network to ONNX.");
       CommandLine::RegisterMode("onnx2leela",
                                 "Convert ONNX network to Leela net.");
       CommandLine::RegisterMode("describenet",
                                 "Shows details about the Leela network.");
+      CommandLine::RegisterMode(
+          "compilebook", "Convert PGN or EPD openings to a binary book.");
+      CommandLine::RegisterMode(
+          "analyze", "Analyze a list of positions into a JSONL file.");
+      CommandLine::RegisterMode(
+          "bulkeval", "Evaluate positions with the network only, to JSONL.");
     }
     for (const std::string_view search_name :
          SearchManager::Get()->GetSearchNames()) {
@@ -124,16 +145,34 @@ int main(int argc, const char** argv) {
       // Benchmark mode, shorter version.
       Benchmark benchmark;
       benchmark.Run(/*run_shorter_benchmark=*/true);
+    } else if (CommandLine::ConsumeCommand("benchsuite")) {
+      if (!RunBenchmarkSuite()) return 1;
     } else if (CommandLine::ConsumeCommand("backendbench")) {
       // Backend Benchmark mode.
       BackendBenchmark benchmark;
       benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("perft")) {
+      // Move generation benchmark mode.
+      PerftBenchmark benchmark;
+      benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("serve")) {
+      // Backend server mode, for the "remote" backend.
+      BackendServer server;
+      server.Run();
+    } else if (CommandLine::ConsumeCommand("analysisserver")) {
+      RunAnalysisServer(SearchManager::Get()->GetFactoryByName("classic"));
     } else if (CommandLine::ConsumeCommand("leela2onnx")) {
       lczero::ConvertLeelaToOnnx();
     } else if (CommandLine::ConsumeCommand("onnx2leela")) {
       lczero::ConvertOnnxToLeela();
     } else if (CommandLine::ConsumeCommand("describenet")) {
       lczero::DescribeNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("compilebook")) {
+      lczero::CompileOpeningBook();
+    } else if (CommandLine::ConsumeCommand("analyze")) {
+      RunBatchAnalysis(SearchManager::Get()->GetFactoryByName("classic"));
+    } else if (CommandLine::ConsumeCommand("bulkeval")) {
+      RunBulkEvaluation();
     } else {
       lczero::ChooseAndRunEngine();
     }
@@ -0,0 +1,132 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "metrics_exporter.h"
+
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/metrics.h"
+
+namespace lczero {
+
+MetricsExporter::~MetricsExporter() {
+  SetDumpFile("", {});
+  SetHttpPort("", 0);
+}
+
+void MetricsExporter::SetDumpFile(const std::string& filename,
+                                  std::chrono::seconds interval) {
+  if (filename == dump_file_ && interval == dump_interval_) return;
+  if (dump_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(dump_mutex_);
+      stop_dumping_ = true;
+    }
+    dump_cv_.notify_all();
+    dump_thread_.join();
+    WriteDump();
+  }
+  dump_file_ = filename;
+  dump_interval_ = interval;
+  stop_dumping_ = false;
+  if (!dump_file_.empty()) dump_thread_ = std::thread([this]() { DumpLoop(); });
+}
+
+void MetricsExporter::DumpLoop() {
+  std::unique_lock<std::mutex> lock(dump_mutex_);
+  while (!dump_cv_.wait_for(lock, dump_interval_,
+                            [this]() { return stop_dumping_; })) {
+    lock.unlock();
+    WriteDump();
+    lock.lock();
+  }
+}
+
+void MetricsExporter::WriteDump() {
+  try {
+    MetricsRegistry::Get().WriteToFile(dump_file_);
+  } catch (const Exception& e) {
+    LOGFILE << "Cannot write metrics: " << e.what();
+  }
+}
+
+void MetricsExporter::SetHttpPort(const std::string& host, int port) {
+  if (host == http_host_ && port == http_port_) return;
+  if (http_thread_.joinable()) {
+    // Wakes up the Accept() call in the serving thread.
+    listener_.Shutdown();
+    http_thread_.join();
+    listener_.Close();
+  }
+  http_host_ = host;
+  http_port_ = port;
+  if (http_port_ == 0) return;
+  try {
+    listener_ = remote::Socket::Listen(http_host_, http_port_);
+  } catch (const Exception& e) {
+    CERR << "Metrics endpoint disabled: " << e.what();
+    return;
+  }
+  LOGFILE << "Serving metrics on " << http_host_ << ":" << http_port_;
+  http_thread_ = std::thread([this]() { ServeLoop(); });
+}
+
+void MetricsExporter::ServeLoop() {
+  while (true) {
+    remote::Socket socket;
+    try {
+      socket = listener_.Accept();
+    } catch (const Exception&) {
+      // The listener was shut down.
+      return;
+    }
+    try {
+      // Read the request headers, the request itself doesn't matter.
+      std::string request;
+      char buffer[1024];
+      while (request.find("\r\n\r\n") == std::string::npos &&
+             request.size() < 16384) {
+        const size_t size = socket.ReadSome(buffer, sizeof(buffer));
+        if (size == 0) break;
+        request.append(buffer, size);
+      }
+      const std::string body = MetricsRegistry::Get().Snapshot().ToPrometheus();
+      const std::string response =
+          "HTTP/1.0 200 OK\r\n"
+          "Content-Type: text/plain; version=0.0.4\r\n"
+          "Content-Length: " +
+          std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+      socket.WriteAll(response.data(), response.size());
+    } catch (const Exception& e) {
+      LOGFILE << "Metrics request failed: " << e.what();
+    }
+    socket.Close();
+  }
+}
+
+}  // namespace lczero
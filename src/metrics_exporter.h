@@ -0,0 +1,72 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "neural/remote/protocol.h"
+
+namespace lczero {
+
+// Exports MetricsRegistry to the outside: periodically writes it to a file,
+// and serves it over HTTP to Prometheus scrapers (any request path returns the
+// metrics). Both are off until configured.
+class MetricsExporter {
+ public:
+  ~MetricsExporter();
+
+  // Starts writing the metrics to the file every @interval. Empty filename
+  // stops writing.
+  void SetDumpFile(const std::string& filename, std::chrono::seconds interval);
+  // Starts serving the metrics on the port. Zero port stops the server.
+  void SetHttpPort(const std::string& host, int port);
+
+ private:
+  void DumpLoop();
+  void WriteDump();
+  void ServeLoop();
+
+  std::mutex dump_mutex_;
+  std::condition_variable dump_cv_;
+  bool stop_dumping_ = false;
+  std::string dump_file_;
+  std::chrono::seconds dump_interval_{0};
+  std::thread dump_thread_;
+
+  std::string http_host_;
+  int http_port_ = 0;
+  remote::Socket listener_;
+  std::thread http_thread_;
+};
+
+}  // namespace lczero
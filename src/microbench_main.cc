@@ -0,0 +1,258 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+// Micro-benchmarks of the hot paths of the search and the backends. Usage:
+//   lc0_microbench [substring of the case names to run]
+// Every case is run in batches until kMinBatchTime passes, kRepeats times, and
+// the fastest repeat is reported, which is the most stable estimate on a busy
+// machine.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chess/board.h"
+#include "chess/position.h"
+#include "neural/encoder.h"
+#include "search/classic/node.h"
+#include "utils/cache.h"
+#include "utils/clock_cache.h"
+#include "utils/fastmath.h"
+#include "utils/fp16_utils.h"
+#include "utils/hashcat.h"
+
+namespace lczero {
+namespace {
+
+constexpr auto kMinBatchTime = std::chrono::milliseconds(100);
+constexpr int kRepeats = 5;
+
+// Keeps the compiler from optimizing away the computation of @value.
+template <class T>
+void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+struct Case {
+  std::string name;
+  // Runs one operation.
+  std::function<void()> fn;
+};
+
+double NanosecondsPerOp(const std::function<void()>& fn) {
+  // Find the batch size which takes at least kMinBatchTime.
+  int64_t iterations = 1;
+  while (true) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < iterations; ++i) fn();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed >= kMinBatchTime) break;
+    iterations *= 2;
+  }
+  double best = 0;
+  for (int r = 0; r < kRepeats; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < iterations; ++i) fn();
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    const double ns = elapsed.count() / iterations;
+    if (r == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+const std::vector<std::string> kFens = {
+    ChessBoard::kStartposFen,
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+};
+
+PositionHistory MakeHistory(const std::string& fen,
+                            const std::vector<std::string>& moves) {
+  PositionHistory history;
+  history.Reset(Position::FromFen(fen));
+  for (const std::string& str : moves) {
+    history.Append(history.Last().GetBoard().ParseMove(str));
+  }
+  return history;
+}
+
+std::vector<Case> MakeCases() {
+  std::vector<Case> cases;
+
+  // Move generation.
+  for (size_t i = 0; i < kFens.size(); ++i) {
+    const PositionHistory history = MakeHistory(kFens[i], {});
+    const ChessBoard board = history.Last().GetBoard();
+    cases.push_back({"GenerateLegalMoves/" + std::to_string(i), [board]() {
+                       DoNotOptimize(board.GenerateLegalMoves());
+                     }});
+  }
+
+  // Input encoding of a position with the full history.
+  {
+    auto history = std::make_shared<PositionHistory>(
+        MakeHistory(ChessBoard::kStartposFen,
+                    {"e2e4", "e7e5", "g1f3", "b8c6", "f1b5", "a7a6", "b5a4",
+                     "g8f6", "e1g1", "f8e7"}));
+    cases.push_back({"EncodePositionForNN/classical", [history]() {
+                       int transform;
+                       DoNotOptimize(EncodePositionForNN(
+                           pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+                           *history, 8, FillEmptyHistory::FEN_ONLY,
+                           &transform));
+                     }});
+    cases.push_back(
+        {"EncodePositionForNN/canonical", [history]() {
+           int transform;
+           DoNotOptimize(EncodePositionForNN(
+               pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2,
+               *history, 8, FillEmptyHistory::FEN_ONLY, &transform));
+         }});
+  }
+
+  // Edges of a node, created and sorted by policy.
+  {
+    const MoveList moves = MakeHistory(kFens[1], {}).Last().GetBoard()
+                               .GenerateLegalMoves();
+    cases.push_back({"Node::CreateEdges+SortEdges", [moves]() {
+                       classic::Node node(nullptr, 0);
+                       node.CreateEdges(moves);
+                       uint64_t hash = 0;
+                       for (auto& edge : node.Edges()) {
+                         hash = HashCat(hash, 12345);
+                         edge.edge()->SetP((hash % 1000) / 1000.0f);
+                       }
+                       node.SortEdges();
+                       DoNotOptimize(node.GetNumEdges());
+                     }});
+  }
+
+  // Softmax of a policy of a typical size.
+  {
+    auto values = std::make_shared<std::vector<float>>(40);
+    cases.push_back({"FastExp/40", [values]() {
+                       float sum = 0;
+                       for (size_t i = 0; i < values->size(); ++i) {
+                         sum += FastExp(-0.1f * i);
+                       }
+                       DoNotOptimize(sum);
+                     }});
+    cases.push_back({"FastSoftmax/40", [values]() {
+                       for (size_t i = 0; i < values->size(); ++i) {
+                         (*values)[i] = 0.05f * i;
+                       }
+                       FastSoftmax(values->data(), values->size(), 1.0f);
+                       DoNotOptimize((*values)[0]);
+                     }});
+  }
+
+  // fp16 conversions of a block of values.
+  {
+    auto floats = std::make_shared<std::vector<float>>(1024);
+    auto halves = std::make_shared<std::vector<uint16_t>>(1024);
+    for (size_t i = 0; i < floats->size(); ++i) {
+      (*floats)[i] = (static_cast<int>(i) - 512) / 64.0f;
+    }
+    cases.push_back({"FP32toFP16/1024", [floats, halves]() {
+                       for (size_t i = 0; i < floats->size(); ++i) {
+                         (*halves)[i] = FP32toFP16((*floats)[i]);
+                       }
+                       DoNotOptimize((*halves)[0]);
+                     }});
+    cases.push_back({"FP16toFP32/1024", [floats, halves]() {
+                       for (size_t i = 0; i < halves->size(); ++i) {
+                         (*floats)[i] = FP16toFP32((*halves)[i]);
+                       }
+                       DoNotOptimize((*floats)[0]);
+                     }});
+    cases.push_back({"ConvertFP32toFP16/1024", [floats, halves]() {
+                       ConvertFP32toFP16(floats->data(), halves->data(),
+                                         floats->size());
+                       DoNotOptimize((*halves)[0]);
+                     }});
+    cases.push_back({"ConvertFP16toFP32/1024", [floats, halves]() {
+                       ConvertFP16toFP32(halves->data(), floats->data(),
+                                         halves->size());
+                       DoNotOptimize((*floats)[0]);
+                     }});
+  }
+
+  // Caches, with a working set twice their capacity so that both hits and
+  // evictions happen.
+  {
+    constexpr int kCapacity = 100000;
+    auto cache = std::make_shared<HashKeyedCache<int>>(kCapacity);
+    auto key = std::make_shared<uint64_t>(0);
+    cases.push_back({"HashKeyedCache/insert+lookup", [cache, key]() {
+                       const uint64_t k =
+                           HashCat(0, ++*key % (2 * kCapacity));
+                       if (int* value = cache->LookupAndPin(k)) {
+                         DoNotOptimize(*value);
+                         cache->Unpin(k, value);
+                       } else {
+                         cache->Insert(k, std::make_unique<int>(1));
+                       }
+                     }});
+    auto clock_cache = std::make_shared<ClockCache<int>>(kCapacity);
+    cases.push_back({"ClockCache/insert+lookup", [clock_cache, key]() {
+                       const uint64_t k =
+                           HashCat(0, ++*key % (2 * kCapacity));
+                       if (!clock_cache->Lookup(k, [](const int& value) {
+                             DoNotOptimize(value);
+                             return true;
+                           })) {
+                         clock_cache->Insert(k, 1);
+                       }
+                     }});
+  }
+  return cases;
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, const char** argv) {
+  const std::string filter = argc > 1 ? argv[1] : "";
+  for (const auto& c : lczero::MakeCases()) {
+    if (c.name.find(filter) == std::string::npos) continue;
+    std::printf("%-32s %12.1f ns/op\n", c.name.c_str(),
+                lczero::NanosecondsPerOp(c.fn));
+    std::fflush(stdout);
+  }
+}
@@ -30,6 +30,7 @@
 #include <string>
 
 #include "neural/shared_params.h"
+#include "utils/exception.h"
 #include "utils/hashcat.h"
 
 namespace lczero {
@@ -51,6 +52,41 @@ std::vector<EvalResult> Backend::EvaluateBatch(
   return results;
 }
 
+void Backend::EvaluateBatch(std::span<const EvalPosition> positions,
+                            const EvalBatchBuffers& buffers) {
+  const size_t count = positions.size();
+  const bool with_policy = !buffers.p_offsets.empty();
+  if (buffers.q.size() < count ||
+      (!buffers.d.empty() && buffers.d.size() < count) ||
+      (!buffers.m.empty() && buffers.m.size() < count) ||
+      (with_policy && buffers.p_offsets.size() < count + 1)) {
+    throw Exception("Evaluation buffers are smaller than the batch");
+  }
+  if (with_policy) {
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+      buffers.p_offsets[i] = offset;
+      offset += positions[i].legal_moves.size();
+    }
+    buffers.p_offsets[count] = offset;
+    if (buffers.p.size() < offset) {
+      throw Exception("Policy buffer is smaller than the legal moves");
+    }
+  }
+  std::unique_ptr<BackendComputation> computation = CreateComputation();
+  for (size_t i = 0; i < count; ++i) {
+    computation->AddInput(
+        positions[i],
+        EvalResultPtr{
+            &buffers.q[i], buffers.d.empty() ? nullptr : &buffers.d[i],
+            buffers.m.empty() ? nullptr : &buffers.m[i],
+            with_policy ? buffers.p.subspan(buffers.p_offsets[i],
+                                            positions[i].legal_moves.size())
+                        : std::span<float>()});
+  }
+  computation->ComputeBlocking();
+}
+
 uint64_t Backend::ConfigurationHash(const OptionsDict& options) const {
   uint64_t hash = std::hash<std::string>{}(
       options.Get<std::string>(SharedBackendParams::kBackendId));
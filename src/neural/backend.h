@@ -39,6 +39,12 @@
 
 namespace lczero {
 
+// Measured time to evaluate a batch of the given size.
+struct BatchLatency {
+  int batch_size;
+  float seconds;
+};
+
 // Information about the backend or network that search may need.
 struct BackendAttributes {
   bool has_mlh;
@@ -47,6 +53,11 @@ struct BackendAttributes {
   int suggested_num_search_threads;
   int recommended_batch_size;
   int maximum_batch_size;
+  // Batch latencies sorted by batch size, if they were measured when the
+  // backend was created (see neural/warmup.h). Empty otherwise.
+  std::vector<BatchLatency> latency_profile = {};
+  // Device memory used by the backend, zero when it doesn't report it.
+  DeviceMemoryUsage device_memory = {};
 };
 
 struct EvalResultPtr {
@@ -72,6 +83,19 @@ struct EvalPosition {
   std::span<const Move> legal_moves;
 };
 
+// Caller provided buffers for the results of a batch, see
+// Backend::EvaluateBatch(). Values of the position i are at index i, its policy
+// is p[p_offsets[i]..p_offsets[i + 1]). Empty d or m are not fetched, empty p
+// and p_offsets skip the policy.
+struct EvalBatchBuffers {
+  std::span<float> q;
+  std::span<float> d = {};
+  std::span<float> m = {};
+  std::span<float> p = {};
+  // Filled by EvaluateBatch(), one element more than the positions.
+  std::span<size_t> p_offsets = {};
+};
+
 class BackendComputation {
  public:
   virtual ~BackendComputation() = default;
@@ -84,6 +108,27 @@ class BackendComputation {
       const EvalPosition& pos,    // Input position.
       EvalResultPtr result) = 0;  // Where to fetch data into.
   virtual void ComputeBlocking() = 0;
+
+  // Non-blocking counterpart of ComputeBlocking(). Starts the computation and
+  // returns immediately, the results are populated by the time Wait() returns.
+  // AddInput() must not be called after ComputeAsync(). The default
+  // implementation just computes synchronously.
+  virtual void ComputeAsync() { ComputeBlocking(); }
+  // Returns true when the computation started with ComputeAsync() is finished,
+  // i.e. Wait() would not block.
+  virtual bool IsReady() const { return true; }
+  // Blocks until the computation started with ComputeAsync() is finished.
+  virtual void Wait() {}
+
+  // Sets the priority class of the computation. Should be called before the
+  // inputs are added, backends which don't share the device ignore it.
+  virtual void SetPriority(ComputationPriority /*priority*/) {}
+
+  // Restricts the heads computed for the batch, e.g. for value-only requests.
+  // Should be called before the inputs are added. Results of the skipped heads
+  // are left untouched. Heads which no input asks for (null m or empty p in
+  // EvalResultPtr) may be skipped by backends even without this call.
+  virtual void SetRequiredHeads(EvalHeads /*heads*/) {}
 };
 
 class Backend {
@@ -96,6 +141,10 @@ class Backend {
   // creating a computation explicitly.
   virtual std::vector<EvalResult> EvaluateBatch(
       std::span<const EvalPosition> positions);
+  // Same, but writes the results into @buffers without allocating memory per
+  // position. Throws if the buffers are too small.
+  virtual void EvaluateBatch(std::span<const EvalPosition> positions,
+                             const EvalBatchBuffers& buffers);
   // Returns the evaluation if it's possible to do immediately.
   virtual std::optional<EvalResult> GetCachedEvaluation(const EvalPosition&) {
     return std::nullopt;
@@ -18,10 +18,12 @@
 
 #include "neural/backends/blas/fully_connected_layer.h"
 #include "neural/backends/blas/blas.h"
+#include "utils/exception.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <utility>
 
 #include <Eigen/Dense>
 
@@ -118,6 +120,72 @@ float FullyConnectedLayer<false>::Forward0D(const size_t size, const float* x,
 }
 #endif
 
+bool PackedWeights::IsSupported() {
+#ifdef USE_MKL
+  return true;
+#else
+  return false;
+#endif
+}
+
+PackedWeights::PackedWeights([[maybe_unused]] const float* weights,
+                             size_t input_size, size_t output_size,
+                             [[maybe_unused]] size_t max_batch_size)
+    : input_size_(input_size), output_size_(output_size) {
+#ifdef USE_MKL
+  // Same product as in FullyConnectedLayer<false>::Forward1D(), with the
+  // weights being matrix A.
+  data_ = cblas_sgemm_alloc(CblasAMatrix, (int)output_size,
+                            (int)max_batch_size, (int)input_size);
+  if (data_ == nullptr) throw Exception("Failed to allocate packed weights");
+  cblas_sgemm_pack(CblasColMajor, CblasAMatrix, CblasTrans, (int)output_size,
+                   (int)max_batch_size, (int)input_size, 1.0f, weights,
+                   (int)input_size, data_);
+#endif
+}
+
+PackedWeights::~PackedWeights() {
+#ifdef USE_MKL
+  if (data_) cblas_sgemm_free(data_);
+#endif
+}
+
+PackedWeights::PackedWeights(PackedWeights&& other) noexcept {
+  *this = std::move(other);
+}
+
+PackedWeights& PackedWeights::operator=(PackedWeights&& other) noexcept {
+  std::swap(data_, other.data_);
+  std::swap(input_size_, other.input_size_);
+  std::swap(output_size_, other.output_size_);
+  return *this;
+}
+
+void PackedWeights::Forward1D([[maybe_unused]] size_t batch_size,
+                              [[maybe_unused]] const float* inputs,
+                              [[maybe_unused]] const float* biases,
+                              [[maybe_unused]] ActivationFunction activation,
+                              [[maybe_unused]] float* outputs) const {
+#ifdef USE_MKL
+  cblas_sgemm_compute(CblasColMajor, CblasPacked, CblasNoTrans,
+                      (int)output_size_,  // M
+                      (int)batch_size,    // N
+                      (int)input_size_,   // K
+                      data_,              // A, packed
+                      (int)input_size_,   // lda, ignored for packed A
+                      inputs,             // B
+                      (int)input_size_,   // ldb
+                      0.0f,               // beta
+                      outputs,            // C
+                      (int)output_size_);  // ldc
+  if (biases != nullptr) {
+    ApplyBias(batch_size, output_size_, biases, activation, outputs);
+  }
+#else
+  throw Exception("Packed weights are not supported");
+#endif
+}
+
 template <>
 void FullyConnectedLayer<true>::Forward1D(
     size_t batch_size, const size_t input_size, const size_t output_size,
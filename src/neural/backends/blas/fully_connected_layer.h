@@ -42,4 +42,33 @@ class FullyConnectedLayer {
 
 };
 
+// Fully connected layer weights repacked once at load time into the internal
+// GEMM layout of the BLAS library, so that it doesn't repack them on every
+// call. Only supported with MKL, elsewhere stays empty.
+class PackedWeights {
+ public:
+  PackedWeights() = default;
+  // @max_batch_size is the largest number of rows the weights will be
+  // multiplied with.
+  PackedWeights(const float* weights, size_t input_size, size_t output_size,
+                size_t max_batch_size);
+  ~PackedWeights();
+  PackedWeights(PackedWeights&& other) noexcept;
+  PackedWeights& operator=(PackedWeights&& other) noexcept;
+  PackedWeights(const PackedWeights&) = delete;
+  PackedWeights& operator=(const PackedWeights&) = delete;
+
+  static bool IsSupported();
+  bool empty() const { return data_ == nullptr; }
+
+  // Same as FullyConnectedLayer<false>::Forward1D() with the packed weights.
+  void Forward1D(size_t batch_size, const float* input, const float* biases,
+                 ActivationFunction activation, float* output) const;
+
+ private:
+  float* data_ = nullptr;
+  size_t input_size_ = 0;
+  size_t output_size_ = 0;
+};
+
 }  // namespace lczero
@@ -0,0 +1,123 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/backends/blas/int8_fully_connected_layer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace lczero {
+namespace {
+
+constexpr float kInt8Max = 127.0f;
+// Input rows processed together, so that every weight row loaded from memory
+// is reused several times.
+constexpr size_t kRowBlock = 4;
+
+// Quantizes @size values to int8 and returns the scale to dequantize them.
+float QuantizeRow(size_t size, const float* input, int8_t* output) {
+  float amax = 0.0f;
+  for (size_t i = 0; i < size; i++) amax = std::max(amax, std::abs(input[i]));
+  if (amax == 0.0f) {
+    std::fill(output, output + size, 0);
+    return 0.0f;
+  }
+  const float inv_scale = kInt8Max / amax;
+  for (size_t i = 0; i < size; i++) {
+    output[i] = static_cast<int8_t>(std::lrint(input[i] * inv_scale));
+  }
+  return amax / kInt8Max;
+}
+
+// Written as a plain loop over widened operands, which compilers turn into
+// pmaddwd, or into the VNNI dot product instructions when they are enabled.
+int32_t DotProduct(size_t size, const int8_t* a, const int8_t* b) {
+  int32_t sum = 0;
+  for (size_t i = 0; i < size; i++) {
+    sum += static_cast<int16_t>(a[i]) * static_cast<int16_t>(b[i]);
+  }
+  return sum;
+}
+
+}  // namespace
+
+Int8Weights Int8FullyConnectedLayer::Quantize(const std::vector<float>& weights,
+                                              size_t input_size,
+                                              size_t output_size) {
+  assert(weights.size() == input_size * output_size);
+  Int8Weights result;
+  result.input_size = input_size;
+  result.output_size = output_size;
+  result.weights.resize(input_size * output_size);
+  result.scales.resize(output_size);
+  for (size_t o = 0; o < output_size; o++) {
+    result.scales[o] = QuantizeRow(input_size, &weights[o * input_size],
+                                   &result.weights[o * input_size]);
+  }
+  return result;
+}
+
+void Int8FullyConnectedLayer::Forward1D(size_t batch_size, const float* input,
+                                        const Int8Weights& weights,
+                                        const float* biases,
+                                        ActivationFunction activation,
+                                        float* output,
+                                        std::vector<int8_t>* scratch) {
+  const size_t input_size = weights.input_size;
+  const size_t output_size = weights.output_size;
+  if (scratch->size() < batch_size * input_size) {
+    scratch->resize(batch_size * input_size);
+  }
+  int8_t* quantized = scratch->data();
+  float input_scales[kRowBlock];
+
+  for (size_t start = 0; start < batch_size; start += kRowBlock) {
+    const size_t rows = std::min(kRowBlock, batch_size - start);
+    for (size_t r = 0; r < rows; r++) {
+      input_scales[r] =
+          QuantizeRow(input_size, &input[(start + r) * input_size],
+                      &quantized[(start + r) * input_size]);
+    }
+    for (size_t o = 0; o < output_size; o++) {
+      const int8_t* w = &weights.weights[o * input_size];
+      for (size_t r = 0; r < rows; r++) {
+        const int32_t sum =
+            DotProduct(input_size, &quantized[(start + r) * input_size], w);
+        output[(start + r) * output_size + o] =
+            static_cast<float>(sum) * input_scales[r] * weights.scales[o];
+      }
+    }
+    for (size_t r = 0; r < rows; r++) {
+      float* batch_output = &output[(start + r) * output_size];
+      Activate(output_size, batch_output, biases, batch_output, activation);
+    }
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,65 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "neural/backends/shared/activation.h"
+
+namespace lczero {
+
+// Weights of a fully connected layer quantized to int8, with one scale per
+// output channel. The layout is [output][input], same as for fp32 weights.
+struct Int8Weights {
+  std::vector<int8_t> weights;
+  std::vector<float> scales;
+  size_t input_size = 0;
+  size_t output_size = 0;
+};
+
+class Int8FullyConnectedLayer {
+ public:
+  Int8FullyConnectedLayer() = delete;
+
+  // Quantizes fp32 weights symmetrically, output channel by output channel.
+  static Int8Weights Quantize(const std::vector<float>& weights,
+                              size_t input_size, size_t output_size);
+
+  // Forward inference, batched. Every input row is quantized on the fly with
+  // its own scale into @scratch, products are accumulated in int32 and scaled
+  // back to fp32 before bias and activation are applied.
+  static void Forward1D(size_t batch_size, const float* input,
+                        const Int8Weights& weights, const float* biases,
+                        ActivationFunction activation, float* output,
+                        std::vector<int8_t>* scratch);
+};
+
+}  // namespace lczero
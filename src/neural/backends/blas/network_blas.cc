@@ -26,9 +26,11 @@
 #include "neural/backends/blas/convolution1.h"
 #include "neural/backends/blas/encoder.h"
 #include "neural/backends/blas/fully_connected_layer.h"
+#include "neural/backends/blas/int8_fully_connected_layer.h"
 #include "neural/backends/blas/se_unit.h"
 #include "neural/backends/blas/winograd_convolution3.h"
 #include "neural/backends/shared/activation.h"
+#include "neural/backends/shared/weights_cache.h"
 #include "neural/backends/shared/winograd_filter.h"
 #include "neural/factory.h"
 #include "neural/network.h"
@@ -36,6 +38,7 @@
 #include "neural/tables/attention_policy_map.h"
 #include "neural/tables/policy_map.h"
 #include "utils/numa.h"
+#include "utils/worker_pool.h"
 
 #ifdef USE_DNNL
 #include <omp.h>
@@ -43,6 +46,7 @@
 
 #ifdef USE_ISPC
 #include "activation_ispc.h"
+#include "attention_ispc.h"
 #endif
 
 namespace lczero {
@@ -53,6 +57,26 @@ struct Buffers {
   std::vector<float> buffer2;
   std::vector<float> buffer3;
   std::vector<float> buffer4;
+  // Quantized inputs of int8 layers.
+  std::vector<int8_t> quantized;
+};
+
+// Weights of a dense layer converted at load time, either quantized to int8
+// or packed for the BLAS library.
+struct PreparedDense {
+  Int8Weights int8;
+  PackedWeights packed;
+};
+
+// Dense layers of an encoder layer prepared at load time. Layer norms, skip
+// connections and smolgen stay in fp32.
+struct PreparedEncoderLayer {
+  PreparedDense q;
+  PreparedDense k;
+  PreparedDense v;
+  PreparedDense dense;
+  PreparedDense ffn1;
+  PreparedDense ffn2;
 };
 
 template <bool use_eigen>
@@ -116,14 +140,27 @@ class BlasComputation : public NetworkComputation {
     return policies_[sample][move_id];
   }
 
+  void SetRequiredHeads(EvalHeads heads) override { heads_ = heads; }
+
  private:
   void EncodePlanes(const InputPlanes& sample, float* buffer);
+  // Computes samples [@begin, @end) of the batch using @buffers as scratch.
+  void ComputeRange(size_t begin, size_t end, Buffers* buffers);
   void ForwardEncoderLayer(
       std::vector<float>& encoder_buffer, std::vector<float>& encoder_buffer2,
       std::vector<float>& encoder_buffer3, std::vector<float>& encoder_buffer4,
       size_t batch_size, const MultiHeadWeights::EncoderLayer& layer,
+      const PreparedEncoderLayer* prepared, std::vector<int8_t>& quantized,
       int embedding_size, int heads, ActivationFunction smolgen_activation,
       ActivationFunction ffn_activation, float alpha, float default_eps);
+  // Uses the prepared weights of the layer if @prepared is not null.
+  static void ForwardDense(size_t batch_size, size_t input_size,
+                           size_t output_size, const float* input,
+                           const std::vector<float>& weights,
+                           const std::vector<float>& biases,
+                           const PreparedDense* prepared,
+                           ActivationFunction activation, float* output,
+                           std::vector<int8_t>& quantized);
 
   static constexpr auto kWidth = 8;
   static constexpr auto kHeight = 8;
@@ -137,6 +174,7 @@ class BlasComputation : public NetworkComputation {
   size_t max_batch_size_;
   std::vector<InputPlanes> planes_;
   std::vector<std::vector<float>> policies_;
+  EvalHeads heads_;
   std::vector<float> q_values_;
   std::vector<float> m_values_;
   bool wdl_;
@@ -170,11 +208,33 @@ class BlasNetwork : public Network {
     return capabilities_;
   }
 
-  int GetMiniBatchSize() const override { return 7; }
+  int GetMiniBatchSize() const override {
+    // Give every worker a share of the batch.
+    return 7 * (worker_pool_ ? worker_pool_->GetSize() : 1);
+  }
 
   bool IsCpu() const override { return true; }
 
-  void InitThread(int id) override { Numa::BindThread(id); }
+  bool UpdateWeights(const WeightsFile& file) override;
+
+  void InitThread(int id) override {
+    // Processors are reserved for the workers if there are any.
+    if (!worker_pool_) Numa::BindThread(id);
+  }
+
+  // Null unless intra-batch workers are enabled.
+  WorkerPool* GetWorkerPool() { return worker_pool_.get(); }
+
+  // Buffers owned by a worker, only used from that worker's thread.
+  Buffers* GetWorkerBuffers(int worker) {
+    return worker_buffers_[worker].get();
+  }
+
+  // Prepared body encoder layers, empty unless int8 mode or weight packing
+  // is enabled.
+  const std::vector<PreparedEncoderLayer>& GetPreparedEncoder() const {
+    return prepared_encoder_;
+  }
 
   std::unique_ptr<Buffers> GetBuffers() {
     std::lock_guard<std::mutex> lock(buffers_lock_);
@@ -196,7 +256,16 @@ class BlasNetwork : public Network {
   // A cap on the max batch size since it consumes a lot of memory
   static constexpr auto kHardMaxBatchSize = 2048;
 
+  // Converts the weights to the layout used by the computation, and prepares
+  // the encoder layers in int8 or packed mode.
+  void PrepareWeights(
+      MultiHeadWeights* weights,
+      std::vector<PreparedEncoderLayer>* prepared_encoder) const;
+
   const NetworkCapabilities capabilities_;
+  // Serialized format of the network, weights can only be updated to a
+  // network of the same format.
+  const std::string format_;
   MultiHeadWeights weights_;
   size_t max_batch_size_;
   bool wdl_;
@@ -210,8 +279,15 @@ class BlasNetwork : public Network {
   ActivationFunction ffn_activation_;
   std::string policy_head_;
   std::string value_head_;
+  bool int8_;
+  bool pack_weights_;
+  std::string weights_cache_;
   std::mutex buffers_lock_;
   std::vector<std::unique_ptr<Buffers>> free_buffers_;
+  std::vector<PreparedEncoderLayer> prepared_encoder_;
+  std::vector<std::unique_ptr<Buffers>> worker_buffers_;
+  // Declared last to stop the workers before anything they use is destroyed.
+  std::unique_ptr<WorkerPool> worker_pool_;
 };
 
 template <bool use_eigen>
@@ -266,11 +342,34 @@ void vec_adjust(std::vector<float>& vec, size_t size) {
   }
 }
 
+template <bool use_eigen>
+void BlasComputation<use_eigen>::ForwardDense(
+    size_t batch_size, size_t input_size, size_t output_size,
+    const float* input, const std::vector<float>& weights,
+    const std::vector<float>& biases, const PreparedDense* prepared,
+    ActivationFunction activation, float* output,
+    std::vector<int8_t>& quantized) {
+  if (prepared && !prepared->int8.weights.empty()) {
+    Int8FullyConnectedLayer::Forward1D(batch_size, input, prepared->int8,
+                                       biases.data(), activation, output,
+                                       &quantized);
+  } else if (prepared && !prepared->packed.empty()) {
+    prepared->packed.Forward1D(batch_size, input, biases.data(), activation,
+                               output);
+  } else {
+    FullyConnectedLayer<use_eigen>::Forward1D(batch_size, input_size,
+                                              output_size, input,
+                                              weights.data(), biases.data(),
+                                              activation, output);
+  }
+}
+
 template <bool use_eigen>
 void BlasComputation<use_eigen>::ForwardEncoderLayer(
     std::vector<float>& encoder_buffer, std::vector<float>& encoder_buffer2,
     std::vector<float>& encoder_buffer3, std::vector<float>& encoder_buffer4,
     size_t batch_size, const MultiHeadWeights::EncoderLayer& layer,
+    const PreparedEncoderLayer* prepared, std::vector<int8_t>& quantized,
     int embedding_size, int heads, ActivationFunction smolgen_activation,
     ActivationFunction ffn_activation, float alpha, float default_eps) {
   const int d_model = layer.mha.q_b.size();
@@ -337,15 +436,15 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
   }
 
   // Q
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, encoder_buffer.data(),
-      layer.mha.q_w.data(), layer.mha.q_b.data(), ACTIVATION_NONE,
-      encoder_buffer2.data());
+  ForwardDense(batch_size * kSquares, embedding_size, d_model,
+               encoder_buffer.data(), layer.mha.q_w, layer.mha.q_b,
+               prepared ? &prepared->q : nullptr, ACTIVATION_NONE,
+               encoder_buffer2.data(), quantized);
   // K
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, encoder_buffer.data(),
-      layer.mha.k_w.data(), layer.mha.k_b.data(), ACTIVATION_NONE,
-      encoder_buffer3.data());
+  ForwardDense(batch_size * kSquares, embedding_size, d_model,
+               encoder_buffer.data(), layer.mha.k_w, layer.mha.k_b,
+               prepared ? &prepared->k : nullptr, ACTIVATION_NONE,
+               encoder_buffer3.data(), quantized);
 
   // MHA (Q, K, V)
   const int depth = d_model / heads;
@@ -388,26 +487,22 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
 #endif
       }
     }
-  }
 
-  // Apply Softmax.
-  float* QK = &encoder_buffer4[0];
-  for (size_t h = 0; h < batch_size * heads * kSquares * kSquares;
-       h += kSquares) {
+    // Softmax of all heads of the sample.
 #if defined(USE_ISPC)
-    if (!use_eigen) {
-      ispc::SoftmaxActivation(kSquares, QK + h, QK + h);
-      continue;
+    ispc::AttentionSoftmax(heads * kSquares, kSquares, QK);
+#else
+    for (auto row = 0; row < heads * kSquares; row++) {
+      SoftmaxActivation(kSquares, QK + row * kSquares, QK + row * kSquares);
     }
 #endif
-    SoftmaxActivation(kSquares, QK + h, QK + h);
   }
 
   // V
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, encoder_buffer.data(),
-      layer.mha.v_w.data(), layer.mha.v_b.data(), ACTIVATION_NONE,
-      encoder_buffer3.data());
+  ForwardDense(batch_size * kSquares, embedding_size, d_model,
+               encoder_buffer.data(), layer.mha.v_w, layer.mha.v_b,
+               prepared ? &prepared->v : nullptr, ACTIVATION_NONE,
+               encoder_buffer3.data(), quantized);
 
   for (auto batch = size_t{0}; batch < batch_size; batch++) {
     auto batchStart = batch * kSquares * d_model;
@@ -437,10 +532,10 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
   }
 
   // Fully connected final MHA layer.
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, d_model, embedding_size, encoder_buffer2.data(),
-      layer.mha.dense_w.data(), layer.mha.dense_b.data(), ACTIVATION_NONE,
-      encoder_buffer3.data());
+  ForwardDense(batch_size * kSquares, d_model, embedding_size,
+               encoder_buffer2.data(), layer.mha.dense_w, layer.mha.dense_b,
+               prepared ? &prepared->dense : nullptr, ACTIVATION_NONE,
+               encoder_buffer3.data(), quantized);
 
   // Layer Norm + skip connection.
   LayerNorm2DWithSkipConnection(batch_size * kSquares, embedding_size,
@@ -450,15 +545,15 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
   std::swap(encoder_buffer3, encoder_buffer);
 
   // FFN.
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, dff_size, encoder_buffer.data(),
-      layer.ffn.dense1_w.data(), layer.ffn.dense1_b.data(), ffn_activation,
-      encoder_buffer4.data());
+  ForwardDense(batch_size * kSquares, embedding_size, dff_size,
+               encoder_buffer.data(), layer.ffn.dense1_w, layer.ffn.dense1_b,
+               prepared ? &prepared->ffn1 : nullptr, ffn_activation,
+               encoder_buffer4.data(), quantized);
 
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, dff_size, layer.ffn.dense2_b.size(),
-      encoder_buffer4.data(), layer.ffn.dense2_w.data(),
-      layer.ffn.dense2_b.data(), ACTIVATION_NONE, encoder_buffer3.data());
+  ForwardDense(batch_size * kSquares, dff_size, layer.ffn.dense2_b.size(),
+               encoder_buffer4.data(), layer.ffn.dense2_w, layer.ffn.dense2_b,
+               prepared ? &prepared->ffn2 : nullptr, ACTIVATION_NONE,
+               encoder_buffer3.data(), quantized);
 
   // Layer Norm + skip connection.
   LayerNorm2DWithSkipConnection(batch_size * kSquares, embedding_size,
@@ -470,6 +565,31 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
 
 template <bool use_eigen>
 void BlasComputation<use_eigen>::ComputeBlocking() {
+  const auto total_batches = planes_.size();
+  q_values_.resize(wdl_ ? 3 * total_batches : total_batches);
+  policies_.resize(total_batches);
+  if (moves_left_) m_values_.resize(total_batches);
+
+  WorkerPool* pool = network_->GetWorkerPool();
+  const size_t num_parts =
+      pool ? std::min(static_cast<size_t>(pool->GetSize()), total_batches) : 1;
+  if (num_parts <= 1) {
+    std::unique_ptr<Buffers> buffers = network_->GetBuffers();
+    ComputeRange(0, total_batches, buffers.get());
+    network_->ReleaseBuffers(std::move(buffers));
+    return;
+  }
+  // Split the batch evenly, every worker uses its own buffers.
+  pool->Run(static_cast<int>(num_parts), [&](int worker) {
+    const size_t begin = total_batches * worker / num_parts;
+    const size_t end = total_batches * (worker + 1) / num_parts;
+    ComputeRange(begin, end, network_->GetWorkerBuffers(worker));
+  });
+}
+
+template <bool use_eigen>
+void BlasComputation<use_eigen>::ComputeRange(size_t begin, size_t end,
+                                              Buffers* buffers) {
   const auto& value_head = weights_.value_heads.at(value_head_);
   const auto& policy_head = weights_.policy_heads.at(policy_head_);
   // Retrieve network key dimensions from the weights structure.
@@ -508,8 +628,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
           : output_channels;
 
   // Determine the largest batch for allocations.
-  const auto total_batches = planes_.size();
-  const auto largest_batch_size = std::min(max_batch_size_, total_batches);
+  const auto largest_batch_size = std::min(max_batch_size_, end - begin);
 
   /* Typically
    input_channels = 112
@@ -532,8 +651,6 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                                policy_head.ip_pol_b.size());
   }
 
-  std::unique_ptr<Buffers> buffers = network_->GetBuffers();
-
   // Allocate data for the whole batch.
   std::vector<float>& buffer1 = buffers->buffer1;
   vec_adjust(buffer1, largest_batch_size * max_channels * kSquares);
@@ -545,16 +662,11 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
   std::vector<float>& head_buffer = buffers->buffer4;
   vec_adjust(head_buffer, largest_batch_size * max_head_planes * kSquares);
 
-  // Output values.
-  q_values_.reserve(wdl_ ? 3 * total_batches : total_batches);
-  policies_.reserve(total_batches);
-  if (moves_left_) m_values_.resize(total_batches);
-
   WinogradConvolution3<use_eigen> convolve3(largest_batch_size, max_channels,
                                             max_output_channels);
 
-  for (size_t start = 0; start < total_batches; start += largest_batch_size) {
-    const auto batch_size = std::min(total_batches - start, largest_batch_size);
+  for (size_t start = begin; start < end; start += largest_batch_size) {
+    const auto batch_size = std::min(end - start, largest_batch_size);
     for (size_t j = 0; j < batch_size; j++) {
       EncodePlanes(planes_[start + j], &buffer1[j * kSquares * kInputPlanes]);
     }
@@ -710,11 +822,15 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       }
 
       // Attention body encoders.
-      for (auto& layer : weights_.encoder) {
-        ForwardEncoderLayer(buffer1, buffer2, buffer3, head_buffer, batch_size,
-                            layer, embedding_size, weights_.encoder_head_count,
-                            smolgen_activation_, ffn_activation_, alpha,
-                            is_pe_dense_embedding_ ? 1e-3 : 1e-6);
+      const auto& prepared_encoder = network_->GetPreparedEncoder();
+      for (size_t i = 0; i < weights_.encoder.size(); i++) {
+        ForwardEncoderLayer(
+            buffer1, buffer2, buffer3, head_buffer, batch_size,
+            weights_.encoder[i],
+            prepared_encoder.empty() ? nullptr : &prepared_encoder[i],
+            buffers->quantized, embedding_size, weights_.encoder_head_count,
+            smolgen_activation_, ffn_activation_, alpha,
+            is_pe_dense_embedding_ ? 1e-3 : 1e-6);
       }
     }
 
@@ -754,9 +870,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
         std::vector<float> wdl_softmax(3);
         SoftmaxActivation(3, &wdl[j * 3], wdl_softmax.data());
 
-        q_values_.emplace_back(wdl_softmax[0]);
-        q_values_.emplace_back(wdl_softmax[1]);
-        q_values_.emplace_back(wdl_softmax[2]);
+        q_values_[3 * (start + j) + 0] = wdl_softmax[0];
+        q_values_[3 * (start + j) + 1] = wdl_softmax[1];
+        q_values_[3 * (start + j) + 2] = wdl_softmax[2];
       }
     } else {
       for (size_t j = 0; j < batch_size; j++) {
@@ -765,12 +881,12 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                              &buffer3[j * num_value_channels]) +
                          value_head.ip2_val_b[0];
 
-        q_values_.emplace_back(std::tanh(winrate));
+        q_values_[start + j] = std::tanh(winrate);
       }
     }
 
     // Moves left head.
-    if (moves_left_) {
+    if (moves_left_ && heads_.moves_left) {
       if (attn_body_) {
         FullyConnectedLayer<use_eigen>::Forward1D(
             batch_size * kSquares, weights_.ip_emb_b.size(),
@@ -800,7 +916,8 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
           &m_values_[start]);
     }
 
-    // Policy head.
+    // Policy head, the last one.
+    if (!heads_.policy) continue;
     if (attn_policy_) {
       if (!attn_body_) {
         // NCHW to NHWC conversion.
@@ -830,7 +947,8 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       for (auto& layer : policy_head.pol_encoder) {
         ForwardEncoderLayer(
             buffer2, buffer1, buffer3, head_buffer, batch_size, layer,
-            policy_embedding_size, policy_head.pol_encoder_head_count,
+            nullptr, buffers->quantized, policy_embedding_size,
+            policy_head.pol_encoder_head_count,
             attn_body_ ? smolgen_activation_ : ACTIVATION_NONE,
             attn_body_ ? ffn_activation_ : ACTIVATION_SELU, 1.0f, 1e-6);
       }
@@ -908,7 +1026,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
             policy[j] = head_buffer[batch * (64 * 64 + 8 * 24) + i];
           }
         }
-        policies_.emplace_back(std::move(policy));
+        policies_[start + batch] = std::move(policy);
       }
     } else if (conv_policy_) {
       assert(!attn_body_);  // not supported with attention body
@@ -936,7 +1054,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                 head_buffer[batch * num_policy_input_planes * kSquares + i];
           }
         }
-        policies_.emplace_back(std::move(policy));
+        policies_[start + batch] = std::move(policy);
       }
 
     } else {
@@ -961,11 +1079,10 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
         // Get the moves
         policy.assign(buffer3.begin() + j * num_output_policy,
                       buffer3.begin() + (j + 1) * num_output_policy);
-        policies_.emplace_back(std::move(policy));
+        policies_[start + j] = std::move(policy);
       }
     }
   }
-  network_->ReleaseBuffers(std::move(buffers));
 }
 
 template <bool use_eigen>
@@ -984,6 +1101,7 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
     : capabilities_{file.format().network_format().input(),
                     file.format().network_format().output(),
                     file.format().network_format().moves_left()},
+      format_(file.format().OutputAsString()),
       weights_(file.weights()) {
   Numa::Init();
 
@@ -1028,23 +1146,6 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
     max_batch_size_ = kHardMaxBatchSize;
   }
 
-  const auto inputChannels = kInputPlanes;
-  const auto channels = static_cast<int>(weights_.input.biases.size());
-  const auto residual_blocks = weights_.residual.size();
-
-  weights_.input.weights =
-      WinogradFilterTransformF(weights_.input.weights, channels, inputChannels);
-
-  // residual blocks
-  for (size_t i = 0; i < residual_blocks; i++) {
-    auto& residual = weights_.residual[i];
-    auto& conv1 = residual.conv1;
-    auto& conv2 = residual.conv2;
-
-    conv1.weights = WinogradFilterTransformF(conv1.weights, channels, channels);
-    conv2.weights = WinogradFilterTransformF(conv2.weights, channels, channels);
-  }
-
   policy_head_ = options.GetOrDefault<std::string>("policy_head", "vanilla");
   // Check that selected policy head exists.
   if (weights_.policy_heads.count(policy_head_) == 0) {
@@ -1059,13 +1160,32 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
                     "' does not exist in this net.");
   }
 
-  if (conv_policy_) {
-    auto& policy_head = weights_.policy_heads.at("vanilla");
-    policy_head.policy1.weights = WinogradFilterTransformF(
-        policy_head.policy1.weights, channels, channels);
-    auto pol_channels = policy_head.policy.biases.size();
-    policy_head.policy.weights = WinogradFilterTransformF(
-        policy_head.policy.weights, pol_channels, channels);
+  int8_ = options.GetOrDefault<bool>("int8", false);
+  weights_cache_ = options.GetOrDefault<std::string>("weights_cache", "");
+  // Int8 layers don't go through the BLAS library.
+  pack_weights_ = !use_eigen && !int8_ && PackedWeights::IsSupported() &&
+                  options.GetOrDefault<bool>("pack_weights", true);
+  if (int8_ && !attn_body_) {
+    CERR << "Int8 mode only quantizes attention body encoders, ignoring.";
+  }
+  PrepareWeights(&weights_, &prepared_encoder_);
+
+  const int workers = options.GetOrDefault<int>("workers", 0);
+  if (workers > 1) {
+    const bool affinity = options.GetOrDefault<bool>("worker_affinity", true);
+    for (int i = 0; i < workers; i++) {
+      worker_buffers_.push_back(std::make_unique<Buffers>());
+    }
+    // Buffers are first touched on the worker thread, so with affinity their
+    // memory ends up on the worker's NUMA node.
+    worker_pool_ = std::make_unique<WorkerPool>(workers, [affinity](int id) {
+      if (affinity) Numa::BindThreadToCpu(id);
+#ifdef USE_DNNL
+      omp_set_num_threads(1);
+#endif
+    });
+    CERR << "Splitting batches across " << workers << " worker threads"
+         << (affinity ? " bound to processors." : ".");
   }
 
   if (use_eigen) {
@@ -1109,6 +1229,140 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
   }
 }
 
+template <bool use_eigen>
+void BlasNetwork<use_eigen>::PrepareWeights(
+    MultiHeadWeights* weights,
+    std::vector<PreparedEncoderLayer>* prepared_encoder) const {
+  MultiHeadWeights& w = *weights;
+  const auto inputChannels = kInputPlanes;
+  const auto channels = static_cast<int>(w.input.biases.size());
+  const auto residual_blocks = w.residual.size();
+
+  // Transformed and quantized weights can be cached on disk, keyed by their
+  // source weights.
+  WeightsCache cache(weights_cache_,
+                     use_eigen ? "eigen" : "blas");
+  cache.AddToKey(int8_);
+  cache.AddToKey(w.input.weights);
+  for (const auto& residual : w.residual) {
+    cache.AddToKey(residual.conv1.weights);
+    cache.AddToKey(residual.conv2.weights);
+  }
+  if (conv_policy_) {
+    const auto& policy_head = w.policy_heads.at("vanilla");
+    cache.AddToKey(policy_head.policy1.weights);
+    cache.AddToKey(policy_head.policy.weights);
+  }
+  if (int8_ && attn_body_) {
+    for (const auto& layer : w.encoder) {
+      cache.AddToKey(layer.mha.q_w);
+      cache.AddToKey(layer.mha.k_w);
+      cache.AddToKey(layer.mha.v_w);
+      cache.AddToKey(layer.mha.dense_w);
+      cache.AddToKey(layer.ffn.dense1_w);
+      cache.AddToKey(layer.ffn.dense2_w);
+    }
+  }
+
+  auto winograd_transform = [&](const std::string& name,
+                                std::vector<float>* weights, size_t outputs,
+                                size_t inputs) {
+    if (cache.Get(name, weights)) return;
+    *weights = WinogradFilterTransformF(*weights, outputs, inputs);
+    cache.Put(name, *weights);
+  };
+
+  winograd_transform("input", &w.input.weights, channels,
+                     inputChannels);
+
+  // residual blocks
+  for (size_t i = 0; i < residual_blocks; i++) {
+    auto& residual = w.residual[i];
+    const std::string name = "residual." + std::to_string(i);
+    winograd_transform(name + ".conv1", &residual.conv1.weights, channels,
+                       channels);
+    winograd_transform(name + ".conv2", &residual.conv2.weights, channels,
+                       channels);
+  }
+
+  if (conv_policy_) {
+    auto& policy_head = w.policy_heads.at("vanilla");
+    winograd_transform("policy1", &policy_head.policy1.weights, channels,
+                       channels);
+    auto pol_channels = policy_head.policy.biases.size();
+    winograd_transform("policy", &policy_head.policy.weights, pol_channels,
+                       channels);
+  }
+
+  if (int8_ || pack_weights_) {
+    // Dense layers of the body are applied to every square.
+    const size_t max_rows = max_batch_size_ * 64;
+    auto prepare = [&](const std::string& name,
+                       const std::vector<float>& weights, size_t input_size,
+                       size_t output_size) {
+      PreparedDense result;
+      if (int8_) {
+        Int8Weights& quantized = result.int8;
+        if (cache.Get(name + ".weights", &quantized.weights) &&
+            cache.Get(name + ".scales", &quantized.scales)) {
+          quantized.input_size = input_size;
+          quantized.output_size = output_size;
+          return result;
+        }
+        quantized = Int8FullyConnectedLayer::Quantize(weights, input_size,
+                                                      output_size);
+        cache.Put(name + ".weights", quantized.weights);
+        cache.Put(name + ".scales", quantized.scales);
+      } else {
+        result.packed = PackedWeights(weights.data(), input_size, output_size,
+                                      max_rows);
+      }
+      return result;
+    };
+    for (size_t i = 0; i < w.encoder.size(); i++) {
+      const auto& layer = w.encoder[i];
+      const std::string name = "encoder." + std::to_string(i);
+      const size_t embedding_size = layer.ln1_betas.size();
+      const size_t d_model = layer.mha.q_b.size();
+      const size_t dff_size = layer.ffn.dense1_b.size();
+      PreparedEncoderLayer& prepared = prepared_encoder->emplace_back();
+      prepared.q = prepare(name + ".q", layer.mha.q_w, embedding_size, d_model);
+      prepared.k = prepare(name + ".k", layer.mha.k_w, embedding_size, d_model);
+      prepared.v = prepare(name + ".v", layer.mha.v_w, embedding_size, d_model);
+      prepared.dense =
+          prepare(name + ".dense", layer.mha.dense_w, d_model, embedding_size);
+      prepared.ffn1 =
+          prepare(name + ".ffn1", layer.ffn.dense1_w, embedding_size, dff_size);
+      prepared.ffn2 = prepare(name + ".ffn2", layer.ffn.dense2_w, dff_size,
+                              layer.ffn.dense2_b.size());
+    }
+    if (!prepared_encoder->empty()) {
+      CERR << (int8_ ? "Quantized " : "Packed ") << prepared_encoder->size()
+           << (int8_ ? " encoder layers to int8."
+                     : " encoder layers for BLAS.");
+    }
+  }
+  cache.Save();
+}
+
+template <bool use_eigen>
+bool BlasNetwork<use_eigen>::UpdateWeights(const WeightsFile& file) {
+  // Layer sizes are taken from the weights with every batch and the buffers
+  // grow as needed, so only the format has to match.
+  if (file.format().OutputAsString() != format_) return false;
+  MultiHeadWeights weights(file.weights());
+  if (weights.policy_heads.count(policy_head_) == 0 ||
+      weights.value_heads.count(value_head_) == 0) {
+    return false;
+  }
+  // The current weights stay in use until the new ones are fully prepared.
+  std::vector<PreparedEncoderLayer> prepared_encoder;
+  PrepareWeights(&weights, &prepared_encoder);
+  weights_ = std::move(weights);
+  prepared_encoder_ = std::move(prepared_encoder);
+  return true;
+}
+
 template <bool use_eigen>
 std::unique_ptr<Network> MakeBlasNetwork(const std::optional<WeightsFile>& w,
                                          const OptionsDict& options) {
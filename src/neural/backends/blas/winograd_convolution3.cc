@@ -25,6 +25,8 @@
 
 #include <array>
 
+#include "utils/fastmath.h"
+
 #ifdef USE_ISPC
 #include "winograd_transform_ispc.h"
 #endif
@@ -263,13 +265,78 @@ void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
                                                    const size_t channels) {
 #ifndef USE_ISPC
 
+  size_t vector_channels = 0;
+#ifndef LCZERO_SCALAR_SOFTMAX
+  // The channels of a tile are contiguous in M_, so the transform is done for
+  // Ops::kWidth channels at once. The operations are in the same order as in
+  // the scalar loop below, which handles the remaining channels.
+  using Ops = fastmath_internal::VecOps;
+  const auto A = Ops::Add;
+  const auto S = Ops::Sub;
+  vector_channels = channels - channels % Ops::kWidth;
+  for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
+    const float* M_batch = &M_[channels * kTiles * batch_index];
+    float* output_batch = output + batch_index * kWidth * kHeight * channels;
+    const auto M_incr = channels * kTiles * batch_size;
+
+    for (int block_x = 0; block_x < kWtiles; block_x++) {
+      for (int block_y = 0; block_y < kWtiles; block_y++) {
+        const auto x = 2 * block_x;
+        const auto y = 2 * block_y;
+        const auto b = block_y * kWtiles + block_x;
+
+        for (size_t channel = 0; channel < vector_channels;
+             channel += Ops::kWidth) {
+          Ops::V m[kWinogradTile];
+          const float* M_wtile = M_batch + channels * b + channel;
+          for (int wTile = 0; wTile < kWinogradTile; wTile++) {
+            m[wTile] = Ops::Load(M_wtile);
+            M_wtile += M_incr;
+          }
+
+          float o[4][Ops::kWidth];
+          Ops::Store(
+              o[0],
+              A(A(A(A(A(A(A(A(m[0], m[1]), m[2]), m[4]), m[5]), m[6]), m[8]),
+                  m[9]),
+                m[10]));
+          Ops::Store(
+              o[1],
+              S(S(A(S(S(A(S(S(m[1], m[2]), m[3]), m[5]), m[6]), m[7]), m[9]),
+                  m[10]),
+                m[11]));
+          Ops::Store(
+              o[2],
+              S(S(S(S(S(S(A(A(m[4], m[5]), m[6]), m[8]), m[9]), m[10]), m[12]),
+                  m[13]),
+                m[14]));
+          Ops::Store(
+              o[3],
+              A(A(S(A(A(S(S(S(m[5], m[6]), m[7]), m[9]), m[10]), m[11]), m[13]),
+                  m[14]),
+                m[15]));
+
+          for (size_t k = 0; k < Ops::kWidth; k++) {
+            float* output_channel =
+                output_batch + (channel + k) * (kHeight * kWidth);
+            output_channel[(y)*kWidth + (x)] = o[0][k];
+            output_channel[(y)*kWidth + (x + 1)] = o[1][k];
+            output_channel[(y + 1) * kWidth + (x)] = o[2][k];
+            output_channel[(y + 1) * kWidth + (x + 1)] = o[3][k];
+          }
+        }
+      }
+    }
+  }
+#endif
+
   float m[kWinogradTile];
 
   for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
     const float* M_batch = &M_[channels * kTiles * batch_index];
     float* output_batch = output + batch_index * kWidth * kHeight * channels;
 
-    for (size_t channel = 0; channel < channels; channel++) {
+    for (size_t channel = vector_channels; channel < channels; channel++) {
       const float* M_channel = M_batch + channel;
       float* output_channel = output_batch + channel * (kHeight * kWidth);
 
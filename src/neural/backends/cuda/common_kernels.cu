@@ -30,6 +30,9 @@
 
 #include "cuda_common.h"
 #include "neural/tables/activation_function.h"
+#if CUDART_VERSION >= 11080
+#include <cuda_fp8.h>
+#endif
 #include "neural/tables/attention_policy_map.h"
 #include "winograd_helper.inc"
 
@@ -406,6 +409,174 @@ void copyTypeConverted(DstType* op, SrcType* ip, int N, cudaStream_t stream) {
   copyTypeConverted_kernel<<<blocks, kBlockSize, 0, stream>>>(op, ip, N);
 }
 
+__global__ void gatherPolicy_kernel(float* op, const float* ip, const int* idx,
+                                    int N) {
+  int tid = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (tid >= N) return;
+
+  op[tid] = ip[idx[tid]];
+}
+
+void gatherPolicy(float* op, const float* ip, const int* idx, int N,
+                  cudaStream_t stream) {
+  const int kBlockSize = 256;
+  int blocks = DivUp(N, kBlockSize);
+  gatherPolicy_kernel<<<blocks, kBlockSize, 0, stream>>>(op, ip, idx, N);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
+// One block per (sample, head) and a thread per query. The keys and values of
+// the head are staged in shared memory, the softmax is computed online
+// (flash attention style), so that the scores never leave the registers.
+template <typename T, int kDepth>
+__global__ void fusedMHA_kernel(T* output, const T* q, const T* k, const T* v,
+                                const T* bias, int heads, float factor) {
+  __shared__ float ks[64][kDepth];
+  __shared__ float vs[64][kDepth];
+  const int n = blockIdx.x / heads;
+  const int h = blockIdx.x % heads;
+  const int i = threadIdx.x;
+  const size_t row = ((size_t)n * 64 + i) * heads * kDepth + h * kDepth;
+
+  float qr[kDepth];
+  float acc[kDepth];
+#pragma unroll
+  for (int d = 0; d < kDepth; d++) {
+    qr[d] = (float)q[row + d] * factor;
+    acc[d] = 0.0f;
+    ks[i][d] = (float)k[row + d];
+    vs[i][d] = (float)v[row + d];
+  }
+  __syncthreads();
+
+  const T* b = bias ? bias + ((size_t)blockIdx.x * 64 + i) * 64 : nullptr;
+  float m = -INFINITY;
+  float l = 0.0f;
+  for (int j = 0; j < 64; j++) {
+    float s = 0.0f;
+#pragma unroll
+    for (int d = 0; d < kDepth; d++) s += qr[d] * ks[j][d];
+    if (b) s += (float)b[j];
+    const float m_new = max(m, s);
+    const float correction = __expf(m - m_new);
+    const float p = __expf(s - m_new);
+    l = l * correction + p;
+#pragma unroll
+    for (int d = 0; d < kDepth; d++) {
+      acc[d] = acc[d] * correction + p * vs[j][d];
+    }
+    m = m_new;
+  }
+
+  const float inv_l = 1.0f / l;
+#pragma unroll
+  for (int d = 0; d < kDepth; d++) output[row + d] = (T)(acc[d] * inv_l);
+}
+
+template <typename T>
+void fusedMHA(T* output, const T* q, const T* k, const T* v, const T* bias,
+              int N, int heads, int depth, float factor, cudaStream_t stream) {
+  const int blocks = N * heads;
+  switch (depth) {
+    case 16:
+      fusedMHA_kernel<T, 16><<<blocks, 64, 0, stream>>>(output, q, k, v, bias,
+                                                         heads, factor);
+      break;
+    case 32:
+      fusedMHA_kernel<T, 32><<<blocks, 64, 0, stream>>>(output, q, k, v, bias,
+                                                         heads, factor);
+      break;
+    case 64:
+      fusedMHA_kernel<T, 64><<<blocks, 64, 0, stream>>>(output, q, k, v, bias,
+                                                         heads, factor);
+      break;
+    default:
+      throw Exception("Unsupported depth for fused MHA: " +
+                      std::to_string(depth));
+  }
+  ReportCUDAErrors(cudaGetLastError());
+}
+
+// One block per row.
+template <typename T, bool fp8>
+__global__ void quantizeRows_kernel(void* output, float* scales,
+                                    const T* input, int cols) {
+  __shared__ float shared_max[32];
+  const int row = blockIdx.x;
+  const T* in = input + (size_t)row * cols;
+
+  float m = 0.0f;
+  for (int i = threadIdx.x; i < cols; i += blockDim.x) {
+    m = max(m, fabsf((float)in[i]));
+  }
+  m = warpMax(m);
+  if ((threadIdx.x & 31) == 0) shared_max[threadIdx.x >> 5] = m;
+  __syncthreads();
+  if (threadIdx.x < 32) {
+    m = threadIdx.x < (blockDim.x >> 5) ? shared_max[threadIdx.x] : 0.0f;
+    m = warpMax(m);
+    if (threadIdx.x == 0) shared_max[0] = m;
+  }
+  __syncthreads();
+  m = shared_max[0];
+
+  // Largest finite values of int8 and fp8 e4m3.
+  const float kMaxQuantized = fp8 ? 448.0f : 127.0f;
+  const float scale = m > 0.0f ? m / kMaxQuantized : 1.0f;
+  if (threadIdx.x == 0) scales[row] = scale;
+  const float inv_scale = 1.0f / scale;
+  for (int i = threadIdx.x; i < cols; i += blockDim.x) {
+    const float x = (float)in[i] * inv_scale;
+    const size_t index = (size_t)row * cols + i;
+    if (fp8) {
+#if CUDART_VERSION >= 11080
+      ((__nv_fp8_e4m3*)output)[index] = __nv_fp8_e4m3(x);
+#endif
+    } else {
+      ((int8_t*)output)[index] =
+          (int8_t)min(127, max(-127, __float2int_rn(x)));
+    }
+  }
+}
+
+template <typename T>
+void quantizeRows(void* output, float* scales, const T* input, int rows,
+                  int cols, bool fp8, cudaStream_t stream) {
+  const int kBlockSize = 256;
+  if (fp8) {
+    quantizeRows_kernel<T, true>
+        <<<rows, kBlockSize, 0, stream>>>(output, scales, input, cols);
+  } else {
+    quantizeRows_kernel<T, false>
+        <<<rows, kBlockSize, 0, stream>>>(output, scales, input, cols);
+  }
+  ReportCUDAErrors(cudaGetLastError());
+}
+
+template <typename T, typename AccT>
+__global__ void dequantizeRows_kernel(T* output, const AccT* acc,
+                                      const float* row_scales,
+                                      const float* col_scales, int rows,
+                                      int cols) {
+  int tid = blockIdx.x * blockDim.x + threadIdx.x;
+  if (tid >= rows * cols) return;
+  const int row = tid / cols;
+  const int col = tid % cols;
+  output[tid] = (T)((float)acc[tid] * row_scales[row] * col_scales[col]);
+}
+
+template <typename T, typename AccT>
+void dequantizeRows(T* output, const AccT* acc, const float* row_scales,
+                    const float* col_scales, int rows, int cols,
+                    cudaStream_t stream) {
+  const int kBlockSize = 256;
+  int blocks = DivUp(rows * cols, kBlockSize);
+  dequantizeRows_kernel<<<blocks, kBlockSize, 0, stream>>>(
+      output, acc, row_scales, col_scales, rows, cols);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 template <typename T>
 __global__ void batchNorm_kernel(T* output, const T* input, const T* skipInput,
                                  int N, int C, int H, int W, const float* means,
@@ -568,6 +739,48 @@ void expandPlanes_Fp16_NCHW(half* output, const uint64_t* masks,
   ReportCUDAErrors(cudaGetLastError());
 }
 
+template <typename T>
+__global__ void expandCompactPlanes_kernel_NCHW(
+    T* output, const CompactInputPlanes* inputs, int n) {
+  constexpr int kHistoryPlanes =
+      CompactInputPlanes::kBoards * (CompactInputPlanes::kPiecePlanes + 1);
+  int index = threadIdx.x + blockDim.x * blockIdx.x;
+  if (index >= n * kInputPlanes * 64) return;
+
+  const int sample = index / (kInputPlanes * 64);
+  const int plane = (index >> 6) % kInputPlanes;
+  const int sqIndex = index & 0x3F;
+  const CompactInputPlanes& input = inputs[sample];
+
+  float op = 0.0f;
+  if (plane < kHistoryPlanes) {
+    const int board = plane / (CompactInputPlanes::kPiecePlanes + 1);
+    const int boardPlane = plane % (CompactInputPlanes::kPiecePlanes + 1);
+    if (boardPlane == CompactInputPlanes::kPiecePlanes) {
+      if (input.repetitions & (1 << board)) op = 1.0f;
+    } else {
+      const int piece =
+          (input.pieces[board][sqIndex >> 1] >> ((sqIndex & 1) * 4)) & 0xF;
+      if (piece == boardPlane + 1) op = 1.0f;
+    }
+  } else {
+    const int aux = plane - kHistoryPlanes;
+    if (input.aux_masks[aux] & (1ull << sqIndex)) op = input.aux_values[aux];
+  }
+  output[index] = (T)op;
+}
+
+template <typename T>
+void expandCompactPlanes_NCHW(T* output, const CompactInputPlanes* inputs,
+                              int n, cudaStream_t stream) {
+  int threads = n * kInputPlanes * 8 * 8;  // one thread per element
+  const int blockSize = 256;
+  int blocks = DivUp(threads, blockSize);
+  expandCompactPlanes_kernel_NCHW<<<blocks, blockSize, 0, stream>>>(
+      output, inputs, n);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 template <typename T>
 __global__ void globalScale_kernel(T* output, const T* input,
                                    const T* scaleBias, const T* prevLayerBias,
@@ -1310,6 +1523,13 @@ void applyInputGating(T* output, const T* input, const T* mult, const T* add,
 }
 
 // Template instantiation.
+template void expandCompactPlanes_NCHW<float>(
+    float* output, const CompactInputPlanes* inputs, int n,
+    cudaStream_t stream);
+template void expandCompactPlanes_NCHW<half>(half* output,
+                                             const CompactInputPlanes* inputs,
+                                             int n, cudaStream_t stream);
+
 template void copyTypeConverted<half, float>(half* op, float* ip, int N,
                                              cudaStream_t stream);
 template void copyTypeConverted<float, half>(float* op, half* ip, int N,
@@ -1595,5 +1815,37 @@ template void applyInputGating<float>(float* output, const float* input,
                                       const float* mult, const float* add,
                                       int N, int C, int output_size,
                                       cudaStream_t stream);
+
+template void fusedMHA<half>(half* output, const half* q, const half* k,
+                             const half* v, const half* bias, int N, int heads,
+                             int depth, float factor, cudaStream_t stream);
+template void fusedMHA<float>(float* output, const float* q, const float* k,
+                              const float* v, const float* bias, int N,
+                              int heads, int depth, float factor,
+                              cudaStream_t stream);
+
+template void quantizeRows<half>(void* output, float* scales, const half* input,
+                                 int rows, int cols, bool fp8,
+                                 cudaStream_t stream);
+template void quantizeRows<float>(void* output, float* scales,
+                                  const float* input, int rows, int cols,
+                                  bool fp8, cudaStream_t stream);
+
+template void dequantizeRows<half, int>(half* output, const int* acc,
+                                        const float* row_scales,
+                                        const float* col_scales, int rows,
+                                        int cols, cudaStream_t stream);
+template void dequantizeRows<half, float>(half* output, const float* acc,
+                                          const float* row_scales,
+                                          const float* col_scales, int rows,
+                                          int cols, cudaStream_t stream);
+template void dequantizeRows<float, int>(float* output, const int* acc,
+                                         const float* row_scales,
+                                         const float* col_scales, int rows,
+                                         int cols, cudaStream_t stream);
+template void dequantizeRows<float, float>(float* output, const float* acc,
+                                           const float* row_scales,
+                                           const float* col_scales, int rows,
+                                           int cols, cudaStream_t stream);
 }  // namespace cudnn_backend
 }  // namespace lczero
@@ -0,0 +1,399 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "gemm_tuner.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <tuple>
+
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/string.h"
+
+#ifdef CUDA_GEMM_TUNER
+#include <cublasLt.h>
+#endif
+
+namespace lczero {
+namespace cudnn_backend {
+namespace {
+// Bumped when the format of the cache lines changes.
+constexpr int kCacheVersion = 1;
+// Number of cublasLt heuristic candidates which are timed.
+constexpr int kMaxCandidates = 8;
+constexpr int kTimedRuns = 10;
+
+GemmTuner* tuner = nullptr;
+}  // namespace
+
+void GemmTuner::Enable(const std::string& cache_file, bool force_tune) {
+#ifdef CUDA_GEMM_TUNER
+  static std::once_flag once;
+  std::call_once(once, [&]() {
+    // Never destroyed, the networks may still run GEMMs at exit.
+    tuner = new GemmTuner(cache_file, force_tune);
+    CERR << "GEMM tuning enabled, cache file " << cache_file << ".";
+  });
+#else
+  (void)cache_file;
+  (void)force_tune;
+  CERR << "GEMM tuning requires cuBLASLt and CUDA 11, ignored.";
+#endif
+}
+
+GemmTuner* GemmTuner::Get() { return tuner; }
+
+#ifndef CUDA_GEMM_TUNER
+
+struct GemmTuner::Device {};
+
+bool GemmTuner::Gemm(cublasHandle_t, bool, cublasOperation_t,
+                     cublasOperation_t, int, int, int, const void*,
+                     const void*, int, long long, const void*, int, long long,
+                     const void*, void*, int, long long, int) {
+  return false;
+}
+
+#else
+
+struct GemmTuner::Shape {
+  bool fp16;
+  cublasOperation_t transa;
+  cublasOperation_t transb;
+  int m, n, k;
+  int lda, ldb, ldc;
+  long long stride_a, stride_b, stride_c;
+  int batch_count;
+
+  auto Tie() const {
+    return std::tie(fp16, transa, transb, m, n, k, lda, ldb, ldc, stride_a,
+                    stride_b, stride_c, batch_count);
+  }
+  bool operator<(const Shape& other) const { return Tie() < other.Tie(); }
+
+  std::string ToString() const {
+    std::ostringstream out;
+    out << fp16 << ';' << transa << ';' << transb << ';' << m << ';' << n
+        << ';' << k << ';' << lda << ';' << ldb << ';' << ldc << ';'
+        << stride_a << ';' << stride_b << ';' << stride_c << ';'
+        << batch_count;
+    return out.str();
+  }
+};
+
+// The cublasLt descriptors of a shape and its algorithm. Kept for the life of
+// the process, like the tuner.
+struct GemmTuner::Tuned {
+  cublasLtMatmulDesc_t desc = nullptr;
+  cublasLtMatrixLayout_t layout_a = nullptr;
+  cublasLtMatrixLayout_t layout_b = nullptr;
+  cublasLtMatrixLayout_t layout_c = nullptr;
+  // Whether @algo was tuned, or loaded from the cache and checked.
+  bool ready = false;
+  // No cublasLt algorithm supports the shape.
+  bool unsupported = false;
+  // Loaded from the cache, not checked yet.
+  bool cached = false;
+  cublasLtMatmulAlgo_t algo;
+};
+
+struct GemmTuner::Device {
+  std::string name;
+  std::map<Shape, Tuned> shapes;
+  // Output of the tuning runs, so that the GEMM outputs are not overwritten.
+  void* scratch = nullptr;
+  size_t scratch_size = 0;
+};
+
+namespace {
+std::string AlgoToString(const cublasLtMatmulAlgo_t& algo) {
+  std::ostringstream out;
+  out << std::hex << std::setfill('0');
+  for (auto word : algo.data) out << std::setw(16) << word;
+  return out.str();
+}
+
+bool AlgoFromString(const std::string& str, cublasLtMatmulAlgo_t* algo) {
+  constexpr size_t kWords = sizeof(algo->data) / sizeof(algo->data[0]);
+  if (str.size() != kWords * 16) return false;
+  for (size_t i = 0; i < kWords; i++) {
+    algo->data[i] = std::stoull(str.substr(i * 16, 16), nullptr, 16);
+  }
+  return true;
+}
+
+cublasLtMatrixLayout_t CreateLayout(cudaDataType_t type, cublasOperation_t op,
+                                    int rows, int cols, int ld,
+                                    long long stride, int batch_count) {
+  cublasLtMatrixLayout_t layout;
+  if (op != CUBLAS_OP_N) std::swap(rows, cols);
+  ReportCUBLASErrors(cublasLtMatrixLayoutCreate(&layout, type, rows, cols, ld));
+  if (batch_count > 1) {
+    ReportCUBLASErrors(cublasLtMatrixLayoutSetAttribute(
+        layout, CUBLASLT_MATRIX_LAYOUT_BATCH_COUNT, &batch_count,
+        sizeof(batch_count)));
+    ReportCUBLASErrors(cublasLtMatrixLayoutSetAttribute(
+        layout, CUBLASLT_MATRIX_LAYOUT_STRIDED_BATCH_OFFSET, &stride,
+        sizeof(stride)));
+  }
+  return layout;
+}
+
+// The identity of the setup the algorithms were tuned for.
+std::string DeviceName(int device) {
+  cudaDeviceProp prop;
+  ReportCUDAErrors(cudaGetDeviceProperties(&prop, device));
+  int driver = 0;
+  ReportCUDAErrors(cudaDriverGetVersion(&driver));
+  return std::string(prop.name) + ";" + std::to_string(driver) + ";" +
+         std::to_string(cublasLtGetVersion());
+}
+}  // namespace
+
+GemmTuner::Device* GemmTuner::GetDevice() {
+  int ordinal;
+  ReportCUDAErrors(cudaGetDevice(&ordinal));
+  if (devices_.size() <= static_cast<size_t>(ordinal)) {
+    devices_.resize(ordinal + 1);
+  }
+  auto& device = devices_[ordinal];
+  if (!device) {
+    device = std::make_unique<Device>();
+    device->name = DeviceName(ordinal);
+    if (!force_tune_) LoadCache(device.get());
+  }
+  return device.get();
+}
+
+// Cache lines are "version;gpu;driver;cublaslt;shape...;algorithm", with the
+// algorithm "none" for the unsupported shapes. Later lines override the
+// earlier ones.
+void GemmTuner::LoadCache(Device* device) {
+  std::ifstream file(cache_file_);
+  const std::string prefix =
+      std::to_string(kCacheVersion) + ";" + device->name + ";";
+  std::string line;
+  int loaded = 0;
+  while (std::getline(file, line)) {
+    if (line.compare(0, prefix.size(), prefix) != 0) continue;
+    const auto fields = StrSplit(line.substr(prefix.size()), ";");
+    if (fields.size() != 14) continue;
+    try {
+      Shape shape;
+      shape.fp16 = std::stoi(fields[0]);
+      shape.transa = static_cast<cublasOperation_t>(std::stoi(fields[1]));
+      shape.transb = static_cast<cublasOperation_t>(std::stoi(fields[2]));
+      shape.m = std::stoi(fields[3]);
+      shape.n = std::stoi(fields[4]);
+      shape.k = std::stoi(fields[5]);
+      shape.lda = std::stoi(fields[6]);
+      shape.ldb = std::stoi(fields[7]);
+      shape.ldc = std::stoi(fields[8]);
+      shape.stride_a = std::stoll(fields[9]);
+      shape.stride_b = std::stoll(fields[10]);
+      shape.stride_c = std::stoll(fields[11]);
+      shape.batch_count = std::stoi(fields[12]);
+      Tuned tuned;
+      if (fields[13] == "none") {
+        tuned.unsupported = true;
+      } else if (AlgoFromString(fields[13], &tuned.algo)) {
+        tuned.cached = true;
+      } else {
+        continue;
+      }
+      device->shapes[shape] = tuned;
+      loaded++;
+    } catch (const std::exception&) {
+      // Malformed line, the shape is tuned again.
+    }
+  }
+  if (loaded > 0) {
+    CERR << "Loaded " << loaded << " tuned GEMM shapes from " << cache_file_
+         << ".";
+  }
+}
+
+void GemmTuner::StoreCache(const Device& device, const Shape& shape,
+                           const Tuned& tuned) {
+  std::ofstream file(cache_file_, std::ios::app);
+  file << kCacheVersion << ';' << device.name << ';' << shape.ToString() << ';'
+       << (tuned.unsupported ? std::string("none") : AlgoToString(tuned.algo))
+       << std::endl;
+  if (file.fail()) {
+    CERR << "Could not save the GEMM tuning to " << cache_file_ << ".";
+  }
+}
+
+void GemmTuner::Tune(Device* device, const Shape& shape, Tuned* tuned,
+                     cublasHandle_t cublas, cudaStream_t stream,
+                     const void* alpha, const void* A, const void* B,
+                     const void* beta) {
+  const cublasLtHandle_t lt = (cublasLtHandle_t)cublas;
+  cublasLtMatmulPreference_t preference;
+  ReportCUBLASErrors(cublasLtMatmulPreferenceCreate(&preference));
+  // The GEMMs of the different streams can't share a workspace.
+  const uint64_t workspace_size = 0;
+  ReportCUBLASErrors(cublasLtMatmulPreferenceSetAttribute(
+      preference, CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES, &workspace_size,
+      sizeof(workspace_size)));
+  cublasLtMatmulHeuristicResult_t results[kMaxCandidates];
+  int found = 0;
+  const cublasStatus_t status = cublasLtMatmulAlgoGetHeuristic(
+      lt, tuned->desc, tuned->layout_a, tuned->layout_b, tuned->layout_c,
+      tuned->layout_c, preference, kMaxCandidates, results, &found);
+  cublasLtMatmulPreferenceDestroy(preference);
+  tuned->ready = true;
+  if (status != CUBLAS_STATUS_SUCCESS || found == 0) {
+    tuned->unsupported = true;
+    StoreCache(*device, shape, *tuned);
+    return;
+  }
+
+  const size_t output_size =
+      ((size_t)shape.ldc * shape.n +
+       (size_t)shape.stride_c * (shape.batch_count - 1)) *
+      (shape.fp16 ? 2 : 4);
+  if (device->scratch_size < output_size) {
+    if (device->scratch) ReportCUDAErrors(cudaFree(device->scratch));
+    ReportCUDAErrors(cudaMalloc(&device->scratch, output_size));
+    device->scratch_size = output_size;
+  }
+  ReportCUDAErrors(
+      cudaMemsetAsync(device->scratch, 0, output_size, stream));
+
+  cudaEvent_t start, stop;
+  ReportCUDAErrors(cudaEventCreate(&start));
+  ReportCUDAErrors(cudaEventCreate(&stop));
+  float best_time = std::numeric_limits<float>::max();
+  int best = -1;
+  for (int i = 0; i < found; i++) {
+    if (results[i].state != CUBLAS_STATUS_SUCCESS) continue;
+    auto run = [&]() {
+      return cublasLtMatmul(lt, tuned->desc, alpha, A, tuned->layout_a, B,
+                            tuned->layout_b, beta, device->scratch,
+                            tuned->layout_c, device->scratch, tuned->layout_c,
+                            &results[i].algo, nullptr, 0, stream);
+    };
+    // Warm up, and skip the candidates which fail to run.
+    if (run() != CUBLAS_STATUS_SUCCESS) continue;
+    ReportCUDAErrors(cudaEventRecord(start, stream));
+    for (int j = 0; j < kTimedRuns; j++) ReportCUBLASErrors(run());
+    ReportCUDAErrors(cudaEventRecord(stop, stream));
+    ReportCUDAErrors(cudaEventSynchronize(stop));
+    float time;
+    ReportCUDAErrors(cudaEventElapsedTime(&time, start, stop));
+    if (time < best_time) {
+      best_time = time;
+      best = i;
+    }
+  }
+  cudaEventDestroy(start);
+  cudaEventDestroy(stop);
+
+  if (best < 0) {
+    tuned->unsupported = true;
+  } else {
+    tuned->algo = results[best].algo;
+    LOGFILE << "Tuned GEMM " << shape.ToString() << ": candidate " << best
+            << " of " << found << ", "
+            << best_time * 1000.0f / kTimedRuns << " us.";
+  }
+  StoreCache(*device, shape, *tuned);
+}
+
+bool GemmTuner::Gemm(cublasHandle_t cublas, bool fp16,
+                     cublasOperation_t transa, cublasOperation_t transb, int m,
+                     int n, int k, const void* alpha, const void* A, int lda,
+                     long long stride_a, const void* B, int ldb,
+                     long long stride_b, const void* beta, void* C, int ldc,
+                     long long stride_c, int batch_count) {
+  cudaStream_t stream;
+  ReportCUBLASErrors(cublasGetStream(cublas, &stream));
+  const Shape shape{fp16,     transa,   transb,   m,        n,
+                    k,        lda,      ldb,      ldc,      stride_a,
+                    stride_b, stride_c, batch_count};
+  Tuned* tuned;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Device* device = GetDevice();
+    tuned = &device->shapes[shape];
+    if (tuned->unsupported) return false;
+    if (!tuned->desc) {
+      // Same precision as cublasXgemm().
+      const cudaDataType_t type = fp16 ? CUDA_R_16F : CUDA_R_32F;
+      ReportCUBLASErrors(cublasLtMatmulDescCreate(
+          &tuned->desc, fp16 ? CUBLAS_COMPUTE_16F : CUBLAS_COMPUTE_32F, type));
+      ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+          tuned->desc, CUBLASLT_MATMUL_DESC_TRANSA, &transa, sizeof(transa)));
+      ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+          tuned->desc, CUBLASLT_MATMUL_DESC_TRANSB, &transb, sizeof(transb)));
+      tuned->layout_a =
+          CreateLayout(type, transa, m, k, lda, stride_a, batch_count);
+      tuned->layout_b =
+          CreateLayout(type, transb, k, n, ldb, stride_b, batch_count);
+      tuned->layout_c =
+          CreateLayout(type, CUBLAS_OP_N, m, n, ldc, stride_c, batch_count);
+    }
+    if (tuned->cached) {
+      // The cached algorithm may not fit this cublasLt build after all.
+      cublasLtMatmulHeuristicResult_t result;
+      tuned->cached = false;
+      tuned->ready = cublasLtMatmulAlgoCheck(
+                         (cublasLtHandle_t)cublas, tuned->desc,
+                         tuned->layout_a, tuned->layout_b, tuned->layout_c,
+                         tuned->layout_c, &tuned->algo,
+                         &result) == CUBLAS_STATUS_SUCCESS &&
+                     result.workspaceSize == 0;
+    }
+    if (!tuned->ready) {
+      // Stream captures can't be timed, the first uncaptured run tunes.
+      cudaStreamCaptureStatus capture;
+      ReportCUDAErrors(cudaStreamIsCapturing(stream, &capture));
+      if (capture != cudaStreamCaptureStatusNone) return false;
+      Tune(device, shape, tuned, cublas, stream, alpha, A, B, beta);
+      if (tuned->unsupported) return false;
+    }
+  }
+  ReportCUBLASErrors(cublasLtMatmul(
+      (cublasLtHandle_t)cublas, tuned->desc, alpha, A, tuned->layout_a, B,
+      tuned->layout_b, beta, C, tuned->layout_c, C, tuned->layout_c,
+      &tuned->algo, nullptr, 0, stream));
+  return true;
+}
+
+#endif
+
+GemmTuner::GemmTuner(const std::string& cache_file, bool force_tune)
+    : cache_file_(cache_file), force_tune_(force_tune) {}
+
+}  // namespace cudnn_backend
+}  // namespace lczero
@@ -0,0 +1,92 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+#pragma once
+
+#include <cublas_v2.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cuda_common.h"
+
+#if defined(USE_CUBLASLT) && CUDART_VERSION >= 11000
+#define CUDA_GEMM_TUNER
+#endif
+
+namespace lczero {
+namespace cudnn_backend {
+
+// Picks the fastest cublasLt algorithm for each GEMM shape the network runs,
+// by timing the candidates of the cublasLt heuristic the first time the shape
+// is seen. That is during the first, uncaptured, run of a batch size with CUDA
+// graphs. The winners are appended to a cache file, per GPU model, driver and
+// cublasLt version, and loaded when the shape is seen again.
+class GemmTuner {
+ public:
+  // Enables the tuner for all the cuda networks of the process, with the
+  // results kept in @cache_file. With @force_tune, the cache file isn't read.
+  static void Enable(const std::string& cache_file, bool force_tune);
+  // The tuner, or nullptr if it's not enabled.
+  static GemmTuner* Get();
+
+  // C[i] = alpha * op(A[i]) * op(B[i]) + beta * C[i] for i < @batch_count,
+  // column major like cublasGemmStridedBatchedEx(), with alpha and beta of
+  // the data type. Runs on the stream of @cublas. Returns false if there is no
+  // tuned algorithm for the shape (and it can't be tuned now), in which case
+  // the caller does the GEMM with cublas.
+  bool Gemm(cublasHandle_t cublas, bool fp16, cublasOperation_t transa,
+            cublasOperation_t transb, int m, int n, int k, const void* alpha,
+            const void* A, int lda, long long stride_a, const void* B, int ldb,
+            long long stride_b, const void* beta, void* C, int ldc,
+            long long stride_c, int batch_count);
+
+ private:
+  struct Shape;
+  struct Tuned;
+  struct Device;
+
+  GemmTuner(const std::string& cache_file, bool force_tune);
+
+  Device* GetDevice();
+  void LoadCache(Device* device);
+  void Tune(Device* device, const Shape& shape, Tuned* tuned,
+            cublasHandle_t cublas, cudaStream_t stream, const void* alpha,
+            const void* A, const void* B, const void* beta);
+  void StoreCache(const Device& device, const Shape& shape,
+                  const Tuned& tuned);
+
+  const std::string cache_file_;
+  const bool force_tune_;
+  std::mutex mutex_;
+  // By device ordinal.
+  std::vector<std::unique_ptr<Device>> devices_;
+};
+
+}  // namespace cudnn_backend
+}  // namespace lczero
@@ -27,26 +27,56 @@
 
 #pragma once
 
+#include <unordered_map>
+
 #include "neural/network.h"
 
 namespace lczero {
 namespace cudnn_backend {
 
+// Upper bound of the number of legal moves in a chess position, for the
+// buffers of the gathered policy.
+constexpr int kMaxGatheredPolicyPerSample = 256;
+
 struct InputsOutputs {
   InputsOutputs(int maxBatchSize, bool wdl, bool moves_left,
                 size_t tensor_mem_size = 0, size_t scratch_size = 0,
-                bool cublasDisableTensorCores = false) {
-    ReportCUDAErrors(cudaHostAlloc(
-        &input_masks_mem_, maxBatchSize * kInputPlanes * sizeof(uint64_t),
-        cudaHostAllocMapped));
-    ReportCUDAErrors(
-        cudaHostGetDevicePointer(&input_masks_mem_gpu_, input_masks_mem_, 0));
-
-    ReportCUDAErrors(cudaHostAlloc(&input_val_mem_,
-                                   maxBatchSize * kInputPlanes * sizeof(float),
-                                   cudaHostAllocMapped));
-    ReportCUDAErrors(
-        cudaHostGetDevicePointer(&input_val_mem_gpu_, input_val_mem_, 0));
+                bool cublasDisableTensorCores = false,
+                bool nonBlockingStream = false, bool asyncCopy = false) {
+    if (asyncCopy) {
+      // Pinned staging memory, uploaded on the copy stream, see
+      // CudaNetwork::forwardEval().
+      async_copy_ = true;
+      ReportCUDAErrors(cudaHostAlloc(
+          &input_masks_mem_, maxBatchSize * kInputPlanes * sizeof(uint64_t),
+          cudaHostAllocDefault));
+      ReportCUDAErrors(
+          cudaMalloc(&input_masks_mem_gpu_,
+                     maxBatchSize * kInputPlanes * sizeof(uint64_t)));
+      ReportCUDAErrors(cudaHostAlloc(
+          &input_val_mem_, maxBatchSize * kInputPlanes * sizeof(float),
+          cudaHostAllocDefault));
+      ReportCUDAErrors(cudaMalloc(&input_val_mem_gpu_,
+                                  maxBatchSize * kInputPlanes * sizeof(float)));
+      ReportCUDAErrors(
+          cudaStreamCreateWithFlags(&copy_stream_, cudaStreamNonBlocking));
+      for (auto event : {&upload_done_, &compute_done_, &download_done_}) {
+        ReportCUDAErrors(
+            cudaEventCreateWithFlags(event, cudaEventDisableTiming));
+      }
+    } else {
+      ReportCUDAErrors(cudaHostAlloc(
+          &input_masks_mem_, maxBatchSize * kInputPlanes * sizeof(uint64_t),
+          cudaHostAllocMapped));
+      ReportCUDAErrors(cudaHostGetDevicePointer(&input_masks_mem_gpu_,
+                                                input_masks_mem_, 0));
+
+      ReportCUDAErrors(cudaHostAlloc(
+          &input_val_mem_, maxBatchSize * kInputPlanes * sizeof(float),
+          cudaHostAllocMapped));
+      ReportCUDAErrors(
+          cudaHostGetDevicePointer(&input_val_mem_gpu_, input_val_mem_, 0));
+    }
 
     ReportCUDAErrors(cudaHostAlloc(
         &op_policy_mem_, maxBatchSize * kNumOutputPolicy * sizeof(float), 0));
@@ -57,6 +87,21 @@ struct InputsOutputs {
     ReportCUDAErrors(cudaMalloc(
         &op_policy_mem_gpu_, maxBatchSize * kNumOutputPolicy * sizeof(float)));
 
+    // Flat indices into the policy output of the moves to gather, and the
+    // gathered values.
+    ReportCUDAErrors(cudaHostAlloc(
+        &policy_gather_indices_mem_,
+        maxBatchSize * kMaxGatheredPolicyPerSample * sizeof(int),
+        cudaHostAllocMapped));
+    ReportCUDAErrors(cudaHostGetDevicePointer(
+        &policy_gather_indices_mem_gpu_, policy_gather_indices_mem_, 0));
+    ReportCUDAErrors(cudaHostAlloc(
+        &op_gathered_policy_mem_,
+        maxBatchSize * kMaxGatheredPolicyPerSample * sizeof(float), 0));
+    ReportCUDAErrors(cudaMalloc(
+        &op_gathered_policy_mem_gpu_,
+        maxBatchSize * kMaxGatheredPolicyPerSample * sizeof(float)));
+
     ReportCUDAErrors(cudaHostAlloc(&op_value_mem_,
                                    maxBatchSize * (wdl ? 3 : 1) * sizeof(float),
                                    cudaHostAllocMapped));
@@ -73,7 +118,11 @@ struct InputsOutputs {
     // memory for network execution managed inside this structure
     if (tensor_mem_size) {
       multi_stream_ = true;
-      ReportCUDAErrors(cudaStreamCreate(&stream_));
+      // Non-blocking streams don't synchronize with the legacy default stream,
+      // which would break CUDA graph captures.
+      ReportCUDAErrors(cudaStreamCreateWithFlags(
+          &stream_, nonBlockingStream ? cudaStreamNonBlocking
+                                      : cudaStreamDefault));
       ReportCUDAErrors(cudaMalloc(&scratch_mem_, scratch_size));
       for (auto& mem : tensor_mem_) {
         ReportCUDAErrors(cudaMalloc(&mem, tensor_mem_size));
@@ -89,10 +138,24 @@ struct InputsOutputs {
     }
   }
   ~InputsOutputs() {
+    for (auto& [batch_size, graph_exec] : cuda_graphs_) {
+      ReportCUDAErrors(cudaGraphExecDestroy(graph_exec));
+    }
     ReportCUDAErrors(cudaFreeHost(input_masks_mem_));
     ReportCUDAErrors(cudaFreeHost(input_val_mem_));
+    if (async_copy_) {
+      ReportCUDAErrors(cudaFree(input_masks_mem_gpu_));
+      ReportCUDAErrors(cudaFree(input_val_mem_gpu_));
+      for (auto event : {upload_done_, compute_done_, download_done_}) {
+        cudaEventDestroy(event);
+      }
+      cudaStreamDestroy(copy_stream_);
+    }
     ReportCUDAErrors(cudaFreeHost(op_policy_mem_));
     ReportCUDAErrors(cudaFree(op_policy_mem_gpu_));
+    ReportCUDAErrors(cudaFreeHost(policy_gather_indices_mem_));
+    ReportCUDAErrors(cudaFreeHost(op_gathered_policy_mem_));
+    ReportCUDAErrors(cudaFree(op_gathered_policy_mem_gpu_));
     ReportCUDAErrors(cudaFreeHost(op_value_mem_));
     if (op_moves_left_mem_ != nullptr)
       ReportCUDAErrors(cudaFreeHost(op_moves_left_mem_));
@@ -116,7 +179,8 @@ struct InputsOutputs {
   float* op_value_mem_;
   float* op_moves_left_mem_ = nullptr;
 
-  // GPU pointers for the above allocations.
+  // GPU pointers for the above allocations. Separate device memory for the
+  // inputs when async_copy_ is set.
   uint64_t* input_masks_mem_gpu_;
   float* input_val_mem_gpu_;
   float* op_value_mem_gpu_;
@@ -125,6 +189,12 @@ struct InputsOutputs {
   // This is a seperate copy.
   float* op_policy_mem_gpu_;
 
+  // Policy gathered on the device, see forwardEval().
+  int* policy_gather_indices_mem_;
+  int* policy_gather_indices_mem_gpu_;
+  float* op_gathered_policy_mem_;
+  float* op_gathered_policy_mem_gpu_;
+
   // memory needed to run the network owned by InputsOutputs when multi_stream
   // is enabled
   bool multi_stream_;
@@ -138,6 +208,18 @@ struct InputsOutputs {
 
   // cublas handle used to run the network
   cublasHandle_t cublas_;
+
+  // Inputs are uploaded, and the policy downloaded, on copy_stream_
+  // asynchronously to the network stream. The events order the copies with
+  // the network.
+  bool async_copy_ = false;
+  cudaStream_t copy_stream_;
+  cudaEvent_t upload_done_;
+  cudaEvent_t compute_done_;
+  cudaEvent_t download_done_;
+
+  // CUDA graphs of the network captured with these buffers, by batch size.
+  std::unordered_map<int, cudaGraphExec_t> cuda_graphs_;
 };
 
 }  // namespace cudnn_backend
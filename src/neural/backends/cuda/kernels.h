@@ -28,6 +28,7 @@
 #pragma once
 
 #include "cuda_common.h"
+#include "neural/compact_input.h"
 #include "neural/tables/activation_function.h"
 
 namespace lczero {
@@ -73,6 +74,34 @@ void convertNCHWtoNHWC(DstType* output_tensor, const SrcType* input_tensor,
 template <typename DstType, typename SrcType>
 void copyTypeConverted(DstType* op, SrcType* ip, int N, cudaStream_t stream);
 
+// Gathers the elements of the input at the given indices: op[i] = ip[idx[i]].
+void gatherPolicy(float* op, const float* ip, const int* idx, int N,
+                  cudaStream_t stream);
+
+// Fused scaled dot product attention of 64 queries over 64 keys per head:
+// output = softmax(q * k^T * factor + bias) * v, with the scores kept on chip.
+// q, k, v and output are [N][64][heads * depth], bias (smolgen, optional) is
+// [N][heads][64][64]. Only some depths are supported.
+inline bool fusedMHASupported(int depth) {
+  return depth == 16 || depth == 32 || depth == 64;
+}
+template <typename T>
+void fusedMHA(T* output, const T* q, const T* k, const T* v, const T* bias,
+              int N, int heads, int depth, float factor, cudaStream_t stream);
+
+// Quantizes the rows (of @cols elements) of the input with a scale per row,
+// to int8 or, when @fp8, to fp8 e4m3. The scales are written to @scales.
+template <typename T>
+void quantizeRows(void* output, float* scales, const T* input, int rows,
+                  int cols, bool fp8, cudaStream_t stream);
+
+// Dequantizes the output of a quantized GEMM:
+// output[r][c] = acc[r][c] * row_scales[r] * col_scales[c].
+template <typename T, typename AccT>
+void dequantizeRows(T* output, const AccT* acc, const float* row_scales,
+                    const float* col_scales, int rows, int cols,
+                    cudaStream_t stream);
+
 // Perform batch normilization.
 template <typename T>
 void batchNorm(T* output, const T* input, const T* skipInput, int N, int C,
@@ -89,6 +118,12 @@ void expandPlanes_Fp16_NHWC(half* output, const uint64_t* masks,
 void expandPlanes_Fp16_NCHW(half* output, const uint64_t* masks,
                             const float* values, int n, cudaStream_t stream);
 
+// Expands @n inputs in the compact form (see neural/compact_input.h) to full
+// planes.
+template <typename T>
+void expandCompactPlanes_NCHW(T* output, const CompactInputPlanes* inputs,
+                              int n, cudaStream_t stream);
+
 // Perform global avg pool.
 template <typename T>
 void globalAvgPool(int N, int C, T* output, const T* input,
@@ -26,15 +26,26 @@
 */
 #include "layers.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 #include <vector>
 
 #include "cuda_common.h"
+#include "gemm_tuner.h"
 #include "kernels.h"
 #include "neural/network.h"
 #include "neural/tables/attention_policy_map.h"
 #include "utils/fp16_utils.h"
+#include "utils/fp8_utils.h"
+
+#if defined(USE_CUBLASLT) && CUDART_VERSION >= 11080
+#include <cublasLt.h>
+#define CUDA_FP8_GEMM
+// Bias add and activation in the epilogue of the dense layer GEMMs.
+#define CUDA_LT_EPILOGUE
+#endif
 
 namespace lczero {
 
@@ -1485,7 +1496,8 @@ EncoderBlock<DataType>::EncoderBlock(
     const MultiHeadWeights::EncoderLayer& cpu_weights, void* scratch, int heads,
     int size, float alpha, DataType* smolgen_global_scratch,
     int smolgen_global_size, int max_batch_size, ActivationFunction smolgen_act,
-    ActivationFunction ffn_act, float default_eps)
+    ActivationFunction ffn_act, float default_eps, bool fused_mha,
+    const QuantizedGemm* quantized_gemm)
     : embedding_op_size_(size),
       encoder_heads_(heads),
       alpha_(alpha),
@@ -1493,7 +1505,10 @@ EncoderBlock<DataType>::EncoderBlock(
       has_smolgen_(cpu_weights.mha.has_smolgen),
       smolgen_activation_(smolgen_act),
       ffn_activation_(ffn_act),
-      max_batch_size_(max_batch_size) {
+      max_batch_size_(max_batch_size),
+      fused_mha_(fused_mha &&
+                 fusedMHASupported(cpu_weights.mha.q_b.size() / heads)),
+      quantized_gemm_(quantized_gemm) {
   mha_q_size_ = cpu_weights.mha.q_b.size();
   mha_k_size_ = cpu_weights.mha.k_b.size();
   mha_v_size_ = cpu_weights.mha.v_b.size();
@@ -1548,6 +1563,18 @@ EncoderBlock<DataType>::EncoderBlock(
   allocAndUpload<DataType>(&ln2_gammas, cpu_weights.ln2_gammas, scratch);
   allocAndUpload<DataType>(&ln2_betas, cpu_weights.ln2_betas, scratch);
 
+  if (quantized_gemm_) {
+    std::vector<float> qkv_w = cpu_weights.mha.q_w;
+    qkv_w.insert(qkv_w.end(), cpu_weights.mha.k_w.begin(),
+                 cpu_weights.mha.k_w.end());
+    qkv_w.insert(qkv_w.end(), cpu_weights.mha.v_w.begin(),
+                 cpu_weights.mha.v_w.end());
+    mha_qkv_q_ = quantized_gemm_->Quantize(qkv_w, size, 3);
+    ffn_dense1_q_ = quantized_gemm_->Quantize(cpu_weights.ffn.dense1_w, size);
+    ffn_dense2_q_ =
+        quantized_gemm_->Quantize(cpu_weights.ffn.dense2_w, ffn_dense1_size_);
+  }
+
   // Smolgen weights.
   if (has_smolgen_) {
     smol_compress_size_ = cpu_weights.mha.smolgen.compress.size() / mha_q_size_;
@@ -1587,6 +1614,17 @@ static void cublasXgemm(cublasHandle_t handle, cublasOperation_t transa,
                         const DataType* B, int ldb, float beta, DataType* C,
                         int ldc) {
   const bool fp16 = std::is_same<half, DataType>::value;
+  if (GemmTuner* tuner = GemmTuner::Get()) {
+    const unsigned short alpha_h = FP32toFP16(alpha);
+    const unsigned short beta_h = FP32toFP16(beta);
+    if (tuner->Gemm(handle, fp16, transa, transb, m, n, k,
+                    fp16 ? (const void*)&alpha_h : (const void*)&alpha, A, lda,
+                    0, B, ldb, 0,
+                    fp16 ? (const void*)&beta_h : (const void*)&beta, C, ldc,
+                    0, 1)) {
+      return;
+    }
+  }
   if (fp16) {
     unsigned short alpha_h = FP32toFP16(alpha);
     unsigned short beta_h = FP32toFP16(beta);
@@ -1607,6 +1645,17 @@ static void cublasXGemmStridedBatched(
     long long int strideA, const void* B, int ldb, long long int strideB,
     float beta, void* C, int ldc, long long int strideC, int batchCount) {
   const bool fp16 = std::is_same<half, DataType>::value;
+  if (GemmTuner* tuner = GemmTuner::Get()) {
+    const unsigned short alpha_h = FP32toFP16(alpha);
+    const unsigned short beta_h = FP32toFP16(beta);
+    if (tuner->Gemm(handle, fp16, transa, transb, m, n, k,
+                    fp16 ? (const void*)&alpha_h : (const void*)&alpha, A, lda,
+                    strideA, B, ldb, strideB,
+                    fp16 ? (const void*)&beta_h : (const void*)&beta, C, ldc,
+                    strideC, batchCount)) {
+      return;
+    }
+  }
   if (fp16) {
     unsigned short alpha_h = FP32toFP16(alpha);
     unsigned short beta_h = FP32toFP16(beta);
@@ -1642,6 +1691,262 @@ static void cublasXGemmBatched(cublasHandle_t handle, cublasOperation_t transa,
   }
 }
 
+// Dense layer in NHWC layout: output = act(input * weights^T + biases), with
+// @batch rows. Where cublasLt supports the activation, the bias and the
+// activation are done in the GEMM epilogue instead of another pass over the
+// output.
+template <typename DataType>
+static void denseBiasAct(cublasHandle_t cublas, int num_outputs, int batch,
+                         int num_inputs, const DataType* weights,
+                         const DataType* input, DataType* output,
+                         const DataType* biases, ActivationFunction act,
+                         cudaStream_t stream) {
+#ifdef CUDA_LT_EPILOGUE
+  if (act == ACTIVATION_NONE || act == ACTIVATION_RELU) {
+    const bool fp16 = std::is_same<half, DataType>::value;
+    const cudaDataType_t type = fp16 ? CUDA_R_16F : CUDA_R_32F;
+    // Same precision as cublasXgemm().
+    cublasLtMatmulDesc_t desc;
+    ReportCUBLASErrors(cublasLtMatmulDescCreate(
+        &desc, fp16 ? CUBLAS_COMPUTE_16F : CUBLAS_COMPUTE_32F, type));
+    const cublasOperation_t trans_a = CUBLAS_OP_T;
+    const cublasOperation_t trans_b = CUBLAS_OP_N;
+    const cublasLtEpilogue_t epilogue = act == ACTIVATION_RELU
+                                            ? CUBLASLT_EPILOGUE_RELU_BIAS
+                                            : CUBLASLT_EPILOGUE_BIAS;
+    ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+        desc, CUBLASLT_MATMUL_DESC_TRANSA, &trans_a, sizeof(trans_a)));
+    ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+        desc, CUBLASLT_MATMUL_DESC_TRANSB, &trans_b, sizeof(trans_b)));
+    ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+        desc, CUBLASLT_MATMUL_DESC_EPILOGUE, &epilogue, sizeof(epilogue)));
+    ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+        desc, CUBLASLT_MATMUL_DESC_BIAS_POINTER, &biases, sizeof(biases)));
+
+    cublasLtMatrixLayout_t layout_a, layout_b, layout_c;
+    ReportCUBLASErrors(cublasLtMatrixLayoutCreate(&layout_a, type, num_inputs,
+                                                  num_outputs, num_inputs));
+    ReportCUBLASErrors(cublasLtMatrixLayoutCreate(&layout_b, type, num_inputs,
+                                                  batch, num_inputs));
+    ReportCUBLASErrors(cublasLtMatrixLayoutCreate(&layout_c, type, num_outputs,
+                                                  batch, num_outputs));
+
+    const float alpha = 1.0f;
+    const float beta = 0.0f;
+    const unsigned short alpha_h = FP32toFP16(alpha);
+    const unsigned short beta_h = FP32toFP16(beta);
+    // A cublas handle can be used as a cublasLt handle.
+    ReportCUBLASErrors(cublasLtMatmul(
+        (cublasLtHandle_t)cublas, desc,
+        fp16 ? (const void*)&alpha_h : (const void*)&alpha, weights, layout_a,
+        input, layout_b, fp16 ? (const void*)&beta_h : (const void*)&beta,
+        output, layout_c, output, layout_c, nullptr, nullptr, 0, stream));
+
+    cublasLtMatrixLayoutDestroy(layout_c);
+    cublasLtMatrixLayoutDestroy(layout_b);
+    cublasLtMatrixLayoutDestroy(layout_a);
+    cublasLtMatmulDescDestroy(desc);
+    return;
+  }
+#endif
+  cublasXgemm<DataType>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                        num_inputs, 1.0f, weights, num_inputs, input,
+                        num_inputs, 0.0f, output, num_outputs);
+  addBiasBatched(output, output, biases, 1, batch, num_outputs, act, stream);
+}
+
+QuantizedGemm::QuantizedGemm(Quantization type, int max_rows, int max_inputs,
+                             int max_columns)
+    : type_(type),
+      max_rows_(max_rows),
+      max_inputs_(max_inputs),
+      max_columns_(max_columns) {
+#ifndef CUDA_FP8_GEMM
+  if (type_ == Quantization::kFp8) {
+    throw Exception("FP8 quantization requires CUDA 11.8 and cuBLASLt.");
+  }
+#endif
+  ReportCUDAErrors(cudaMalloc(&activations_, (size_t)max_rows_ * max_inputs_));
+  ReportCUDAErrors(cudaMalloc(&row_scales_, max_rows_ * sizeof(float)));
+  // int32 and float accumulators have the same size.
+  ReportCUDAErrors(cudaMalloc(&accumulators_,
+                              (size_t)max_rows_ * max_columns_ * sizeof(int)));
+  if (type_ == Quantization::kFp8) {
+    ReportCUDAErrors(cudaMalloc(&workspace_, kCublasLtWorkspaceSize));
+  }
+}
+
+QuantizedGemm::~QuantizedGemm() {
+  ReportCUDAErrors(cudaFree(activations_));
+  ReportCUDAErrors(cudaFree(row_scales_));
+  ReportCUDAErrors(cudaFree(accumulators_));
+  if (workspace_) ReportCUDAErrors(cudaFree(workspace_));
+}
+
+QuantizedGemm::Weights QuantizedGemm::Quantize(
+    const std::vector<float>& weights, int num_inputs, int count) const {
+  Weights result;
+  const int num_outputs = weights.size() / num_inputs / count;
+  // Tensor core GEMMs need the dimensions to be multiples of 16.
+  if (num_inputs % 16 != 0 || num_outputs % 16 != 0 ||
+      num_inputs > max_inputs_ || num_outputs * count > max_columns_) {
+    return result;
+  }
+  const int rows = num_outputs * count;
+  std::vector<uint8_t> quantized(weights.size());
+  std::vector<float> scales(rows);
+  for (int row = 0; row < rows; row++) {
+    const float* w = &weights[(size_t)row * num_inputs];
+    float max_abs = 0.0f;
+    for (int i = 0; i < num_inputs; i++) {
+      max_abs = std::max(max_abs, std::abs(w[i]));
+    }
+    const float max_quantized = type_ == Quantization::kFp8 ? 448.0f : 127.0f;
+    const float scale = max_abs > 0.0f ? max_abs / max_quantized : 1.0f;
+    scales[row] = scale;
+    uint8_t* q = &quantized[(size_t)row * num_inputs];
+    for (int i = 0; i < num_inputs; i++) {
+      if (type_ == Quantization::kFp8) {
+        q[i] = FP32toFP8E4M3FN(w[i] / scale);
+      } else {
+        const long v = std::lround(w[i] / scale);
+        q[i] = static_cast<uint8_t>(
+            static_cast<int8_t>(std::clamp(v, -127L, 127L)));
+      }
+    }
+  }
+  ReportCUDAErrors(cudaMalloc(&result.weights, quantized.size()));
+  ReportCUDAErrors(cudaMemcpy(result.weights, quantized.data(),
+                              quantized.size(), cudaMemcpyHostToDevice));
+  ReportCUDAErrors(cudaMalloc(&result.scales, rows * sizeof(float)));
+  ReportCUDAErrors(cudaMemcpy(result.scales, scales.data(),
+                              rows * sizeof(float), cudaMemcpyHostToDevice));
+  result.num_inputs = num_inputs;
+  result.num_outputs = num_outputs;
+  result.count = count;
+  return result;
+}
+
+bool QuantizedGemm::HasFp8Support() {
+#ifdef CUDA_FP8_GEMM
+  return true;
+#else
+  return false;
+#endif
+}
+
+void QuantizedGemm::Free(Weights* weights) {
+  if (weights->weights) ReportCUDAErrors(cudaFree(weights->weights));
+  if (weights->scales) ReportCUDAErrors(cudaFree(weights->scales));
+  *weights = Weights();
+}
+
+// Computes accumulators_[i] = activations_ * weights[i]^T for the first @rows
+// rows, [count][rows][num_outputs].
+void QuantizedGemm::Gemm(const Weights& weights, int rows,
+                         cublasHandle_t cublas, cudaStream_t stream) const {
+  const int m = weights.num_outputs;
+  const int n = rows;
+  const int k = weights.num_inputs;
+  const long long stride_a = (long long)m * k;
+  const long long stride_c = (long long)m * n;
+  if (type_ == Quantization::kInt8) {
+    const int alpha = 1;
+    const int beta = 0;
+    ReportCUBLASErrors(cublasGemmStridedBatchedEx(
+        cublas, CUBLAS_OP_T, CUBLAS_OP_N, m, n, k, &alpha, weights.weights,
+        CUDA_R_8I, k, stride_a, activations_, CUDA_R_8I, k, 0, &beta,
+        accumulators_, CUDA_R_32I, m, stride_c, weights.count,
+        CUBLAS_COMPUTE_32I, CUBLAS_GEMM_DEFAULT));
+    return;
+  }
+#ifdef CUDA_FP8_GEMM
+  // A cublas handle can be used as a cublasLt handle.
+  cublasLtHandle_t lt = (cublasLtHandle_t)cublas;
+  cublasLtMatmulDesc_t desc;
+  ReportCUBLASErrors(
+      cublasLtMatmulDescCreate(&desc, CUBLAS_COMPUTE_32F, CUDA_R_32F));
+  const cublasOperation_t trans_a = CUBLAS_OP_T;
+  const cublasOperation_t trans_b = CUBLAS_OP_N;
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSA, &trans_a, sizeof(trans_a)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSB, &trans_b, sizeof(trans_b)));
+
+  cublasLtMatrixLayout_t layout_a, layout_b, layout_c;
+  ReportCUBLASErrors(
+      cublasLtMatrixLayoutCreate(&layout_a, CUDA_R_8F_E4M3, k, m, k));
+  ReportCUBLASErrors(
+      cublasLtMatrixLayoutCreate(&layout_b, CUDA_R_8F_E4M3, k, n, k));
+  ReportCUBLASErrors(
+      cublasLtMatrixLayoutCreate(&layout_c, CUDA_R_32F, m, n, m));
+  const int32_t batch_count = weights.count;
+  const int64_t stride_b = 0;
+  for (auto [layout, stride] : {std::make_pair(layout_a, (int64_t)stride_a),
+                                std::make_pair(layout_b, stride_b),
+                                std::make_pair(layout_c, (int64_t)stride_c)}) {
+    ReportCUBLASErrors(cublasLtMatrixLayoutSetAttribute(
+        layout, CUBLASLT_MATRIX_LAYOUT_BATCH_COUNT, &batch_count,
+        sizeof(batch_count)));
+    ReportCUBLASErrors(cublasLtMatrixLayoutSetAttribute(
+        layout, CUBLASLT_MATRIX_LAYOUT_STRIDED_BATCH_OFFSET, &stride,
+        sizeof(stride)));
+  }
+
+  const float alpha = 1.0f;
+  const float beta = 0.0f;
+  ReportCUBLASErrors(cublasLtMatmul(
+      lt, desc, &alpha, weights.weights, layout_a, activations_, layout_b,
+      &beta, accumulators_, layout_c, accumulators_, layout_c, nullptr,
+      workspace_, kCublasLtWorkspaceSize, stream));
+
+  cublasLtMatrixLayoutDestroy(layout_c);
+  cublasLtMatrixLayoutDestroy(layout_b);
+  cublasLtMatrixLayoutDestroy(layout_a);
+  cublasLtMatmulDescDestroy(desc);
+#else
+  (void)stream;
+#endif
+}
+
+template <typename DataType>
+void QuantizedGemm::Eval(const Weights& weights, DataType* output,
+                         size_t output_stride, const DataType* input, int rows,
+                         cublasHandle_t cublas, cudaStream_t stream) const {
+  const int num_inputs = weights.num_inputs;
+  const int num_outputs = weights.num_outputs;
+  // The rows are processed in chunks that fit in the workspace.
+  for (int start = 0; start < rows; start += max_rows_) {
+    const int n = std::min(max_rows_, rows - start);
+    quantizeRows(activations_, row_scales_, input + (size_t)start * num_inputs,
+                 n, num_inputs, type_ == Quantization::kFp8, stream);
+    Gemm(weights, n, cublas, stream);
+    for (int i = 0; i < weights.count; i++) {
+      DataType* out = output + i * output_stride + (size_t)start * num_outputs;
+      const float* col_scales = weights.scales + i * num_outputs;
+      const size_t acc_offset = (size_t)i * n * num_outputs;
+      if (type_ == Quantization::kFp8) {
+        dequantizeRows(out, (const float*)accumulators_ + acc_offset,
+                       row_scales_, col_scales, n, num_outputs, stream);
+      } else {
+        dequantizeRows(out, (const int*)accumulators_ + acc_offset,
+                       row_scales_, col_scales, n, num_outputs, stream);
+      }
+    }
+  }
+}
+
+template void QuantizedGemm::Eval<half>(const Weights& weights, half* output,
+                                        size_t output_stride,
+                                        const half* input, int rows,
+                                        cublasHandle_t cublas,
+                                        cudaStream_t stream) const;
+template void QuantizedGemm::Eval<float>(const Weights& weights, float* output,
+                                         size_t output_stride,
+                                         const float* input, int rows,
+                                         cublasHandle_t cublas,
+                                         cudaStream_t stream) const;
+
 // input/output tensor is in_out_tensor, others are used as scratch.
 template <typename DataType>
 void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
@@ -1733,10 +2038,16 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     mha_k = mha_q + num_outputs * max_batch;
     mha_v = mha_k + num_outputs * max_batch;
 
-    cublasXGemmStridedBatched<DataType>(
-        cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch, num_inputs, 1.0f,
-        mha_qkv_w, num_inputs, num_inputs * num_outputs, in_out_tensor,
-        num_inputs, 0, 0.0f, mha_q, num_outputs, num_outputs * max_batch, 3);
+    if (mha_qkv_q_.weights) {
+      quantized_gemm_->Eval(mha_qkv_q_, mha_q, num_outputs * max_batch,
+                            (const DataType*)in_out_tensor, batch, cublas,
+                            stream);
+    } else {
+      cublasXGemmStridedBatched<DataType>(
+          cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch, num_inputs,
+          1.0f, mha_qkv_w, num_inputs, num_inputs * num_outputs, in_out_tensor,
+          num_inputs, 0, 0.0f, mha_q, num_outputs, num_outputs * max_batch, 3);
+    }
     addBiasBatched<DataType>(mha_q, mha_q, mha_qkv_b, 3, batch, num_outputs,
                              max_batch, ACTIVATION_NONE, stream);
   }
@@ -1760,109 +2071,131 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
   // shape(k)[-1] = depth
   float factor = 1.0f / sqrt((float)depth);
 
-  // matmul_qk = tf.matmul(q, k, transpose_b=True)
-  {
-    if (*offset_pointers == nullptr) {
-      std::vector<DataType*> offsets(encoder_heads_ * max_batch_size_ * 5);
-      for (int i = 0; i < encoder_heads_ * max_batch_size_; i++) {
-        int h = i % encoder_heads_;
-        int n = i / encoder_heads_;
-        offsets[i] = mha_k + h * depth + 64 * d_model * n;
-        offsets[i + encoder_heads_ * max_batch_size_] =
-            mha_q + h * depth + 64 * d_model * n;
-        offsets[i + 2 * encoder_heads_ * max_batch_size_] =
-            buffer1 + i * 64 * 64;
-        offsets[i + 3 * encoder_heads_ * max_batch_size_] =
-            mha_v + h * depth + 64 * d_model * n;
-        offsets[i + 4 * encoder_heads_ * max_batch_size_] =
-            buffer2 + h * depth + 64 * d_model * n;
+  // Output of the attention, input of the final dense layer.
+  DataType* attention_output = buffer2;
+  DataType* dense_output = buffer1;
+
+  if (fused_mha_) {
+    // Smolgen weights are in buffer2, so the output goes to buffer1.
+    fusedMHA<DataType>(buffer1, mha_q, mha_k, mha_v,
+                       has_smolgen_ ? buffer2 : nullptr, N, encoder_heads_,
+                       depth, factor, stream);
+    attention_output = buffer1;
+    dense_output = buffer2;
+  } else {
+    // matmul_qk = tf.matmul(q, k, transpose_b=True)
+    {
+      if (*offset_pointers == nullptr) {
+        std::vector<DataType*> offsets(encoder_heads_ * max_batch_size_ * 5);
+        for (int i = 0; i < encoder_heads_ * max_batch_size_; i++) {
+          int h = i % encoder_heads_;
+          int n = i / encoder_heads_;
+          offsets[i] = mha_k + h * depth + 64 * d_model * n;
+          offsets[i + encoder_heads_ * max_batch_size_] =
+              mha_q + h * depth + 64 * d_model * n;
+          offsets[i + 2 * encoder_heads_ * max_batch_size_] =
+              buffer1 + i * 64 * 64;
+          offsets[i + 3 * encoder_heads_ * max_batch_size_] =
+              mha_v + h * depth + 64 * d_model * n;
+          offsets[i + 4 * encoder_heads_ * max_batch_size_] =
+              buffer2 + h * depth + 64 * d_model * n;
+        }
+        ReportCUDAErrors(
+            cudaMalloc((void**)offset_pointers,
+                       encoder_heads_ * max_batch_size_ * 5 *
+                           sizeof(DataType*)));
+        ReportCUDAErrors(
+            cudaMemcpy(*offset_pointers, offsets.data(),
+                       encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*),
+                       cudaMemcpyHostToDevice));
       }
-      ReportCUDAErrors(
-          cudaMalloc((void**)offset_pointers,
-                     encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*)));
-      ReportCUDAErrors(
-          cudaMemcpy(*offset_pointers, offsets.data(),
-                     encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*),
-                     cudaMemcpyHostToDevice));
+      cublasXGemmBatched<DataType>(
+          cublas, CUBLAS_OP_T, CUBLAS_OP_N, 64 /*M*/, 64 /*N*/,
+          depth /*K*/,  // A/B, and M/N are swapped for row-major to col-major
+                        // transform
+          factor,       // to handle "/ tf.math.sqrt(dk)"
+          *offset_pointers,  // mha_k + offset /*A*/,
+          d_model /*LDA*/,   // (d_model = depth * encoder_heads_) to skip over
+                             // other "depth" slices / heads
+          // 64 * d_model,     /*strideA*/
+          *offset_pointers +
+              encoder_heads_ * max_batch_size_,  // mha_q + offset /*B*/,
+          d_model /*LDB*/,  // to skip over other other "depth" slices / heads
+          // 64 * d_model,     /*strideB*/
+          0.0f,
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 2,  // buffer1 + outOffset /*C*/,  // output
+                                     // (matmul_qk) goes to buffer1
+          64 /*LDC*/,
+          // 64 * 64 /*strideC*/,
+          N * encoder_heads_);
+    }
+
+    // attention_weights = tf.nn.softmax(scaled_attention_logits, axis = -1)
+    // attention_weights -> buffer1
+    if (has_smolgen_) {
+      // Add smolgen weights to the scaled matmul_qk attention logits before
+      // softmax.
+      Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1, buffer2, stream);
+    } else {
+      Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1,
+              (const DataType*)nullptr, stream);
+    }
+
+    {
+      cublasXGemmBatched<DataType>(
+          cublas, CUBLAS_OP_N, CUBLAS_OP_N, depth /*M*/, 64 /*N*/, 64 /*K*/,
+          1.0f,
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 3,  // mha_v + offset /*A*/,  // "v" matrix
+          d_model /*LDA*/,  // to skip over other "depth" slices / heads
+          // 64 * d_model,          /*strideA*/
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 2,  // buffer1 + weightsOffset /*B*/,
+          64 /*LDB*/,                // 64 * 64, /*strideB*/
+          0.0f,
+          *offset_pointers +
+              encoder_heads_ * max_batch_size_ *
+                  4,  // buffer2 + offset /*C*/,  // output goes to buffer2
+          d_model /*LDC*/,
+          // 64 * d_model /*strideC*/,
+          N * encoder_heads_);
     }
-    cublasXGemmBatched<DataType>(
-        cublas, CUBLAS_OP_T, CUBLAS_OP_N, 64 /*M*/, 64 /*N*/,
-        depth /*K*/,  // A/B, and M/N are swapped for row-major to col-major
-                      // transform
-        factor,       // to handle "/ tf.math.sqrt(dk)"
-        *offset_pointers,  // mha_k + offset /*A*/,
-        d_model /*LDA*/,   // (d_model = depth * encoder_heads_) to skip over
-                           // other "depth" slices / heads
-        // 64 * d_model,     /*strideA*/
-        *offset_pointers +
-            encoder_heads_ * max_batch_size_,  // mha_q + offset /*B*/,
-        d_model /*LDB*/,  // to skip over other other "depth" slices / heads
-        // 64 * d_model,     /*strideB*/
-        0.0f,
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               2,  // buffer1 + outOffset /*C*/,  // output
-                                   // (matmul_qk) goes to buffer1
-        64 /*LDC*/,
-        // 64 * 64 /*strideC*/,
-        N * encoder_heads_);
-  }
-
-  // attention_weights = tf.nn.softmax(scaled_attention_logits, axis = -1)
-  // attention_weights -> buffer1
-  if (has_smolgen_) {
-    // Add smolgen weights to the scaled matmul_qk attention logits before
-    // softmax.
-    Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1, buffer2, stream);
-  } else {
-    Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1,
-            (const DataType*)nullptr, stream);
   }
 
-  {
-    cublasXGemmBatched<DataType>(
-        cublas, CUBLAS_OP_N, CUBLAS_OP_N, depth /*M*/, 64 /*N*/, 64 /*K*/, 1.0f,
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               3,  // mha_v + offset /*A*/,  // "v" matrix
-        d_model /*LDA*/,           // to skip over other "depth" slices / heads
-        // 64 * d_model,          /*strideA*/
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               2,  // buffer1 + weightsOffset /*B*/,
-        64 /*LDB*/,                // 64 * 64, /*strideB*/
-        0.0f,
-        *offset_pointers +
-            encoder_heads_ * max_batch_size_ *
-                4,  // buffer2 + offset /*C*/,  // output goes to buffer2
-        d_model /*LDC*/,
-        // 64 * d_model /*strideC*/,
-        N * encoder_heads_);
-  }
-
-  // #final dense layer (mha_dense), buffer2 -> buffer1
+  // #final dense layer (mha_dense), buffer2 -> buffer1 (the other way around
+  // with the fused attention)
   {
     const int num_inputs = d_model;
     const int num_outputs = embedding_op_size_;
     const int batch = N * 64;
     cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
                 num_inputs, 1.0f, (const DataType*)mha_dense_w, num_inputs,
-                buffer2, num_inputs, 0.0f, buffer1, num_outputs);
+                attention_output, num_inputs, 0.0f, dense_output, num_outputs);
   }
 
   // LN1: skip connection and layer normalization (also bias add of prev gemm)
   // buffer1/in_out_tensor -> scratch
-  LayerNorm<DataType>(N * 64, embedding_op_size_, scratch, buffer1, mha_dense_b,
-                      in_out_tensor, ln1_gammas, ln1_betas, default_eps_,
-                      alpha_, ACTIVATION_NONE, stream);
+  LayerNorm<DataType>(N * 64, embedding_op_size_, scratch, dense_output,
+                      mha_dense_b, in_out_tensor, ln1_gammas, ln1_betas,
+                      default_eps_, alpha_, ACTIVATION_NONE, stream);
 
   // #FFN dense 1, scratch -> in_out_tensor
   {
     const int num_inputs = embedding_op_size_;
     const int num_outputs = ffn_dense1_size_;  // encoder_dff
     const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
-                scratch, num_inputs, 0.0f, in_out_tensor, num_outputs);
-    addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
-                   num_outputs, ffn_activation_, stream);
+    if (ffn_dense1_q_.weights) {
+      quantized_gemm_->Eval(ffn_dense1_q_, in_out_tensor, 0,
+                            (const DataType*)scratch, batch, cublas, stream);
+      addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
+                     num_outputs, ffn_activation_, stream);
+    } else {
+      denseBiasAct(cublas, num_outputs, batch, num_inputs,
+                   (const DataType*)ffn_dense1_w, (const DataType*)scratch,
+                   in_out_tensor, (const DataType*)ffn_dense1_b,
+                   ffn_activation_, stream);
+    }
   }
 
   // #FFN dense 2, in_out_tensor -> buffer1
@@ -1870,9 +2203,15 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     const int num_inputs = ffn_dense1_size_;  // encoder_dff
     const int num_outputs = embedding_op_size_;
     const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
-                in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs);
+    if (ffn_dense2_q_.weights) {
+      quantized_gemm_->Eval(ffn_dense2_q_, buffer1, 0,
+                            (const DataType*)in_out_tensor, batch, cublas,
+                            stream);
+    } else {
+      cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
+                  in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs);
+    }
   }
 
   // LN2: skip connection and layer normilization (also bias add of prev gemm)
@@ -1997,6 +2336,9 @@ EncoderBlock<DataType>::~EncoderBlock() {
   ReportCUDAErrors(cudaFree(ffn_dense2_b));
   ReportCUDAErrors(cudaFree(ln2_gammas));
   ReportCUDAErrors(cudaFree(ln2_betas));
+  QuantizedGemm::Free(&mha_qkv_q_);
+  QuantizedGemm::Free(&ffn_dense1_q_);
+  QuantizedGemm::Free(&ffn_dense2_q_);
   if (has_smolgen_) {
     ReportCUDAErrors(cudaFree(smol_compress));
     ReportCUDAErrors(cudaFree(smol_dense1_w));
@@ -2034,10 +2376,8 @@ void EmbeddingLayer<DataType>::Eval(
   const int num_outputs = this->GetC();
   const int num_inputs = this->input_->GetC();
   const int batch = N * 64;
-  cublasXgemm<DataType>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                        num_inputs, 1.0f, weights_, num_inputs, input,
-                        num_inputs, 0.0f, output, num_outputs);
-  addBiasBatched(output, output, biases_, 1, batch, num_outputs, act_, stream);
+  denseBiasAct<DataType>(cublas, num_outputs, batch, num_inputs, weights_,
+                         input, output, biases_, act_, stream);
 }
 
 template <typename DataType>
@@ -2045,7 +2385,9 @@ AttentionBody<DataType>::AttentionBody(const MultiHeadWeights& weights,
                                        void* scratch, Activations activations,
                                        int num_res_blocks, int input_c,
                                        int max_batch_size,
-                                       bool is_pe_dense_embedding)
+                                       bool is_pe_dense_embedding,
+                                       bool fused_mha,
+                                       const QuantizedGemm* quantized_gemm)
     : BaseLayer<DataType>(weights.ip_emb_b.size(), 8, 8, nullptr),
       embedding_op_size_(weights.ip_emb_b.size()),
       encoder_head_count_(weights.encoder_head_count),
@@ -2110,7 +2452,7 @@ AttentionBody<DataType>::AttentionBody(const MultiHeadWeights& weights,
         enc, scratch, encoder_head_count_, embedding_op_size_, alpha,
         smolgen_global_, smolgen_global_size_, max_batch_size,
         activations_.smolgen_activation, activations_.ffn_activation,
-        is_pe_dense_embedding_ ? 1e-3 : 1e-6);
+        is_pe_dense_embedding_ ? 1e-3 : 1e-6, fused_mha, quantized_gemm);
     encoder_weights_.emplace_back(pW);
   }
 }
@@ -2241,11 +2583,10 @@ void AttentionBody<DataType>::Eval(int N, DataType* output,
       const int num_inputs = embedding_ffn_size_;
       const int num_outputs = embedding_ffn_dff_;  // encoder_dff
       const int batch = N * 64;
-      cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                  num_inputs, 1.0f, (const DataType*)ip_emb_ffn_d1_w_,
-                  num_inputs, temp, num_inputs, 0.0f, buffer1, num_outputs);
-      addBiasBatched(buffer1, buffer1, ip_emb_ffn_d1_b_, 1, batch, num_outputs,
-                     activations_.ffn_activation, stream);
+      denseBiasAct(cublas, num_outputs, batch, num_inputs,
+                   (const DataType*)ip_emb_ffn_d1_w_, (const DataType*)temp,
+                   buffer1, (const DataType*)ip_emb_ffn_d1_b_,
+                   activations_.ffn_activation, stream);
     }
 
     // embedding FFN dense 2
@@ -29,6 +29,7 @@
 #include <cublas_v2.h>
 
 #include <cstddef>
+#include <vector>
 
 #include "cuda_common.h"
 #include "neural/network_legacy.h"
@@ -333,6 +334,64 @@ class ResidualBlock : public BaseLayer<DataType> {
   DataType* b2_;
 };
 
+enum class Quantization { kNone, kInt8, kFp8 };
+
+// Runs fully connected layers with the weights quantized per output channel
+// (at load time) and the activations quantized per row (at run time), on the
+// int8 or fp8 tensor cores. The accumulators are dequantized to DataType, the
+// bias and activation are applied by the caller as for the regular GEMMs.
+// The workspace is shared by all layers, so evaluations must not overlap.
+class QuantizedGemm {
+ public:
+  // A set of @count weight matrices of the same shape, stored one after
+  // another, that are multiplied with the same input.
+  struct Weights {
+    void* weights = nullptr;
+    float* scales = nullptr;
+    int num_inputs = 0;
+    int num_outputs = 0;
+    int count = 1;
+  };
+
+  // @max_columns is the maximum of num_outputs * count.
+  QuantizedGemm(Quantization type, int max_rows, int max_inputs,
+                int max_columns);
+  ~QuantizedGemm();
+
+  // Quantizes row-major [count][num_outputs][num_inputs] weights. Returns empty
+  // weights (to run the layer unquantized) for the shapes the quantized GEMMs
+  // don't support.
+  Weights Quantize(const std::vector<float>& weights, int num_inputs,
+                   int count = 1) const;
+  static void Free(Weights* weights);
+
+  // output[i] = input * weights[i]^T, with output[i] @output_stride elements
+  // apart.
+  template <typename DataType>
+  void Eval(const Weights& weights, DataType* output, size_t output_stride,
+            const DataType* input, int rows, cublasHandle_t cublas,
+            cudaStream_t stream) const;
+
+  Quantization GetType() const { return type_; }
+  // Whether the FP8 GEMMs were compiled in.
+  static bool HasFp8Support();
+
+ private:
+  void Gemm(const Weights& weights, int rows, cublasHandle_t cublas,
+            cudaStream_t stream) const;
+
+  static constexpr size_t kCublasLtWorkspaceSize = 32 * 1024 * 1024;
+
+  const Quantization type_;
+  const int max_rows_;
+  const int max_inputs_;
+  const int max_columns_;
+  void* activations_ = nullptr;  // max_rows_ * max_inputs_ bytes.
+  float* row_scales_ = nullptr;
+  void* accumulators_ = nullptr;  // max_rows_ * max_columns_ int32 or float.
+  void* workspace_ = nullptr;     // cublasLt workspace.
+};
+
 template <typename DataType>
 class EncoderBlock {
  public:
@@ -340,7 +399,9 @@ class EncoderBlock {
                int heads, int size, float alpha,
                DataType* smolgen_global_scratch, int smolgen_global_size,
                int max_batch_size, ActivationFunction smolgen_act,
-               ActivationFunction ffn_act, float default_eps);
+               ActivationFunction ffn_act, float default_eps,
+               bool fused_mha = false,
+               const QuantizedGemm* quantized_gemm = nullptr);
   ~EncoderBlock();
 
   void Eval(int N, DataType* inpop, DataType* scratch0, DataType* scratch1,
@@ -393,6 +454,14 @@ class EncoderBlock {
   int smol_global_size_;
 
   const int max_batch_size_;
+  // Use the fused attention kernel instead of the GEMM/softmax/GEMM sequence.
+  const bool fused_mha_;
+
+  // Quantized copies of the QKV and FFN weights, when quantized_gemm_ is set.
+  const QuantizedGemm* quantized_gemm_;
+  QuantizedGemm::Weights mha_qkv_q_;
+  QuantizedGemm::Weights ffn_dense1_q_;
+  QuantizedGemm::Weights ffn_dense2_q_;
 };
 
 // The Attention policy head implementation
@@ -476,7 +545,9 @@ class AttentionBody : public BaseLayer<DataType> {
  public:
   AttentionBody(const MultiHeadWeights& weights, void* scratch,
                 Activations activations, int num_res_blocks, int input_c,
-                int max_batch_size, bool is_pe_dense_embedding);
+                int max_batch_size, bool is_pe_dense_embedding,
+                bool fused_mha = false,
+                const QuantizedGemm* quantized_gemm = nullptr);
   ~AttentionBody();
   void Eval(int N, DataType* output, const DataType* input,
             const DataType* input2, void* scratch, size_t scratch_size,
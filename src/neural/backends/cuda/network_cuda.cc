@@ -25,22 +25,40 @@
   Program grant you additional permission to convey the resulting work.
 */
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "cuda_common.h"
+#include "gemm_tuner.h"
 #include "inputs_outputs.h"
 #include "kernels.h"
 #include "layers.h"
+#include "neural/encoder.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
 #include "neural/tables/attention_policy_map.h"
 #include "neural/tables/policy_map.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/logging.h"
+#include "utils/string.h"
 
 namespace lczero {
 using namespace cudnn_backend;
@@ -48,6 +66,36 @@ using namespace cudnn_backend;
 template <typename DataType>
 class CudaNetwork;
 
+// Returns whether an MPS control daemon is running for the processes of this
+// user, so that their kernels can run concurrently on the same GPU.
+static bool IsMpsActive() {
+#ifdef _WIN32
+  return false;
+#else
+  const char* pipe_dir = std::getenv("CUDA_MPS_PIPE_DIRECTORY");
+  const std::string dir = pipe_dir ? pipe_dir : "/tmp/nvidia-mps";
+  return GetFileTime(dir + "/control") != 0;
+#endif
+}
+
+// Limits the share of the SMs the kernels of this process use under MPS. Only
+// has effect before the CUDA context of the process is created.
+static void SetMpsSmPercent(int percent) {
+#ifdef _WIN32
+  (void)percent;
+  throw Exception("The mps_sm_percent option needs CUDA MPS, Linux only.");
+#else
+  const std::string value = std::to_string(percent);
+  const char* current = std::getenv("CUDA_MPS_ACTIVE_THREAD_PERCENTAGE");
+  if (current && value != current) {
+    CERR << "WARNING: CUDA_MPS_ACTIVE_THREAD_PERCENTAGE=" << current
+         << " is already set, ignoring mps_sm_percent.";
+    return;
+  }
+  setenv("CUDA_MPS_ACTIVE_THREAD_PERCENTAGE", value.c_str(), 1);
+#endif
+}
+
 static size_t getMaxAttentionHeadSize(
     const MultiHeadWeights::PolicyHead& weights, int N) {
   const size_t embedding_op_size = weights.ip_pol_b.size();
@@ -125,19 +173,28 @@ class CudaNetworkComputation : public NetworkComputation {
   ~CudaNetworkComputation();
 
   void AddInput(InputPlanes&& input) override {
-    const auto iter_mask =
-        &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes];
-    const auto iter_val =
-        &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes];
+    // The whole policy has to be copied when any sample doesn't have indices.
+    gather_policy_ = false;
+    AddPlanes(input);
+  }
 
-    int i = 0;
-    for (const auto& plane : input) {
-      iter_mask[i] = plane.mask;
-      iter_val[i] = plane.value;
-      i++;
+  void AddInputWithPolicyIndices(
+      InputPlanes&& input, std::span<const uint16_t> policy_indices) override {
+    if (policy_indices.size() > kMaxGatheredPolicyPerSample) {
+      gather_policy_ = false;
     }
-
-    batch_size_++;
+    if (gather_policy_) {
+      // Indices are flattened to the whole batch, so that the gather kernel
+      // can copy them with one thread per move.
+      gathered_policy_offsets_.push_back(gathered_policy_size_);
+      int* indices =
+          &inputs_outputs_->policy_gather_indices_mem_[gathered_policy_size_];
+      for (uint16_t idx : policy_indices) {
+        *indices++ = batch_size_ * kNumOutputPolicy + idx;
+      }
+      gathered_policy_size_ += policy_indices.size();
+    }
+    AddPlanes(input);
   }
 
   void ComputeBlocking() override;
@@ -164,6 +221,12 @@ class CudaNetworkComputation : public NetworkComputation {
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
+  const float* GetGatheredPVals(int sample) const override {
+    if (!gather_policy_) return nullptr;
+    return &inputs_outputs_
+                ->op_gathered_policy_mem_[gathered_policy_offsets_[sample]];
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_[sample];
@@ -172,11 +235,41 @@ class CudaNetworkComputation : public NetworkComputation {
   }
 
  private:
+  void AddPlanes(const InputPlanes& input) {
+    if (network_->UsesCompactInput()) {
+      // The compact inputs are smaller than the masks, and use their buffer.
+      static_assert(sizeof(CompactInputPlanes) <=
+                    sizeof(uint64_t) * kInputPlanes);
+      reinterpret_cast<CompactInputPlanes*>(
+          inputs_outputs_->input_masks_mem_)[batch_size_] =
+          CompactifyInputPlanes(input);
+      batch_size_++;
+      return;
+    }
+    const auto iter_mask =
+        &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes];
+    const auto iter_val =
+        &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes];
+
+    int i = 0;
+    for (const auto& plane : input) {
+      iter_mask[i] = plane.mask;
+      iter_val[i] = plane.value;
+      i++;
+    }
+
+    batch_size_++;
+  }
+
   // Memory holding inputs, outputs.
   std::unique_ptr<InputsOutputs> inputs_outputs_;
   int batch_size_;
   bool wdl_;
   bool moves_left_;
+  // Whether only the policy of the legal moves is copied from the device.
+  bool gather_policy_ = true;
+  int gathered_policy_size_ = 0;
+  std::vector<int> gathered_policy_offsets_;
 
   CudaNetwork<DataType>* network_;
 };
@@ -184,12 +277,15 @@ class CudaNetworkComputation : public NetworkComputation {
 template <typename DataType>
 class CudaNetwork : public Network {
  public:
-  CudaNetwork(const WeightsFile& file, const OptionsDict& options)
+  // @gpu_id overrides the "gpu" option, it's set when the network is one of
+  // the devices of CudaMultiNetwork.
+  CudaNetwork(const WeightsFile& file, const OptionsDict& options,
+              std::optional<int> gpu_id = std::nullopt)
       : capabilities_{file.format().network_format().input(),
                       file.format().network_format().output(),
                       file.format().network_format().moves_left()} {
     MultiHeadWeights weights(file.weights());
-    gpu_id_ = options.GetOrDefault<int>("gpu", 0);
+    gpu_id_ = gpu_id ? *gpu_id : options.GetOrDefault<int>("gpu", 0);
 
     const auto nf = file.format().network_format();
     using NF = pblczero::NetworkFormat;
@@ -208,6 +304,14 @@ class CudaNetwork : public Network {
     if (max_batch_size_ < min_batch_size_)
       throw Exception("Max batch must not be less than min_batch setting.");
 
+    // Percentage of the SMs of the GPU for this process when several processes
+    // share it through MPS. Zero keeps the default of the MPS daemon.
+    const int mps_sm_percent = options.GetOrDefault<int>("mps_sm_percent", 0);
+    if (mps_sm_percent < 0 || mps_sm_percent > 100) {
+      throw Exception("Invalid mps_sm_percent for cuda backend.");
+    }
+    if (mps_sm_percent > 0) SetMpsSmPercent(mps_sm_percent);
+
     showInfo();
 
     int total_gpus;
@@ -222,14 +326,76 @@ class CudaNetwork : public Network {
 
     l2_cache_size_ = deviceProp.l2CacheSize;
     sm_count_ = deviceProp.multiProcessorCount;
+    partition_sm_count_ = sm_count_;
+    if (IsMpsActive()) {
+      if (mps_sm_percent > 0) {
+        partition_sm_count_ = std::max(1, sm_count_ * mps_sm_percent / 100);
+      }
+      CERR << "CUDA MPS is active, using " << partition_sm_count_ << " of "
+           << sm_count_ << " SMs.";
+    } else if (mps_sm_percent > 0) {
+      CERR << "WARNING: mps_sm_percent has no effect, CUDA MPS is not active.";
+    }
 
     allow_cache_opt_ = options.GetOrDefault<bool>("cache_opt", false);
 
     // Select GPU to run on (for *the current* thread).
     ReportCUDAErrors(cudaSetDevice(gpu_id_));
 
+    // Free device memory before anything is allocated, to measure how much the
+    // weights take.
+    size_t free_at_start, total_memory;
+    ReportCUDAErrors(cudaMemGetInfo(&free_at_start, &total_memory));
+
+    // Limit of the device memory of the network in MiB, max_batch is lowered
+    // to fit it. Zero means no limit.
+    const size_t max_memory =
+        static_cast<size_t>(options.GetOrDefault<int>("max_memory", 0)) << 20;
+
     multi_stream_ = options.GetOrDefault<bool>("multi_stream", false);
 
+    // Number of streams the computations check out instead of serializing on
+    // a single one, each with its own activation and scratch memory. Unlike
+    // multi_stream, the memory doesn't grow with the number of computations.
+    num_streams_ = options.GetOrDefault<int>("streams", 1);
+    if (num_streams_ < 1) throw Exception("Invalid streams for cuda backend.");
+    if (multi_stream_ && num_streams_ > 1) {
+      throw Exception("The streams option can't be used with multi_stream.");
+    }
+
+    // Upload the inputs from pinned memory and download the policy on a
+    // separate copy stream, overlapping with the evaluation of other batches.
+    // Otherwise the inputs are read by the GPU from mapped host memory.
+    async_copy_ = options.GetOrDefault<bool>("async_copy", false);
+
+    // Capture the network into a CUDA graph per batch size on first use and
+    // replay it afterwards, to save the kernel launch overhead.
+    use_cuda_graphs_ = options.GetOrDefault<bool>("cuda_graphs", false);
+    graph_batch_step_ =
+        std::max(1, options.GetOrDefault<int>("graph_batch_step", 8));
+
+    // Upload the inputs as CompactInputPlanes and expand them on the GPU,
+    // which is about five times less data to copy.
+    compact_input_ = options.GetOrDefault<bool>("compact_input", false);
+
+    // Time the cublasLt algorithms for the GEMM shapes of the network instead
+    // of relying on the cublas heuristics, with the winners cached in a file.
+    if (options.GetOrDefault<bool>("gemm_tuning", false)) {
+      std::string tuner_file;
+      if (options.Exists<std::string>("gemm_tuner_file")) {
+        tuner_file = options.Get<std::string>("gemm_tuner_file");
+      } else {
+        tuner_file = GetUserCacheDirectory();
+        if (!tuner_file.empty()) {
+          tuner_file += "lc0/";
+          CreateDirectory(tuner_file);
+        }
+        tuner_file += "cuda_gemm_tuning";
+      }
+      GemmTuner::Enable(tuner_file,
+                        options.GetOrDefault<bool>("force_tune", false));
+    }
+
     // layout used by cuda backend is nchw.
     has_tensor_cores_ = false;
     constexpr bool fp16 = std::is_same<half, DataType>::value;
@@ -256,6 +422,12 @@ class CudaNetwork : public Network {
 
     if (!multi_stream_) {
       ReportCUBLASErrors(cublasCreate(&cublas_));
+      if (use_cuda_graphs_) {
+        // The legacy default stream can't be captured.
+        ReportCUDAErrors(
+            cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+        ReportCUBLASErrors(cublasSetStream(cublas_, stream_));
+      }
       if (has_tensor_cores_)
         ReportCUBLASErrors(cublasSetMathMode(
             cublas_,
@@ -328,17 +500,6 @@ class CudaNetwork : public Network {
     if (max_weight_size < 3 * residual_single_layer_weight_size)
       max_weight_size = 3 * residual_single_layer_weight_size;
 
-    scratch_size_ = max_weight_size;
-
-    // Need additional space for transformed input/outputs which are 36/16
-    // times size (4x4 block transformed into 6x6).
-    if (numBlocks_ > 0) {
-      const size_t transformed_tensor_size =
-          (size_t)(max_batch_size_ * kNumFilters * 64 * (36.0 / 16.0) *
-                   sizeof(DataType));
-      scratch_size_ = std::max(scratch_size_, 2 * transformed_tensor_size);
-    }
-
     std::string policy_head =
         options.GetOrDefault<std::string>("policy_head", "vanilla");
     // Check that selected policy head exists.
@@ -354,16 +515,26 @@ class CudaNetwork : public Network {
                       "' does not exist in this net.");
     }
 
-    // Attention policy head or body may need more memory
-    const size_t attentionPolicySize =
-        getMaxAttentionHeadSize(weights.policy_heads.at(policy_head),
-                                max_batch_size_) *
-        sizeof(DataType);
-
-    const size_t attentionBodySize =
-        getMaxAttentionBodySize(weights, max_batch_size_) * sizeof(DataType);
-    scratch_size_ = std::max(scratch_size_,
-                             std::max(attentionPolicySize, attentionBodySize));
+    auto get_scratch_size = [&](int batch_size) {
+      size_t size = max_weight_size;
+      // Need additional space for transformed input/outputs which are 36/16
+      // times size (4x4 block transformed into 6x6).
+      if (numBlocks_ > 0) {
+        const size_t transformed_tensor_size =
+            (size_t)(batch_size * kNumFilters * 64 * (36.0 / 16.0) *
+                     sizeof(DataType));
+        size = std::max(size, 2 * transformed_tensor_size);
+      }
+      // Attention policy head or body may need more memory
+      const size_t attentionPolicySize =
+          getMaxAttentionHeadSize(weights.policy_heads.at(policy_head),
+                                  batch_size) *
+          sizeof(DataType);
+      const size_t attentionBodySize =
+          getMaxAttentionBodySize(weights, batch_size) * sizeof(DataType);
+      return std::max(size, std::max(attentionPolicySize, attentionBodySize));
+    };
+    scratch_size_ = get_scratch_size(max_batch_size_);
 
     ReportCUDAErrors(cudaMalloc(&scratch_mem_, scratch_size_));
 
@@ -452,12 +623,29 @@ class CudaNetwork : public Network {
               : static_cast<ActivationFunction>(ffn_activation);
       activations.default_activation = act;
 
+      const Quantization quantization = GetQuantization(options, deviceProp);
+      if (quantization != Quantization::kNone && !weights.encoder.empty()) {
+        if (multi_stream_) {
+          throw Exception("Quantization is not supported with multi_stream.");
+        }
+        const auto& enc = weights.encoder[0];
+        const int d_model = enc.mha.q_b.size();
+        const int dff = enc.ffn.dense1_b.size();
+        const int embedding = enc.ffn.dense2_b.size();
+        // Up to 64 positions at a time.
+        quantized_gemm_ = std::make_unique<QuantizedGemm>(
+            quantization, std::min(max_batch_size_, 64) * 64,
+            std::max(embedding, dff), std::max({3 * d_model, dff, embedding}));
+      }
+
       auto attention_body = std::make_unique<AttentionBody<DataType>>(
           weights, scratch_mem_, activations, numBlocks_,
           numBlocks_ > 0 ? kNumFilters : kInputPlanes, max_batch_size_,
           static_cast<InputEmbedding>(
               file.format().network_format().input_embedding()) ==
-              InputEmbedding::INPUT_EMBEDDING_PE_DENSE);
+              InputEmbedding::INPUT_EMBEDDING_PE_DENSE,
+          options.GetOrDefault<bool>("fused_mha", true),
+          quantized_gemm_.get());
       network_.emplace_back(std::move(attention_body));
 
       encoder_last_ = getLastLayer();
@@ -569,20 +757,50 @@ class CudaNetwork : public Network {
     //    - three buffers of max size are enough (one to hold input, second to
     //      hold output and third to hold skip connection's input).
 
-    // size of input to the network
-    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
-
-    // take max size of all layers
-    for (auto& layer : network_) {
-      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+    auto get_tensor_size = [&](int batch_size) {
+      // size of input to the network
+      size_t size = batch_size * kNumInputPlanes * 64 * sizeof(DataType);
+      // take max size of all layers
+      for (auto& layer : network_) {
+        size = std::max(size, layer->GetOutputSize(batch_size));
+      }
+      if (attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) {
+        size = std::max(size, get_scratch_size(batch_size));
+      }
+      return size;
+    };
+
+    size_t free_memory;
+    ReportCUDAErrors(cudaMemGetInfo(&free_memory, &total_memory));
+    memory_usage_.weights = free_at_start > free_memory + scratch_size_
+                                ? free_at_start - free_memory - scratch_size_
+                                : 0;
+    memory_usage_.scratch = scratch_size_;
+    if (max_memory > 0) {
+      FitMaxMemory(max_memory, get_scratch_size, get_tensor_size);
     }
 
-    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
-        (scratch_size_ > maxSize)) {
-      maxSize = scratch_size_;
+    size_t maxSize = get_tensor_size(max_batch_size_);
+    if (multi_stream_ || num_streams_ > 1) {
+      memory_usage_.workspace = scratch_size_ + 3 * maxSize;
+    } else {
+      memory_usage_.scratch += 3 * maxSize;
     }
-
-    if (!multi_stream_) {
+    std::string memory_info =
+        "GPU memory: weights " + std::to_string(memory_usage_.weights >> 20) +
+        " MiB, scratch " + std::to_string(memory_usage_.scratch >> 20) + " MiB";
+    if (multi_stream_ || num_streams_ > 1) {
+      memory_info += ", per stream " +
+                     std::to_string(memory_usage_.workspace >> 20) + " MiB";
+    }
+    CERR << memory_info << ".";
+
+    if (num_streams_ > 1) {
+      stream_tensor_size_ = maxSize;
+      // The other streams of the pool are created when needed.
+      stream_pool_.push_back(CreateStreamContext(0));
+      free_streams_.push_back(stream_pool_.back().get());
+    } else if (!multi_stream_) {
       for (auto& mem : tensor_mem_) {
         ReportCUDAErrors(cudaMalloc(&mem, maxSize));
         ReportCUDAErrors(cudaMemset(mem, 0, maxSize));
@@ -597,21 +815,47 @@ class CudaNetwork : public Network {
     std::unique_ptr<InputsOutputs> io = GetInputsOutputs();
   }
 
-  void forwardEval(InputsOutputs* io, int batchSize) {
+  // When @gatheredPolicySize is not zero, only that many elements of the
+  // policy, at the indices in io->policy_gather_indices_mem_, are copied to
+  // the host (into io->op_gathered_policy_mem_).
+  void forwardEval(InputsOutputs* io, int batchSize,
+                   int gatheredPolicySize = 0) {
     // It is safe to evaluate larger than the batchSize
     // as all buffers are designed to handle max_batch_size
     // and the extra invalid results are never read.
+    if (async_copy_) {
+      // Uploaded before taking the lock, so that it overlaps with the
+      // evaluation of the previous batch.
+      if (compact_input_) {
+        ReportCUDAErrors(cudaMemcpyAsync(
+            io->input_masks_mem_gpu_, io->input_masks_mem_,
+            sizeof(CompactInputPlanes) * batchSize, cudaMemcpyHostToDevice,
+            io->copy_stream_));
+      } else {
+        ReportCUDAErrors(cudaMemcpyAsync(
+            io->input_masks_mem_gpu_, io->input_masks_mem_,
+            sizeof(uint64_t) * kInputPlanes * batchSize,
+            cudaMemcpyHostToDevice, io->copy_stream_));
+        ReportCUDAErrors(cudaMemcpyAsync(
+            io->input_val_mem_gpu_, io->input_val_mem_,
+            sizeof(float) * kInputPlanes * batchSize, cudaMemcpyHostToDevice,
+            io->copy_stream_));
+      }
+      ReportCUDAErrors(cudaEventRecord(io->upload_done_, io->copy_stream_));
+    }
     if (batchSize < min_batch_size_) batchSize = min_batch_size_;
-    if (!multi_stream_) lock_.lock();
+    StreamContext* context = nullptr;
+    if (num_streams_ > 1) {
+      context = AcquireStream();
+    } else if (!multi_stream_) {
+      lock_.lock();
+    }
+    const auto compute_start = std::chrono::steady_clock::now();
 
 #ifdef DEBUG_RAW_NPS
     auto t_start = std::chrono::high_resolution_clock::now();
 #endif
 
-    // Expand packed planes to full planes.
-    uint64_t* ipDataMasks = io->input_masks_mem_gpu_;
-    float* ipDataValues = io->input_val_mem_gpu_;
-
     DataType* tensor_mem[3];
     void* scratch_mem;
     DataType*** offset_pointers;
@@ -627,135 +871,579 @@ class CudaNetwork : public Network {
       head_offset_pointers = (DataType***)&io->head_offset_pointers_;
       stream = io->stream_;
       cublas = io->cublas_;
+    } else if (context) {
+      for (int i = 0; i < 3; i++) tensor_mem[i] = context->tensor_mem[i];
+      scratch_mem = context->scratch_mem;
+      offset_pointers = &context->offset_pointers;
+      head_offset_pointers = &context->head_offset_pointers;
+      stream = context->stream;
+      cublas = context->cublas;
     } else {
       for (int i = 0; i < 3; i++) tensor_mem[i] = tensor_mem_[i];
       scratch_mem = scratch_mem_;
       offset_pointers = (DataType***)&offset_pointers_;
       head_offset_pointers = (DataType***)&head_offset_pointers_;
-      stream = 0;  // default stream
+      stream = stream_;
       cublas = cublas_;
     }
+    if (async_copy_) {
+      ReportCUDAErrors(cudaStreamWaitEvent(stream, io->upload_done_, 0));
+    }
 
-    bool fp16 = std::is_same<half, DataType>::value;
-    if (fp16) {
-      expandPlanes_Fp16_NCHW((half*)(tensor_mem[0]), ipDataMasks, ipDataValues,
-                             batchSize * kInputPlanes, stream);
+    if (use_cuda_graphs_) {
+      batchSize = GetGraphBatchSize(batchSize);
+      // The graphs also capture the memory of the stream, so they are kept
+      // per stream of the pool.
+      const int graph_key =
+          context ? context->index * (max_batch_size_ + 1) + batchSize
+                  : batchSize;
+      auto it = io->cuda_graphs_.find(graph_key);
+      if (it == io->cuda_graphs_.end()) {
+        // The first run for the batch size is done without the graph, it also
+        // makes the lazy allocations of the layers, which can't be captured.
+        enqueueForward(io, batchSize, tensor_mem, scratch_mem, offset_pointers,
+                       head_offset_pointers, stream, cublas, false);
+        cudaGraph_t graph;
+        ReportCUDAErrors(
+            cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal));
+        enqueueForward(io, batchSize, tensor_mem, scratch_mem, offset_pointers,
+                       head_offset_pointers, stream, cublas, true);
+        ReportCUDAErrors(cudaStreamEndCapture(stream, &graph));
+        cudaGraphExec_t graph_exec;
+        ReportCUDAErrors(cudaGraphInstantiateWithFlags(&graph_exec, graph, 0));
+        ReportCUDAErrors(cudaGraphDestroy(graph));
+        io->cuda_graphs_.emplace(graph_key, graph_exec);
+      } else {
+        ReportCUDAErrors(cudaGraphLaunch(it->second, stream));
+      }
     } else {
-      expandPlanes_Fp32_NCHW((float*)(tensor_mem[0]), ipDataMasks, ipDataValues,
-                             batchSize * kInputPlanes, stream);
+      enqueueForward(io, batchSize, tensor_mem, scratch_mem, offset_pointers,
+                     head_offset_pointers, stream, cublas, false);
     }
 
-    float* opPol = io->op_policy_mem_gpu_;
-    float* opVal = io->op_value_mem_gpu_;
-    float* opMov = io->op_moves_left_mem_gpu_;
-
-    // Figure out if the memory requirment for running the res block would fit
-    // in the L2 cache.
-    bool enableCacheOpt = false;
-    DataType* skip_connection =
-        use_res_block_winograd_fuse_opt_ ? tensor_mem[1] : tensor_mem[2];
+    // Copy policy output from device memory to host memory.
+    cudaStream_t copy_stream = stream;
+    if (async_copy_) {
+      ReportCUDAErrors(cudaEventRecord(io->compute_done_, stream));
+      ReportCUDAErrors(
+          cudaStreamWaitEvent(io->copy_stream_, io->compute_done_, 0));
+      copy_stream = io->copy_stream_;
+    }
+    if (gatheredPolicySize > 0) {
+      gatherPolicy(io->op_gathered_policy_mem_gpu_, io->op_policy_mem_gpu_,
+                   io->policy_gather_indices_mem_gpu_, gatheredPolicySize,
+                   copy_stream);
+      ReportCUDAErrors(cudaMemcpyAsync(
+          io->op_gathered_policy_mem_, io->op_gathered_policy_mem_gpu_,
+          sizeof(float) * gatheredPolicySize, cudaMemcpyDeviceToHost,
+          copy_stream));
+    } else {
+      ReportCUDAErrors(
+          cudaMemcpyAsync(io->op_policy_mem_, io->op_policy_mem_gpu_,
+                          sizeof(float) * kNumOutputPolicy * batchSize,
+                          cudaMemcpyDeviceToHost, copy_stream));
+    }
 
+    if (async_copy_) {
+      ReportCUDAErrors(cudaEventRecord(io->download_done_, copy_stream));
+      // The value and moves left heads are in mapped memory, only the policy
+      // is still in flight when the network is done. The next batch can start
+      // meanwhile.
+      ReportCUDAErrors(cudaEventSynchronize(io->compute_done_));
+      if (context) {
+        ReleaseStream(context);
+      } else if (!multi_stream_) {
+        lock_.unlock();
+      }
+      ReportCUDAErrors(cudaEventSynchronize(io->download_done_));
+    } else if (multi_stream_) {
+      ReportCUDAErrors(cudaStreamSynchronize(stream));
+    } else if (context) {
+      ReportCUDAErrors(cudaStreamSynchronize(stream));
+      ReleaseStream(context);
+    } else {
+      ReportCUDAErrors(cudaDeviceSynchronize());
+      // The next thread can start using the GPU now.
+      lock_.unlock();
+    }
+    busy_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - compute_start)
+                           .count(),
+                       std::memory_order_relaxed);
+    batches_.fetch_add(1, std::memory_order_relaxed);
 #if CUDART_VERSION >= 11000
-    const int pre_transform_tensor_size =
-        batchSize * numFilters_ * 8 * 8 * sizeof(DataType);
-    const int transformed_tensor_size = pre_transform_tensor_size * 36 / 16;
-    const int res_block_mem =
-        transformed_tensor_size * 2 + pre_transform_tensor_size;
-
-    cudaStreamAttrValue stream_attribute = {};
-    stream_attribute.accessPolicyWindow.base_ptr = tensor_mem[2];
-    stream_attribute.accessPolicyWindow.num_bytes = res_block_mem;
-    stream_attribute.accessPolicyWindow.hitRatio = 1.0f;
-    stream_attribute.accessPolicyWindow.hitProp = cudaAccessPropertyPersisting;
-    stream_attribute.accessPolicyWindow.missProp = cudaAccessPropertyStreaming;
-
-    if (allow_cache_opt_ && use_res_block_winograd_fuse_opt_ &&
-        (static_cast<size_t>(res_block_mem) <= scratch_size_) &&
-        (res_block_mem <= l2_cache_size_)) {
-      // we can use a single alloc to hold all the required tensors, and enable
-      // persistent L2 caching on it
-      ReportCUDAErrors(cudaStreamSetAttribute(
-          stream, cudaStreamAttributeAccessPolicyWindow, &stream_attribute));
+    if (use_cuda_graphs_ && allow_cache_opt_) cudaCtxResetPersistingL2Cache();
+#endif
 
-      enableCacheOpt = true;
-      skip_connection =
-          tensor_mem[2] + 2 * transformed_tensor_size / sizeof(DataType);
+    if (wdl_) {
+      // Value softmax done cpu side.
+      for (int i = 0; i < batchSize; i++) {
+        float w = io->op_value_mem_[3 * i + 0];
+        float d = io->op_value_mem_[3 * i + 1];
+        float l = io->op_value_mem_[3 * i + 2];
+        float m = std::max({w, d, l});
+        w = std::exp(w - m);
+        d = std::exp(d - m);
+        l = std::exp(l - m);
+        float sum = w + d + l;
+        w /= sum;
+        l /= sum;
+        d = 1.0f - w - l;
+        io->op_value_mem_[3 * i + 0] = w;
+        io->op_value_mem_[3 * i + 1] = d;
+        io->op_value_mem_[3 * i + 2] = l;
+      }
     }
-#endif
+  }
 
-    int l = 0;
+  ~CudaNetwork() {
+    // Average number of batches the GPU was busy with, over the lifetime of
+    // the network. Above 1 with streams or multi_stream, and the sum over the
+    // processes sharing the GPU shows how much their kernels overlap.
+    const int64_t batches = batches_.load(std::memory_order_relaxed);
+    if (batches > 0) {
+      const std::chrono::duration<double> lifetime =
+          std::chrono::steady_clock::now() - created_;
+      LOGFILE << "GPU " << gpu_id_ << " partition of " << partition_sm_count_
+              << " SMs: " << batches << " batches, achieved parallelism "
+              << busy_ns_.load(std::memory_order_relaxed) * 1e-9 /
+                     lifetime.count()
+              << ".";
+    }
+    stream_pool_.clear();
+    if (scratch_mem_) ReportCUDAErrors(cudaFree(scratch_mem_));
+    if (!multi_stream_) {
+      for (auto mem : tensor_mem_) {
+        if (mem) ReportCUDAErrors(cudaFree(mem));
+      }
+      if (offset_pointers_) ReportCUDAErrors(cudaFree(offset_pointers_));
+      if (head_offset_pointers_)
+        ReportCUDAErrors(cudaFree(head_offset_pointers_));
+      cublasDestroy(cublas_);
+      if (stream_) cudaStreamDestroy(stream_);
+    }
+  }
 
-    DataType* flow = tensor_mem[0];
-    DataType* spare1 = tensor_mem[1];
-    DataType* spare2 = tensor_mem[2];
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
 
-    if (numBlocks_ > 0) {
-      // Input.
-      network_[l++]->Eval(batchSize, skip_connection, tensor_mem[0], nullptr,
-                          scratch_mem, scratch_size_, nullptr, cublas,
-                          stream);  // input conv
+  int GetMiniBatchSize() const override {
+    // Simple heuristic that seems to work for a wide range of GPUs.
+    return 2 * partition_sm_count_;
+  }
 
-      // Residual block.
-      for (int block = 0; block < numBlocks_; block++) {
-        if (use_res_block_winograd_fuse_opt_) {
-          network_[l++]->Eval(batchSize, tensor_mem[2], skip_connection,
-                              nullptr, enableCacheOpt ? nullptr : scratch_mem,
-                              scratch_size_, nullptr, cublas,
-                              stream);  // block
-        } else {
-          network_[l++]->Eval(batchSize, tensor_mem[0], tensor_mem[2], nullptr,
-                              scratch_mem, scratch_size_, nullptr, cublas,
-                              stream);  // conv1
+  int GetThreads() const override {
+    return multi_stream_ ? 2 : num_streams_;
+  }
 
-          network_[l++]->Eval(batchSize, tensor_mem[2], tensor_mem[0],
-                              tensor_mem[2], scratch_mem, scratch_size_,
-                              nullptr, cublas, stream);  // conv2
-        }
-      }
+  DeviceMemoryUsage GetDeviceMemoryUsage() const override {
+    return memory_usage_;
+  }
 
-      flow = tensor_mem[2];
-      spare1 = tensor_mem[0];
-      spare2 = tensor_mem[1];
-    }
+  int GetMaxBatchSize() const { return max_batch_size_; }
+  int GetGpuId() const { return gpu_id_; }
+  bool UsesCompactInput() const { return compact_input_; }
 
-    if (attn_body_) {
-      network_[l++]->Eval(
-          batchSize, tensor_mem[1],
-          (numBlocks_ > 0) ? tensor_mem[2] : tensor_mem[0],
-          (numBlocks_ > 0) ? tensor_mem[0] : tensor_mem[2], scratch_mem,
-          scratch_size_, nullptr, cublas, stream,
-          offset_pointers);  // Entire attention body of the network
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    // Set correct gpu id for this computation (as it might have been called
+    // from a different thread).
+    ReportCUDAErrors(cudaSetDevice(gpu_id_));
+    return std::make_unique<CudaNetworkComputation<DataType>>(this, wdl_,
+                                                              moves_left_);
+  }
 
-      flow = tensor_mem[1];
-      spare1 = tensor_mem[0];
-      spare2 = tensor_mem[2];
+  std::unique_ptr<InputsOutputs> GetInputsOutputs() {
+    std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
+    if (free_inputs_outputs_.empty()) {
+      return std::make_unique<InputsOutputs>(
+          max_batch_size_, wdl_, moves_left_, tensor_mem_size_, scratch_size_,
+          !has_tensor_cores_ && std::is_same<half, DataType>::value,
+          use_cuda_graphs_, async_copy_);
+    } else {
+      std::unique_ptr<InputsOutputs> resource =
+          std::move(free_inputs_outputs_.front());
+      free_inputs_outputs_.pop_front();
+      return resource;
     }
+  }
 
-#if CUDART_VERSION >= 11000
-    if (enableCacheOpt) {
-      // reset the cache settings
-      stream_attribute.accessPolicyWindow.num_bytes = 0;
-      cudaStreamSetAttribute(stream, cudaStreamAttributeAccessPolicyWindow,
-                             &stream_attribute);
-      cudaCtxResetPersistingL2Cache();
-    }
-#endif
+  void ReleaseInputsOutputs(std::unique_ptr<InputsOutputs> resource) {
+    std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
+    free_inputs_outputs_.push_back(std::move(resource));
+  }
 
-    // Policy head.
-    if (attn_policy_) {
-      network_[l++]->Eval(
-          batchSize, spare1, flow, spare2, scratch_mem, scratch_size_, nullptr,
-          cublas, stream,
-          head_offset_pointers);  // Entire Attention policy head except for the
-                                  // policy map
-      if (fp16) {
-        network_[l++]->Eval(batchSize, spare2, spare1, nullptr, scratch_mem,
-                            scratch_size_, nullptr, cublas,
-                            stream);  // policy map layer
-        copyTypeConverted(opPol, (half*)spare2, batchSize * kNumOutputPolicy,
-                          stream);  // POLICY output
-      } else {
-        network_[l++]->Eval(batchSize, (DataType*)opPol, spare1, nullptr,
+  // Apparently nvcc doesn't see constructor invocations through make_unique.
+  // This function invokes constructor just to please complier and silence
+  // warning. Is never called (but compiler thinks that it could).
+  void UglyFunctionToSilenceNvccWarning() {
+    InputsOutputs io(0, false, false, false);
+  }
+
+ private:
+  const NetworkCapabilities capabilities_;
+  int gpu_id_;
+  int l2_cache_size_;
+  int sm_count_;
+  // SMs available to the process, less than sm_count_ with mps_sm_percent.
+  int partition_sm_count_;
+  // For the achieved parallelism report.
+  const std::chrono::steady_clock::time_point created_ =
+      std::chrono::steady_clock::now();
+  std::atomic<int64_t> busy_ns_ = 0;
+  std::atomic<int64_t> batches_ = 0;
+  int max_batch_size_;
+  int min_batch_size_;
+  bool wdl_;
+  bool moves_left_;
+  bool use_res_block_winograd_fuse_opt_;  // fuse operations inside the residual
+                                          // tower
+  bool multi_stream_;                     // run multiple parallel network evals
+  bool allow_cache_opt_;  // try to fit residual block activations in L2 cache
+  bool use_cuda_graphs_;  // replay captured CUDA graphs of the network
+  int graph_batch_step_;  // batch size granularity of the CUDA graphs
+  bool async_copy_;       // copy inputs and outputs on a separate stream
+  bool compact_input_;    // inputs are uploaded as CompactInputPlanes
+  DeviceMemoryUsage memory_usage_;
+
+  // Without multi_stream or a stream pool, only one NN Eval can happen at a
+  // time.
+  mutable std::mutex lock_;
+
+  // A stream of the pool with the memory to run the network on it. The memory
+  // comes from the stream ordered allocator of the device when it's supported,
+  // which keeps freed memory cached (e.g. for the next network after a reload)
+  // instead of returning it to the driver.
+  struct StreamContext {
+    StreamContext(int index, cudaStream_t stream)
+        : index(index), stream(stream) {
+#if CUDART_VERSION >= 11020
+      int device;
+      int pools_supported = 0;
+      ReportCUDAErrors(cudaGetDevice(&device));
+      ReportCUDAErrors(cudaDeviceGetAttribute(
+          &pools_supported, cudaDevAttrMemoryPoolsSupported, device));
+      if (pools_supported) {
+        cudaMemPool_t pool;
+        ReportCUDAErrors(cudaDeviceGetDefaultMemPool(&pool, device));
+        uint64_t threshold = UINT64_MAX;
+        ReportCUDAErrors(cudaMemPoolSetAttribute(
+            pool, cudaMemPoolAttrReleaseThreshold, &threshold));
+        pooled_memory = true;
+      }
+#endif
+    }
+    ~StreamContext() {
+      for (auto mem : tensor_mem) Free(mem);
+      Free(scratch_mem);
+      ReportCUDAErrors(cudaStreamSynchronize(stream));
+      if (offset_pointers) ReportCUDAErrors(cudaFree(offset_pointers));
+      if (head_offset_pointers) {
+        ReportCUDAErrors(cudaFree(head_offset_pointers));
+      }
+      if (cublas) cublasDestroy(cublas);
+      cudaStreamDestroy(stream);
+    }
+
+    // Zeroed device memory, ready for use on the stream.
+    void* Allocate(size_t size) {
+      void* mem;
+#if CUDART_VERSION >= 11020
+      if (pooled_memory) {
+        ReportCUDAErrors(cudaMallocAsync(&mem, size, stream));
+      } else
+#endif
+      {
+        ReportCUDAErrors(cudaMalloc(&mem, size));
+      }
+      ReportCUDAErrors(cudaMemsetAsync(mem, 0, size, stream));
+      return mem;
+    }
+
+    void Free(void* mem) {
+      if (!mem) return;
+#if CUDART_VERSION >= 11020
+      if (pooled_memory) {
+        ReportCUDAErrors(cudaFreeAsync(mem, stream));
+        return;
+      }
+#endif
+      ReportCUDAErrors(cudaFree(mem));
+    }
+
+    const int index;
+    const cudaStream_t stream;
+    bool pooled_memory = false;
+    cublasHandle_t cublas = nullptr;
+    DataType* tensor_mem[3] = {};
+    void* scratch_mem = nullptr;
+    DataType** offset_pointers = nullptr;
+    DataType** head_offset_pointers = nullptr;
+  };
+
+  int num_streams_;
+  size_t stream_tensor_size_ = 0;
+  std::mutex stream_pool_mutex_;
+  std::condition_variable stream_available_;
+  std::vector<std::unique_ptr<StreamContext>> stream_pool_;
+  std::vector<StreamContext*> free_streams_;
+
+  std::unique_ptr<StreamContext> CreateStreamContext(int index) {
+    cudaStream_t stream;
+    ReportCUDAErrors(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    auto context = std::make_unique<StreamContext>(index, stream);
+    for (auto& mem : context->tensor_mem) {
+      mem = static_cast<DataType*>(context->Allocate(stream_tensor_size_));
+    }
+    context->scratch_mem = context->Allocate(scratch_size_);
+    ReportCUBLASErrors(cublasCreate(&context->cublas));
+    ReportCUBLASErrors(cublasSetMathMode(
+        context->cublas,
+        !has_tensor_cores_ && std::is_same<half, DataType>::value
+            ? CUBLAS_PEDANTIC_MATH
+            : CUBLAS_TENSOR_OP_MATH));
+    ReportCUBLASErrors(cublasSetStream(context->cublas, stream));
+    return context;
+  }
+
+  // Checks out a free stream of the pool, creating it if the pool isn't full
+  // yet, or waits for one to be released.
+  StreamContext* AcquireStream() {
+    std::unique_lock<std::mutex> lock(stream_pool_mutex_);
+    if (free_streams_.empty() &&
+        stream_pool_.size() < static_cast<size_t>(num_streams_)) {
+      stream_pool_.push_back(CreateStreamContext(stream_pool_.size()));
+      return stream_pool_.back().get();
+    }
+    stream_available_.wait(lock, [&]() { return !free_streams_.empty(); });
+    StreamContext* context = free_streams_.back();
+    free_streams_.pop_back();
+    return context;
+  }
+
+  void ReleaseStream(StreamContext* context) {
+    {
+      std::lock_guard<std::mutex> lock(stream_pool_mutex_);
+      free_streams_.push_back(context);
+    }
+    stream_available_.notify_one();
+  }
+
+  int numBlocks_;
+  int numFilters_;
+  bool has_se_;
+  bool conv_policy_;
+  bool attn_policy_;
+  bool attn_body_;
+  int num_encoder_blocks_;
+  // Shared by the encoder layers, so must outlive network_.
+  std::unique_ptr<QuantizedGemm> quantized_gemm_;
+  std::vector<std::unique_ptr<BaseLayer<DataType>>> network_;
+  BaseLayer<DataType>* getLastLayer() { return network_.back().get(); }
+
+  BaseLayer<DataType>* resi_last_;
+  BaseLayer<DataType>* encoder_last_;
+
+  size_t tensor_mem_size_;
+  size_t scratch_size_;
+
+  // this copy is used only for initialization when multi-stream is enabled
+  void* scratch_mem_;
+  // this is only used when multi-stream is disabled
+  void** offset_pointers_ = nullptr;
+  void** head_offset_pointers_ = nullptr;
+
+  bool has_tensor_cores_;
+
+  // not used when multi-steam is enabled
+  cublasHandle_t cublas_;
+  // The default stream, unless CUDA graphs are enabled.
+  cudaStream_t stream_ = 0;
+  DataType* tensor_mem_[3] = {};
+
+  mutable std::mutex inputs_outputs_lock_;
+  std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
+
+  // Lowers max_batch_size_ so that the activations and scratch buffers fit the
+  // @max_memory bytes together with what is already allocated. With
+  // multi_stream or a stream pool, the limit is for the first stream. The scratch size used by
+  // the layers is reduced accordingly, the allocated scratch is kept.
+  template <typename ScratchSizeFunc, typename TensorSizeFunc>
+  void FitMaxMemory(size_t max_memory, ScratchSizeFunc get_scratch_size,
+                    TensorSizeFunc get_tensor_size) {
+    const size_t allocated = memory_usage_.weights + memory_usage_.scratch;
+    auto fits = [&](int batch_size) {
+      const size_t needed = 3 * get_tensor_size(batch_size) +
+                            (multi_stream_ || num_streams_ > 1
+                                 ? get_scratch_size(batch_size)
+                                 : 0);
+      return allocated + needed <= max_memory;
+    };
+    if (fits(max_batch_size_)) return;
+    // Largest batch size which fits, by bisection.
+    int low = 0;
+    int high = max_batch_size_;
+    while (high - low > 1) {
+      const int mid = low + (high - low) / 2;
+      (fits(mid) ? low : high) = mid;
+    }
+    if (low < min_batch_size_) {
+      throw Exception("The network doesn't fit max_memory of " +
+                      std::to_string(max_memory >> 20) + " MiB on GPU " +
+                      std::to_string(gpu_id_) + ".");
+    }
+    CERR << "Lowered max_batch from " << max_batch_size_ << " to " << low
+         << " to fit max_memory.";
+    max_batch_size_ = low;
+    scratch_size_ = get_scratch_size(max_batch_size_);
+  }
+
+  // Batch sizes are rounded up to a multiple of graph_batch_step_, so that
+  // only a limited number of graphs is captured.
+  int GetGraphBatchSize(int batchSize) const {
+    batchSize =
+        (batchSize + graph_batch_step_ - 1) / graph_batch_step_ *
+        graph_batch_step_;
+    return std::min(batchSize, max_batch_size_);
+  }
+
+  // Enqueues the network on @stream, up to the outputs in device memory (and
+  // the mapped host memory of the value and moves left heads). When
+  // @capturing, only stream operations are done, so that it can be captured
+  // into a CUDA graph.
+  void enqueueForward(InputsOutputs* io, int batchSize, DataType** tensor_mem,
+                      void* scratch_mem, DataType*** offset_pointers,
+                      DataType*** head_offset_pointers, cudaStream_t stream,
+                      cublasHandle_t cublas, bool capturing) {
+    // Expand packed planes to full planes.
+    uint64_t* ipDataMasks = io->input_masks_mem_gpu_;
+    float* ipDataValues = io->input_val_mem_gpu_;
+
+    bool fp16 = std::is_same<half, DataType>::value;
+    if (compact_input_) {
+      expandCompactPlanes_NCHW(
+          tensor_mem[0], reinterpret_cast<CompactInputPlanes*>(ipDataMasks),
+          batchSize, stream);
+    } else if (fp16) {
+      expandPlanes_Fp16_NCHW((half*)(tensor_mem[0]), ipDataMasks, ipDataValues,
+                             batchSize * kInputPlanes, stream);
+    } else {
+      expandPlanes_Fp32_NCHW((float*)(tensor_mem[0]), ipDataMasks, ipDataValues,
+                             batchSize * kInputPlanes, stream);
+    }
+
+    float* opPol = io->op_policy_mem_gpu_;
+    float* opVal = io->op_value_mem_gpu_;
+    float* opMov = io->op_moves_left_mem_gpu_;
+
+    // Figure out if the memory requirment for running the res block would fit
+    // in the L2 cache.
+    bool enableCacheOpt = false;
+    DataType* skip_connection =
+        use_res_block_winograd_fuse_opt_ ? tensor_mem[1] : tensor_mem[2];
+
+#if CUDART_VERSION >= 11000
+    const int pre_transform_tensor_size =
+        batchSize * numFilters_ * 8 * 8 * sizeof(DataType);
+    const int transformed_tensor_size = pre_transform_tensor_size * 36 / 16;
+    const int res_block_mem =
+        transformed_tensor_size * 2 + pre_transform_tensor_size;
+
+    cudaStreamAttrValue stream_attribute = {};
+    stream_attribute.accessPolicyWindow.base_ptr = tensor_mem[2];
+    stream_attribute.accessPolicyWindow.num_bytes = res_block_mem;
+    stream_attribute.accessPolicyWindow.hitRatio = 1.0f;
+    stream_attribute.accessPolicyWindow.hitProp = cudaAccessPropertyPersisting;
+    stream_attribute.accessPolicyWindow.missProp = cudaAccessPropertyStreaming;
+
+    if (allow_cache_opt_ && use_res_block_winograd_fuse_opt_ &&
+        (static_cast<size_t>(res_block_mem) <= scratch_size_) &&
+        (res_block_mem <= l2_cache_size_)) {
+      // we can use a single alloc to hold all the required tensors, and enable
+      // persistent L2 caching on it
+      ReportCUDAErrors(cudaStreamSetAttribute(
+          stream, cudaStreamAttributeAccessPolicyWindow, &stream_attribute));
+
+      enableCacheOpt = true;
+      skip_connection =
+          tensor_mem[2] + 2 * transformed_tensor_size / sizeof(DataType);
+    }
+#endif
+
+    int l = 0;
+
+    DataType* flow = tensor_mem[0];
+    DataType* spare1 = tensor_mem[1];
+    DataType* spare2 = tensor_mem[2];
+
+    if (numBlocks_ > 0) {
+      // Input.
+      network_[l++]->Eval(batchSize, skip_connection, tensor_mem[0], nullptr,
+                          scratch_mem, scratch_size_, nullptr, cublas,
+                          stream);  // input conv
+
+      // Residual block.
+      for (int block = 0; block < numBlocks_; block++) {
+        if (use_res_block_winograd_fuse_opt_) {
+          network_[l++]->Eval(batchSize, tensor_mem[2], skip_connection,
+                              nullptr, enableCacheOpt ? nullptr : scratch_mem,
+                              scratch_size_, nullptr, cublas,
+                              stream);  // block
+        } else {
+          network_[l++]->Eval(batchSize, tensor_mem[0], tensor_mem[2], nullptr,
+                              scratch_mem, scratch_size_, nullptr, cublas,
+                              stream);  // conv1
+
+          network_[l++]->Eval(batchSize, tensor_mem[2], tensor_mem[0],
+                              tensor_mem[2], scratch_mem, scratch_size_,
+                              nullptr, cublas, stream);  // conv2
+        }
+      }
+
+      flow = tensor_mem[2];
+      spare1 = tensor_mem[0];
+      spare2 = tensor_mem[1];
+    }
+
+    if (attn_body_) {
+      network_[l++]->Eval(
+          batchSize, tensor_mem[1],
+          (numBlocks_ > 0) ? tensor_mem[2] : tensor_mem[0],
+          (numBlocks_ > 0) ? tensor_mem[0] : tensor_mem[2], scratch_mem,
+          scratch_size_, nullptr, cublas, stream,
+          offset_pointers);  // Entire attention body of the network
+
+      flow = tensor_mem[1];
+      spare1 = tensor_mem[0];
+      spare2 = tensor_mem[2];
+    }
+
+#if CUDART_VERSION >= 11000
+    if (enableCacheOpt) {
+      // reset the cache settings
+      stream_attribute.accessPolicyWindow.num_bytes = 0;
+      cudaStreamSetAttribute(stream, cudaStreamAttributeAccessPolicyWindow,
+                             &stream_attribute);
+      // Not a stream operation, so it's done after the graph replay instead.
+      if (!capturing) cudaCtxResetPersistingL2Cache();
+    }
+#endif
+
+    // Policy head.
+    if (attn_policy_) {
+      network_[l++]->Eval(
+          batchSize, spare1, flow, spare2, scratch_mem, scratch_size_, nullptr,
+          cublas, stream,
+          head_offset_pointers);  // Entire Attention policy head except for the
+                                  // policy map
+      if (fp16) {
+        network_[l++]->Eval(batchSize, spare2, spare1, nullptr, scratch_mem,
+                            scratch_size_, nullptr, cublas,
+                            stream);  // policy map layer
+        copyTypeConverted(opPol, (half*)spare2, batchSize * kNumOutputPolicy,
+                          stream);  // POLICY output
+      } else {
+        network_[l++]->Eval(batchSize, (DataType*)opPol, spare1, nullptr,
                             scratch_mem, scratch_size_, nullptr, cublas,
                             stream);  // policy map layer  // POLICY output
       }
@@ -799,12 +1487,6 @@ class CudaNetwork : public Network {
       }
     }
 
-    // Copy policy output from device memory to host memory.
-    ReportCUDAErrors(
-        cudaMemcpyAsync(io->op_policy_mem_, io->op_policy_mem_gpu_,
-                        sizeof(float) * kNumOutputPolicy * batchSize,
-                        cudaMemcpyDeviceToHost, stream));
-
     // value head
     if (fp16) {
       network_[l++]->Eval(batchSize, spare1, flow, spare2, scratch_mem,
@@ -841,142 +1523,37 @@ class CudaNetwork : public Network {
       }
     }
 
-    if (multi_stream_) {
-      ReportCUDAErrors(cudaStreamSynchronize(stream));
-    } else {
-      ReportCUDAErrors(cudaDeviceSynchronize());
-      // The next thread can start using the GPU now.
-      lock_.unlock();
-    }
-
-    if (wdl_) {
-      // Value softmax done cpu side.
-      for (int i = 0; i < batchSize; i++) {
-        float w = io->op_value_mem_[3 * i + 0];
-        float d = io->op_value_mem_[3 * i + 1];
-        float l = io->op_value_mem_[3 * i + 2];
-        float m = std::max({w, d, l});
-        w = std::exp(w - m);
-        d = std::exp(d - m);
-        l = std::exp(l - m);
-        float sum = w + d + l;
-        w /= sum;
-        l /= sum;
-        d = 1.0f - w - l;
-        io->op_value_mem_[3 * i + 0] = w;
-        io->op_value_mem_[3 * i + 1] = d;
-        io->op_value_mem_[3 * i + 2] = l;
-      }
-    }
-  }
-
-  ~CudaNetwork() {
-    if (scratch_mem_) ReportCUDAErrors(cudaFree(scratch_mem_));
-    if (!multi_stream_) {
-      for (auto mem : tensor_mem_) {
-        if (mem) ReportCUDAErrors(cudaFree(mem));
-      }
-      if (offset_pointers_) ReportCUDAErrors(cudaFree(offset_pointers_));
-      if (head_offset_pointers_)
-        ReportCUDAErrors(cudaFree(head_offset_pointers_));
-      cublasDestroy(cublas_);
-    }
-  }
-
-  const NetworkCapabilities& GetCapabilities() const override {
-    return capabilities_;
-  }
-
-  int GetMiniBatchSize() const override {
-    // Simple heuristic that seems to work for a wide range of GPUs.
-    return 2 * sm_count_;
-  }
-
-  int GetThreads() const override { return 1 + multi_stream_; }
-
-  std::unique_ptr<NetworkComputation> NewComputation() override {
-    // Set correct gpu id for this computation (as it might have been called
-    // from a different thread).
-    ReportCUDAErrors(cudaSetDevice(gpu_id_));
-    return std::make_unique<CudaNetworkComputation<DataType>>(this, wdl_,
-                                                              moves_left_);
   }
 
-  std::unique_ptr<InputsOutputs> GetInputsOutputs() {
-    std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
-    if (free_inputs_outputs_.empty()) {
-      return std::make_unique<InputsOutputs>(
-          max_batch_size_, wdl_, moves_left_, tensor_mem_size_, scratch_size_,
-          !has_tensor_cores_ && std::is_same<half, DataType>::value);
+  // The "quantize" backend option runs the QKV and FFN GEMMs of the encoder
+  // layers quantized: "int8", "fp8" (Ada and newer) or "auto" (fp8 when the
+  // GPU supports it, int8 otherwise).
+  static Quantization GetQuantization(const OptionsDict& options,
+                                      const cudaDeviceProp& deviceProp) {
+    const std::string quantize =
+        options.GetOrDefault<std::string>("quantize", "none");
+    const bool has_fp8 =
+        QuantizedGemm::HasFp8Support() &&
+        (deviceProp.major > 8 ||
+         (deviceProp.major == 8 && deviceProp.minor >= 9));
+    Quantization result;
+    if (quantize == "none") {
+      return Quantization::kNone;
+    } else if (quantize == "int8") {
+      result = Quantization::kInt8;
+    } else if (quantize == "fp8") {
+      if (!has_fp8) throw Exception("FP8 quantization is not supported.");
+      result = Quantization::kFp8;
+    } else if (quantize == "auto") {
+      result = has_fp8 ? Quantization::kFp8 : Quantization::kInt8;
     } else {
-      std::unique_ptr<InputsOutputs> resource =
-          std::move(free_inputs_outputs_.front());
-      free_inputs_outputs_.pop_front();
-      return resource;
+      throw Exception("Unknown quantization: " + quantize);
     }
+    CERR << "Using " << (result == Quantization::kFp8 ? "FP8" : "INT8")
+         << " quantization for the encoder layers.";
+    return result;
   }
 
-  void ReleaseInputsOutputs(std::unique_ptr<InputsOutputs> resource) {
-    std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
-    free_inputs_outputs_.push_back(std::move(resource));
-  }
-
-  // Apparently nvcc doesn't see constructor invocations through make_unique.
-  // This function invokes constructor just to please complier and silence
-  // warning. Is never called (but compiler thinks that it could).
-  void UglyFunctionToSilenceNvccWarning() {
-    InputsOutputs io(0, false, false, false);
-  }
-
- private:
-  const NetworkCapabilities capabilities_;
-  int gpu_id_;
-  int l2_cache_size_;
-  int sm_count_;
-  int max_batch_size_;
-  int min_batch_size_;
-  bool wdl_;
-  bool moves_left_;
-  bool use_res_block_winograd_fuse_opt_;  // fuse operations inside the residual
-                                          // tower
-  bool multi_stream_;                     // run multiple parallel network evals
-  bool allow_cache_opt_;  // try to fit residual block activations in L2 cache
-
-  // Currently only one NN Eval can happen a time (we can fix this if needed
-  // by allocating more memory).
-  mutable std::mutex lock_;
-
-  int numBlocks_;
-  int numFilters_;
-  bool has_se_;
-  bool conv_policy_;
-  bool attn_policy_;
-  bool attn_body_;
-  int num_encoder_blocks_;
-  std::vector<std::unique_ptr<BaseLayer<DataType>>> network_;
-  BaseLayer<DataType>* getLastLayer() { return network_.back().get(); }
-
-  BaseLayer<DataType>* resi_last_;
-  BaseLayer<DataType>* encoder_last_;
-
-  size_t tensor_mem_size_;
-  size_t scratch_size_;
-
-  // this copy is used only for initialization when multi-stream is enabled
-  void* scratch_mem_;
-  // this is only used when multi-stream is disabled
-  void** offset_pointers_ = nullptr;
-  void** head_offset_pointers_ = nullptr;
-
-  bool has_tensor_cores_;
-
-  // not used when multi-steam is enabled
-  cublasHandle_t cublas_;
-  DataType* tensor_mem_[3];
-
-  mutable std::mutex inputs_outputs_lock_;
-  std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
-
   void showInfo() const {
     int version;
     int ret = cudaRuntimeGetVersion(&version);
@@ -1041,7 +1618,415 @@ CudaNetworkComputation<DataType>::~CudaNetworkComputation() {
 
 template <typename DataType>
 void CudaNetworkComputation<DataType>::ComputeBlocking() {
-  network_->forwardEval(inputs_outputs_.get(), GetBatchSize());
+  network_->forwardEval(inputs_outputs_.get(), GetBatchSize(),
+                        gather_policy_ ? gathered_policy_size_ : 0);
+}
+
+// Runs the network on several GPUs at once. Every device holds its own copy of
+// the weights, and each batch is sharded between the devices proportionally to
+// their measured throughput, so that faster cards get more samples.
+template <typename DataType>
+std::shared_ptr<CudaNetwork<DataType>> MakeDeviceNetwork(
+    const WeightsFile& file, const OptionsDict& options,
+    std::optional<int> gpu_id);
+
+template <typename DataType>
+class CudaMultiNetwork : public Network {
+ public:
+  CudaMultiNetwork(const WeightsFile& file, const OptionsDict& options,
+                   const std::vector<int>& gpu_ids) {
+    for (int gpu_id : gpu_ids) {
+      devices_.push_back(MakeDeviceNetwork<DataType>(file, options, gpu_id));
+    }
+    rates_.assign(devices_.size(), 0.0);
+    std::string ids;
+    for (int gpu_id : gpu_ids) {
+      ids += (ids.empty() ? "" : ",") + std::to_string(gpu_id);
+    }
+    CERR << "Sharding batches between GPUs " << ids << ".";
+    // Every device gets as many workers as it has streams, so that
+    // concurrent computations don't queue behind each other.
+    queues_.resize(devices_.size());
+    for (size_t device = 0; device < devices_.size(); ++device) {
+      for (int i = 0; i < devices_[device]->GetThreads(); ++i) {
+        workers_.emplace_back([this, device]() { WorkerLoop(device); });
+      }
+    }
+  }
+
+  ~CudaMultiNetwork() {
+    {
+      std::lock_guard<std::mutex> lock(queues_lock_);
+      stop_ = true;
+    }
+    queues_cv_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return devices_[0]->GetCapabilities();
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override;
+
+  int GetThreads() const override {
+    int threads = 0;
+    for (const auto& device : devices_) threads += device->GetThreads();
+    return threads;
+  }
+
+  int GetMiniBatchSize() const override {
+    int size = 0;
+    for (const auto& device : devices_) size += device->GetMiniBatchSize();
+    return size;
+  }
+
+  DeviceMemoryUsage GetDeviceMemoryUsage() const override {
+    DeviceMemoryUsage usage;
+    for (const auto& device : devices_) usage += device->GetDeviceMemoryUsage();
+    return usage;
+  }
+
+  int GetNumDevices() const { return devices_.size(); }
+  CudaNetwork<DataType>* GetDevice(int idx) { return devices_[idx].get(); }
+
+  // Returns the number of samples of @batch_size to run on each device.
+  std::vector<int> SplitBatch(int batch_size) {
+    std::vector<double> rates;
+    {
+      std::lock_guard<std::mutex> lock(rates_lock_);
+      rates = rates_;
+    }
+    // Until every device has been measured, split evenly.
+    if (std::any_of(rates.begin(), rates.end(),
+                    [](double rate) { return rate <= 0.0; })) {
+      std::fill(rates.begin(), rates.end(), 1.0);
+    }
+    double total_rate = 0.0;
+    for (double rate : rates) total_rate += rate;
+
+    std::vector<int> sizes(rates.size());
+    std::vector<double> remainders(rates.size());
+    int assigned = 0;
+    for (size_t i = 0; i < rates.size(); ++i) {
+      const double share = batch_size * rates[i] / total_rate;
+      sizes[i] = std::min(static_cast<int>(std::floor(share)),
+                          devices_[i]->GetMaxBatchSize());
+      remainders[i] = share - sizes[i];
+      assigned += sizes[i];
+    }
+    // The rest goes to the devices with largest remainders and free capacity.
+    while (assigned < batch_size) {
+      int best = -1;
+      for (size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] >= devices_[i]->GetMaxBatchSize()) continue;
+        if (best < 0 || remainders[i] > remainders[best]) best = i;
+      }
+      if (best < 0) {
+        throw Exception("Batch size " + std::to_string(batch_size) +
+                        " exceeds max_batch of all GPUs.");
+      }
+      ++sizes[best];
+      remainders[best] -= 1.0;
+      ++assigned;
+    }
+    return sizes;
+  }
+
+  // Runs @task on one of the worker threads of @device.
+  void Submit(int device, std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(queues_lock_);
+      queues_[device].push_back(std::move(task));
+    }
+    queues_cv_.notify_all();
+  }
+
+  // Records that @device evaluated @samples in @seconds.
+  void UpdateRate(int device, int samples, double seconds) {
+    // Weight of the latest measurement in the moving average.
+    constexpr double kAlpha = 0.1;
+    if (seconds <= 0.0) return;
+    const double rate = samples / seconds;
+    std::lock_guard<std::mutex> lock(rates_lock_);
+    rates_[device] = rates_[device] <= 0.0
+                         ? rate
+                         : (1.0 - kAlpha) * rates_[device] + kAlpha * rate;
+    if (++num_updates_ % kLogInterval == 0) {
+      std::string log = "GPU throughput (nps):";
+      for (size_t i = 0; i < devices_.size(); ++i) {
+        log += " " + std::to_string(devices_[i]->GetGpuId()) + "=" +
+               std::to_string(static_cast<int>(rates_[i]));
+      }
+      LOGFILE << log;
+    }
+  }
+
+ private:
+  static constexpr int kLogInterval = 1000;
+
+  void WorkerLoop(size_t device) {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(queues_lock_);
+        queues_cv_.wait(lock,
+                        [&]() { return stop_ || !queues_[device].empty(); });
+        if (stop_) return;
+        task = std::move(queues_[device].front());
+        queues_[device].pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::shared_ptr<CudaNetwork<DataType>>> devices_;
+  std::mutex queues_lock_;
+  std::condition_variable queues_cv_;
+  // Pending shards of every device.
+  std::vector<std::deque<std::function<void()>>> queues_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+  std::mutex rates_lock_;
+  // Samples per second of every device, zero when not measured yet.
+  std::vector<double> rates_;
+  int64_t num_updates_ = 0;
+};
+
+template <typename DataType>
+class CudaMultiNetworkComputation : public NetworkComputation {
+ public:
+  explicit CudaMultiNetworkComputation(CudaMultiNetwork<DataType>* network)
+      : network_(network) {
+    policy_offsets_.push_back(0);
+  }
+
+  void AddInput(InputPlanes&& input) override {
+    inputs_.push_back(std::move(input));
+    has_policy_indices_.push_back(false);
+    policy_offsets_.push_back(policy_indices_.size());
+  }
+
+  void AddInputWithPolicyIndices(
+      InputPlanes&& input, std::span<const uint16_t> policy_indices) override {
+    inputs_.push_back(std::move(input));
+    has_policy_indices_.push_back(true);
+    policy_indices_.insert(policy_indices_.end(), policy_indices.begin(),
+                           policy_indices.end());
+    policy_offsets_.push_back(policy_indices_.size());
+  }
+
+  void ComputeBlocking() override {
+    shards_.clear();
+    if (inputs_.empty()) return;
+    const std::vector<int> sizes = network_->SplitBatch(inputs_.size());
+    sample_shard_.resize(inputs_.size());
+    int start = 0;
+    for (size_t device = 0; device < sizes.size(); ++device) {
+      if (sizes[device] == 0) continue;
+      std::fill(sample_shard_.begin() + start,
+                sample_shard_.begin() + start + sizes[device], shards_.size());
+      shards_.push_back({static_cast<int>(device), start, sizes[device], {}});
+      start += sizes[device];
+    }
+
+    // Every shard but the first runs on a worker thread of its device, as
+    // the device is selected per thread. The calling thread takes the first.
+    std::vector<std::exception_ptr> errors(shards_.size());
+    std::mutex done_lock;
+    std::condition_variable done_cv;
+    size_t pending = shards_.size() - 1;
+    for (size_t i = 1; i < shards_.size(); ++i) {
+      network_->Submit(shards_[i].device, [&, i]() {
+        try {
+          RunShard(&shards_[i]);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(done_lock);
+        if (--pending == 0) done_cv.notify_one();
+      });
+    }
+    try {
+      RunShard(&shards_[0]);
+    } catch (...) {
+      errors[0] = std::current_exception();
+    }
+    {
+      std::unique_lock<std::mutex> lock(done_lock);
+      done_cv.wait(lock, [&]() { return pending == 0; });
+    }
+    for (const auto& error : errors) {
+      if (error) std::rethrow_exception(error);
+    }
+  }
+
+  int GetBatchSize() const override { return inputs_.size(); }
+
+  float GetQVal(int sample) const override {
+    const Shard& shard = shards_[sample_shard_[sample]];
+    return shard.computation->GetQVal(sample - shard.start);
+  }
+
+  float GetDVal(int sample) const override {
+    const Shard& shard = shards_[sample_shard_[sample]];
+    return shard.computation->GetDVal(sample - shard.start);
+  }
+
+  float GetPVal(int sample, int move_id) const override {
+    const Shard& shard = shards_[sample_shard_[sample]];
+    return shard.computation->GetPVal(sample - shard.start, move_id);
+  }
+
+  const float* GetGatheredPVals(int sample) const override {
+    const Shard& shard = shards_[sample_shard_[sample]];
+    return shard.computation->GetGatheredPVals(sample - shard.start);
+  }
+
+  float GetMVal(int sample) const override {
+    const Shard& shard = shards_[sample_shard_[sample]];
+    return shard.computation->GetMVal(sample - shard.start);
+  }
+
+ private:
+  struct Shard {
+    int device;
+    int start;
+    int size;
+    std::unique_ptr<NetworkComputation> computation;
+  };
+
+  void RunShard(Shard* shard) {
+    const auto start_time = std::chrono::steady_clock::now();
+    shard->computation = network_->GetDevice(shard->device)->NewComputation();
+    for (int i = shard->start; i < shard->start + shard->size; ++i) {
+      if (has_policy_indices_[i]) {
+        shard->computation->AddInputWithPolicyIndices(
+            std::move(inputs_[i]),
+            std::span<const uint16_t>(
+                policy_indices_.data() + policy_offsets_[i],
+                policy_offsets_[i + 1] - policy_offsets_[i]));
+      } else {
+        shard->computation->AddInput(std::move(inputs_[i]));
+      }
+    }
+    shard->computation->ComputeBlocking();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time;
+    network_->UpdateRate(shard->device, shard->size, elapsed.count());
+  }
+
+  CudaMultiNetwork<DataType>* network_;
+  std::vector<InputPlanes> inputs_;
+  std::vector<bool> has_policy_indices_;
+  // Policy indices of all samples, sample i owns the range
+  // [policy_offsets_[i], policy_offsets_[i + 1]).
+  std::vector<uint16_t> policy_indices_;
+  std::vector<size_t> policy_offsets_;
+  std::vector<Shard> shards_;
+  // Index in shards_ of every sample.
+  std::vector<int> sample_shard_;
+};
+
+template <typename DataType>
+std::unique_ptr<NetworkComputation>
+CudaMultiNetwork<DataType>::NewComputation() {
+  return std::make_unique<CudaMultiNetworkComputation<DataType>>(this);
+}
+
+// Forwards to a CudaNetwork which is shared by all the instances in the process
+// with the same weights and options on the same GPU. The weights are only
+// uploaded once, while every computation still gets its own stream and
+// activation memory from the multi_stream pool.
+template <typename DataType>
+class SharedCudaNetwork : public Network {
+ public:
+  explicit SharedCudaNetwork(std::shared_ptr<CudaNetwork<DataType>> network)
+      : network_(std::move(network)) {}
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return network_->GetCapabilities();
+  }
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return network_->NewComputation();
+  }
+  int GetThreads() const override { return network_->GetThreads(); }
+  int GetMiniBatchSize() const override {
+    return network_->GetMiniBatchSize();
+  }
+  DeviceMemoryUsage GetDeviceMemoryUsage() const override {
+    return network_->GetDeviceMemoryUsage();
+  }
+
+ private:
+  std::shared_ptr<CudaNetwork<DataType>> network_;
+};
+
+// Identifies the networks which can be shared: the GPU, the contents of the
+// weights and every option the network is built from. Reads all the options,
+// so they count as used also when an existing network is reused.
+static std::string SharedNetworkKey(const WeightsFile& file,
+                                    const OptionsDict& options,
+                                    std::optional<int> gpu_id) {
+  std::string key = std::to_string(
+      gpu_id ? *gpu_id : options.GetOrDefault<int>("gpu", 0));
+  key += "/" + std::to_string(std::hash<std::string>{}(file.OutputAsString()));
+  for (const char* name :
+       {"max_batch", "min_batch", "graph_batch_step", "max_memory"}) {
+    key += "/" + std::to_string(options.GetOrDefault<int>(name, -1));
+  }
+  for (const char* name :
+       {"cache_opt", "multi_stream", "async_copy", "cuda_graphs",
+        "compact_input", "res_block_fusing", "fused_mha", "mlh"}) {
+    if (!options.Exists<bool>(name)) {
+      key += "/-";
+    } else {
+      key += options.Get<bool>(name) ? "/1" : "/0";
+    }
+  }
+  for (const char* name : {"policy_head", "value_head", "quantize"}) {
+    key += "/" + options.GetOrDefault<std::string>(name, "");
+  }
+  return key;
+}
+
+// Creates the network of one GPU. With the share_weights option, returns the
+// existing network with the same key if there is one.
+template <typename DataType>
+std::shared_ptr<CudaNetwork<DataType>> MakeDeviceNetwork(
+    const WeightsFile& file, const OptionsDict& options,
+    std::optional<int> gpu_id) {
+  if (!options.GetOrDefault<bool>("share_weights", false)) {
+    return std::make_shared<CudaNetwork<DataType>>(file, options, gpu_id);
+  }
+  if (!options.GetOrDefault<bool>("multi_stream", false)) {
+    throw Exception("The share_weights option requires multi_stream.");
+  }
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<CudaNetwork<DataType>>> networks;
+  const std::string key = SharedNetworkKey(file, options, gpu_id);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<CudaNetwork<DataType>>& entry = networks[key];
+  if (auto network = entry.lock()) {
+    CERR << "Sharing the weights with another instance on GPU "
+         << network->GetGpuId() << ".";
+    return network;
+  }
+  auto network = std::make_shared<CudaNetwork<DataType>>(file, options, gpu_id);
+  entry = network;
+  return network;
+}
+
+// Parses the "gpus" option, a quoted list of devices to shard batches between,
+// e.g. gpus="0,1". Empty when not set.
+static std::vector<int> GetGpuIds(const OptionsDict& options) {
+  const std::string gpus = options.GetOrDefault<std::string>("gpus", "");
+  if (gpus.empty()) return {};
+  try {
+    return ParseIntList(gpus);
+  } catch (const std::exception&) {
+    throw Exception("Invalid gpus option: " + gpus);
+  }
 }
 
 template <typename DataType>
@@ -1112,12 +2097,25 @@ std::unique_ptr<Network> MakeCudaNetwork(const std::optional<WeightsFile>& w,
                       NF::InputEmbeddingFormat_Name(nf.input_embedding()) +
                       " is not supported by the CUDA backend.");
   }
-  return std::make_unique<CudaNetwork<DataType>>(weights, options);
+  const std::vector<int> gpu_ids = GetGpuIds(options);
+  if (gpu_ids.size() > 1) {
+    return std::make_unique<CudaMultiNetwork<DataType>>(weights, options,
+                                                        gpu_ids);
+  }
+  std::optional<int> gpu_id;
+  if (gpu_ids.size() == 1) gpu_id = gpu_ids[0];
+  if (options.GetOrDefault<bool>("share_weights", false)) {
+    return std::make_unique<SharedCudaNetwork<DataType>>(
+        MakeDeviceNetwork<DataType>(weights, options, gpu_id));
+  }
+  return std::make_unique<CudaNetwork<DataType>>(weights, options, gpu_id);
 }
 
 std::unique_ptr<Network> MakeCudaNetworkAuto(
     const std::optional<WeightsFile>& weights, const OptionsDict& options) {
-  int gpu_id = options.GetOrDefault<int>("gpu", 0);
+  const std::vector<int> gpu_ids = GetGpuIds(options);
+  int gpu_id =
+      gpu_ids.empty() ? options.GetOrDefault<int>("gpu", 0) : gpu_ids[0];
   cudaDeviceProp deviceProp = {};
   // No error checking here, this will be repeated later.
   cudaGetDeviceProperties(&deviceProp, gpu_id);
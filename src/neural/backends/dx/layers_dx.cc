@@ -44,9 +44,7 @@ namespace dx_backend {
 namespace {
 
 static void CopyFloatToHalf(dx_half* out, const float* in, size_t elements) {
-  for (int i = 0; i < elements; i++) {
-    out[i] = FP32toFP16(in[i]);
-  }
+  ConvertFP32toFP16(in, out, elements);
 }
 
 static void CpuTranspose(float* op, float* ip, size_t rows, size_t cols) {
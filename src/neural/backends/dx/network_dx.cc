@@ -61,6 +61,29 @@ void DxContext::WaitForGpu(uint64_t fence_val) {
   upload_scratch_mem_.offset = 0;
 }
 
+int DxContext::AcquireComputeQueue() {
+  if (compute_queues_.empty()) return -1;
+  return next_compute_queue_++ % compute_queues_.size();
+}
+
+uint64_t DxContext::FlushCL(ID3D12GraphicsCommandList4* cl,
+                            int compute_queue) {
+  if (compute_queue < 0) return FlushCL(cl);
+  ComputeQueue& cq = *compute_queues_[compute_queue];
+  cl->Close();
+  std::lock_guard<std::mutex> lock(cq.mutex);
+  cq.queue->ExecuteCommandLists(1, (ID3D12CommandList**)&cl);
+  cq.queue->Signal(cq.fence, ++cq.fence_val);
+  return cq.fence_val;
+}
+
+void DxContext::WaitForGpu(uint64_t fence_val, int compute_queue) {
+  if (compute_queue < 0) return WaitForGpu(fence_val);
+  ID3D12Fence* fence = compute_queues_[compute_queue]->fence;
+  while (fence->GetCompletedValue() < fence_val)
+    ;
+}
+
 void DxContext::ResetCL(ID3D12GraphicsCommandList4* cl,
                         ID3D12CommandAllocator* ca, bool reset) {
   if (!cl) cl = command_list_;
@@ -208,6 +231,20 @@ DxContext::DxContext(const OptionsDict& options) {
   ReportDxErrors(device_->CreateFence(fence_val_, D3D12_FENCE_FLAG_NONE,
                                       IID_PPV_ARGS(&fence_)));
 
+  // With compute queues several computations run on the GPU at the same time,
+  // instead of one after another on the direct queue.
+  const int compute_queues = options.GetOrDefault<int>("compute-queues", 0);
+  commandqueueDesc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+  for (int i = 0; i < compute_queues; i++) {
+    auto cq = std::make_unique<ComputeQueue>();
+    ReportDxErrors(device_->CreateCommandQueue(&commandqueueDesc,
+                                               IID_PPV_ARGS(&cq->queue)));
+    ReportDxErrors(device_->CreateFence(0, D3D12_FENCE_FLAG_NONE,
+                                        IID_PPV_ARGS(&cq->fence)));
+    compute_queues_.push_back(std::move(cq));
+  }
+  next_compute_queue_ = 0;
+
   shader_wrapper_.Init(device_);
 
   // Allocate scratch space for uploads and read-back.
@@ -220,6 +257,12 @@ DxContext::DxContext(const OptionsDict& options) {
 DxContext::~DxContext() {
   // Make sure nothing is in flight
   FlushAndWait();
+  for (auto& cq : compute_queues_) {
+    while (cq->fence->GetCompletedValue() < cq->fence_val)
+      ;
+    cq->queue->Release();
+    cq->fence->Release();
+  }
 
   upload_scratch_mem_.resource->Release();
   readback_scratch_mem_.resource->Release();
@@ -640,6 +683,7 @@ DxNetwork::DxNetwork(const WeightsFile& file, const OptionsDict& options)
   // Winograd transformed inputs/outputs need more space.
   // Every 4x4 block of input/output is transfored to 6x6 block.
   max_size *= (size_t)ceil(36.0 / 16.0);
+  tensor_mem_size_ = max_size;
 
   for (auto& mem : tensor_mem_) {
     dx_context_.CreateAlloc(max_size, D3D12_HEAP_TYPE_DEFAULT, mem, fp16_);
@@ -650,6 +694,9 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   if (batch_size > kMaxSupportedBatchSize)
     throw Exception("Unsupported batch size: " + std::to_string(batch_size));
 
+  DXAlloc* tensor_mem =
+      io->compute_queue_ >= 0 ? io->tensor_mem_ : tensor_mem_;
+
 #ifdef DEBUG_DUMP_PER_LAYER_DATA
   lock_.lock();
   ID3D12GraphicsCommandList4* cl = dx_context_.getCommandList();
@@ -665,96 +712,96 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   CD3DX12_RESOURCE_BARRIER barrier;
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[1].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+      tensor_mem[1].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
       D3D12_RESOURCE_STATE_COPY_DEST);
   cl->ResourceBarrier(1, &barrier);
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[2].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+      tensor_mem[2].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
       D3D12_RESOURCE_STATE_COPY_DEST);
   cl->ResourceBarrier(1, &barrier);
 
-  cl->CopyBufferRegion(tensor_mem_[1].resource, 0,
+  cl->CopyBufferRegion(tensor_mem[1].resource, 0,
                        io->input_masks_mem_gpu_.resource, 0,
                        sizeof(uint64_t) * batch_size * kInputPlanes);
-  cl->CopyBufferRegion(tensor_mem_[2].resource, 0,
+  cl->CopyBufferRegion(tensor_mem[2].resource, 0,
                        io->input_val_mem_gpu_.resource, 0,
                        sizeof(float) * batch_size * kInputPlanes);
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[1].resource, D3D12_RESOURCE_STATE_COPY_DEST,
+      tensor_mem[1].resource, D3D12_RESOURCE_STATE_COPY_DEST,
       D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
   cl->ResourceBarrier(1, &barrier);
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[2].resource, D3D12_RESOURCE_STATE_COPY_DEST,
+      tensor_mem[2].resource, D3D12_RESOURCE_STATE_COPY_DEST,
       D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
   cl->ResourceBarrier(1, &barrier);
 
   dx_context_.UavBarrier(cl);
 
   dx_context_.getShaderWrapper()->ExpandPlanes(
-      cl, tensor_mem_[0], tensor_mem_[1], tensor_mem_[2], batch_size, fp16_);
+      cl, tensor_mem[0], tensor_mem[1], tensor_mem[2], batch_size, fp16_);
 
 #else
   dx_context_.getShaderWrapper()->ExpandPlanes(
-      cl, tensor_mem_[0], io->input_masks_mem_gpu_, io->input_val_mem_gpu_,
+      cl, tensor_mem[0], io->input_masks_mem_gpu_, io->input_val_mem_gpu_,
       batch_size, fp16_);
 #endif
 
   dx_context_.UavBarrier(cl);
 
   // Debug logging (not compiled by default)
-  dx_context_.DumpTensor("After expand planes", tensor_mem_[0], 1024, fp16_);
+  dx_context_.DumpTensor("After expand planes", tensor_mem[0], 1024, fp16_);
 
   int l = 0;
 
   //-----------------------------------///---------------------------------------
   // Input Conv
-  network_[l++]->Eval(batch_size, tensor_mem_[2], tensor_mem_[0], DXAlloc(),
-                      tensor_mem_[1], tensor_mem_[3], cl);
+  network_[l++]->Eval(batch_size, tensor_mem[2], tensor_mem[0], DXAlloc(),
+                      tensor_mem[1], tensor_mem[3], cl);
   dx_context_.UavBarrier(cl);
 
-  dx_context_.DumpTensor("After input conv", tensor_mem_[2], 1024, fp16_);
+  dx_context_.DumpTensor("After input conv", tensor_mem[2], 1024, fp16_);
 
   //-----------------------------------///---------------------------------------
 
   // Residual tower.
   for (int block = 0; block < num_blocks_; block++) {
     // conv1
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl);
     dx_context_.UavBarrier(cl);
 
     // conv2
-    network_[l++]->Eval(batch_size, tensor_mem_[2], tensor_mem_[0],
-                        tensor_mem_[2], tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[2], tensor_mem[0],
+                        tensor_mem[2], tensor_mem[1], tensor_mem[3], cl);
     dx_context_.UavBarrier(cl);
   }
 
-  dx_context_.DumpTensor("After Residual tower", tensor_mem_[2], 1024, fp16_);
+  dx_context_.DumpTensor("After Residual tower", tensor_mem[2], 1024, fp16_);
 
   //-----------------------------------///---------------------------------------
 
   // Policy head.
   if (has_conv_policy_) {
     // Policy conv1.
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl);
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After policy conv1", tensor_mem_[0], 1024, fp16_);
+    dx_context_.DumpTensor("After policy conv1", tensor_mem[0], 1024, fp16_);
 
     // Policy conv2
-    network_[l++]->Eval(batch_size, tensor_mem_[1], tensor_mem_[0], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[1], tensor_mem[0], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl);
 
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After policy conv2", tensor_mem_[1], 1024, fp16_);
+    dx_context_.DumpTensor("After policy conv2", tensor_mem[1], 1024, fp16_);
 
     // Policy Map layer  (writes directly to system memory).
-    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem_[1],
+    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem[1],
                         DXAlloc(), DXAlloc(), DXAlloc(), cl);
 
     // Output of policy map layer is always FP32.
@@ -763,13 +810,13 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
 
   } else {
     // Policy conv.
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl);
     dx_context_.UavBarrier(cl);
 
     // Policy FC (writes directly to system memory).
-    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem_[0],
-                        DXAlloc(), tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem[0],
+                        DXAlloc(), tensor_mem[1], tensor_mem[3], cl);
   }
 
   //-----------------------------------///---------------------------------------
@@ -777,21 +824,21 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   // Value head.
 
   // Value conv.
-  network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                      tensor_mem_[1], tensor_mem_[3], cl);
+  network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                      tensor_mem[1], tensor_mem[3], cl);
   dx_context_.UavBarrier(cl);
 
-  dx_context_.DumpTensor("After value conv", tensor_mem_[0], 1024, fp16_);
+  dx_context_.DumpTensor("After value conv", tensor_mem[0], 1024, fp16_);
 
   // value FC1.
-  network_[l++]->Eval(batch_size, tensor_mem_[1], tensor_mem_[0], DXAlloc(),
+  network_[l++]->Eval(batch_size, tensor_mem[1], tensor_mem[0], DXAlloc(),
                       DXAlloc(), DXAlloc(), cl);
   dx_context_.UavBarrier(cl);
 
-  dx_context_.DumpTensor("After value fc1", tensor_mem_[1], 128, fp16_);
+  dx_context_.DumpTensor("After value fc1", tensor_mem[1], 128, fp16_);
 
   // value FC2.
-  network_[l++]->Eval(batch_size, io->op_value_mem_gpu_, tensor_mem_[1],
+  network_[l++]->Eval(batch_size, io->op_value_mem_gpu_, tensor_mem[1],
                       DXAlloc(), DXAlloc(), DXAlloc(), cl);
 
   dx_context_.DumpTensor("After value fc2", io->op_value_mem_gpu_, 8, fp16_);
@@ -801,22 +848,22 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   // Moves left head.
   if (moves_left_) {
     // Moves left conv.
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl);
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After moves left conv", tensor_mem_[0], 1024,
+    dx_context_.DumpTensor("After moves left conv", tensor_mem[0], 1024,
                            fp16_);
 
     // Moves left FC1.
-    network_[l++]->Eval(batch_size, tensor_mem_[1], tensor_mem_[0], DXAlloc(),
+    network_[l++]->Eval(batch_size, tensor_mem[1], tensor_mem[0], DXAlloc(),
                         DXAlloc(), DXAlloc(), cl);
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After moves left fc1", tensor_mem_[1], 512, fp16_);
+    dx_context_.DumpTensor("After moves left fc1", tensor_mem[1], 512, fp16_);
 
     // Moves left FC2.
-    network_[l++]->Eval(batch_size, io->op_moves_left_mem_gpu_, tensor_mem_[1],
+    network_[l++]->Eval(batch_size, io->op_moves_left_mem_gpu_, tensor_mem[1],
                         DXAlloc(), DXAlloc(), DXAlloc(), cl);
 
     dx_context_.DumpTensor("After moves left fc2", io->op_moves_left_mem_gpu_,
@@ -828,15 +875,16 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   dx_context_.FlushAndWait();
   lock_.unlock();
 #else
-  // TODO: Get rid of this lock once we move the Command Queue also to
-  // InputsOutputs structure This isn't a bottleneck anyway (for CPU side perf).
-  // The hope is that we will get some GPU side parallelism with multiple async
-  // compute queues.
-  lock_.lock();
-  uint64_t fence = dx_context_.FlushCL(cl);
-  lock_.unlock();
+  uint64_t fence;
+  if (io->compute_queue_ >= 0) {
+    fence = dx_context_.FlushCL(cl, io->compute_queue_);
+  } else {
+    lock_.lock();
+    fence = dx_context_.FlushCL(cl);
+    lock_.unlock();
+  }
 
-  dx_context_.WaitForGpu(fence);
+  dx_context_.WaitForGpu(fence, io->compute_queue_);
   io->needs_reset_ = true;
 #endif
 
@@ -933,9 +981,10 @@ std::unique_ptr<NetworkComputation> DxNetwork::NewComputation() {
 std::unique_ptr<InputsOutputsDx> DxNetwork::GetInputsOutputs() {
   std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
   if (free_inputs_outputs_.empty()) {
-    return std::make_unique<InputsOutputsDx>(max_batch_size_, &dx_context_,
-                                             has_wdl_, moves_left_,
-                                             has_conv_policy_, fp16_);
+    return std::make_unique<InputsOutputsDx>(
+        max_batch_size_, &dx_context_, has_wdl_, moves_left_,
+        has_conv_policy_, fp16_, dx_context_.AcquireComputeQueue(),
+        tensor_mem_size_);
   } else {
     std::unique_ptr<InputsOutputsDx> resource =
         std::move(free_inputs_outputs_.front());
@@ -982,9 +1031,11 @@ void DxNetworkComputation::ComputeBlocking() {
 
 InputsOutputsDx::InputsOutputsDx(int maxBatchSize, DxContext* dx_context,
                                  bool wdl, bool moves_left, bool policy_map,
-                                 bool fp16)
-    : uses_policy_map_(policy_map),
-      needs_reset_(false),
+                                 bool fp16, int compute_queue,
+                                 size_t tensor_mem_size)
+    : needs_reset_(false),
+      compute_queue_(compute_queue),
+      uses_policy_map_(policy_map),
       moves_left_(moves_left) {
   // CPU accesses on Default heap doesn't work.
   // GPU accesses on Upload heap works.
@@ -1035,12 +1086,21 @@ InputsOutputsDx::InputsOutputsDx(int maxBatchSize, DxContext* dx_context,
   op_value_mem_final_ = new float[maxBatchSize * (wdl ? 3 : 1)];
   if (moves_left) op_moves_left_mem_final_ = new float[maxBatchSize];
 
+  // Lists submitted to a compute queue have to be compute lists.
+  const auto list_type = compute_queue >= 0 ? D3D12_COMMAND_LIST_TYPE_COMPUTE
+                                            : D3D12_COMMAND_LIST_TYPE_DIRECT;
   ReportDxErrors(dx_context->getDevice()->CreateCommandAllocator(
-      D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&command_allocator_)));
+      list_type, IID_PPV_ARGS(&command_allocator_)));
 
   ReportDxErrors(dx_context->getDevice()->CreateCommandList(
-      1, D3D12_COMMAND_LIST_TYPE_DIRECT, command_allocator_, NULL,
-      IID_PPV_ARGS(&command_list_)));
+      1, list_type, command_allocator_, NULL, IID_PPV_ARGS(&command_list_)));
+
+  if (compute_queue >= 0) {
+    for (auto& mem : tensor_mem_) {
+      dx_context->CreateAlloc(tensor_mem_size, D3D12_HEAP_TYPE_DEFAULT, mem,
+                              fp16);
+    }
+  }
 }
 
 InputsOutputsDx::~InputsOutputsDx() {
@@ -1063,6 +1123,10 @@ InputsOutputsDx::~InputsOutputsDx() {
   command_allocator_->Release();
   command_list_->Release();
 
+  if (compute_queue_ >= 0) {
+    for (auto mem : tensor_mem_) mem.resource->Release();
+  }
+
   if (!uses_policy_map_) delete[] op_policy_mem_final_;
   delete[] op_value_mem_final_;
   if (moves_left_) delete[] op_moves_left_mem_final_;
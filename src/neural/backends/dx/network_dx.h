@@ -26,6 +26,11 @@
 */
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "dx_common.h"
 #include "layers_dx.h"
 #include "neural/factory.h"
@@ -53,7 +58,8 @@ static constexpr int kNumOutputMovesLeftPadded8 = 8;
 
 struct InputsOutputsDx {
   InputsOutputsDx(int maxBatchSize, DxContext* dx_context, bool wdl,
-                  bool moves_left, bool conv_policy, bool fp16);
+                  bool moves_left, bool conv_policy, bool fp16,
+                  int compute_queue = -1, size_t tensor_mem_size = 0);
   ~InputsOutputsDx();
 
   // Wanted to put these in default heap (video memory, mapped to support CPU
@@ -88,6 +94,12 @@ struct InputsOutputsDx {
   // Always need to reset command list / allocator after first time.
   bool needs_reset_;
 
+  // Compute queue the commands are submitted to, or -1 for the shared direct
+  // queue. Computations on compute queues run in parallel, so they need their
+  // own tensor memory.
+  const int compute_queue_;
+  DXAlloc tensor_mem_[4];
+
   const bool uses_policy_map_;
   const bool moves_left_;
 };
@@ -169,6 +181,17 @@ class DxContext {
 
   int gpu_id_;
 
+  // Compute queues that computations are spread over, each with its own
+  // fence. Submissions to one queue are serialized by its mutex.
+  struct ComputeQueue {
+    ID3D12CommandQueue* queue;
+    ID3D12Fence* fence;
+    uint64_t fence_val = 0;
+    std::mutex mutex;
+  };
+  std::vector<std::unique_ptr<ComputeQueue>> compute_queues_;
+  std::atomic<unsigned int> next_compute_queue_;
+
  public:
   DxContext(const OptionsDict& options);
   ~DxContext();
@@ -186,6 +209,12 @@ class DxContext {
   void ResetCL(ID3D12GraphicsCommandList4* cl = nullptr,
                ID3D12CommandAllocator* ca = nullptr, bool reset = true);
 
+  // Returns the compute queue for a new computation in round robin order, or
+  // -1 when there are none and the direct queue has to be used.
+  int AcquireComputeQueue();
+  uint64_t FlushCL(ID3D12GraphicsCommandList4* cl, int compute_queue);
+  void WaitForGpu(uint64_t fence_val, int compute_queue);
+
   void FlushAndWait();
   void ScheduleUpload(DXAlloc alloc, const void* data, size_t size);
   void DumpFp32(float* buf, int elements);
@@ -216,6 +245,8 @@ class DxNetwork : public Network {
   const NetworkCapabilities capabilities_;
   DxContext dx_context_;
   int max_batch_size_;
+  // Size of each of the tensor_mem_ buffers.
+  size_t tensor_mem_size_;
 
   // Currently only one NN Eval can happen a time (we can fix this if needed
   // by allocating more memory).
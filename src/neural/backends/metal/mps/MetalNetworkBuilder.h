@@ -51,6 +51,10 @@ class MetalNetworkBuilder {
              Activations& activations, std::string& policy_head,
              std::string& value_head);
 
+  // Sets the directory where compiled graphs are serialized to and loaded
+  // from. Empty disables the cache.
+  void setExecutableCache(const std::string& path);
+
   void forwardEval(float* inputs, int batchSize,
                    std::vector<float*> output_mems);
 
@@ -302,6 +302,16 @@ void MetalNetworkBuilder::build(int kInputPlanes, MultiHeadWeights& weights, Inp
     }
 }
 
+void MetalNetworkBuilder::setExecutableCache(const std::string& path)
+{
+    Lc0NetworkGraph * graph = [Lc0NetworkGraph getGraphAt:[NSNumber numberWithInt:this->gpu_id]];
+    NSURL * url = nil;
+    if (!path.empty()) {
+        url = [NSURL fileURLWithPath:[NSString stringWithUTF8String:path.c_str()] isDirectory:YES];
+    }
+    [graph setExecutableCacheURL:url];
+}
+
 void MetalNetworkBuilder::forwardEval(float * inputs, int batchSize, std::vector<float *> output_mems)
 {
     @autoreleasepool {
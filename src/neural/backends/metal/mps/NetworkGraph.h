@@ -54,12 +54,21 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
     // Variables to track results of graph inference.
     NSArray<MPSGraphTensor *> * _resultTensors;
     NSArray<MPSGraphTensor *> * _targetTensors;
-    NSMutableDictionary<NSNumber *, MPSGraphTensorDataDictionary *> * _resultDataDicts;
     NSMutableDictionary<NSString *, NSObject *> * _readVariables;
 
     // Variables for triple buffering
     dispatch_semaphore_t _doubleBufferingSemaphore;
 
+    // Shared memory input buffers, one per in-flight command buffer, and the
+    // indices of the ones not in use.
+    NSMutableArray<id<MTLBuffer>> * _inputBuffers;
+    NSMutableIndexSet * _freeInputBuffers;
+
+    // Compiled graph executables keyed by sub-batch size, and the directory
+    // they are serialized to (nil to disable).
+    NSMutableDictionary<NSNumber *, MPSGraphExecutable *> * _executables;
+    NSURL * __nullable _executableCacheURL;
+
     // Global smolgen weights.
     float * __nullable _globalSmolgenWeights;
 }
@@ -197,15 +206,21 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
 
 -(void) setResultTensors:(NSArray<MPSGraphTensor *> * __nonnull)results;
 
+-(void) setExecutableCacheURL:(NSURL * __nullable)url;
+
+-(nonnull MPSGraphExecutable *) executableWithBatchSize:(NSUInteger)batchSize;
+
 -(nonnull NSArray<MPSGraphTensor *> *) runInferenceWithBatchSize:(NSUInteger)batchSize
                                                           inputs:(float * __nonnull)inputs
                                                          outputs:(float * __nonnull * __nonnull)outputBuffers;
 
 -(nonnull MPSCommandBuffer *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
                                                   subBatch:(NSUInteger)subBatch
-                                              subBatchSize:(NSUInteger)subBatchSize;
+                                              subBatchSize:(NSUInteger)subBatchSize
+                                                   results:(NSArray<MPSGraphTensorData *> * __nullable * __nonnull)results;
 
--(void) copyResultsToBuffers:(float * __nonnull * __nonnull)outputBuffers
-                subBatchSize:(NSUInteger)subBatchSize;
+-(void) copyResults:(NSArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
+          toBuffers:(float * __nonnull * __nonnull)outputBuffers
+       subBatchSize:(NSUInteger)subBatchSize;
 
 @end
@@ -48,7 +48,7 @@ static MPSGraphPooling2DOpDescriptor * __nonnull averagePoolingDescriptor = [MPS
 static const NSUInteger kNumPolicyOutputs = 1858;
 
 // Maximum number of metal command buffers that can run simultaneously.
-static const NSUInteger kMaxInflightBuffers = 2;
+static const NSUInteger kMaxInflightBuffers = 3;
 
 // Minimum batch size below which parallel command buffers will not be used.
 static const NSInteger kMinSubBatchSize = 20;
@@ -130,7 +130,13 @@ static const NSInteger kMinSubBatchSize = 20;
     _resultTensors = @[];
     _readVariables = [[NSMutableDictionary alloc] init];
     _doubleBufferingSemaphore = dispatch_semaphore_create(kMaxInflightBuffers);
-    _resultDataDicts = [NSMutableDictionary dictionaryWithCapacity:kMaxInflightBuffers];
+    _inputBuffers = [NSMutableArray arrayWithCapacity:kMaxInflightBuffers];
+    for (NSUInteger i = 0; i < kMaxInflightBuffers; i++) {
+        [_inputBuffers addObject:(id<MTLBuffer>)[NSNull null]];
+    }
+    _freeInputBuffers = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, kMaxInflightBuffers)];
+    _executables = [NSMutableDictionary dictionary];
+    _executableCacheURL = nil;
 
     return self;
 }
@@ -146,24 +152,30 @@ static const NSInteger kMinSubBatchSize = 20;
     NSUInteger subBatchSize = batchSize / splits;
     NSUInteger inputDataLength = subBatchSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]];
 
-    // Split batchSize into smaller sub-batches and run using double-buffering.
-    NSUInteger subBatch = 0;
-    MPSCommandBuffer * commandBuffer;
-    for (subBatch = 0; subBatch < splits - 1; subBatch++) {
-        commandBuffer = [self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
-                                                  subBatch:subBatch
-                                              subBatchSize:subBatchSize];
+    NSMutableArray<MPSCommandBuffer *> * commandBuffers = [NSMutableArray arrayWithCapacity:splits];
+    NSMutableArray<NSArray<MPSGraphTensorData *> *> * results = [NSMutableArray arrayWithCapacity:splits];
+
+    // Only encoding is serialized. Command buffers of the next batch are encoded and queued while
+    // the GPU still works on this one, the in-flight semaphore bounds how many are outstanding.
+    @synchronized (self) {
+        for (NSUInteger subBatch = 0; subBatch < splits; subBatch++) {
+            // Last sub-batch may be smaller or larger than others.
+            NSUInteger size = subBatch == splits - 1 ? batchSize - subBatch * subBatchSize : subBatchSize;
+            NSArray<MPSGraphTensorData *> * subBatchResults = nil;
+            [commandBuffers addObject:[self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
+                                                                subBatch:subBatch
+                                                            subBatchSize:size
+                                                                 results:&subBatchResults]];
+            [results addObject:subBatchResults];
+        }
     }
-    // Last sub-batch may be smaller or larger than others.
-    MPSCommandBuffer * latestCommandBuffer = [self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
-                                                                       subBatch:subBatch
-                                                                   subBatchSize:batchSize - subBatch * subBatchSize];
 
-    // Wait for the last batch to be processed.
-    [latestCommandBuffer waitUntilCompleted];
-    [commandBuffer waitUntilCompleted];
+    // Wait for all sub-batches to be processed.
+    for (MPSCommandBuffer * commandBuffer in commandBuffers) {
+        [commandBuffer waitUntilCompleted];
+    }
 
-    [self copyResultsToBuffers:outputBuffers subBatchSize:subBatchSize];
+    [self copyResults:results toBuffers:outputBuffers subBatchSize:subBatchSize];
 
     return _resultTensors;
 }
@@ -171,54 +183,124 @@ static const NSInteger kMinSubBatchSize = 20;
 -(nonnull MPSCommandBuffer *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
                                                   subBatch:(NSUInteger)subBatch
                                               subBatchSize:(NSUInteger)subBatchSize
+                                                   results:(NSArray<MPSGraphTensorData *> * __nullable * __nonnull)results
 {
     // Double buffering semaphore to correctly double buffer iterations.
     dispatch_semaphore_wait(_doubleBufferingSemaphore, DISPATCH_TIME_FOREVER);
 
-    // Create command buffer for this sub-batch.
-    MPSCommandBuffer * commandBuffer = [MPSCommandBuffer commandBufferFromCommandQueue:_queue];
+    // The semaphore guarantees that one of the input buffers is free.
+    NSUInteger slot;
+    @synchronized (_freeInputBuffers) {
+        slot = [_freeInputBuffers firstIndex];
+        [_freeInputBuffers removeIndex:slot];
+    }
 
-    MPSShape * shape = @[@(subBatchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+    // Inputs are written to a shared memory buffer which the GPU reads directly, without staging
+    // them through a private copy. Buffers grow to the largest sub-batch seen.
+    NSUInteger length = subBatchSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]] * sizeof(float);
+    id<MTLBuffer> inputBuffer = _inputBuffers[slot];
+    if ((id)inputBuffer == [NSNull null] || inputBuffer.length < length) {
+        inputBuffer = [_device.metalDevice newBufferWithLength:length
+                                                       options:MTLResourceStorageModeShared];
+        _inputBuffers[slot] = inputBuffer;
+    }
+    memcpy(inputBuffer.contents, inputs, length);
 
-    NSData * inputData = [NSData dataWithBytesNoCopy:inputs
-                                              length:subBatchSize * sizeof(float)
-                                        freeWhenDone:NO];
+    MPSShape * shape = @[@(subBatchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+    MPSGraphTensorData * inputTensorData = [[MPSGraphTensorData alloc] initWithMTLBuffer:inputBuffer
+                                                                                   shape:shape
+                                                                                dataType:_inputTensor.dataType];
 
-    MPSGraphTensorData * inputTensorData = [[MPSGraphTensorData alloc] initWithDevice:_device
-                                                                                 data:inputData
-                                                                                shape:shape
-                                                                             dataType:_inputTensor.dataType];
+    // Create command buffer for this sub-batch.
+    MPSCommandBuffer * commandBuffer = [MPSCommandBuffer commandBufferFromCommandQueue:_queue];
 
-    // Create execution descriptor with block to update results for each iteration.
-    MPSGraphExecutionDescriptor * executionDescriptor = [[MPSGraphExecutionDescriptor alloc] init];
-    executionDescriptor.completionHandler = ^(MPSGraphTensorDataDictionary * resultDictionary, NSError * error) {
-        _resultDataDicts[@(subBatch)] = resultDictionary;
+    // Create execution descriptor with block to release the input buffer once the sub-batch is done.
+    MPSGraphExecutableExecutionDescriptor * executionDescriptor = [[MPSGraphExecutableExecutionDescriptor alloc] init];
+    executionDescriptor.completionHandler = ^(NSArray<MPSGraphTensorData *> * resultsArray, NSError * error) {
+        @synchronized (_freeInputBuffers) {
+            [_freeInputBuffers addIndex:slot];
+        }
 
-        // Release double buffering semaphore for the next training iteration to be encoded.
+        // Release double buffering semaphore for the next iteration to be encoded.
         dispatch_semaphore_signal(_doubleBufferingSemaphore);
     };
 
-    [self encodeToCommandBuffer:commandBuffer
-                          feeds:@{_inputTensor : inputTensorData}
-                  targetTensors:_targetTensors
-               targetOperations:nil
-            executionDescriptor:executionDescriptor];
+    *results = [[self executableWithBatchSize:subBatchSize] encodeToCommandBuffer:commandBuffer
+                                                                      inputsArray:@[inputTensorData]
+                                                                     resultsArray:nil
+                                                              executionDescriptor:executionDescriptor];
 
     // Commit the command buffer
     [commandBuffer commit];
     return commandBuffer;
 }
 
+-(nonnull MPSGraphExecutable *) executableWithBatchSize:(NSUInteger)batchSize
+{
+    MPSGraphExecutable * executable = _executables[@(batchSize)];
+    if (executable != nil) return executable;
+
+    NSURL * url = nil;
+    if (@available(macOS 14.0, *)) {
+        if (_executableCacheURL != nil) {
+            url = [_executableCacheURL URLByAppendingPathComponent:
+                [NSString stringWithFormat:@"batch_%lu.mpsgraphpackage", (unsigned long)batchSize]];
+        }
+        if (url != nil && [url checkResourceIsReachableAndReturnError:nil]) {
+            @try {
+                executable = [[MPSGraphExecutable alloc] initWithMPSGraphPackageAtURL:url
+                                                                compilationDescriptor:nil];
+            }
+            @catch (NSException * exception) {
+                // Stale or corrupt package, compile from scratch below.
+                executable = nil;
+            }
+        }
+    }
+
+    if (executable == nil) {
+        MPSShape * shape = @[@(batchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+        MPSGraphShapedType * inputType = [[MPSGraphShapedType alloc] initWithShape:shape
+                                                                          dataType:_inputTensor.dataType];
+        executable = [self compileWithDevice:_device
+                                       feeds:@{_inputTensor : inputType}
+                               targetTensors:_targetTensors
+                            targetOperations:nil
+                       compilationDescriptor:nil];
+
+        if (@available(macOS 14.0, *)) {
+            if (url != nil) {
+                [[NSFileManager defaultManager] createDirectoryAtURL:_executableCacheURL
+                                         withIntermediateDirectories:YES
+                                                          attributes:nil
+                                                               error:nil];
+                MPSGraphExecutableSerializationDescriptor * descriptor =
+                    [[MPSGraphExecutableSerializationDescriptor alloc] init];
+                [executable serializeToMPSGraphPackageAtURL:url descriptor:descriptor];
+            }
+        }
+    }
+
+    _executables[@(batchSize)] = executable;
+    return executable;
+}
+
+-(void) setExecutableCacheURL:(NSURL * __nullable)url
+{
+    _executableCacheURL = url;
+}
 
--(void) copyResultsToBuffers:(float * __nonnull * __nonnull)outputBuffers
-                subBatchSize:(NSUInteger)subBatchSize
+-(void) copyResults:(NSArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
+          toBuffers:(float * __nonnull * __nonnull)outputBuffers
+       subBatchSize:(NSUInteger)subBatchSize
 {
-    // Copy results for batch back into the output buffers.
+    // Copy results for batch back into the output buffers. Executable results are in the order of
+    // _targetTensors, which starts with _resultTensors.
     for (NSUInteger rsIdx = 0; rsIdx < [_resultTensors count]; rsIdx++) {
         NSUInteger outputDataLength = [_resultTensors[rsIdx] sizeOfDimensions:@[@1, @2, @3]] * subBatchSize;
-        for (NSUInteger subBatch = 0; subBatch < [_resultDataDicts count]; subBatch++) {
-            [[_resultDataDicts[@(subBatch)][_resultTensors[rsIdx]] mpsndarray] readBytes:outputBuffers[rsIdx] + subBatch * outputDataLength
-                                                                             strideBytes:nil];
+        for (NSUInteger subBatch = 0; subBatch < [results count]; subBatch++) {
+            [[results[subBatch][rsIdx] mpsndarray] readBytes:outputBuffers[rsIdx] + subBatch * outputDataLength
+                                                  strideBytes:nil];
         }
     }
 }
@@ -235,6 +317,9 @@ static const NSInteger kMinSubBatchSize = 20;
     // Target tensor for graph is combination of both.
     _targetTensors = [NSArray arrayWithArray:_resultTensors];
     _targetTensors = [_targetTensors arrayByAddingObjectsFromArray:[_readVariables allValues]];
+
+    // Executables compiled for the previous targets can't be reused.
+    [_executables removeAllObjects];
 }
 
 -(nonnull MPSGraphTensor *) inputPlaceholderWithInputChannels:(NSUInteger)channels
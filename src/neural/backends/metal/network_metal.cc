@@ -29,10 +29,12 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
 #include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <string>
 
 #include "mps/MetalNetworkBuilder.h"
 #include "neural/factory.h"
@@ -40,7 +42,9 @@
 #include "neural/tables/attention_policy_map.h"
 #include "neural/tables/policy_map.h"
 #include "utils/bititer.h"
+#include "utils/commandline.h"
 #include "utils/exception.h"
+#include "utils/hashcat.h"
 
 namespace lczero {
 namespace metal_backend {
@@ -163,6 +167,21 @@ MetalNetwork::MetalNetwork(const WeightsFile& file, const OptionsDict& options)
   auto embedding = static_cast<InputEmbedding>(file.format().network_format().input_embedding());
   builder_->build(kInputPlanes, weights, embedding, attn_body, attn_policy_, conv_policy_,
                   wdl_, moves_left_, activations, policy_head, value_head);
+
+  // Compiled graphs embed the weights, so they are cached per network and
+  // head selection.
+  const std::string cache_dir = options.GetOrDefault<std::string>(
+      "cache_dir", CommandLine::BinaryDirectory() + "/metal_cache");
+  if (!cache_dir.empty()) {
+    const uint64_t key = HashCat(
+        {std::hash<std::string>()(file.weights().OutputAsString()),
+         std::hash<std::string>()(policy_head),
+         std::hash<std::string>()(value_head), wdl_, moves_left_});
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx",
+             static_cast<unsigned long long>(key));
+    builder_->setExecutableCache(cache_dir + "/" + name);
+  }
 }
 
 void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
@@ -178,9 +197,8 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
     }
   }
 
-  // Metal is not thread-safe, so lock is needed.
-  lock_.lock();
-
+  // The graph serializes encoding itself, and waits for the GPU without
+  // holding its lock, so batches from other threads are queued meanwhile.
   if (attn_policy_ || conv_policy_) {
     /**
      * @todo policy map implementation has bug in MPSGraph (GatherND not working
@@ -198,8 +216,6 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
           &io->input_val_mem_expanded_[0], batchSize,
           {&io->op_policy_raw_mem_[0], &io->op_value_mem_[0]});
     }
-    // The next thread can start using the GPU now.
-    lock_.unlock();
 
     if (attn_policy_) {
       // Promotion offset calculation.
@@ -249,9 +265,6 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
       builder_->forwardEval(&io->input_val_mem_expanded_[0], batchSize,
                             {&io->op_policy_mem_[0], &io->op_value_mem_[0]});
     }
-
-    // The next thread can start using the GPU now.
-    lock_.unlock();
   }
 }
 
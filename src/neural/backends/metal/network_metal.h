@@ -153,10 +153,6 @@ class MetalNetwork : public Network {
   std::mutex inputs_outputs_lock_;
   std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
   std::unique_ptr<MetalNetworkBuilder> builder_;
-
-  // Metal not really good at multi-threading, so we need to do one NN eval at a
-  // time.
-  mutable std::mutex lock_;
 };
 
 }  // namespace metal_backend
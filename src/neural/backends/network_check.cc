@@ -26,8 +26,13 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <iomanip>
+#include <mutex>
+#include <thread>
 
 #include "neural/decoder.h"
 #include "neural/encoder.h"
@@ -54,8 +59,37 @@ struct CheckParams {
   double absolute_tolerance;
   double relative_tolerance;
   pblczero::NetworkFormat::InputFormat input_format;
+
+  bool IsAlmostEqual(double a, double b) const {
+    return std::abs(a - b) <=
+           std::max(relative_tolerance * std::max(std::abs(a), std::abs(b)),
+                    absolute_tolerance);
+  }
 };
 
+void SoftMax(std::vector<float>* policy) {
+  float max_p = -std::numeric_limits<float>::infinity();
+  for (const auto p : *policy) max_p = std::max(max_p, p);
+  float total = 0;
+  for (auto& p : *policy) {
+    p = std::exp(p - max_p);
+    total += p;
+  }
+  if (total > 0) {
+    for (auto& p : *policy) {
+      p /= total;
+    }
+  }
+}
+
+MoveList GetLegalMoves(const CheckParams& params, const InputPlanes& input) {
+  ChessBoard board;
+  int rule50;
+  int gameply;
+  PopulateBoard(params.input_format, input, &board, &rule50, &gameply);
+  return board.GenerateLegalMoves();
+}
+
 class CheckComputation : public NetworkComputation {
  public:
   CheckComputation(const CheckParams& params,
@@ -70,12 +104,7 @@ class CheckComputation : public NetworkComputation {
     InputPlanes y = input;
     work_comp_->AddInput(std::move(x));
     check_comp_->AddInput(std::move(y));
-
-    ChessBoard board;
-    int rule50;
-    int gameply;
-    PopulateBoard(params_.input_format, input, &board, &rule50, &gameply);
-    moves_.emplace_back(board.GenerateLegalMoves());
+    moves_.emplace_back(GetLegalMoves(params_, input));
   }
 
   void ComputeBlocking() override {
@@ -119,24 +148,13 @@ class CheckComputation : public NetworkComputation {
   std::vector<MoveList> moves_;
 
   std::vector<float> PolicySoftMax(const NetworkComputation* comp, int sample,
-                                   const std::vector<Move>& moves) const {
-    float max_p = -std::numeric_limits<float>::infinity();
+                                   const MoveList& moves) const {
     std::vector<float> policy;
     policy.reserve(moves.size());
     for (const auto move : moves) {
       policy.emplace_back(comp->GetPVal(sample, MoveToNNIndex(move, 0)));
-      max_p = std::max(max_p, policy.back());
-    }
-    float total = 0;
-    for (auto& p : policy) {
-      p = std::exp(p - max_p);
-      total += p;
-    }
-    if (total > 0) {
-      for (auto& p : policy) {
-        p /= total;
-      }
     }
+    SoftMax(&policy);
     return policy;
   }
 
@@ -180,9 +198,7 @@ class CheckComputation : public NetworkComputation {
   }
 
   bool IsAlmostEqual(double a, double b) const {
-    return std::abs(a - b) <= std::max(params_.relative_tolerance *
-                                           std::max(std::abs(a), std::abs(b)),
-                                       params_.absolute_tolerance);
+    return params_.IsAlmostEqual(a, b);
   }
 
   void DisplayHistogram() {
@@ -263,6 +279,228 @@ class CheckComputation : public NetworkComputation {
   std::unique_ptr<NetworkComputation> check_comp_;
 };
 
+// Outputs of the working backend for a sampled input, to be compared with the
+// reference backend later.
+struct CheckSample {
+  InputPlanes input;
+  MoveList moves;
+  float q;
+  float d;
+  float m;
+  // Raw policy outputs of the legal moves.
+  std::vector<float> policy;
+};
+
+// Checks the sampled inputs against the reference backend on a background
+// thread, so that the working backend never waits for the reference one.
+// Samples which don't fit into the queue are dropped. Divergence statistics
+// are reported periodically.
+class AsyncChecker {
+ public:
+  AsyncChecker(const CheckParams& params, Network* check_net,
+               size_t queue_size, int report_interval)
+      : params_(params),
+        check_net_(check_net),
+        queue_size_(queue_size),
+        report_interval_(report_interval),
+        last_report_(std::chrono::steady_clock::now()),
+        worker_([this]() { Worker(); }) {}
+
+  ~AsyncChecker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+    if (checked_ > 0) Report();
+  }
+
+  void Enqueue(std::vector<CheckSample>&& samples) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.size() + samples.size() > queue_size_) {
+        dropped_ += samples.size();
+        return;
+      }
+      for (auto& sample : samples) queue_.push_back(std::move(sample));
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  // Maximum and mean absolute error of a network head.
+  struct HeadError {
+    double max = 0;
+    double sum = 0;
+    uint64_t count = 0;
+
+    void Add(double a, double b) {
+      const double error = std::abs(a - b);
+      max = std::max(max, error);
+      sum += error;
+      ++count;
+    }
+
+    void Dump(const char* name) const {
+      if (count == 0) return;
+      CERR << std::scientific << std::setprecision(1) << name
+           << ": max: " << max << ", mean: " << sum / count << ".";
+    }
+  };
+
+  void Worker() {
+    while (true) {
+      std::vector<CheckSample> batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+        const size_t size = std::min(queue_.size(), kMaxBatchSize);
+        std::move(queue_.begin(), queue_.begin() + size,
+                  std::back_inserter(batch));
+        queue_.erase(queue_.begin(), queue_.begin() + size);
+      }
+      try {
+        Check(batch);
+      } catch (const std::exception& e) {
+        CERR << "*** ERROR reference backend failed: " << e.what();
+      }
+      const auto now = std::chrono::steady_clock::now();
+      if (now - last_report_ >= std::chrono::seconds(report_interval_)) {
+        Report();
+        last_report_ = now;
+      }
+    }
+  }
+
+  void Check(const std::vector<CheckSample>& batch) {
+    std::unique_ptr<NetworkComputation> comp = check_net_->NewComputation();
+    for (const auto& sample : batch) {
+      InputPlanes input = sample.input;
+      comp->AddInput(std::move(input));
+    }
+    comp->ComputeBlocking();
+    for (size_t i = 0; i < batch.size(); i++) {
+      const CheckSample& sample = batch[i];
+      bool passed = params_.IsAlmostEqual(sample.q, comp->GetQVal(i));
+      q_error_.Add(sample.q, comp->GetQVal(i));
+      d_error_.Add(sample.d, comp->GetDVal(i));
+      m_error_.Add(sample.m, comp->GetMVal(i));
+      histogram_.Add(comp->GetQVal(i) - sample.q);
+      std::vector<float> work = sample.policy;
+      SoftMax(&work);
+      std::vector<float> check;
+      check.reserve(sample.moves.size());
+      for (const auto move : sample.moves) {
+        check.emplace_back(comp->GetPVal(i, MoveToNNIndex(move, 0)));
+      }
+      SoftMax(&check);
+      for (size_t j = 0; j < work.size(); j++) {
+        passed &= params_.IsAlmostEqual(work[j], check[j]);
+        policy_error_.Add(work[j], check[j]);
+        histogram_.Add(check[j] - work[j]);
+      }
+      if (!passed) ++failed_;
+    }
+    checked_ += batch.size();
+  }
+
+  void Report() {
+    uint64_t dropped;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      dropped = dropped_;
+    }
+    CERR << "Checked " << checked_ << " positions asynchronously, " << failed_
+         << " out of tolerance, " << dropped << " dropped.";
+    q_error_.Dump("  q");
+    d_error_.Dump("  d");
+    m_error_.Dump("  m");
+    policy_error_.Dump("  policy");
+    CERR << "Absolute error histogram:";
+    histogram_.Dump();
+  }
+
+  static constexpr size_t kMaxBatchSize = 256;
+
+  const CheckParams params_;
+  Network* const check_net_;
+  const size_t queue_size_;
+  const int report_interval_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<CheckSample> queue_;
+  bool stop_ = false;
+  uint64_t dropped_ = 0;
+
+  // Only accessed by the worker thread (and after it's joined).
+  std::chrono::steady_clock::time_point last_report_;
+  uint64_t checked_ = 0;
+  uint64_t failed_ = 0;
+  HeadError q_error_;
+  HeadError d_error_;
+  HeadError m_error_;
+  HeadError policy_error_;
+  Histogram histogram_{-15, 1, 5};
+
+  std::thread worker_;
+};
+
+// Passes the computation to the working backend, and hands the inputs and the
+// outputs over to the AsyncChecker afterwards.
+class AsyncCheckComputation : public NetworkComputation {
+ public:
+  AsyncCheckComputation(const CheckParams& params, AsyncChecker* checker,
+                        std::unique_ptr<NetworkComputation> work_comp)
+      : params_(params), checker_(checker), work_comp_(std::move(work_comp)) {}
+
+  void AddInput(InputPlanes&& input) override {
+    samples_.emplace_back();
+    samples_.back().moves = GetLegalMoves(params_, input);
+    samples_.back().input = input;
+    work_comp_->AddInput(std::move(input));
+  }
+
+  void ComputeBlocking() override {
+    work_comp_->ComputeBlocking();
+    for (size_t i = 0; i < samples_.size(); i++) {
+      CheckSample& sample = samples_[i];
+      sample.q = work_comp_->GetQVal(i);
+      sample.d = work_comp_->GetDVal(i);
+      sample.m = work_comp_->GetMVal(i);
+      sample.policy.reserve(sample.moves.size());
+      for (const auto move : sample.moves) {
+        sample.policy.emplace_back(
+            work_comp_->GetPVal(i, MoveToNNIndex(move, 0)));
+      }
+    }
+    checker_->Enqueue(std::move(samples_));
+    samples_.clear();
+  }
+
+  int GetBatchSize() const override { return work_comp_->GetBatchSize(); }
+  float GetQVal(int sample) const override {
+    return work_comp_->GetQVal(sample);
+  }
+  float GetDVal(int sample) const override {
+    return work_comp_->GetDVal(sample);
+  }
+  float GetMVal(int sample) const override {
+    return work_comp_->GetMVal(sample);
+  }
+  float GetPVal(int sample, int move_id) const override {
+    return work_comp_->GetPVal(sample, move_id);
+  }
+
+ private:
+  const CheckParams& params_;
+  AsyncChecker* const checker_;
+  std::unique_ptr<NetworkComputation> work_comp_;
+  std::vector<CheckSample> samples_;
+};
+
 class CheckNetwork : public Network {
  public:
   static constexpr CheckMode kDefaultMode = kCheckOnly;
@@ -347,11 +585,25 @@ class CheckNetwork : public Network {
     }
     CERR << "Check rate: " << std::fixed << std::setprecision(0)
          << 100 * check_frequency_ << "%.";
+
+    if (options.GetOrDefault<bool>("async", false)) {
+      const int queue_size = options.GetOrDefault<int>("queue_size", 1024);
+      const int report_interval =
+          options.GetOrDefault<int>("report_interval", 60);
+      async_checker_ = std::make_unique<AsyncChecker>(
+          params_, check_net_.get(), queue_size, report_interval);
+      CERR << "Checking asynchronously, reporting every " << report_interval
+           << "s.";
+    }
   }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
     const double draw = Random::Get().GetDouble(1.0);
     const bool check = draw < check_frequency_;
+    if (check && async_checker_) {
+      return std::make_unique<AsyncCheckComputation>(
+          params_, async_checker_.get(), work_net_->NewComputation());
+    }
     if (check) {
       std::unique_ptr<NetworkComputation> work_comp =
           work_net_->NewComputation();
@@ -375,6 +627,9 @@ class CheckNetwork : public Network {
   std::unique_ptr<Network> work_net_;
   std::unique_ptr<Network> check_net_;
   NetworkCapabilities capabilities_;
+  // Set in the async mode. Declared last, so that it's stopped before the
+  // networks are destroyed.
+  std::unique_ptr<AsyncChecker> async_checker_;
 };
 
 std::unique_ptr<Network> MakeCheckNetwork(
@@ -25,16 +25,27 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <limits>
 #include <queue>
 #include <thread>
 
 #include "neural/factory.h"
 #include "utils/exception.h"
+#include "utils/logging.h"
 
 namespace lczero {
 namespace {
 
+// Size of a batch to be evaluated by one of the children.
+struct SplitSize {
+  int child;
+  int size;
+};
+
 class DemuxingNetwork;
 class DemuxingComputation : public NetworkComputation {
  public:
@@ -47,27 +58,27 @@ class DemuxingComputation : public NetworkComputation {
   int GetBatchSize() const override { return planes_.size(); }
 
   float GetQVal(int sample) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetQVal(offset);
+    const Split& split = splits_[sample_split_[sample]];
+    return split.parent->GetQVal(sample - split.start);
   }
 
   float GetDVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetDVal(offset);
+    const Split& split = splits_[sample_split_[sample]];
+    return split.parent->GetDVal(sample - split.start);
   }
 
   float GetMVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetMVal(offset);
+    const Split& split = splits_[sample_split_[sample]];
+    return split.parent->GetMVal(sample - split.start);
   }
 
   float GetPVal(int sample, int move_id) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetPVal(offset, move_id);
+    const Split& split = splits_[sample_split_[sample]];
+    return split.parent->GetPVal(sample - split.start, move_id);
+  }
+
+  void SetPriority(ComputationPriority priority) override {
+    priority_ = priority;
   }
 
   void NotifyComplete() {
@@ -78,26 +89,37 @@ class DemuxingComputation : public NetworkComputation {
     }
   }
 
-  NetworkComputation* AddParentFromNetwork(Network* network) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    parents_.emplace_back(network->NewComputation());
-    const int cur_idx = (parents_.size() - 1) * partial_size_;
-    for (int i = cur_idx; i < std::min(GetBatchSize(), cur_idx + partial_size_);
-         i++) {
-      parents_.back()->AddInput(std::move(planes_[i]));
+  // Creates the computation of split @idx on @network. Every split is only
+  // touched by the worker which took it.
+  NetworkComputation* AddParentFromNetwork(int idx, Network* network) {
+    Split& split = splits_[idx];
+    split.parent = network->NewComputation();
+    split.parent->SetPriority(priority_);
+    for (int i = split.start; i < split.start + split.size; i++) {
+      split.parent->AddInput(std::move(planes_[i]));
     }
-    return parents_.back().get();
+    return split.parent.get();
   }
 
+  int GetSplitSize(int idx) const { return splits_[idx].size; }
+
  private:
+  struct Split {
+    int start;
+    int size;
+    std::unique_ptr<NetworkComputation> parent;
+  };
+
   std::vector<InputPlanes> planes_;
   DemuxingNetwork* network_;
-  std::vector<std::unique_ptr<NetworkComputation>> parents_;
+  std::vector<Split> splits_;
+  // Index in splits_ of every sample.
+  std::vector<int> sample_split_;
+  ComputationPriority priority_ = ComputationPriority::kNormal;
 
   std::mutex mutex_;
   std::condition_variable dataready_cv_;
   int dataready_ = 0;
-  int partial_size_ = 0;
 };
 
 class DemuxingNetwork : public Network {
@@ -105,6 +127,16 @@ class DemuxingNetwork : public Network {
   DemuxingNetwork(const std::optional<WeightsFile>& weights,
                   const OptionsDict& options) {
     minimum_split_size_ = options.GetOrDefault<int>("minimum-split-size", 0);
+    const std::string policy =
+        options.GetOrDefault<std::string>("split-policy", "throughput");
+    if (policy != "throughput" && policy != "even") {
+      throw Exception("Unknown demux split-policy: " + policy);
+    }
+    balance_ = policy == "throughput";
+    rate_decay_ = options.GetOrDefault<float>("rate-decay", 0.1f);
+    if (rate_decay_ <= 0.0f || rate_decay_ > 1.0f) {
+      throw Exception("Demux rate-decay must be in (0, 1].");
+    }
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
@@ -116,6 +148,7 @@ class DemuxingNetwork : public Network {
     for (const auto& name : parents) {
       AddBackend(name, weights, options.GetSubdict(name));
     }
+    CERR << "Demux split policy: " << policy << ".";
   }
 
   void AddBackend(const std::string& name,
@@ -123,26 +156,28 @@ class DemuxingNetwork : public Network {
                   const OptionsDict& opts) {
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
+    auto& child = children_.emplace_back(std::make_unique<Child>());
+    child->name = name;
+    child->network = NetworkFactory::Get()->Create(backend, weights, opts);
 
-    int nn_threads = opts.GetOrDefault<int>("threads", 0);
-    if (nn_threads == 0) {
-      nn_threads = networks_.back()->GetThreads();
+    child->threads = opts.GetOrDefault<int>("threads", 0);
+    if (child->threads == 0) {
+      child->threads = child->network->GetThreads();
     }
 
     min_batch_size_ =
-        std::min(min_batch_size_, networks_.back()->GetMiniBatchSize());
-    is_cpu_ &= networks_.back()->IsCpu();
+        std::min(min_batch_size_, child->network->GetMiniBatchSize());
+    is_cpu_ &= child->network->IsCpu();
 
-    if (networks_.size() == 1) {
-      capabilities_ = networks_.back()->GetCapabilities();
+    if (children_.size() == 1) {
+      capabilities_ = child->network->GetCapabilities();
     } else {
-      capabilities_.Merge(networks_.back()->GetCapabilities());
+      capabilities_.Merge(child->network->GetCapabilities());
     }
 
-    for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back([this]() { Worker(); });
+    const int idx = children_.size() - 1;
+    for (int i = 0; i < child->threads; ++i) {
+      threads_.emplace_back([this, idx]() { Worker(idx); });
     }
   }
 
@@ -160,49 +195,109 @@ class DemuxingNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
-  void Enqueue(DemuxingComputation* computation) {
+  // Splits @batch_size samples between the children so that they finish at
+  // the same time, with one split per worker thread at most.
+  std::vector<SplitSize> SplitBatch(int batch_size) {
+    std::vector<double> weights(children_.size());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Children which were not measured yet are assumed to be as fast as the
+      // average of the measured ones.
+      double known_sum = 0.0;
+      int known = 0;
+      for (const auto& child : children_) {
+        if (child->rate > 0.0) {
+          known_sum += child->rate;
+          ++known;
+        }
+      }
+      const double fallback = known ? known_sum / known : 1.0;
+      for (size_t i = 0; i < children_.size(); ++i) {
+        const double rate = balance_ && children_[i]->rate > 0.0
+                                ? children_[i]->rate
+                                : fallback;
+        weights[i] = children_[i]->threads * (balance_ ? rate : 1.0);
+      }
+    }
+
+    std::vector<int> shares;
+    while (true) {
+      shares = Apportion(batch_size, weights);
+      // Children with the share below the minimum split size drop out, the
+      // slowest first.
+      int slowest = -1;
+      int active = 0;
+      for (size_t i = 0; i < shares.size(); ++i) {
+        if (weights[i] <= 0.0) continue;
+        ++active;
+        if (shares[i] < minimum_split_size_ &&
+            (slowest < 0 || weights[i] < weights[slowest])) {
+          slowest = i;
+        }
+      }
+      if (slowest < 0 || active <= 1) break;
+      weights[slowest] = 0.0;
+    }
+
+    std::vector<SplitSize> result;
+    for (size_t i = 0; i < shares.size(); ++i) {
+      if (shares[i] == 0) continue;
+      int splits = children_[i]->threads;
+      if (minimum_split_size_ > 0) {
+        splits = std::min(splits, shares[i] / minimum_split_size_);
+      }
+      splits = std::clamp(splits, 1, shares[i]);
+      for (int j = 0; j < splits; ++j) {
+        result.push_back({static_cast<int>(i),
+                          shares[i] / splits + (j < shares[i] % splits)});
+      }
+    }
+    return result;
+  }
+
+  void Enqueue(DemuxingComputation* computation,
+               const std::vector<SplitSize>& splits) {
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+    for (size_t i = 0; i < splits.size(); ++i) {
+      children_[splits[i].child]->queue.push(
+          {computation, static_cast<int>(i)});
+    }
+    cv_.notify_all();
   }
 
   ~DemuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyComplete();
-      queue_.pop();
+    for (auto& child : children_) {
+      while (!child->queue.empty()) {
+        child->queue.front().computation->NotifyComplete();
+        child->queue.pop();
+      }
     }
   }
 
-  void Worker() {
-    // While Abort() is not called (and it can only be called from destructor).
-    while (!abort_) {
+  void Worker(int idx) {
+    Child* child = children_[idx].get();
+    // Until Abort() is called (and it can only be called from destructor).
+    while (true) {
+      Task task;
       {
-        {
-          std::unique_lock<std::mutex> lock(mutex_);
-          // Wait until there's come work to compute.
-          cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
-          if (abort_) break;
-        }
-
-        // While there is a work in queue, process it.
-        while (true) {
-          DemuxingComputation* to_notify;
-          {
-            std::unique_lock<std::mutex> lock(mutex_);
-            if (queue_.empty()) break;
-            to_notify = queue_.front();
-            queue_.pop();
-          }
-          long long net_idx = ++(counter_) % networks_.size();
-          NetworkComputation* to_compute =
-              to_notify->AddParentFromNetwork(networks_[net_idx].get());
-          to_compute->ComputeBlocking();
-          to_notify->NotifyComplete();
-        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Wait until there's come work to compute.
+        cv_.wait(lock, [&] { return abort_ || TakeTask(idx, &task); });
+        if (abort_) break;
       }
+      const auto start = std::chrono::steady_clock::now();
+      NetworkComputation* to_compute =
+          task.computation->AddParentFromNetwork(task.split,
+                                                 child->network.get());
+      to_compute->ComputeBlocking();
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      UpdateRate(child, task.computation->GetSplitSize(task.split),
+                 elapsed.count());
+      task.computation->NotifyComplete();
     }
   }
 
@@ -221,13 +316,93 @@ class DemuxingNetwork : public Network {
     }
   }
 
-  std::vector<std::unique_ptr<Network>> networks_;
+ private:
+  struct Task {
+    DemuxingComputation* computation;
+    int split;
+  };
+
+  struct Child {
+    std::string name;
+    std::unique_ptr<Network> network;
+    int threads;
+    std::queue<Task> queue;
+    // Exponentially decayed samples per second of one worker thread, zero
+    // until measured.
+    double rate = 0.0;
+  };
+
+  // Distributes @total proportionally to @weights, by largest remainder.
+  static std::vector<int> Apportion(int total,
+                                    const std::vector<double>& weights) {
+    double weight_sum = 0.0;
+    for (double weight : weights) weight_sum += weight;
+    std::vector<int> shares(weights.size());
+    std::vector<double> remainders(weights.size());
+    int assigned = 0;
+    for (size_t i = 0; i < weights.size(); ++i) {
+      const double share = total * weights[i] / weight_sum;
+      shares[i] = std::floor(share);
+      remainders[i] = share - shares[i];
+      assigned += shares[i];
+    }
+    while (assigned < total) {
+      const size_t best =
+          std::max_element(remainders.begin(), remainders.end()) -
+          remainders.begin();
+      ++shares[best];
+      remainders[best] -= 1.0;
+      ++assigned;
+    }
+    return shares;
+  }
+
+  // Takes the next task for the worker of child @idx, or when its own queue
+  // is empty, steals one queued on a slower child. Requires mutex_ locked.
+  bool TakeTask(int idx, Task* task) {
+    Child* child = children_[idx].get();
+    Child* victim = child->queue.empty() ? nullptr : child;
+    if (!victim && balance_ && child->rate > 0.0) {
+      for (auto& other : children_) {
+        if (other->queue.empty() || other->rate <= 0.0 ||
+            other->rate >= child->rate) {
+          continue;
+        }
+        if (!victim || other->rate < victim->rate) victim = other.get();
+      }
+    }
+    if (!victim) return false;
+    *task = victim->queue.front();
+    victim->queue.pop();
+    return true;
+  }
+
+  void UpdateRate(Child* child, int samples, double seconds) {
+    if (seconds <= 0.0) return;
+    const double rate = samples / seconds;
+    std::lock_guard<std::mutex> lock(mutex_);
+    child->rate = child->rate <= 0.0
+                      ? rate
+                      : (1.0 - rate_decay_) * child->rate + rate_decay_ * rate;
+    if (++num_updates_ % kLogInterval != 0) return;
+    std::string log = "Demux rates (nps per thread):";
+    for (const auto& c : children_) {
+      log += " " + c->name + "=" + std::to_string(static_cast<int>(c->rate));
+    }
+    LOGFILE << log;
+  }
+
+  static constexpr int kLogInterval = 1000;
+
+  std::vector<std::unique_ptr<Child>> children_;
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
-  std::queue<DemuxingComputation*> queue_;
   int minimum_split_size_ = 0;
-  std::atomic<long long> counter_;
+  // Whether the splits follow the measured rates, otherwise they are even.
+  bool balance_ = true;
+  float rate_decay_ = 0.1f;
+  int64_t num_updates_ = 0;
   bool abort_ = false;
 
   std::mutex mutex_;
@@ -238,18 +413,20 @@ class DemuxingNetwork : public Network {
 
 void DemuxingComputation::ComputeBlocking() {
   if (GetBatchSize() == 0) return;
-  partial_size_ = (GetBatchSize() + network_->threads_.size() - 1) /
-                  network_->threads_.size();
-  if (partial_size_ < network_->minimum_split_size_) {
-    partial_size_ = std::min(GetBatchSize(), network_->minimum_split_size_);
+  const std::vector<SplitSize> sizes = network_->SplitBatch(GetBatchSize());
+  splits_.clear();
+  sample_split_.resize(GetBatchSize());
+  int start = 0;
+  for (const auto& size : sizes) {
+    std::fill(sample_split_.begin() + start,
+              sample_split_.begin() + start + size.size, splits_.size());
+    splits_.push_back({start, size.size, nullptr});
+    start += size.size;
   }
-  const int splits = (GetBatchSize() + partial_size_ - 1) / partial_size_;
 
   std::unique_lock<std::mutex> lock(mutex_);
-  dataready_ = splits;
-  for (int j = 0; j < splits; j++) {
-    network_->Enqueue(this);
-  }
+  dataready_ = splits_.size();
+  network_->Enqueue(this, sizes);
   dataready_cv_.wait(lock, [this]() { return dataready_ == 0; });
 }
 
@@ -25,7 +25,12 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <limits>
+#include <optional>
 #include <queue>
 #include <thread>
 
@@ -35,6 +40,44 @@
 namespace lczero {
 namespace {
 
+using Clock = std::chrono::steady_clock;
+using Microseconds = std::chrono::duration<double, std::micro>;
+
+// Exponentially decayed least squares fit of the backend latency as
+// a + b * batch_size.
+class LatencyModel {
+ public:
+  void Add(double batch_size, double latency_us) {
+    constexpr double kDecay = 0.02;
+    sum_ = (1.0 - kDecay) * sum_ + kDecay;
+    sum_x_ = (1.0 - kDecay) * sum_x_ + kDecay * batch_size;
+    sum_y_ = (1.0 - kDecay) * sum_y_ + kDecay * latency_us;
+    sum_xx_ = (1.0 - kDecay) * sum_xx_ + kDecay * batch_size * batch_size;
+    sum_xy_ = (1.0 - kDecay) * sum_xy_ + kDecay * batch_size * latency_us;
+  }
+
+  bool IsEmpty() const { return sum_ == 0.0; }
+
+  // Predicted latency in microseconds. While all samples had about the same
+  // batch size, the latency is assumed to not depend on it.
+  double Predict(double batch_size) const {
+    const double mean_x = sum_x_ / sum_;
+    const double mean_y = sum_y_ / sum_;
+    const double var_x = sum_xx_ / sum_ - mean_x * mean_x;
+    if (var_x < 1.0) return std::max(1.0, mean_y);
+    const double b =
+        std::max(0.0, (sum_xy_ / sum_ - mean_x * mean_y) / var_x);
+    return std::max(1.0, mean_y + b * (batch_size - mean_x));
+  }
+
+ private:
+  double sum_ = 0.0;
+  double sum_x_ = 0.0;
+  double sum_y_ = 0.0;
+  double sum_xx_ = 0.0;
+  double sum_xy_ = 0.0;
+};
+
 class MuxingNetwork;
 class MuxingComputation : public NetworkComputation {
  public:
@@ -62,6 +105,11 @@ class MuxingComputation : public NetworkComputation {
     return parent_->GetPVal(sample + idx_in_parent_, move_id);
   }
 
+  void SetPriority(ComputationPriority priority) override {
+    priority_ = priority;
+  }
+  ComputationPriority GetPriority() const { return priority_; }
+
   void PopulateToParent(std::shared_ptr<NetworkComputation> parent) {
     // Populate our batch into batch of batches.
     parent_ = parent;
@@ -80,6 +128,7 @@ class MuxingComputation : public NetworkComputation {
   MuxingNetwork* network_;
   std::shared_ptr<NetworkComputation> parent_;
   int idx_in_parent_ = 0;
+  ComputationPriority priority_ = ComputationPriority::kNormal;
 
   std::mutex mutex_;
   std::condition_variable dataready_cv_;
@@ -87,12 +136,17 @@ class MuxingComputation : public NetworkComputation {
 };
 
 class MuxingNetwork : public Network {
+  struct Child;
+
  public:
   MuxingNetwork(const std::optional<WeightsFile>& weights,
                 const OptionsDict& options) {
     // int threads, int max_batch)
     //: network_(std::move(network)), max_batch_(max_batch) {
 
+    // Lower priority work which waited that long is served first.
+    starvation_limit_ = Microseconds(
+        std::max(0, options.GetOrDefault<int>("starvation_us", 20000)));
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
@@ -109,12 +163,24 @@ class MuxingNetwork : public Network {
   void AddBackend(const std::string& name,
                   const std::optional<WeightsFile>& weights,
                   const OptionsDict& opts) {
-    const int max_batch = opts.GetOrDefault<int>("max_batch", 256);
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
-    Network* net = networks_.back().get();
+    auto& child = backends_.emplace_back(std::make_unique<Child>());
+    child->network = NetworkFactory::Get()->Create(backend, weights, opts);
+    child->max_batch = opts.GetOrDefault<int>("max_batch", 256);
+    // Workers wait up to max_wait_us for the batch to be filled to batch_fill
+    // fraction of max_batch. In adaptive mode the wait is shortened when the
+    // expected gain in throughput doesn't pay for it.
+    child->adaptive = opts.GetOrDefault<bool>("adaptive_wait", false);
+    const float fill = opts.GetOrDefault<float>(
+        "batch_fill", child->adaptive ? 1.0f : 0.0f);
+    if (fill < 0.0f || fill > 1.0f) {
+      throw Exception("batch_fill must be between 0 and 1.");
+    }
+    child->target_batch = std::ceil(fill * child->max_batch);
+    child->max_wait =
+        Microseconds(std::max(0, opts.GetOrDefault<int>("max_wait_us", 0)));
+    Network* net = child->network.get();
 
     int nn_threads = opts.GetOrDefault<int>("threads", 0);
     if (nn_threads == 0) {
@@ -124,15 +190,14 @@ class MuxingNetwork : public Network {
     min_batch_size_ = std::min(min_batch_size_, net->GetMiniBatchSize());
     is_cpu_ &= net->IsCpu();
 
-    if (networks_.size() == 1) {
+    if (backends_.size() == 1) {
       capabilities_ = net->GetCapabilities();
     } else {
       capabilities_.Merge(net->GetCapabilities());
     }
 
     for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back(
-          [this, net, max_batch]() { Worker(net, max_batch); });
+      threads_.emplace_back([this, b = child.get()]() { Worker(b); });
     }
   }
 
@@ -152,53 +217,72 @@ class MuxingNetwork : public Network {
 
   void Enqueue(MuxingComputation* computation) {
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+    queues_[static_cast<int>(computation->GetPriority())].push(
+        {computation, Clock::now()});
+    UpdateArrivalRate(computation->GetBatchSize());
+    // Both the worker filling a batch and idle ones may be waiting.
+    cv_.notify_all();
   }
 
   ~MuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyReady();
-      queue_.pop();
+    for (auto& queue : queues_) {
+      while (!queue.empty()) {
+        queue.front().computation->NotifyReady();
+        queue.pop();
+      }
     }
   }
 
-  void Worker(Network* network, const int max_batch) {
+  void Worker(Child* backend) {
+    Network* network = backend->network.get();
     // While Abort() is not called (and it can only be called from destructor).
     while (!abort_) {
       std::vector<MuxingComputation*> children;
       // Create new computation in "upstream" network, to gather batch into
       // there.
       std::shared_ptr<NetworkComputation> parent(network->NewComputation());
+      ComputationPriority priority = ComputationPriority::kLow;
       {
         std::unique_lock<std::mutex> lock(mutex_);
-        // Wait until there's come work to compute.
-        cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
+        // Wait until there's come work to compute, and no other worker is
+        // filling its batch.
+        cv_.wait(lock, [&] { return abort_ || (HasQueued() && !filling_); });
         if (abort_) break;
 
-        // While there is a work in queue, add it.
-        while (!queue_.empty()) {
-          // If we are reaching batch size limit, stop adding.
-          // However, if a single input batch is larger than output batch limit,
-          // we still have to add it.
-          if (parent->GetBatchSize() != 0 &&
-              parent->GetBatchSize() + queue_.front()->GetBatchSize() >
-                  max_batch) {
-            break;
+        bool full =
+            TakeQueued(backend->max_batch, parent, &children, &priority);
+        if (!full && parent->GetBatchSize() < backend->target_batch) {
+          // Keep collecting the arriving work until the batch is filled or
+          // the deadline passes.
+          const auto deadline =
+              Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                 GetWait(*backend, parent->GetBatchSize()));
+          filling_ = true;
+          while (!full && parent->GetBatchSize() < backend->target_batch) {
+            if (!cv_.wait_until(lock, deadline,
+                                [&] { return abort_ || HasQueued(); })) {
+              break;
+            }
+            if (abort_) break;
+            full = TakeQueued(backend->max_batch, parent, &children, &priority);
           }
-          // Remember which of "input" computations we serve.
-          children.push_back(queue_.front());
-          queue_.pop();
-          // Make "input" computation populate data into output batch.
-          children.back()->PopulateToParent(parent);
+          filling_ = false;
+          cv_.notify_all();
         }
       }
 
       // Compute.
+      parent->SetPriority(priority);
+      const auto start = Clock::now();
       parent->ComputeBlocking();
+      if (backend->adaptive) {
+        const Microseconds latency = Clock::now() - start;
+        std::lock_guard<std::mutex> lock(mutex_);
+        backend->latency.Add(parent->GetBatchSize(), latency.count());
+      }
       // Notify children that data is ready!
       for (auto child : children) child->NotifyReady();
     }
@@ -220,9 +304,129 @@ class MuxingNetwork : public Network {
   }
 
  private:
-  std::vector<std::unique_ptr<Network>> networks_;
-  std::queue<MuxingComputation*> queue_;
+  struct Child {
+    std::unique_ptr<Network> network;
+    int max_batch;
+    // Batch size to wait for, zero when not waiting.
+    int target_batch;
+    Microseconds max_wait;
+    bool adaptive;
+    // Only used in adaptive mode. Protected by mutex_.
+    LatencyModel latency;
+  };
+
+  struct QueueEntry {
+    MuxingComputation* computation;
+    Clock::time_point enqueue_time;
+  };
+  static constexpr int kNumPriorities =
+      static_cast<int>(ComputationPriority::kHigh) + 1;
+
+  // Requires mutex_ locked.
+  bool HasQueued() const {
+    return std::any_of(std::begin(queues_), std::end(queues_),
+                       [](const auto& queue) { return !queue.empty(); });
+  }
+
+  // Returns the queue to take the next computation from: the one which waited
+  // past the starvation limit if any, otherwise the highest priority one.
+  // Requires mutex_ locked and some work queued.
+  std::queue<QueueEntry>* NextQueue() {
+    const auto starving = Clock::now() - starvation_limit_;
+    std::queue<QueueEntry>* oldest = nullptr;
+    for (auto& queue : queues_) {
+      if (queue.empty() || queue.front().enqueue_time > starving) continue;
+      if (!oldest ||
+          queue.front().enqueue_time < oldest->front().enqueue_time) {
+        oldest = &queue;
+      }
+    }
+    if (oldest) return oldest;
+    for (int i = kNumPriorities - 1; i >= 0; --i) {
+      if (!queues_[i].empty()) return &queues_[i];
+    }
+    return nullptr;
+  }
+
+  // Moves queued computations into @parent while they fit into @max_batch,
+  // raising @priority to the highest one taken. Returns whether the batch
+  // should be sent without waiting for more work, i.e. it's full or has high
+  // priority work. Requires mutex_ locked.
+  bool TakeQueued(int max_batch, std::shared_ptr<NetworkComputation> parent,
+                  std::vector<MuxingComputation*>* children,
+                  ComputationPriority* priority) {
+    // While there is a work in queue, add it.
+    while (HasQueued()) {
+      std::queue<QueueEntry>* queue = NextQueue();
+      MuxingComputation* computation = queue->front().computation;
+      // If we are reaching batch size limit, stop adding.
+      // However, if a single input batch is larger than output batch limit,
+      // we still have to add it.
+      if (parent->GetBatchSize() != 0 &&
+          parent->GetBatchSize() + computation->GetBatchSize() > max_batch) {
+        return true;
+      }
+      // Remember which of "input" computations we serve.
+      children->push_back(computation);
+      queue->pop();
+      *priority = std::max(*priority, computation->GetPriority());
+      // Make "input" computation populate data into output batch.
+      computation->PopulateToParent(parent);
+    }
+    return parent->GetBatchSize() >= max_batch ||
+           *priority == ComputationPriority::kHigh;
+  }
+
+  // Records arrival of @samples for the adaptive wait. Requires mutex_ locked.
+  void UpdateArrivalRate(int samples) {
+    constexpr double kDecay = 0.05;
+    // Longer gaps are pauses in the search rather than the arrival rate.
+    constexpr Microseconds kMaxGap{100000.0};
+    const auto now = Clock::now();
+    if (last_arrival_ && samples > 0) {
+      const Microseconds gap = now - *last_arrival_;
+      if (gap < kMaxGap) {
+        const double interval = gap.count() / samples;
+        arrival_interval_us_ =
+            arrival_interval_us_ <= 0.0
+                ? interval
+                : (1.0 - kDecay) * arrival_interval_us_ + kDecay * interval;
+      }
+    }
+    last_arrival_ = now;
+  }
+
+  // Returns how long to wait for more work when @batch_size samples are
+  // collected. Requires mutex_ locked.
+  Microseconds GetWait(const Child& backend, int batch_size) const {
+    if (!backend.adaptive || backend.latency.IsEmpty() ||
+        arrival_interval_us_ <= 0.0) {
+      return backend.max_wait;
+    }
+    // Time until the target is expected to be reached, and the batch size
+    // expected by then.
+    const double wait = std::min(
+        backend.max_wait.count(),
+        (backend.target_batch - batch_size) * arrival_interval_us_);
+    const double expected = batch_size + wait / arrival_interval_us_;
+    // Waiting only pays off when the throughput, including the wait, improves
+    // over computing right now.
+    const double now_rate = batch_size / backend.latency.Predict(batch_size);
+    const double wait_rate =
+        expected / (wait + backend.latency.Predict(expected));
+    return Microseconds(wait_rate > now_rate ? wait : 0.0);
+  }
+
+  std::vector<std::unique_ptr<Child>> backends_;
+  // Queued computations, one queue per priority class.
+  std::queue<QueueEntry> queues_[kNumPriorities];
+  Microseconds starvation_limit_;
   bool abort_ = false;
+  // Whether one of the workers is waiting for its batch to fill.
+  bool filling_ = false;
+  std::optional<Clock::time_point> last_arrival_;
+  // Exponentially averaged time between arriving samples.
+  double arrival_interval_us_ = 0.0;
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
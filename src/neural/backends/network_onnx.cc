@@ -27,10 +27,17 @@
 
 #include <algorithm>
 #include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iterator>
+#include <list>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #if __has_include("dml_provider_factory.h")
@@ -38,6 +45,10 @@
 #define USE_DML
 #endif
 
+#ifdef USE_ONNX_CUDART
+#include <cuda_runtime.h>
+#endif
+
 #include "cpu_provider_factory.h"
 #include "neural/factory.h"
 #include "neural/loader.h"
@@ -48,8 +59,11 @@
 #include "utils/bititer.h"
 #include "utils/commandline.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 #include "utils/fp16_utils.h"
+#include "utils/hashcat.h"
 #include "utils/logging.h"
+#include "utils/string.h"
 
 namespace lczero {
 namespace {
@@ -58,10 +72,45 @@ enum class OnnxProvider { CPU, CUDA, DML, ROCM, TRT };
 
 class OnnxNetwork;
 
+// Input and output memory of a computation, reused between computations. With
+// I/O binding the memory is pinned, so that the provider copies it to and from
+// the device directly, and every session (batch bucket) has its binding.
+struct OnnxBuffers {
+  using Buffer = std::unique_ptr<void, std::function<void(void*)>>;
+  Buffer input;
+  std::vector<Buffer> outputs;
+  std::vector<Ort::IoBinding> bindings;
+};
+
+#ifdef USE_ONNX_CUDART
+void ReportCudaErrors(cudaError_t status) {
+  if (status != cudaSuccess) {
+    throw Exception(std::string("CUDA error: ") + cudaGetErrorString(status));
+  }
+}
+#endif
+
+// With CUDA graphs, the device memory a session is bound to. The graph replays
+// read and write the same addresses, so the binding is only set up once, and
+// the computations copy their inputs and outputs in and out of it.
+struct OnnxGraphIo {
+  OnnxGraphIo(Ort::Session& session) : binding(session) {}
+  ~OnnxGraphIo() {
+#ifdef USE_ONNX_CUDART
+    cudaFree(input);
+    for (void* output : outputs) cudaFree(output);
+#endif
+  }
+  Ort::IoBinding binding;
+  void* input = nullptr;
+  std::vector<void*> outputs;
+};
+
 template <typename DataType>
 class OnnxComputation : public NetworkComputation {
  public:
   OnnxComputation(OnnxNetwork* network);
+  ~OnnxComputation();
   void AddInput(InputPlanes&& input) override;
   int GetBatchSize() const override { return raw_input_.size(); }
   void ComputeBlocking() override;
@@ -73,11 +122,17 @@ class OnnxComputation : public NetworkComputation {
  private:
   Ort::Value PrepareInputs(int start, int batch_size);
 
+  DataType* GetInputData() const {
+    return static_cast<DataType*>(buffers_->input.get());
+  }
+  const DataType* GetOutputData(int head) const {
+    return static_cast<const DataType*>(buffers_->outputs[head].get());
+  }
+
   OnnxNetwork* network_;
   std::vector<InputPlanes> raw_input_;
-  std::vector<DataType> input_tensor_data_;
+  std::unique_ptr<OnnxBuffers> buffers_;
   std::vector<Ort::Value> output_tensors_;
-  std::vector<std::vector<DataType>> output_tensors_data_;
   std::vector<size_t> output_tensors_step_;
 };
 
@@ -98,17 +153,46 @@ class OnnxNetwork : public Network {
     return capabilities_;
   }
   int GetMiniBatchSize() const override {
-    return batch_size_ == -1 ? Network::GetMiniBatchSize()
-                             : batch_size_ * steps_;
+    return buckets_.empty() ? Network::GetMiniBatchSize() : buckets_.back();
   }
   bool IsCpu() const override { return provider_ == OnnxProvider::CPU; }
+  int GetThreads() const override { return num_replicas_; }
+
+  Ort::SessionOptions GetOptions(int gpu, int threads, int batch_size,
+                                 const std::string& affinity);
+
+  int NumBuckets() const {
+    return buckets_.empty() ? 1 : static_cast<int>(buckets_.size());
+  }
+  // Index of the smallest bucket with room for @size positions, or of the
+  // largest one if there is none.
+  int GetBucket(int size) const;
+  // Session of @replica for the batch size of @bucket.
+  int GetSessionIndex(int replica, int bucket) const {
+    return replica * NumBuckets() + bucket;
+  }
+  // Allocates the device memory of the sessions and binds it. The replicas
+  // are on @gpus, round robin.
+  void CreateGraphIo(const std::vector<int>& gpus);
+  // Picks the replica to run a computation on, waiting for a free one if the
+  // provider doesn't support concurrent runs.
+  int AcquireReplica();
+  void ReleaseReplica(int replica);
 
-  Ort::SessionOptions GetOptions(int gpu, int threads, int batch_size);
+  std::unique_ptr<OnnxBuffers> GetBuffers();
+  void ReleaseBuffers(std::unique_ptr<OnnxBuffers> buffers);
 
   Ort::Env onnx_env_;
-  // Prepare sessions for this many multiples of the batch size;
-  int steps_;
+  // Fixed batch sizes of the sessions of a replica, in ascending order. Empty
+  // for variable batch size.
+  std::vector<int> buckets_;
+  // Number of independent copies of the sessions, to run computations in
+  // parallel.
+  int num_replicas_;
+  // Sessions of all replicas, NumBuckets() per replica.
   std::vector<Ort::Session> session_;
+  // With CUDA graphs, the bound device memory of every session.
+  std::vector<std::unique_ptr<OnnxGraphIo>> graph_io_;
   std::vector<std::string> inputs_;
   // Points to strings in inputs_.
   std::vector<const char*> inputs_cstr_;
@@ -123,41 +207,48 @@ class OnnxNetwork : public Network {
   NetworkCapabilities capabilities_;
   bool fp16_;
   bool bf16_;
-  // The batch size to use, or -1 for variable.
-  int batch_size_;
+  // Whether the CUDA based providers capture and replay CUDA graphs.
+  bool cuda_graphs_ = false;
   // The lower limit for variable batch size.
   int min_batch_size_;
   static constexpr int max_batch_size_ = 1024;
-  // For conditional locking if running the DML/ROCM/TRT provider.
   OnnxProvider provider_;
-  std::mutex lock_;
+  // Number of computations running on each replica.
+  std::vector<int> replica_load_;
+  std::mutex replica_lock_;
+  std::condition_variable replica_cv_;
+  // Directory of the TensorRT engine and timing caches of these weights.
+  std::string trt_cache_dir_;
+  // Size of the elements of the input and output tensors.
+  size_t data_size_;
+  // Memory of the input and output tensors, pinned when I/O binding is used.
+  Ort::MemoryInfo memory_info_;
+  std::optional<Ort::Allocator> pinned_allocator_;
+  std::mutex buffers_lock_;
+  std::list<std::unique_ptr<OnnxBuffers>> free_buffers_;
 };
 
 template <typename DataType>
 OnnxComputation<DataType>::OnnxComputation(OnnxNetwork* network)
-    : network_(network) {
-  output_tensors_data_.resize(network_->outputs_.size());
+    : network_(network), buffers_(network->GetBuffers()) {
   output_tensors_step_.resize(network_->outputs_.size());
   output_tensors_step_[network_->policy_head_] = 1858;
-  output_tensors_data_[network_->policy_head_] =
-      std::vector<DataType>(1858 * network_->max_batch_size_);
   if (network_->wdl_head_ != -1) {
     output_tensors_step_[network_->wdl_head_] = 3;
-    output_tensors_data_[network_->wdl_head_] =
-        std::vector<DataType>(3 * network_->max_batch_size_);
   }
   if (network_->value_head_ != -1) {
     output_tensors_step_[network_->value_head_] = 1;
-    output_tensors_data_[network_->value_head_] =
-        std::vector<DataType>(network_->max_batch_size_);
   }
   if (network_->mlh_head_ != -1) {
     output_tensors_step_[network_->mlh_head_] = 1;
-    output_tensors_data_[network_->mlh_head_] =
-        std::vector<DataType>(network_->max_batch_size_);
   }
 }
 
+template <typename DataType>
+OnnxComputation<DataType>::~OnnxComputation() {
+  network_->ReleaseBuffers(std::move(buffers_));
+}
+
 template <typename DataType>
 void OnnxComputation<DataType>::AddInput(InputPlanes&& input) {
   raw_input_.emplace_back(input);
@@ -182,10 +273,10 @@ float AsFloat(Ort::BFloat16_t x) {
 template <typename DataType>
 float OnnxComputation<DataType>::GetQVal(int sample) const {
   if (network_->wdl_head_ != -1) {
-    const auto& data = output_tensors_data_[network_->wdl_head_];
+    const DataType* data = GetOutputData(network_->wdl_head_);
     return AsFloat(data[sample * 3 + 0]) - AsFloat(data[sample * 3 + 2]);
   } else {
-    const auto& data = output_tensors_data_[network_->value_head_];
+    const DataType* data = GetOutputData(network_->value_head_);
     return AsFloat(data[sample]);
   }
 }
@@ -193,20 +284,20 @@ float OnnxComputation<DataType>::GetQVal(int sample) const {
 template <typename DataType>
 float OnnxComputation<DataType>::GetDVal(int sample) const {
   if (network_->wdl_head_ == -1) return 0.0f;
-  const auto& data = output_tensors_data_[network_->wdl_head_];
+  const DataType* data = GetOutputData(network_->wdl_head_);
   return AsFloat(data[sample * 3 + 1]);
 }
 
 template <typename DataType>
 float OnnxComputation<DataType>::GetPVal(int sample, int move_id) const {
-  const auto& data = output_tensors_data_[network_->policy_head_];
+  const DataType* data = GetOutputData(network_->policy_head_);
   return AsFloat(data[sample * 1858 + move_id]);
 }
 
 template <typename DataType>
 float OnnxComputation<DataType>::GetMVal(int sample) const {
   if (network_->mlh_head_ == -1) return 0.0f;
-  const auto& data = output_tensors_data_[network_->mlh_head_];
+  const DataType* data = GetOutputData(network_->mlh_head_);
   return AsFloat(data[sample]);
 }
 
@@ -222,9 +313,10 @@ void AsDataType(float x, Ort::BFloat16_t* y) {
 
 template <typename DataType>
 Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
-  input_tensor_data_.clear();
-  input_tensor_data_.resize(batch_size * kInputPlanes * 8 * 8);
-  auto iter = input_tensor_data_.data();
+  const size_t input_size = batch_size * kInputPlanes * 8 * 8;
+  DataType* const input_data = GetInputData();
+  std::fill(input_data, input_data + input_size, DataType());
+  auto iter = input_data;
   int end = std::min(start + batch_size, static_cast<int>(raw_input_.size()));
   for (int i = start; i < end; i++) {
     for (const auto& plane : raw_input_[i]) {
@@ -236,69 +328,124 @@ Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
       iter += 64;
     }
   }
-  for (int i = end; i < start + batch_size; i++) {
-    for (int j = 0; j < kInputPlanes * 64; j++) {
-      *iter++ = DataType();
-    }
-  }
 
-  auto memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+  const OrtMemoryInfo* memory_info = network_->memory_info_;
 
   output_tensors_.clear();
   for (size_t i = 0; i < output_tensors_step_.size(); i++) {
     int size = output_tensors_step_[i];
     int64_t dims[] = {batch_size, size};
     output_tensors_.emplace_back(Ort::Value::CreateTensor<DataType>(
-        memory_info, output_tensors_data_[i].data() + start * size,
+        memory_info, const_cast<DataType*>(GetOutputData(i)) + start * size,
         size * batch_size, dims, 2));
   }
 
   int64_t dims[] = {batch_size, kInputPlanes, 8, 8};
-  return Ort::Value::CreateTensor<DataType>(memory_info,
-                                            input_tensor_data_.data(),
-                                            input_tensor_data_.size(), dims, 4);
+  return Ort::Value::CreateTensor<DataType>(memory_info, input_data,
+                                            input_size, dims, 4);
 }
 
 template <typename DataType>
 void OnnxComputation<DataType>::ComputeBlocking() {
-  int batch_size = network_->batch_size_;
-  if (batch_size < 0) {
-    batch_size = std::max(static_cast<int>(raw_input_.size()),
-                          network_->min_batch_size_);
-  }
+  const int replica = network_->AcquireReplica();
+  struct ReplicaReleaser {
+    ~ReplicaReleaser() { network->ReleaseReplica(replica); }
+    OnnxNetwork* network;
+    int replica;
+  } releaser{network_, replica};
   for (size_t i = 0; i < raw_input_.size();) {
-    int step = (raw_input_.size() - i + batch_size - 1) / batch_size;
-    if (step > network_->steps_) step = network_->steps_;
-    int batch = batch_size * step;
+    const int remaining = raw_input_.size() - i;
+    const int bucket = network_->GetBucket(remaining);
+    const int batch =
+        network_->buckets_.empty()
+            ? std::max(remaining, network_->min_batch_size_)
+            : network_->buckets_[bucket];
 
     auto input_tensor = PrepareInputs(i, batch);
-    // The DML onnxruntime execution provider is documented as not supporting
-    // multi-threaded calls to Run on the same inference session. We found the
-    // same to be true for the ROCm execution provider (at least for CNNs).
-    // TODO: This may be a onnxruntime/ROCm bug, check onnxruntime 1.16 release.
-    if (network_->provider_ == OnnxProvider::DML ||
-        network_->provider_ == OnnxProvider::ROCM ||
-        network_->provider_ == OnnxProvider::TRT) {
-      network_->lock_.lock();
-    }
-    network_->session_[step - 1].Run(
-        {}, network_->inputs_cstr_.data(), &input_tensor, 1,
-        network_->outputs_cstr_.data(), output_tensors_.data(),
-        output_tensors_.size());
-    if (network_->provider_ == OnnxProvider::DML ||
-        network_->provider_ == OnnxProvider::ROCM ||
-        network_->provider_ == OnnxProvider::TRT) {
-      network_->lock_.unlock();
+    const int index = network_->GetSessionIndex(replica, bucket);
+    Ort::Session& session = network_->session_[index];
+    if (!network_->graph_io_.empty()) {
+#ifdef USE_ONNX_CUDART
+      OnnxGraphIo& io = *network_->graph_io_[index];
+      const size_t data_size = sizeof(DataType);
+      ReportCudaErrors(cudaMemcpy(io.input, GetInputData(),
+                                  batch * kInputPlanes * 8 * 8 * data_size,
+                                  cudaMemcpyHostToDevice));
+      session.Run(Ort::RunOptions(), io.binding);
+      // Only the rows of actual inputs, the bucket may be larger.
+      const size_t rows = std::min(batch, remaining);
+      for (size_t j = 0; j < output_tensors_step_.size(); j++) {
+        const size_t size = output_tensors_step_[j];
+        ReportCudaErrors(cudaMemcpy(
+            const_cast<DataType*>(GetOutputData(j)) + i * size, io.outputs[j],
+            rows * size * data_size, cudaMemcpyDeviceToHost));
+      }
+#endif
+    } else if (buffers_->bindings.empty()) {
+      session.Run({}, network_->inputs_cstr_.data(), &input_tensor, 1,
+                  network_->outputs_cstr_.data(), output_tensors_.data(),
+                  output_tensors_.size());
+    } else {
+      Ort::IoBinding& binding = buffers_->bindings[index];
+      binding.ClearBoundInputs();
+      binding.ClearBoundOutputs();
+      binding.BindInput(network_->inputs_cstr_[0], input_tensor);
+      for (size_t j = 0; j < output_tensors_.size(); j++) {
+        binding.BindOutput(network_->outputs_cstr_[j], output_tensors_[j]);
+      }
+      session.Run(Ort::RunOptions(), binding);
     }
     i += batch;
   }
 }
 
+int OnnxNetwork::GetBucket(int size) const {
+  if (buckets_.empty()) return 0;
+  const auto it = std::lower_bound(buckets_.begin(), buckets_.end(), size);
+  if (it == buckets_.end()) return buckets_.size() - 1;
+  return it - buckets_.begin();
+}
+
+int OnnxNetwork::AcquireReplica() {
+  // The DML onnxruntime execution provider is documented as not supporting
+  // multi-threaded calls to Run on the same inference session. We found the
+  // same to be true for the ROCm execution provider (at least for CNNs).
+  // TODO: This may be a onnxruntime/ROCm bug, check onnxruntime 1.16 release.
+  // The CUDA graphs of a session are bound to its single set of buffers.
+  const bool exclusive = provider_ == OnnxProvider::DML ||
+                         provider_ == OnnxProvider::ROCM ||
+                         provider_ == OnnxProvider::TRT || cuda_graphs_;
+  std::unique_lock<std::mutex> lock(replica_lock_);
+  auto least_loaded = [&]() {
+    return std::min_element(replica_load_.begin(), replica_load_.end()) -
+           replica_load_.begin();
+  };
+  if (exclusive) {
+    replica_cv_.wait(lock,
+                     [&]() { return replica_load_[least_loaded()] == 0; });
+  }
+  const int replica = least_loaded();
+  ++replica_load_[replica];
+  return replica;
+}
+
+void OnnxNetwork::ReleaseReplica(int replica) {
+  {
+    std::lock_guard<std::mutex> lock(replica_lock_);
+    --replica_load_[replica];
+  }
+  replica_cv_.notify_one();
+}
+
 Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
-                                            int batch_size) {
+                                            int batch_size,
+                                            const std::string& affinity) {
   Ort::SessionOptions options;
   options.SetIntraOpNumThreads(threads);
+  if (!affinity.empty()) {
+    options.AddConfigEntry("session.intra_op_thread_affinities",
+                           affinity.c_str());
+  }
   options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
 
   if (batch_size > 0) {
@@ -323,7 +470,7 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
     case OnnxProvider::TRT: {
       options.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
 
-      std::string cache_dir = CommandLine::BinaryDirectory() + "/trt_cache";
+      const std::string& cache_dir = trt_cache_dir_;
       std::map<std::string, std::string> trt_options;
       trt_options["device_id"] = std::to_string(gpu);
       trt_options["trt_fp16_enable"] = fp16_ ? "1" : "0";
@@ -331,15 +478,16 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
       trt_options["trt_max_partition_iterations"] = "1000";
       trt_options["trt_min_subgraph_size"] = "1";
       trt_options["trt_engine_cache_enable"] = "1";
-      trt_options["trt_engine_cache_prefix"] =
-          "Lc0_ONNX_TRT_batch_" + std::to_string(batch_size) + "_";
+      trt_options["trt_engine_cache_prefix"] = "Lc0_ONNX_TRT_gpu_" +
+                                               std::to_string(gpu) + "_batch_" +
+                                               std::to_string(batch_size) + "_";
       trt_options["trt_engine_cache_path"] = cache_dir;
       trt_options["trt_timing_cache_enable"] = "1";
       trt_options["trt_timing_cache_path"] = cache_dir;
       trt_options["trt_layer_norm_fp32_fallback"] = "1";
       trt_options["trt_force_sequential_engine_build"] = "1";
-      // Looks like we need I/O binding to enable this.
-      // trt_options["trt_cuda_graph_enable"] = "1";
+      // Needs the device memory binding of CreateGraphIo().
+      if (cuda_graphs_) trt_options["trt_cuda_graph_enable"] = "1";
       if (batch_size < 0) {
         trt_options["trt_profile_min_shapes"] =
             inputs_[0] + ":" + std::to_string(min_batch_size_) + "x112x8x8";
@@ -348,14 +496,12 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
         trt_options["trt_profile_opt_shapes"] =
             inputs_[0] + ":" + std::to_string(max_batch_size_ / 4) + "x112x8x8";
       } else {
-        trt_options["trt_profile_min_shapes"] =
-            inputs_[0] + ":" + std::to_string(batch_size_) + "x112x8x8";
-        trt_options["trt_profile_max_shapes"] =
-            inputs_[0] + ":" + std::to_string(batch_size_ * steps_) +
-            "x112x8x8";
-        trt_options["trt_profile_opt_shapes"] =
-            inputs_[0] + ":" + std::to_string(batch_size_ * steps_) +
-            "x112x8x8";
+        // Every bucket has its own engine, built for its exact shape.
+        const std::string shape =
+            inputs_[0] + ":" + std::to_string(batch_size) + "x112x8x8";
+        trt_options["trt_profile_min_shapes"] = shape;
+        trt_options["trt_profile_max_shapes"] = shape;
+        trt_options["trt_profile_opt_shapes"] = shape;
       }
       std::vector<const char*> keys;
       std::vector<const char*> values;
@@ -380,9 +526,22 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
       break;
     }
     case OnnxProvider::CUDA: {
-      OrtCUDAProviderOptions cuda_options;
-      cuda_options.device_id = gpu;
-      options.AppendExecutionProvider_CUDA(cuda_options);
+      if (!cuda_graphs_) {
+        OrtCUDAProviderOptions cuda_options;
+        cuda_options.device_id = gpu;
+        options.AppendExecutionProvider_CUDA(cuda_options);
+        break;
+      }
+      const std::string device_id = std::to_string(gpu);
+      const char* keys[] = {"device_id", "enable_cuda_graph"};
+      const char* values[] = {device_id.c_str(), "1"};
+      const auto& api = Ort::GetApi();
+      OrtCUDAProviderOptionsV2* cuda_options_v2;
+      Ort::ThrowOnError(api.CreateCUDAProviderOptions(&cuda_options_v2));
+      Ort::ThrowOnError(api.UpdateCUDAProviderOptions(cuda_options_v2, keys,
+                                                      values, 2));
+      options.AppendExecutionProvider_CUDA_V2(*cuda_options_v2);
+      api.ReleaseCUDAProviderOptions(cuda_options_v2);
       break;
     }
     case OnnxProvider::CPU:
@@ -399,6 +558,98 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
   return options;
 }
 
+std::unique_ptr<OnnxBuffers> OnnxNetwork::GetBuffers() {
+  {
+    std::lock_guard<std::mutex> lock(buffers_lock_);
+    if (!free_buffers_.empty()) {
+      auto buffers = std::move(free_buffers_.front());
+      free_buffers_.pop_front();
+      return buffers;
+    }
+  }
+  auto allocate = [&](size_t elements) -> OnnxBuffers::Buffer {
+    const size_t bytes = elements * data_size_;
+    if (pinned_allocator_) {
+      return {pinned_allocator_->Alloc(bytes),
+              [this](void* p) { pinned_allocator_->Free(p); }};
+    }
+    return {::operator new(bytes), [](void* p) { ::operator delete(p); }};
+  };
+  auto buffers = std::make_unique<OnnxBuffers>();
+  buffers->input = allocate(max_batch_size_ * kInputPlanes * 8 * 8);
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    const int size = static_cast<int>(i) == policy_head_ ? 1858
+                     : static_cast<int>(i) == wdl_head_  ? 3
+                                                         : 1;
+    buffers->outputs.push_back(allocate(max_batch_size_ * size));
+  }
+  if (pinned_allocator_) {
+    for (auto& session : session_) buffers->bindings.emplace_back(session);
+  }
+  return buffers;
+}
+
+void OnnxNetwork::ReleaseBuffers(std::unique_ptr<OnnxBuffers> buffers) {
+  std::lock_guard<std::mutex> lock(buffers_lock_);
+  free_buffers_.push_back(std::move(buffers));
+}
+
+void OnnxNetwork::CreateGraphIo(const std::vector<int>& gpus) {
+#ifdef USE_ONNX_CUDART
+  const ONNXTensorElementDataType type =
+      fp16_   ? ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16
+      : bf16_ ? ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16
+              : ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+  auto allocate = [&](int batch, int size, void** mem) {
+    const size_t bytes = static_cast<size_t>(batch) * size * data_size_;
+    ReportCudaErrors(cudaMalloc(mem, bytes));
+    return bytes;
+  };
+  for (size_t i = 0; i < session_.size(); i++) {
+    const int gpu = gpus[i / buckets_.size() % gpus.size()];
+    const Ort::MemoryInfo device("Cuda", OrtDeviceAllocator, gpu,
+                                 OrtMemTypeDefault);
+    ReportCudaErrors(cudaSetDevice(gpu));
+    const int batch = buckets_[i % buckets_.size()];
+    auto io = std::make_unique<OnnxGraphIo>(session_[i]);
+    const size_t input_bytes =
+        allocate(batch, kInputPlanes * 8 * 8, &io->input);
+    const int64_t input_dims[] = {batch, kInputPlanes, 8, 8};
+    io->binding.BindInput(
+        inputs_cstr_[0],
+        Ort::Value::CreateTensor(device, io->input, input_bytes, input_dims, 4,
+                                 type));
+    for (size_t j = 0; j < outputs_.size(); j++) {
+      const int size = static_cast<int>(j) == policy_head_ ? 1858
+                       : static_cast<int>(j) == wdl_head_  ? 3
+                                                           : 1;
+      io->outputs.push_back(nullptr);
+      const size_t bytes = allocate(batch, size, &io->outputs.back());
+      const int64_t dims[] = {batch, size};
+      io->binding.BindOutput(
+          outputs_cstr_[j], Ort::Value::CreateTensor(device, io->outputs.back(),
+                                                     bytes, dims, 2, type));
+    }
+    graph_io_.push_back(std::move(io));
+  }
+#else
+  (void)gpus;
+  throw Exception("cuda_graphs needs lc0 built with the CUDA runtime.");
+#endif
+}
+
+// A hash of the model which is stable between runs, to key the caches by.
+uint64_t HashModel(std::string_view model) {
+  uint64_t hash = model.size();
+  for (size_t i = 0; i < model.size(); i += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    std::memcpy(&word, model.data() + i,
+                std::min(sizeof(uint64_t), model.size() - i));
+    hash = HashCat(hash, word);
+  }
+  return hash;
+}
+
 OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
                          OnnxProvider provider)
     : onnx_env_(ORT_LOGGING_LEVEL_WARNING, "lc0"),
@@ -407,26 +658,65 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
                     file.format().network_format().moves_left()},
       fp16_(file.onnx_model().data_type() == pblczero::OnnxModel::FLOAT16),
       bf16_(file.onnx_model().data_type() == pblczero::OnnxModel::BFLOAT16),
-      provider_(provider) {
+      provider_(provider),
+      data_size_(fp16_ || bf16_ ? sizeof(uint16_t) : sizeof(float)),
+      memory_info_(
+          Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)) {
   onnx_env_.DisableTelemetryEvents();
-  batch_size_ =
+  // Fixed batch sizes of the sessions, either listed in the quoted buckets
+  // option (e.g. buckets="8,16,32,64"), or steps multiples of batch.
+  int batch_size =
       opts.GetOrDefault<int>("batch", provider == OnnxProvider::DML ? 16 : -1);
-  steps_ =
+  const int steps =
       opts.GetOrDefault<int>("steps", provider == OnnxProvider::DML ? 4 : 1);
+  if (const auto list = opts.GetOrDefault<std::string>("buckets", "");
+      !list.empty()) {
+    buckets_ = ParseIntList(list);
+    std::sort(buckets_.begin(), buckets_.end());
+    if (buckets_.front() < 1 || buckets_.back() > max_batch_size_) {
+      throw Exception("Invalid buckets for onnx backend.");
+    }
+    buckets_.erase(std::unique(buckets_.begin(), buckets_.end()),
+                   buckets_.end());
+  } else if (batch_size > 0) {
+    if (batch_size * steps > max_batch_size_) {
+      batch_size = max_batch_size_ / steps;
+    }
+    for (int step = 1; step <= steps; step++) {
+      buckets_.push_back(batch_size * step);
+    }
+  }
+  // Launch overhead of small batches is mostly gone with CUDA graphs, which
+  // need the fixed shapes of the buckets.
+  cuda_graphs_ = opts.GetOrDefault<bool>("cuda_graphs", false);
+  if (cuda_graphs_ && (buckets_.empty() || (provider != OnnxProvider::CUDA &&
+                                            provider != OnnxProvider::TRT))) {
+    throw Exception("cuda_graphs needs onnx-cuda or onnx-trt, and batch or "
+                    "buckets.");
+  }
   min_batch_size_ = opts.GetOrDefault<int>(
       "min_batch", provider == OnnxProvider::TRT ? 4 : 1);
   int gpu = opts.GetOrDefault<int>("gpu", 0);
   int threads =
       opts.GetOrDefault<int>("threads", provider == OnnxProvider::CPU ? 1 : 0);
-
-  // Sanity checks.
-  if (batch_size_ <= 0) {
-    batch_size_ = -1;  // Variable batch size.
-    steps_ = 1;
+  // The replicas are assigned round robin to the devices listed in the quoted
+  // gpus option (e.g. gpus="0,1"), and to the cores sets of the affinity
+  // option, which are separated with '|' and use the onnxruntime format of
+  // session.intra_op_thread_affinities (e.g. affinity="1;2|4;5").
+  std::vector<int> gpus{gpu};
+  if (const auto list = opts.GetOrDefault<std::string>("gpus", "");
+      !list.empty()) {
+    gpus = ParseIntList(list);
   }
-  if (batch_size_ * steps_ > max_batch_size_) {
-    batch_size_ = max_batch_size_ / steps_;
+  std::vector<std::string> affinities{""};
+  if (const auto list = opts.GetOrDefault<std::string>("affinity", "");
+      !list.empty()) {
+    affinities = StrSplit(list, "|");
   }
+  num_replicas_ = opts.GetOrDefault<int>(
+      "sessions", static_cast<int>(std::max(gpus.size(), affinities.size())));
+  if (num_replicas_ < 1) throw Exception("sessions must be at least 1.");
+  replica_load_.assign(num_replicas_, 0);
 
   const auto& md = file.onnx_model();
   if (!md.has_input_planes()) {
@@ -458,10 +748,55 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
                  std::back_inserter(outputs_cstr_),
                  [](const auto& x) { return x.c_str(); });
 
-  for (int step = 1; step <= steps_; step++)
-    session_.emplace_back(onnx_env_, file.onnx_model().model().data(),
-                          file.onnx_model().model().size(),
-                          GetOptions(gpu, threads, batch_size_ * step));
+  if (provider_ == OnnxProvider::TRT) {
+    // Engines are only valid for the weights they were built from, so every
+    // network gets its own cache directory.
+    const std::string base_dir = opts.GetOrDefault<std::string>(
+        "trt_cache", CommandLine::BinaryDirectory() + "/trt_cache");
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(
+                 HashModel(file.onnx_model().model())));
+    trt_cache_dir_ = base_dir + "/" + hash;
+    CreateDirectory(base_dir);
+    CreateDirectory(trt_cache_dir_);
+    CERR << "TensorRT engine cache: " << trt_cache_dir_;
+  }
+
+  for (int replica = 0; replica < num_replicas_; replica++) {
+    for (int bucket = 0; bucket < NumBuckets(); bucket++) {
+      session_.emplace_back(
+          onnx_env_, file.onnx_model().model().data(),
+          file.onnx_model().model().size(),
+          GetOptions(gpus[replica % gpus.size()], threads,
+                     buckets_.empty() ? -1 : buckets_[bucket],
+                     affinities[replica % affinities.size()]));
+    }
+  }
+  if (num_replicas_ > 1) {
+    CERR << "Running " << num_replicas_ << " ONNX sessions in parallel.";
+  }
+  if (cuda_graphs_) CreateGraphIo(gpus);
+
+  // With I/O binding, the inputs and outputs are in pinned memory, which the
+  // CUDA based providers transfer without an extra copy.
+  const bool cuda_provider =
+      provider_ == OnnxProvider::CUDA || provider_ == OnnxProvider::TRT;
+  if (opts.GetOrDefault<bool>("io_binding", cuda_provider)) {
+    if (!cuda_provider) {
+      throw Exception("io_binding is only supported by onnx-cuda and "
+                      "onnx-trt.");
+    }
+    try {
+      Ort::MemoryInfo pinned("CudaPinned", OrtDeviceAllocator, gpu,
+                             OrtMemTypeCPUOutput);
+      pinned_allocator_.emplace(session_[0], pinned);
+      memory_info_ = std::move(pinned);
+    } catch (const Ort::Exception& e) {
+      CERR << "Pinned memory is not available, not using I/O binding: "
+           << e.what();
+    }
+  }
 }
 
 template <OnnxProvider kProvider>
@@ -25,23 +25,143 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
+#include <fstream>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include "neural/factory.h"
+#include "utils/exception.h"
 #include "utils/hashcat.h"
+#include "utils/random.h"
+#include "utils/string.h"
 
 namespace lczero {
 namespace {
 
+// Synthetic latency of the computations, to study the search behaviour with a
+// GPU-like backend on machines without one. The latency of a batch is either
+// fixed_us + per_position_us * batch_size, or is interpolated from a profile
+// written by "backendbench --csv". jitter randomly scales it by up to that
+// fraction, and at most parallelism computations (if set) run at once, the
+// rest wait for them.
+class LatencyModel {
+ public:
+  explicit LatencyModel(const OptionsDict& options)
+      : fixed_us_(options.GetOrDefault<int>("delay", 0) * 1000 +
+                  options.GetOrDefault<int>("fixed_us", 0)),
+        per_position_us_(options.GetOrDefault<int>("per_position_us", 0)),
+        jitter_(options.GetOrDefault<float>("jitter", 0.0f)),
+        parallelism_(options.GetOrDefault<int>("parallelism", 0)),
+        free_slots_(parallelism_) {
+    const std::string profile =
+        options.GetOrDefault<std::string>("profile", "");
+    if (!profile.empty()) LoadProfile(profile);
+  }
+
+  // Blocks for the time the computation of the batch takes.
+  void Wait(int batch_size) {
+    double us = GetLatencyUs(batch_size);
+    if (jitter_ > 0.0f) {
+      us *= 1.0 + jitter_ * (2.0 * Random::Get().GetDouble(1.0) - 1.0);
+    }
+    if (us <= 0.0) return;
+    if (parallelism_ > 0) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return free_slots_ > 0; });
+      --free_slots_;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(std::lround(us)));
+    if (parallelism_ > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++free_slots_;
+      cv_.notify_one();
+    }
+  }
+
+ private:
+  double GetLatencyUs(int batch_size) const {
+    if (profile_.empty()) {
+      return fixed_us_ + static_cast<double>(per_position_us_) * batch_size;
+    }
+    if (profile_.size() == 1) return profile_[0].us;
+    // Linear interpolation between the neighbouring points, extrapolation
+    // outside of the profile.
+    auto iter = std::lower_bound(
+        profile_.begin(), profile_.end(), batch_size,
+        [](const Point& p, int size) { return p.batch_size < size; });
+    if (iter == profile_.end()) --iter;
+    if (iter == profile_.begin()) ++iter;
+    const Point& lo = *(iter - 1);
+    const Point& hi = *iter;
+    const double slope = (hi.us - lo.us) / (hi.batch_size - lo.batch_size);
+    return std::max(0.0, lo.us + slope * (batch_size - lo.batch_size));
+  }
+
+  // Reads the batch_size and p50_ms (or mean_ms) columns of the CSV.
+  void LoadProfile(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) throw Exception("Unable to open latency profile " + filename);
+    std::string line;
+    std::getline(file, line);
+    const std::vector<std::string> header = StrSplit(Trim(line), ",");
+    auto column = [&header](const std::string& name) {
+      return std::find(header.begin(), header.end(), name) - header.begin();
+    };
+    const size_t batch_column = column("batch_size");
+    size_t latency_column = column("p50_ms");
+    if (latency_column == header.size()) latency_column = column("mean_ms");
+    if (batch_column == header.size() || latency_column == header.size()) {
+      throw Exception("Latency profile " + filename +
+                      " needs batch_size and p50_ms or mean_ms columns.");
+    }
+    while (std::getline(file, line)) {
+      const std::vector<std::string> row = StrSplit(Trim(line), ",");
+      if (row.size() != header.size()) continue;
+      profile_.push_back({std::stoi(row[batch_column]),
+                          1000.0 * std::stod(row[latency_column])});
+    }
+    if (profile_.empty()) {
+      throw Exception("Latency profile " + filename + " is empty.");
+    }
+    std::sort(profile_.begin(), profile_.end(),
+              [](const Point& a, const Point& b) {
+                return a.batch_size < b.batch_size;
+              });
+    // Same batch size measured with several thread counts: keep the first.
+    profile_.erase(std::unique(profile_.begin(), profile_.end(),
+                               [](const Point& a, const Point& b) {
+                                 return a.batch_size == b.batch_size;
+                               }),
+                   profile_.end());
+  }
+
+  struct Point {
+    int batch_size;
+    double us;
+  };
+
+  const int fixed_us_;
+  const int per_position_us_;
+  const float jitter_;
+  const int parallelism_;
+  std::vector<Point> profile_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int free_slots_;
+};
+
 class RandomNetworkComputation : public NetworkComputation {
  public:
-  RandomNetworkComputation(int delay, int seed, bool uniform_mode)
-      : delay_ms_(delay), seed_(seed), uniform_mode_(uniform_mode) {}
+  RandomNetworkComputation(LatencyModel* latency, int seed, bool uniform_mode)
+      : latency_(latency), seed_(seed), uniform_mode_(uniform_mode) {}
 
   void AddInput(InputPlanes&& input) override {
     std::uint64_t hash = seed_;
@@ -55,11 +175,7 @@ class RandomNetworkComputation : public NetworkComputation {
     inputs_.push_back(hash);
   }
 
-  void ComputeBlocking() override {
-    if (delay_ms_) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
-    }
-  }
+  void ComputeBlocking() override { latency_->Wait(inputs_.size()); }
 
   int GetBatchSize() const override { return inputs_.size(); }
 
@@ -96,7 +212,7 @@ class RandomNetworkComputation : public NetworkComputation {
 
  private:
   std::vector<std::uint64_t> inputs_;
-  int delay_ms_ = 0;
+  LatencyModel* const latency_;
   int seed_ = 0;
   bool uniform_mode_ = false;
 };
@@ -104,7 +220,7 @@ class RandomNetworkComputation : public NetworkComputation {
 class RandomNetwork : public Network {
  public:
   RandomNetwork(const OptionsDict& options)
-      : delay_ms_(options.GetOrDefault<int>("delay", 0)),
+      : latency_(options),
         seed_(options.GetOrDefault<int>("seed", 0)),
         uniform_mode_(options.GetOrDefault<bool>("uniform", false)),
         capabilities_{
@@ -115,7 +231,7 @@ class RandomNetwork : public Network {
             pblczero::NetworkFormat::OUTPUT_WDL,
             pblczero::NetworkFormat::MOVES_LEFT_NONE} {}
   std::unique_ptr<NetworkComputation> NewComputation() override {
-    return std::make_unique<RandomNetworkComputation>(delay_ms_, seed_,
+    return std::make_unique<RandomNetworkComputation>(&latency_, seed_,
                                                       uniform_mode_);
   }
   const NetworkCapabilities& GetCapabilities() const override {
@@ -123,7 +239,7 @@ class RandomNetwork : public Network {
   }
 
  private:
-  int delay_ms_ = 0;
+  LatencyModel latency_;
   int seed_ = 0;
   bool uniform_mode_ = false;
   NetworkCapabilities capabilities_{
@@ -25,14 +25,162 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <span>
+#include <unordered_map>
 
 #include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
 #include "utils/hashcat.h"
 
 namespace lczero {
 namespace {
 
+// Recordings are appended to record_file as a stream of entries: hash, number
+// of values, values. For replay they can be converted into the indexed format,
+// all numbers in native byte order:
+//   header: magic, version, number of entries, number of values;
+//   index: entries sorted by hash, each with the offset and the length of its
+//     values;
+//   values: float values of all entries.
+// Indexed files are memory mapped, so even large recordings replay without any
+// loading time.
+constexpr uint32_t kIndexMagic = 0x4950524c;  // "LRPI"
+constexpr uint32_t kIndexVersion = 1;
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_entries;
+  uint64_t num_values;
+};
+
+struct IndexEntry {
+  uint64_t hash;
+  uint64_t offset;
+  uint32_t length;
+  uint32_t reserved;
+};
+
+using RecordMap = std::unordered_map<uint64_t, std::vector<float>>;
+
+// Reads a recording stream. Only the first recorded value is used for any hash
+// collisions.
+RecordMap ReadRecordStream(const std::string& filename) {
+  RecordMap result;
+  std::ifstream input(filename, std::ios_base::binary);
+  input.seekg(0, input.end);
+  auto file_length = input.tellg();
+  input.seekg(0, input.beg);
+  while (input.tellg() < file_length) {
+    uint64_t value = 0;
+    input.read(reinterpret_cast<char*>(&value), sizeof(value));
+    int32_t length = 0;
+    input.read(reinterpret_cast<char*>(&length), sizeof(length));
+    auto& entry = result[value];
+    bool fill = entry.size() == 0;
+    for (int j = 0; j < length; j++) {
+      float recorded = 0.0f;
+      input.read(reinterpret_cast<char*>(&recorded), sizeof(recorded));
+      if (fill) {
+        entry.push_back(recorded);
+      }
+    }
+  }
+  return result;
+}
+
+void WriteIndexedRecording(const RecordMap& records,
+                           const std::string& filename) {
+  std::vector<IndexEntry> index;
+  index.reserve(records.size());
+  uint64_t num_values = 0;
+  for (const auto& [hash, values] : records) {
+    index.push_back(
+        {hash, num_values, static_cast<uint32_t>(values.size()), 0});
+    num_values += values.size();
+  }
+  std::sort(index.begin(), index.end(),
+            [](const IndexEntry& a, const IndexEntry& b) {
+              return a.hash < b.hash;
+            });
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) throw Exception("Cannot write indexed recording: " + filename);
+  const IndexHeader header{kIndexMagic, kIndexVersion, index.size(),
+                           num_values};
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(index.data()),
+            index.size() * sizeof(IndexEntry));
+  // Values go in the order of the offsets, i.e. in the map iteration order.
+  for (const auto& [hash, values] : records) {
+    out.write(reinterpret_cast<const char*>(values.data()),
+              values.size() * sizeof(float));
+  }
+  out.close();
+  if (!out) throw Exception("Cannot write indexed recording: " + filename);
+  CERR << "Wrote " << index.size() << " recorded evaluations to " << filename;
+}
+
+// Recorded values to replay, either loaded from a recording stream or memory
+// mapped from an indexed file.
+class ReplayTable {
+ public:
+  explicit ReplayTable(const std::string& filename) {
+    if (GetFileSize(filename) >= sizeof(IndexHeader)) {
+      auto file = std::make_unique<MappedFile>(filename);
+      IndexHeader header;
+      std::memcpy(&header, file->data().data(), sizeof(header));
+      if (header.magic == kIndexMagic) {
+        if (header.version != kIndexVersion) {
+          throw Exception("Unsupported indexed recording version: " +
+                          filename);
+        }
+        const size_t index_size = header.num_entries * sizeof(IndexEntry);
+        if (file->data().size() < sizeof(IndexHeader) + index_size +
+                                      header.num_values * sizeof(float)) {
+          throw Exception("Truncated indexed recording: " + filename);
+        }
+        const uint8_t* data = file->data().data() + sizeof(IndexHeader);
+        index_ = {reinterpret_cast<const IndexEntry*>(data),
+                  header.num_entries};
+        values_ = {reinterpret_cast<const float*>(data + index_size),
+                   header.num_values};
+        file_ = std::move(file);
+        return;
+      }
+    }
+    records_ = ReadRecordStream(filename);
+  }
+
+  bool is_indexed() const { return file_ != nullptr; }
+  const RecordMap& records() const { return records_; }
+
+  // Returns empty span if the hash is not recorded.
+  std::span<const float> Find(uint64_t hash) const {
+    if (!file_) {
+      const auto iter = records_.find(hash);
+      if (iter == records_.end()) return {};
+      return iter->second;
+    }
+    const auto iter = std::lower_bound(
+        index_.begin(), index_.end(), hash,
+        [](const IndexEntry& entry, uint64_t h) { return entry.hash < h; });
+    if (iter == index_.end() || iter->hash != hash) return {};
+    if (iter->offset + iter->length > values_.size()) return {};
+    return values_.subspan(iter->offset, iter->length);
+  }
+
+ private:
+  std::unique_ptr<MappedFile> file_;
+  std::span<const IndexEntry> index_;
+  std::span<const float> values_;
+  RecordMap records_;
+};
+
 class RecordComputation : public NetworkComputation {
  public:
   RecordComputation(std::unique_ptr<NetworkComputation>&& inner,
@@ -109,8 +257,7 @@ Mutex RecordComputation::mutex_;
 
 class ReplayComputation : public NetworkComputation {
  public:
-  ReplayComputation(std::unordered_map<uint64_t, std::vector<float>>* lookup)
-      : lookup_(lookup) {}
+  ReplayComputation(const ReplayTable* lookup) : lookup_(lookup) {}
   // Adds a sample to the batch.
   void AddInput(InputPlanes&& input) override {
     hashes_.push_back(RecordComputation::make_hash(input));
@@ -121,11 +268,10 @@ class ReplayComputation : public NetworkComputation {
   // Returns how many times AddInput() was called.
   int GetBatchSize() const override { return static_cast<int>(hashes_.size()); }
   float Replay(int index) const {
-    const auto& entry_ptr = lookup_->find(hashes_[index]);
-    if (entry_ptr == lookup_->end()) {
+    const std::span<const float> entry = lookup_->Find(hashes_[index]);
+    if (entry.empty()) {
       return 0.0f;
     }
-    const auto& entry = entry_ptr->second;
     size_t counter = replay_counter_[index];
     if (counter >= entry.size()) {
       // Second pass reads the same things in the same order as first.
@@ -152,7 +298,7 @@ class ReplayComputation : public NetworkComputation {
   std::unique_ptr<NetworkComputation> inner_;
   std::vector<uint64_t> hashes_;
   mutable std::vector<size_t> replay_counter_;
-  std::unordered_map<uint64_t, std::vector<float>>* lookup_;
+  const ReplayTable* lookup_;
 };
 
 class RecordReplayNetwork : public Network {
@@ -172,28 +318,12 @@ class RecordReplayNetwork : public Network {
     }
     replay_file_ = options.GetOrDefault<std::string>("replay_file", "");
     record_file_ = options.GetOrDefault<std::string>("record_file", "");
+    index_file_ = options.GetOrDefault<std::string>("index_file", "");
     if (replay_file_.size() > 0) {
-      lookup_ =
-          std::make_unique<std::unordered_map<uint64_t, std::vector<float>>>();
-      std::ifstream input(replay_file_, std::ios_base::binary);
-      input.seekg(0, input.end);
-      auto file_length = input.tellg();
-      input.seekg(0, input.beg);
-      while (input.tellg() < file_length) {
-        uint64_t value = 0;
-        input.read(reinterpret_cast<char*>(&value), sizeof(value));
-        int32_t length = 0;
-        input.read(reinterpret_cast<char*>(&length), sizeof(length));
-        auto& entry = (*lookup_)[value];
-        // Only use the first recorded value for any hash collisions.
-        bool fill = entry.size() == 0;
-        for (int j = 0; j < length; j++) {
-          float recorded = 0.0f;
-          input.read(reinterpret_cast<char*>(&recorded), sizeof(recorded));
-          if (fill) {
-            entry.push_back(recorded);
-          }
-        }
+      lookup_ = std::make_unique<ReplayTable>(replay_file_);
+      // Existing recording streams can be converted without recording again.
+      if (!lookup_->is_indexed() && !index_file_.empty()) {
+        WriteIndexedRecording(lookup_->records(), index_file_);
       }
     }
   }
@@ -226,7 +356,15 @@ class RecordReplayNetwork : public Network {
     return capabilities_;
   }
 
-  ~RecordReplayNetwork() {}
+  ~RecordReplayNetwork() {
+    if (lookup_ || record_file_.empty() || index_file_.empty()) return;
+    // All the computations are done by now, so the recording is complete.
+    try {
+      WriteIndexedRecording(ReadRecordStream(record_file_), index_file_);
+    } catch (const Exception& e) {
+      CERR << e.what();
+    }
+  }
 
  private:
   std::vector<std::unique_ptr<Network>> networks_;
@@ -234,7 +372,8 @@ class RecordReplayNetwork : public Network {
   NetworkCapabilities capabilities_;
   std::string replay_file_;
   std::string record_file_;
-  std::unique_ptr<std::unordered_map<uint64_t, std::vector<float>>> lookup_;
+  std::string index_file_;
+  std::unique_ptr<ReplayTable> lookup_;
 };
 
 std::unique_ptr<Network> MakeRecordReplayNetwork(
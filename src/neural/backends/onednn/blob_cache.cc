@@ -0,0 +1,99 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "blob_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace onednn_backend {
+
+PrimitiveBlobCache::PrimitiveBlobCache(const std::string& directory,
+                                       const dnnl::engine& eng)
+    : directory_(directory) {
+  const dnnl_version_t* ver = dnnl_version();
+  salt_ = HashCat({static_cast<uint64_t>(ver->major),
+                   static_cast<uint64_t>(ver->minor),
+                   static_cast<uint64_t>(ver->patch),
+                   static_cast<uint64_t>(eng.get_kind()),
+                   static_cast<uint64_t>(dnnl::get_effective_cpu_isa())});
+  for (const char* c = ver->hash; c && *c; c++) {
+    salt_ = HashCat(salt_, static_cast<uint64_t>(*c));
+  }
+}
+
+std::string PrimitiveBlobCache::GetFilename(
+    const std::vector<uint8_t>& id) const {
+  uint64_t hash = HashCat(salt_, id.size());
+  for (const uint8_t byte : id) hash = HashCat(hash, byte);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.dnnl",
+           static_cast<unsigned long long>(hash));
+  return directory_ + "/" + name;
+}
+
+std::vector<uint8_t> PrimitiveBlobCache::Load(
+    const std::string& filename) const {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) return {};
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
+                              std::istreambuf_iterator<char>());
+}
+
+void PrimitiveBlobCache::Save(const std::string& filename,
+                              const std::vector<uint8_t>& blob) const {
+  try {
+    // Only created once something is saved, which never happens on cpu.
+    CreateDirectory(directory_);
+    // Write to a temporary file first, so that a concurrently starting process
+    // never sees a partial entry.
+    const std::string tmp_filename = filename + ".tmp";
+    {
+      std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+      file.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+      if (!file) throw Exception("Unable to write " + tmp_filename);
+    }
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(tmp_filename.c_str());
+      throw Exception("Unable to rename " + tmp_filename);
+    }
+  } catch (const std::exception& e) {
+    // Not fatal, the primitive just will be compiled again next time.
+    CERR << "Unable to cache primitive: " << e.what();
+  }
+}
+
+}  // namespace onednn_backend
+}  // namespace lczero
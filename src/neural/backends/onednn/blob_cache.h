@@ -0,0 +1,88 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dnnl.hpp"
+
+namespace lczero {
+namespace onednn_backend {
+
+// Keeps compiled primitives on disk across processes, using the oneDNN cache
+// blob API. Entries are named by a hash of the primitive cache blob id (which
+// covers shapes, including the batch size, data types and attributes) and a
+// salt for the library version, engine and ISA. Primitives for which oneDNN
+// doesn't provide cache blobs (currently those on cpu) are just created.
+class PrimitiveBlobCache {
+ public:
+  PrimitiveBlobCache(const std::string& directory, const dnnl::engine& eng);
+
+  template <typename Primitive, typename PrimitiveDesc>
+  Primitive Create(const PrimitiveDesc& pd) const {
+#if DNNL_VERSION_MAJOR * 100 + DNNL_VERSION_MINOR >= 206
+    std::vector<uint8_t> id;
+    try {
+      id = pd.get_cache_blob_id();
+    } catch (const dnnl::error&) {
+    }
+    if (!id.empty()) {
+      const std::string filename = GetFilename(id);
+      const std::vector<uint8_t> blob = Load(filename);
+      if (!blob.empty()) {
+        try {
+          return Primitive(pd, blob);
+        } catch (const dnnl::error&) {
+          // Stale or corrupted entry, overwritten below.
+        }
+      }
+      Primitive primitive(pd);
+      try {
+        Save(filename, primitive.get_cache_blob());
+      } catch (const dnnl::error&) {
+      }
+      return primitive;
+    }
+#endif
+    return Primitive(pd);
+  }
+
+ private:
+  std::string GetFilename(const std::vector<uint8_t>& id) const;
+  std::vector<uint8_t> Load(const std::string& filename) const;
+  void Save(const std::string& filename,
+            const std::vector<uint8_t>& blob) const;
+
+  const std::string directory_;
+  uint64_t salt_;
+};
+
+}  // namespace onednn_backend
+}  // namespace lczero
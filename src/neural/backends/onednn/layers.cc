@@ -40,9 +40,11 @@ BaseLayer::BaseLayer(int c, int h, int w, BaseLayer* ip)
   if (ip) {
     data_type_ = ip->data_type_;
     convolution_type_ = ip->convolution_type_;
+    blob_cache_ = ip->blob_cache_;
   } else {
     data_type_ = dnnl::memory::data_type::undef;
     convolution_type_ = dnnl::algorithm::convolution_auto;
+    blob_cache_ = nullptr;
   }
 }
 
@@ -104,7 +106,7 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     auto conv_pd =
         dnnl::convolution_forward::primitive_desc(conv_d, conv_attr, eng);
     auto scratchpad_md = conv_pd.scratchpad_desc();
-    conv_ = dnnl::convolution_forward(conv_pd);
+    conv_ = MakePrimitive<dnnl::convolution_forward>(conv_pd);
 
     in_md = conv_pd.src_desc();
     out_md = conv_pd.dst_desc();
@@ -118,7 +120,7 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
       mish_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
       auto mish_pd =
           dnnl::eltwise_forward::primitive_desc(mish_d, mish_attr, eng);
-      mish_ = dnnl::eltwise_forward(mish_pd);
+      mish_ = MakePrimitive<dnnl::eltwise_forward>(mish_pd);
       if (scratchpad_md.get_size() < mish_pd.scratchpad_desc().get_size()) {
         scratchpad_md = mish_pd.scratchpad_desc();
       }
@@ -137,7 +139,7 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     reorder_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto in_reorder_pd = dnnl::reorder::primitive_desc(
         eng, input.get_desc(), eng, in_md, reorder_attr);
-    in_reorder_ = dnnl::reorder(in_reorder_pd);
+    in_reorder_ = MakePrimitive<dnnl::reorder>(in_reorder_pd);
     if (scratchpad_md.get_size() < in_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = in_reorder_pd.scratchpad_desc();
     }
@@ -145,7 +147,7 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     if (use_skip_) {
       auto skip_reorder_pd = dnnl::reorder::primitive_desc(
           eng, output.get_desc(), eng, out_md, reorder_attr);
-      skip_reorder_ = dnnl::reorder(skip_reorder_pd);
+      skip_reorder_ = MakePrimitive<dnnl::reorder>(skip_reorder_pd);
       if (scratchpad_md.get_size() <
           skip_reorder_pd.scratchpad_desc().get_size()) {
         scratchpad_md = skip_reorder_pd.scratchpad_desc();
@@ -252,7 +254,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     pooling_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto pooling_pd =
         dnnl::pooling_forward::primitive_desc(pooling_d, pooling_attr, eng);
-    pooling_ = dnnl::pooling_forward(pooling_pd);
+    pooling_ = MakePrimitive<dnnl::pooling_forward>(pooling_pd);
     auto scratchpad_md = pooling_pd.scratchpad_desc();
 
     // This is also the optimized memory format descriptor for the binary
@@ -275,7 +277,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_attr.set_post_ops(fc_ops);
     auto fc_pd =
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
-    fc_ = dnnl::inner_product_forward(fc_pd);
+    fc_ = MakePrimitive<dnnl::inner_product_forward>(fc_pd);
     if (scratchpad_md.get_size() < fc_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fc_pd.scratchpad_desc();
     }
@@ -295,7 +297,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc2_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto fc2_pd =
         dnnl::inner_product_forward::primitive_desc(fc2_d, fc2_attr, eng);
-    fc2_ = dnnl::inner_product_forward(fc2_pd);
+    fc2_ = MakePrimitive<dnnl::inner_product_forward>(fc2_pd);
     if (scratchpad_md.get_size() < fc2_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fc2_pd.scratchpad_desc();
     }
@@ -315,7 +317,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     sigmoid_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto sigmoid_pd =
         dnnl::eltwise_forward::primitive_desc(sigmoid_d, sigmoid_attr, eng);
-    sigmoid_ = dnnl::eltwise_forward(sigmoid_pd);
+    sigmoid_ = MakePrimitive<dnnl::eltwise_forward>(sigmoid_pd);
     if (scratchpad_md.get_size() < sigmoid_pd.scratchpad_desc().get_size()) {
       scratchpad_md = sigmoid_pd.scratchpad_desc();
     }
@@ -340,7 +342,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     mul_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     mul_attr.set_post_ops(mul_ops);
     auto mul_pd = dnnl::binary::primitive_desc(mul_d, mul_attr, eng);
-    mul_ = dnnl::binary(mul_pd);
+    mul_ = MakePrimitive<dnnl::binary>(mul_pd);
     if (scratchpad_md.get_size() < mul_pd.scratchpad_desc().get_size()) {
       scratchpad_md = mul_pd.scratchpad_desc();
     }
@@ -361,7 +363,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
       add_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
       add_attr.set_post_ops(add_ops);
       auto add_pd = dnnl::binary::primitive_desc(add_d, add_attr, eng);
-      add_ = dnnl::binary(add_pd);
+      add_ = MakePrimitive<dnnl::binary>(add_pd);
       if (scratchpad_md.get_size() < add_pd.scratchpad_desc().get_size()) {
         scratchpad_md = add_pd.scratchpad_desc();
       }
@@ -371,7 +373,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     reorder_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto fc1_reorder_pd = dnnl::reorder::primitive_desc(
         eng, pool_out_md, eng, fc1_in_md, reorder_attr);
-    fc1_reorder_ = dnnl::reorder(fc1_reorder_pd);
+    fc1_reorder_ = MakePrimitive<dnnl::reorder>(fc1_reorder_pd);
     if (scratchpad_md.get_size() <
         fc1_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fc1_reorder_pd.scratchpad_desc();
@@ -380,7 +382,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     auto mul_reorder_pd = dnnl::reorder::primitive_desc(
         eng, fc2_out_md.submemory_desc({N, C}, {0, 0}).reshape({N, C, 1, 1}),
         eng, pool_out_md, reorder_attr);
-    mul_reorder_ = dnnl::reorder(mul_reorder_pd);
+    mul_reorder_ = MakePrimitive<dnnl::reorder>(mul_reorder_pd);
     if (scratchpad_md.get_size() <
         mul_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = mul_reorder_pd.scratchpad_desc();
@@ -389,7 +391,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     auto add_reorder_pd = dnnl::reorder::primitive_desc(
         eng, fc2_out_md.submemory_desc({N, C}, {0, C}).reshape({N, C, 1, 1}),
         eng, pool_out_md, reorder_attr);
-    add_reorder_ = dnnl::reorder(add_reorder_pd);
+    add_reorder_ = MakePrimitive<dnnl::reorder>(add_reorder_pd);
     if (scratchpad_md.get_size() <
         add_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = add_reorder_pd.scratchpad_desc();
@@ -519,7 +521,7 @@ void FCLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_attr.set_post_ops(fc_ops);
     auto fc_pd =
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
-    fc_ = dnnl::inner_product_forward(fc_pd);
+    fc_ = MakePrimitive<dnnl::inner_product_forward>(fc_pd);
     auto scratchpad_md = fc_pd.scratchpad_desc();
 
     in_md = fc_pd.src_desc();
@@ -534,7 +536,7 @@ void FCLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     reorder_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto in_reorder_pd = dnnl::reorder::primitive_desc(
         eng, input.get_desc(), eng, in_md, reorder_attr);
-    in_reorder_ = dnnl::reorder(in_reorder_pd);
+    in_reorder_ = MakePrimitive<dnnl::reorder>(in_reorder_pd);
     if (scratchpad_md.get_size() < in_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = in_reorder_pd.scratchpad_desc();
     }
@@ -627,7 +629,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_attr.set_post_ops(fc_ops);
     auto fc_pd =
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
-    fc_ = dnnl::inner_product_forward(fc_pd);
+    fc_ = MakePrimitive<dnnl::inner_product_forward>(fc_pd);
     auto scratchpad_md = fc_pd.scratchpad_desc();
 
     // Q
@@ -642,7 +644,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     common_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto fcQK_pd =
         dnnl::inner_product_forward::primitive_desc(fcQK_d, common_attr, eng);
-    fcQK_ = dnnl::inner_product_forward(fcQK_pd);
+    fcQK_ = MakePrimitive<dnnl::inner_product_forward>(fcQK_pd);
     if (scratchpad_md.get_size() < fcQK_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fcQK_pd.scratchpad_desc();
     }
@@ -661,7 +663,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     mul_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     mul_attr.set_output_scales(0, {1.0f / scaling});
     auto mul_pd = dnnl::matmul::primitive_desc(mul_d, mul_attr, eng);
-    mul_ = dnnl::matmul(mul_pd);
+    mul_ = MakePrimitive<dnnl::matmul>(mul_pd);
     if (scratchpad_md.get_size() < mul_pd.scratchpad_desc().get_size()) {
       scratchpad_md = mul_pd.scratchpad_desc();
     }
@@ -676,7 +678,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
           eng, mul_B_md.submemory_desc({N, policy_d_model_, 8}, {0, 0, 56}),
           eng, mul_B_md.submemory_desc({N, policy_d_model_, 8}, {0, 0, 0}),
           common_attr);
-      hack_reorder_ = dnnl::reorder(reorder_pd);
+      hack_reorder_ = MakePrimitive<dnnl::reorder>(reorder_pd);
       if (scratchpad_md.get_size() < reorder_pd.scratchpad_desc().get_size()) {
         scratchpad_md = reorder_pd.scratchpad_desc();
       }
@@ -686,7 +688,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
           mul_B_md.submemory_desc({N, policy_d_model_, 8}, {0, 0, 0}),
           mul_A_md.submemory_desc({N, 4, 8}, {0, 0, 0}));
       auto pmul_pd = dnnl::matmul::primitive_desc(pmul_d, common_attr, eng);
-      pmul_ = dnnl::matmul(pmul_pd);
+      pmul_ = MakePrimitive<dnnl::matmul>(pmul_pd);
       if (scratchpad_md.get_size() < pmul_pd.scratchpad_desc().get_size()) {
         scratchpad_md = pmul_pd.scratchpad_desc();
       }
@@ -694,7 +696,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
       reorder_pd = dnnl::reorder::primitive_desc(
           eng, mul_A_md.submemory_desc({N, 4, 8}, {0, 0, 0}), eng, promo_md,
           common_attr);
-      hack_reorder_2_ = dnnl::reorder(reorder_pd);
+      hack_reorder_2_ = MakePrimitive<dnnl::reorder>(reorder_pd);
       if (scratchpad_md.get_size() < reorder_pd.scratchpad_desc().get_size()) {
         scratchpad_md = reorder_pd.scratchpad_desc();
       }
@@ -705,7 +707,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
           mul_B_md.submemory_desc({N, policy_d_model_, 8}, {0, 0, 56}),
           promo_md);
       auto pmul_pd = dnnl::matmul::primitive_desc(pmul_d, common_attr, eng);
-      pmul_ = dnnl::matmul(pmul_pd);
+      pmul_ = MakePrimitive<dnnl::matmul>(pmul_pd);
       if (scratchpad_md.get_size() < pmul_pd.scratchpad_desc().get_size()) {
         scratchpad_md = pmul_pd.scratchpad_desc();
       }
@@ -713,7 +715,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
 
     auto in_reorder_pd = dnnl::reorder::primitive_desc(eng, input.get_desc(),
                                                        eng, in_md, common_attr);
-    in_reorder_ = dnnl::reorder(in_reorder_pd);
+    in_reorder_ = MakePrimitive<dnnl::reorder>(in_reorder_pd);
     if (scratchpad_md.get_size() < in_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = in_reorder_pd.scratchpad_desc();
     }
@@ -26,6 +26,7 @@
 */
 #pragma once
 
+#include "neural/backends/onednn/blob_cache.h"
 #include "neural/tables/activation_function.h"
 #include "utils/exception.h"
 
@@ -48,6 +49,8 @@ class BaseLayer {
   size_t GetOutputSize(int N) const { return sizeof(float) * N * C * H * W; }
   void SetDataType(dnnl::memory::data_type type) { data_type_ = type; }
   void SetConvolutionType(dnnl::algorithm type) { convolution_type_ = type; }
+  // May be null, then primitives are always compiled.
+  void SetBlobCache(const PrimitiveBlobCache* cache) { blob_cache_ = cache; }
   virtual void Eval(int N, dnnl::memory& output, dnnl::memory& input,
                     dnnl::engine& eng, dnnl::stream& stream) = 0;
 
@@ -59,7 +62,13 @@ class BaseLayer {
   int W;
   dnnl::memory::data_type data_type_;
   dnnl::algorithm convolution_type_;
+  const PrimitiveBlobCache* blob_cache_;
   std::mutex lock_;
+
+  template <typename Primitive, typename PrimitiveDesc>
+  Primitive MakePrimitive(const PrimitiveDesc& pd) {
+    return blob_cache_ ? blob_cache_->Create<Primitive>(pd) : Primitive(pd);
+  }
 };
 
 class ConvLayer : public BaseLayer {
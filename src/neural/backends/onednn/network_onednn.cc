@@ -38,6 +38,7 @@
 #include "neural/tables/attention_policy_map.h"
 #include "neural/tables/policy_map.h"
 #include "utils/bititer.h"
+#include "utils/commandline.h"
 #include "utils/exception.h"
 
 #include <omp.h>
@@ -187,11 +188,26 @@ class OnednnNetwork : public Network {
     }
     eng_stream_ = dnnl::stream(eng_);
 
+    // Compiled primitives are kept across runs, an empty path disables it.
+    const std::string cache_dir = options.GetOrDefault<std::string>(
+        "cache_dir", CommandLine::BinaryDirectory() + "/onednn_cache");
+    if (!cache_dir.empty()) {
+      blob_cache_ = std::make_unique<PrimitiveBlobCache>(cache_dir, eng_);
+    }
+
+    // On cpu the reduced precision type is bf16, which is the default where
+    // it has hardware support (AVX512-BF16 or AMX), as it's faster there.
+    // oneDNN still accumulates in fp32.
+    const bool is_cpu = eng_.get_kind() == dnnl::engine::kind::cpu;
+    const bool has_bf16 = is_cpu && dnnl::get_effective_cpu_isa() >=
+                                        dnnl::cpu_isa::avx512_core_bf16;
     auto data_type = dnnl::memory::data_type::f32;
-    if (options.GetOrDefault<bool>(
-            "fp16", eng_.get_kind() == dnnl::engine::kind::gpu)) {
-      if (eng_.get_kind() == dnnl::engine::kind::cpu) {
+    if (options.GetOrDefault<bool>("fp16", !is_cpu || has_bf16)) {
+      if (is_cpu) {
         data_type = dnnl::memory::data_type::bf16;
+        if (!has_bf16) {
+          CERR << "WARNING: No hardware bf16 support, it will be emulated.";
+        }
       } else {
         data_type = dnnl::memory::data_type::f16;
       }
@@ -252,6 +268,7 @@ class OnednnNetwork : public Network {
         // Set the data type first, the following layers will pick it up.
         inputConv->SetDataType(data_type);
         inputConv->SetConvolutionType(convolution_type);
+        inputConv->SetBlobCache(blob_cache_.get());
         auto w_md = dnnl::memory::desc({numFilters_, kInputPlanes, 3, 3},
                                        dnnl::memory::data_type::f32,
                                        dnnl::memory::format_tag::oihw);
@@ -856,6 +873,8 @@ class OnednnNetwork : public Network {
   bool attn_policy_;
   ActivationFunction default_activation_;
 
+  // Used by the layers, so declared before them.
+  std::unique_ptr<PrimitiveBlobCache> blob_cache_;
   std::vector<std::vector<std::unique_ptr<BaseLayer>>> layers_;
   BaseLayer* getLastLayer(int idx) { return layers_[idx].back().get(); }
 
@@ -348,6 +348,8 @@ void OpenCL::initialize(const int channels, const OpenCLParams& params) {
   }
 
   m_cl_args = cl_args;
+  m_fp16 = params.fp16;
+  if (m_fp16) m_cl_args += " -DUSE_HALF";
 
   auto t = Tuner(*this, params, m_context, m_device);
   auto sgemm_tuners = t.load_sgemm_tuners(
@@ -355,7 +357,7 @@ void OpenCL::initialize(const int channels, const OpenCLParams& params) {
 
   // Build program for these specific devices.
   try {
-    std::string args = cl_args;
+    std::string args = m_cl_args;
     args += sgemm_tuners;
     m_program.build(args.c_str());
   } catch (const cl::Error&) {
@@ -385,8 +387,21 @@ void OpenCL::initialize(const int channels, const OpenCLParams& params) {
 }
 
 std::unique_ptr<OpenCLBuffers> OpenCL_Network::acquire_buffers() const {
-  std::lock_guard<std::mutex> lock(m_pool_mutex);
-  if (m_buffers_pool.empty()) return std::make_unique<OpenCLBuffers>(*this);
+  std::unique_lock<std::mutex> lock(m_pool_mutex);
+  if (m_buffers_pool.empty() && m_buffers_created < m_queue_count) {
+    // The buffers are allocated outside of the lock, the other queues keep
+    // being handed out meanwhile.
+    m_buffers_created++;
+    lock.unlock();
+    try {
+      return std::make_unique<OpenCLBuffers>(*this);
+    } catch (...) {
+      lock.lock();
+      m_buffers_created--;
+      throw;
+    }
+  }
+  m_pool_cv.wait(lock, [&] { return !m_buffers_pool.empty(); });
   auto result = std::move(m_buffers_pool.back());
   m_buffers_pool.pop_back();
   return result;
@@ -394,8 +409,11 @@ std::unique_ptr<OpenCLBuffers> OpenCL_Network::acquire_buffers() const {
 
 void OpenCL_Network::release_buffers(
     std::unique_ptr<OpenCLBuffers> buffers) const {
-  std::lock_guard<std::mutex> lock(m_pool_mutex);
-  m_buffers_pool.push_back(std::move(buffers));
+  {
+    std::lock_guard<std::mutex> lock(m_pool_mutex);
+    m_buffers_pool.push_back(std::move(buffers));
+  }
+  m_pool_cv.notify_one();
 }
 
 std::string OpenCL::get_device_name() {
@@ -408,3 +426,7 @@ std::string OpenCL::get_device_name() {
 
   return ss.str();
 }
+
+std::string OpenCL::get_driver_version() {
+  return m_device.getInfo<CL_DRIVER_VERSION>();
+}
@@ -32,6 +32,7 @@ using net_t = float;
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <cstddef>
 #include <memory>
+#include <condition_variable>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -88,6 +89,10 @@ class OpenCL_Network {
 
   void setMaxMatchSize(size_t new_value) { m_max_batch_size = new_value; }
 
+  size_t getQueueCount() const { return m_queue_count; }
+
+  void setQueueCount(size_t new_value) { m_queue_count = new_value; }
+
   void push_input_convolution(unsigned int filter_size, unsigned int channels,
                               unsigned int outputs,
                               const std::vector<float>& weights,
@@ -225,7 +230,12 @@ class OpenCL_Network {
 
   std::vector<Layer> m_layers;
 
+  // Every set of buffers has its own in-order command queue, so that up to
+  // m_queue_count computations run on the device at the same time.
+  size_t m_queue_count{1};
   mutable std::mutex m_pool_mutex;
+  mutable std::condition_variable m_pool_cv;
+  mutable size_t m_buffers_created{0};
   mutable std::vector<std::unique_ptr<OpenCLBuffers>> m_buffers_pool;
 };
 
@@ -237,6 +247,7 @@ class OpenCL {
  public:
   void initialize(const int channels, const OpenCLParams& params);
   std::string get_device_name();
+  std::string get_driver_version();
 
   std::vector<size_t> get_sgemm_tuners(void);
 
@@ -249,6 +260,7 @@ class OpenCL {
 
   cl::Program m_program;
   std::string m_cl_args;
+  bool m_fp16{false};
 
   struct sgemm_tuners {
     size_t mwg, nwg, kwg;
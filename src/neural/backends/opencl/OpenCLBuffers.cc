@@ -21,8 +21,27 @@
 
 #include "neural/backends/opencl/OpenCLBuffers.h"
 
+#include "utils/fp16_utils.h"
+
+namespace {
+
+// Copies @count activations from a (mapped) device buffer into @out, widening
+// them to float if they are stored as half.
+void CopyOutput(const void* src, size_t count, bool fp16, net_t* out) {
+  if (!fp16) {
+    std::memcpy(out, src, count * sizeof(net_t));
+    return;
+  }
+  const auto* half = static_cast<const uint16_t*>(src);
+  lczero::ConvertFP16toFP32(half, out, count);
+}
+
+}  // namespace
+
 OpenCLBuffers::OpenCLBuffers(const OpenCL_Network& opencl_net)
-    : m_opencl_net(opencl_net), m_opencl(opencl_net.getOpenCL()) {
+    : m_opencl_net(opencl_net),
+      m_opencl(opencl_net.getOpenCL()),
+      m_net_size(m_opencl.m_fp16 ? sizeof(uint16_t) : sizeof(net_t)) {
   auto& program = m_opencl.m_program;
   auto& context = m_opencl.m_context;
   auto& device = m_opencl.m_device;
@@ -55,13 +74,13 @@ OpenCLBuffers::OpenCLBuffers(const OpenCL_Network& opencl_net)
     max_channels =
         std::max(max_channels, std::max(layer.channels, layer.outputs));
     if (layer.is_policy || layer.is_conv_policy) {
-      m_finalSize_pol = layer.ip_out_size * sizeof(net_t);
+      m_finalSize_pol = layer.ip_out_size * m_net_size;
     }
     if (layer.is_value) {
-      m_finalSize_val = layer.ip_out_size * sizeof(net_t);
+      m_finalSize_val = layer.ip_out_size * m_net_size;
     }
     if (layer.is_moves_left) {
-      m_finalSize_mov = layer.ip_out_size * sizeof(net_t);
+      m_finalSize_mov = layer.ip_out_size * m_net_size;
     }
   }
 
@@ -75,11 +94,11 @@ OpenCLBuffers::OpenCLBuffers(const OpenCL_Network& opencl_net)
 
   const auto max_batch_size = m_opencl_net.getMaxMatchSize();
   const auto alloc_inSize =
-      max_batch_size * width * height * max_channels * sizeof(net_t);
+      max_batch_size * width * height * max_channels * m_net_size;
   const auto alloc_vm_size =
-      max_batch_size * WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
+      max_batch_size * WINOGRAD_TILE * m_ceil * n_ceil * sizeof(float);
   const auto alloc_pool_size =
-      max_batch_size * 2 * max_channels * sizeof(net_t);
+      max_batch_size * 2 * max_channels * m_net_size;
 
   auto v_zeros = std::vector<float>(alloc_vm_size);
 
@@ -137,9 +156,15 @@ void OpenCLBuffers::forward(const std::vector<net_t>& input,
                             const int batch_size) {
   auto& layers = m_opencl_net.m_layers;
 
-  const auto inSize = sizeof(net_t) * input.size();
-  m_commandqueue.enqueueWriteBuffer(m_inBuffer, CL_FALSE, 0, inSize,
-                                    input.data());
+  const void* in_data = input.data();
+  if (m_opencl.m_fp16) {
+    m_half_input.resize(input.size());
+    lczero::ConvertFP32toFP16(input.data(), m_half_input.data(),
+                              input.size());
+    in_data = m_half_input.data();
+  }
+  const auto inSize = m_net_size * input.size();
+  m_commandqueue.enqueueWriteBuffer(m_inBuffer, CL_FALSE, 0, inSize, in_data);
 
   auto skip_in_trans = false;
   for (auto iter = cbegin(layers); iter != cend(layers); iter++) {
@@ -307,13 +332,15 @@ void OpenCLBuffers::forward(const std::vector<net_t>& input,
 
   m_commandqueue.finish();
 
-  std::memcpy(output_pol.data(), pinnedOutBufferHost_pol,
-              batch_size * m_finalSize_pol);
-  std::memcpy(output_val.data(), pinnedOutBufferHost_val,
-              batch_size * m_finalSize_val);
+  const auto fp16 = m_opencl.m_fp16;
+  CopyOutput(pinnedOutBufferHost_pol, batch_size * m_finalSize_pol / m_net_size,
+             fp16, output_pol.data());
+  CopyOutput(pinnedOutBufferHost_val, batch_size * m_finalSize_val / m_net_size,
+             fp16, output_val.data());
   if (m_finalSize_mov > 0) {
-    std::memcpy(output_mov.data(), pinnedOutBufferHost_mov,
-                batch_size * m_finalSize_mov);
+    CopyOutput(pinnedOutBufferHost_mov,
+               batch_size * m_finalSize_mov / m_net_size, fp16,
+               output_mov.data());
   }
 
   m_commandqueue.enqueueUnmapMemObject(m_pinnedOutBuffer_pol,
@@ -517,7 +544,7 @@ void OpenCLBuffers::convolve1(int channels, int outputs,
 
 #ifndef NDEBUG
   // Total output size after reducing.
-  size_t outSize = width * height * outputs * sizeof(net_t);
+  size_t outSize = width * height * outputs * m_net_size;
 
   // Produce channel * output planes and merge them at the end.
   size_t mergeSize = (channels >> channelShift) * outSize;
@@ -25,6 +25,7 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
@@ -82,6 +83,8 @@ class OpenCLBuffers {
 
   const OpenCL_Network& m_opencl_net;
   const OpenCL& m_opencl;
+  // Size of a stored activation, 2 when they are kept in half precision.
+  const size_t m_net_size;
 
   cl::CommandQueue m_commandqueue;
   cl::Kernel m_convolve1_kernel;
@@ -105,4 +108,5 @@ class OpenCLBuffers {
   size_t m_finalSize_pol;
   size_t m_finalSize_val;
   size_t m_finalSize_mov;
+  std::vector<uint16_t> m_half_input;
 };
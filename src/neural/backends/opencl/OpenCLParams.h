@@ -27,6 +27,11 @@ struct OpenCLParams {
   bool tune_only = false;
   bool force_tune = false;
   bool tune_exhaustive = false;
+  bool tune_halving = true;
   int tune_batch_size = 1;
   std::string tuner_file;
+  // Read-only tuner database consulted before tuner_file.
+  std::string shared_tuner_file;
+  // Store activations in half precision.
+  bool fp16 = false;
 };
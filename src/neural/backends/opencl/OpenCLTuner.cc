@@ -21,6 +21,7 @@
 
 #include "neural/backends/opencl/OpenCLTuner.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
@@ -60,6 +61,19 @@ static void sgemmBatched_ref(const std::vector<float>& a,
   }
 }
 
+namespace {
+// A configuration being tuned, with its compiled kernel.
+struct Candidate {
+  TuneParameters params;
+  std::string defines;
+  cl::Program program;
+  cl::Kernel kernel;
+  // Total time of all runs so far, in nanoseconds.
+  double time = 0.0;
+  int runs = 0;
+};
+}  // namespace
+
 static bool IsMultiple(const size_t a, const size_t b) { return (a % b == 0); }
 
 bool Tuner::valid_config_sgemm(TuneParameters p, bool exhaustive) {
@@ -254,34 +268,29 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
 
   CERR << "Will try " << valid_params.size() << " valid configurations.";
 
-  std::string best_params;
-  auto best_time = unsigned{0};
-
   auto queue = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE);
-  auto event = cl::Event();
-  auto program = cl::Program(m_context, sourceCode_sgemm);
 
   auto m_ceil_prev = 0;
   auto n_ceil_prev = 0;
   auto k_ceil_prev = 0;
-  auto param_counter = size_t{0};
-
-  for (const auto& i : valid_params) {
-    param_counter++;
-
-    auto p = get_parameters_by_int(opts, i);
-    auto defines = parameters_to_defines(p);
 
+  // Compiles the kernel of a configuration, returns false if that fails.
+  auto build = [&](Candidate& candidate) {
     try {
-      auto args = m_opencl.m_cl_args + " " + defines;
-      program.build(args.c_str());
+      candidate.program = cl::Program(m_context, sourceCode_sgemm);
+      auto args = m_opencl.m_cl_args + " " + candidate.defines;
+      candidate.program.build(args.c_str());
+      candidate.kernel = cl::Kernel(candidate.program, "XgemmBatched");
     } catch (const cl::Error&) {
-      // Failed to compile, get next parameter.
-      continue;
+      return false;
     }
+    return true;
+  };
 
-    auto sgemm_kernel = cl::Kernel(program, "XgemmBatched");
-
+  // Times @count more runs of a candidate, returns false if the kernel fails
+  // or gives wrong results.
+  auto measure = [&](Candidate& candidate, const int count) {
+    auto& p = candidate.params;
     auto m_ceil = (int)ceilMultiple(ceilMultiple(m, p["MWG"]), p["VWM"]);
     auto n_ceil = (int)ceilMultiple(ceilMultiple(n, p["NWG"]), p["VWN"]);
     auto k_ceil = (int)ceilMultiple(ceilMultiple(k, p["KWG"]), p["VWM"]);
@@ -302,6 +311,7 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
       queue.finish();
     }
 
+    auto& sgemm_kernel = candidate.kernel;
     sgemm_kernel.setArg(0, m_ceil);
     sgemm_kernel.setArg(1, n_ceil);
     sgemm_kernel.setArg(2, k_ceil);
@@ -315,9 +325,8 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
                               (n_ceil * p["NDIMC"]) / p["NWG"],
                               (size_t)batch_size};
 
-    auto sum = 0.0f;
-    auto max_error = 0.0f;
-    for (auto r = 0; r < runs; r++) {
+    auto event = cl::Event();
+    for (auto r = 0; r < count; r++) {
       try {
         queue.enqueueNDRangeKernel(sgemm_kernel, cl::NullRange, size_sgemm,
                                    local_sgemm, nullptr, &event);
@@ -330,32 +339,88 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
 
         auto this_error =
             compare_ref(c, c_ref, n, m, batch_size, n_ceil, m_ceil);
-        max_error = std::max(max_error, this_error);
+        if (this_error >= MAX_ERROR) return false;
 
         auto elapsed = event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
                        event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
 
-        sum += elapsed;
+        candidate.time += elapsed;
+        candidate.runs++;
       } catch (const cl::Error&) {
-        // Failed to enqueue kernel. Set error to max.
-        max_error = MAX_ERROR;
-        break;
+        // Failed to enqueue kernel.
+        return false;
+      }
+    }
+    return true;
+  };
+
+  auto report = [&](const Candidate& candidate, const std::string& prefix) {
+    auto mean = candidate.time / candidate.runs;
+    auto kernel_us = 1e-3f * mean;
+    // Timing is in nanoseconds (10^-9), Giga = 10^9, so this works out.
+    auto kernel_gflops = total_flops / mean;
+    CERR << std::fixed << std::setprecision(1) << prefix
+         << parameters_to_string(candidate.params) << " " << kernel_us
+         << " us (" << kernel_gflops << " GFLOPS)";
+  };
+
+  std::string best_params;
+  if (m_params.tune_halving) {
+    // Successive halving: every configuration gets a single run, then the
+    // faster half is kept and timed with twice as many runs, until one is
+    // left. Most of the time is spent on the promising configurations.
+    std::vector<Candidate> candidates;
+    for (const auto& i : valid_params) {
+      Candidate candidate;
+      candidate.params = get_parameters_by_int(opts, i);
+      candidate.defines = parameters_to_defines(candidate.params);
+      if (!build(candidate) || !measure(candidate, 1)) continue;
+      candidates.push_back(std::move(candidate));
+    }
+    auto round_runs = 1;
+    while (candidates.size() > 1) {
+      std::sort(candidates.begin(), candidates.end(),
+                [](const Candidate& a, const Candidate& b) {
+                  return a.time / a.runs < b.time / b.runs;
+                });
+      candidates.resize((candidates.size() + 1) / 2);
+      round_runs = std::min(round_runs * 2, std::max(runs, 1) * 4);
+      std::vector<Candidate> survivors;
+      for (auto& candidate : candidates) {
+        if (measure(candidate, round_runs)) {
+          survivors.push_back(std::move(candidate));
+        }
+      }
+      candidates = std::move(survivors);
+      if (!candidates.empty()) {
+        report(candidates.front(),
+               "(" + std::to_string(candidates.size()) + " left) ");
       }
     }
-    if (max_error < MAX_ERROR && (best_time == 0 || sum < best_time)) {
-      auto param_str = parameters_to_string(p);
-      auto kernel_us = 1e-3f * (sum / runs);
-      // Timing is in nanoseconds (10^-9), Giga = 10^9, so this works out.
-      auto kernel_gflops = total_flops / (sum / runs);
-      CERR << std::fixed << std::setprecision(1) << "(" << param_counter << "/"
-           << valid_params.size() << ") " << param_str << " " << kernel_us
-           << " us (" << kernel_gflops << " GFLOPS)";
-
-      best_time = sum;
-      best_params = defines;
+    if (!candidates.empty()) {
+      report(candidates.front(), "Best: ");
+      best_params = candidates.front().defines;
+    }
+  } else {
+    auto best_time = 0.0;
+    auto param_counter = size_t{0};
+    for (const auto& i : valid_params) {
+      param_counter++;
+
+      Candidate candidate;
+      candidate.params = get_parameters_by_int(opts, i);
+      candidate.defines = parameters_to_defines(candidate.params);
+      if (!build(candidate) || !measure(candidate, runs)) continue;
+
+      if (best_time == 0 || candidate.time < best_time) {
+        report(candidate, "(" + std::to_string(param_counter) + "/" +
+                              std::to_string(valid_params.size()) + ") ");
+        best_time = candidate.time;
+        best_params = candidate.defines;
+      }
     }
   }
-  if (best_time == 0) {
+  if (best_params.empty()) {
     CERR << "Failed to find a working configuration." << std::endl
          << "Check your OpenCL drivers.";
     throw std::runtime_error("Tuner failed to find working configuration.");
@@ -382,14 +447,16 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
   auto tuning_params = std::stringstream{};
   tuning_params << m << ";" << n << ";" << k << ";" << batch_size;
 
-  auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";XgemmBatched;" +
-                            tuning_params.str() + ";";
-  auto tuning_line = tuning_line_prefix + tuners + ";" + device_name;
+  // Lines of the older version for this device are dropped too.
+  auto tuning_line_suffix = ";XgemmBatched;" + tuning_params.str() + ";";
+  auto tuning_line = std::to_string(TUNER_VERSION) + tuning_line_suffix +
+                     tuners + ";" + device_name + ";" +
+                     m_opencl.get_driver_version();
 
   // Write back previous data as long as it's not the device and
   // tuning we just tuned.
   for (const auto& line : file_contents) {
-    if (line.find(tuning_line_prefix) == std::string::npos ||
+    if (line.find(tuning_line_suffix) == std::string::npos ||
         line.find(device_name) == std::string::npos) {
       file << line << std::endl;
     }
@@ -415,7 +482,13 @@ std::string Tuner::sgemm_tuners_from_line(std::string line, const int m,
     s.emplace_back(item);
   }
 
-  if (s.size() != 8) {
+  // Version 0 lines lack the driver version.
+  if (s.size() == 8 && s[0] == "0") {
+    s[0] = std::to_string(TUNER_VERSION);
+    s.push_back(m_opencl.get_driver_version());
+  }
+
+  if (s.size() != 9) {
     return "";
   }
 
@@ -447,14 +520,22 @@ std::string Tuner::sgemm_tuners_from_line(std::string line, const int m,
     return "";
   }
 
+  if (s[8] != m_opencl.get_driver_version()) {
+    return "";
+  }
+
   return s[6];
 }
 
 std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
                                      const int batch_size) {
   if (!m_params.force_tune) {
-    auto file = std::ifstream{m_params.tuner_file};
-    if (file.good()) {
+    // The shared database takes precedence over the local file.
+    for (const auto& filename :
+         {m_params.shared_tuner_file, m_params.tuner_file}) {
+      if (filename.empty()) continue;
+      auto file = std::ifstream{filename};
+      if (!file.good()) continue;
       auto line = std::string{};
       while (std::getline(file, line)) {
         auto tuners = sgemm_tuners_from_line(line, m, n, k, batch_size);
@@ -464,7 +545,7 @@ std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
           // Convolution batch size affects the "n" dimension of
           // the matrix multiplication (n = WINOGRAD_P * batch_size).
           CERR << "Loaded existing SGEMM tuning for batch size "
-               << n / WINOGRAD_P << ".";
+               << n / WINOGRAD_P << " from " << filename << ".";
           return tuners;
         }
       }
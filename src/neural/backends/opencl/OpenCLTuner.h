@@ -46,7 +46,10 @@ class Tuner {
   std::string load_sgemm_tuners(const int m, const int n, const int k,
                                 const int batch_size);
 
-  static constexpr auto TUNER_VERSION = 0;
+  // Lines in the tuner file are
+  // version;XgemmBatched;m;n;k;batch_size;tuners;device name;driver version
+  // so that a file can be shared between machines with identical devices.
+  static constexpr auto TUNER_VERSION = 1;
   Tuner(OpenCL& opencl, const OpenCLParams& params, cl::Context context,
         cl::Device device)
       : m_opencl(opencl),
@@ -72,12 +72,11 @@ class OpenCLComputation : public NetworkComputation {
         q_values_(),
         m_values_(),
         wdl_(wdl),
-        moves_left_(moves_left) {
-    buffers_ = opencl_net.acquire_buffers();
-  }
+        moves_left_(moves_left) {}
 
   virtual ~OpenCLComputation() {
-    opencl_net_.release_buffers(std::move(buffers_));
+    // Still held if the computation failed.
+    if (buffers_) opencl_net_.release_buffers(std::move(buffers_));
   }
 
   // Adds a sample to the batch.
@@ -104,6 +103,9 @@ class OpenCLComputation : public NetworkComputation {
     std::vector<float> output_mov(largest_batch_size * num_moves_channels);
     std::vector<float> input_data(largest_batch_size * kInputPlanes * kSquares);
 
+    // The buffers with their command queue are only held while the batch is
+    // computed, not while the inputs are gathered.
+    buffers_ = opencl_net_.acquire_buffers();
     for (size_t i = 0; i < plane_count; i += largest_batch_size) {
       const auto batch_size = std::min(plane_count - i, largest_batch_size);
       for (size_t j = 0; j < batch_size; j++) {
@@ -160,6 +162,7 @@ class OpenCLComputation : public NetworkComputation {
         }
       }
     }
+    opencl_net_.release_buffers(std::move(buffers_));
   }
 
   // Returns how many times AddInput() was called.
@@ -247,6 +250,10 @@ class OpenCLNetwork : public Network {
     params_.tune_only = options.GetOrDefault<bool>("tune_only", false);
     params_.tune_exhaustive =
         options.GetOrDefault<bool>("tune_exhaustive", false);
+    params_.tune_halving = options.GetOrDefault<bool>("tune_halving", true);
+    params_.shared_tuner_file =
+        options.GetOrDefault<std::string>("shared_tuner_file", "");
+    params_.fp16 = options.GetOrDefault<bool>("fp16", false);
     if (options.Exists<std::string>("tuner_file")) {
       params_.tuner_file = options.Get<std::string>("tuner_file");
     } else {
@@ -404,6 +411,10 @@ class OpenCLNetwork : public Network {
     }
 
     opencl_net_.setMaxMatchSize(max_batch_size_);
+    opencl_net_.setQueueCount(
+        std::max(options.GetOrDefault<int>("queues", kDefaultQueues), 1));
+    CERR << "OpenCL, using " << opencl_net_.getQueueCount()
+         << " command queues.";
   }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
@@ -415,8 +426,15 @@ class OpenCLNetwork : public Network {
     return capabilities_;
   }
 
+  // One search thread per command queue keeps them all busy.
+  int GetThreads() const override {
+    return static_cast<int>(opencl_net_.getQueueCount());
+  }
+
  private:
   static constexpr auto kHardMaxBatchSize = 32;
+  // Two batches in flight are enough to hide the host side work between them.
+  static constexpr auto kDefaultQueues = 2;
   static constexpr auto kPolicyUsedPlanes = 73;
   static constexpr auto kPolicyOutputs = 1858;
 
@@ -22,6 +22,7 @@
 #include <cmath>
 
 #include "utils/exception.h"
+#include "utils/fastmath.h"
 
 #ifdef USE_ISPC
 #include "activation_ispc.h"
@@ -32,6 +33,33 @@ namespace {
 constexpr int kWidth = 8;
 constexpr int kHeight = 8;
 constexpr int kSquares = kWidth * kHeight;
+
+// Computes relu(gamma * data + bias + beta), squared for relu_2, with the
+// vector types of fastmath.h when ISPC is not available.
+template <bool kSquare>
+void ActivateRelu(const size_t len, float gamma, const float* data,
+                  const float* bias, float beta, float* output) {
+  size_t b = 0;
+#ifndef LCZERO_SCALAR_SOFTMAX
+  using Ops = fastmath_internal::VecOps;
+  const Ops::V vgamma = Ops::Set1(gamma);
+  const Ops::V vbeta = Ops::Set1(beta);
+  const Ops::V zero = Ops::Set1(0.0f);
+  for (; b + Ops::kWidth <= len; b += Ops::kWidth) {
+    Ops::V val = Ops::Add(
+        Ops::Add(Ops::Mul(vgamma, Ops::Load(data + b)), Ops::Load(bias + b)),
+        vbeta);
+    val = Ops::Max(val, zero);
+    if (kSquare) val = Ops::Mul(val, val);
+    Ops::Store(output + b, val);
+  }
+#endif
+  for (; b < len; b++) {
+    float val = gamma * data[b] + bias[b] + beta;
+    val = val > 0 ? val : 0;
+    output[b] = kSquare ? val * val : val;
+  }
+}
 }  // namespace
 
 void SoftmaxActivation(const size_t size, const float* input, float* output) {
@@ -101,10 +129,7 @@ void Activate(const size_t len, const float* data, const float* bias,
     }
   } else if (activation == ACTIVATION_RELU) {
 #ifndef USE_ISPC
-    for (size_t b = 0; b < len; b++) {
-      float val = data[b] + bias[b];
-      output[b] = val > 0 ? val : 0;
-    }
+    ActivateRelu<false>(len, 1.0f, data, bias, 0.0f, output);
 #else
     ispc::ActivateRelu(len, 1.0f, data, bias, 0.0f, output);
 #endif
@@ -119,10 +144,7 @@ void Activate(const size_t len, const float* data, const float* bias,
 #endif
   } else if (activation == ACTIVATION_RELU_2) {
 #ifndef USE_ISPC
-    for (size_t b = 0; b < len; b++) {
-      float val = data[b] + bias[b];
-      output[b] = val > 0 ? val * val : 0;
-    }
+    ActivateRelu<true>(len, 1.0f, data, bias, 0.0f, output);
 #else
     ispc::ActivateRelu_2(len, data, bias, output);
 #endif
@@ -163,10 +185,7 @@ void Activate(const size_t len, float gamma, const float* data,
     }
   } else if (activation == ACTIVATION_RELU) {
 #ifndef USE_ISPC
-    for (size_t b = 0; b < len; b++) {
-      float val = gamma * data[b] + bias[b] + beta;
-      output[b] = val > 0 ? val : 0;
-    }
+    ActivateRelu<false>(len, gamma, data, bias, beta, output);
 #else
     ispc::ActivateRelu(len, gamma, data, bias, beta, output);
 #endif
@@ -202,10 +221,7 @@ void BiasResidual(const size_t batch_size, const size_t channels, float* data,
         }
       } else if (activation == ACTIVATION_RELU) {
 #ifndef USE_ISPC
-        for (size_t b = 0; b < kSquares; b++) {
-          float val = res[b] + arr[b] + bias;
-          arr[b] = val > 0 ? val : 0;
-        }
+        ActivateRelu<false>(kSquares, 1.0f, res, arr, bias, arr);
 #else
         ispc::ActivateRelu(kSquares, 1.0f, res, arr, bias, arr);
 #endif
@@ -0,0 +1,194 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/backends/shared/weights_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "utils/exception.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+// Cache file layout, all numbers in native byte order:
+//   header: magic, version, key, number of blobs;
+//   blob: name size, data size, name, padding, data.
+// Blob data is aligned to kAlignment bytes from the start of the file.
+constexpr uint32_t kCacheMagic = 0x4243574c;  // "LWCB"
+constexpr uint32_t kCacheVersion = 1;
+constexpr size_t kAlignment = 64;
+
+template <typename T>
+T Load(const uint8_t*& in, const uint8_t* end) {
+  if (static_cast<size_t>(end - in) < sizeof(T)) {
+    throw Exception("Truncated weights cache file");
+  }
+  T value;
+  std::memcpy(&value, in, sizeof(T));
+  in += sizeof(T);
+  return value;
+}
+
+}  // namespace
+
+WeightsCache::WeightsCache(const std::string& directory,
+                           std::string_view backend)
+    : directory_(directory),
+      backend_(backend),
+      key_(HashCat(kCacheVersion, std::hash<std::string_view>{}(backend))) {}
+
+WeightsCache::~WeightsCache() = default;
+
+void WeightsCache::AddToKey(uint64_t value) {
+  if (opened_) throw Exception("Weights cache key can't change after Get()");
+  key_ = HashCat(key_, value);
+}
+
+void WeightsCache::AddToKey(std::string_view value) {
+  if (!enabled()) return;
+  AddToKey(std::hash<std::string_view>{}(value));
+  AddToKey(value.size());
+}
+
+std::string WeightsCache::GetFilename() const {
+  std::ostringstream name;
+  name << directory_ << "/" << backend_ << "-" << std::hex
+       << std::setfill('0') << std::setw(16) << key_ << ".bin";
+  return name.str();
+}
+
+void WeightsCache::Open() {
+  opened_ = true;
+  const std::string filename = GetFilename();
+  if (GetFileSize(filename) == 0) return;
+  try {
+    auto file = std::make_unique<MappedFile>(filename);
+    const uint8_t* const begin = file->data().data();
+    const uint8_t* const end = begin + file->data().size();
+    const uint8_t* in = begin;
+    if (Load<uint32_t>(in, end) != kCacheMagic ||
+        Load<uint32_t>(in, end) != kCacheVersion ||
+        Load<uint64_t>(in, end) != key_) {
+      throw Exception("Weights cache file doesn't match");
+    }
+    const uint64_t num_blobs = Load<uint64_t>(in, end);
+    for (uint64_t i = 0; i < num_blobs; ++i) {
+      const size_t name_size = Load<uint32_t>(in, end);
+      const size_t size = Load<uint64_t>(in, end);
+      if (static_cast<size_t>(end - in) < name_size) {
+        throw Exception("Truncated weights cache file");
+      }
+      std::string name(reinterpret_cast<const char*>(in), name_size);
+      in += name_size;
+      in = begin + (in - begin + kAlignment - 1) / kAlignment * kAlignment;
+      if (in > end || static_cast<size_t>(end - in) < size) {
+        throw Exception("Truncated weights cache file");
+      }
+      blobs_.emplace(std::move(name), std::span<const uint8_t>(in, size));
+      in += size;
+    }
+    file_ = std::move(file);
+    CERR << "Using cached " << backend_ << " weights from " << filename << ".";
+  } catch (const Exception& e) {
+    CERR << "Ignoring weights cache " << filename << ": " << e.what();
+    blobs_.clear();
+  }
+}
+
+std::optional<std::span<const uint8_t>> WeightsCache::Get(
+    std::string_view name) {
+  if (!enabled()) return std::nullopt;
+  if (!opened_) Open();
+  const auto iter = blobs_.find(name);
+  if (iter == blobs_.end()) return std::nullopt;
+  return iter->second;
+}
+
+void WeightsCache::Put(std::string_view name, std::span<const uint8_t> blob) {
+  if (!enabled()) return;
+  if (!opened_) Open();
+  if (blobs_.count(name)) return;
+  dirty_ = true;
+  new_blobs_.emplace(std::string(name),
+                     std::vector<uint8_t>(blob.begin(), blob.end()));
+}
+
+void WeightsCache::Save() {
+  if (!dirty_) return;
+  dirty_ = false;
+  // Blobs found in the cache are written again, so that the file is complete.
+  std::vector<std::pair<std::string_view, std::span<const uint8_t>>> blobs(
+      blobs_.begin(), blobs_.end());
+  for (const auto& [name, data] : new_blobs_) blobs.emplace_back(name, data);
+
+  const std::string filename = GetFilename();
+  const std::string tmp_filename = filename + ".tmp";
+  try {
+    CreateDirectory(directory_);
+    std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!out) throw Exception("Cannot write " + tmp_filename);
+    auto write = [&out](auto x) {
+      out.write(reinterpret_cast<const char*>(&x), sizeof(x));
+    };
+    write(kCacheMagic);
+    write(kCacheVersion);
+    write(key_);
+    write(static_cast<uint64_t>(blobs.size()));
+    for (const auto& [name, data] : blobs) {
+      write(static_cast<uint32_t>(name.size()));
+      write(static_cast<uint64_t>(data.size()));
+      out.write(name.data(), name.size());
+      const size_t padding =
+          (kAlignment - static_cast<size_t>(out.tellp()) % kAlignment) %
+          kAlignment;
+      out.write(std::string(padding, '\0').data(), padding);
+      out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    out.close();
+    if (!out) throw Exception("Cannot write " + tmp_filename);
+    // Other processes may be reading the old file, so it's replaced at once.
+    file_.reset();
+    blobs_.clear();
+    std::remove(filename.c_str());
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      throw Exception("Cannot rename " + tmp_filename);
+    }
+    CERR << "Saved converted " << backend_ << " weights to " << filename
+         << ".";
+  } catch (const Exception& e) {
+    CERR << "Unable to save weights cache: " << e.what();
+  }
+  new_blobs_.clear();
+}
+
+}  // namespace lczero
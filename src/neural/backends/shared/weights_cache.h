@@ -0,0 +1,117 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils/filesystem.h"
+
+namespace lczero {
+
+// Optional on-disk cache of weights already converted to the backend layout
+// (transformed, quantized, converted to fp16 etc.), so that the conversion
+// can be skipped on the next start.
+//
+// The cache file is keyed by everything that is added with AddToKey(): the
+// source weights of the converted blobs and the settings that affect the
+// conversion. All of that has to be added before the first Get(). Cached
+// blobs are memory mapped and can be copied to the device as they are.
+//
+// Typical use:
+//   WeightsCache cache(options.GetOrDefault<std::string>("weights_cache", ""),
+//                      "backend");
+//   cache.AddToKey(source_weights);
+//   if (!cache.Get("layer", &converted)) {
+//     converted = Convert(source_weights);
+//     cache.Put("layer", converted);
+//   }
+//   cache.Save();
+class WeightsCache {
+ public:
+  // The cache is disabled if @directory is empty.
+  WeightsCache(const std::string& directory, std::string_view backend);
+  ~WeightsCache();
+
+  bool enabled() const { return !directory_.empty(); }
+
+  void AddToKey(uint64_t value);
+  void AddToKey(std::string_view value);
+  template <typename T>
+  void AddToKey(const std::vector<T>& data) {
+    AddToKey(std::string_view(reinterpret_cast<const char*>(data.data()),
+                              data.size() * sizeof(T)));
+  }
+
+  // Returns the blob stored under @name, or std::nullopt if it's not cached.
+  std::optional<std::span<const uint8_t>> Get(std::string_view name);
+  template <typename T>
+  bool Get(std::string_view name, std::vector<T>* out) {
+    const auto blob = Get(name);
+    if (!blob || blob->size() % sizeof(T) != 0) return false;
+    out->resize(blob->size() / sizeof(T));
+    std::memcpy(out->data(), blob->data(), blob->size());
+    return true;
+  }
+
+  // Stores the blob to be saved into the cache. Only does anything if the
+  // blob has not been found in the cache.
+  void Put(std::string_view name, std::span<const uint8_t> blob);
+  template <typename T>
+  void Put(std::string_view name, const std::vector<T>& data) {
+    Put(name, std::span<const uint8_t>(
+                  reinterpret_cast<const uint8_t*>(data.data()),
+                  data.size() * sizeof(T)));
+  }
+
+  // Writes the cache file if any of the blobs were missing from it.
+  void Save();
+
+ private:
+  std::string GetFilename() const;
+  void Open();
+
+  const std::string directory_;
+  const std::string backend_;
+  uint64_t key_;
+  bool opened_ = false;
+  bool dirty_ = false;
+  std::unique_ptr<MappedFile> file_;
+  std::map<std::string, std::span<const uint8_t>, std::less<>> blobs_;
+  std::map<std::string, std::vector<uint8_t>, std::less<>> new_blobs_;
+};
+
+}  // namespace lczero
@@ -29,21 +29,42 @@ namespace sycldnn_backend {
 struct InputsOutputs {
   InputsOutputs(int maxBatchSize, bool wdl, bool moves_left, sycl::queue& m_ct1,
                 size_t tensor_mem_size = 0, size_t scratch_size = 0,
-                bool cublasDisableTensorCores = false): q_ct1(m_ct1) {
+                bool cublasDisableTensorCores = false,
+                bool shared_memory = false)
+      // With multi_stream every InputsOutputs gets its own in-order queue in
+      // the context of the main one, so independent evals overlap.
+      : q_ct1(tensor_mem_size
+                  ? sycl::queue(m_ct1.get_context(), m_ct1.get_device(),
+                                sycl::property_list{
+                                    sycl::property::queue::in_order{}})
+                  : m_ct1) {
   #ifdef USE_CUBLAS
     cublasHandle_t h= cuBlasContextManager::getcuBlasHandle_t();
   #endif                
-    input_masks_mem_shared_ = malloc_host<uint64_t>(maxBatchSize * kInputPlanes, q_ct1);
-    input_val_mem_shared_ = malloc_host<float>(maxBatchSize * kInputPlanes, q_ct1);
-    // Seperate device memory copy for policy output.
-    // It's faster to write to device memory and then copy to host memory
-    // than having the kernel write directly to it.
-    op_policy_mem_ = malloc_host<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
-    op_policy_mem_gpu_ = malloc_device<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
-    op_value_mem_shared_ = malloc_host<float>(maxBatchSize * (wdl ? 3 : 1), q_ct1);
-
-    if (moves_left) {
-      op_moves_left_mem_shared_ = malloc_host<float>(maxBatchSize, q_ct1);
+    if (shared_memory) {
+      // The device shares memory with the host, so kernels read inputs and
+      // write outputs in place and no copies are needed.
+      input_masks_mem_shared_ = malloc_shared<uint64_t>(maxBatchSize * kInputPlanes, q_ct1);
+      input_val_mem_shared_ = malloc_shared<float>(maxBatchSize * kInputPlanes, q_ct1);
+      op_policy_mem_ = malloc_shared<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
+      op_policy_mem_gpu_ = op_policy_mem_;
+      op_value_mem_shared_ = malloc_shared<float>(maxBatchSize * (wdl ? 3 : 1), q_ct1);
+      if (moves_left) {
+        op_moves_left_mem_shared_ = malloc_shared<float>(maxBatchSize, q_ct1);
+      }
+    } else {
+      input_masks_mem_shared_ = malloc_host<uint64_t>(maxBatchSize * kInputPlanes, q_ct1);
+      input_val_mem_shared_ = malloc_host<float>(maxBatchSize * kInputPlanes, q_ct1);
+      // Seperate device memory copy for policy output.
+      // It's faster to write to device memory and then copy to host memory
+      // than having the kernel write directly to it.
+      op_policy_mem_ = malloc_host<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
+      op_policy_mem_gpu_ = malloc_device<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
+      op_value_mem_shared_ = malloc_host<float>(maxBatchSize * (wdl ? 3 : 1), q_ct1);
+
+      if (moves_left) {
+        op_moves_left_mem_shared_ = malloc_host<float>(maxBatchSize, q_ct1);
+      }
     }
 
     // memory for network execution managed inside this structure
@@ -96,7 +117,7 @@ struct InputsOutputs {
   //float* op_value_mem_gpu_;
   //float* op_moves_left_mem_gpu_;
 
-  // This is a seperate copy.
+  // This is a seperate copy, unless the device shares memory with the host.
   float* op_policy_mem_gpu_;
   float* op_policy_mem_;
 
@@ -108,8 +129,8 @@ struct InputsOutputs {
   void** offset_pointers_ = nullptr;
   void** head_offset_pointers_ = nullptr;
 
-  // cuda stream used to run the network
-  sycl::queue& q_ct1;
+  // Queue used to run the network.
+  sycl::queue q_ct1;
 };
 
 }  // namespace sycldnn_backend
@@ -234,6 +234,15 @@ class SyclNetwork : public Network {
     // Select GPU to run on (for *the current* thread).
     multi_stream_ = options.GetOrDefault<bool>("multi_stream", false);
 
+    // Integrated GPUs share memory with the host, and staging inputs and
+    // outputs through device memory is pure overhead there.
+    const sycl::device device = sycl_queue_->get_device();
+    shared_memory_ =
+        device.has(sycl::aspect::usm_shared_allocations) &&
+        device.get_info<sycl::info::device::host_unified_memory>() &&
+        options.GetOrDefault<bool>("shared_memory", true);
+    if (shared_memory_) CERR << "Using shared memory for inputs and outputs.";
+
     // layout used by cuda backend is nchw.
     has_tensor_cores_ = false;
     constexpr bool fp16 = std::is_same<sycl::half, DataType>::value;
@@ -811,8 +820,10 @@ class SyclNetwork : public Network {
 
     // Copy policy output from device memory to host memory.
 
-    io_sycl_queue_.memcpy(io->op_policy_mem_, io->op_policy_mem_gpu_, sizeof(float) * kNumOutputPolicy * batchSize);
-    io_sycl_queue_.wait();
+    if (io->op_policy_mem_ != io->op_policy_mem_gpu_) {
+      io_sycl_queue_.memcpy(io->op_policy_mem_, io->op_policy_mem_gpu_, sizeof(float) * kNumOutputPolicy * batchSize);
+      io_sycl_queue_.wait();
+    }
 
 
     // value head
@@ -933,7 +944,8 @@ class SyclNetwork : public Network {
     if (free_inputs_outputs_.empty()) {
       return std::make_unique<InputsOutputs>(
           max_batch_size_, wdl_, moves_left_, *sycl_queue_, tensor_mem_size_, scratch_size_,
-          !has_tensor_cores_ && std::is_same<sycl::half, DataType>::value);
+          !has_tensor_cores_ && std::is_same<sycl::half, DataType>::value,
+          shared_memory_);
     } else {
       std::unique_ptr<InputsOutputs> resource =
           std::move(free_inputs_outputs_.front());
@@ -958,6 +970,7 @@ class SyclNetwork : public Network {
   bool use_res_block_winograd_fuse_opt_;  // fuse operations inside the residual
                                           // tower
   bool multi_stream_;                     // run multiple parallel network evals
+  bool shared_memory_;  // device shares memory with the host, use shared USM
   bool allow_cache_opt_;  // try to fit residual block activations in L2 cache
 
   // Currently only one NN Eval can happen a time (we can fix this if needed
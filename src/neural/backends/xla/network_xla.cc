@@ -25,6 +25,7 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
 #include <cassert>
 
 #include "neural/backends/xla/xla_runner.h"
@@ -33,6 +34,8 @@
 #include "neural/onnx/converter.h"
 #include "neural/xla/onnx2hlo.h"
 #include "utils/bititer.h"
+#include "utils/commandline.h"
+#include "utils/string.h"
 
 namespace lczero {
 namespace {
@@ -177,11 +180,12 @@ XlaNetwork::XlaNetwork(std::unique_ptr<XlaRunner> runner,
       capabilities_{format.input(), format.output(), format.moves_left()} {}
 
 // Converts ONNX model to HLO (for various batch sizes) and adds them to the
-// XlaRunner.
+// XlaRunner. The batch sizes are split between the devices of the runner.
 XlaNetworkOptions FillXlaRunnerFromOnnx(
     const pblczero::OnnxModel& onnx_model, XlaRunner* runner,
     size_t max_batch_size, size_t steps,
-    std::optional<pblczero::XlaShapeProto::Type> io_type) {
+    std::optional<pblczero::XlaShapeProto::Type> io_type, bool hlo_passes,
+    std::optional<pblczero::XlaShapeProto::Type> fp8_matmul_type) {
   pblczero::ModelProto onnx;
   onnx.ParseFromString(onnx_model.model());
 
@@ -219,27 +223,44 @@ XlaNetworkOptions FillXlaRunnerFromOnnx(
     onnx2hlo_options.outputs_override.emplace_back(onnx_model.output_mlh());
   }
   onnx2hlo_options.io_type = io_type;
-
+  onnx2hlo_options.fold_constants = hlo_passes;
+  onnx2hlo_options.pretranspose_matmul_weights = hlo_passes;
+  onnx2hlo_options.fuse_normalizations = hlo_passes;
+  onnx2hlo_options.fp8_matmul_type = fp8_matmul_type;
+
+  // Folded constants are the same for all batch sizes, so only the last
+  // conversion's copy is kept.
+  std::vector<pblczero::TensorProto> folded_constants;
+
+  const size_t max_replica_batch_size =
+      (max_batch_size + runner->GetNumReplicas() - 1) /
+      runner->GetNumReplicas();
+  steps = std::min(steps, max_replica_batch_size);
   for (size_t i = 0; i < steps; ++i) {
-    size_t batch_size = max_batch_size * (i + 1) / steps;
+    size_t batch_size = max_replica_batch_size * (i + 1) / steps;
     CERR << "Building HLO for batch size " << batch_size << "...";
     auto conversion = ConvertOnnxToHlo(onnx, batch_size, onnx2hlo_options);
     add_tensors(conversion.constants, constant_to_parameter_idx);
     add_tensors(conversion.inputs, input_to_parameter_idx);
     add_tensors(conversion.outputs, output_to_parameter_idx);
+    folded_constants = std::move(conversion.folded_constants);
     runner->AddModule(batch_size, conversion.hlo_module);
   }
 
   std::vector<std::unique_ptr<XlaTensor>> constants;
   constants.resize(constant_to_parameter_idx.size() +
                    input_to_parameter_idx.size());
-  for (const auto& initializer : onnx.graph().initializer()) {
+  auto add_constant = [&](const pblczero::TensorProto& initializer) {
     auto iter = constant_to_parameter_idx.find(std::string(initializer.name()));
-    if (iter == constant_to_parameter_idx.end()) continue;
+    if (iter == constant_to_parameter_idx.end()) return;
     auto io_info = iter->second;
     assert(io_info.idx < constants.size());
     constants[io_info.idx] = OnnxTensorToXlaTensor(initializer);
+  };
+  for (const auto& initializer : onnx.graph().initializer()) {
+    add_constant(initializer);
   }
+  for (const auto& initializer : folded_constants) add_constant(initializer);
 
   CERR << "Transferring constants...";
   runner->SetFrozenInputs(std::move(constants));
@@ -276,15 +297,27 @@ XlaNetworkOptions FillXlaRunnerFromOnnx(
 std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
                                         const OptionsDict& opts) {
   if (!w) throw Exception("The XLA backend requires a network file.");
-  int device = opts.GetOrDefault<int>("device", 0);
+  // Either a single device, or a comma separated list of devices (or "all")
+  // which the batches are split between.
+  std::vector<int> devices;
+  if (opts.Exists<std::string>("devices")) {
+    const std::string list = opts.Get<std::string>("devices");
+    if (list != "all") devices = ParseIntList(list);
+  } else {
+    devices.push_back(opts.GetOrDefault<int>("device", 0));
+  }
   // Note: if the plugin_path does NOT contain a slash, it's looked up in the
   // LD_LIBRARY_PATH (and a few other system defined places). If it does
   // contain a slash, it's looked up at the exact relative or absolute path.
+  // Compiled executables are cached between runs; an empty cache_dir disables
+  // the cache.
   auto runner = std::make_unique<XlaRunner>(
       opts.GetOrDefault<std::string>("plugin_path",
                                      "./pjrt_c_api_gpu_plugin.so")
           .c_str(),
-      device);
+      devices,
+      opts.GetOrDefault<std::string>(
+          "cache_dir", CommandLine::BinaryDirectory() + "/xla_cache"));
   int max_batch_size = opts.GetOrDefault<int>("max_batch", 512);
   int steps = opts.GetOrDefault<int>("steps", 16);
 
@@ -293,9 +326,21 @@ std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
   if (opts.Exists<std::string>("io_datatype")) {
     io_type = StringToXlaType(opts.Get<std::string>("io_datatype"));
   }
+  const bool hlo_passes = opts.GetOrDefault<bool>("hlo_passes", true);
+  // Computes weight matmuls in fp8 (f8e4m3fn or f8e5m2), for hardware that
+  // supports it.
+  std::optional<pblczero::XlaShapeProto::Type> fp8_matmul_type;
+  if (opts.Exists<std::string>("fp8_matmul")) {
+    fp8_matmul_type = StringToXlaType(opts.Get<std::string>("fp8_matmul"));
+    if (*fp8_matmul_type != pblczero::XlaShapeProto::F8E4M3FN &&
+        *fp8_matmul_type != pblczero::XlaShapeProto::F8E5M2) {
+      throw Exception("fp8_matmul must be f8e4m3fn or f8e5m2.");
+    }
+  }
   if (w->has_onnx_model()) {
     options = FillXlaRunnerFromOnnx(w->onnx_model(), runner.get(),
-                                    max_batch_size, steps, io_type);
+                                    max_batch_size, steps, io_type,
+                                    hlo_passes, fp8_matmul_type);
   } else {
     CERR << "Converting weights to ONNX first.";
     WeightsToOnnxConverterOptions onnx_converter_options;
@@ -307,7 +352,8 @@ std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
         opts.GetOrDefault<bool>("alt_mish", false);
     auto converted = ConvertWeightsToOnnx(*w, onnx_converter_options);
     options = FillXlaRunnerFromOnnx(converted.onnx_model(), runner.get(),
-                                    max_batch_size, steps, io_type);
+                                    max_batch_size, steps, io_type,
+                                    hlo_passes, fp8_matmul_type);
   }
 
   return std::make_unique<XlaNetwork>(std::move(runner), options,
@@ -29,10 +29,10 @@
 
 #include <dlfcn.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
-#include <numeric>
 
 #include "pjrt_c_api.h"
 #include "utils/logging.h"
@@ -147,42 +147,87 @@ PjrtExecutable::~PjrtExecutable() {
 
 size_t PjrtExecutable::GetNumOutputs() const { return num_outputs_; }
 
-std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteBlocking(
-    const std::vector<PjrtDeviceBuffer*>& inputs) {
+PjrtExecution PjrtExecutable::Execute(
+    const std::vector<PjrtDeviceBuffer*>& inputs,
+    const std::vector<size_t>& donated) {
+  return std::move(ExecuteReplicated({inputs}, donated).front());
+}
+
+std::vector<PjrtExecution> PjrtExecutable::ExecuteReplicated(
+    const std::vector<std::vector<PjrtDeviceBuffer*>>& inputs,
+    const std::vector<size_t>& donated) {
+  const size_t num_args = inputs.front().size();
   auto options = MakeStruct<PJRT_ExecuteOptions>();
-  options.num_non_donatable_input_indices = inputs.size();
-  std::vector<int64_t> non_donatable_indices(inputs.size());
-  // TODO the buffer 0 is actually donatable.
-  std::iota(non_donatable_indices.begin(), non_donatable_indices.end(), 0);
+  std::vector<int64_t> non_donatable_indices;
+  non_donatable_indices.reserve(num_args);
+  for (size_t i = 0; i < num_args; ++i) {
+    if (std::find(donated.begin(), donated.end(), i) == donated.end()) {
+      non_donatable_indices.push_back(i);
+    }
+  }
+  options.num_non_donatable_input_indices = non_donatable_indices.size();
   options.non_donatable_input_indices = non_donatable_indices.data();
 
+  const size_t num_devices = inputs.size();
   auto args = MakeStruct<PJRT_LoadedExecutable_Execute_Args>();
   args.executable = executable_;
   args.options = &options;
-  args.num_devices = 1;
-  std::vector<PJRT_Buffer*> buffers(inputs.size());
-  for (size_t i = 0; i < inputs.size(); ++i) buffers[i] = inputs[i]->buffer_;
-  PJRT_Buffer* const* buffers_ptr = buffers.data();
-  args.num_args = inputs.size();
-  args.argument_lists = &buffers_ptr;
-
-  std::vector<PJRT_Buffer*> outputs(num_outputs_);
-  PJRT_Buffer** outputs_ptr = outputs.data();
-  PJRT_Event* event_ptr;
-  args.output_lists = &outputs_ptr;
-  args.device_complete_events = &event_ptr;
+  args.num_devices = num_devices;
+  std::vector<std::vector<PJRT_Buffer*>> buffers(num_devices);
+  std::vector<PJRT_Buffer* const*> buffers_ptrs(num_devices);
+  for (size_t d = 0; d < num_devices; ++d) {
+    buffers[d].resize(num_args);
+    for (size_t i = 0; i < num_args; ++i) {
+      buffers[d][i] = inputs[d][i]->buffer_;
+    }
+    buffers_ptrs[d] = buffers[d].data();
+  }
+  args.num_args = num_args;
+  args.argument_lists = buffers_ptrs.data();
+
+  std::vector<std::vector<PJRT_Buffer*>> outputs(
+      num_devices, std::vector<PJRT_Buffer*>(num_outputs_));
+  std::vector<PJRT_Buffer**> outputs_ptrs(num_devices);
+  for (size_t d = 0; d < num_devices; ++d) outputs_ptrs[d] = outputs[d].data();
+  std::vector<PJRT_Event*> events(num_devices);
+  args.output_lists = outputs_ptrs.data();
+  args.device_complete_events = events.data();
   CheckError(api_->PJRT_LoadedExecutable_Execute(&args));
 
-  PjrtEvent event(api_, event_ptr);
-  event.Await();
-
-  std::vector<std::unique_ptr<PjrtDeviceBuffer>> output_buffers;
-  output_buffers.reserve(num_outputs_);
-  for (size_t i = 0; i < num_outputs_; ++i) {
-    output_buffers.push_back(
-        std::make_unique<PjrtDeviceBuffer>(api_, outputs[i]));
+  std::vector<PjrtExecution> result(num_devices);
+  for (size_t d = 0; d < num_devices; ++d) {
+    result[d].done = std::make_unique<PjrtEvent>(api_, events[d]);
+    result[d].outputs.reserve(num_outputs_);
+    for (size_t i = 0; i < num_outputs_; ++i) {
+      result[d].outputs.push_back(
+          std::make_unique<PjrtDeviceBuffer>(api_, outputs[d][i]));
+    }
   }
-  return output_buffers;
+  return result;
+}
+
+std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteBlocking(
+    const std::vector<PjrtDeviceBuffer*>& inputs) {
+  auto execution = Execute(inputs);
+  execution.done->Await();
+  return std::move(execution.outputs);
+}
+
+std::string PjrtExecutable::Serialize() const {
+  auto args = MakeStruct<PJRT_LoadedExecutable_GetExecutable_Args>();
+  args.loaded_executable = executable_;
+  CheckError(api_->PJRT_LoadedExecutable_GetExecutable(&args));
+
+  auto args2 = MakeStruct<PJRT_Executable_Serialize_Args>();
+  args2.executable = args.executable;
+  CheckError(api_->PJRT_Executable_Serialize(&args2));
+  std::string result(args2.serialized_bytes, args2.serialized_bytes_size);
+  args2.serialized_executable_deleter(args2.serialized_executable);
+
+  auto args3 = MakeStruct<PJRT_Executable_Destroy_Args>();
+  args3.executable = args.executable;
+  CheckError(api_->PJRT_Executable_Destroy(&args3));
+  return result;
 }
 
 PjrtDevice::PjrtDevice(const PJRT_Api* api, PJRT_Device* device)
@@ -200,6 +245,13 @@ std::string PjrtDevice::ToString() const {
   return {args.to_string, args.to_string_size};
 }
 
+std::string PjrtDevice::GetKind() const {
+  auto args = MakeStruct<PJRT_DeviceDescription_Kind_Args>();
+  args.device_description = description_;
+  CheckError(api_->PJRT_DeviceDescription_Kind(&args));
+  return {args.device_kind, args.device_kind_size};
+}
+
 PjrtClient::PjrtClient(const PJRT_Api* api, PJRT_Client* client)
     : PjrtCommon(api), client_(client) {}
 
@@ -227,6 +279,23 @@ std::unique_ptr<PjrtExecutable> PjrtClient::CompileHlo(
   return std::make_unique<PjrtExecutable>(api_, args.executable);
 }
 
+std::unique_ptr<PjrtExecutable> PjrtClient::DeserializeAndLoad(
+    std::string_view serialized) {
+  auto args = MakeStruct<PJRT_Executable_DeserializeAndLoad_Args>();
+  args.client = client_;
+  args.serialized_executable = serialized.data();
+  args.serialized_executable_size = serialized.size();
+  CheckError(api_->PJRT_Executable_DeserializeAndLoad(&args));
+  return std::make_unique<PjrtExecutable>(api_, args.loaded_executable);
+}
+
+std::string PjrtClient::GetPlatformVersion() const {
+  auto args = MakeStruct<PJRT_Client_PlatformVersion_Args>();
+  args.client = client_;
+  CheckError(api_->PJRT_Client_PlatformVersion(&args));
+  return {args.platform_version, args.platform_version_size};
+}
+
 std::vector<std::unique_ptr<PjrtDevice>> PjrtClient::GetDevices() {
   auto args = MakeStruct<PJRT_Client_Devices_Args>();
   args.client = client_;
@@ -312,6 +381,16 @@ PjrtHostToDeviceTransfer::AwaitAndReleaseBuffer() {
   return res;
 }
 
+std::unique_ptr<PjrtDeviceBuffer> PjrtHostToDeviceTransfer::ReleaseBuffer() {
+  if (!buffer_) {
+    throw PjrtException(PjrtErrorCode::INVALID_ARGUMENT,
+                        "Buffer already released");
+  }
+  auto res = std::make_unique<PjrtDeviceBuffer>(api_, buffer_);
+  buffer_ = nullptr;
+  return res;
+}
+
 PjrtHostToDeviceTransfer::~PjrtHostToDeviceTransfer() {
   Await();
   if (buffer_) {
@@ -31,6 +31,8 @@
 
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -152,6 +154,9 @@ class PjrtDevice : protected PjrtCommon {
  public:
   PjrtDevice(const PJRT_Api* api, PJRT_Device* device);
   std::string ToString() const;
+  // Vendor-dependent string identifying the kind of the device, e.g.
+  // "NVIDIA GeForce RTX 4090".
+  std::string GetKind() const;
 
  private:
   PJRT_Device* device_;
@@ -189,15 +194,39 @@ class PjrtDeviceBuffer : protected PjrtCommon {
   friend class PjrtExecutable;
 };
 
+// Result of an asynchronous execution. The output buffers can be used (e.g.
+// transferred to the host) right away, PJRT orders the operations.
+struct PjrtExecution {
+  std::vector<std::unique_ptr<PjrtDeviceBuffer>> outputs;
+  // Signalled when the computation completes on the device.
+  std::unique_ptr<PjrtEvent> done;
+};
+
 class PjrtExecutable : protected PjrtCommon {
  public:
   PjrtExecutable(const PJRT_Api* api, PJRT_LoadedExecutable* executable);
   ~PjrtExecutable();
+  // Enqueues the execution with the given inputs and returns without waiting
+  // for it to complete. Inputs with indices in @donated may be consumed by the
+  // computation (their device memory reused for outputs); such buffers must
+  // not be used afterwards, other inputs are not modified.
+  PjrtExecution Execute(const std::vector<PjrtDeviceBuffer*>& inputs,
+                        const std::vector<size_t>& donated = {});
+  // Same for an executable compiled with several replicas: @inputs has the
+  // arguments of every replica, in the order of the device assignment, and
+  // the result has an execution per replica.
+  std::vector<PjrtExecution> ExecuteReplicated(
+      const std::vector<std::vector<PjrtDeviceBuffer*>>& inputs,
+      const std::vector<size_t>& donated = {});
   // Executes the executable with the given inputs. The inputs are not owned or
   // modified. The function allocates the output buffers and returns them.
   std::vector<std::unique_ptr<PjrtDeviceBuffer>> ExecuteBlocking(
       const std::vector<PjrtDeviceBuffer*>& inputs);
   size_t GetNumOutputs() const;
+  // Returns platform-specific serialization of the executable, which can be
+  // loaded back with PjrtClient::DeserializeAndLoad() by the same plugin
+  // version.
+  std::string Serialize() const;
 
  private:
   PJRT_LoadedExecutable* executable_;
@@ -217,6 +246,10 @@ class PjrtHostToDeviceTransfer : protected PjrtCommon {
   // Waits for the transfer to complete and releases the ownership of the
   // buffer.
   std::unique_ptr<PjrtDeviceBuffer> AwaitAndReleaseBuffer();
+  // Releases the ownership of the buffer without waiting. The buffer can be
+  // passed to the executable immediately, but the host memory must be kept
+  // alive until the transfer object is destroyed.
+  std::unique_ptr<PjrtDeviceBuffer> ReleaseBuffer();
 
  private:
   PJRT_Buffer* buffer_;
@@ -229,6 +262,11 @@ class PjrtClient : protected PjrtCommon {
   ~PjrtClient();
   std::unique_ptr<PjrtExecutable> CompileHlo(std::string_view hlo,
                                              std::string_view config);
+  // Loads the executable produced by PjrtExecutable::Serialize().
+  std::unique_ptr<PjrtExecutable> DeserializeAndLoad(
+      std::string_view serialized);
+  // Human-readable platform version (e.g. CUDA version for GPU plugin).
+  std::string GetPlatformVersion() const;
   std::vector<std::unique_ptr<PjrtDevice>> GetDevices();
   std::unique_ptr<PjrtHostToDeviceTransfer> HostToDevice(
       std::string_view buffer, PjrtType type, const std::vector<int64_t>& dims,
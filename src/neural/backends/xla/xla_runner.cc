@@ -28,9 +28,15 @@
 #include "neural/backends/xla/xla_runner.h"
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <numeric>
+#include <sstream>
 
 #include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/hashcat.h"
 #include "utils/logging.h"
 
 namespace lczero {
@@ -105,10 +111,27 @@ PjrtType XlaTypeToPjrtType(pblczero::XlaShapeProto::Type type) {
                       pblczero::XlaShapeProto::Type_Name(type));
   }
 }
+
+// Stable (across runs and platforms) hash of a byte string.
+uint64_t HashBytes(uint64_t hash, std::string_view bytes) {
+  hash = HashCat(hash, bytes.size());
+  for (size_t i = 0; i < bytes.size(); i += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes.data() + i,
+                std::min(sizeof(uint64_t), bytes.size() - i));
+    hash = HashCat(hash, word);
+  }
+  return hash;
+}
+
 }  // namespace
 
-XlaRunner::XlaRunner(const char* library_path, int device)
-    : pjrt_client_(Pjrt(library_path).CreateClient()), device_(device) {
+XlaRunner::XlaRunner(const char* library_path,
+                     const std::vector<int>& devices,
+                     const std::string& cache_dir)
+    : replica_devices_(devices), cache_dir_(cache_dir) {
+  Pjrt pjrt(library_path);
+  pjrt_client_ = pjrt.CreateClient();
   CERR << "Devices:";
   devices_ = pjrt_client_->GetDevices();
   for (const auto& device : devices_) {
@@ -117,25 +140,111 @@ XlaRunner::XlaRunner(const char* library_path, int device)
   if (devices_.empty()) {
     throw Exception("No devices available");
   }
+  if (replica_devices_.empty()) {
+    replica_devices_.resize(devices_.size());
+    std::iota(replica_devices_.begin(), replica_devices_.end(), 0);
+  }
+  for (int device : replica_devices_) {
+    if (device < 0 || static_cast<size_t>(device) >= devices_.size()) {
+      throw Exception("Invalid device " + std::to_string(device));
+    }
+  }
+  if (replica_devices_.size() > 1) {
+    CERR << "Splitting batches between " << replica_devices_.size()
+         << " devices.";
+  }
+  if (cache_dir_.empty()) return;
+  auto [major, minor] = pjrt.ApiVersion();
+  cache_salt_ = "api=" + std::to_string(major) + "." + std::to_string(minor) +
+                ";platform=" + pjrt_client_->GetPlatformVersion() +
+                ";device=" + devices_.at(replica_devices_[0])->GetKind();
+  for (const auto& attr : pjrt.GetAttributes()) {
+    cache_salt_ += ";" + attr.key() + "=" + attr.value_as_string();
+  }
+  CreateDirectory(cache_dir_);
+  CERR << "XLA compilation cache: " << cache_dir_;
+}
+
+std::string XlaRunner::GetCacheFilename(std::string_view hlo,
+                                        std::string_view options) const {
+  if (cache_dir_.empty()) return {};
+  uint64_t hash = HashBytes(0, cache_salt_);
+  hash = HashBytes(hash, options);
+  hash = HashBytes(hash, hlo);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.xla",
+           static_cast<unsigned long long>(hash));
+  return cache_dir_ + "/" + name;
+}
+
+std::unique_ptr<PjrtExecutable> XlaRunner::LoadFromCache(
+    const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) return nullptr;
+  std::ostringstream buffer;
+  buffer << file.rdbuf();
+  try {
+    return pjrt_client_->DeserializeAndLoad(buffer.str());
+  } catch (const PjrtException& e) {
+    // Stale or corrupted entry, will be overwritten after recompilation.
+    CERR << "Unable to load cached executable " << filename << ": "
+         << e.what();
+    return nullptr;
+  }
+}
+
+void XlaRunner::SaveToCache(const std::string& filename,
+                            const PjrtExecutable& executable) const {
+  try {
+    const std::string serialized = executable.Serialize();
+    // Write to a temporary file first, so that a concurrently starting process
+    // never sees a partial entry.
+    const std::string tmp_filename = filename + ".tmp";
+    {
+      std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+      file.write(serialized.data(), serialized.size());
+      if (!file) throw Exception("Unable to write " + tmp_filename);
+    }
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(tmp_filename.c_str());
+      throw Exception("Unable to rename " + tmp_filename);
+    }
+  } catch (const std::exception& e) {
+    // Not fatal, the module just will be compiled again next time.
+    CERR << "Unable to cache executable: " << e.what();
+  }
 }
 
 void XlaRunner::AddModule(size_t minibatch_size,
                           const pblczero::HloModuleProto& module) {
+  // The module is compiled once, and replicated to all the devices.
+  const size_t num_replicas = replica_devices_.size();
   pblczero::CompileOptionsProto options;
-  options.mutable_executable_build_options()->set_num_replicas(1);
+  options.mutable_executable_build_options()->set_num_replicas(num_replicas);
   options.mutable_executable_build_options()->set_num_partitions(1);
   options.mutable_executable_build_options()
       ->mutable_device_assignment()
-      ->set_replica_count(1);
+      ->set_replica_count(num_replicas);
   options.mutable_executable_build_options()
       ->mutable_device_assignment()
       ->set_computation_count(1);
-  options.mutable_executable_build_options()
-      ->mutable_device_assignment()
-      ->add_computation_devices()
-      ->add_replica_device_ids(device_);
-  auto executable = pjrt_client_->CompileHlo(module.OutputAsString(),
-                                             options.OutputAsString());
+  auto* computation_devices = options.mutable_executable_build_options()
+                                  ->mutable_device_assignment()
+                                  ->add_computation_devices();
+  for (int device : replica_devices_) {
+    computation_devices->add_replica_device_ids(device);
+  }
+  const std::string hlo = module.OutputAsString();
+  const std::string config = options.OutputAsString();
+  const std::string cache_filename = GetCacheFilename(hlo, config);
+  std::unique_ptr<PjrtExecutable> executable;
+  if (!cache_filename.empty()) executable = LoadFromCache(cache_filename);
+  if (executable) {
+    CERR << "Loaded cached executable for batch size " << minibatch_size;
+  } else {
+    executable = pjrt_client_->CompileHlo(hlo, config);
+    if (!cache_filename.empty()) SaveToCache(cache_filename, *executable);
+  }
   executables_.push_back({minibatch_size, std::move(executable)});
   std::sort(executables_.begin(), executables_.end());
 }
@@ -143,44 +252,54 @@ void XlaRunner::AddModule(size_t minibatch_size,
 void XlaRunner::SetFrozenInputs(
     const std::vector<std::unique_ptr<XlaTensor>> inputs) {
   param_idxs_.clear();
-  std::vector<std::unique_ptr<PjrtHostToDeviceTransfer>> transfers_;
   for (size_t i = 0; i < inputs.size(); ++i) {
-    const auto* input = inputs[i].get();
-    if (!input) {
-      param_idxs_.push_back(i);
-      continue;
+    if (!inputs[i]) param_idxs_.push_back(i);
+  }
+  // Every device gets its own copy; all the transfers are started before
+  // waiting for any of them.
+  std::vector<std::unique_ptr<PjrtHostToDeviceTransfer>> transfers_;
+  for (int device : replica_devices_) {
+    for (const auto& input : inputs) {
+      if (!input) continue;
+      transfers_.push_back(pjrt_client_->HostToDevice(
+          {static_cast<const char*>(input->data()), input->size()},
+          XlaTypeToPjrtType(input->type()), input->shape(),
+          devices_.at(device).get()));
     }
-    transfers_.push_back(pjrt_client_->HostToDevice(
-        {static_cast<const char*>(input->data()), input->size()},
-        XlaTypeToPjrtType(input->type()), input->shape(),
-        devices_.at(device_).get()));
   }
 
   owned_buffers_.clear();
-  buffers_.clear();
-  buffers_.resize(inputs.size());
+  buffers_.assign(replica_devices_.size(),
+                  std::vector<PjrtDeviceBuffer*>(inputs.size()));
   size_t transfer_idx = 0;
-  for (size_t i = 0; i < inputs.size(); ++i) {
-    if (inputs[i]) {
-      owned_buffers_.push_back(
-          transfers_[transfer_idx++]->AwaitAndReleaseBuffer());
-      buffers_[i] = owned_buffers_.back().get();
+  for (auto& buffers : buffers_) {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      if (inputs[i]) {
+        owned_buffers_.push_back(
+            transfers_[transfer_idx++]->AwaitAndReleaseBuffer());
+        buffers[i] = owned_buffers_.back().get();
+      }
     }
   }
 }
 
-size_t XlaRunner::GetMaxBatchSize() const { return executables_.back().first; }
+size_t XlaRunner::GetMaxBatchSize() const {
+  return executables_.back().first * replica_devices_.size();
+}
 
 std::vector<std::unique_ptr<XlaMutableTensor>> XlaRunner::ExecuteBlocking(
     const std::vector<XlaMutableTensor*>& inputs) {
   if (inputs.size() != 1) {
     throw Exception("Only one input is kinda supported.");
   }
-  // Find the smallest batch size that fits the input.
+  // Find the smallest batch size that fits the input when split between the
+  // devices.
+  const size_t num_replicas = replica_devices_.size();
+  const size_t per_replica =
+      (inputs[0]->shape()[0] + num_replicas - 1) / num_replicas;
   auto iter = std::find_if(
-      executables_.begin(), executables_.end(), [&](const auto& e) {
-        return e.first >= static_cast<size_t>(inputs[0]->shape()[0]);
-      });
+      executables_.begin(), executables_.end(),
+      [&](const auto& e) { return e.first >= per_replica; });
   if (iter == executables_.end()) {
     throw Exception("No executable found for batch size " +
                     std::to_string(inputs[0]->shape()[0]));
@@ -190,38 +309,57 @@ std::vector<std::unique_ptr<XlaMutableTensor>> XlaRunner::ExecuteBlocking(
   // batch size must fit within tensor buffer capacity (it's fine to have
   // garbage in the tail of that buffer).
   std::vector<int64_t> new_shape = inputs[0]->shape();
-  new_shape[0] = batch_size;
+  new_shape[0] = batch_size * num_replicas;
   inputs[0]->Reshape(new_shape);
-  // Transfer the input to the device.
-  auto input_buffer =
-      pjrt_client_
-          ->HostToDevice(
-              {static_cast<const char*>(inputs[0]->data()), inputs[0]->size()},
-              XlaTypeToPjrtType(inputs[0]->type()), new_shape,
-              devices_.at(device_).get())
-          ->AwaitAndReleaseBuffer();
-  // Make a copy to support multiple concurrent calls, not sure if it's needed.
-  auto input_buffers = buffers_;
-  input_buffers[param_idxs_[0]] = input_buffer.get();
-  // Execute!
-  auto outputs = iter->second->ExecuteBlocking(input_buffers);
-
-  // Now we need to transfer the outputs back to the host.
+  // Start the transfers of the input slices to the devices. There is no need
+  // to wait for them, the execution is ordered after them by PJRT. The host
+  // buffer must stay alive until the transfer objects are destroyed though.
+  std::vector<int64_t> replica_shape = new_shape;
+  replica_shape[0] = batch_size;
+  const size_t slice_size = inputs[0]->size() / num_replicas;
+  std::vector<std::unique_ptr<PjrtHostToDeviceTransfer>> transfers;
+  std::vector<std::unique_ptr<PjrtDeviceBuffer>> input_buffers;
+  // Make a copy to support multiple concurrent calls.
+  auto replica_buffers = buffers_;
+  for (size_t r = 0; r < num_replicas; ++r) {
+    transfers.push_back(pjrt_client_->HostToDevice(
+        {static_cast<const char*>(inputs[0]->data()) + r * slice_size,
+         slice_size},
+        XlaTypeToPjrtType(inputs[0]->type()), replica_shape,
+        devices_.at(replica_devices_[r]).get()));
+    input_buffers.push_back(transfers.back()->ReleaseBuffer());
+    replica_buffers[r][param_idxs_[0]] = input_buffers.back().get();
+  }
+  // Execute! The input buffers are only used by this call, so they're donated.
+  auto executions =
+      iter->second->ExecuteReplicated(replica_buffers, {param_idxs_[0]});
+
+  // Now we need to transfer the outputs back to the host, the slices of every
+  // replica into one tensor.
+  const size_t num_outputs = executions[0].outputs.size();
   std::vector<std::unique_ptr<XlaMutableTensor>> result;
-  result.reserve(outputs.size());
+  result.reserve(num_outputs);
   std::vector<std::unique_ptr<PjrtEvent>> done_events;
-  done_events.reserve(outputs.size());
-  // Initialte transfers from device to host.
-  for (size_t i = 0; i < outputs.size(); ++i) {
-    const auto& output = outputs[i];
+  done_events.reserve(num_outputs * num_replicas);
+  // Initiate transfers from device to host. They are enqueued after the
+  // execution.
+  for (size_t i = 0; i < num_outputs; ++i) {
+    const auto& output = executions[0].outputs[i];
+    std::vector<int64_t> dims = output->GetDimensions();
+    if (num_replicas > 1) dims.at(0) *= num_replicas;
     auto new_tensor = std::make_unique<XlaMutableTensor>(
-        PjrtTypeToXlaType(output->GetType()), output->GetDimensions());
-    done_events.push_back(
-        output->DeviceToHost(new_tensor->mutable_data(), new_tensor->size()));
+        PjrtTypeToXlaType(output->GetType()), dims);
+    const size_t output_slice = new_tensor->size() / num_replicas;
+    for (size_t r = 0; r < num_replicas; ++r) {
+      done_events.push_back(executions[r].outputs[i]->DeviceToHost(
+          static_cast<char*>(new_tensor->mutable_data()) + r * output_slice,
+          output_slice));
+    }
     result.push_back(std::move(new_tensor));
   }
   // Wait for the transfers to complete.
-  for (size_t i = 0; i < outputs.size(); ++i) done_events[i]->Await();
+  for (auto& event : done_events) event->Await();
+  for (auto& execution : executions) execution.done->Await();
   return result;
 }
 
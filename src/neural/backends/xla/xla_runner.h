@@ -41,39 +41,63 @@ namespace lczero {
 
 // A class that keeps several XLA executables (for different batch sizes),
 // manages common buffers among them, and chooses the right executable for a
-// batch size.
+// batch size. With several devices, the executables are replicated on all of
+// them and every batch is split evenly between the devices.
 class XlaRunner {
  public:
-  // The library_path is the path to the PJRT library, and device indx.
-  XlaRunner(const char* library_path, int device);
-  // Compiles and adds a module for the given batch size.
+  // The library_path is the path to the PJRT library, and devices are the
+  // indices of the devices to run on (empty for all of them). If cache_dir is
+  // not empty, compiled executables are stored there and reused by later runs.
+  XlaRunner(const char* library_path, const std::vector<int>& devices,
+            const std::string& cache_dir = "");
+  // Number of devices the batches are split between.
+  size_t GetNumReplicas() const { return replica_devices_.size(); }
+  // Compiles (or loads from the compilation cache) and adds a module for the
+  // given batch size per device.
   void AddModule(size_t minibatch_size, const pblczero::HloModuleProto& module);
   // Transfers inputs to the device and execute the executable corresponding to
   // the batch size. Only non-frozen inputs are passed as arguments.
   // Currnetly only single input is supported (just because we don't need more).
+  // The transfers and the execution are enqueued without intermediate waits,
+  // so that concurrent calls overlap on the device; the input buffer is
+  // donated to the computation.
   std::vector<std::unique_ptr<XlaMutableTensor>> ExecuteBlocking(
       const std::vector<XlaMutableTensor*>& inputs);
   // Inputs that are shared between all calls (i.e. network weights passed as
   // parameters). These inputs are transferred to device immediately (and not
   // for each inference).
   void SetFrozenInputs(const std::vector<std::unique_ptr<XlaTensor>> inputs);
-  // Maximum supported batch size. It's expected that the capacity (not size) of
-  // the input tensors would be able to fit this size.
+  // Maximum supported batch size, over all devices. It's expected that the
+  // capacity (not size) of the input tensors would be able to fit this size.
   size_t GetMaxBatchSize() const;
 
  private:
+  // Returns the compilation cache file name for the given module and compile
+  // options, or empty string if the cache is disabled.
+  std::string GetCacheFilename(std::string_view hlo,
+                               std::string_view options) const;
+  std::unique_ptr<PjrtExecutable> LoadFromCache(const std::string& filename);
+  void SaveToCache(const std::string& filename,
+                   const PjrtExecutable& executable) const;
+
   std::unique_ptr<PjrtClient> pjrt_client_;
   std::vector<std::unique_ptr<PjrtDevice>> devices_;
-  // Compiled executables per batch size.
+  // Compiled executables per batch size (per device).
   std::vector<std::pair<size_t, std::unique_ptr<PjrtExecutable>>> executables_;
   // Frozen inputs, in no particular order, kept for ownership.
   std::vector<std::unique_ptr<PjrtDeviceBuffer>> owned_buffers_;
-  // Vector of pointers to all input buffers, that is passed to PJRT. Frozen
-  // parameters (constants) are pre-filled in SetFrozenInputs(), and non-frozen
-  // inputs (input planes) are created and filled in every request.
-  std::vector<PjrtDeviceBuffer*> buffers_;
+  // Vectors of pointers to all input buffers of every device, that are passed
+  // to PJRT. Frozen parameters (constants) are pre-filled in
+  // SetFrozenInputs(), and non-frozen inputs (input planes) are created and
+  // filled in every request.
+  std::vector<std::vector<PjrtDeviceBuffer*>> buffers_;
   std::vector<size_t> param_idxs_;
-  int device_;
+  // Indices in devices_ of the devices the replicas run on.
+  std::vector<int> replica_devices_;
+  std::string cache_dir_;
+  // Everything besides the module itself that the compiled executable depends
+  // on: plugin version and attributes, platform version and device kind.
+  std::string cache_salt_;
 };
 
 }  // namespace lczero
@@ -27,6 +27,9 @@
 
 #include "neural/batchsplit.h"
 
+#include <algorithm>
+#include <deque>
+
 namespace lczero {
 namespace {
 
@@ -60,32 +63,88 @@ class BatchSplittingComputation : public BackendComputation {
  public:
   BatchSplittingComputation(Backend* wrapped_backend)
       : wrapped_backend_(wrapped_backend),
-        max_batch_size_(wrapped_backend->GetAttributes().maximum_batch_size) {
+        max_batch_size_(wrapped_backend->GetAttributes().maximum_batch_size),
+        max_in_flight_(std::max(
+            1, wrapped_backend->GetAttributes().suggested_num_search_threads)) {
     MakeComputation();
   }
 
+  ~BatchSplittingComputation() override {
+    // Dispatched sub-batches write into the caller's buffers.
+    for (auto& computation : in_flight_) computation->Wait();
+  }
+
   size_t UsedBatchSize() const override {
-    return wrapped_computation_->UsedBatchSize();
+    return dispatched_batch_size_ + wrapped_computation_->UsedBatchSize();
   }
   AddInputResult AddInput(const EvalPosition& pos,
                           EvalResultPtr result) override {
     if (wrapped_computation_->UsedBatchSize() >= max_batch_size_) {
-      ComputeBlocking();
+      Dispatch();
       MakeComputation();
     }
     return wrapped_computation_->AddInput(pos, result);
   }
 
-  void ComputeBlocking() override { wrapped_computation_->ComputeBlocking(); }
+  void ComputeBlocking() override {
+    if (in_flight_.empty()) return wrapped_computation_->ComputeBlocking();
+    ComputeAsync();
+    Wait();
+  }
+  void ComputeAsync() override { wrapped_computation_->ComputeAsync(); }
+  bool IsReady() const override {
+    return wrapped_computation_->IsReady() &&
+           std::all_of(in_flight_.begin(), in_flight_.end(),
+                       [](const auto& computation) {
+                         return computation->IsReady();
+                       });
+  }
+  void Wait() override {
+    for (auto& computation : in_flight_) computation->Wait();
+    in_flight_.clear();
+    wrapped_computation_->Wait();
+  }
+  void SetPriority(ComputationPriority priority) override {
+    priority_ = priority;
+    wrapped_computation_->SetPriority(priority);
+  }
+  void SetRequiredHeads(EvalHeads heads) override {
+    heads_ = heads;
+    wrapped_computation_->SetRequiredHeads(heads);
+  }
 
  private:
   void MakeComputation() {
     wrapped_computation_ = wrapped_backend_->CreateComputation();
+    wrapped_computation_->SetPriority(priority_);
+    wrapped_computation_->SetRequiredHeads(heads_);
+  }
+
+  // Sends the full sub-batch to the wrapped backend. Up to as many sub-batches
+  // as the backend has threads are computed at the same time.
+  void Dispatch() {
+    dispatched_batch_size_ += wrapped_computation_->UsedBatchSize();
+    if (max_in_flight_ == 1) {
+      wrapped_computation_->ComputeBlocking();
+      return;
+    }
+    if (in_flight_.size() >= max_in_flight_) {
+      in_flight_.front()->Wait();
+      in_flight_.pop_front();
+    }
+    wrapped_computation_->ComputeAsync();
+    in_flight_.push_back(std::move(wrapped_computation_));
   }
 
   Backend* wrapped_backend_;
   size_t max_batch_size_;
+  const size_t max_in_flight_;
   std::unique_ptr<BackendComputation> wrapped_computation_;
+  // Sub-batches which were sent to the backend but may be not finished yet.
+  std::deque<std::unique_ptr<BackendComputation>> in_flight_;
+  size_t dispatched_batch_size_ = 0;
+  ComputationPriority priority_ = ComputationPriority::kNormal;
+  EvalHeads heads_;
 };
 
 std::unique_ptr<BackendComputation> BatchSplittingBackend::CreateComputation() {
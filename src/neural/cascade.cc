@@ -0,0 +1,330 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+// The "cascade" backend holds a small draft network and the main network.
+// Computations with a priority below the configured one (e.g. the idle time
+// prefetch) are only evaluated by the draft network. The others go to the main
+// network, optionally after a draft pass which keeps the draft evaluation of
+// positions it finds decisive.
+//
+// Backend options:
+//   draft-backend, main-backend: names of the backends to use.
+//   draft-weights, main-weights: weights files, default is WeightsFile.
+//   draft-opts, main-opts: backend options for the respective backends.
+//   main-priority: lowest priority (low, normal, high) evaluated by the main
+//     network, default is normal.
+//   decisive-q: if above zero, the main network only evaluates the positions
+//     for which the draft network has |q| below this value.
+// Example:
+//   --backend=cascade --backend-opts="draft-backend=blas,
+//     draft-weights='small.pb.gz',main-backend=cuda-auto"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "neural/encoder.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+ComputationPriority ParsePriority(const std::string& priority) {
+  if (priority == "low") return ComputationPriority::kLow;
+  if (priority == "normal") return ComputationPriority::kNormal;
+  if (priority == "high") return ComputationPriority::kHigh;
+  throw Exception("Invalid cascade main-priority: " + priority);
+}
+
+class CascadeBackend : public Backend {
+ public:
+  CascadeBackend(const OptionsDict& options)
+      : backend_opts_(
+            options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
+    OptionsDict opts;
+    opts.AddSubdictFromString(backend_opts_);
+    draft_ = CreateChild("draft", opts, options);
+    main_ = CreateChild("main", opts, options);
+    main_priority_ = ParsePriority(
+        opts.GetOrDefault<std::string>("main-priority", "normal"));
+    decisive_q_ = opts.GetOrDefault<float>("decisive-q", 0.0f);
+    opts.CheckAllOptionsRead("cascade");
+
+    const BackendAttributes draft_attrs = draft_->GetAttributes();
+    attrs_ = main_->GetAttributes();
+    attrs_.runs_on_cpu &= draft_attrs.runs_on_cpu;
+    attrs_.device_memory += draft_attrs.device_memory;
+    attrs_.maximum_batch_size = std::min(attrs_.maximum_batch_size,
+                                         draft_attrs.maximum_batch_size);
+    attrs_.recommended_batch_size =
+        std::min(attrs_.recommended_batch_size, attrs_.maximum_batch_size);
+    // Latencies of the main network alone don't describe the cascade.
+    attrs_.latency_profile.clear();
+    Backend::UpdateConfiguration(options);
+  }
+
+  ~CascadeBackend() override {
+    const uint64_t draft = draft_positions_.load(std::memory_order_relaxed);
+    const uint64_t main_net = main_positions_.load(std::memory_order_relaxed);
+    if (draft + main_net == 0) return;
+    LOGFILE << "Cascade evaluated " << draft << " positions with the draft "
+            << "network and " << main_net << " with the main network, "
+            << resolved_positions_.load(std::memory_order_relaxed)
+            << " resolved by the draft network.";
+  }
+
+  BackendAttributes GetAttributes() const override { return attrs_; }
+  std::unique_ptr<BackendComputation> CreateComputation() override;
+
+  std::optional<EvalResult> GetCachedEvaluation(
+      const EvalPosition& pos) override {
+    return main_->GetCachedEvaluation(pos);
+  }
+
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    Backend::UpdateConfiguration(options);
+    if (backend_opts_ !=
+        options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
+      return NEED_RESTART;
+    }
+    OptionsDict opts;
+    opts.AddSubdictFromString(backend_opts_);
+    if (UpdateChild(draft_.get(), "draft", opts, options) == NEED_RESTART ||
+        UpdateChild(main_.get(), "main", opts, options) == NEED_RESTART) {
+      return NEED_RESTART;
+    }
+    return UPDATE_OK;
+  }
+
+  Backend* draft_backend() const { return draft_.get(); }
+  Backend* main_backend() const { return main_.get(); }
+  ComputationPriority main_priority() const { return main_priority_; }
+  float decisive_q() const { return decisive_q_; }
+
+  void AddStats(uint64_t draft, uint64_t main_net, uint64_t resolved) {
+    draft_positions_.fetch_add(draft, std::memory_order_relaxed);
+    main_positions_.fetch_add(main_net, std::memory_order_relaxed);
+    resolved_positions_.fetch_add(resolved, std::memory_order_relaxed);
+  }
+
+ private:
+  // Top-level options of a wrapped backend, with the weights and the backend
+  // options taken from the cascade options.
+  static void FillChildOptions(const std::string& prefix,
+                               const OptionsDict& opts,
+                               const OptionsDict& options,
+                               OptionsDict* child) {
+    child->Set<std::string>(
+        SharedBackendParams::kWeightsId,
+        opts.GetOrDefault<std::string>(
+            prefix + "-weights",
+            options.Get<std::string>(SharedBackendParams::kWeightsId)));
+    child->Set<std::string>(
+        SharedBackendParams::kBackendOptionsId,
+        opts.GetOrDefault<std::string>(prefix + "-opts", ""));
+    child->Set<std::string>(SharedBackendParams::kBackendId,
+                            opts.Get<std::string>(prefix + "-backend"));
+  }
+
+  static std::unique_ptr<Backend> CreateChild(const std::string& prefix,
+                                              const OptionsDict& opts,
+                                              const OptionsDict& options) {
+    if (!opts.Exists<std::string>(prefix + "-backend")) {
+      throw Exception("Cascade backend requires the " + prefix +
+                      "-backend option");
+    }
+    OptionsDict child(&options);
+    FillChildOptions(prefix, opts, options, &child);
+    const std::string name =
+        child.Get<std::string>(SharedBackendParams::kBackendId);
+    if (name == "cascade") throw Exception("Cascade backends can't be nested");
+    return BackendManager::Get()->CreateFromName(name, child);
+  }
+
+  static UpdateConfigurationResult UpdateChild(Backend* backend,
+                                               const std::string& prefix,
+                                               const OptionsDict& opts,
+                                               const OptionsDict& options) {
+    OptionsDict child(&options);
+    FillChildOptions(prefix, opts, options, &child);
+    return backend->UpdateConfiguration(child);
+  }
+
+  const std::string backend_opts_;
+  std::unique_ptr<Backend> draft_;
+  std::unique_ptr<Backend> main_;
+  ComputationPriority main_priority_;
+  float decisive_q_;
+  BackendAttributes attrs_;
+  std::atomic<uint64_t> draft_positions_ = 0;
+  std::atomic<uint64_t> main_positions_ = 0;
+  std::atomic<uint64_t> resolved_positions_ = 0;
+};
+
+class CascadeComputation : public BackendComputation {
+ public:
+  CascadeComputation(CascadeBackend* backend) : backend_(backend) {}
+
+  ~CascadeComputation() override {
+    if (draft_) draft_->Wait();
+    if (main_) main_->Wait();
+    backend_->AddStats(draft_ ? draft_->UsedBatchSize() : 0,
+                       main_ ? main_->UsedBatchSize() : 0, resolved_);
+  }
+
+  size_t UsedBatchSize() const override { return used_batch_size_; }
+
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    AddInputResult ret;
+    if (priority_ < backend_->main_priority()) {
+      ret = Draft()->AddInput(pos, result);
+    } else if (backend_->decisive_q() <= 0.0f || !result.q) {
+      ret = Main()->AddInput(pos, result);
+    } else {
+      // The draft writes straight into the result, the main network overwrites
+      // it later if the position is escalated. The input spans are not
+      // guaranteed to live that long, so the positions are copied.
+      Draft()->AddInput(pos, result);
+      const size_t history =
+          std::min(pos.pos.size(), static_cast<size_t>(kMoveHistory));
+      pending_.push_back(
+          {std::vector<Position>(pos.pos.end() - history, pos.pos.end()),
+           std::vector<Move>(pos.legal_moves.begin(), pos.legal_moves.end()),
+           result});
+      ret = ENQUEUED_FOR_EVAL;
+    }
+    if (ret == ENQUEUED_FOR_EVAL) ++used_batch_size_;
+    return ret;
+  }
+
+  void ComputeBlocking() override {
+    if (draft_) draft_->ComputeBlocking();
+    Escalate();
+    if (main_) main_->ComputeBlocking();
+  }
+
+  // With a draft pass, the main batch depends on the draft results, so it's
+  // only started after the draft network is done.
+  void ComputeAsync() override {
+    if (!pending_.empty()) return ComputeBlocking();
+    if (draft_) draft_->ComputeAsync();
+    if (main_) main_->ComputeAsync();
+  }
+
+  bool IsReady() const override {
+    return (!draft_ || draft_->IsReady()) && (!main_ || main_->IsReady());
+  }
+
+  void Wait() override {
+    if (draft_) draft_->Wait();
+    if (main_) main_->Wait();
+  }
+
+  void SetPriority(ComputationPriority priority) override {
+    priority_ = priority;
+    if (draft_) draft_->SetPriority(priority);
+    if (main_) main_->SetPriority(priority);
+  }
+
+  void SetRequiredHeads(EvalHeads heads) override {
+    heads_ = heads;
+    if (draft_) draft_->SetRequiredHeads(heads);
+    if (main_) main_->SetRequiredHeads(heads);
+  }
+
+ private:
+  struct PendingInput {
+    std::vector<Position> history;
+    std::vector<Move> legal_moves;
+    EvalResultPtr result;
+  };
+
+  BackendComputation* Draft() {
+    if (!draft_) draft_ = CreateWrapped(backend_->draft_backend());
+    return draft_.get();
+  }
+
+  BackendComputation* Main() {
+    if (!main_) main_ = CreateWrapped(backend_->main_backend());
+    return main_.get();
+  }
+
+  std::unique_ptr<BackendComputation> CreateWrapped(Backend* backend) {
+    auto computation = backend->CreateComputation();
+    computation->SetPriority(priority_);
+    computation->SetRequiredHeads(heads_);
+    return computation;
+  }
+
+  // Sends the positions of the draft pass which are not decisive to the main
+  // network.
+  void Escalate() {
+    for (const PendingInput& input : pending_) {
+      if (std::abs(*input.result.q) >= backend_->decisive_q()) {
+        ++resolved_;
+        continue;
+      }
+      Main()->AddInput(EvalPosition{input.history, input.legal_moves},
+                       input.result);
+    }
+    pending_.clear();
+  }
+
+  CascadeBackend* const backend_;
+  std::unique_ptr<BackendComputation> draft_;
+  std::unique_ptr<BackendComputation> main_;
+  std::vector<PendingInput> pending_;
+  size_t used_batch_size_ = 0;
+  uint64_t resolved_ = 0;
+  ComputationPriority priority_ = ComputationPriority::kNormal;
+  EvalHeads heads_;
+};
+
+std::unique_ptr<BackendComputation> CascadeBackend::CreateComputation() {
+  return std::make_unique<CascadeComputation>(this);
+}
+
+class CascadeBackendFactory : public BackendFactory {
+ public:
+  int GetPriority() const override { return -1000; }
+  std::string_view GetName() const override { return "cascade"; }
+  std::unique_ptr<Backend> Create(const OptionsDict& options) override {
+    return std::make_unique<CascadeBackend>(options);
+  }
+};
+
+BackendManager::Register reg(std::make_unique<CascadeBackendFactory>());
+
+}  // namespace
+}  // namespace lczero
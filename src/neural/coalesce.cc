@@ -0,0 +1,376 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/coalesce.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "neural/encoder.h"
+#include "neural/shared_params.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Hash of everything the network input is made of, so that positions with the
+// same hash get the same evaluation.
+uint64_t ComputeInputHash(const EvalPosition& pos) {
+  const size_t num_positions =
+      std::min(pos.pos.size(), static_cast<size_t>(kMoveHistory));
+  uint64_t hash = pos.legal_moves.size();
+  for (const Position& p : pos.pos.last(num_positions)) {
+    hash = HashCat(hash, p.Hash());
+  }
+  return HashCat(hash, pos.pos.back().GetRule50Ply());
+}
+
+// Whether @to only needs the outputs which @from has.
+bool CanCopyResult(const EvalResultPtr& from, const EvalResultPtr& to) {
+  return (!to.q || from.q) && (!to.d || from.d) && (!to.m || from.m) &&
+         (to.p.empty() || to.p.size() == from.p.size());
+}
+
+void CopyResult(const EvalResultPtr& from, const EvalResultPtr& to) {
+  if (to.q) *to.q = *from.q;
+  if (to.d) *to.d = *from.d;
+  if (to.m) *to.m = *from.m;
+  std::copy(from.p.begin(), from.p.begin() + to.p.size(), to.p.begin());
+}
+
+// Batch of the wrapped backend, shared by all computations which have inputs
+// in it.
+struct Batch {
+  std::unique_ptr<BackendComputation> computation;
+  // Can be moved earlier by the inputs. Guarded by the backend mutex.
+  Clock::time_point deadline;
+  // Set when the batch is closed for new inputs. Guarded by the backend mutex.
+  bool flushed = false;
+  // Held while the computation is being started and waited for.
+  std::mutex compute_mutex;
+  bool done = false;
+  // Highest priority of the computations in the batch. Guarded by the backend
+  // mutex.
+  ComputationPriority priority = ComputationPriority::kNormal;
+  // With deduplication, the first input of every position in the batch, and
+  // the inputs which get a copy of its result instead of being evaluated
+  // again. Guarded by the backend mutex until the batch is flushed.
+  std::unordered_map<uint64_t, EvalResultPtr> inputs;
+  std::vector<std::pair<EvalResultPtr, EvalResultPtr>> duplicates;
+};
+
+class CoalescingBackendImpl : public CoalescingBackend {
+ public:
+  CoalescingBackendImpl(std::unique_ptr<Backend> wrapped,
+                        const OptionsDict& options)
+      : wrapped_backend_(std::move(wrapped)) {
+    UpdateParams(options);
+  }
+
+  ~CoalescingBackendImpl() override {
+    const Stats stats = GetStats();
+    if (stats.batches == 0) return;
+    LOGFILE << "Coalesced " << stats.positions << " positions into "
+            << stats.batches << " batches, average fill "
+            << 100.0 * stats.positions / stats.batches / stats.max_batch_size
+            << "%, " << stats.deadline_flushes << " sent on deadline, "
+            << stats.duplicates << " duplicate positions.";
+  }
+
+  BackendAttributes GetAttributes() const override {
+    return wrapped_backend_->GetAttributes();
+  }
+  std::optional<EvalResult> GetCachedEvaluation(
+      const EvalPosition& pos) override {
+    return wrapped_backend_->GetCachedEvaluation(pos);
+  }
+  std::unique_ptr<BackendComputation> CreateComputation() override;
+  std::unique_ptr<BackendComputation> CreateComputationWithDeadline(
+      Clock::time_point deadline) override;
+
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    const auto ret = wrapped_backend_->UpdateConfiguration(options);
+    if (ret == UPDATE_OK) UpdateParams(options);
+    return ret;
+  }
+
+  bool IsSameConfiguration(const OptionsDict& options) const override {
+    return wrapped_backend_->IsSameConfiguration(options);
+  }
+
+  Stats GetStats() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  // Adds the input to the currently open batch, and returns the batch if the
+  // input was enqueued into it.
+  std::shared_ptr<Batch> AddInput(const EvalPosition& pos, EvalResultPtr result,
+                                  ComputationPriority priority,
+                                  Clock::time_point deadline) {
+    std::shared_ptr<Batch> batch;
+    std::unique_lock<std::mutex> compute_lock;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!open_batch_) {
+        open_batch_ = std::make_shared<Batch>();
+        open_batch_->computation = wrapped_backend_->CreateComputation();
+        open_batch_->deadline = Clock::now() + deadline_;
+      }
+      batch = open_batch_;
+      // The waiting threads pick the earlier deadline up when they wake.
+      if (deadline < batch->deadline) {
+        batch->deadline = deadline;
+        flushed_cv_.notify_all();
+      }
+      // The batch as a whole goes with the priority of its most urgent input.
+      if (priority > batch->priority) {
+        batch->priority = priority;
+        batch->computation->SetPriority(priority);
+      }
+      const uint64_t hash = deduplicate_ ? ComputeInputHash(pos) : 0;
+      if (deduplicate_) {
+        const auto it = batch->inputs.find(hash);
+        if (it != batch->inputs.end() && CanCopyResult(it->second, result)) {
+          batch->duplicates.emplace_back(it->second, result);
+          ++stats_.duplicates;
+          return batch;
+        }
+      }
+      if (batch->computation->AddInput(pos, result) ==
+          BackendComputation::FETCHED_IMMEDIATELY) {
+        return nullptr;
+      }
+      // Results fetched immediately are not kept, as their buffers may go
+      // away before the batch is computed.
+      if (deduplicate_) batch->inputs.try_emplace(hash, result);
+      if (static_cast<int>(batch->computation->UsedBatchSize()) >=
+          stats_.max_batch_size) {
+        compute_lock = FlushLocked(/*on_deadline=*/false);
+      }
+    }
+    if (compute_lock) batch->computation->ComputeAsync();
+    return batch;
+  }
+
+  // Waits until the batch is computed. Sends the batch if it's not sent by the
+  // deadline.
+  void WaitForBatch(Batch* batch) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!batch->flushed) {
+        if (Clock::now() >= batch->deadline) {
+          std::unique_lock<std::mutex> compute_lock =
+              FlushLocked(/*on_deadline=*/true);
+          lock.unlock();
+          batch->computation->ComputeAsync();
+          break;
+        }
+        flushed_cv_.wait_until(lock, batch->deadline);
+      }
+    }
+    std::lock_guard<std::mutex> compute_lock(batch->compute_mutex);
+    if (batch->done) return;
+    batch->computation->Wait();
+    // No computation of the batch returns from waiting before this, so all the
+    // result buffers are still there.
+    for (const auto& [from, to] : batch->duplicates) CopyResult(from, to);
+    batch->done = true;
+  }
+
+  // Sends the batch without waiting for the deadline or other inputs, for
+  // high priority computations.
+  void SendNow(Batch* batch) {
+    std::unique_lock<std::mutex> compute_lock;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (batch->flushed) return;
+      compute_lock = FlushLocked(/*on_deadline=*/false);
+    }
+    batch->computation->ComputeAsync();
+  }
+
+  bool IsBatchReady(Batch* batch) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!batch->flushed) return false;
+    }
+    std::lock_guard<std::mutex> compute_lock(batch->compute_mutex);
+    return batch->done || batch->computation->IsReady();
+  }
+
+  bool IsPassThrough() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return deadline_.count() == 0;
+  }
+
+  Backend* wrapped_backend() const { return wrapped_backend_.get(); }
+
+ private:
+  void UpdateParams(const OptionsDict& options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deadline_ = std::chrono::microseconds(
+        options.Get<int>(SharedBackendParams::kNNCoalesceDeadlineId));
+    const int max_batch_size =
+        options.Get<int>(SharedBackendParams::kNNCoalesceMaxBatchId);
+    const int backend_max_batch_size =
+        wrapped_backend_->GetAttributes().maximum_batch_size;
+    deduplicate_ =
+        options.Get<bool>(SharedBackendParams::kNNCoalesceDeduplicateId);
+    stats_.max_batch_size = max_batch_size == 0
+                                ? backend_max_batch_size
+                                : std::min(max_batch_size,
+                                           backend_max_batch_size);
+  }
+
+  // Closes the open batch. Returns the lock of its compute mutex, so that
+  // nobody waits for the batch until ComputeAsync() is called.
+  std::unique_lock<std::mutex> FlushLocked(bool on_deadline) {
+    std::shared_ptr<Batch> batch = std::move(open_batch_);
+    std::unique_lock<std::mutex> compute_lock(batch->compute_mutex);
+    batch->flushed = true;
+    ++stats_.batches;
+    if (on_deadline) ++stats_.deadline_flushes;
+    stats_.positions += batch->computation->UsedBatchSize();
+    flushed_cv_.notify_all();
+    return compute_lock;
+  }
+
+  std::unique_ptr<Backend> wrapped_backend_;
+  mutable std::mutex mutex_;
+  std::condition_variable flushed_cv_;
+  std::shared_ptr<Batch> open_batch_;
+  std::chrono::microseconds deadline_;
+  bool deduplicate_ = false;
+  Stats stats_;
+};
+
+class CoalescingComputation : public BackendComputation {
+ public:
+  CoalescingComputation(CoalescingBackendImpl* backend,
+                        Clock::time_point deadline = Clock::time_point::max())
+      : backend_(backend), deadline_(deadline) {
+    if (backend->IsPassThrough()) {
+      wrapped_computation_ = backend->wrapped_backend()->CreateComputation();
+    }
+  }
+
+  ~CoalescingComputation() override {
+    // Shared batches keep writing into the caller's buffers, so they have to
+    // finish before the caller can release them.
+    if (!wrapped_computation_) Wait();
+  }
+
+  size_t UsedBatchSize() const override {
+    if (wrapped_computation_) return wrapped_computation_->UsedBatchSize();
+    return used_batch_size_;
+  }
+
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    if (wrapped_computation_) return wrapped_computation_->AddInput(pos, result);
+    std::shared_ptr<Batch> batch =
+        backend_->AddInput(pos, result, priority_, deadline_);
+    if (!batch) return FETCHED_IMMEDIATELY;
+    ++used_batch_size_;
+    if (batches_.empty() || batches_.back() != batch) {
+      batches_.push_back(std::move(batch));
+    }
+    return ENQUEUED_FOR_EVAL;
+  }
+
+  void ComputeBlocking() override {
+    if (wrapped_computation_) return wrapped_computation_->ComputeBlocking();
+    ComputeAsync();
+    Wait();
+  }
+
+  // Batches are sent by size or deadline, nothing to start here unless the
+  // computation is urgent.
+  void ComputeAsync() override {
+    if (wrapped_computation_) return wrapped_computation_->ComputeAsync();
+    if (priority_ == ComputationPriority::kHigh && !batches_.empty()) {
+      backend_->SendNow(batches_.back().get());
+    }
+  }
+
+  bool IsReady() const override {
+    if (wrapped_computation_) return wrapped_computation_->IsReady();
+    return std::all_of(batches_.begin(), batches_.end(),
+                       [this](const std::shared_ptr<Batch>& batch) {
+                         return backend_->IsBatchReady(batch.get());
+                       });
+  }
+
+  void Wait() override {
+    if (wrapped_computation_) return wrapped_computation_->Wait();
+    for (auto& batch : batches_) backend_->WaitForBatch(batch.get());
+    batches_.clear();
+  }
+
+  void SetPriority(ComputationPriority priority) override {
+    priority_ = priority;
+    if (wrapped_computation_) wrapped_computation_->SetPriority(priority);
+  }
+
+ private:
+  CoalescingBackendImpl* const backend_;
+  const Clock::time_point deadline_;
+  // Set in the pass through mode.
+  std::unique_ptr<BackendComputation> wrapped_computation_;
+  size_t used_batch_size_ = 0;
+  ComputationPriority priority_ = ComputationPriority::kNormal;
+  // Batches with inputs of this computation, in the order they were opened.
+  std::vector<std::shared_ptr<Batch>> batches_;
+};
+
+std::unique_ptr<BackendComputation> CoalescingBackendImpl::CreateComputation() {
+  return std::make_unique<CoalescingComputation>(this);
+}
+
+std::unique_ptr<BackendComputation>
+CoalescingBackendImpl::CreateComputationWithDeadline(
+    Clock::time_point deadline) {
+  return std::make_unique<CoalescingComputation>(this, deadline);
+}
+
+}  // namespace
+
+std::unique_ptr<CoalescingBackend> CreateCoalescingBackend(
+    std::unique_ptr<Backend> wrapped, const OptionsDict& options) {
+  return std::make_unique<CoalescingBackendImpl>(std::move(wrapped), options);
+}
+
+}  // namespace lczero
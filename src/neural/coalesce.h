@@ -0,0 +1,72 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "neural/backend.h"
+
+namespace lczero {
+
+class CoalescingBackend : public Backend {
+ public:
+  struct Stats {
+    // Number of batches sent to the wrapped backend.
+    uint64_t batches = 0;
+    // Number of batches sent because the deadline has passed, rather than
+    // because they were full.
+    uint64_t deadline_flushes = 0;
+    // Total number of positions in all the batches.
+    uint64_t positions = 0;
+    // Number of positions which got the result of an identical position in the
+    // same batch, rather than being evaluated again.
+    uint64_t duplicates = 0;
+    // Batch size at which the batches are sent without waiting.
+    int max_batch_size = 0;
+  };
+  virtual Stats GetStats() const = 0;
+
+  // Same as CreateComputation(), but the batches which get the inputs of the
+  // computation are sent by @deadline at the latest, even if that's sooner
+  // than the coalescing deadline. Lets the more urgent users go first.
+  virtual std::unique_ptr<BackendComputation> CreateComputationWithDeadline(
+      std::chrono::steady_clock::time_point deadline) = 0;
+};
+
+// Creates a backend wrapper which merges the computations of all its concurrent
+// users (search threads, selfplay games) into shared batches of the wrapped
+// backend. A batch is sent when it's full or when the deadline since its first
+// position has passed, whichever comes first. With zero deadline, computations
+// are passed through to the wrapped backend unchanged. Optionally, identical
+// positions in a batch are only evaluated once.
+std::unique_ptr<CoalescingBackend> CreateCoalescingBackend(
+    std::unique_ptr<Backend> wrapped, const OptionsDict& options);
+
+}  // namespace lczero
@@ -0,0 +1,58 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace lczero {
+
+// Compact form of the encoded input planes of one position, about a fifth of
+// the size of the (mask, value) pairs. Every history board is stored as the
+// piece on every square, the aux planes are stored as they are. Backends can
+// upload it as is and expand it to planes on the device.
+//
+// Doesn't use anything newer than C++14, so that it can be included in the
+// device code.
+struct CompactInputPlanes {
+  static constexpr int kBoards = 8;
+  static constexpr int kPiecePlanes = 12;
+  static constexpr int kAuxPlanes = 8;
+
+  // Pieces of every history board, two squares per byte, the lower nibble is
+  // for the even square. 0 is an empty square, 1 to 12 means that the square
+  // is set in the plane 0 to 11 of the board.
+  uint8_t pieces[kBoards][32];
+  // Bit i is set if the repetition plane (12) of the board i is set.
+  uint8_t repetitions;
+  uint8_t reserved[7];
+  uint64_t aux_masks[kAuxPlanes];
+  float aux_values[kAuxPlanes];
+};
+
+}  // namespace lczero
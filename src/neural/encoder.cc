@@ -100,6 +100,21 @@ int ChooseTransform(const ChessBoard& board) {
   }
   return transform;
 }
+
+uint64_t TransformMask(uint64_t v, int transform) {
+  if ((transform & FlipTransform) != 0) v = ReverseBitsInBytes(v);
+  if ((transform & MirrorTransform) != 0) v = ReverseBytesInBytes(v);
+  if ((transform & TransposeTransform) != 0) v = TransposeBitsInBytes(v);
+  return v;
+}
+
+// Inverse of TransformMask().
+uint64_t UntransformMask(uint64_t v, int transform) {
+  if ((transform & TransposeTransform) != 0) v = TransposeBitsInBytes(v);
+  if ((transform & MirrorTransform) != 0) v = ReverseBytesInBytes(v);
+  if ((transform & FlipTransform) != 0) v = ReverseBitsInBytes(v);
+  return v;
+}
 }  // namespace
 
 bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format) {
@@ -226,6 +241,13 @@ InputPlanes EncodePositionForNN(
     if (stop_early) {
       castlings = board.castlings();
     }
+    // The history planes are transformed as they are encoded below.
+    if (transform != NoTransform) {
+      uint64_t masks[5];
+      for (int i = 0; i < 5; ++i) masks[i] = result[kAuxPlaneBase + i].mask;
+      TransformBitBoards(masks, 5, transform);
+      for (int i = 0; i < 5; ++i) result[kAuxPlaneBase + i].mask = masks[i];
+    }
   }
   bool skip_non_repeats =
       input_format ==
@@ -273,19 +295,21 @@ InputPlanes EncodePositionForNN(
     }
 
     const int base = i * kPlanesPerBoard;
-    result[base + 0].mask = (board.ours() & board.pawns()).as_int();
-    result[base + 1].mask = (board.ours() & board.knights()).as_int();
-    result[base + 2].mask = (board.ours() & board.bishops()).as_int();
-    result[base + 3].mask = (board.ours() & board.rooks()).as_int();
-    result[base + 4].mask = (board.ours() & board.queens()).as_int();
-    result[base + 5].mask = (board.ours() & board.kings()).as_int();
-
-    result[base + 6].mask = (board.theirs() & board.pawns()).as_int();
-    result[base + 7].mask = (board.theirs() & board.knights()).as_int();
-    result[base + 8].mask = (board.theirs() & board.bishops()).as_int();
-    result[base + 9].mask = (board.theirs() & board.rooks()).as_int();
-    result[base + 10].mask = (board.theirs() & board.queens()).as_int();
-    result[base + 11].mask = (board.theirs() & board.kings()).as_int();
+    uint64_t masks[kPlanesPerBoard - 1] = {
+        (board.ours() & board.pawns()).as_int(),
+        (board.ours() & board.knights()).as_int(),
+        (board.ours() & board.bishops()).as_int(),
+        (board.ours() & board.rooks()).as_int(),
+        (board.ours() & board.queens()).as_int(),
+        (board.ours() & board.kings()).as_int(),
+
+        (board.theirs() & board.pawns()).as_int(),
+        (board.theirs() & board.knights()).as_int(),
+        (board.theirs() & board.bishops()).as_int(),
+        (board.theirs() & board.rooks()).as_int(),
+        (board.theirs() & board.queens()).as_int(),
+        (board.theirs() & board.kings()).as_int(),
+    };
 
     if (repetitions >= 1) result[base + 12].SetAll();
 
@@ -294,35 +318,22 @@ InputPlanes EncodePositionForNN(
     if (history_idx < 0 && !board.en_passant().empty()) {
       const auto idx = GetLowestBit(board.en_passant().as_int());
       if (idx < 8) {  // "Us" board
-        result[base + 0].mask +=
-            ((0x0000000000000100ULL - 0x0000000001000000ULL) << idx);
+        masks[0] += ((0x0000000000000100ULL - 0x0000000001000000ULL) << idx);
       } else {
-        result[base + 6].mask +=
+        masks[6] +=
             ((0x0001000000000000ULL - 0x0000000100000000ULL) << (idx - 56));
       }
     }
+    // The repetitions plane is all ones or zeros, and is not transformed.
+    TransformBitBoards(masks, kPlanesPerBoard - 1, transform);
+    for (int j = 0; j < kPlanesPerBoard - 1; ++j) {
+      result[base + j].mask = masks[j];
+    }
     if (history_idx > 0) flip = !flip;
     // If no capture no pawn is 0, the previous was start of game, capture or
     // pawn push, so no need to go back further if stopping early.
     if (stop_early && position.GetRule50Ply() == 0) break;
   }
-  if (transform != NoTransform) {
-    // Transform all masks.
-    for (int i = 0; i <= kAuxPlaneBase + 4; i++) {
-      auto v = result[i].mask;
-      if (v == 0 || v == ~0ULL) continue;
-      if ((transform & FlipTransform) != 0) {
-        v = ReverseBitsInBytes(v);
-      }
-      if ((transform & MirrorTransform) != 0) {
-        v = ReverseBytesInBytes(v);
-      }
-      if ((transform & TransposeTransform) != 0) {
-        v = TransposeBitsInBytes(v);
-      }
-      result[i].mask = v;
-    }
-  }
   if (transform_out) *transform_out = transform;
   return result;
 }
@@ -335,6 +346,119 @@ InputPlanes EncodePositionForNN(
                              history_planes, fill_empty_history, transform_out);
 }
 
+InputPlanes EncodePositionForNNIncremental(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const Position> history, const InputPlanes& parent_planes,
+    int parent_transform, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out) {
+  if (history.size() < 2 || history_planes != kMoveHistory) {
+    return EncodePositionForNN(input_format, history, history_planes,
+                               fill_empty_history, transform_out);
+  }
+  // The last position and the aux planes are encoded as usual.
+  int transform;
+  InputPlanes result = EncodePositionForNN(
+      input_format, history.last(1), 1, fill_empty_history, &transform);
+  if (transform_out) *transform_out = transform;
+
+  // The rest of the history is the history of the parent, seen from the other
+  // side, unless the full encoding would stop or skip positions where the
+  // encoding of the parent didn't. See the loop in EncodePositionForNN().
+  const Position& position = history.back();
+  const Position& parent = history[history.size() - 2];
+  ChessBoard parent_board = parent.GetBoard();
+  parent_board.Mirror();
+  int parent_block = 0;
+  if (IsCanonicalFormat(input_format)) {
+    if (position.GetRule50Ply() == 0) return result;
+    if (parent_board.castlings().as_int() !=
+        position.GetBoard().castlings().as_int()) {
+      return result;
+    }
+    if (!parent_board.en_passant().empty()) return result;
+    const bool skip_non_repeats =
+        input_format ==
+            pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2 ||
+        input_format == pblczero::NetworkFormat::
+                            INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON;
+    if (skip_non_repeats && parent.GetRepetitions() == 0) {
+      if (parent.GetRule50Ply() == 0) return result;
+      parent_block = 1;
+    }
+  }
+
+  for (int i = 1; i < kMoveHistory && parent_block < kMoveHistory;
+       ++i, ++parent_block) {
+    const int base = i * kPlanesPerBoard;
+    const int parent_base = parent_block * kPlanesPerBoard;
+    for (int j = 0; j < kPlanesPerBoard; ++j) {
+      // Our and their pieces swap places.
+      const int parent_plane = j < 12 ? parent_base + (j + 6) % 12
+                                      : parent_base + j;
+      uint64_t v = parent_planes[parent_plane].mask;
+      if (v != 0 && v != ~0ULL) {
+        v = UntransformMask(v, parent_transform);
+        v = TransformMask(ReverseBytesInBytes(v), transform);
+      }
+      result[base + j].mask = v;
+    }
+  }
+  return result;
+}
+
+static_assert(CompactInputPlanes::kBoards == kMoveHistory);
+static_assert(CompactInputPlanes::kPiecePlanes + 1 == kPlanesPerBoard);
+static_assert(kAuxPlaneBase + CompactInputPlanes::kAuxPlanes == kInputPlanes);
+
+CompactInputPlanes CompactifyInputPlanes(const InputPlanes& planes) {
+  CompactInputPlanes result{};
+  for (int board = 0; board < kMoveHistory; ++board) {
+    const int base = board * kPlanesPerBoard;
+    uint64_t occupied = 0;
+    for (int plane = 0; plane < CompactInputPlanes::kPiecePlanes; ++plane) {
+      const InputPlane& input = planes[base + plane];
+      if (input.mask == 0) continue;
+      if ((occupied & input.mask) != 0 || input.value != 1.0f) {
+        throw Exception("Input planes can't be stored in the compact form");
+      }
+      occupied |= input.mask;
+      for (auto square : IterateBits(input.mask)) {
+        result.pieces[board][square / 2] |= (plane + 1)
+                                            << (square % 2 * 4);
+      }
+    }
+    const InputPlane& repetition = planes[base + 12];
+    if (repetition.mask == ~0ULL && repetition.value == 1.0f) {
+      result.repetitions |= 1 << board;
+    } else if (repetition.mask != 0) {
+      throw Exception("Input planes can't be stored in the compact form");
+    }
+  }
+  for (int i = 0; i < CompactInputPlanes::kAuxPlanes; ++i) {
+    result.aux_masks[i] = planes[kAuxPlaneBase + i].mask;
+    result.aux_values[i] = planes[kAuxPlaneBase + i].value;
+  }
+  return result;
+}
+
+InputPlanes ExpandCompactInputPlanes(const CompactInputPlanes& compact) {
+  InputPlanes result(kInputPlanes);
+  for (int board = 0; board < kMoveHistory; ++board) {
+    const int base = board * kPlanesPerBoard;
+    for (int square = 0; square < 64; ++square) {
+      const int piece =
+          (compact.pieces[board][square / 2] >> (square % 2 * 4)) & 0xF;
+      if (piece != 0) result[base + piece - 1].mask |= 1ULL << square;
+    }
+    if (compact.repetitions & (1 << board)) result[base + 12].SetAll();
+  }
+  for (int i = 0; i < CompactInputPlanes::kAuxPlanes; ++i) {
+    result[kAuxPlaneBase + i].mask = compact.aux_masks[i];
+    result[kAuxPlaneBase + i].value = compact.aux_values[i];
+  }
+  return result;
+}
+
 namespace {
 const char* kMoveStrs[] = {
     "a1b1",  "a1c1",  "a1d1",  "a1e1",  "a1f1",  "a1g1",  "a1h1",  "a1a2",
@@ -30,6 +30,7 @@
 #include <span>
 
 #include "chess/position.h"
+#include "neural/compact_input.h"
 #include "neural/network.h"
 #include "proto/net.pb.h"
 
@@ -56,6 +57,24 @@ InputPlanes EncodePositionForNN(
     std::span<const Position> positions, int history_planes,
     FillEmptyHistory fill_empty_history, int* transform_out);
 
+// Same as EncodePositionForNN(), but reuses @parent_planes, which must be the
+// encoding (with @parent_transform) of the same history without the last
+// position. Only the last position is encoded from scratch, the rest of the
+// history planes are taken from the parent.
+InputPlanes EncodePositionForNNIncremental(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const Position> history, const InputPlanes& parent_planes,
+    int parent_transform, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out);
+
+// Converts the encoded input planes to the compact form. Throws if they can't
+// be represented in it, which doesn't happen with the encoding of any input
+// format.
+CompactInputPlanes CompactifyInputPlanes(const InputPlanes& planes);
+// Converts the compact form back to input planes. The reference of what the
+// backends do on the device.
+InputPlanes ExpandCompactInputPlanes(const CompactInputPlanes& compact);
+
 bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format);
 bool IsCanonicalArmageddonFormat(
     pblczero::NetworkFormat::InputFormat input_format);
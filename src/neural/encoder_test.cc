@@ -20,6 +20,8 @@
 
 #include <gtest/gtest.h>
 
+#include <random>
+
 namespace lczero {
 
 auto kAllSquaresMask = std::numeric_limits<std::uint64_t>::max();
@@ -531,10 +533,107 @@ TEST(EncodePositionForNN, EncodeEarlyGameFlipFormat3) {
   EXPECT_EQ(their_king_plane.value, 1.0f);
 }
 
+TEST(EncodePositionForNN, IncrementalEncodingMatchesFullEncoding) {
+  using NF = pblczero::NetworkFormat;
+  const NF::InputFormat formats[] = {
+      NF::INPUT_CLASSICAL_112_PLANE,
+      NF::INPUT_112_WITH_CASTLING_PLANE,
+      NF::INPUT_112_WITH_CANONICALIZATION,
+      NF::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES,
+      NF::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON,
+      NF::INPUT_112_WITH_CANONICALIZATION_V2,
+      NF::INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON};
+  const FillEmptyHistory fills[] = {FillEmptyHistory::NO,
+                                    FillEmptyHistory::FEN_ONLY,
+                                    FillEmptyHistory::ALWAYS};
+  // With castlings, with pawns only and without pawns, to have different
+  // transforms.
+  const char* fens[] = {ChessBoard::kStartposFen,
+                        "4k3/pppppppp/8/8/8/8/PPPPPPPP/4K3 w - - 0 1",
+                        "4k3/8/8/3q4/8/8/2R5/4K3 w - - 0 1",
+                        "r3k2r/1p4p1/8/2pP4/8/8/6P1/R3K2R w KQkq c6 0 1"};
+  std::mt19937 gen(3);
+  for (const char* fen : fens) {
+    for (int game = 0; game < 10; ++game) {
+      ChessBoard board;
+      int rule50;
+      int moves;
+      PositionHistory history;
+      board.SetFromFen(fen, &rule50, &moves);
+      history.Reset(board, rule50, moves);
+      for (int ply = 0; ply < 80; ++ply) {
+        const MoveList legal_moves =
+            history.Last().GetBoard().GenerateLegalMoves();
+        if (legal_moves.empty()) break;
+        std::vector<std::pair<InputPlanes, int>> parents;
+        for (const auto format : formats) {
+          for (const auto fill : fills) {
+            int transform;
+            auto planes =
+                EncodePositionForNN(format, history, 8, fill, &transform);
+            parents.emplace_back(std::move(planes), transform);
+          }
+        }
+        history.Append(legal_moves[gen() % legal_moves.size()]);
+        auto parent = parents.begin();
+        for (const auto format : formats) {
+          for (const auto fill : fills) {
+            int transform;
+            const InputPlanes expected =
+                EncodePositionForNN(format, history, 8, fill, &transform);
+            int incremental_transform;
+            const InputPlanes planes = EncodePositionForNNIncremental(
+                format, history.GetPositions(), parent->first, parent->second,
+                8, fill, &incremental_transform);
+            ++parent;
+            EXPECT_EQ(incremental_transform, transform);
+            ASSERT_EQ(planes.size(), expected.size());
+            for (size_t i = 0; i < planes.size(); ++i) {
+              EXPECT_EQ(planes[i].mask, expected[i].mask)
+                  << "plane " << i << " format " << format << " ply " << ply;
+              EXPECT_EQ(planes[i].value, expected[i].value);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(EncodePositionForNN, CompactInputPlanesRoundTrip) {
+  using NF = pblczero::NetworkFormat;
+  std::mt19937 gen(5);
+  for (const auto format :
+       {NF::INPUT_CLASSICAL_112_PLANE, NF::INPUT_112_WITH_CASTLING_PLANE,
+        NF::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES,
+        NF::INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON}) {
+    PositionHistory history;
+    history.Reset(ChessBoard(ChessBoard::kStartposFen), 0, 1);
+    for (int ply = 0; ply < 60; ++ply) {
+      const InputPlanes planes =
+          EncodePositionForNN(format, history, 8, FillEmptyHistory::FEN_ONLY,
+                              nullptr);
+      const InputPlanes expanded =
+          ExpandCompactInputPlanes(CompactifyInputPlanes(planes));
+      ASSERT_EQ(expanded.size(), planes.size());
+      for (size_t i = 0; i < planes.size(); ++i) {
+        // The value doesn't matter when the mask is empty.
+        EXPECT_EQ(expanded[i].mask, planes[i].mask) << "plane " << i;
+        if (planes[i].mask != 0) {
+          EXPECT_EQ(expanded[i].value, planes[i].value) << "plane " << i;
+        }
+      }
+      const MoveList legal_moves =
+          history.Last().GetBoard().GenerateLegalMoves();
+      if (legal_moves.empty()) break;
+      history.Append(legal_moves[gen() % legal_moves.size()]);
+    }
+  }
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
@@ -33,7 +33,10 @@
 #include <cassert>
 #include <cctype>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <span>
 #include <sstream>
 #include <string>
 
@@ -41,68 +44,32 @@
 #include "proto/net.pb.h"
 #include "utils/commandline.h"
 #include "utils/exception.h"
+#include "utils/files.h"
 #include "utils/filesystem.h"
 #include "utils/optionsdict.h"
 #include "version.h"
 
-#ifdef _WIN32
-#include <io.h>
-#else
-#include <unistd.h>
-#endif
-
 namespace lczero {
 
 namespace {
 const std::uint32_t kWeightMagic = 0x1c0;
 
-std::string DecompressGzip(const std::string& filename) {
-  const int kStartingSize = 8 * 1024 * 1024;  // 8M
-  std::string buffer;
-  buffer.resize(kStartingSize);
-  int bytes_read = 0;
-
-  // Read whole file into a buffer.
-  FILE* fp = fopen(filename.c_str(), "rb");
-  if (!fp) {
-    throw Exception("Cannot read weights from " + filename);
-  }
-  if (filename == CommandLine::BinaryName()) {
-    // The network file should be appended at the end of the lc0 executable,
-    // followed by the network file size and a "Lc0!" (0x2130634c) magic.
-    int32_t size, magic;
-    if (fseek(fp, -8, SEEK_END) || fread(&size, 4, 1, fp) != 1 ||
-        fread(&magic, 4, 1, fp) != 1 || magic != 0x2130634c) {
-      fclose(fp);
-      throw Exception("No embedded file detected.");
-    }
-    fseek(fp, -size - 8, SEEK_END);
-  }
-  fflush(fp);
-  gzFile file = gzdopen(dup(fileno(fp)), "rb");
-  fclose(fp);
-  if (!file) {
-    throw Exception("Cannot process file " + filename);
-  }
-  while (true) {
-    const int sz =
-        gzread(file, &buffer[bytes_read], buffer.size() - bytes_read);
-    if (sz < 0) {
-      int errnum;
-      throw Exception(gzerror(file, &errnum));
-    }
-    if (sz == static_cast<int>(buffer.size()) - bytes_read) {
-      bytes_read = buffer.size();
-      buffer.resize(buffer.size() * 2);
-    } else {
-      bytes_read += sz;
-      buffer.resize(bytes_read);
-      break;
-    }
+// Returns the weights part of the file, which is the whole file unless the
+// weights are embedded into the lc0 binary.
+std::span<const uint8_t> GetWeightsData(const std::string& filename,
+                                        std::span<const uint8_t> data) {
+  if (filename != CommandLine::BinaryName()) return data;
+  // The network file should be appended at the end of the lc0 executable,
+  // followed by the network file size and a "Lc0!" (0x2130634c) magic.
+  int32_t size, magic;
+  if (data.size() < 8) throw Exception("No embedded file detected.");
+  std::memcpy(&size, data.data() + data.size() - 8, 4);
+  std::memcpy(&magic, data.data() + data.size() - 4, 4);
+  if (magic != 0x2130634c || size < 0 ||
+      static_cast<size_t>(size) > data.size() - 8) {
+    throw Exception("No embedded file detected.");
   }
-  gzclose(file);
-
-  return buffer;
+  return data.subspan(data.size() - 8 - size, size);
 }
 
 void FixOlderWeightsFile(WeightsFile* file) {
@@ -157,7 +124,7 @@ void FixOlderWeightsFile(WeightsFile* file) {
   }
 }
 
-WeightsFile ParseWeightsProto(const std::string& buffer) {
+WeightsFile ParseWeightsProto(std::string_view buffer) {
   WeightsFile net;
   net.ParseFromString(buffer);
 
@@ -192,8 +159,22 @@ WeightsFile ParseWeightsProto(const std::string& buffer) {
 }  // namespace
 
 WeightsFile LoadWeightsFromFile(const std::string& filename) {
-  FloatVectors vecs;
-  auto buffer = DecompressGzip(filename);
+  // Files are memory mapped, so uncompressed weights are parsed without
+  // reading them into a buffer first.
+  std::unique_ptr<MappedFile> file;
+  try {
+    file = std::make_unique<MappedFile>(filename);
+  } catch (const Exception&) {
+    throw Exception("Cannot read weights from " + filename);
+  }
+  const std::span<const uint8_t> data = GetWeightsData(filename, file->data());
+  std::string decompressed;
+  std::string_view buffer(reinterpret_cast<const char*>(data.data()),
+                          data.size());
+  if (data.size() >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+    decompressed = GunzipBuffer(data);
+    buffer = decompressed;
+  }
 
   if (buffer.size() < 2) {
     throw Exception("Invalid weight file: too small.");
@@ -210,13 +191,16 @@ WeightsFile LoadWeightsFromFile(const std::string& filename) {
   return ParseWeightsProto(buffer);
 }
 
-std::optional<WeightsFile> LoadWeights(std::string_view location) {
-  std::string net_path = std::string(location);
-  if (net_path == SharedBackendParams::kAutoDiscover) {
-    net_path = DiscoverWeightsFile();
-  } else if (net_path == SharedBackendParams::kEmbed) {
-    net_path = CommandLine::BinaryName();
+std::string ResolveWeightsLocation(std::string_view location) {
+  if (location == SharedBackendParams::kAutoDiscover) {
+    return DiscoverWeightsFile();
   }
+  if (location == SharedBackendParams::kEmbed) return CommandLine::BinaryName();
+  return std::string(location);
+}
+
+std::optional<WeightsFile> LoadWeights(std::string_view location) {
+  const std::string net_path = ResolveWeightsLocation(location);
   if (net_path.empty()) return std::nullopt;
   if (location == SharedBackendParams::kEmbed) {
     CERR << "Using embedded weights from binary: " << net_path;
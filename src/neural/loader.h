@@ -53,6 +53,10 @@ WeightsFile LoadWeightsFromFile(const std::string& filename);
 // Returns std::nullopt if no weights file was found in <autodiscover> mode.
 std::optional<WeightsFile> LoadWeights(std::string_view location);
 
+// Returns the file LoadWeights() reads for the "location", empty if no
+// weights file was found in <autodiscover> mode.
+std::string ResolveWeightsLocation(std::string_view location);
+
 // Tries to find a file which looks like a weights file, and located in
 // directory of binary_name or one of subdirectories. If there are several such
 // files, returns one which has the latest modification date.
@@ -27,9 +27,32 @@
 
 #include "neural/memcache.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "neural/loader.h"
+#include "neural/memory_budget.h"
 #include "neural/shared_params.h"
 #include "utils/atomic_vector.h"
 #include "utils/cache.h"
+#include "utils/clock_cache.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/fp16_utils.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+#include "utils/shm_table.h"
 #include "utils/smallarray.h"
 
 namespace lczero {
@@ -41,28 +64,312 @@ namespace {
 uint64_t ComputeEvalPositionHash(const EvalPosition& pos) {
   return pos.pos.back().Hash();
 }
+// Number of history positions ComputeEvalPositionHash() takes into account
+// (the role CacheHistoryLength plays for the search tree). It's a part of the
+// snapshot key, so that snapshots are dropped when the hashing changes.
+constexpr uint64_t kHashHistoryLength = 0;
+
+// Format in which the evaluations are stored in the cache.
+enum class CacheStorage {
+  kFp32,  // Everything as floats.
+  kFp16,  // Everything as halves.
+  kLog8,  // Q, D and M as halves, policy priors as 8-bit log-scaled values.
+};
+
+CacheStorage ParseCacheStorage(const std::string& storage) {
+  if (storage == "fp16") return CacheStorage::kFp16;
+  if (storage == "log8") return CacheStorage::kLog8;
+  assert(storage == "fp32");
+  return CacheStorage::kFp32;
+}
 
+// Evaluation packed into a single allocation: Q, D and M are followed by the
+// policy priors, all in the format given by CacheStorage.
 struct CachedValue {
-  float q;
-  float d;
-  float m;
-  uint8_t num_moves;
-  std::unique_ptr<float[]> p;
+  std::unique_ptr<uint8_t[]> data;
+  uint8_t num_moves = 0;
+  bool has_policy = false;
+};
+
+// 8-bit log-scaled priors: code c stands for exp(-c / kLog8Scale) and the
+// largest code stands for zero. The relative error is within 3.2% and the
+// smallest non-zero prior is about 1.3e-7.
+constexpr float kLog8Scale = 16.0f;
+constexpr int kLog8Zero = 255;
+
+uint8_t EncodeLog8(float p) {
+  if (!(p > 0.0f)) return kLog8Zero;
+  const float code = std::round(-std::log(p) * kLog8Scale);
+  return std::clamp(code, 0.0f, static_cast<float>(kLog8Zero));
+}
+
+float DecodeLog8(uint8_t code) {
+  static const auto kTable = []() {
+    std::array<float, 256> table;
+    for (int i = 0; i < 256; ++i) table[i] = std::exp(-i / kLog8Scale);
+    table[kLog8Zero] = 0.0f;
+    return table;
+  }();
+  return kTable[code];
+}
+
+template <class T>
+void Store(T x, uint8_t*& out) {
+  std::memcpy(out, &x, sizeof(T));
+  out += sizeof(T);
+}
+
+template <class T>
+T Load(const uint8_t*& in) {
+  T x;
+  std::memcpy(&x, in, sizeof(T));
+  in += sizeof(T);
+  return x;
+}
+
+// Size of CachedValue::data.
+size_t CachedValueSize(CacheStorage storage, size_t num_moves) {
+  const size_t value_size =
+      storage == CacheStorage::kFp32 ? sizeof(float) : sizeof(uint16_t);
+  const size_t prior_size = storage == CacheStorage::kFp32   ? sizeof(float)
+                            : storage == CacheStorage::kFp16 ? sizeof(uint16_t)
+                                                             : sizeof(uint8_t);
+  return 3 * value_size + num_moves * prior_size;
+}
+
+CachedValue EncodeCachedValue(CacheStorage storage, float q, float d, float m,
+                              std::span<const float> p, bool has_policy) {
+  CachedValue cv;
+  cv.num_moves = p.size();
+  cv.has_policy = has_policy;
+  cv.data.reset(new uint8_t[CachedValueSize(storage, p.size())]);
+  uint8_t* out = cv.data.get();
+  switch (storage) {
+    case CacheStorage::kFp32:
+      for (float x : {q, d, m}) Store(x, out);
+      for (float x : p) Store(x, out);
+      break;
+    case CacheStorage::kFp16:
+      for (float x : {q, d, m}) Store(FP32toFP16(x), out);
+      for (float x : p) Store(FP32toFP16(x), out);
+      break;
+    case CacheStorage::kLog8:
+      for (float x : {q, d, m}) Store(FP32toFP16(x), out);
+      for (float x : p) Store(EncodeLog8(x), out);
+      break;
+  }
+  return cv;
+}
+
+void CachedValueToEvalResult(CacheStorage storage, const CachedValue& cv,
+                             const EvalResultPtr& ptr) {
+  const uint8_t* in = cv.data.get();
+  float values[3];
+  for (float& x : values) {
+    x = storage == CacheStorage::kFp32 ? Load<float>(in)
+                                       : FP16toFP32(Load<uint16_t>(in));
+  }
+  if (ptr.q) *ptr.q = values[0];
+  if (ptr.d) *ptr.d = values[1];
+  if (ptr.m) *ptr.m = values[2];
+  switch (storage) {
+    case CacheStorage::kFp32:
+      for (float& x : ptr.p) x = Load<float>(in);
+      break;
+    case CacheStorage::kFp16:
+      for (float& x : ptr.p) x = FP16toFP32(Load<uint16_t>(in));
+      break;
+    case CacheStorage::kLog8:
+      for (float& x : ptr.p) x = DecodeLog8(Load<uint8_t>(in));
+      break;
+  }
+}
+
+// Snapshot file layout, all numbers in native byte order:
+//   header: magic, version, storage, key, number of entries;
+//   entry: hash, num_moves, has_policy, CachedValue::data.
+// The key identifies the network and the options that affect evaluations, the
+// snapshot is only loaded by a cache with the same key.
+constexpr uint32_t kSnapshotMagic = 0x434e4e4c;  // "LNNC"
+constexpr uint32_t kSnapshotVersion = 2;
+// Magic, version and storage; key and number of entries.
+constexpr size_t kSnapshotHeaderSize =
+    3 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+constexpr size_t kSnapshotEntryHeaderSize = sizeof(uint64_t) + 2;
+
+// Identifies the network by the resolved weights file and a hash of its
+// contents, as <autodiscover> and <built in> don't name the file, and the size
+// and time may match for different networks. The hash is only recomputed when
+// the file changes, the key is computed on every configuration update.
+uint64_t WeightsFingerprint(const std::string& location) {
+  const std::string path = ResolveWeightsLocation(location);
+  const uint64_t size = path.empty() ? 0 : GetFileSize(path);
+  // Backends without a weights file only depend on the options.
+  if (size == 0) return std::hash<std::string>{}(location);
+  const uint64_t time = GetFileTime(path);
+  struct Entry {
+    uint64_t size;
+    uint64_t time;
+    uint64_t hash;
+  };
+  static std::mutex mutex;
+  static std::unordered_map<std::string, Entry> fingerprints;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto iter = fingerprints.find(path);
+  if (iter != fingerprints.end() && iter->second.size == size &&
+      iter->second.time == time) {
+    return iter->second.hash;
+  }
+  const MappedFile file(path);
+  const std::span<const uint8_t> data = file.data();
+  const uint64_t hash = HashCat(
+      {std::hash<std::string>{}(path),
+       std::hash<std::string_view>{}(std::string_view(
+           reinterpret_cast<const char*>(data.data()), data.size()))});
+  fingerprints[path] = {size, time, hash};
+  return hash;
+}
+
+uint64_t ComputeSnapshotKey(const OptionsDict& options,
+                            CacheStorage storage) {
+  const float softmax_temp =
+      options.Get<float>(SharedBackendParams::kPolicySoftmaxTemp);
+  uint32_t softmax_temp_bits;
+  std::memcpy(&softmax_temp_bits, &softmax_temp, sizeof(softmax_temp_bits));
+  return HashCat(
+      {kSnapshotVersion, kHashHistoryLength, static_cast<uint64_t>(storage),
+       WeightsFingerprint(
+           options.Get<std::string>(SharedBackendParams::kWeightsId)),
+       softmax_temp_bits,
+       std::hash<std::string>{}(
+           options.Get<std::string>(SharedBackendParams::kHistoryFill))});
+}
+
+// Sometimes search queries NN without passing the legal moves. It is still
+// cached in this case, but in subsequent queries we only return it if legal
+// moves are not passed again. Otherwise check the size to guard against hash
+// collisions.
+bool IsCachedValueUsable(const CachedValue& cv, const EvalPosition& pos) {
+  return pos.legal_moves.empty() ||
+         (cv.has_policy && cv.num_moves == pos.legal_moves.size());
+}
+
+// Values in the host cache are CachedValue::data, tagged with the number of
+// moves and whether there is a policy. The table name has the snapshot key, so
+// that processes with different networks or options don't share values.
+uint32_t HostCacheTag(const CachedValue& cv) {
+  return cv.num_moves | (cv.has_policy ? 0x100 : 0);
+}
+
+std::string HostCacheName(uint64_t snapshot_key) {
+  char name[40];
+  std::snprintf(name, sizeof(name), "lc0-nncache-%016llx",
+                static_cast<unsigned long long>(snapshot_key));
+  return name;
+}
+
+// Returns false if the value doesn't look like one stored by a cache with the
+// same storage.
+bool HostValueToCachedValue(CacheStorage storage,
+                            const SharedMemoryTable::Value& value,
+                            CachedValue* cv) {
+  if (value.tag > 0x1ff) return false;
+  cv->num_moves = value.tag & 0xff;
+  cv->has_policy = value.tag & 0x100;
+  if (value.size != CachedValueSize(storage, cv->num_moves)) return false;
+  cv->data.reset(new uint8_t[value.size]);
+  std::memcpy(cv->data.get(), value.data, value.size);
+  return true;
+}
+
+// Entry of the per-thread direct-mapped cache which sits in front of the shared
+// one. It holds a copy of the value, so it's used without locks. Every MemCache
+// has a generation number (renewed when the cache is cleared), entries of other
+// generations are ignored.
+struct L1Entry {
+  uint64_t key = 0;
+  uint64_t generation = 0;
+  CachedValue value;
+  size_t data_capacity = 0;
 };
 
-void CachedValueToEvalResult(const CachedValue& cv, const EvalResultPtr& ptr) {
-  if (ptr.d) *ptr.d = cv.d;
-  if (ptr.q) *ptr.q = cv.q;
-  if (ptr.m) *ptr.m = cv.m;
-  std::copy(cv.p.get(), cv.p.get() + ptr.p.size(), ptr.p.begin());
+std::atomic<uint64_t> g_next_l1_generation = 1;
+thread_local std::vector<L1Entry> tls_l1_cache;
+
+// Returns the per-thread cache entry for the key, or nullptr if the per-thread
+// cache is disabled.
+L1Entry* GetL1Entry(uint64_t key, size_t l1_size) {
+  if (l1_size == 0) return nullptr;
+  if (tls_l1_cache.size() != l1_size) {
+    tls_l1_cache.clear();
+    tls_l1_cache.resize(l1_size);
+  }
+  return &tls_l1_cache[key % l1_size];
+}
+
+void StoreL1Entry(L1Entry* entry, uint64_t key, uint64_t generation,
+                  CacheStorage storage, const CachedValue& cv) {
+  // Reuse the allocation, as entries are overwritten all the time.
+  const size_t size = CachedValueSize(storage, cv.num_moves);
+  if (entry->data_capacity < size) {
+    entry->value.data.reset(new uint8_t[size]);
+    entry->data_capacity = size;
+  }
+  std::memcpy(entry->value.data.get(), cv.data.get(), size);
+  entry->value.num_moves = cv.num_moves;
+  entry->value.has_policy = cv.has_policy;
+  entry->key = key;
+  entry->generation = generation;
+}
+
+// Accessors that let MemCache use all cache types the same way.
+using FifoCache = ShardedHashKeyedCache<CachedValue>;
+
+template <class F>
+bool LookupCachedValue(FifoCache* cache, uint64_t key, F&& fn) {
+  HashKeyedCacheLock<CachedValue> lock(cache->GetShard(key), key);
+  return lock.holds_value() && fn(**lock);
+}
+
+template <class F>
+bool LookupCachedValue(ClockCache<CachedValue>* cache, uint64_t key, F&& fn) {
+  return cache->Lookup(key, std::forward<F>(fn));
+}
+
+void InsertCachedValue(FifoCache* cache, uint64_t key, CachedValue&& value) {
+  cache->Insert(key, std::make_unique<CachedValue>(std::move(value)));
 }
 
+void InsertCachedValue(ClockCache<CachedValue>* cache, uint64_t key,
+                       CachedValue&& value) {
+  cache->Insert(key, std::move(value));
+}
+
+template <class Cache>
+class MemCacheComputation;
+
+template <class Cache>
 class MemCache : public CachingBackend {
  public:
   MemCache(std::unique_ptr<Backend> wrapped, const OptionsDict& options)
       : wrapped_backend_(std::move(wrapped)),
-        cache_(options.Get<int>(SharedBackendParams::kNNCacheSizeId)),
-        max_batch_size_(wrapped_backend_->GetAttributes().maximum_batch_size) {}
+        cache_type_(
+            options.Get<std::string>(SharedBackendParams::kNNCacheTypeId)),
+        cache_(GetMemoryBudget(options).nn_cache_entries),
+        storage_(ParseCacheStorage(
+            options.Get<std::string>(SharedBackendParams::kNNCacheStorageId))),
+        max_batch_size_(wrapped_backend_->GetAttributes().maximum_batch_size) {
+    if constexpr (std::is_same_v<Cache, FifoCache>) {
+      cache_.SetNumShards(
+          options.Get<int>(SharedBackendParams::kNNCacheShardsId));
+    }
+    snapshot_key_ = ComputeSnapshotKey(options, storage_);
+    l1_size_.store(options.Get<int>(SharedBackendParams::kNNCacheL1SizeId));
+    InvalidateL1();
+    OpenHostCache(options);
+  }
+
+  ~MemCache() override { StopLoading(); }
 
   BackendAttributes GetAttributes() const override {
     return wrapped_backend_->GetAttributes();
@@ -70,16 +377,63 @@ class MemCache : public CachingBackend {
   std::unique_ptr<BackendComputation> CreateComputation() override;
   std::optional<EvalResult> GetCachedEvaluation(const EvalPosition&) override;
 
-  void ClearCache() override { cache_.Clear(); }
+  // The host cache is shared with other processes, so it's left as is.
+  void ClearCache() override {
+    StopLoading();
+    cache_.Clear();
+    InvalidateL1();
+    const CacheStats stats = GetCacheStats();
+    LOGFILE << "NN cache lookups: " << stats.l1_hits << " per-thread hits, "
+            << stats.l2_hits << " shared hits, " << stats.host_hits
+            << " host hits, " << stats.misses << " misses.";
+    l1_hits_.store(0, std::memory_order_relaxed);
+    l2_hits_.store(0, std::memory_order_relaxed);
+    host_hits_.store(0, std::memory_order_relaxed);
+    misses_.store(0, std::memory_order_relaxed);
+  }
+
+  CacheStats GetCacheStats() const override {
+    return {.l1_hits = l1_hits_.load(std::memory_order_relaxed),
+            .l2_hits = l2_hits_.load(std::memory_order_relaxed),
+            .host_hits = host_hits_.load(std::memory_order_relaxed),
+            .misses = misses_.load(std::memory_order_relaxed),
+            .entries = static_cast<uint64_t>(cache_.GetSize()),
+            .capacity = static_cast<uint64_t>(cache_.GetCapacity())};
+  }
 
   UpdateConfigurationResult UpdateConfiguration(
       const OptionsDict& options) override {
     auto ret = wrapped_backend_->UpdateConfiguration(options);
+    if (cache_type_ !=
+        options.Get<std::string>(SharedBackendParams::kNNCacheTypeId)) {
+      return NEED_RESTART;
+    }
     if (ret == Backend::UPDATE_OK) {
       // Check if we need to clear the cache.
       if (!wrapped_backend_->IsSameConfiguration(options)) {
+        StopLoading();
+        cache_.Clear();
+        InvalidateL1();
+      }
+      if constexpr (std::is_same_v<Cache, FifoCache>) {
+        const int num_shards =
+            options.Get<int>(SharedBackendParams::kNNCacheShardsId);
+        if (num_shards != cache_.GetNumShards()) {
+          StopLoading();
+          cache_.SetNumShards(num_shards);
+        }
+      }
+      const CacheStorage storage = ParseCacheStorage(
+          options.Get<std::string>(SharedBackendParams::kNNCacheStorageId));
+      if (storage != storage_) {
+        StopLoading();
         cache_.Clear();
+        InvalidateL1();
+        storage_ = storage;
       }
+      snapshot_key_ = ComputeSnapshotKey(options, storage_);
+      l1_size_.store(options.Get<int>(SharedBackendParams::kNNCacheL1SizeId));
+      OpenHostCache(options);
     }
     return ret;
   }
@@ -88,23 +442,142 @@ class MemCache : public CachingBackend {
     return wrapped_backend_->IsSameConfiguration(options);
   }
 
-  void SetCacheSize(size_t size) override { cache_.SetCapacity(size); }
+  void SetCacheSize(size_t size) override {
+    if (static_cast<int>(size) != cache_.GetCapacity()) StopLoading();
+    cache_.SetCapacity(size);
+  }
+
+  void SaveCache(const std::string& filename) override;
+  void LoadCache(const std::string& filename) override;
 
  private:
+  enum class LookupResult { kL1Hit, kL2Hit, kHostHit, kMiss };
+
+  // Looks the key up in the per-thread cache, then in the shared one and then
+  // in the host one, and calls @fn(const CachedValue&) for the value found. @fn
+  // returns whether the value is usable. Values found in a cache are copied
+  // into the ones before it.
+  template <class F>
+  LookupResult Lookup(uint64_t key, F&& fn) {
+    const uint64_t generation = l1_generation_.load(std::memory_order_relaxed);
+    L1Entry* l1 = GetL1Entry(key, l1_size_.load(std::memory_order_relaxed));
+    if (l1 && l1->generation == generation && l1->key == key &&
+        fn(std::as_const(l1->value))) {
+      return LookupResult::kL1Hit;
+    }
+    if (LookupCachedValue(&cache_, key, [&](const CachedValue& cv) {
+          if (!fn(cv)) return false;
+          if (l1) StoreL1Entry(l1, key, generation, storage_, cv);
+          return true;
+        })) {
+      return LookupResult::kL2Hit;
+    }
+    if (host_cache_) {
+      SharedMemoryTable::Value value;
+      CachedValue cv;
+      if (host_cache_->Lookup(key, &value) &&
+          HostValueToCachedValue(storage_, value, &cv) &&
+          fn(std::as_const(cv))) {
+        if (l1) StoreL1Entry(l1, key, generation, storage_, cv);
+        InsertCachedValue(&cache_, key, std::move(cv));
+        return LookupResult::kHostHit;
+      }
+    }
+    return LookupResult::kMiss;
+  }
+
+  // Inserts the freshly computed value into all the cache levels.
+  void Insert(uint64_t key, CachedValue&& cv) {
+    L1Entry* l1 = GetL1Entry(key, l1_size_.load(std::memory_order_relaxed));
+    if (l1) {
+      StoreL1Entry(l1, key, l1_generation_.load(std::memory_order_relaxed),
+                   storage_, cv);
+    }
+    if (host_cache_) {
+      host_cache_->Insert(
+          key, HostCacheTag(cv),
+          {cv.data.get(), CachedValueSize(storage_, cv.num_moves)});
+    }
+    InsertCachedValue(&cache_, key, std::move(cv));
+  }
+
+  // Opens the host cache for the current snapshot key, or closes it if it's
+  // disabled. Works without it if shared memory is not available.
+  void OpenHostCache(const OptionsDict& options) {
+    const size_t size = static_cast<size_t>(options.Get<int>(
+                            SharedBackendParams::kNNCacheHostSizeId))
+                        << 20;
+    if (size == host_cache_size_ && snapshot_key_ == host_cache_key_) return;
+    host_cache_.reset();
+    host_cache_size_ = size;
+    host_cache_key_ = snapshot_key_;
+    if (size == 0) return;
+    try {
+      host_cache_ = std::make_unique<SharedMemoryTable>(
+          HostCacheName(snapshot_key_), size);
+      LOGFILE << "NN host cache " << HostCacheName(snapshot_key_) << " has "
+              << host_cache_->num_slots() << " slots.";
+    } catch (const Exception& e) {
+      CERR << "NN host cache is disabled: " << e.what();
+    }
+  }
+
+  void InvalidateL1() {
+    l1_generation_.store(g_next_l1_generation.fetch_add(1));
+  }
+
+  void AddStats(const CacheStats& stats) {
+    l1_hits_.fetch_add(stats.l1_hits, std::memory_order_relaxed);
+    l2_hits_.fetch_add(stats.l2_hits, std::memory_order_relaxed);
+    host_hits_.fetch_add(stats.host_hits, std::memory_order_relaxed);
+    misses_.fetch_add(stats.misses, std::memory_order_relaxed);
+  }
+
+  // Aborts loading the snapshot if it's still in progress. Must be called
+  // before the operations on the cache which are not thread-safe.
+  void StopLoading() {
+    if (!loader_thread_.joinable()) return;
+    abort_loading_.store(true, std::memory_order_relaxed);
+    loader_thread_.join();
+  }
+
   std::unique_ptr<Backend> wrapped_backend_;
-  HashKeyedCache<CachedValue> cache_;
+  const std::string cache_type_;
+  Cache cache_;
+  CacheStorage storage_;
+  uint64_t snapshot_key_;
   const size_t max_batch_size_;
-  friend class MemCacheComputation;
+  std::unique_ptr<SharedMemoryTable> host_cache_;
+  size_t host_cache_size_ = 0;
+  uint64_t host_cache_key_ = 0;
+  std::thread loader_thread_;
+  std::atomic<bool> abort_loading_ = false;
+  std::atomic<uint64_t> l1_generation_ = 0;
+  std::atomic<int> l1_size_ = 0;
+  std::atomic<uint64_t> l1_hits_ = 0;
+  std::atomic<uint64_t> l2_hits_ = 0;
+  std::atomic<uint64_t> host_hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+  friend class MemCacheComputation<Cache>;
 };
 
+template <class Cache>
 class MemCacheComputation : public BackendComputation {
  public:
   MemCacheComputation(std::unique_ptr<BackendComputation> wrapped_computation,
-                      MemCache* memcache)
+                      MemCache<Cache>* memcache)
       : wrapped_computation_(std::move(wrapped_computation)),
         memcache_(memcache),
         entries_(memcache->max_batch_size_) {}
 
+  ~MemCacheComputation() override {
+    memcache_->AddStats({.l1_hits = l1_hits_.load(std::memory_order_relaxed),
+                         .l2_hits = l2_hits_.load(std::memory_order_relaxed),
+                         .host_hits =
+                             host_hits_.load(std::memory_order_relaxed),
+                         .misses = entries_.size()});
+  }
+
  private:
   size_t UsedBatchSize() const override {
     return wrapped_computation_->UsedBatchSize();
@@ -112,82 +585,250 @@ class MemCacheComputation : public BackendComputation {
   virtual AddInputResult AddInput(const EvalPosition& pos,
                                   EvalResultPtr result) override {
     assert(pos.legal_moves.size() == result.p.size() || result.p.empty());
+    if (!policy_required_) result.p = {};
     const uint64_t hash = ComputeEvalPositionHash(pos);
-    {
-      HashKeyedCacheLock<CachedValue> lock(&memcache_->cache_, hash);
-      // Sometimes search queries NN without passing the legal moves. It is
-      // still cached in this case, but in subsequent queries we only return it
-      // if legal moves are not passed again. Otherwise check the size to guard
-      // against hash collisions.
-      if (lock.holds_value() &&
-          (pos.legal_moves.empty() ||
-           (lock->p && lock->num_moves == pos.legal_moves.size()))) {
-        CachedValueToEvalResult(**lock, result);
+    switch (memcache_->Lookup(hash, [&](const CachedValue& cv) {
+      if (policy_required_ && !IsCachedValueUsable(cv, pos)) return false;
+      CachedValueToEvalResult(memcache_->storage_, cv, result);
+      return true;
+    })) {
+      case MemCache<Cache>::LookupResult::kL1Hit:
+        l1_hits_.fetch_add(1, std::memory_order_relaxed);
         return AddInputResult::FETCHED_IMMEDIATELY;
+      case MemCache<Cache>::LookupResult::kL2Hit:
+        l2_hits_.fetch_add(1, std::memory_order_relaxed);
+        return AddInputResult::FETCHED_IMMEDIATELY;
+      case MemCache<Cache>::LookupResult::kHostHit:
+        host_hits_.fetch_add(1, std::memory_order_relaxed);
+        return AddInputResult::FETCHED_IMMEDIATELY;
+      case MemCache<Cache>::LookupResult::kMiss:
+        break;
+    }
+    const size_t entry_idx =
+        entries_.emplace_back(Entry{.key = hash, .result_ptr = result});
+    Entry& entry = entries_[entry_idx];
+    entry.has_policy = policy_required_ && !pos.legal_moves.empty();
+    if (entry.has_policy) {
+      // Policy goes directly to the caller's buffer when there is one.
+      const size_t num_moves = pos.legal_moves.size();
+      if (result.p.size() == num_moves) {
+        entry.p = result.p;
+      } else {
+        entry.p_buffer.reset(new float[num_moves]);
+        entry.p = std::span<float>(entry.p_buffer.get(), num_moves);
       }
     }
-    size_t entry_idx = entries_.emplace_back(
-        Entry{hash, std::make_unique<CachedValue>(), result});
-    auto& value = entries_[entry_idx].value;
-    value->p.reset(pos.legal_moves.empty() ? nullptr
-                                           : new float[pos.legal_moves.size()]);
-    value->num_moves = pos.legal_moves.size();
     return wrapped_computation_->AddInput(
-        pos, EvalResultPtr{&value->q, &value->d, &value->m,
-                           value->p ? std::span<float>{value->p.get(),
-                                                       pos.legal_moves.size()}
-                                    : std::span<float>{}});
+        pos, EvalResultPtr{&entry.q, &entry.d, &entry.m, entry.p});
   }
 
   virtual void ComputeBlocking() override {
     wrapped_computation_->ComputeBlocking();
+    PopulateResults();
+  }
+
+  virtual void ComputeAsync() override { wrapped_computation_->ComputeAsync(); }
+
+  virtual bool IsReady() const override {
+    return wrapped_computation_->IsReady();
+  }
+
+  virtual void Wait() override {
+    wrapped_computation_->Wait();
+    PopulateResults();
+  }
+
+  virtual void SetPriority(ComputationPriority priority) override {
+    wrapped_computation_->SetPriority(priority);
+  }
+
+  // Entries without policy are cached as such, but the moves left head is
+  // still computed so that cached values are complete.
+  virtual void SetRequiredHeads(EvalHeads heads) override {
+    policy_required_ = heads.policy;
+    wrapped_computation_->SetRequiredHeads(
+        EvalHeads{.policy = heads.policy, .moves_left = true});
+  }
+
+  void PopulateResults() {
     for (auto& entry : entries_) {
-      CachedValueToEvalResult(*entry.value, entry.result_ptr);
-      memcache_->cache_.Insert(entry.key, std::move(entry.value));
+      const EvalResultPtr& result = entry.result_ptr;
+      if (result.q) *result.q = entry.q;
+      if (result.d) *result.d = entry.d;
+      if (result.m) *result.m = entry.m;
+      if (!result.p.empty() && result.p.data() != entry.p.data()) {
+        std::copy(entry.p.begin(), entry.p.end(), result.p.begin());
+      }
+      memcache_->Insert(entry.key, EncodeCachedValue(memcache_->storage_,
+                                                     entry.q, entry.d, entry.m,
+                                                     entry.p, entry.has_policy));
     }
   }
 
   struct Entry {
-    uint64_t key;
-    std::unique_ptr<CachedValue> value;
-    EvalResultPtr result_ptr;
+    uint64_t key = 0;
+    float q = 0.0f;
+    float d = 0.0f;
+    float m = 0.0f;
+    bool has_policy = false;
+    // Where the wrapped computation writes the policy to. Either the caller's
+    // buffer, or p_buffer if the caller didn't pass one.
+    std::span<float> p = {};
+    std::unique_ptr<float[]> p_buffer = nullptr;
+    EvalResultPtr result_ptr = {};
   };
 
   std::unique_ptr<BackendComputation> wrapped_computation_;
-  MemCache* memcache_;
+  MemCache<Cache>* memcache_;
   AtomicVector<Entry> entries_;
+  bool policy_required_ = true;
+  std::atomic<uint64_t> l1_hits_ = 0;
+  std::atomic<uint64_t> l2_hits_ = 0;
+  std::atomic<uint64_t> host_hits_ = 0;
 };
 
-std::unique_ptr<BackendComputation> MemCache::CreateComputation() {
-  return std::make_unique<MemCacheComputation>(
+template <class Cache>
+std::unique_ptr<BackendComputation> MemCache<Cache>::CreateComputation() {
+  return std::make_unique<MemCacheComputation<Cache>>(
       wrapped_backend_->CreateComputation(), this);
 }
-std::optional<EvalResult> MemCache::GetCachedEvaluation(
+
+template <class Cache>
+std::optional<EvalResult> MemCache<Cache>::GetCachedEvaluation(
     const EvalPosition& pos) {
   const uint64_t hash = ComputeEvalPositionHash(pos);
-  HashKeyedCacheLock<CachedValue> lock(&cache_, hash);
-  if (!lock.holds_value() ||
-      (!pos.legal_moves.empty() &&
-       !(lock->p && lock->num_moves == pos.legal_moves.size()))) {
-    return std::nullopt;
-  }
   EvalResult result;
-  result.d = lock->d;
-  result.q = lock->q;
-  result.m = lock->m;
-  if (lock->p) {
-    result.p.reserve(pos.legal_moves.size());
-    std::copy(lock->p.get(), lock->p.get() + pos.legal_moves.size(),
-              std::back_inserter(result.p));
+  switch (Lookup(hash, [&](const CachedValue& cv) {
+    if (!IsCachedValueUsable(cv, pos)) return false;
+    if (cv.has_policy) result.p.resize(pos.legal_moves.size());
+    CachedValueToEvalResult(storage_, cv, result.AsPtr());
+    return true;
+  })) {
+    case LookupResult::kL1Hit:
+      AddStats({.l1_hits = 1});
+      return result;
+    case LookupResult::kL2Hit:
+      AddStats({.l2_hits = 1});
+      return result;
+    case LookupResult::kHostHit:
+      AddStats({.host_hits = 1});
+      return result;
+    case LookupResult::kMiss:
+      break;
+  }
+  AddStats({.misses = 1});
+  return std::nullopt;
+}
+
+template <class Cache>
+void MemCache<Cache>::SaveCache(const std::string& filename) {
+  // The loader may still have the old snapshot mapped, and the cache isn't
+  // iterated while it inserts.
+  StopLoading();
+  // Written next to the file and renamed, so that a crash in the middle
+  // doesn't leave a corrupt snapshot behind.
+  const std::string temp_filename = filename + ".tmp";
+  std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+  if (!out) throw Exception("Cannot write NN cache snapshot: " + filename);
+  auto write = [&out](auto x) {
+    out.write(reinterpret_cast<const char*>(&x), sizeof(x));
+  };
+  // The number of entries is filled in after all of them are written.
+  write(kSnapshotMagic);
+  write(kSnapshotVersion);
+  write(static_cast<uint32_t>(storage_));
+  write(snapshot_key_);
+  const auto num_entries_pos = out.tellp();
+  write(uint64_t{0});
+  uint64_t num_entries = 0;
+  cache_.ForEach([&](uint64_t key, const CachedValue& cv) {
+    write(key);
+    write(cv.num_moves);
+    write(static_cast<uint8_t>(cv.has_policy));
+    out.write(reinterpret_cast<const char*>(cv.data.get()),
+              CachedValueSize(storage_, cv.num_moves));
+    ++num_entries;
+  });
+  out.seekp(num_entries_pos);
+  write(num_entries);
+  out.close();
+  if (!out) throw Exception("Cannot write NN cache snapshot: " + filename);
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    throw Exception("Cannot rename " + temp_filename);
+  }
+  CERR << "Saved " << num_entries << " NN cache entries to " << filename;
+}
+
+template <class Cache>
+void MemCache<Cache>::LoadCache(const std::string& filename) {
+  StopLoading();
+  if (GetFileSize(filename) < kSnapshotHeaderSize) return;
+  auto file = std::make_unique<MappedFile>(filename);
+  const uint8_t* in = file->data().data();
+  const uint32_t magic = Load<uint32_t>(in);
+  const uint32_t version = Load<uint32_t>(in);
+  const uint32_t storage = Load<uint32_t>(in);
+  const uint64_t key = Load<uint64_t>(in);
+  const uint64_t num_entries = Load<uint64_t>(in);
+  if (magic != kSnapshotMagic || version != kSnapshotVersion ||
+      storage != static_cast<uint32_t>(storage_) || key != snapshot_key_) {
+    CERR << "NN cache snapshot " << filename
+         << " is for a different network or configuration, ignoring.";
+    return;
   }
-  return result;
+  abort_loading_.store(false, std::memory_order_relaxed);
+  loader_thread_ = std::thread([this, file = std::move(file), in,
+                                num_entries]() mutable {
+    const uint8_t* const end = file->data().data() + file->data().size();
+    for (uint64_t i = 0; i < num_entries; ++i) {
+      if (abort_loading_.load(std::memory_order_relaxed)) return;
+      if (static_cast<size_t>(end - in) < kSnapshotEntryHeaderSize) break;
+      const uint64_t hash = Load<uint64_t>(in);
+      CachedValue cv;
+      cv.num_moves = Load<uint8_t>(in);
+      cv.has_policy = Load<uint8_t>(in);
+      const size_t size = CachedValueSize(storage_, cv.num_moves);
+      if (static_cast<size_t>(end - in) < size) break;
+      cv.data.reset(new uint8_t[size]);
+      std::memcpy(cv.data.get(), in, size);
+      in += size;
+      // Entries already evaluated by the search take precedence.
+      InsertCachedValue(&cache_, hash, std::move(cv));
+    }
+  });
 }
 
 }  // namespace
 
+size_t EstimateNNCacheEntrySize(const OptionsDict& options) {
+  // Same as for the tree memory estimate.
+  constexpr size_t kAvgMovesPerPosition = 30;
+  // Heap allocations have some overhead too.
+  constexpr size_t kAllocationOverhead = 16;
+  const size_t data_size =
+      CachedValueSize(ParseCacheStorage(options.Get<std::string>(
+                          SharedBackendParams::kNNCacheStorageId)),
+                      kAvgMovesPerPosition) +
+      kAllocationOverhead;
+  if (options.Get<std::string>(SharedBackendParams::kNNCacheTypeId) ==
+      "clock") {
+    // The slot, and a share of the bucket.
+    return data_size + sizeof(uint64_t) + sizeof(CachedValue) + 64 / 14;
+  }
+  // The value is a separate allocation, and the hash table has about two
+  // entries of key, pointer and pin count per value.
+  return data_size + sizeof(CachedValue) + kAllocationOverhead +
+         2 * (2 * sizeof(void*) + sizeof(int) + sizeof(bool));
+}
+
 std::unique_ptr<CachingBackend> CreateMemCache(std::unique_ptr<Backend> wrapped,
                                                const OptionsDict& options) {
-  return std::make_unique<MemCache>(std::move(wrapped), options);
+  if (options.Get<std::string>(SharedBackendParams::kNNCacheTypeId) ==
+      "clock") {
+    return std::make_unique<MemCache<ClockCache<CachedValue>>>(
+        std::move(wrapped), options);
+  }
+  return std::make_unique<MemCache<FifoCache>>(std::move(wrapped), options);
 }
 
 }  // namespace lczero
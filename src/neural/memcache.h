@@ -27,15 +27,39 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+
 #include "neural/backend.h"
 
 namespace lczero {
 
 class CachingBackend : public Backend {
  public:
+  struct CacheStats {
+    // Lookups served by the per-thread cache.
+    uint64_t l1_hits = 0;
+    // Lookups served by the shared cache.
+    uint64_t l2_hits = 0;
+    // Lookups served by the cache in shared memory, see NNCacheHostSize.
+    uint64_t host_hits = 0;
+    // Lookups which had to be evaluated by the wrapped backend.
+    uint64_t misses = 0;
+    // Positions in the memory cache now, and how many it can hold.
+    uint64_t entries = 0;
+    uint64_t capacity = 0;
+  };
+
   // Clears the cache.
   virtual void ClearCache() = 0;
   virtual void SetCacheSize(size_t size) = 0;
+  // Writes the cache contents to a snapshot file. Throws on error.
+  virtual void SaveCache(const std::string& filename) = 0;
+  // Starts loading the snapshot into the cache in background. Snapshots of a
+  // different network or configuration, and missing files, are ignored.
+  virtual void LoadCache(const std::string& filename) = 0;
+  // Returns lookup counters since the last ClearCache(), and the occupancy.
+  virtual CacheStats GetCacheStats() const = 0;
 };
 
 // Creates a caching backend wrapper, which returns values immediately if they
@@ -44,4 +68,8 @@ class CachingBackend : public Backend {
 std::unique_ptr<CachingBackend> CreateMemCache(std::unique_ptr<Backend> parent,
                                                const OptionsDict& options);
 
+// Estimated memory used by one cache entry with the cache type and storage
+// from the options, in bytes.
+size_t EstimateNNCacheEntrySize(const OptionsDict& options);
+
 }  // namespace lczero
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/memory_budget.h"
+
+#include <algorithm>
+
+#include "neural/memcache.h"
+#include "neural/shared_params.h"
+
+namespace lczero {
+
+std::string MemoryBudget::ToString() const {
+  return "Memory budget " + std::to_string(total_mb) + "MB: NN cache " +
+         std::to_string(nn_cache_mb) + "MB (" +
+         std::to_string(nn_cache_entries) + " positions), tree " +
+         std::to_string(tree_mb) + "MB, backend " + std::to_string(backend_mb) +
+         "MB.";
+}
+
+MemoryBudget GetMemoryBudget(const OptionsDict& options) {
+  MemoryBudget budget;
+  budget.total_mb = options.Get<int>(SharedBackendParams::kMemoryBudgetId);
+  if (!budget.IsSet()) {
+    budget.nn_cache_entries =
+        options.Get<int>(SharedBackendParams::kNNCacheSizeId);
+    return budget;
+  }
+  float cache_share =
+      options.Get<float>(SharedBackendParams::kMemoryBudgetCacheShareId);
+  float tree_share =
+      options.Get<float>(SharedBackendParams::kMemoryBudgetTreeShareId);
+  // Scale down when the shares don't fit, leaving nothing to the backend.
+  if (cache_share + tree_share > 1.0f) {
+    const float sum = cache_share + tree_share;
+    cache_share /= sum;
+    tree_share /= sum;
+  }
+  budget.nn_cache_mb = budget.total_mb * cache_share;
+  budget.tree_mb = budget.total_mb * tree_share;
+  budget.backend_mb = budget.total_mb - budget.nn_cache_mb - budget.tree_mb;
+  // Megabytes are 1000000 bytes, same as in RamLimitMb.
+  budget.nn_cache_entries = std::min<size_t>(
+      budget.nn_cache_mb * 1000000 / EstimateNNCacheEntrySize(options),
+      999999999);
+  return budget;
+}
+
+}  // namespace lczero
@@ -0,0 +1,59 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "utils/optionsdict.h"
+
+namespace lczero {
+
+// Split of the MemoryBudget option between the NN cache, the search tree (and
+// the DAG transposition table) and the backend.
+struct MemoryBudget {
+  // Zero when MemoryBudget is not set, then the NN cache has NNCacheSize
+  // entries and the tree is not limited by the budget.
+  size_t total_mb = 0;
+  size_t nn_cache_mb = 0;
+  size_t nn_cache_entries = 0;
+  size_t tree_mb = 0;
+  // Not allocated by anyone, the headroom for the backend scratch buffers.
+  size_t backend_mb = 0;
+
+  bool IsSet() const { return total_mb != 0; }
+  // Human readable summary, for "info string".
+  std::string ToString() const;
+};
+
+// Computes the budget from the current options. Cheap, so is recomputed
+// between searches when the options change.
+MemoryBudget GetMemoryBudget(const OptionsDict& options);
+
+}  // namespace lczero
@@ -27,7 +27,10 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <vector>
 
 #include "proto/net.pb.h"
@@ -52,6 +55,17 @@ struct InputPlane {
 };
 using InputPlanes = std::vector<InputPlane>;
 
+// Priority class of a computation. Backends which serve several searches at
+// once (multiplexing, request merging) send higher priority work first.
+enum class ComputationPriority { kLow = 0, kNormal = 1, kHigh = 2 };
+
+// Outputs of the network which are needed from a batch. The value head is
+// always needed.
+struct EvalHeads {
+  bool policy = true;
+  bool moves_left = true;
+};
+
 // An interface to implement by computing backends.
 class NetworkComputation {
  public:
@@ -67,6 +81,28 @@ class NetworkComputation {
   // Returns P value @move_id of @sample.
   virtual float GetPVal(int sample, int move_id) const = 0;
   virtual float GetMVal(int sample) const = 0;
+
+  // Adds a sample, along with the policy outputs (NN move indices) that are
+  // going to be read for it. Backends which can gather these outputs on the
+  // device return them from GetGatheredPVals(); the default implementation
+  // ignores the indices.
+  virtual void AddInputWithPolicyIndices(
+      InputPlanes&& input, std::span<const uint16_t> /*policy_indices*/) {
+    AddInput(std::move(input));
+  }
+  // Returns the policy outputs of @sample requested in
+  // AddInputWithPolicyIndices(), in the same order, or nullptr if the backend
+  // doesn't gather the policy (GetPVal() must be used then).
+  virtual const float* GetGatheredPVals(int /*sample*/) const {
+    return nullptr;
+  }
+  // Sets the priority class of the computation, before ComputeBlocking().
+  virtual void SetPriority(ComputationPriority /*priority*/) {}
+  // Tells which heads are going to be read, before ComputeBlocking(). Backends
+  // may skip computing or transferring the others, GetPVal() and GetMVal()
+  // must not be called for them then.
+  virtual void SetRequiredHeads(EvalHeads /*heads*/) {}
+
   virtual ~NetworkComputation() = default;
 };
 
@@ -113,6 +149,26 @@ struct NetworkCapabilities {
   }
 };
 
+// Device memory taken by a network, in bytes. Zero when not known (e.g. CPU
+// backends).
+struct DeviceMemoryUsage {
+  // Weights and everything else allocated once per network.
+  size_t weights = 0;
+  // Activations and scratch buffers shared by the computations.
+  size_t scratch = 0;
+  // Activations and scratch buffers of every concurrently running computation
+  // (e.g. with multi_stream).
+  size_t workspace = 0;
+
+  size_t total() const { return weights + scratch + workspace; }
+  DeviceMemoryUsage& operator+=(const DeviceMemoryUsage& other) {
+    weights += other.weights;
+    scratch += other.scratch;
+    workspace += other.workspace;
+    return *this;
+  }
+};
+
 class Network {
  public:
   virtual const NetworkCapabilities& GetCapabilities() const = 0;
@@ -121,6 +177,14 @@ class Network {
   virtual void InitThread(int /*id*/) {}
   virtual bool IsCpu() const { return false; }
   virtual int GetMiniBatchSize() const { return 256; }
+  virtual DeviceMemoryUsage GetDeviceMemoryUsage() const { return {}; }
+  // Replaces the weights of the network with @weights, keeping the device
+  // state and allocations. Returns false if that's not possible (e.g. the
+  // architecture is different), the network has to be recreated then. Not
+  // called while any computations exist.
+  virtual bool UpdateWeights(const pblczero::Net& /*weights*/) {
+    return false;
+  }
   virtual ~Network() = default;
 };
 
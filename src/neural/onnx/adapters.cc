@@ -76,7 +76,7 @@ pblczero::TensorProto::DataType Float16OnnxWeightsAdapter::GetDataType() const {
 
 std::string Float16OnnxWeightsAdapter::GetRawData() const {
   std::vector<uint16_t> fp16(weights_.size());
-  std::transform(weights_.begin(), weights_.end(), fp16.begin(), FP32toFP16);
+  ConvertFP32toFP16(weights_.data(), fp16.data(), weights_.size());
   return TransposeAndReturnRaw<uint16_t>(dims_, order_, fp16);
 }
 
@@ -87,7 +87,7 @@ pblczero::TensorProto::DataType BFloat16OnnxWeightsAdapter::GetDataType()
 
 std::string BFloat16OnnxWeightsAdapter::GetRawData() const {
   std::vector<uint16_t> bf16(weights_.size());
-  std::transform(weights_.begin(), weights_.end(), bf16.begin(), FP32toBF16);
+  ConvertFP32toBF16(weights_.data(), bf16.data(), weights_.size());
   return TransposeAndReturnRaw<uint16_t>(dims_, order_, bf16);
 }
 
@@ -478,4 +478,51 @@ std::string OnnxBuilder::ReduceMean(const std::string& name,
   return out;
 }
 
+std::string OnnxBuilder::DequantizeLinear(const std::string& name,
+                                          const OnnxConst& input,
+                                          const OnnxConst& scale, int axis) {
+  if (opset_ < 13) {
+    throw Exception("Per-channel DequantizeLinear requires opset 13 or later.");
+  }
+  auto* node = model_.mutable_graph()->add_node();
+  auto out = PopulateStdNodeFields(node, name,
+                                   AddInitializer(name + "/x", input),
+                                   "DequantizeLinear");
+  node->add_input(AddInitializer(name + "/scale", scale));
+  AddIntAttribute(node, "axis", axis);
+  return out;
+}
+
+std::string OnnxBuilder::MultiHeadAttention(const std::string& name,
+                                            const std::string& query,
+                                            const std::string& key,
+                                            const std::string& value,
+                                            const std::string& attention_bias,
+                                            int num_heads, float scale) {
+  constexpr const char* kDomain = "com.microsoft";
+  bool has_domain = false;
+  for (const auto& opset : model_.opset_import()) {
+    if (opset.domain() == kDomain) has_domain = true;
+  }
+  if (!has_domain) {
+    auto* opset = model_.add_opset_import();
+    opset->set_domain(kDomain);
+    opset->set_version(1);
+  }
+  auto* node = model_.mutable_graph()->add_node();
+  auto out = PopulateStdNodeFields(node, name, query, "MultiHeadAttention");
+  node->set_domain(kDomain);
+  node->add_input(key);
+  node->add_input(value);
+  if (!attention_bias.empty()) {
+    // Skipping bias, key_padding_mask.
+    node->add_input("");
+    node->add_input("");
+    node->add_input(attention_bias);
+  }
+  AddIntAttribute(node, "num_heads", num_heads);
+  AddFloatAttribute(node, "scale", scale);
+  return out;
+}
+
 }  // namespace lczero
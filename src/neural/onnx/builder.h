@@ -126,6 +126,17 @@ class OnnxBuilder {
                    pblczero::TensorProto::DataType type);
   std::string ReduceMean(const std::string& name, const std::string& input,
                          std::initializer_list<int> axes, bool keepdims = true);
+  // Per-channel DequantizeLinear of a constant along @axis (opset 13+).
+  std::string DequantizeLinear(const std::string& name, const OnnxConst& input,
+                               const OnnxConst& scale, int axis);
+  // com.microsoft.MultiHeadAttention contrib operator (onnxruntime only).
+  // Inputs are [batch, sequence, hidden], @attention_bias is optional.
+  std::string MultiHeadAttention(const std::string& name,
+                                 const std::string& query,
+                                 const std::string& key,
+                                 const std::string& value,
+                                 const std::string& attention_bias,
+                                 int num_heads, float scale);
   // Returns ONNX model as protobuf.
   const pblczero::ModelProto& as_proto() const { return model_; }
   // Returns serialized model.
@@ -27,6 +27,7 @@
 
 #include "neural/onnx/converter.h"
 
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <cstddef>
@@ -125,6 +126,13 @@ class Converter {
                           const std::string& encoder_in,
                           const std::string& name);
 
+  // MatMul with a [in_size, out_size] weights matrix, stored transposed in
+  // @weights. Quantized to int8 with per-output-channel scales if requested.
+  std::string MakeDense(OnnxBuilder* builder, const std::string& input,
+                        const std::string& name,
+                        const std::vector<float>& weights, int in_size,
+                        int out_size);
+
   std::string MakeLayerNorm(OnnxBuilder* builder, const std::string& input,
                             const std::string& name,
                             const lczero::OnnxConst& gammas,
@@ -468,6 +476,41 @@ std::string Converter::MakeSmolgen(OnnxBuilder* builder,
   return flow;
 }
 
+std::string Converter::MakeDense(OnnxBuilder* builder,
+                                 const std::string& input,
+                                 const std::string& name,
+                                 const std::vector<float>& weights,
+                                 int in_size, int out_size) {
+  if (!options_.int8_weights) {
+    return builder->MatMul(
+        name, input,
+        *GetWeghtsConverter(weights, {in_size, out_size}, {1, 0}));
+  }
+  // Symmetric per-output-channel quantization, the source is [out][in].
+  std::vector<float> scales(out_size);
+  std::vector<int8_t> quantized(weights.size());
+  for (int o = 0; o < out_size; ++o) {
+    float max_abs = 0.0f;
+    for (int i = 0; i < in_size; ++i) {
+      max_abs = std::max(max_abs, std::abs(weights[o * in_size + i]));
+    }
+    scales[o] = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+    for (int i = 0; i < in_size; ++i) {
+      quantized[i * out_size + o] = static_cast<int8_t>(
+          std::lround(weights[o * in_size + i] / scales[o]));
+    }
+  }
+  auto flow = builder->DequantizeLinear(
+      name + "/dequantize", Int8OnnxConst(quantized, {in_size, out_size}),
+      FloatOnnxConst(scales, {out_size}), 1);
+  if (options_.data_type !=
+      WeightsToOnnxConverterOptions::DataType::kFloat32) {
+    flow = builder->Cast(name + "/dequantize/to_data_type", flow,
+                         GetDataType());
+  }
+  return builder->MatMul(name, input, flow);
+}
+
 std::string Converter::MakeLayerNorm(OnnxBuilder* builder,
                                      const std::string& input,
                                      const std::string& name,
@@ -505,15 +548,13 @@ std::string Converter::MakeFFN(OnnxBuilder* builder,
                                const std::string& name,
                                ActivationFunction activation, float alpha) {
   const int dff_size = ffn.dense1_b.size();
-  auto flow = builder->MatMul(
-      name + "/ffn/dense1/w", ffn_in,
-      *GetWeghtsConverter(ffn.dense1_w, {embedding_size, dff_size}, {1, 0}));
+  auto flow = MakeDense(builder, ffn_in, name + "/ffn/dense1/w", ffn.dense1_w,
+                        embedding_size, dff_size);
   flow = builder->Add(name + "/ffn/dense1/b", flow,
                       *GetWeghtsConverter(ffn.dense1_b, {dff_size}));
   flow = MakeActivation(builder, flow, name + "/ffn/dense1", activation);
-  flow = builder->MatMul(
-      name + "/ffn/dense2/w", flow,
-      *GetWeghtsConverter(ffn.dense2_w, {dff_size, embedding_size}, {1, 0}));
+  flow = MakeDense(builder, flow, name + "/ffn/dense2/w", ffn.dense2_w,
+                   dff_size, embedding_size);
   flow = builder->Add(name + "/ffn/dense2/b", flow,
                       *GetWeghtsConverter(ffn.dense2_b, {embedding_size}));
   if (alpha != 1.0) {
@@ -530,51 +571,65 @@ std::string Converter::MakeEncoderLayer(
   const int d_model = layer.mha.q_b.size();
   const int depth = d_model / heads;
 
-  auto mha_shape =
-      builder->AddInitializer("/const" + name + "/mha/shape",
-                              Int64OnnxConst({-1, 64, heads, depth}, {4}));
-  auto flow = builder->MatMul(
-      name + "/mha/Q/w", encoder_in,
-      *GetWeghtsConverter(layer.mha.q_w, {embedding_size, d_model}, {1, 0}));
-  flow = builder->Add(name + "/mha/Q/b", flow,
-                      *GetWeghtsConverter(layer.mha.q_b, {d_model}));
-  flow = builder->Reshape(name + "/mha/Q/reshape", flow, mha_shape);
-  auto Q = builder->Transpose(name + "/mha/Q/transpose", flow, {0, 2, 1, 3});
-  flow = builder->MatMul(
-      name + "/mha/K/w", encoder_in,
-      *GetWeghtsConverter(layer.mha.k_w, {embedding_size, d_model}, {1, 0}));
-  flow = builder->Add(name + "/mha/K/b", flow,
-                      *GetWeghtsConverter(layer.mha.k_b, {d_model}));
-  flow = builder->Reshape(name + "/mha/K/reshape", flow, mha_shape);
-  auto K = builder->Transpose(name + "/mha/K/transpose", flow, {0, 2, 3, 1});
-  flow = builder->MatMul(
-      name + "/mha/V/w", encoder_in,
-      *GetWeghtsConverter(layer.mha.v_w, {embedding_size, d_model}, {1, 0}));
-  flow = builder->Add(name + "/mha/V/b", flow,
-                      *GetWeghtsConverter(layer.mha.v_b, {d_model}));
-  flow = builder->Reshape(name + "/mha/V/reshape", flow, mha_shape);
-  auto V = builder->Transpose(name + "/mha/V/transpose", flow, {0, 2, 1, 3});
-  flow = builder->MatMul(name + "/mha/QK/matmul", Q, K);
-  flow = builder->Mul(name + "/mha/QK/scale", flow,
-                      *GetScalarConverter(1.0f / sqrtf(depth)));
-  if (layer.mha.has_smolgen) {
-    auto smolgen_weights =
-        MakeSmolgen(builder, layer, embedding_size, heads, encoder_in, name);
-    flow = builder->Add(name + "/smolgen_weights", flow, smolgen_weights);
-  }
-  flow = builder->Softmax(name + "/mha/QK/softmax", flow, 3);
-  flow = builder->MatMul(name + "/mha/QKV/matmul", flow, V);
-  if (heads > 1) {
-    flow = builder->Transpose(name + "/mha/out/transpose", flow, {0, 2, 1, 3});
+  auto Q = MakeDense(builder, encoder_in, name + "/mha/Q/w", layer.mha.q_w,
+                     embedding_size, d_model);
+  Q = builder->Add(name + "/mha/Q/b", Q,
+                   *GetWeghtsConverter(layer.mha.q_b, {d_model}));
+  auto K = MakeDense(builder, encoder_in, name + "/mha/K/w", layer.mha.k_w,
+                     embedding_size, d_model);
+  K = builder->Add(name + "/mha/K/b", K,
+                   *GetWeghtsConverter(layer.mha.k_b, {d_model}));
+  auto V = MakeDense(builder, encoder_in, name + "/mha/V/w", layer.mha.v_w,
+                     embedding_size, d_model);
+  V = builder->Add(name + "/mha/V/b", V,
+                   *GetWeghtsConverter(layer.mha.v_b, {d_model}));
+  std::string flow;
+  if (options_.fused_attention) {
+    auto seq_shape =
+        builder->AddInitializer("/const" + name + "/mha/shape",
+                                Int64OnnxConst({-1, 64, d_model}, {3}));
+    Q = builder->Reshape(name + "/mha/Q/reshape", Q, seq_shape);
+    K = builder->Reshape(name + "/mha/K/reshape", K, seq_shape);
+    V = builder->Reshape(name + "/mha/V/reshape", V, seq_shape);
+    std::string smolgen_weights;
+    if (layer.mha.has_smolgen) {
+      smolgen_weights =
+          MakeSmolgen(builder, layer, embedding_size, heads, encoder_in, name);
+    }
+    flow = builder->MultiHeadAttention(name + "/mha/fused", Q, K, V,
+                                       smolgen_weights, heads,
+                                       1.0f / sqrtf(depth));
+  } else {
+    auto mha_shape =
+        builder->AddInitializer("/const" + name + "/mha/shape",
+                                Int64OnnxConst({-1, 64, heads, depth}, {4}));
+    flow = builder->Reshape(name + "/mha/Q/reshape", Q, mha_shape);
+    Q = builder->Transpose(name + "/mha/Q/transpose", flow, {0, 2, 1, 3});
+    flow = builder->Reshape(name + "/mha/K/reshape", K, mha_shape);
+    K = builder->Transpose(name + "/mha/K/transpose", flow, {0, 2, 3, 1});
+    flow = builder->Reshape(name + "/mha/V/reshape", V, mha_shape);
+    V = builder->Transpose(name + "/mha/V/transpose", flow, {0, 2, 1, 3});
+    flow = builder->MatMul(name + "/mha/QK/matmul", Q, K);
+    flow = builder->Mul(name + "/mha/QK/scale", flow,
+                        *GetScalarConverter(1.0f / sqrtf(depth)));
+    if (layer.mha.has_smolgen) {
+      auto smolgen_weights =
+          MakeSmolgen(builder, layer, embedding_size, heads, encoder_in, name);
+      flow = builder->Add(name + "/smolgen_weights", flow, smolgen_weights);
+    }
+    flow = builder->Softmax(name + "/mha/QK/softmax", flow, 3);
+    flow = builder->MatMul(name + "/mha/QKV/matmul", flow, V);
+    if (heads > 1) {
+      flow =
+          builder->Transpose(name + "/mha/out/transpose", flow, {0, 2, 1, 3});
+    }
   }
   flow = builder->Reshape(
       name + "/mha/out/reshape", flow,
       builder->AddInitializer("/const" + name + "/mha/out/shape",
                               Int64OnnxConst({-1, d_model}, {2})));
-  flow =
-      builder->MatMul(name + "/mha/out/dense/w", flow,
-                      *GetWeghtsConverter(layer.mha.dense_w,
-                                          {d_model, embedding_size}, {1, 0}));
+  flow = MakeDense(builder, flow, name + "/mha/out/dense/w",
+                   layer.mha.dense_w, d_model, embedding_size);
   flow = builder->Add(name + "/mha/out/dense/b", flow,
                       *GetWeghtsConverter(layer.mha.dense_b, {embedding_size}));
   if (alpha != 1.0) {
@@ -1101,6 +1156,11 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
 void Converter::GenerateOnnx(pblczero::OnnxModel* onnx) {
   MultiHeadWeights weights(src_.weights());
   OnnxBuilder builder(options_.opset);
+  if (options_.fused_attention &&
+      options_.data_type ==
+          WeightsToOnnxConverterOptions::DataType::kBFloat16) {
+    throw Exception("Fused attention is only supported for f32 and f16.");
+  }
 
   if (GetDataType() == pblczero::TensorProto::FLOAT16) {
     onnx->set_data_type(pblczero::OnnxModel::FLOAT16);
@@ -48,6 +48,8 @@ struct WeightsToOnnxConverterOptions {
   bool alt_mish = false;       // Use "Mish" approximation (fp32 only).
   bool alt_layernorm = false;  // Discrete "LayerNormalization" implementation.
   bool no_shape = false;       // Avoid use of "Shape" operator.
+  bool fused_attention = false;  // Use onnxruntime "MultiHeadAttention" op.
+  bool int8_weights = false;     // Int8 QDQ weights for encoder matmuls.
   std::string policy_head = "vanilla";
   std::string value_head = "winner";
 
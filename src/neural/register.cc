@@ -30,6 +30,7 @@
 #include <algorithm>
 
 #include "neural/shared_params.h"
+#include "neural/warmup.h"
 
 namespace lczero {
 
@@ -68,7 +69,12 @@ std::unique_ptr<Backend> BackendManager::CreateFromParams(
     const OptionsDict& options) const {
   const std::string backend =
       options.Get<std::string>(SharedBackendParams::kBackendId);
-  return CreateFromName(backend, options);
+  auto result = CreateFromName(backend, options);
+  if (options.GetOrDefault<bool>(SharedBackendParams::kBackendWarmupId,
+                                 false)) {
+    result = CreateWarmedUpBackend(std::move(result));
+  }
+  return result;
 }
 
 std::unique_ptr<Backend> BackendManager::CreateFromName(
@@ -47,7 +47,7 @@ class BackendManager {
   std::vector<std::string> GetBackendNames() const;
 
   // Creates a backend from the parameters. Extracts the weights file and the
-  // backend from the options.
+  // backend from the options. Warms the backend up if requested.
   std::unique_ptr<Backend> CreateFromParams(const OptionsDict& options) const;
 
   // Creates a backend from the name. Backend name from the options is ignored.
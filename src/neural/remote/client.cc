@@ -0,0 +1,315 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "neural/register.h"
+#include "neural/remote/protocol.h"
+#include "neural/shared_params.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace remote {
+namespace {
+
+// Batch sent to the server, waiting for the response.
+struct PendingRequest {
+  std::vector<EvalResultPtr> results;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  std::string error;
+
+  void Finish(std::string err) {
+    std::lock_guard<std::mutex> lock(mutex);
+    error = std::move(err);
+    done = true;
+    cv.notify_all();
+  }
+};
+
+// Connection to the server. Requests are pipelined: they are sent without
+// waiting for the previous responses, the reader thread matches responses to
+// requests by the request id.
+class Connection {
+ public:
+  Connection(const std::string& host, int port, bool compress,
+             const std::string& name)
+      : socket_(Socket::Connect(host, port)), compress_(compress) {
+    PayloadWriter hello;
+    hello.Put<uint32_t>(kProtocolVersion);
+    hello.PutString(name);
+    WriteFrame(&socket_, MessageType::kHello, 0, hello.data(), false);
+    Frame frame;
+    if (!ReadFrame(&socket_, &frame)) {
+      throw Exception("Remote server closed the connection");
+    }
+    if (frame.type == MessageType::kError) {
+      throw Exception("Remote server error: " + frame.payload);
+    }
+    if (frame.type != MessageType::kAttributes) {
+      throw Exception("Unexpected remote server reply");
+    }
+    PayloadReader reader(frame.payload);
+    attributes_ = DecodeAttributes(&reader);
+    reader_ = std::thread([this]() { ReaderLoop(); });
+  }
+
+  ~Connection() {
+    closing_ = true;
+    socket_.Shutdown();
+    reader_.join();
+  }
+
+  const BackendAttributes& attributes() const { return attributes_; }
+
+  void Send(std::shared_ptr<PendingRequest> request, std::string_view payload) {
+    uint32_t request_id;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_.empty()) {
+        request->Finish(error_);
+        return;
+      }
+      request_id = next_request_id_++;
+      pending_.emplace(request_id, request);
+    }
+    try {
+      std::lock_guard<std::mutex> lock(write_mutex_);
+      WriteFrame(&socket_, MessageType::kEvalRequest, request_id, payload,
+                 compress_);
+    } catch (const Exception&) {
+      // The reader thread fails the pending requests when it notices that the
+      // connection is gone.
+      socket_.Shutdown();
+    }
+  }
+
+ private:
+  void ReaderLoop() {
+    std::string error = "Remote server closed the connection";
+    try {
+      Frame frame;
+      while (ReadFrame(&socket_, &frame)) {
+        std::shared_ptr<PendingRequest> request;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          auto iter = pending_.find(frame.request_id);
+          if (iter == pending_.end()) {
+            throw Exception("Unexpected remote response");
+          }
+          request = std::move(iter->second);
+          pending_.erase(iter);
+        }
+        if (frame.type == MessageType::kError) {
+          request->Finish("Remote server error: " + frame.payload);
+          continue;
+        }
+        PayloadReader reader(frame.payload);
+        for (const EvalResultPtr& result : request->results) {
+          DecodeEvalResult(&reader, result);
+        }
+        request->Finish({});
+      }
+    } catch (const Exception& e) {
+      error = e.what();
+    }
+    if (!closing_) CERR << error;
+    std::unordered_map<uint32_t, std::shared_ptr<PendingRequest>> pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      error_ = error;
+      pending.swap(pending_);
+    }
+    for (auto& [id, request] : pending) request->Finish(error);
+  }
+
+  Socket socket_;
+  const bool compress_;
+  BackendAttributes attributes_;
+  std::mutex write_mutex_;
+  std::mutex mutex_;
+  uint32_t next_request_id_ = 0;
+  std::unordered_map<uint32_t, std::shared_ptr<PendingRequest>> pending_;
+  // Set when the connection is lost.
+  std::string error_;
+  std::atomic<bool> closing_ = false;
+  std::thread reader_;
+};
+
+class RemoteBackend : public Backend {
+ public:
+  RemoteBackend(const OptionsDict& options)
+      : backend_opts_(
+            options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
+    OptionsDict opts;
+    opts.AddSubdictFromString(backend_opts_);
+    const std::string host =
+        opts.GetOrDefault<std::string>("host", "localhost");
+    const int port = opts.GetOrDefault<int>("port", kDefaultPort);
+    const int connections = opts.GetOrDefault<int>("connections", 2);
+    const bool compress = opts.GetOrDefault<bool>("compression", true);
+    const std::string name = opts.GetOrDefault<std::string>("name", "");
+    // With many clients on one server, those with a deadline have their
+    // positions sent to the GPU first.
+    const int deadline_us = opts.GetOrDefault<int>("deadline-us", 0);
+    opts.CheckAllOptionsRead("remote");
+    if (connections < 1) throw Exception("Invalid number of connections");
+    if (deadline_us < 0) throw Exception("Invalid remote deadline-us");
+    deadline_us_ = static_cast<uint32_t>(deadline_us);
+    for (int i = 0; i < connections; ++i) {
+      connections_.push_back(
+          std::make_unique<Connection>(host, port, compress, name));
+    }
+    attrs_ = connections_[0]->attributes();
+    CERR << "Connected to the remote backend at " << host << ":" << port
+         << " with " << connections << " connection(s).";
+    UpdateConfiguration(options);
+  }
+
+  BackendAttributes GetAttributes() const override { return attrs_; }
+  std::unique_ptr<BackendComputation> CreateComputation() override;
+
+  // The network and the backend settings belong to the server, only the
+  // connection can change here.
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    Backend::UpdateConfiguration(options);
+    if (backend_opts_ !=
+        options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
+      return NEED_RESTART;
+    }
+    return UPDATE_OK;
+  }
+
+  uint32_t deadline_us() const { return deadline_us_; }
+
+  // Computations are spread over the connections round robin.
+  Connection* NextConnection() {
+    const size_t idx = next_connection_.fetch_add(1, std::memory_order_relaxed);
+    return connections_[idx % connections_.size()].get();
+  }
+
+ private:
+  const std::string backend_opts_;
+  BackendAttributes attrs_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+  std::atomic<size_t> next_connection_ = 0;
+  uint32_t deadline_us_ = 0;
+};
+
+class RemoteComputation : public BackendComputation {
+ public:
+  RemoteComputation(RemoteBackend* backend) : backend_(backend) {}
+
+  ~RemoteComputation() override {
+    // The reader thread writes into the caller's buffers.
+    if (request_) WaitForRequest();
+  }
+
+  size_t UsedBatchSize() const override { return results_.size(); }
+
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    EncodeEvalPosition(pos, &payload_);
+    results_.push_back(result);
+    return ENQUEUED_FOR_EVAL;
+  }
+
+  void ComputeBlocking() override {
+    ComputeAsync();
+    Wait();
+  }
+
+  void ComputeAsync() override {
+    if (results_.empty()) return;
+    request_ = std::make_shared<PendingRequest>();
+    request_->results = std::move(results_);
+    results_.clear();
+    // The priority and the deadline go in front of the positions.
+    PayloadWriter header;
+    header.Put<uint8_t>(static_cast<uint8_t>(priority_));
+    header.Put<uint32_t>(backend_->deadline_us());
+    backend_->NextConnection()->Send(request_, header.data() + payload_.data());
+    payload_.Clear();
+  }
+
+  bool IsReady() const override {
+    if (!request_) return true;
+    std::lock_guard<std::mutex> lock(request_->mutex);
+    return request_->done;
+  }
+
+  void Wait() override {
+    if (!request_) return;
+    const std::string error = WaitForRequest();
+    request_.reset();
+    if (!error.empty()) throw Exception(error);
+  }
+
+  void SetPriority(ComputationPriority priority) override {
+    priority_ = priority;
+  }
+
+ private:
+  std::string WaitForRequest() {
+    std::unique_lock<std::mutex> lock(request_->mutex);
+    request_->cv.wait(lock, [this]() { return request_->done; });
+    return request_->error;
+  }
+
+  RemoteBackend* const backend_;
+  PayloadWriter payload_;
+  std::vector<EvalResultPtr> results_;
+  std::shared_ptr<PendingRequest> request_;
+  ComputationPriority priority_ = ComputationPriority::kNormal;
+};
+
+std::unique_ptr<BackendComputation> RemoteBackend::CreateComputation() {
+  return std::make_unique<RemoteComputation>(this);
+}
+
+class RemoteBackendFactory : public BackendFactory {
+ public:
+  int GetPriority() const override { return -1000; }
+  std::string_view GetName() const override { return "remote"; }
+  std::unique_ptr<Backend> Create(const OptionsDict& options) override {
+    return std::make_unique<RemoteBackend>(options);
+  }
+};
+
+BackendManager::Register reg(std::make_unique<RemoteBackendFactory>());
+
+}  // namespace
+}  // namespace remote
+}  // namespace lczero
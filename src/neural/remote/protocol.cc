@@ -0,0 +1,384 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/remote/protocol.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include "chess/board.h"
+#include "neural/encoder.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace lczero {
+namespace remote {
+namespace {
+
+#ifdef _WIN32
+using NativeSocket = SOCKET;
+using IoSize = int;
+constexpr int kSendFlags = 0;
+void CloseNative(NativeSocket fd) { closesocket(fd); }
+constexpr int kShutdownBoth = SD_BOTH;
+std::string LastError() { return std::to_string(WSAGetLastError()); }
+void InitSockets() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+      throw Exception("Unable to initialize Windows sockets");
+    }
+  });
+}
+#else
+using NativeSocket = int;
+using IoSize = size_t;
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+void CloseNative(NativeSocket fd) { close(fd); }
+constexpr int kShutdownBoth = SHUT_RDWR;
+std::string LastError() { return std::strerror(errno); }
+void InitSockets() {}
+#endif
+
+NativeSocket Native(intptr_t fd) { return static_cast<NativeSocket>(fd); }
+
+// Resolves the address and calls @fn(addrinfo*) for every candidate until it
+// returns a valid socket.
+template <typename F>
+intptr_t ForEachAddress(const std::string& host, int port, bool passive,
+                        F&& fn) {
+  InitSockets();
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (passive) hints.ai_flags = AI_PASSIVE;
+  addrinfo* addresses = nullptr;
+  const std::string port_str = std::to_string(port);
+  const int err =
+      getaddrinfo(host.empty() ? nullptr : host.c_str(), port_str.c_str(),
+                  &hints, &addresses);
+  if (err != 0) {
+    throw Exception("Unable to resolve " + host + ": " + gai_strerror(err));
+  }
+  intptr_t result = -1;
+  for (addrinfo* addr = addresses; addr && result < 0; addr = addr->ai_next) {
+    result = fn(addr);
+  }
+  freeaddrinfo(addresses);
+  return result;
+}
+
+void SetNoDelay(NativeSocket fd) {
+  // Requests are latency bound, don't let Nagle's algorithm hold them back.
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&flag),
+             sizeof(flag));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &flag, sizeof(flag));
+#endif
+}
+
+}  // namespace
+
+Socket::~Socket() { Close(); }
+
+Socket::Socket(Socket&& other) : fd_(other.fd_) { other.fd_ = -1; }
+
+Socket& Socket::operator=(Socket&& other) {
+  if (this != &other) {
+    Close();
+    fd_ = other.fd_;
+    other.fd_ = -1;
+  }
+  return *this;
+}
+
+Socket Socket::Connect(const std::string& host, int port) {
+  const intptr_t fd =
+      ForEachAddress(host, port, false, [](addrinfo* addr) -> intptr_t {
+        NativeSocket fd =
+            socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (Native(fd) == Native(-1)) return -1;
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+          CloseNative(fd);
+          return -1;
+        }
+        SetNoDelay(fd);
+        return static_cast<intptr_t>(fd);
+      });
+  if (fd < 0) {
+    throw Exception("Unable to connect to " + host + ":" +
+                    std::to_string(port) + ": " + LastError());
+  }
+  return Socket(fd);
+}
+
+Socket Socket::Listen(const std::string& host, int port) {
+  const intptr_t fd =
+      ForEachAddress(host, port, true, [](addrinfo* addr) -> intptr_t {
+        NativeSocket fd =
+            socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (Native(fd) == Native(-1)) return -1;
+        int flag = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+                   reinterpret_cast<char*>(&flag), sizeof(flag));
+        if (bind(fd, addr->ai_addr, addr->ai_addrlen) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+          CloseNative(fd);
+          return -1;
+        }
+        return static_cast<intptr_t>(fd);
+      });
+  if (fd < 0) {
+    throw Exception("Unable to listen on port " + std::to_string(port) + ": " +
+                    LastError());
+  }
+  return Socket(fd);
+}
+
+Socket Socket::Accept() {
+  NativeSocket fd = accept(Native(fd_), nullptr, nullptr);
+  if (Native(fd) == Native(-1)) {
+    throw Exception("Unable to accept connection: " + LastError());
+  }
+  SetNoDelay(fd);
+  return Socket(static_cast<intptr_t>(fd));
+}
+
+bool Socket::ReadAll(void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+  size_t done = 0;
+  while (done < size) {
+    const auto ret = recv(Native(fd_), ptr + done,
+                          static_cast<IoSize>(size - done), 0);
+    if (ret == 0 && done == 0) return false;
+    if (ret <= 0) throw Exception("Remote connection lost: " + LastError());
+    done += ret;
+  }
+  return true;
+}
+
+size_t Socket::ReadSome(void* data, size_t size) {
+  const auto ret =
+      recv(Native(fd_), static_cast<char*>(data), static_cast<IoSize>(size), 0);
+  if (ret < 0) throw Exception("Remote connection lost: " + LastError());
+  return ret;
+}
+
+void Socket::WriteAll(const void* data, size_t size) {
+  const char* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+    const auto ret =
+        send(Native(fd_), ptr, static_cast<IoSize>(size), kSendFlags);
+    if (ret <= 0) throw Exception("Remote connection lost: " + LastError());
+    ptr += ret;
+    size -= ret;
+  }
+}
+
+void Socket::Shutdown() {
+  if (is_open()) shutdown(Native(fd_), kShutdownBoth);
+}
+
+void Socket::Close() {
+  if (!is_open()) return;
+  CloseNative(Native(fd_));
+  fd_ = -1;
+}
+
+bool Socket::is_open() const { return fd_ >= 0; }
+
+bool ReadFrame(Socket* socket, Frame* frame) {
+  FrameHeader header;
+  if (!socket->ReadAll(&header, sizeof(header))) return false;
+  if (header.magic != kMagic) throw Exception("Bad remote message");
+  frame->type = header.type;
+  frame->request_id = header.request_id;
+  frame->compressed = header.flags & kFlagCompressed;
+  if (header.payload_size > kMaxFrameSize ||
+      (frame->compressed && header.raw_size > kMaxFrameSize)) {
+    throw Exception("Remote message too large");
+  }
+  std::string wire(header.payload_size, '\0');
+  if (!wire.empty() && !socket->ReadAll(wire.data(), wire.size())) {
+    throw Exception("Remote connection lost");
+  }
+  if (!frame->compressed) {
+    frame->payload = std::move(wire);
+    return true;
+  }
+  frame->payload.resize(header.raw_size);
+  uLongf raw_size = header.raw_size;
+  if (uncompress(reinterpret_cast<Bytef*>(frame->payload.data()), &raw_size,
+                 reinterpret_cast<const Bytef*>(wire.data()),
+                 wire.size()) != Z_OK ||
+      raw_size != header.raw_size) {
+    throw Exception("Corrupted remote message");
+  }
+  return true;
+}
+
+void WriteFrame(Socket* socket, MessageType type, uint32_t request_id,
+                std::string_view payload, bool compress) {
+  FrameHeader header = {};
+  header.magic = kMagic;
+  header.type = type;
+  header.request_id = request_id;
+  if (payload.size() > kMaxFrameSize) {
+    throw Exception("Remote message too large");
+  }
+  header.raw_size = payload.size();
+  // Header and payload go in one send to save a packet.
+  std::string buffer(sizeof(header), '\0');
+  if (compress && payload.size() >= kMinCompressSize) {
+    uLongf size = compressBound(payload.size());
+    buffer.resize(sizeof(header) + size);
+    // The fastest level, the batches are latency sensitive.
+    if (compress2(reinterpret_cast<Bytef*>(buffer.data() + sizeof(header)),
+                  &size, reinterpret_cast<const Bytef*>(payload.data()),
+                  payload.size(), Z_BEST_SPEED) == Z_OK &&
+        size < payload.size()) {
+      header.flags |= kFlagCompressed;
+      buffer.resize(sizeof(header) + size);
+    }
+  }
+  if (!(header.flags & kFlagCompressed)) {
+    buffer.resize(sizeof(header));
+    buffer.append(payload);
+  }
+  header.payload_size = buffer.size() - sizeof(header);
+  std::memcpy(buffer.data(), &header, sizeof(header));
+  socket->WriteAll(buffer.data(), buffer.size());
+}
+
+void EncodeAttributes(const BackendAttributes& attrs, PayloadWriter* writer) {
+  writer->Put<uint32_t>(kProtocolVersion);
+  writer->Put<uint8_t>(attrs.has_mlh);
+  writer->Put<uint8_t>(attrs.has_wdl);
+  writer->Put<uint8_t>(attrs.runs_on_cpu);
+  writer->Put<int32_t>(attrs.suggested_num_search_threads);
+  writer->Put<int32_t>(attrs.recommended_batch_size);
+  writer->Put<int32_t>(attrs.maximum_batch_size);
+}
+
+BackendAttributes DecodeAttributes(PayloadReader* reader) {
+  if (reader->Get<uint32_t>() != kProtocolVersion) {
+    throw Exception("Remote server protocol version mismatch");
+  }
+  BackendAttributes attrs;
+  attrs.has_mlh = reader->Get<uint8_t>();
+  attrs.has_wdl = reader->Get<uint8_t>();
+  attrs.runs_on_cpu = reader->Get<uint8_t>();
+  attrs.suggested_num_search_threads = reader->Get<int32_t>();
+  attrs.recommended_batch_size = reader->Get<int32_t>();
+  attrs.maximum_batch_size = reader->Get<int32_t>();
+  return attrs;
+}
+
+void EncodeEvalPosition(const EvalPosition& pos, PayloadWriter* writer) {
+  const size_t history = std::min<size_t>(pos.pos.size(), kMoveHistory);
+  writer->Put<uint8_t>(history);
+  for (const Position& position : pos.pos.last(history)) {
+    // Only the board part, the counters are sent separately as the game ply
+    // doesn't survive the FEN round trip.
+    writer->PutString(BoardToFen(position.GetBoard()));
+    writer->Put<uint16_t>(position.GetRule50Ply());
+    writer->Put<uint16_t>(position.GetGamePly());
+    writer->Put<uint8_t>(position.GetRepetitions());
+    writer->Put<uint16_t>(position.GetPliesSincePrevRepetition());
+  }
+  writer->Put<uint16_t>(pos.legal_moves.size());
+  for (const Move move : pos.legal_moves) {
+    writer->Put<uint16_t>(move.raw_data());
+  }
+}
+
+void DecodeEvalPosition(PayloadReader* reader, DecodedPosition* pos) {
+  const size_t history = reader->Get<uint8_t>();
+  // The backends look at the last position.
+  if (history == 0) throw Exception("Remote position without history");
+  pos->history.clear();
+  pos->history.reserve(history);
+  for (size_t i = 0; i < history; ++i) {
+    ChessBoard board;
+    board.SetFromFen(reader->GetString());
+    const int rule50_ply = reader->Get<uint16_t>();
+    const int game_ply = reader->Get<uint16_t>();
+    pos->history.emplace_back(board, rule50_ply, game_ply);
+    const int repetitions = reader->Get<uint8_t>();
+    pos->history.back().SetRepetitions(repetitions, reader->Get<uint16_t>());
+  }
+  const size_t moves = reader->Get<uint16_t>();
+  pos->legal_moves.resize(moves);
+  for (Move& move : pos->legal_moves) {
+    move = Move::FromRawData(reader->Get<uint16_t>());
+  }
+}
+
+void EncodeEvalResult(const EvalResult& result, PayloadWriter* writer) {
+  writer->Put<float>(result.q);
+  writer->Put<float>(result.d);
+  writer->Put<float>(result.m);
+  writer->Put<uint16_t>(result.p.size());
+  for (const float p : result.p) writer->Put<float>(p);
+}
+
+void DecodeEvalResult(PayloadReader* reader, const EvalResultPtr& result) {
+  const float q = reader->Get<float>();
+  const float d = reader->Get<float>();
+  const float m = reader->Get<float>();
+  if (result.q) *result.q = q;
+  if (result.d) *result.d = d;
+  if (result.m) *result.m = m;
+  const size_t moves = reader->Get<uint16_t>();
+  for (size_t i = 0; i < moves; ++i) {
+    const float p = reader->Get<float>();
+    if (i < result.p.size()) result.p[i] = p;
+  }
+}
+
+}  // namespace remote
+}  // namespace lczero
@@ -0,0 +1,205 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chess/position.h"
+#include "neural/backend.h"
+#include "utils/exception.h"
+
+namespace lczero {
+namespace remote {
+
+// Wire protocol of the "remote" backend and the "serve" mode.
+//
+// Every message is a frame: FrameHeader followed by the payload. The payload
+// is optionally zlib compressed as a whole, so a batch of similar positions
+// compresses well. Multi-byte values are in the host byte order, both ends
+// are expected to run on little endian machines.
+//
+// Client sends kHello and receives kAttributes (or kError), then sends
+// kEvalRequest frames, without waiting for the previous responses. Server
+// replies with kEvalResponse (or kError) with the same request id, in the
+// order of requests.
+//
+// kHello is the protocol version and the name of the client, for the server
+// statistics. kEvalRequest is the priority, the time in microseconds within
+// which the client wants the response (0 if it has no deadline) and the
+// positions.
+
+constexpr uint32_t kMagic = 0x5230434c;  // "LC0R"
+constexpr uint32_t kProtocolVersion = 2;
+constexpr int kDefaultPort = 17835;
+// Payloads smaller than that are sent uncompressed.
+constexpr size_t kMinCompressSize = 256;
+// Larger frames (on the wire or decompressed) are rejected, a full batch is
+// a few megabytes at most.
+constexpr size_t kMaxFrameSize = 64 << 20;
+
+enum class MessageType : uint8_t {
+  kHello = 1,
+  kAttributes = 2,
+  kEvalRequest = 3,
+  kEvalResponse = 4,
+  kError = 5,
+};
+
+enum FrameFlags : uint8_t {
+  kFlagCompressed = 1,
+};
+
+struct FrameHeader {
+  uint32_t magic;
+  MessageType type;
+  uint8_t flags;
+  uint16_t reserved;
+  uint32_t request_id;
+  // Size of the payload on the wire.
+  uint32_t payload_size;
+  // Size of the payload after decompression.
+  uint32_t raw_size;
+};
+static_assert(sizeof(FrameHeader) == 20);
+
+struct Frame {
+  MessageType type;
+  uint32_t request_id;
+  // Decompressed payload.
+  std::string payload;
+  // Whether the payload was compressed on the wire.
+  bool compressed;
+};
+
+// Blocking TCP socket. Throws Exception on errors.
+class Socket {
+ public:
+  Socket() = default;
+  ~Socket();
+  Socket(Socket&& other);
+  Socket& operator=(Socket&& other);
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+
+  static Socket Connect(const std::string& host, int port);
+  static Socket Listen(const std::string& host, int port);
+  // Waits for the next incoming connection of a listening socket.
+  Socket Accept();
+
+  // Returns false if the connection was closed before any byte was read.
+  bool ReadAll(void* data, size_t size);
+  // Blocks until some data arrives and reads up to @size bytes of it. Returns
+  // 0 if the connection was closed.
+  size_t ReadSome(void* data, size_t size);
+  void WriteAll(const void* data, size_t size);
+  // Wakes up the threads blocked in reads, so that the socket can be closed.
+  void Shutdown();
+  void Close();
+  bool is_open() const;
+
+ private:
+  explicit Socket(intptr_t fd) : fd_(fd) {}
+  intptr_t fd_ = -1;
+};
+
+// Returns false on the end of stream before the frame.
+bool ReadFrame(Socket* socket, Frame* frame);
+// The payload is compressed when @compress is set and it's large enough.
+void WriteFrame(Socket* socket, MessageType type, uint32_t request_id,
+                std::string_view payload, bool compress);
+
+class PayloadWriter {
+ public:
+  template <typename T>
+  void Put(T value) {
+    const size_t offset = buffer_.size();
+    buffer_.resize(offset + sizeof(T));
+    std::memcpy(buffer_.data() + offset, &value, sizeof(T));
+  }
+  void PutString(std::string_view str) {
+    Put<uint16_t>(str.size());
+    buffer_.append(str);
+  }
+  const std::string& data() const { return buffer_; }
+  void Clear() { buffer_.clear(); }
+
+ private:
+  std::string buffer_;
+};
+
+class PayloadReader {
+ public:
+  explicit PayloadReader(std::string_view data) : data_(data) {}
+  template <typename T>
+  T Get() {
+    T value;
+    std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+    return value;
+  }
+  std::string_view GetString() {
+    const size_t size = Get<uint16_t>();
+    return std::string_view(Take(size), size);
+  }
+  bool empty() const { return data_.empty(); }
+
+ private:
+  const char* Take(size_t size) {
+    if (size > data_.size()) throw Exception("Truncated remote message");
+    const char* result = data_.data();
+    data_.remove_prefix(size);
+    return result;
+  }
+  std::string_view data_;
+};
+
+void EncodeAttributes(const BackendAttributes& attrs, PayloadWriter* writer);
+BackendAttributes DecodeAttributes(PayloadReader* reader);
+
+// Sends the last kMoveHistory positions of the history (that's all the
+// encoder looks at) and the legal moves.
+void EncodeEvalPosition(const EvalPosition& pos, PayloadWriter* writer);
+
+struct DecodedPosition {
+  std::vector<Position> history;
+  std::vector<Move> legal_moves;
+  EvalPosition AsEvalPosition() const { return {history, legal_moves}; }
+};
+void DecodeEvalPosition(PayloadReader* reader, DecodedPosition* pos);
+
+// Results are sent as q, d, m and the policy of every legal move.
+void EncodeEvalResult(const EvalResult& result, PayloadWriter* writer);
+// Any of the output pointers may be null, then the value is skipped.
+void DecodeEvalResult(PayloadReader* reader, const EvalResultPtr& result);
+
+}  // namespace remote
+}  // namespace lczero
@@ -64,6 +64,88 @@ const OptionId SharedBackendParams::kNNCacheSizeId{
     "nncache", "NNCacheSize",
     "Number of positions to store in a memory cache. A large cache can speed "
     "up searching, but takes memory."};
+const OptionId SharedBackendParams::kNNCacheShardsId{
+    "nncache-shards", "NNCacheShards",
+    "Number of independently locked parts the memory cache is split into. "
+    "Values larger than 1 reduce lock contention with many search threads. "
+    "Only used by the fifo cache type."};
+const OptionId SharedBackendParams::kNNCacheTypeId{
+    "nncache-type", "NNCacheType",
+    "Memory cache implementation. fifo is a hash table with first in, first "
+    "out eviction. clock uses cache line sized buckets with per-bucket locks "
+    "and second chance eviction, and doesn't allocate memory per entry."};
+const OptionId SharedBackendParams::kLargePagesId{
+    "large-pages", "LargePages",
+    "Use large memory pages for the search tree, the memory cache and the "
+    "transposition table, which reduces address translation misses. On Linux "
+    "uses reserved huge pages or transparent huge pages, on Windows requires "
+    "the \"Lock pages in memory\" privilege."};
+const OptionId SharedBackendParams::kMemoryBudgetId{
+    "memory-budget", "MemoryBudget",
+    "Memory to use, in megabytes, split between the NN cache, the search tree "
+    "and the backend by the MemoryBudget*Share options. When set, overrides "
+    "NNCacheSize and limits the tree like TreeMemoryLimit (the DAG search "
+    "stops instead). Recomputed before every search. When set to 0, the "
+    "individual settings are used."};
+const OptionId SharedBackendParams::kMemoryBudgetCacheShareId{
+    "memory-budget-cache-share", "MemoryBudgetCacheShare",
+    "Part of the MemoryBudget given to the NN cache."};
+const OptionId SharedBackendParams::kMemoryBudgetTreeShareId{
+    "memory-budget-tree-share", "MemoryBudgetTreeShare",
+    "Part of the MemoryBudget given to the search tree and the transposition "
+    "table. What the cache and the tree don't take is left to the backend."};
+const OptionId SharedBackendParams::kNNCacheStorageId{
+    "nncache-storage", "NNCacheStorage",
+    "Format of the evaluations stored in the memory cache. fp16 stores "
+    "everything as half precision floats, log8 additionally stores policy "
+    "priors as 8-bit log-scaled values. Compact formats fit 2-4 times more "
+    "positions into the same memory, at the cost of slightly rounded values."};
+const OptionId SharedBackendParams::kNNCacheL1SizeId{
+    "nncache-l1-size", "NNCacheL1Size",
+    "Number of positions in the small per-thread cache in front of the memory "
+    "cache. It holds recently used evaluations and is accessed without locks. "
+    "0 disables it."};
+const OptionId SharedBackendParams::kNNCacheHostSizeId{
+    "nncache-host-size", "NNCacheHostSize",
+    "Size in MiB of the cache in shared memory behind the memory cache. All "
+    "lc0 processes on the host using the same network and cache options share "
+    "it, so a position evaluated by one of them isn't evaluated by the others. "
+    "It stays there after the processes exit. 0 disables it."};
+const OptionId SharedBackendParams::kNNCoalesceDeadlineId{
+    "nn-coalesce-deadline", "NNCoalesceDeadline",
+    "Time in microseconds a batch waits for positions from other search "
+    "threads or games before it's sent to the backend. Merging the requests "
+    "of many concurrent games fills the batches better. 0 disables merging."};
+const OptionId SharedBackendParams::kNNCoalesceMaxBatchId{
+    "nn-coalesce-max-batch", "NNCoalesceMaxBatch",
+    "Number of positions after which a merged batch is sent to the backend "
+    "without waiting for the deadline. 0 means the maximum batch size of the "
+    "backend."};
+const OptionId SharedBackendParams::kNNCoalesceDeduplicateId{
+    "nn-coalesce-deduplicate", "NNCoalesceDeduplicate",
+    "Evaluate identical positions which end up in the same merged batch only "
+    "once, e.g. when concurrent selfplay games play the same opening. Only "
+    "has effect when NNCoalesceDeadline is set."};
+const OptionId SharedBackendParams::kNNPriorityId{
+    "nn-priority", "NNPriority",
+    "Priority class of the neural network requests of the search, for when "
+    "the backend is shared with other searches or games. The multiplexing "
+    "backend and request merging serve higher classes first. The evaluation "
+    "of the root is always sent with high priority."};
+const OptionId SharedBackendParams::kNNEncodingThreadsId{
+    "nn-encoding-threads", "NNEncodingThreads",
+    "Number of helper threads which encode the positions of large batches into "
+    "network inputs and compute the policy softmax of the results. 0 does it "
+    "on the search thread as positions are added."};
+const OptionId SharedBackendParams::kBackendWarmupId{
+    {.long_flag = "backend-warmup",
+     .uci_option = "BackendWarmup",
+     .help_text =
+         "Evaluates batches of increasing size when the backend is created, so "
+         "that the backend doesn't allocate or tune things in the middle of "
+         "the game. The measured latencies are used to pick the minibatch "
+         "size when MinibatchSize is 0.",
+     .visibility = OptionId::kProOnly}};
 
 void SharedBackendParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kPolicySoftmaxTemp, 0.1f, 10.0f) = 1.359f;
@@ -81,6 +163,36 @@ void SharedBackendParams::Populate(OptionsParser* options) {
   options->Add<StringOption>(SharedBackendParams::kBackendOptionsId);
   options->Add<IntOption>(SharedBackendParams::kNNCacheSizeId, 0, 999999999) =
       2000000;
+  options->Add<IntOption>(SharedBackendParams::kNNCacheShardsId, 1, 256) = 1;
+  std::vector<std::string> cache_types{"fifo", "clock"};
+  options->Add<ChoiceOption>(SharedBackendParams::kNNCacheTypeId,
+                             cache_types) = "fifo";
+  options->Add<BoolOption>(SharedBackendParams::kLargePagesId) = false;
+  options->Add<IntOption>(SharedBackendParams::kMemoryBudgetId, 0, 100000000) =
+      0;
+  options->Add<FloatOption>(SharedBackendParams::kMemoryBudgetCacheShareId,
+                            0.0f, 1.0f) = 0.4f;
+  options->Add<FloatOption>(SharedBackendParams::kMemoryBudgetTreeShareId,
+                            0.0f, 1.0f) = 0.5f;
+  std::vector<std::string> cache_storage{"fp32", "fp16", "log8"};
+  options->Add<ChoiceOption>(SharedBackendParams::kNNCacheStorageId,
+                             cache_storage) = "fp32";
+  options->Add<IntOption>(SharedBackendParams::kNNCacheL1SizeId, 0, 65536) =
+      256;
+  options->Add<IntOption>(SharedBackendParams::kNNCacheHostSizeId, 0, 65536) =
+      0;
+  options->Add<IntOption>(SharedBackendParams::kNNCoalesceDeadlineId, 0,
+                          1000000) = 0;
+  options->Add<IntOption>(SharedBackendParams::kNNCoalesceMaxBatchId, 0,
+                          65536) = 0;
+  options->Add<BoolOption>(SharedBackendParams::kNNCoalesceDeduplicateId) =
+      false;
+  std::vector<std::string> priorities{"low", "normal", "high"};
+  options->Add<ChoiceOption>(SharedBackendParams::kNNPriorityId,
+                             priorities) = "normal";
+  options->Add<IntOption>(SharedBackendParams::kNNEncodingThreadsId, 0, 64) =
+      0;
+  options->Add<BoolOption>(SharedBackendParams::kBackendWarmupId) = false;
 }
 
 }  // namespace lczero
\ No newline at end of file
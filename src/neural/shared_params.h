@@ -44,6 +44,21 @@ struct SharedBackendParams {
   static const OptionId kBackendId;
   static const OptionId kBackendOptionsId;
   static const OptionId kNNCacheSizeId;
+  static const OptionId kNNCacheShardsId;
+  static const OptionId kNNCacheTypeId;
+  static const OptionId kLargePagesId;
+  static const OptionId kMemoryBudgetId;
+  static const OptionId kMemoryBudgetCacheShareId;
+  static const OptionId kMemoryBudgetTreeShareId;
+  static const OptionId kNNCacheStorageId;
+  static const OptionId kNNCacheL1SizeId;
+  static const OptionId kNNCacheHostSizeId;
+  static const OptionId kNNCoalesceDeadlineId;
+  static const OptionId kNNCoalesceMaxBatchId;
+  static const OptionId kNNCoalesceDeduplicateId;
+  static const OptionId kNNPriorityId;
+  static const OptionId kNNEncodingThreadsId;
+  static const OptionId kBackendWarmupId;
 
   static void Populate(OptionsParser*);
 
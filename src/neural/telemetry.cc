@@ -0,0 +1,350 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/telemetry.h"
+
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#include "utils/exception.h"
+#include "utils/files.h"
+#include "utils/histogram.h"
+#include "utils/logging.h"
+#include "utils/trace.h"
+
+namespace lczero {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ToSeconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+std::string FormatSeconds(double seconds) {
+  std::ostringstream oss;
+  oss.precision(3);
+  if (seconds < 1e-3) {
+    oss << seconds * 1e6 << "us";
+  } else if (seconds < 1.0) {
+    oss << seconds * 1e3 << "ms";
+  } else {
+    oss << seconds << "s";
+  }
+  return oss.str();
+}
+
+std::string FormatPercent(uint64_t count, uint64_t total) {
+  std::ostringstream oss;
+  oss.precision(3);
+  oss << (total ? 100.0 * count / total : 0.0) << "%";
+  return oss.str();
+}
+
+template <class F>
+std::string FormatQuantiles(const Histogram& histogram, F&& format) {
+  std::string result;
+  for (auto [name, q] : {std::pair{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}}) {
+    if (!result.empty()) result += " ";
+    result += std::string(name) + " " + format(histogram.GetQuantile(q));
+  }
+  return result;
+}
+
+void AppendPrometheusHistogram(std::ostringstream* oss, const std::string& name,
+                               const std::string& help,
+                               const Histogram& histogram) {
+  *oss << "# HELP " << name << " " << help << "\n";
+  *oss << "# TYPE " << name << " histogram\n";
+  double count = 0;
+  double prev_upper_bound = 0;
+  for (size_t i = 0; i < histogram.GetNumBuckets(); ++i) {
+    count += histogram.GetBucketCount(i);
+    const double upper_bound = histogram.GetBucketUpperBound(i);
+    // Bounds must be unique, the counts will be merged into the next bucket.
+    if (upper_bound == prev_upper_bound) continue;
+    prev_upper_bound = upper_bound;
+    if (std::isinf(upper_bound)) {
+      *oss << name << "_bucket{le=\"+Inf\"} " << count << "\n";
+    } else {
+      *oss << name << "_bucket{le=\"" << upper_bound << "\"} " << count
+           << "\n";
+    }
+  }
+  *oss << name << "_sum " << histogram.GetSum() << "\n";
+  *oss << name << "_count " << histogram.GetCount() << "\n";
+}
+
+class TelemetryBackendImpl : public TelemetryBackend {
+ public:
+  TelemetryBackendImpl(std::unique_ptr<CachingBackend> wrapped)
+      : wrapped_backend_(std::move(wrapped)) {}
+
+  ~TelemetryBackendImpl() override { SetDumpFile("", {}); }
+
+  BackendAttributes GetAttributes() const override {
+    return wrapped_backend_->GetAttributes();
+  }
+  std::unique_ptr<BackendComputation> CreateComputation() override;
+  std::optional<EvalResult> GetCachedEvaluation(
+      const EvalPosition& pos) override {
+    return wrapped_backend_->GetCachedEvaluation(pos);
+  }
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    return wrapped_backend_->UpdateConfiguration(options);
+  }
+  bool IsSameConfiguration(const OptionsDict& options) const override {
+    return wrapped_backend_->IsSameConfiguration(options);
+  }
+
+  void ClearCache() override { wrapped_backend_->ClearCache(); }
+  void SetCacheSize(size_t size) override {
+    wrapped_backend_->SetCacheSize(size);
+  }
+  void SaveCache(const std::string& filename) override {
+    wrapped_backend_->SaveCache(filename);
+  }
+  void LoadCache(const std::string& filename) override {
+    wrapped_backend_->LoadCache(filename);
+  }
+  CacheStats GetCacheStats() const override {
+    return wrapped_backend_->GetCacheStats();
+  }
+
+  std::vector<std::string> GetReport() const override;
+  std::string GetPrometheusReport() const override;
+  void SetDumpFile(const std::string& filename,
+                   std::chrono::seconds interval) override;
+
+  void Record(Clock::duration compute_time, size_t batch_size,
+              Clock::duration queue_wait) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    compute_time_.Add(ToSeconds(compute_time));
+    batch_size_.Add(batch_size);
+    queue_wait_.Add(ToSeconds(queue_wait));
+  }
+
+ private:
+  void DumpLoop();
+  void WriteDump();
+
+  std::unique_ptr<CachingBackend> wrapped_backend_;
+
+  mutable std::mutex mutex_;
+  Histogram compute_time_{-6, 2, 5};
+  Histogram batch_size_{0, 4, 5};
+  Histogram queue_wait_{-6, 2, 5};
+
+  // Periodic dump of the Prometheus report.
+  std::mutex dump_mutex_;
+  std::condition_variable dump_cv_;
+  bool stop_dumping_ = false;
+  std::string dump_file_;
+  std::chrono::seconds dump_interval_{0};
+  std::thread dump_thread_;
+};
+
+class TelemetryComputation : public BackendComputation {
+ public:
+  TelemetryComputation(std::unique_ptr<BackendComputation> wrapped,
+                       TelemetryBackendImpl* backend)
+      : wrapped_computation_(std::move(wrapped)), backend_(backend) {}
+
+  size_t UsedBatchSize() const override {
+    return wrapped_computation_->UsedBatchSize();
+  }
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    const AddInputResult ret = wrapped_computation_->AddInput(pos, result);
+    if (ret == ENQUEUED_FOR_EVAL) {
+      if (num_evaluated_++ == 0) first_input_time_ = Clock::now();
+    }
+    return ret;
+  }
+  void ComputeBlocking() override {
+    start_time_ = Clock::now();
+    wrapped_computation_->ComputeBlocking();
+    Record();
+  }
+  void ComputeAsync() override {
+    start_time_ = Clock::now();
+    wrapped_computation_->ComputeAsync();
+  }
+  bool IsReady() const override { return wrapped_computation_->IsReady(); }
+  void Wait() override {
+    wrapped_computation_->Wait();
+    Record();
+  }
+  void SetPriority(ComputationPriority priority) override {
+    wrapped_computation_->SetPriority(priority);
+  }
+  void SetRequiredHeads(EvalHeads heads) override {
+    wrapped_computation_->SetRequiredHeads(heads);
+  }
+
+ private:
+  void Record() {
+    // Computations served entirely from the cache don't reach the network.
+    if (!start_time_ || num_evaluated_ == 0) return;
+    const Clock::time_point now = Clock::now();
+    if (Tracer::IsEnabled()) {
+      // From the submission of the batch until the results are available.
+      Tracer::RecordSpan("nn_batch", "backend", *start_time_, now);
+    }
+    backend_->Record(now - *start_time_, num_evaluated_,
+                     *start_time_ - first_input_time_);
+    start_time_.reset();
+  }
+
+  std::unique_ptr<BackendComputation> wrapped_computation_;
+  TelemetryBackendImpl* const backend_;
+  size_t num_evaluated_ = 0;
+  Clock::time_point first_input_time_;
+  std::optional<Clock::time_point> start_time_;
+};
+
+std::unique_ptr<BackendComputation> TelemetryBackendImpl::CreateComputation() {
+  return std::make_unique<TelemetryComputation>(
+      wrapped_backend_->CreateComputation(), this);
+}
+
+std::vector<std::string> TelemetryBackendImpl::GetReport() const {
+  auto format_size = [](double x) {
+    std::ostringstream oss;
+    oss.precision(3);
+    oss << x;
+    return oss.str();
+  };
+  std::vector<std::string> report;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    report.push_back("Backend: " + format_size(compute_time_.GetCount()) +
+                     " computations, " + format_size(batch_size_.GetSum()) +
+                     " positions, " + FormatSeconds(compute_time_.GetSum()) +
+                     " computing.");
+    report.push_back("Batch size: " +
+                     FormatQuantiles(batch_size_, format_size));
+    report.push_back("Compute time: " +
+                     FormatQuantiles(compute_time_, FormatSeconds));
+    report.push_back("Queue wait: " +
+                     FormatQuantiles(queue_wait_, FormatSeconds));
+  }
+  const CacheStats cache = GetCacheStats();
+  const uint64_t hits = cache.l1_hits + cache.l2_hits + cache.host_hits;
+  const uint64_t lookups = hits + cache.misses;
+  report.push_back("NN cache: " + std::to_string(lookups) + " lookups, " +
+                   FormatPercent(hits, lookups) + " hits (per-thread " +
+                   FormatPercent(cache.l1_hits, lookups) + ", shared " +
+                   FormatPercent(cache.l2_hits, lookups) + ", host " +
+                   FormatPercent(cache.host_hits, lookups) + ").");
+  return report;
+}
+
+std::string TelemetryBackendImpl::GetPrometheusReport() const {
+  std::ostringstream oss;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AppendPrometheusHistogram(&oss, "lc0_backend_compute_seconds",
+                              "Wall time of backend computations.",
+                              compute_time_);
+    AppendPrometheusHistogram(&oss, "lc0_backend_batch_size",
+                              "Positions evaluated per backend computation.",
+                              batch_size_);
+    AppendPrometheusHistogram(
+        &oss, "lc0_backend_queue_wait_seconds",
+        "Time from the first input to the start of backend computation.",
+        queue_wait_);
+  }
+  const CacheStats cache = GetCacheStats();
+  oss << "# HELP lc0_nncache_lookups NN cache lookups since the last new "
+         "game.\n";
+  oss << "# TYPE lc0_nncache_lookups gauge\n";
+  oss << "lc0_nncache_lookups{result=\"l1_hit\"} " << cache.l1_hits << "\n";
+  oss << "lc0_nncache_lookups{result=\"l2_hit\"} " << cache.l2_hits << "\n";
+  oss << "lc0_nncache_lookups{result=\"miss\"} " << cache.misses << "\n";
+  return oss.str();
+}
+
+void TelemetryBackendImpl::SetDumpFile(const std::string& filename,
+                                       std::chrono::seconds interval) {
+  if (filename == dump_file_ && interval == dump_interval_) return;
+  if (dump_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(dump_mutex_);
+      stop_dumping_ = true;
+    }
+    dump_cv_.notify_all();
+    dump_thread_.join();
+    WriteDump();
+  }
+  dump_file_ = filename;
+  dump_interval_ = interval;
+  stop_dumping_ = false;
+  if (!dump_file_.empty()) dump_thread_ = std::thread([this]() { DumpLoop(); });
+}
+
+void TelemetryBackendImpl::DumpLoop() {
+  std::unique_lock<std::mutex> lock(dump_mutex_);
+  while (!dump_cv_.wait_for(lock, dump_interval_,
+                            [this]() { return stop_dumping_; })) {
+    lock.unlock();
+    WriteDump();
+    lock.lock();
+  }
+}
+
+void TelemetryBackendImpl::WriteDump() {
+  // Write to a temporary file and rename it, so that the scraper never sees a
+  // partially written file.
+  const std::string tmp_file = dump_file_ + ".tmp";
+  try {
+    WriteStringToFile(tmp_file, GetPrometheusReport());
+  } catch (const Exception& e) {
+    LOGFILE << "Cannot write backend stats: " << e.what();
+    return;
+  }
+#ifdef _WIN32
+  // Unlike POSIX, rename doesn't replace the existing file on Windows.
+  std::remove(dump_file_.c_str());
+#endif
+  std::rename(tmp_file.c_str(), dump_file_.c_str());
+}
+
+}  // namespace
+
+std::unique_ptr<TelemetryBackend> CreateTelemetryBackend(
+    std::unique_ptr<CachingBackend> wrapped) {
+  return std::make_unique<TelemetryBackendImpl>(std::move(wrapped));
+}
+
+}  // namespace lczero
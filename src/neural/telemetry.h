@@ -0,0 +1,57 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "neural/memcache.h"
+
+namespace lczero {
+
+// Caching backend wrapper which collects statistics of the computations: wall
+// time, number of evaluated positions, time the inputs waited before the
+// computation was started, and the cache hit ratio of the wrapped backend.
+class TelemetryBackend : public CachingBackend {
+ public:
+  // Returns a human readable summary, a few lines long.
+  virtual std::vector<std::string> GetReport() const = 0;
+  // Returns the statistics in the Prometheus text exposition format.
+  virtual std::string GetPrometheusReport() const = 0;
+  // Starts writing the Prometheus report to the file every @interval. Empty
+  // filename stops writing.
+  virtual void SetDumpFile(const std::string& filename,
+                           std::chrono::seconds interval) = 0;
+};
+
+std::unique_ptr<TelemetryBackend> CreateTelemetryBackend(
+    std::unique_ptr<CachingBackend> wrapped);
+
+}  // namespace lczero
@@ -0,0 +1,179 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/warmup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+// The profile goes up to this many times the recommended batch size.
+constexpr int kMaxBatchSizeFactor = 4;
+constexpr int kRepetitions = 3;
+
+// Positions of random games, so that the batches are not made of a single
+// position repeated.
+struct WarmupPositions {
+  std::vector<Position> positions;
+  std::vector<MoveList> legal_moves;
+};
+
+WarmupPositions MakeWarmupPositions(size_t count) {
+  WarmupPositions result;
+  // Fixed seed to evaluate the same positions every time.
+  std::mt19937 gen(count);
+  const Position startpos = Position::FromFen(ChessBoard::kStartposFen);
+  Position position = startpos;
+  while (result.positions.size() < count) {
+    MoveList moves = position.GetBoard().GenerateLegalMoves();
+    if (moves.empty() || position.GetGamePly() > 100) {
+      position = startpos;
+      continue;
+    }
+    result.positions.push_back(position);
+    const Move move = moves[gen() % moves.size()];
+    result.legal_moves.push_back(std::move(moves));
+    position = Position(position, move);
+  }
+  return result;
+}
+
+class WarmedUpBackend : public Backend {
+ public:
+  WarmedUpBackend(std::unique_ptr<Backend> wrapped)
+      : wrapped_backend_(std::move(wrapped)),
+        attrs_(wrapped_backend_->GetAttributes()) {
+    const int limit = std::max(
+        1, std::min(attrs_.maximum_batch_size,
+                    kMaxBatchSizeFactor * attrs_.recommended_batch_size));
+    std::vector<int> batch_sizes = {attrs_.recommended_batch_size, limit};
+    for (int size = 1; size < limit; size *= 2) batch_sizes.push_back(size);
+    std::sort(batch_sizes.begin(), batch_sizes.end());
+    batch_sizes.erase(std::unique(batch_sizes.begin(), batch_sizes.end()),
+                      batch_sizes.end());
+    attrs_.latency_profile = ProfileBackendLatency(wrapped_backend_.get(),
+                                                   batch_sizes, kRepetitions);
+    for (const auto& [size, seconds] : attrs_.latency_profile) {
+      CERR << "Batch of " << size << " takes " << seconds * 1000.0f << " ms.";
+    }
+    const int picked = PickBatchSizeFromProfile(attrs_.latency_profile);
+    if (picked > 0) {
+      CERR << "Using recommended batch size " << picked << " instead of "
+           << attrs_.recommended_batch_size << ".";
+      attrs_.recommended_batch_size = picked;
+    }
+  }
+
+  BackendAttributes GetAttributes() const override { return attrs_; }
+  std::unique_ptr<BackendComputation> CreateComputation() override {
+    return wrapped_backend_->CreateComputation();
+  }
+  std::optional<EvalResult> GetCachedEvaluation(
+      const EvalPosition& pos) override {
+    return wrapped_backend_->GetCachedEvaluation(pos);
+  }
+
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    return wrapped_backend_->UpdateConfiguration(options);
+  }
+
+  bool IsSameConfiguration(const OptionsDict& options) const override {
+    return wrapped_backend_->IsSameConfiguration(options);
+  }
+
+ private:
+  std::unique_ptr<Backend> wrapped_backend_;
+  BackendAttributes attrs_;
+};
+
+}  // namespace
+
+std::vector<BatchLatency> ProfileBackendLatency(
+    Backend* backend, std::span<const int> batch_sizes, int repetitions) {
+  const int max_batch_size =
+      batch_sizes.empty()
+          ? 0
+          : *std::max_element(batch_sizes.begin(), batch_sizes.end());
+  const WarmupPositions warmup = MakeWarmupPositions(max_batch_size);
+  std::vector<EvalResult> results(max_batch_size);
+  for (int i = 0; i < max_batch_size; ++i) {
+    results[i].p.resize(warmup.legal_moves[i].size());
+  }
+
+  std::vector<BatchLatency> profile;
+  for (const int batch_size : batch_sizes) {
+    float best = std::numeric_limits<float>::infinity();
+    // The first run of every size is not timed, that's where the backends
+    // allocate or tune things for that batch size.
+    for (int run = 0; run <= repetitions; ++run) {
+      const auto start = std::chrono::steady_clock::now();
+      auto computation = backend->CreateComputation();
+      for (int i = 0; i < batch_size; ++i) {
+        computation->AddInput(
+            EvalPosition{.pos = {&warmup.positions[i], 1},
+                         .legal_moves = warmup.legal_moves[i]},
+            results[i].AsPtr());
+      }
+      computation->ComputeBlocking();
+      const std::chrono::duration<float> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (run > 0) best = std::min(best, elapsed.count());
+    }
+    profile.push_back({.batch_size = batch_size, .seconds = best});
+  }
+  return profile;
+}
+
+int PickBatchSizeFromProfile(std::span<const BatchLatency> profile) {
+  auto nps = [](const BatchLatency& latency) {
+    return latency.seconds > 0.0f ? latency.batch_size / latency.seconds
+                                  : std::numeric_limits<float>::infinity();
+  };
+  float best_nps = 0.0f;
+  for (const auto& latency : profile) {
+    best_nps = std::max(best_nps, nps(latency));
+  }
+  for (const auto& latency : profile) {
+    if (nps(latency) >= 0.9f * best_nps) return latency.batch_size;
+  }
+  return 0;
+}
+
+std::unique_ptr<Backend> CreateWarmedUpBackend(
+    std::unique_ptr<Backend> parent) {
+  return std::make_unique<WarmedUpBackend>(std::move(parent));
+}
+
+}  // namespace lczero
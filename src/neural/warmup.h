@@ -0,0 +1,55 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "neural/backend.h"
+
+namespace lczero {
+
+// Evaluates batches of each of @batch_sizes with the backend, @repetitions
+// (at least one) times after an untimed first run, and returns the fastest
+// time of each.
+std::vector<BatchLatency> ProfileBackendLatency(
+    Backend* backend, std::span<const int> batch_sizes, int repetitions);
+
+// Returns the smallest batch size in @profile that reaches 90% of the best
+// throughput, or 0 if the profile is empty.
+int PickBatchSizeFromProfile(std::span<const BatchLatency> profile);
+
+// Creates a backend wrapper that warms up the backend with batches of sizes
+// up to a few times the recommended one. The measured latencies are exposed
+// in the attributes, and the recommended batch size is picked from them.
+std::unique_ptr<Backend> CreateWarmedUpBackend(
+    std::unique_ptr<Backend> parent);
+
+}  // namespace lczero
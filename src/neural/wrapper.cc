@@ -28,12 +28,17 @@
 #include "neural/wrapper.h"
 
 #include <algorithm>
-#include <numeric>
+#include <chrono>
+#include <future>
 
 #include "neural/encoder.h"
 #include "neural/shared_params.h"
 #include "utils/atomic_vector.h"
 #include "utils/fastmath.h"
+#include "utils/logging.h"
+#include "utils/mutex.h"
+#include "utils/trace.h"
+#include "utils/worker_pool.h"
 
 namespace lczero {
 namespace {
@@ -45,6 +50,39 @@ FillEmptyHistory EncodeHistoryFill(std::string history_fill) {
   return FillEmptyHistory::NO;
 }
 
+// Batches smaller than this many positions per helper thread are processed on
+// fewer threads.
+constexpr size_t kMinEntriesPerEncodingThread = 16;
+
+struct ComputationEntry {
+  // When encoding is deferred to ComputeBlocking(), the tail of the history
+  // which is needed to encode the position. Empty otherwise.
+  std::vector<Position> history;
+  InputPlanes input;
+  MoveList legal_moves;
+  EvalResultPtr result;
+  int transform;
+};
+
+// Per-batch buffers of a computation. They are large (an entry slot per
+// maximum batch size), so instead of allocating and page faulting them for
+// every batch, the backend keeps released ones and hands them to the next
+// computation.
+struct ComputationBuffers {
+  explicit ComputationBuffers(size_t capacity) : entries(capacity) {}
+
+  void Reset() {
+    entries.clear();
+    policy_indices.clear();
+    policy_offsets.clear();
+  }
+
+  AtomicVector<ComputationEntry> entries;
+  std::vector<uint16_t> policy_indices;
+  // policy_indices range of every entry, with an extra end offset.
+  std::vector<size_t> policy_offsets;
+};
+
 class NetworkAsBackend : public Backend {
  public:
   NetworkAsBackend(std::unique_ptr<Network> network, const OptionsDict& options)
@@ -61,6 +99,7 @@ class NetworkAsBackend : public Backend {
     attrs_.suggested_num_search_threads = network_->GetThreads();
     attrs_.recommended_batch_size = network_->GetMiniBatchSize();
     attrs_.maximum_batch_size = 1024;
+    attrs_.device_memory = network_->GetDeviceMemoryUsage();
     input_format_ = caps.input_format;
   }
 
@@ -73,25 +112,85 @@ class NetworkAsBackend : public Backend {
         options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
       return NEED_RESTART;
     }
-    if (weights_path_ !=
-        options.Get<std::string>(SharedBackendParams::kWeightsId)) {
-      return NEED_RESTART;
+    const std::string weights_path =
+        options.Get<std::string>(SharedBackendParams::kWeightsId);
+    if (weights_path_ != weights_path) {
+      // Try to load the new weights into the existing network, keeping its
+      // device state.
+      std::optional<WeightsFile> weights = LoadWeights(weights_path);
+      if (!weights || !network_->UpdateWeights(*weights)) return NEED_RESTART;
+      CERR << "Updated weights to " << weights_path
+           << " without restarting the backend.";
+      weights_path_ = weights_path;
     }
     softmax_policy_temperature_ =
         1.0f / options.Get<float>(SharedBackendParams::kPolicySoftmaxTemp);
     fill_empty_history_ = EncodeHistoryFill(
         options.Get<std::string>(SharedBackendParams::kHistoryFill));
+    const int encoding_threads =
+        options.GetOrDefault<int>(SharedBackendParams::kNNEncodingThreadsId, 0);
+    if (encoding_threads !=
+        (encoding_pool_ ? encoding_pool_->GetSize() : 0)) {
+      encoding_pool_.reset();
+      if (encoding_threads > 0) {
+        encoding_pool_ =
+            std::make_unique<WorkerPool>(encoding_threads, nullptr);
+      }
+    }
     return UPDATE_OK;
   }
 
  private:
+  std::unique_ptr<ComputationBuffers> AcquireBuffers() {
+    {
+      Mutex::Lock lock(buffers_mutex_);
+      if (!free_buffers_.empty()) {
+        std::unique_ptr<ComputationBuffers> buffers =
+            std::move(free_buffers_.back());
+        free_buffers_.pop_back();
+        return buffers;
+      }
+    }
+    return std::make_unique<ComputationBuffers>(attrs_.maximum_batch_size);
+  }
+
+  void ReleaseBuffers(std::unique_ptr<ComputationBuffers> buffers) {
+    buffers->Reset();
+    Mutex::Lock lock(buffers_mutex_);
+    free_buffers_.push_back(std::move(buffers));
+  }
+
+  // Calls @fn(begin, end) on ranges of [0, size), in parallel on the encoding
+  // pool if there is one and the batch is large enough.
+  template <typename F>
+  void ParallelFor(size_t size, F&& fn) {
+    const size_t num_threads =
+        encoding_pool_
+            ? std::min<size_t>(encoding_pool_->GetSize(),
+                               size / kMinEntriesPerEncodingThread)
+            : 0;
+    if (num_threads <= 1) {
+      fn(size_t{0}, size);
+      return;
+    }
+    encoding_pool_->Run(num_threads, [&](int id) {
+      fn(size * id / num_threads, size * (id + 1) / num_threads);
+    });
+  }
+
   std::unique_ptr<Network> network_;
+  std::unique_ptr<WorkerPool> encoding_pool_;
   BackendAttributes attrs_;
   pblczero::NetworkFormat::InputFormat input_format_;
   float softmax_policy_temperature_;
   FillEmptyHistory fill_empty_history_;
   const std::string backend_opts_;
-  const std::string weights_path_;
+  std::string weights_path_;
+  Mutex buffers_mutex_;
+  // Buffers of the finished computations, at most one per computation that
+  // was alive at the same time.
+  std::vector<std::unique_ptr<ComputationBuffers>> free_buffers_
+      GUARDED_BY(buffers_mutex_);
 
   friend class NetworkAsBackendComputation;
 };
@@ -101,14 +200,40 @@ class NetworkAsBackendComputation : public BackendComputation {
   NetworkAsBackendComputation(NetworkAsBackend* backend)
       : backend_(backend),
         computation_(backend_->network_->NewComputation()),
-        entries_(backend_->attrs_.maximum_batch_size) {}
+        buffers_(backend_->AcquireBuffers()),
+        entries_(buffers_->entries),
+        policy_indices_(buffers_->policy_indices),
+        policy_offsets_(buffers_->policy_offsets) {}
+
+  ~NetworkAsBackendComputation() {
+    // The buffers may only be handed over once the computation is done.
+    if (pending_.valid()) pending_.wait();
+    backend_->ReleaseBuffers(std::move(buffers_));
+  }
 
   size_t UsedBatchSize() const override { return entries_.size(); }
 
   AddInputResult AddInput(const EvalPosition& pos,
                           EvalResultPtr result) override {
+    if (!required_heads_.policy) result.p = {};
+    if (!required_heads_.moves_left) result.m = nullptr;
+    if (backend_->encoding_pool_) {
+      // Only keep what the encoder looks at (one more position than the
+      // history planes, so that it sees the same history boundaries), the
+      // encoding is done for the whole batch in ComputeBlocking().
+      const auto tail = pos.pos.last(std::min<size_t>(pos.pos.size(), 9));
+      entries_.emplace_back(ComputationEntry{
+          .history = std::vector<Position>(tail.begin(), tail.end()),
+          .input = {},
+          .legal_moves =
+              MoveList(pos.legal_moves.begin(), pos.legal_moves.end()),
+          .result = result,
+          .transform = 0});
+      return ENQUEUED_FOR_EVAL;
+    }
     int transform;
-    const size_t idx = entries_.emplace_back(Entry{
+    const size_t idx = entries_.emplace_back(ComputationEntry{
+        .history = {},
         .input = EncodePositionForNN(backend_->input_format_, pos.pos, 8,
                                      backend_->fill_empty_history_, &transform),
         .legal_moves = MoveList(pos.legal_moves.begin(), pos.legal_moves.end()),
@@ -119,50 +244,112 @@ class NetworkAsBackendComputation : public BackendComputation {
   }
 
   void ComputeBlocking() override {
-    for (auto& entry : entries_) computation_->AddInput(std::move(entry.input));
-    computation_->ComputeBlocking();
+    if (backend_->encoding_pool_) {
+      backend_->ParallelFor(entries_.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          ComputationEntry& entry = entries_[i];
+          if (entry.history.empty()) continue;
+          entry.input = EncodePositionForNN(
+              backend_->input_format_, entry.history, 8,
+              backend_->fill_empty_history_, &entry.transform);
+        }
+      });
+    }
+    // NN indices of the legal moves of all entries, precomputed once per batch
+    // and used both for the on-device gather and for the policy readout.
+    policy_indices_.clear();
+    policy_offsets_.clear();
+    // Heads which no entry reads from are not needed for the batch.
+    EvalHeads heads{.policy = false, .moves_left = false};
+    for (const auto& entry : entries_) {
+      policy_offsets_.push_back(policy_indices_.size());
+      if (entry.result.m) heads.moves_left = true;
+      if (entry.result.p.empty()) continue;
+      heads.policy = true;
+      for (const Move& move : entry.legal_moves) {
+        policy_indices_.push_back(MoveToNNIndex(move, entry.transform));
+      }
+    }
+    policy_offsets_.push_back(policy_indices_.size());
+    computation_->SetRequiredHeads(heads);
     for (size_t i = 0; i < entries_.size(); ++i) {
-      const EvalResultPtr& result = entries_[i].result;
-      if (result.q) *result.q = computation_->GetQVal(i);
-      if (result.d) *result.d = computation_->GetDVal(i);
-      if (result.m) *result.m = computation_->GetMVal(i);
-      if (!result.p.empty()) SoftmaxPolicy(result.p, computation_.get(), i);
+      computation_->AddInputWithPolicyIndices(std::move(entries_[i].input),
+                                              GetPolicyIndices(i));
+    }
+    {
+      TraceSpan trace_span("network_compute", "backend");
+      computation_->ComputeBlocking();
     }
+    const float temperature = backend_->softmax_policy_temperature_;
+    backend_->ParallelFor(entries_.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const EvalResultPtr& result = entries_[i].result;
+        if (result.q) *result.q = computation_->GetQVal(i);
+        if (result.d) *result.d = computation_->GetDVal(i);
+        if (result.m) *result.m = computation_->GetMVal(i);
+        if (!result.p.empty()) {
+          SoftmaxPolicy(result.p, computation_.get(), i, temperature);
+        }
+      }
+    });
+  }
+
+  // Network computations are blocking, so the async version runs the whole
+  // thing on a separate thread.
+  void ComputeAsync() override {
+    assert(!pending_.valid());
+    pending_ = std::async(std::launch::async, [this]() { ComputeBlocking(); });
+  }
+
+  bool IsReady() const override {
+    return !pending_.valid() || pending_.wait_for(std::chrono::seconds(0)) ==
+                                    std::future_status::ready;
   }
 
+  void Wait() override {
+    // get() rethrows the exception if the computation has failed.
+    if (pending_.valid()) pending_.get();
+  }
+
+  void SetPriority(ComputationPriority priority) override {
+    computation_->SetPriority(priority);
+  }
+
+  void SetRequiredHeads(EvalHeads heads) override { required_heads_ = heads; }
+
   void SoftmaxPolicy(std::span<float> dst,
-                     const NetworkComputation* computation, int idx) {
-    const std::vector<Move>& moves = entries_[idx].legal_moves;
-    const int transform = entries_[idx].transform;
-    // Copy the values to the destination array and compute the maximum.
-    const float max_p = std::accumulate(
-        moves.begin(), moves.end(), -std::numeric_limits<float>::infinity(),
-        [&, counter = 0](float max_p, const Move& move) mutable {
-          return std::max(max_p, dst[counter++] = computation->GetPVal(
-                                     idx, MoveToNNIndex(move, transform)));
-        });
-    // Compute the softmax and compute the total.
-    const float temperature = backend_->softmax_policy_temperature_;
-    float total = std::accumulate(
-        dst.begin(), dst.end(), 0.0f, [&](float total, float& val) {
-          return total + (val = FastExp((val - max_p) * temperature));
-        });
-    const float scale = total > 0.0f ? 1.0f / total : 1.0f;
-    // Scale the values to sum to 1.0.
-    std::for_each(dst.begin(), dst.end(), [&](float& val) { val *= scale; });
+                     const NetworkComputation* computation, int idx,
+                     float temperature) {
+    const std::span<const uint16_t> indices = GetPolicyIndices(idx);
+    if (const float* gathered = computation->GetGatheredPVals(idx)) {
+      std::copy(gathered, gathered + indices.size(), dst.begin());
+    } else {
+      std::transform(indices.begin(), indices.end(), dst.begin(),
+                     [&](uint16_t nn_idx) {
+                       return computation->GetPVal(idx, nn_idx);
+                     });
+    }
+    FastSoftmax(dst.data(), indices.size(), temperature);
   }
 
  private:
-  struct Entry {
-    InputPlanes input;
-    MoveList legal_moves;
-    EvalResultPtr result;
-    int transform;
-  };
+  std::span<const uint16_t> GetPolicyIndices(size_t idx) const {
+    return std::span<const uint16_t>(policy_indices_)
+        .subspan(policy_offsets_[idx],
+                 policy_offsets_[idx + 1] - policy_offsets_[idx]);
+  }
 
   NetworkAsBackend* backend_;
   std::unique_ptr<NetworkComputation> computation_;
-  AtomicVector<Entry> entries_;
+  std::unique_ptr<ComputationBuffers> buffers_;
+  EvalHeads required_heads_;
+  // References into buffers_.
+  AtomicVector<ComputationEntry>& entries_;
+  std::vector<uint16_t>& policy_indices_;
+  std::vector<size_t>& policy_offsets_;
+  // Must be the last member, so that the destructor waits for the computation
+  // to finish before everything else is destroyed.
+  std::future<void> pending_;
 };
 
 std::unique_ptr<BackendComputation> NetworkAsBackend::CreateComputation() {
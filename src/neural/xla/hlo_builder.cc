@@ -289,11 +289,12 @@ HloFlow HloBuilder::Gather(HloFlow input, HloFlow indices,
   return flow;
 }
 
-HloFlow HloBuilder::Dot(HloFlow lhs, HloFlow rhs,
-                        const pblczero::XlaDotDimensionNumbers& dn) {
+HloFlow HloBuilder::Dot(
+    HloFlow lhs, HloFlow rhs, const pblczero::XlaDotDimensionNumbers& dn,
+    std::optional<pblczero::XlaShapeProto::Type> result_type) {
   HloTensorType lhs_shape(lhs->shape());
   HloTensorType rhs_shape(rhs->shape());
-  HloTensorType new_shape(lhs_shape.GetElementType());
+  HloTensorType new_shape(result_type.value_or(lhs_shape.GetElementType()));
   if (lhs_shape.GetElementType() != rhs_shape.GetElementType()) {
     throw Exception("Dot operands must have the same element type");
   }
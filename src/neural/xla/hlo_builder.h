@@ -114,8 +114,12 @@ class HloBuilder {
   HloFlow Divide(HloFlow lhs, HloFlow rhs);
   HloFlow Maximum(HloFlow lhs, HloFlow rhs);
   HloFlow Reshape(HloFlow input, const HloTensorType& new_shape);
+  // If result_type is not set, the result has the element type of the
+  // operands.
   HloFlow Dot(HloFlow lhs, HloFlow rhs,
-              const pblczero::XlaDotDimensionNumbers& dimension_numbers);
+              const pblczero::XlaDotDimensionNumbers& dimension_numbers,
+              std::optional<pblczero::XlaShapeProto::Type> result_type =
+                  std::nullopt);
   HloFlow Slice(
       HloFlow input,
       const std::vector<pblczero::HloInstructionProto::SliceDimensions>& slice);
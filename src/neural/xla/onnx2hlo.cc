@@ -28,6 +28,9 @@
 #include "neural/xla/onnx2hlo.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
 #include <numeric>
 #include <unordered_map>
 #include <unordered_set>
@@ -309,6 +312,170 @@ pblczero::XlaLiteralProto ConstReshape(
   return result;
 }
 
+bool IsFoldableType(pblczero::TensorProto::DataType type) {
+  switch (type) {
+    case pblczero::TensorProto::FLOAT:
+    case pblczero::TensorProto::FLOAT16:
+    case pblczero::TensorProto::BFLOAT16:
+    case pblczero::TensorProto::FLOAT8E4M3FN:
+    case pblczero::TensorProto::FLOAT8E5M2:
+      return true;
+    default:
+      return false;
+  }
+}
+
+size_t GetOnnxTypeSize(pblczero::TensorProto::DataType type) {
+  switch (type) {
+    case pblczero::TensorProto::FLOAT:
+      return sizeof(float);
+    case pblczero::TensorProto::FLOAT8E4M3FN:
+    case pblczero::TensorProto::FLOAT8E5M2:
+      return sizeof(uint8_t);
+    default:
+      return sizeof(uint16_t);
+  }
+}
+
+// Largest finite value of an fp8 type.
+float GetFp8Max(pblczero::XlaShapeProto::Type type) {
+  switch (type) {
+    case pblczero::XlaShapeProto::F8E4M3FN:
+      return 448.0f;
+    case pblczero::XlaShapeProto::F8E5M2:
+      return 57344.0f;
+    default:
+      throw Exception("Unsupported fp8 type " +
+                      pblczero::XlaShapeProto::Type_Name(type));
+  }
+}
+
+// Decodes a floating point ONNX tensor with raw data into floats.
+std::vector<float> OnnxTensorToFloats(const pblczero::TensorProto& tensor) {
+  const std::string_view raw = tensor.raw_data();
+  std::vector<float> result(raw.size() / GetOnnxTypeSize(tensor.data_type()));
+  const auto* bytes = reinterpret_cast<const uint8_t*>(raw.data());
+  std::vector<uint16_t> halves;
+  switch (tensor.data_type()) {
+    case pblczero::TensorProto::FLOAT:
+      std::memcpy(result.data(), raw.data(), result.size() * sizeof(float));
+      break;
+    case pblczero::TensorProto::FLOAT16:
+    case pblczero::TensorProto::BFLOAT16:
+      // The raw data is not necessarily aligned.
+      halves.resize(result.size());
+      std::memcpy(halves.data(), raw.data(), halves.size() * sizeof(uint16_t));
+      if (tensor.data_type() == pblczero::TensorProto::FLOAT16) {
+        ConvertFP16toFP32(halves.data(), result.data(), result.size());
+      } else {
+        ConvertBF16toFP32(halves.data(), result.data(), result.size());
+      }
+      break;
+    case pblczero::TensorProto::FLOAT8E4M3FN:
+      ConvertFP8E4M3FNtoFP32(bytes, result.data(), result.size());
+      break;
+    case pblczero::TensorProto::FLOAT8E5M2:
+      ConvertFP8E5M2toFP32(bytes, result.data(), result.size());
+      break;
+    default:
+      throw Exception("Cannot fold ONNX tensor of type " +
+                      pblczero::TensorProto::DataType_Name(tensor.data_type()));
+  }
+  return result;
+}
+
+pblczero::TensorProto FloatsToOnnxTensor(std::string_view name,
+                                         pblczero::TensorProto::DataType type,
+                                         const std::vector<int64_t>& dims,
+                                         const std::vector<float>& values) {
+  pblczero::TensorProto tensor;
+  tensor.set_name(name);
+  tensor.set_data_type(type);
+  for (auto dim : dims) tensor.add_dims(dim);
+  std::string raw(values.size() * GetOnnxTypeSize(type), '\0');
+  for (size_t i = 0; i < values.size(); ++i) {
+    uint16_t value;
+    switch (type) {
+      case pblczero::TensorProto::FLOAT:
+        std::memcpy(raw.data() + i * sizeof(float), &values[i], sizeof(float));
+        break;
+      case pblczero::TensorProto::FLOAT16:
+        value = FP32toFP16(values[i]);
+        std::memcpy(raw.data() + i * sizeof(value), &value, sizeof(value));
+        break;
+      case pblczero::TensorProto::BFLOAT16:
+        value = FP32toBF16(values[i]);
+        std::memcpy(raw.data() + i * sizeof(value), &value, sizeof(value));
+        break;
+      case pblczero::TensorProto::FLOAT8E4M3FN:
+        raw[i] = FP32toFP8E4M3FN(values[i]);
+        break;
+      case pblczero::TensorProto::FLOAT8E5M2:
+        raw[i] = FP32toFP8E5M2(values[i]);
+        break;
+      default:
+        throw Exception("Cannot fold ONNX tensor of type " +
+                        pblczero::TensorProto::DataType_Name(type));
+    }
+  }
+  tensor.set_raw_data(raw);
+  return tensor;
+}
+
+// Row-major strides of a tensor of shape @dims, right-aligned to @rank
+// dimensions. Broadcast (size 1 or missing) dimensions get zero stride.
+std::vector<int64_t> GetBroadcastStrides(const std::vector<int64_t>& dims,
+                                         size_t rank) {
+  std::vector<int64_t> strides(rank, 0);
+  int64_t stride = 1;
+  for (size_t i = 0; i < dims.size(); ++i) {
+    const size_t src = dims.size() - 1 - i;
+    if (dims[src] != 1) strides[rank - 1 - i] = stride;
+    stride *= dims[src];
+  }
+  return strides;
+}
+
+// Calls @func(offset) for every element of a tensor of shape @dims in
+// row-major order, where offset is the dot product of the element index and
+// @strides.
+template <typename F>
+void ForEachOffset(const std::vector<int64_t>& dims,
+                   const std::vector<int64_t>& strides, F&& func) {
+  const int64_t count = std::accumulate(dims.begin(), dims.end(), int64_t{1},
+                                        std::multiplies<int64_t>());
+  std::vector<int64_t> index(dims.size(), 0);
+  int64_t offset = 0;
+  for (int64_t i = 0; i < count; ++i) {
+    func(offset);
+    for (size_t d = dims.size(); d-- > 0;) {
+      offset += strides[d];
+      if (++index[d] < dims[d]) break;
+      offset -= strides[d] * dims[d];
+      index[d] = 0;
+    }
+  }
+}
+
+std::vector<float> TransposeFloats(const std::vector<float>& input,
+                                   const std::vector<int64_t>& dims,
+                                   const std::vector<int64_t>& perm) {
+  const auto src_strides = GetBroadcastStrides(dims, dims.size());
+  std::vector<int64_t> new_dims(dims.size());
+  std::vector<int64_t> strides(dims.size());
+  for (size_t i = 0; i < perm.size(); ++i) {
+    new_dims[i] = dims[perm[i]];
+    // Size 1 dimensions have zero stride, which is fine as they are never
+    // iterated over.
+    strides[i] = src_strides[perm[i]];
+  }
+  std::vector<float> result;
+  result.reserve(input.size());
+  ForEachOffset(new_dims, strides,
+                [&](int64_t offset) { result.push_back(input[offset]); });
+  return result;
+}
+
 pblczero::XlaShapeProto::Type OnnxTypeToXlaType(
     const pblczero::TensorProto::DataType& type) {
   switch (type) {
@@ -447,6 +614,9 @@ pblczero::XlaLiteralProto OnnxTensorToXlaLiteral(
     case pblczero::TensorProto::FLOAT8E5M2:
       literal.set_f8e5m2s(tensor.raw_data());
       break;
+    case pblczero::TensorProto::FLOAT8E4M3FN:
+      literal.set_f8e4m3fns(tensor.raw_data());
+      break;
     case pblczero::TensorProto::INT64:
       convert(tensor.raw_data(), literal.mutable_s64s());
       break;
@@ -529,6 +699,12 @@ class Onnx2HloConverter {
         auto& dst = param.is_constant ? result.constants : result.inputs;
         dst.push_back({i, param.name, param.flow->shape()});
       }
+      for (const auto& tensor : folded_initializers_) {
+        auto iter = std::find_if(
+            params_.begin(), params_.end(),
+            [&](const auto& param) { return param.name == tensor.name(); });
+        if (iter != params_.end()) result.folded_constants.push_back(tensor);
+      }
     } catch (Exception& e) {
       if (!options_.debugging_allow_partial_result) throw;
       CERR << "Ignoring error in ONNX to HLO conversion: " << e.what();
@@ -903,6 +1079,14 @@ class Onnx2HloConverter {
     auto sum = builder_.Reduce(
         exp, MakeScalar(0, input->shape().element_type()),
         MakeAddComputation(input->shape().element_type()), {axis});
+    if (options_.fuse_normalizations) {
+      // One division per row instead of one per element.
+      auto* one = MakeScalar(1, sum->shape().element_type());
+      sum = builder_.Divide(DoBroadcast(one, sum->shape().dimensions()), sum);
+      sum = builder_.Broadcast(sum, HloTensorType(input->shape()),
+                               broadcast_dims);
+      return {builder_.Multiply(exp, sum)};
+    }
     sum =
         builder_.Broadcast(sum, HloTensorType(input->shape()), broadcast_dims);
     return {builder_.Divide(exp, sum)};
@@ -1099,11 +1283,27 @@ class Onnx2HloConverter {
     const auto input_type = input->shape().element_type();
     const bool need_conv = input_type != kAccType;
     input = need_conv ? builder_.Convert(input, kAccType) : input;
-    auto* flow =
-        DoBroadcast(DoReduceMean(input, {axis}), input->shape().dimensions());
-    auto* norm = builder_.Subtract(input, flow);
-    flow = builder_.Multiply(norm, norm);
-    flow = DoReduceMean(flow, {axis});
+    HloFlow norm;
+    HloFlow flow;
+    if (options_.fuse_normalizations) {
+      // Var[x] = E[x^2] - E[x]^2. Both reductions only depend on the input, so
+      // the compiler computes them in a single pass over it.
+      auto* mean = DoReduceMean(input, {axis});
+      auto* mean_sq = DoReduceMean(builder_.Multiply(input, input), {axis});
+      flow = builder_.Subtract(mean_sq, builder_.Multiply(mean, mean));
+      // Cancellation may make the variance slightly negative.
+      auto* zero = MakeScalar(0, kAccType);
+      flow = builder_.Maximum(flow,
+                              DoBroadcast(zero, flow->shape().dimensions()));
+      norm = builder_.Subtract(input,
+                               DoBroadcast(mean, input->shape().dimensions()));
+    } else {
+      flow = DoBroadcast(DoReduceMean(input, {axis}),
+                         input->shape().dimensions());
+      norm = builder_.Subtract(input, flow);
+      flow = builder_.Multiply(norm, norm);
+      flow = DoReduceMean(flow, {axis});
+    }
     flow = builder_.Add(flow, DoBroadcast(MakeScalar(epsilon, kAccType),
                                           flow->shape().dimensions()));
     flow = builder_.Rsqrt(flow);
@@ -1386,6 +1586,22 @@ class Onnx2HloConverter {
   std::vector<HloFlow> OpMatMul(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, 2, {});
     auto* lhs = GetInput(node, 0);
+    const pblczero::TensorProto* weights =
+        (options_.pretranspose_matmul_weights || options_.fp8_matmul_type) &&
+                node.input_size() > 1
+            ? GetFoldableInitializer(node.input(1))
+            : nullptr;
+    if (weights && weights->dims().size() == 2 &&
+        lhs->shape().dimensions_size() >= 2) {
+      if (options_.fp8_matmul_type) return {DoFp8MatMul(lhs, *weights)};
+      // [..., K] x [K, N] is computed as [..., K] x [N, K]^T. The original
+      // initializer is not referenced, so it doesn't become a parameter.
+      auto* rhs = GetFlowByName(GetTransposedInitializer(*weights));
+      pblczero::XlaDotDimensionNumbers dn;
+      dn.add_lhs_contracting_dimensions(lhs->shape().dimensions_size() - 1);
+      dn.add_rhs_contracting_dimensions(1);
+      return {builder_.Dot(lhs, rhs, dn)};
+    }
     auto* rhs = GetInput(node, 1);
     HloTensorType lhs_shape(lhs->shape());
     HloTensorType rhs_shape(rhs->shape());
@@ -1403,6 +1619,48 @@ class Onnx2HloConverter {
     return {builder_.Dot(lhs, rhs, dn)};
   }
 
+  // [..., K] x [K, N] with fp8 operands. Each row of the activations is scaled
+  // so that its largest magnitude maps to the largest finite fp8 value.
+  HloFlow DoFp8MatMul(HloFlow lhs, const pblczero::TensorProto& weights) {
+    constexpr auto kAccType = pblczero::XlaShapeProto::F32;
+    const auto fp8_type = *options_.fp8_matmul_type;
+    const auto [weights_name, scales_name] =
+        GetFp8Initializers(weights, fp8_type);
+    auto* rhs = GetFlowByName(weights_name);
+    auto* rhs_scales = GetFlowByName(scales_name);
+    const auto input_type = lhs->shape().element_type();
+    const int64_t rank = lhs->shape().dimensions_size();
+    const auto row_dims = GetIota(rank - 1);
+
+    auto* flow =
+        input_type == kAccType ? lhs : builder_.Convert(lhs, kAccType);
+    auto* amax = builder_.Reduce(builder_.Maximum(flow, builder_.Negate(flow)),
+                                 MakeScalar(0, kAccType),
+                                 MakeMaxComputation(kAccType), {rank - 1});
+    // Avoid division by zero for all-zero rows.
+    amax = builder_.Maximum(
+        amax, DoBroadcast(MakeScalar(1e-12f, kAccType),
+                          amax->shape().dimensions()));
+    auto* lhs_scales = builder_.Divide(
+        amax, DoBroadcast(MakeScalar(GetFp8Max(fp8_type), kAccType),
+                          amax->shape().dimensions()));
+    flow = builder_.Divide(
+        flow,
+        builder_.Broadcast(lhs_scales, HloTensorType(flow->shape()), row_dims));
+    flow = builder_.Convert(flow, fp8_type);
+
+    pblczero::XlaDotDimensionNumbers dn;
+    dn.add_lhs_contracting_dimensions(rank - 1);
+    dn.add_rhs_contracting_dimensions(1);
+    flow = builder_.Dot(flow, rhs, dn, kAccType);
+    const HloTensorType out_shape(flow->shape());
+    flow = builder_.Multiply(
+        flow, builder_.Broadcast(lhs_scales, out_shape, row_dims));
+    flow = builder_.Multiply(
+        flow, builder_.Broadcast(rhs_scales, out_shape, {rank - 1}));
+    return input_type == kAccType ? flow : builder_.Convert(flow, input_type);
+  }
+
   std::vector<HloFlow> OpGlobalAveragePool(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, 1, {});
     auto* lhs = GetInput(node, 0);
@@ -1520,6 +1778,154 @@ class Onnx2HloConverter {
     return {builder_.Select(pred, on_true, on_false)};
   }
 
+  /////////////////////////////////////////////////////////////////////////////
+  // Constant folding
+  /////////////////////////////////////////////////////////////////////////////
+
+  // Returns the initializer (original or folded) with the given name if it's
+  // a floating point tensor with raw data that can be evaluated on the host.
+  const pblczero::TensorProto* GetFoldableInitializer(std::string_view name) {
+    auto iter = initializers_.find(std::string(name));
+    if (iter == initializers_.end()) return nullptr;
+    const auto* tensor = iter->second;
+    if (!IsFoldableType(tensor->data_type())) return nullptr;
+    const auto num_elements = GetNumberElements(tensor->dims());
+    if (tensor->raw_data().size() !=
+        num_elements * GetOnnxTypeSize(tensor->data_type())) {
+      return nullptr;
+    }
+    return tensor;
+  }
+
+  void AddFoldedInitializer(pblczero::TensorProto tensor) {
+    folded_initializers_.push_back(std::move(tensor));
+    const auto& folded = folded_initializers_.back();
+    initializers_[std::string(folded.name())] = &folded;
+  }
+
+  // Returns the name of the transposed copy of a 2D initializer, creating it
+  // if needed.
+  std::string GetTransposedInitializer(const pblczero::TensorProto& tensor) {
+    const std::string name = std::string(tensor.name()) + "/transposed";
+    if (!initializers_.count(name)) {
+      AddFoldedInitializer(FloatsToOnnxTensor(
+          name, tensor.data_type(), {tensor.dims()[1], tensor.dims()[0]},
+          TransposeFloats(OnnxTensorToFloats(tensor), tensor.dims(), {1, 0})));
+    }
+    return name;
+  }
+
+  // Quantizes a [K, N] initializer to fp8, stored transposed as [N, K] with
+  // per output channel f32 scales [N]. Returns names of the quantized weights
+  // and of the scales.
+  std::pair<std::string, std::string> GetFp8Initializers(
+      const pblczero::TensorProto& tensor, pblczero::XlaShapeProto::Type type) {
+    const std::string prefix = std::string(tensor.name()) + "/" +
+                               pblczero::XlaShapeProto::Type_Name(type);
+    const std::string weights_name = prefix + "/weights";
+    const std::string scales_name = prefix + "/scales";
+    if (initializers_.count(weights_name)) return {weights_name, scales_name};
+    const int64_t k = tensor.dims()[0];
+    const int64_t n = tensor.dims()[1];
+    auto values =
+        TransposeFloats(OnnxTensorToFloats(tensor), tensor.dims(), {1, 0});
+    std::vector<float> scales(n);
+    const float max_value = GetFp8Max(type);
+    for (int64_t row = 0; row < n; ++row) {
+      float* begin = values.data() + row * k;
+      float amax = 0.0f;
+      for (int64_t i = 0; i < k; ++i) amax = std::max(amax, std::abs(begin[i]));
+      scales[row] = amax > 0.0f ? amax / max_value : 1.0f;
+      for (int64_t i = 0; i < k; ++i) begin[i] /= scales[row];
+    }
+    AddFoldedInitializer(FloatsToOnnxTensor(
+        weights_name,
+        type == pblczero::XlaShapeProto::F8E4M3FN
+            ? pblczero::TensorProto::FLOAT8E4M3FN
+            : pblczero::TensorProto::FLOAT8E5M2,
+        {n, k}, values));
+    AddFoldedInitializer(FloatsToOnnxTensor(
+        scales_name, pblczero::TensorProto::FLOAT, {n}, scales));
+    return {weights_name, scales_name};
+  }
+
+  // If all inputs of the node are foldable initializers, evaluates it at
+  // conversion time and stores the output as a new initializer. Returns false
+  // if the node has to be converted to HLO.
+  bool TryFoldNode(const pblczero::NodeProto& node) {
+    static const std::unordered_set<std::string_view> kFoldableOps = {
+        "Add", "Cast", "Div", "Mul", "Reciprocal", "Sqrt", "Sub", "Transpose"};
+    if (!kFoldableOps.count(node.op_type()) || node.output_size() != 1 ||
+        node.input_size() == 0) {
+      return false;
+    }
+    std::vector<const pblczero::TensorProto*> inputs;
+    for (const auto& input : node.input()) {
+      const auto* tensor = GetFoldableInitializer(input);
+      if (!tensor) return false;
+      inputs.push_back(tensor);
+    }
+    const std::string_view op = node.op_type();
+    auto type = inputs[0]->data_type();
+    auto dims = inputs[0]->dims();
+    auto values = OnnxTensorToFloats(*inputs[0]);
+
+    if (op == "Transpose") {
+      CheckKnownAttributes(node, 1, {"perm"});
+      auto perm = GetOptionalAttributeAsVec<int64_t>(node, "perm")
+                      .value_or(std::vector<int64_t>());
+      if (perm.empty()) {
+        perm = GetIota(dims.size());
+        std::reverse(perm.begin(), perm.end());
+      }
+      NormalizeDimensions(&perm, dims.size());
+      values = TransposeFloats(values, dims, perm);
+      const auto old_dims = dims;
+      for (size_t i = 0; i < perm.size(); ++i) dims[i] = old_dims[perm[i]];
+    } else if (op == "Cast") {
+      CheckKnownAttributes(node, 1, {"to"});
+      type = static_cast<pblczero::TensorProto::DataType>(
+          GetAttributeAs<int>(node, "to"));
+      if (!IsFoldableType(type)) return false;
+    } else if (op == "Sqrt" || op == "Reciprocal") {
+      CheckKnownAttributes(node, 1, {});
+      const bool sqrt = op == "Sqrt";
+      for (auto& value : values) value = sqrt ? std::sqrt(value) : 1.0f / value;
+    } else {
+      CheckKnownAttributes(node, 2, {});
+      if (inputs.size() != 2 || inputs[1]->data_type() != type) return false;
+      const auto rhs = OnnxTensorToFloats(*inputs[1]);
+      const auto out_dims = BuildCommonDims(dims, inputs[1]->dims());
+      const auto lhs_strides = GetBroadcastStrides(dims, out_dims.size());
+      const auto rhs_strides =
+          GetBroadcastStrides(inputs[1]->dims(), out_dims.size());
+      std::vector<int64_t> lhs_offsets;
+      ForEachOffset(out_dims, lhs_strides,
+                    [&](int64_t offset) { lhs_offsets.push_back(offset); });
+      std::vector<float> result;
+      result.reserve(lhs_offsets.size());
+      size_t i = 0;
+      ForEachOffset(out_dims, rhs_strides, [&](int64_t offset) {
+        const float l = values[lhs_offsets[i++]];
+        const float r = rhs[offset];
+        if (op == "Add") {
+          result.push_back(l + r);
+        } else if (op == "Sub") {
+          result.push_back(l - r);
+        } else if (op == "Mul") {
+          result.push_back(l * r);
+        } else {
+          result.push_back(l / r);
+        }
+      });
+      values = std::move(result);
+      dims = out_dims;
+    }
+    AddFoldedInitializer(
+        FloatsToOnnxTensor(node.output(0), type, dims, values));
+    return true;
+  }
+
   /////////////////////////////////////////////////////////////////////////////
   // Helper computations
   /////////////////////////////////////////////////////////////////////////////
@@ -1689,6 +2095,7 @@ class Onnx2HloConverter {
   // the map.
   void DispatchNode(const pblczero::NodeProto& node) {
     try {
+      if (options_.fold_constants && TryFoldNode(node)) return;
       auto iter = onnx_op_to_builder_.find(std::string(node.op_type()));
       if (iter == onnx_op_to_builder_.end()) {
         throw Exception("Unsupported ONNX op.");
@@ -1718,6 +2125,8 @@ class Onnx2HloConverter {
                                       const pblczero::NodeProto&)>
       onnx_op_to_builder_;
   std::unordered_map<std::string, const pblczero::TensorProto*> initializers_;
+  // Initializers computed at conversion time, deque for pointer stability.
+  std::deque<pblczero::TensorProto> folded_initializers_;
   HloBuilder builder_;
   size_t batch_size_ = 0;
   size_t opset_version_ = 0;
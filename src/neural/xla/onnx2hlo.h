@@ -50,6 +50,21 @@ struct Onnx2HloOptions {
   // If not empty, uses these nodes as outputs instead of the ones from the ONNX
   // model.
   std::vector<std::string> outputs_override;
+  // Evaluate nodes that only depend on (floating point) initializers at
+  // conversion time, so that the HLO only contains the final weights.
+  bool fold_constants = true;
+  // Store constant right hand sides of 2D matrix multiplications transposed,
+  // so that the contraction is over the minor dimension of both operands.
+  bool pretranspose_matmul_weights = true;
+  // Compute layer normalization statistics with sibling reductions over the
+  // same operand (fused by the compiler into a single pass), and normalize
+  // softmax by a per-row reciprocal.
+  bool fuse_normalizations = true;
+  // If set (F8E4M3FN or F8E5M2), matrix multiplications with constant 2D
+  // weights are computed in this type. Weights are quantized per output
+  // channel at conversion time, activations per row at run time, and the
+  // products are accumulated in f32.
+  std::optional<pblczero::XlaShapeProto::Type> fp8_matmul_type = std::nullopt;
 };
 
 struct Onnx2HloResult {
@@ -62,6 +77,9 @@ struct Onnx2HloResult {
   };
   // Constants that are passed as inputs to the module.
   std::vector<NamedTensor> constants;
+  // Values of the constants computed during the conversion (folded weight-only
+  // subgraphs), which are not among the initializers of the ONNX model.
+  std::vector<pblczero::TensorProto> folded_constants;
   std::vector<NamedTensor> inputs;
   std::vector<NamedTensor> outputs;
   pblczero::HloModuleProto hlo_module;
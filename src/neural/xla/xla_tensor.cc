@@ -94,6 +94,14 @@ struct DeduceType<R (&)(A)> {
 
 void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
   if (new_type == type_) return;
+  if (new_type != pblczero::XlaShapeProto::F32 &&
+      type_ != pblczero::XlaShapeProto::F32) {
+    // E.g. bf16 <-> f16, going through float32 is exact for all supported
+    // types.
+    Cast(pblczero::XlaShapeProto::F32);
+    Cast(new_type);
+    return;
+  }
   const size_t new_size = GetBufferSize(new_type, shape_);
   std::unique_ptr<char[]> new_data;
   const void* src = data_.get();
@@ -104,13 +112,6 @@ void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
     std::swap(data_, new_data);
   }
   void* dst = data_.get();
-  if (new_type != pblczero::XlaShapeProto::F32 &&
-      type_ != pblczero::XlaShapeProto::F32) {
-    throw Exception(
-        "Only float32 casts are supported, attempting to cast from " +
-        pblczero::XlaShapeProto::Type_Name(type_) + " to " +
-        pblczero::XlaShapeProto::Type_Name(new_type));
-  }
   auto convert = [&](auto&& func) {
     using src_t = typename DeduceType<decltype(func)>::arg;
     using dst_t = typename DeduceType<decltype(func)>::result;
@@ -131,6 +132,9 @@ void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
       case pblczero::XlaShapeProto::F8E5M2:
         convert(FP32toFP8E5M2_Saturate);
         break;
+      case pblczero::XlaShapeProto::F8E4M3FN:
+        convert(FP32toFP8E4M3FN_Saturate);
+        break;
       default:
         throw Exception("Unsupported cast F32 -> " +
                         pblczero::XlaShapeProto::Type_Name(new_type));
@@ -146,6 +150,9 @@ void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
       case pblczero::XlaShapeProto::F8E5M2:
         convert(FP8E5M2toFP32);
         break;
+      case pblczero::XlaShapeProto::F8E4M3FN:
+        convert(FP8E4M3FNtoFP32);
+        break;
       default:
         throw Exception("Unsupported cast " +
                         pblczero::XlaShapeProto::Type_Name(type_) + " -> F32");
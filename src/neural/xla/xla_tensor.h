@@ -47,6 +47,7 @@ inline size_t GetXlaTypeSize(pblczero::XlaShapeProto::Type type) {
     case pblczero::XlaShapeProto::BF16:
       return sizeof(uint16_t);
     case pblczero::XlaShapeProto::F8E5M2:
+    case pblczero::XlaShapeProto::F8E4M3FN:
       return sizeof(uint8_t);
     case pblczero::XlaShapeProto::F32:
       return sizeof(float);
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <future>
+#include <span>
 #include <string>
 
 #include "neural/encoder.h"
@@ -176,6 +178,86 @@ class Output {
   float m_;
 };
 
+// Outputs of the whole batch, stored contiguously so that they can be exposed
+// to numpy without copying.
+class BatchOutput {
+ public:
+  // Exported.
+  int size() const { return q_.size(); }
+  std::span<const float> q() const { return q_; }
+  std::span<const float> d() const { return d_; }
+  std::span<const float> m() const { return m_; }
+  // Raw policy logits, size() rows of 1858.
+  std::span<const float> p() const { return p_; }
+
+  // Not exposed.
+  BatchOutput(const NetworkComputation& computation) {
+    const int batch_size = computation.GetBatchSize();
+    q_.resize(batch_size);
+    d_.resize(batch_size);
+    m_.resize(batch_size);
+    p_.resize(batch_size * 1858);
+    for (int i = 0; i < batch_size; ++i) {
+      q_[i] = computation.GetQVal(i);
+      d_[i] = computation.GetDVal(i);
+      m_[i] = computation.GetMVal(i);
+      float* p = p_.data() + i * 1858;
+      for (int j = 0; j < 1858; ++j) p[j] = computation.GetPVal(i, j);
+    }
+  }
+
+ private:
+  std::vector<float> q_;
+  std::vector<float> d_;
+  std::vector<float> m_;
+  std::vector<float> p_;
+};
+
+// Computation running in the background, returned by the *_async() methods of
+// Backend. Keeps the network alive until the computation finishes.
+class PendingEvaluation {
+ public:
+  // Exported.
+  int is_ready() const {
+    return !future_.valid() || future_.wait_for(std::chrono::seconds(0)) ==
+                                   std::future_status::ready;
+  }
+  std::vector<std::unique_ptr<Output>> wait() {
+    Finish();
+    std::vector<std::unique_ptr<Output>> result;
+    for (int i = 0; i < computation_->GetBatchSize(); ++i) {
+      result.push_back(std::make_unique<Output>(*computation_, i));
+    }
+    return result;
+  }
+  std::unique_ptr<BatchOutput> wait_batch() {
+    Finish();
+    return std::make_unique<BatchOutput>(*computation_);
+  }
+
+  // Not exposed.
+  PendingEvaluation(std::shared_ptr<Network> network,
+                    std::unique_ptr<NetworkComputation> computation)
+      : network_(std::move(network)), computation_(std::move(computation)) {
+    if (computation_->GetBatchSize() == 0) return;
+    future_ = std::async(std::launch::async,
+                         [c = computation_.get()]() { c->ComputeBlocking(); });
+  }
+  ~PendingEvaluation() {
+    if (future_.valid()) future_.wait();
+  }
+
+ private:
+  // Rethrows the exception of the computation, if any.
+  void Finish() {
+    if (future_.valid()) future_.get();
+  }
+
+  std::shared_ptr<Network> network_;
+  std::unique_ptr<NetworkComputation> computation_;
+  std::future<void> future_;
+};
+
 class BackendCapabilities {
  public:
   // Exported.
@@ -215,11 +297,7 @@ class Backend {
   std::vector<std::unique_ptr<Output>> evaluate(
       const std::vector<Input*>& inputs) const {
     if (inputs.empty()) return {};
-    auto computation = network_->NewComputation();
-    for (const auto* input : inputs) {
-      InputPlanes input_copy = input->GetPlanes();
-      computation->AddInput(std::move(input_copy));
-    }
+    auto computation = PrepareComputation(inputs);
     computation->ComputeBlocking();
     std::vector<std::unique_ptr<Output>> result;
     for (int i = 0; i < computation->GetBatchSize(); ++i) {
@@ -228,8 +306,94 @@ class Backend {
     return result;
   }
 
+  // Evaluates a batch given as flat arrays of plane masks and values, e.g.
+  // numpy arrays of shape (N, 112).
+  std::unique_ptr<BatchOutput> evaluate_planes(
+      std::span<const uint64_t> masks, std::span<const float> values) const {
+    auto computation = PrepareComputation(masks, values);
+    if (computation->GetBatchSize() > 0) computation->ComputeBlocking();
+    return std::make_unique<BatchOutput>(*computation);
+  }
+
+  // Encodes and evaluates a batch of positions given as FENs.
+  std::unique_ptr<BatchOutput> evaluate_fens(
+      const std::vector<std::string>& fens) const {
+    auto computation = PrepareComputation(fens);
+    if (computation->GetBatchSize() > 0) computation->ComputeBlocking();
+    return std::make_unique<BatchOutput>(*computation);
+  }
+
+  // Same as above, but return immediately. The inputs are copied, so they may
+  // be modified while the computation runs.
+  std::unique_ptr<PendingEvaluation> evaluate_async(
+      const std::vector<Input*>& inputs) const {
+    return std::make_unique<PendingEvaluation>(network_,
+                                               PrepareComputation(inputs));
+  }
+  std::unique_ptr<PendingEvaluation> evaluate_planes_async(
+      std::span<const uint64_t> masks, std::span<const float> values) const {
+    return std::make_unique<PendingEvaluation>(
+        network_, PrepareComputation(masks, values));
+  }
+  std::unique_ptr<PendingEvaluation> evaluate_fens_async(
+      const std::vector<std::string>& fens) const {
+    return std::make_unique<PendingEvaluation>(network_,
+                                               PrepareComputation(fens));
+  }
+
  private:
-  std::unique_ptr<::lczero::Network> network_;
+  std::unique_ptr<NetworkComputation> PrepareComputation(
+      const std::vector<Input*>& inputs) const {
+    auto computation = network_->NewComputation();
+    for (const auto* input : inputs) {
+      InputPlanes input_copy = input->GetPlanes();
+      computation->AddInput(std::move(input_copy));
+    }
+    return computation;
+  }
+
+  std::unique_ptr<NetworkComputation> PrepareComputation(
+      std::span<const uint64_t> masks, std::span<const float> values) const {
+    if (masks.size() != values.size()) {
+      throw Exception("Masks and values must have the same size.");
+    }
+    if (masks.size() % kInputPlanes != 0) {
+      throw Exception("Number of planes must be a multiple of " +
+                      std::to_string(kInputPlanes) + ".");
+    }
+    auto computation = network_->NewComputation();
+    for (size_t i = 0; i < masks.size(); i += kInputPlanes) {
+      InputPlanes planes(kInputPlanes);
+      for (int j = 0; j < kInputPlanes; ++j) {
+        planes[j].mask = masks[i + j];
+        planes[j].value = values[i + j];
+      }
+      computation->AddInput(std::move(planes));
+    }
+    return computation;
+  }
+
+  std::unique_ptr<NetworkComputation> PrepareComputation(
+      const std::vector<std::string>& fens) const {
+    const auto input_format = network_->GetCapabilities().input_format;
+    auto computation = network_->NewComputation();
+    for (const auto& fen : fens) {
+      ChessBoard board;
+      int rule50_ply;
+      int full_moves;
+      board.SetFromFen(fen, &rule50_ply, &full_moves);
+      PositionHistory history;
+      history.Reset(board, rule50_ply,
+                    full_moves * 2 - (board.flipped() ? 1 : 2));
+      int transform;
+      computation->AddInput(EncodePositionForNN(input_format, history, 8,
+                                                FillEmptyHistory::FEN_ONLY,
+                                                &transform));
+    }
+    return computation;
+  }
+
+  std::shared_ptr<::lczero::Network> network_;
 };
 
 class GameState {
@@ -246,8 +410,7 @@ class GameState {
                    full_moves * 2 - (starting_board.flipped() ? 1 : 2));
 
     for (const auto& m : moves) {
-      Move move(m, history_.IsBlackToMove());
-      history_.Append(move);
+      history_.Append(history_.Last().GetBoard().ParseMove(m));
     }
   }
 
@@ -264,8 +427,8 @@ class GameState {
     bool is_black = history_.IsBlackToMove();
     std::vector<std::string> result;
     for (auto m : ms) {
-      if (is_black) m.Mirror();
-      result.push_back(m.as_string());
+      if (is_black) m.Flip();
+      result.push_back(m.ToString(false));
     }
     return result;
   }
@@ -274,7 +437,7 @@ class GameState {
     auto ms = history_.Last().GetBoard().GenerateLegalMoves();
     std::vector<int> result;
     for (auto m : ms) {
-      result.push_back(m.as_nn_index(/* transform= */ 0));
+      result.push_back(MoveToNNIndex(m, /* transform= */ 0));
     }
     return result;
   }
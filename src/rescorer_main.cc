@@ -45,8 +45,6 @@ int main(int argc, const char** argv) {
        << GetVersionStr() << " built " << __DATE__;
 
   try {
-    InitializeMagicBitboards();
-
     CommandLine::Init(argc, argv);
     CommandLine::RegisterMode(
         "rescore", "(default) Update data scores with tablebase support");
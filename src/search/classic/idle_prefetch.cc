@@ -0,0 +1,174 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "search/classic/idle_prefetch.h"
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#include "utils/logging.h"
+
+namespace lczero {
+namespace classic {
+namespace {
+
+// A position reachable from the tree head.
+struct Candidate {
+  // Estimated probability that the position is reached by the next searches.
+  float probability;
+  // Moves from the head.
+  std::vector<Move> moves;
+  // nullptr if the edge has no node.
+  const Node* node;
+
+  bool operator<(const Candidate& other) const {
+    return probability < other.probability;
+  }
+};
+
+// The tree is explored best first, look at most at this many nodes per
+// position to evaluate.
+constexpr int kMaxNodesPerPosition = 16;
+// Unlikely to be reached ever.
+constexpr float kMinProbability = 1e-4f;
+
+}  // namespace
+
+void IdlePrefetcher::Start(Search* search, const NodeTree* tree,
+                           Backend* backend, int max_positions,
+                           int solid_threshold) {
+  Stop();
+  if (max_positions <= 0 && solid_threshold <= 0) return;
+  stop_.store(false, std::memory_order_relaxed);
+  thread_ = std::thread(
+      [this, search, tree, backend, max_positions, solid_threshold]() {
+        Run(search, tree, backend, max_positions, solid_threshold);
+      });
+}
+
+void IdlePrefetcher::Stop() {
+  stop_.store(true, std::memory_order_relaxed);
+  if (thread_.joinable()) thread_.join();
+}
+
+int IdlePrefetcher::Solidify(Node* head, uint32_t solid_threshold) {
+  // The most visited nodes first, so that the solid arrays of the hot part of
+  // the tree are allocated close to each other.
+  const auto by_visits = [](const Node* a, const Node* b) {
+    return a->GetN() < b->GetN();
+  };
+  std::priority_queue<Node*, std::vector<Node*>, decltype(by_visits)> queue(
+      by_visits);
+  queue.push(head);
+  int solidified = 0;
+  while (!queue.empty() && !stop_.load(std::memory_order_relaxed)) {
+    Node* node = queue.top();
+    queue.pop();
+    if (node->MakeSolid()) ++solidified;
+    for (Node* child : node->VisitedNodes()) {
+      if (child->GetN() >= solid_threshold) queue.push(child);
+    }
+  }
+  return solidified;
+}
+
+void IdlePrefetcher::Run(Search* search, const NodeTree* tree,
+                         Backend* backend, int max_positions,
+                         int solid_threshold) {
+  search->Wait();
+  if (stop_.load(std::memory_order_relaxed)) return;
+  if (solid_threshold > 0 &&
+      tree->GetCurrentHead()->GetN() >=
+          static_cast<uint32_t>(solid_threshold)) {
+    const int solidified = Solidify(tree->GetCurrentHead(), solid_threshold);
+    LOGFILE << "Idle solidification made " << solidified
+            << " nodes solid.";
+  }
+  if (max_positions <= 0 || stop_.load(std::memory_order_relaxed)) return;
+
+  const int batch_size =
+      std::clamp(backend->GetAttributes().recommended_batch_size, 1,
+                 max_positions);
+  std::unique_ptr<BackendComputation> computation;
+  int enqueued = 0;
+  int evaluated = 0;
+  std::priority_queue<Candidate> queue;
+  queue.push({1.0f, {}, tree->GetCurrentHead()});
+  for (int nodes_left = kMaxNodesPerPosition * max_positions;
+       !queue.empty() && nodes_left > 0 && enqueued < max_positions;
+       --nodes_left) {
+    if (stop_.load(std::memory_order_relaxed)) break;
+    const Candidate candidate = queue.top();
+    queue.pop();
+    const Node* node = candidate.node;
+    if (node && node->IsTerminal()) continue;
+    if (!node || node->GetN() == 0) {
+      // Not evaluated by the search, the next one will likely need it.
+      PositionHistory history = tree->GetPositionHistory();
+      for (Move move : candidate.moves) history.Append(move);
+      const MoveList legal_moves =
+          history.Last().GetBoard().GenerateLegalMoves();
+      if (legal_moves.empty()) continue;
+      if (!computation) {
+        computation = backend->CreateComputation();
+        computation->SetPriority(ComputationPriority::kLow);
+      }
+      if (computation->AddInput(
+              EvalPosition{history.GetPositions(), legal_moves},
+              EvalResultPtr{}) == BackendComputation::ENQUEUED_FOR_EVAL) {
+        ++enqueued;
+      }
+      if (static_cast<int>(computation->UsedBatchSize()) >= batch_size) {
+        evaluated += computation->UsedBatchSize();
+        computation->ComputeBlocking();
+        computation.reset();
+      }
+      continue;
+    }
+    // Visits tell what the search liked, priors fill in the unvisited moves.
+    const float total = node->GetChildrenVisits() + 1.0f;
+    for (const auto& edge : node->Edges()) {
+      const float probability = candidate.probability *
+                                (edge.GetN() + edge.GetP()) / total;
+      if (probability < kMinProbability) continue;
+      std::vector<Move> moves = candidate.moves;
+      moves.push_back(edge.GetMove());
+      queue.push({probability, std::move(moves), edge.node()});
+    }
+  }
+  if (computation && computation->UsedBatchSize() > 0 &&
+      !stop_.load(std::memory_order_relaxed)) {
+    evaluated += computation->UsedBatchSize();
+    computation->ComputeBlocking();
+  }
+  LOGFILE << "Idle prefetch evaluated " << evaluated << " positions.";
+}
+
+}  // namespace classic
+}  // namespace lczero
@@ -0,0 +1,72 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "neural/backend.h"
+#include "search/classic/node.h"
+#include "search/classic/search.h"
+
+namespace lczero {
+namespace classic {
+
+// Evaluates the likely continuations of the game when the engine is idle
+// after a search (e.g. during the opponent's move), so that the next search
+// finds them in the NN cache. The positions are taken from the tree below the
+// searched position, the most likely according to the visits and priors
+// first, and sent to the backend at low priority.
+// Before that, the children of the nodes with enough visits can be made solid,
+// which the search only does when no visits are in flight below them. Nothing
+// else may access the tree until Stop() returns.
+class IdlePrefetcher {
+ public:
+  ~IdlePrefetcher() { Stop(); }
+
+  // Waits for @search to finish in a background thread, makes the children of
+  // the nodes with at least @solid_threshold visits solid (if it's not 0), and
+  // then evaluates up to @max_positions positions.
+  void Start(Search* search, const NodeTree* tree, Backend* backend,
+             int max_positions, int solid_threshold);
+  // Stops prefetching and waits for the thread to exit.
+  void Stop();
+
+ private:
+  void Run(Search* search, const NodeTree* tree, Backend* backend,
+           int max_positions, int solid_threshold);
+  // Returns the number of nodes made solid.
+  int Solidify(Node* head, uint32_t solid_threshold);
+
+  std::atomic<bool> stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace classic
+}  // namespace lczero
@@ -0,0 +1,130 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "search/classic/minibatch_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lczero {
+namespace classic {
+namespace {
+// Weight of the older samples is multiplied by this with every new batch.
+constexpr float kSampleDecay = 0.95f;
+// Weight of a new batch in the moving average of the collision fraction.
+constexpr float kCollisionSmoothing = 0.1f;
+// The batch is made large enough for the fixed overhead to take at most this
+// part of the batch latency.
+constexpr float kMaxOverheadShare = 0.2f;
+// The batch is shrunk when the collision fraction is above this.
+constexpr float kCollisionTolerance = 0.25f;
+// A batch may take at most this part of the remaining search time.
+constexpr float kMaxRemainingTimeShare = 0.1f;
+}  // namespace
+
+MinibatchSizeController::MinibatchSizeController(
+    int base_size, int max_size,
+    const std::vector<BatchLatency>& latency_profile)
+    : base_size_(std::max(1, base_size)),
+      min_size_(std::max(1, base_size_ / 4)),
+      max_size_(max_size > 0 ? std::clamp(4 * base_size_, base_size_, max_size)
+                             : 4 * base_size_) {
+  for (const auto& latency : latency_profile) {
+    AddSample(latency.batch_size, latency.seconds, 1.0f);
+  }
+}
+
+void MinibatchSizeController::AddSample(float size, float seconds,
+                                        float weight) {
+  sum_w_ = sum_w_ * kSampleDecay + weight;
+  sum_x_ = sum_x_ * kSampleDecay + weight * size;
+  sum_y_ = sum_y_ * kSampleDecay + weight * seconds;
+  sum_xx_ = sum_xx_ * kSampleDecay + weight * size * size;
+  sum_xy_ = sum_xy_ * kSampleDecay + weight * size * seconds;
+
+  const float mean_x = sum_x_ / sum_w_;
+  const float mean_y = sum_y_ / sum_w_;
+  const float var_x = sum_xx_ / sum_w_ - mean_x * mean_x;
+  const float cov_xy = sum_xy_ / sum_w_ - mean_x * mean_y;
+  // Until the batch sizes differ enough, only the average cost is known.
+  if (var_x < 1.0f || cov_xy <= 0.0f) {
+    has_model_ = false;
+    overhead_ = 0.0f;
+    per_position_ = mean_x > 0.0f ? mean_y / mean_x : 0.0f;
+    return;
+  }
+  per_position_ = cov_xy / var_x;
+  overhead_ = std::max(0.0f, mean_y - per_position_ * mean_x);
+  has_model_ = true;
+}
+
+void MinibatchSizeController::OnBatchDone(int evaluated, int collisions,
+                                          float seconds) {
+  if (evaluated + collisions > 0) {
+    const float fraction =
+        static_cast<float>(collisions) / (evaluated + collisions);
+    collision_fraction_ +=
+        kCollisionSmoothing * (fraction - collision_fraction_);
+  }
+  if (evaluated > 0 && seconds > 0.0f) AddSample(evaluated, seconds, 1.0f);
+}
+
+float MinibatchSizeController::EstimateLatency(int size) const {
+  return overhead_ + per_position_ * size;
+}
+
+int MinibatchSizeController::GetTargetSize(int64_t remaining_time_ms) const {
+  float target = base_size_;
+  if (has_model_ && per_position_ > 0.0f) {
+    target = std::max(target, overhead_ * (1.0f - kMaxOverheadShare) /
+                                  (kMaxOverheadShare * per_position_));
+  }
+  if (collision_fraction_ > kCollisionTolerance) {
+    target *= (1.0f - collision_fraction_) / (1.0f - kCollisionTolerance);
+  }
+  target = std::clamp(target, static_cast<float>(min_size_),
+                      static_cast<float>(max_size_));
+  return FitToDeadline(target, remaining_time_ms);
+}
+
+int MinibatchSizeController::GetDeadlineSize(int64_t remaining_time_ms) const {
+  return FitToDeadline(base_size_, remaining_time_ms);
+}
+
+int MinibatchSizeController::FitToDeadline(float target,
+                                           int64_t remaining_time_ms) const {
+  if (per_position_ > 0.0f) {
+    const float budget = remaining_time_ms / 1000.0f * kMaxRemainingTimeShare;
+    target = std::min(target, (budget - overhead_) / per_position_);
+  }
+  return std::clamp(static_cast<int>(std::lround(target)), min_size_,
+                    max_size_);
+}
+
+}  // namespace classic
+}  // namespace lczero
@@ -0,0 +1,91 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "neural/backend.h"
+
+namespace lczero {
+namespace classic {
+
+// Picks the target size of every minibatch of a search thread. The backend
+// latency is modelled as fixed overhead plus a per-position cost, fitted from
+// the latency profile of the backend (if any) and the batches measured during
+// the search. The configured size is grown until the fixed overhead is a small
+// part of the batch time, and reduced when the gathering mostly hits
+// collisions, or when a batch of that size would take a noticeable part of the
+// remaining search time.
+// Not thread-safe, every search thread has its own instance.
+class MinibatchSizeController {
+ public:
+  // @base_size is the configured minibatch size, @max_size is the largest
+  // batch the backend accepts.
+  MinibatchSizeController(int base_size, int max_size,
+                          const std::vector<BatchLatency>& latency_profile);
+
+  // Returns the target size for the next minibatch. @remaining_time_ms is the
+  // estimated time left in the search (or a huge value if unknown).
+  int GetTargetSize(int64_t remaining_time_ms) const;
+
+  // Returns the configured size, only reduced when a batch of that size would
+  // take a noticeable part of @remaining_time_ms.
+  int GetDeadlineSize(int64_t remaining_time_ms) const;
+
+  // Records a finished minibatch: @evaluated positions were sent to the
+  // backend, it took @seconds, and @collisions nodes were collisions.
+  void OnBatchDone(int evaluated, int collisions, float seconds);
+
+  // Expected time to evaluate a batch of @size positions.
+  float EstimateLatency(int size) const;
+
+ private:
+  void AddSample(float size, float seconds, float weight);
+  // Reduces @target to fit the remaining time, and rounds it to a valid size.
+  int FitToDeadline(float target, int64_t remaining_time_ms) const;
+
+  const int base_size_;
+  const int min_size_;
+  const int max_size_;
+  // Exponentially weighted sums for the least squares fit of the latency.
+  float sum_w_ = 0.0f;
+  float sum_x_ = 0.0f;
+  float sum_y_ = 0.0f;
+  float sum_xx_ = 0.0f;
+  float sum_xy_ = 0.0f;
+  // Latency model: overhead_ + per_position_ * size (in seconds).
+  float overhead_ = 0.0f;
+  float per_position_ = 0.0f;
+  bool has_model_ = false;
+  // Moving average of collisions / (collisions + evaluated).
+  float collision_fraction_ = 0.0f;
+};
+
+}  // namespace classic
+}  // namespace lczero
@@ -0,0 +1,81 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "search/classic/minibatch_controller.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+namespace classic {
+
+TEST(MinibatchSizeController, BaseSizeWithoutMeasurements) {
+  MinibatchSizeController controller(64, 1024, {});
+  EXPECT_EQ(controller.GetTargetSize(100000000000), 64);
+}
+
+TEST(MinibatchSizeController, GrowsWithLargeOverhead) {
+  // 10ms of overhead and 0.1ms per position: the overhead is 20% of the batch
+  // time at 400 positions, which is beyond four times the base size.
+  MinibatchSizeController controller(
+      64, 1024, {{16, 0.0116f}, {64, 0.0164f}, {256, 0.0356f}});
+  EXPECT_NEAR(controller.EstimateLatency(100), 0.02f, 1e-4f);
+  EXPECT_EQ(controller.GetTargetSize(100000000000), 256);
+}
+
+TEST(MinibatchSizeController, ShrinksNearTimeLimit) {
+  MinibatchSizeController controller(
+      64, 1024, {{16, 0.0116f}, {64, 0.0164f}, {256, 0.0356f}});
+  // 200ms left allows batches of 20ms, i.e. of 100 positions.
+  EXPECT_EQ(controller.GetTargetSize(200), 100);
+  // Never below a quarter of the base size.
+  EXPECT_EQ(controller.GetTargetSize(0), 16);
+}
+
+TEST(MinibatchSizeController, DeadlineSizeOnlyShrinks) {
+  MinibatchSizeController controller(
+      64, 1024, {{16, 0.0116f}, {64, 0.0164f}, {256, 0.0356f}});
+  // Unlike the target size, not grown for the large overhead.
+  EXPECT_EQ(controller.GetDeadlineSize(100000000000), 64);
+  // 150ms left allows batches of 15ms, i.e. of 50 positions.
+  EXPECT_EQ(controller.GetDeadlineSize(150), 50);
+  EXPECT_EQ(controller.GetDeadlineSize(0), 16);
+}
+
+TEST(MinibatchSizeController, ShrinksWithCollisions) {
+  MinibatchSizeController controller(64, 1024, {});
+  for (int i = 0; i < 50; ++i) controller.OnBatchDone(32, 32, 0.0f);
+  EXPECT_LT(controller.GetTargetSize(100000000000), 64);
+}
+
+}  // namespace classic
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
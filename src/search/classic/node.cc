@@ -30,15 +30,21 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <thread>
 
 #include "neural/encoder.h"
 #include "neural/network.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 #include "utils/hashcat.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace classic {
@@ -50,73 +56,179 @@ namespace classic {
 namespace {
 // Periodicity of garbage collection, milliseconds.
 const int kGCIntervalMs = 100;
-
-// Every kGCIntervalMs milliseconds release nodes in a separate GC thread.
+// After freeing this many nodes, a worker shares the rest of its subtree with
+// the other workers.
+const int kGCChunkNodes = 16384;
+
+// Every kGCIntervalMs milliseconds release nodes in separate GC threads.
+// Subtrees are freed iteratively. When there is more than one thread, a
+// thread which has freed kGCChunkNodes nodes of a subtree puts half of the
+// remaining parts back to the queue, so that the other threads can help.
 class NodeGarbageCollector {
  public:
-  NodeGarbageCollector() : gc_thread_([this]() { Worker(); }) {}
+  NodeGarbageCollector() { SetNumThreads(1); }
 
   // Takes ownership of a subtree, to dispose it in a separate thread when
   // it has time.
   void AddToGcQueue(std::unique_ptr<Node> node, size_t solid_size = 0) {
     if (!node) return;
     Mutex::Lock lock(gc_mutex_);
-    subtrees_to_gc_.emplace_back(std::move(node));
-    subtrees_to_gc_solid_size_.push_back(solid_size);
+    subtrees_to_gc_.push_back({std::move(node), solid_size});
+  }
+
+  // Stops the current workers (their unfinished work stays queued) and
+  // starts @threads new ones.
+  void SetNumThreads(int threads) {
+    Mutex::Lock threads_lock(threads_mutex_);
+    if (threads == static_cast<int>(workers_.size())) return;
+    {
+      Mutex::Lock lock(gc_mutex_);
+      stop_.store(true);
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) worker.join();
+    workers_.clear();
+    stop_.store(false);
+    num_workers_.store(threads);
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back([this]() { Worker(); });
+    }
+  }
+
+  NodeGcStats GetStats() {
+    Mutex::Lock lock(gc_mutex_);
+    return {subtrees_to_gc_.size(), freed_nodes_.load()};
   }
 
   ~NodeGarbageCollector() {
-    // Flips stop flag and waits for a worker thread to stop.
-    stop_.store(true);
-    gc_thread_.join();
+    // Flips stop flag and waits for worker threads to stop.
+    SetNumThreads(0);
   }
 
  private:
-  void GarbageCollect() {
+  struct Subtree {
+    std::unique_ptr<Node> node;
+    // Non-zero for solid children arrays.
+    size_t solid_size;
+  };
+
+  // Frees the root node (or the solid array) of the @subtree, and moves the
+  // ownership of its subtrees to @stack. Returns the number of freed nodes.
+  static size_t FreeSubtreeRoot(Subtree subtree, std::vector<Subtree>* stack) {
+    auto detach = [stack](std::unique_ptr<Node> node, size_t solid_size) {
+      stack->push_back({std::move(node), solid_size});
+    };
+    if (subtree.solid_size == 0) {
+      subtree.node->DetachSubtrees(detach);
+      return 1;
+    }
+    // Solid is a hack...
+    Node* nodes = subtree.node.release();
+    for (size_t i = 0; i < subtree.solid_size; i++) {
+      nodes[i].DetachSubtrees(detach);
+      nodes[i].~Node();
+    }
+    Node::FreeSolid(nodes, subtree.solid_size);
+    return subtree.solid_size;
+  }
+
+  void GarbageCollect(std::vector<Subtree>* stack) {
     while (!stop_.load()) {
-      // Node will be released in destructor when mutex is not locked.
-      std::unique_ptr<Node> node_to_gc;
-      size_t solid_size = 0;
       {
         // Lock the mutex and move last subtree from subtrees_to_gc_ into
-        // node_to_gc.
+        // the stack.
         Mutex::Lock lock(gc_mutex_);
         if (subtrees_to_gc_.empty()) return;
-        node_to_gc = std::move(subtrees_to_gc_.back());
+        stack->push_back(std::move(subtrees_to_gc_.back()));
         subtrees_to_gc_.pop_back();
-        solid_size = subtrees_to_gc_solid_size_.back();
-        subtrees_to_gc_solid_size_.pop_back();
       }
-      // Solid is a hack...
-      if (solid_size != 0) {
-        for (size_t i = 0; i < solid_size; i++) {
-          node_to_gc.get()[i].~Node();
-        }
-        std::allocator<Node> alloc;
-        alloc.deallocate(node_to_gc.release(), solid_size);
+      TraceSpan trace_span("gc", "search");
+      size_t freed_in_chunk = 0;
+      while (!stack->empty()) {
+        Subtree subtree = std::move(stack->back());
+        stack->pop_back();
+        freed_in_chunk += FreeSubtreeRoot(std::move(subtree), stack);
+        if (freed_in_chunk < kGCChunkNodes) continue;
+        freed_nodes_.fetch_add(freed_in_chunk);
+        freed_in_chunk = 0;
+        if (stop_.load()) break;
+        if (num_workers_.load() > 1 && stack->size() > 1) ShareWork(stack);
       }
+      freed_nodes_.fetch_add(freed_in_chunk);
+      // When stopping, keep the rest for the next workers.
+      ReturnToQueue(stack, stack->size());
     }
   }
 
+  // Moves the bottom half of the @stack (the parts closer to the root, so
+  // likely larger) to the queue and wakes the other workers.
+  void ShareWork(std::vector<Subtree>* stack) {
+    ReturnToQueue(stack, stack->size() / 2);
+    cv_.notify_all();
+  }
+
+  void ReturnToQueue(std::vector<Subtree>* stack, size_t count) {
+    if (count == 0) return;
+    Mutex::Lock lock(gc_mutex_);
+    std::move(stack->begin(), stack->begin() + count,
+              std::back_inserter(subtrees_to_gc_));
+    stack->erase(stack->begin(), stack->begin() + count);
+  }
+
   void Worker() {
+    Tracer::SetThreadName("node gc");
+    std::vector<Subtree> stack;
     while (!stop_.load()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(kGCIntervalMs));
-      GarbageCollect();
+      {
+        Mutex::Lock lock(gc_mutex_);
+        if (stop_.load()) break;
+        cv_.wait_for(lock.get_raw(), std::chrono::milliseconds(kGCIntervalMs));
+      }
+      GarbageCollect(&stack);
     };
   }
 
   mutable Mutex gc_mutex_;
-  std::vector<std::unique_ptr<Node>> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
-  std::vector<size_t> subtrees_to_gc_solid_size_ GUARDED_BY(gc_mutex_);
+  std::vector<Subtree> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
+  std::condition_variable cv_;
+  std::atomic<uint64_t> freed_nodes_{0};
 
   // When true, Worker() should stop and exit.
   std::atomic<bool> stop_{false};
-  std::thread gc_thread_;
+  std::atomic<int> num_workers_{0};
+  Mutex threads_mutex_;
+  std::vector<std::thread> workers_;
 };
 
 NodeGarbageCollector gNodeGc;
 }  // namespace
 
+void SetNodeGcThreads(int threads) { gNodeGc.SetNumThreads(threads); }
+
+NodeGcStats GetNodeGcStats() { return gNodeGc.GetStats(); }
+
+void CollectTreeStats(const Node* root, TreeStats* stats) {
+  // Depth first, with the explicit stack as the trees are deep.
+  std::vector<std::pair<const Node*, size_t>> stack = {{root, 0}};
+  while (!stack.empty()) {
+    const auto [node, depth] = stack.back();
+    stack.pop_back();
+    stats->nodes.Add(1, sizeof(Node));
+    stats->AddNode(depth, node->GetN());
+    if (!node->HasChildren()) continue;
+    stats->edges.Add(node->GetNumEdges(), sizeof(Edge));
+    stats->AddExpandedNode(node->GetNumEdges());
+    if (node->HasSolidChildren()) {
+      stats->solid_blocks.Add(1, node->GetNumEdges() * sizeof(Node));
+      stats->solid_nodes += node->GetNumEdges();
+    }
+    for (const auto& edge : node->Edges()) {
+      if (edge.node()) stack.emplace_back(edge.node(), depth + 1);
+    }
+  }
+  stats->gc_pending_subtrees += GetNodeGcStats().pending_subtrees;
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Edge
 /////////////////////////////////////////////////////////////////////////
@@ -158,23 +270,27 @@ Move Edge::GetMove(bool as_opponent) const {
 // subtracting the two bits from the input and checking for a negative result
 // (the subtraction works despite crossing from exponent to significand). This
 // is combined with the round-to-nearest addition (1<<11) into one op.
-void Edge::SetP(float p) {
+uint16_t Edge::CompressP(float p) {
   assert(0.0f <= p && p <= 1.0f);
   constexpr int32_t roundings = (1 << 11) - (3 << 28);
   int32_t tmp;
   std::memcpy(&tmp, &p, sizeof(float));
   tmp += roundings;
-  p_ = (tmp < 0) ? 0 : static_cast<uint16_t>(tmp >> 12);
+  return (tmp < 0) ? 0 : static_cast<uint16_t>(tmp >> 12);
 }
 
-float Edge::GetP() const {
+float Edge::DecompressP(uint16_t p) {
   // Reshift into place and set the assumed-set exponent bits.
-  uint32_t tmp = (static_cast<uint32_t>(p_) << 12) | (3 << 28);
+  uint32_t tmp = (static_cast<uint32_t>(p) << 12) | (3 << 28);
   float ret;
   std::memcpy(&ret, &tmp, sizeof(uint32_t));
   return ret;
 }
 
+void Edge::SetP(float p) { p_ = CompressP(p); }
+
+float Edge::GetP() const { return DecompressP(p_); }
+
 std::string Edge::DebugString() const {
   std::ostringstream oss;
   oss << "Move: " << move_.ToString(true) << " p_: " << p_
@@ -209,6 +325,55 @@ void Node::CreateEdges(const MoveList& moves) {
   num_edges_ = moves.size();
 }
 
+void Node::TruncateEdges(int max_edges, float max_policy) {
+  assert(edges_);
+  assert(!child_);
+  assert(!HasTruncatedEdges());
+  const int limit = std::min<int>(max_edges, num_edges_);
+  int kept = 1;
+  float kept_policy = edges_[0].GetP();
+  while (kept < limit && kept_policy < max_policy) {
+    kept_policy += edges_[kept++].GetP();
+  }
+  if (kept == num_edges_) return;
+  float truncated_policy = 0.0f;
+  for (int i = kept; i < num_edges_; i++) truncated_policy += edges_[i].GetP();
+  auto edges = std::make_unique<Edge[]>(kept);
+  std::copy(edges_.get(), edges_.get() + kept, edges.get());
+  edges_ = std::move(edges);
+  truncated_edges_ = num_edges_ - kept;
+  truncated_p_ = Edge::CompressP(std::min(truncated_policy, 1.0f));
+  num_edges_ = kept;
+}
+
+void Node::RestoreTruncatedEdges(const MoveList& moves, const float* priors) {
+  assert(HasTruncatedEdges());
+  assert(!solid_children_);
+  auto edges = std::make_unique<Edge[]>(moves.size());
+  std::copy(edges_.get(), edges_.get() + num_edges_, edges.get());
+  // The new edges are sorted after the existing ones, so they can't have a
+  // higher policy.
+  const float max_p = edges_[num_edges_ - 1].GetP();
+  const float even_p = Edge::DecompressP(truncated_p_) / truncated_edges_;
+  int count = num_edges_;
+  for (size_t i = 0; i < moves.size(); i++) {
+    if (std::any_of(edges_.get(), edges_.get() + num_edges_,
+                    [&](const Edge& edge) { return edge.move_ == moves[i]; })) {
+      continue;
+    }
+    if (count == static_cast<int>(moves.size())) break;
+    edges[count].move_ = moves[i];
+    edges[count].SetP(std::min(max_p, priors ? priors[i] : even_p));
+    count++;
+  }
+  std::sort(edges.get() + num_edges_, edges.get() + count,
+            [](const Edge& a, const Edge& b) { return a.p_ > b.p_; });
+  edges_ = std::move(edges);
+  num_edges_ = count;
+  truncated_edges_ = 0;
+  truncated_p_ = 0;
+}
+
 Node::ConstIterator Node::Edges() const {
   return {*this, !solid_children_ ? &child_ : nullptr};
 }
@@ -235,7 +400,8 @@ std::string Node::DebugString() const {
   oss << " Term:" << static_cast<int>(terminal_type_) << " This:" << this
       << " Parent:" << parent_ << " Index:" << index_
       << " Child:" << child_.get() << " Sibling:" << sibling_.get()
-      << " WL:" << wl_ << " N:" << n_ << " N_:" << n_in_flight_
+      << " WL:" << wl_.load() << " N:" << n_.load()
+      << " N_:" << n_in_flight_.load()
       << " Edges:" << static_cast<int>(num_edges_)
       << " Bounds:" << static_cast<int>(lower_bound_) - 2 << ","
       << static_cast<int>(upper_bound_) - 2 << " Solid:" << solid_children_;
@@ -243,7 +409,10 @@ std::string Node::DebugString() const {
 }
 
 bool Node::MakeSolid() {
-  if (solid_children_ || num_edges_ == 0 || IsTerminal()) return false;
+  if (solid_children_ || num_edges_ == 0 || IsTerminal() ||
+      HasTruncatedEdges()) {
+    return false;
+  }
   // Can only make solid if no immediate leaf children are in flight since we
   // allow the search code to hold references to leaf nodes across locks.
   Node* old_child_to_check = child_.get();
@@ -266,10 +435,9 @@ bool Node::MakeSolid() {
   if (total_in_flight != GetNInFlight()) {
     return false;
   }
-  std::allocator<Node> alloc;
-  auto* new_children = alloc.allocate(num_edges_);
+  auto* new_children = AllocateSolid(num_edges_);
   for (int i = 0; i < num_edges_; i++) {
-    new (&(new_children[i])) Node(this, i);
+    ::new (&(new_children[i])) Node(this, i);
   }
   std::unique_ptr<Node> old_child = std::move(child_);
   while (old_child) {
@@ -322,7 +490,7 @@ void Node::MakeNotTerminal() {
 
   // If we have edges, we've been extended (1 visit), so include children too.
   if (edges_) {
-    n_++;
+    ++n_;
     for (const auto& child : Edges()) {
       const auto n = child.GetN();
       if (n > 0) {
@@ -335,8 +503,8 @@ void Node::MakeNotTerminal() {
     }
 
     // Recompute with current eval (instead of network's) and children's eval.
-    wl_ /= n_;
-    d_ /= n_;
+    wl_ = wl_.load() / n_.load();
+    d_ = d_.load() / n_.load();
   }
 }
 
@@ -354,27 +522,38 @@ bool Node::TryStartScoreUpdate() {
 void Node::CancelScoreUpdate(int multivisit) { n_in_flight_ -= multivisit; }
 
 void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
+  // Increment N. Concurrent updates each get their own old N, and the
+  // averages are updated with that weight. When updates interleave, one may
+  // land on an average which already includes a later one, so the result
+  // depends on the order and only approximates the exact mean. The error
+  // shrinks like multivisit / N, and the averages are exact without
+  // concurrent updates.
+  const uint32_t n = n_.fetch_add(multivisit);
   // Recompute Q.
-  wl_ += multivisit * (v - wl_) / (n_ + multivisit);
-  d_ += multivisit * (d - d_) / (n_ + multivisit);
-  m_ += multivisit * (m - m_) / (n_ + multivisit);
-
-  // Increment N.
-  n_ += multivisit;
+  wl_.Update([&](double wl) {
+    return wl + multivisit * (v - wl) / (n + multivisit);
+  });
+  d_.Update([&](float d_old) {
+    return d_old + multivisit * (d - d_old) / (n + multivisit);
+  });
+  m_.Update([&](float m_old) {
+    return m_old + multivisit * (m - m_old) / (n + multivisit);
+  });
   // Decrement virtual loss.
   n_in_flight_ -= multivisit;
 }
 
 void Node::AdjustForTerminal(float v, float d, float m, int multivisit) {
   // Recompute Q.
-  wl_ += multivisit * v / n_;
-  d_ += multivisit * d / n_;
-  m_ += multivisit * m / n_;
+  const uint32_t n = n_;
+  wl_ += multivisit * v / n;
+  d_ += multivisit * d / n;
+  m_ += multivisit * m / n;
 }
 
 void Node::RevertTerminalVisits(float v, float d, float m, int multivisit) {
   // Compute new n_ first, as reducing a node to 0 visits is a special case.
-  const int n_new = n_ - multivisit;
+  const int n_new = n_.load() - multivisit;
   if (n_new <= 0) {
     // If n_new == 0, reset all relevant values to 0.
     wl_ = 0.0;
@@ -383,9 +562,9 @@ void Node::RevertTerminalVisits(float v, float d, float m, int multivisit) {
     n_ = 0;
   } else {
     // Recompute Q and M.
-    wl_ -= multivisit * (v - wl_) / n_new;
-    d_ -= multivisit * (d - d_) / n_new;
-    m_ -= multivisit * (m - m_) / n_new;
+    wl_ -= multivisit * (v - wl_.load()) / n_new;
+    d_ -= multivisit * (d - d_.load()) / n_new;
+    m_ -= multivisit * (m - m_.load()) / n_new;
     // Decrement N.
     n_ -= multivisit;
   }
@@ -410,6 +589,22 @@ void Node::ReleaseChildren() {
   gNodeGc.AddToGcQueue(std::move(child_), solid_children_ ? num_edges_ : 0);
 }
 
+void Node::ResetToUnexpanded() {
+  assert(!IsTerminal() && n_in_flight_ == 0);
+  ReleaseChildren();
+  solid_children_ = false;
+  edges_.reset();
+  num_edges_ = 0;
+  truncated_edges_ = 0;
+  truncated_p_ = 0;
+  lower_bound_ = GameResult::BLACK_WON;
+  upper_bound_ = GameResult::WHITE_WON;
+  wl_ = 0.0;
+  d_ = 0.0f;
+  m_ = 0.0f;
+  n_ = 0;
+}
+
 void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
   if (solid_children_) {
     std::unique_ptr<Node> saved_node;
@@ -444,6 +639,8 @@ void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
   }
   if (!child_) {
     num_edges_ = 0;
+    truncated_edges_ = 0;
+    truncated_p_ = 0;
     edges_.reset();  // Clear edges list.
   }
 }
@@ -478,6 +675,7 @@ void NodeTree::MakeMove(Move move) {
   current_head_ =
       new_head ? new_head : current_head_->CreateSingleChildNode(move);
   history_.Append(move);
+  moves_.push_back(move);
 }
 
 void NodeTree::TrimTreeAtHead() {
@@ -496,11 +694,21 @@ bool NodeTree::ResetToPosition(const GameState& pos) {
     DeallocateTree();
   }
 
+  if (IsContinuedBy(pos)) {
+    // The usual case in a game (and on ponder hit): the new position follows
+    // the current head, so only the new moves have to be made.
+    for (size_t i = moves_.size(); i < pos.moves.size(); ++i) {
+      MakeMove(pos.moves[i]);
+    }
+    return true;
+  }
+
   if (!gamebegin_node_) {
     gamebegin_node_ = std::make_unique<Node>(nullptr, 0);
   }
 
   history_.Reset(pos.startpos);
+  moves_.clear();
 
   Node* old_head = current_head_;
   current_head_ = gamebegin_node_.get();
@@ -519,6 +727,13 @@ bool NodeTree::ResetToPosition(const GameState& pos) {
   return seen_old_head;
 }
 
+bool NodeTree::IsContinuedBy(const GameState& pos) const {
+  return gamebegin_node_ && current_head_ &&
+         history_.Starting() == pos.startpos &&
+         pos.moves.size() >= moves_.size() &&
+         std::equal(moves_.begin(), moves_.end(), pos.moves.begin());
+}
+
 bool NodeTree::ResetToPosition(const std::string& starting_fen,
                                const std::vector<std::string>& moves) {
   GameState state;
@@ -542,5 +757,159 @@ void NodeTree::DeallocateTree() {
   current_head_ = nullptr;
 }
 
+namespace {
+// Tree snapshot file layout (little endian):
+//   magic "LC0TREE2"
+//   uint16 FEN length, FEN of the starting position
+//   uint32 number of moves, uint16 raw moves of the game
+//   the head node, recursively:
+//     double WL, float D, float M, uint32 N,
+//     uint8 terminal type | lower bound << 2 | upper bound << 4,
+//     uint8 number of edges, (uint16 raw move, float P) for each edge,
+//     uint8 number of truncated edges, float P sum of the truncated edges,
+//     uint8 number of visited children, (uint8 edge index, node) for each.
+constexpr char kSnapshotMagic[] = "LC0TREE2";
+constexpr size_t kSnapshotMagicSize = sizeof(kSnapshotMagic) - 1;
+
+template <class T>
+void WriteValue(std::ostream* out, T value) {
+  out->write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+T ReadValue(std::span<const uint8_t> data, size_t* pos) {
+  if (data.size() - *pos < sizeof(T)) {
+    throw Exception("Truncated tree snapshot.");
+  }
+  T value;
+  std::memcpy(&value, data.data() + *pos, sizeof(T));
+  *pos += sizeof(T);
+  return value;
+}
+}  // namespace
+
+void NodeTree::SaveNode(const Node& node, std::ostream* out) {
+  WriteValue<double>(out, node.wl_);
+  WriteValue<float>(out, node.d_);
+  WriteValue<float>(out, node.m_);
+  WriteValue<uint32_t>(out, node.n_);
+  WriteValue<uint8_t>(out, static_cast<uint8_t>(node.terminal_type_) |
+                               static_cast<uint8_t>(node.lower_bound_) << 2 |
+                               static_cast<uint8_t>(node.upper_bound_) << 4);
+  WriteValue<uint8_t>(out, node.num_edges_);
+  uint8_t num_children = 0;
+  for (const auto& edge : node.Edges()) {
+    WriteValue<uint16_t>(out, edge.GetMove().raw_data());
+    WriteValue<float>(out, edge.GetP());
+    if (edge.GetN() > 0) ++num_children;
+  }
+  WriteValue<uint8_t>(out, node.truncated_edges_);
+  WriteValue<float>(out, Edge::DecompressP(node.truncated_p_));
+  WriteValue<uint8_t>(out, num_children);
+  uint8_t index = 0;
+  for (const auto& edge : node.Edges()) {
+    if (edge.GetN() > 0) {
+      WriteValue<uint8_t>(out, index);
+      SaveNode(*edge.node(), out);
+    }
+    ++index;
+  }
+}
+
+size_t NodeTree::LoadNode(std::span<const uint8_t> data, size_t pos,
+                          Node* node) {
+  node->wl_ = ReadValue<double>(data, &pos);
+  node->d_ = ReadValue<float>(data, &pos);
+  node->m_ = ReadValue<float>(data, &pos);
+  node->n_ = ReadValue<uint32_t>(data, &pos);
+  const uint8_t flags = ReadValue<uint8_t>(data, &pos);
+  node->terminal_type_ = static_cast<Node::Terminal>(flags & 3);
+  node->lower_bound_ = static_cast<GameResult>((flags >> 2) & 3);
+  node->upper_bound_ = static_cast<GameResult>((flags >> 4) & 3);
+  const uint8_t num_edges = ReadValue<uint8_t>(data, &pos);
+  if (num_edges > 0) {
+    MoveList moves;
+    std::vector<float> priors;
+    for (int i = 0; i < num_edges; ++i) {
+      moves.push_back(Move::FromRawData(ReadValue<uint16_t>(data, &pos)));
+      priors.push_back(ReadValue<float>(data, &pos));
+    }
+    node->CreateEdges(moves);
+    for (int i = 0; i < num_edges; ++i) node->edges_[i].SetP(priors[i]);
+  }
+  node->truncated_edges_ = ReadValue<uint8_t>(data, &pos);
+  node->truncated_p_ = Edge::CompressP(ReadValue<float>(data, &pos));
+  if (node->truncated_edges_ > 0 && num_edges == 0) {
+    throw Exception("Corrupt tree snapshot.");
+  }
+  const uint8_t num_children = ReadValue<uint8_t>(data, &pos);
+  // The children are a list sorted by the edge index.
+  std::unique_ptr<Node>* tail = &node->child_;
+  int last_index = -1;
+  for (int i = 0; i < num_children; ++i) {
+    const uint8_t index = ReadValue<uint8_t>(data, &pos);
+    if (index <= last_index || index >= num_edges) {
+      throw Exception("Corrupt tree snapshot.");
+    }
+    last_index = index;
+    *tail = std::make_unique<Node>(node, index);
+    pos = LoadNode(data, pos, tail->get());
+    tail = &(*tail)->sibling_;
+  }
+  return pos;
+}
+
+void NodeTree::SaveSnapshot(const std::string& filename) const {
+  // Written next to the old snapshot and renamed, so that a crash doesn't
+  // leave a truncated file behind.
+  const std::string temp_filename = filename + ".tmp";
+  {
+    std::ofstream out(temp_filename, std::ios::binary);
+    if (!out) throw Exception("Cannot create " + temp_filename);
+    out.write(kSnapshotMagic, kSnapshotMagicSize);
+    const std::string fen = PositionToFen(history_.Starting());
+    WriteValue<uint16_t>(&out, fen.size());
+    out.write(fen.data(), fen.size());
+    WriteValue<uint32_t>(&out, moves_.size());
+    for (const Move move : moves_) WriteValue<uint16_t>(&out, move.raw_data());
+    SaveNode(*current_head_, &out);
+    if (!out) throw Exception("Cannot write " + temp_filename);
+  }
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    throw Exception("Cannot rename " + temp_filename);
+  }
+}
+
+bool NodeTree::LoadSnapshot(const std::string& filename) {
+  const MappedFile file(filename);
+  const std::span<const uint8_t> data = file.data();
+  if (data.size() < kSnapshotMagicSize ||
+      std::memcmp(data.data(), kSnapshotMagic, kSnapshotMagicSize) != 0) {
+    throw Exception(filename + " is not a tree snapshot.");
+  }
+  size_t pos = kSnapshotMagicSize;
+  const uint16_t fen_size = ReadValue<uint16_t>(data, &pos);
+  if (data.size() - pos < fen_size) {
+    throw Exception("Truncated tree snapshot.");
+  }
+  const std::string fen(reinterpret_cast<const char*>(data.data() + pos),
+                        fen_size);
+  pos += fen_size;
+  if (fen != PositionToFen(history_.Starting())) return false;
+  const uint32_t num_moves = ReadValue<uint32_t>(data, &pos);
+  if (num_moves != moves_.size()) return false;
+  for (const Move move : moves_) {
+    if (ReadValue<uint16_t>(data, &pos) != move.raw_data()) return false;
+  }
+  TrimTreeAtHead();
+  try {
+    pos = LoadNode(data, pos, current_head_);
+  } catch (...) {
+    TrimTreeAtHead();
+    throw;
+  }
+  return true;
+}
+
 }  // namespace classic
 }  // namespace lczero
@@ -32,6 +32,7 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <span>
 
 #include "chess/board.h"
 #include "chess/callbacks.h"
@@ -39,7 +40,10 @@
 #include "chess/position.h"
 #include "neural/encoder.h"
 #include "proto/net.pb.h"
+#include "search/tree_stats.h"
+#include "utils/block_pool.h"
 #include "utils/mutex.h"
+#include "utils/relaxed_atomic.h"
 
 namespace lczero {
 namespace classic {
@@ -54,6 +58,8 @@ namespace classic {
 //   solid_children_ is true. If the children have been 'solidified' their
 //   sibling links are unused and left empty. In this state there are no
 //   dangling edges, but the nodes may not have ever received any visits.
+// * The edges may be truncated to the ones with the highest policy, the other
+//   moves then only get edges when search reaches the last stored edge.
 //
 // Example:
 //                                Parent Node
@@ -99,6 +105,18 @@ class Edge {
   // Debug information about the edge.
   std::string DebugString() const;
 
+  // The 16 bit format of the prior, also used for policy sums.
+  static uint16_t CompressP(float val);
+  static float DecompressP(uint16_t val);
+
+  // Edge arrays are allocated and freed at high rate, so use the pool.
+  static void* operator new[](size_t size) {
+    return BlockPool::Allocate(size);
+  }
+  static void operator delete[](void* ptr, size_t size) {
+    BlockPool::Free(ptr, size);
+  }
+
  private:
   // Move corresponding to this node. From the point of view of a player,
   // i.e. black's e7e5 is stored as e2e4.
@@ -131,6 +149,19 @@ class Node {
 
   enum class Terminal : uint8_t { NonTerminal, EndOfGame, Tablebase, TwoFold };
 
+  // Nodes are allocated from the pool, see also AllocateSolid().
+  static void* operator new(size_t size) { return BlockPool::Allocate(size); }
+  static void operator delete(void* ptr, size_t size) {
+    BlockPool::Free(ptr, size);
+  }
+  // Allocates and frees the memory for solid children arrays.
+  static Node* AllocateSolid(int count) {
+    return static_cast<Node*>(BlockPool::Allocate(count * sizeof(Node)));
+  }
+  static void FreeSolid(Node* nodes, int count) {
+    BlockPool::Free(nodes, count * sizeof(Node));
+  }
+
   // Takes pointer to a parent node and own index in a parent.
   Node(Node* parent, uint16_t index)
       : parent_(parent),
@@ -152,6 +183,19 @@ class Node {
   // Creates edges from a movelist. There has to be no edges before that.
   void CreateEdges(const MoveList& moves);
 
+  // Keeps only the first edges, which have to be sorted, until there are
+  // @max_edges of them or their policy adds up to @max_policy. The other moves
+  // are only remembered by their number and policy sum. There has to be no
+  // children yet.
+  void TruncateEdges(int max_edges, float max_policy);
+  // Returns whether TruncateEdges() has left out moves.
+  bool HasTruncatedEdges() const { return truncated_edges_ > 0; }
+  // Adds back the edges left out by TruncateEdges(). @moves are all legal
+  // moves of the node, and @priors (if not null) their policy in the same
+  // order. Without priors, the left out moves share their policy sum evenly.
+  // The existing edges and children stay where they are.
+  void RestoreTruncatedEdges(const MoveList& moves, const float* priors);
+
   // Gets parent node.
   Node* GetParent() const { return parent_; }
 
@@ -162,10 +206,15 @@ class Node {
   float GetVisitedPolicy() const;
   uint32_t GetN() const { return n_; }
   uint32_t GetNInFlight() const { return n_in_flight_; }
-  uint32_t GetChildrenVisits() const { return n_ > 0 ? n_ - 1 : 0; }
+  uint32_t GetChildrenVisits() const {
+    const uint32_t n = n_;
+    return n > 0 ? n - 1 : 0;
+  }
   // Returns n = n_if_flight.
-  int GetNStarted() const { return n_ + n_in_flight_; }
-  float GetQ(float draw_score) const { return wl_ + draw_score * d_; }
+  int GetNStarted() const { return n_.load() + n_in_flight_.load(); }
+  float GetQ(float draw_score) const {
+    return wl_.load() + draw_score * d_.load();
+  }
   // Returns node eval, i.e. average subtree V for non-terminal node and -1/0/1
   // for terminal nodes.
   float GetWL() const { return wl_; }
@@ -236,6 +285,24 @@ class Node {
   // Deletes all children.
   void ReleaseChildren();
 
+  // Deletes all children and edges and forgets the visits, so the node becomes
+  // unexpanded again. Must not be terminal nor have visits in flight. The
+  // visits stay counted in the ancestors.
+  void ResetToUnexpanded();
+
+  // Passes the ownership of the sibling and child subtrees to
+  // @fn(std::unique_ptr<Node> subtree, size_t solid_size), where solid_size
+  // is non-zero for solid children arrays. Lets the garbage collector free
+  // large trees in chunks instead of recursively.
+  template <class F>
+  void DetachSubtrees(F&& fn) {
+    if (sibling_) fn(std::move(sibling_), 0);
+    if (!child_) return;
+    const size_t solid_size = solid_children_ ? num_edges_ : 0;
+    solid_children_ = false;
+    fn(std::move(child_), solid_size);
+  }
+
   // Deletes all children except one.
   // The node provided may be moved, so should not be relied upon to exist
   // afterwards.
@@ -253,6 +320,12 @@ class Node {
   // Reallocates this nodes children to be in a solid block, if possible and not
   // already done. Returns true if the transformation was performed.
   bool MakeSolid();
+  // Returns false if MakeSolid() certainly does nothing.
+  bool HasSolidChildren() const { return solid_children_; }
+  bool MayBecomeSolid() const {
+    return !solid_children_ && num_edges_ > 0 && !IsTerminal() &&
+           !HasTruncatedEdges();
+  }
 
   void SortEdges();
 
@@ -266,8 +339,7 @@ class Node {
       for (int i = 0; i < num_edges_; i++) {
         child_.get()[i].~Node();
       }
-      std::allocator<Node> alloc;
-      alloc.deallocate(child_.release(), num_edges_);
+      FreeSolid(child_.release(), num_edges_);
     }
   }
 
@@ -285,7 +357,9 @@ class Node {
   // of the player who "just" moved to reach this position, rather than from the
   // perspective of the player-to-move for the position.
   // WL stands for "W minus L". Is equal to Q if draw score is 0.
-  double wl_ = 0.0f;
+  // The node stats are atomic, as several backups may update them at once
+  // (see SearchWorker::DoBackupUpdate()).
+  RelaxedAtomic<double> wl_ = 0.0f;
 
   // 8 byte fields on 64-bit platforms, 4 byte on 32-bit.
   // Array of edges.
@@ -302,23 +376,28 @@ class Node {
   // 4 byte fields.
   // Averaged draw probability. Works similarly to WL, except that D is not
   // flipped depending on the side to move.
-  float d_ = 0.0f;
+  RelaxedAtomic<float> d_ = 0.0f;
   // Estimated remaining plies.
-  float m_ = 0.0f;
+  RelaxedAtomic<float> m_ = 0.0f;
   // How many completed visits this node had.
-  uint32_t n_ = 0;
+  RelaxedAtomic<uint32_t> n_ = 0;
   // (AKA virtual loss.) How many threads currently process this node (started
   // but not finished). This value is added to n during selection which node
   // to pick in MCTS, and also when selecting the best move.
-  uint32_t n_in_flight_ = 0;
+  RelaxedAtomic<uint32_t> n_in_flight_ = 0;
 
   // 2 byte fields.
   // Index of this node is parent's edge list.
   uint16_t index_;
+  // Policy sum of the moves left out by TruncateEdges(), in the format of
+  // Edge::CompressP().
+  uint16_t truncated_p_ = 0;
 
   // 1 byte fields.
   // Number of edges in @edges_.
   uint8_t num_edges_ = 0;
+  // Number of moves left out by TruncateEdges().
+  uint8_t truncated_edges_ = 0;
 
   // Bit fields using parts of uint8_t fields initialized in the constructor.
   // Whether or not this node end game (with a winning of either sides or draw).
@@ -351,6 +430,9 @@ class Node {
 static_assert(sizeof(Node) == 48, "Unexpected size of Node for 32bit compile");
 #else
 static_assert(sizeof(Node) == 64, "Unexpected size of Node");
+// A node is exactly a cache line, which the BlockPool aligns it to. So looking
+// at a child during selection touches a single line.
+static_assert(sizeof(Node) == BlockPool::kCacheLineSize);
 #endif
 
 // Contains Edge and Node pair and set of proxy functions to simplify access
@@ -633,6 +715,21 @@ inline VisitedNode_Iterator<false> Node::VisitedNodes() {
   return {*this, child_.get()};
 }
 
+// Sets the number of threads freeing the discarded subtrees in background.
+void SetNodeGcThreads(int threads);
+
+struct NodeGcStats {
+  // Subtrees waiting in the queue, not counting the ones being freed.
+  size_t pending_subtrees;
+  // Nodes freed since the start.
+  uint64_t freed_nodes;
+};
+NodeGcStats GetNodeGcStats();
+
+// Walks the subtree of @root, which must not change meanwhile, and adds its
+// nodes and edges to @stats.
+void CollectTreeStats(const Node* root, TreeStats* stats);
+
 class NodeTree {
  public:
   ~NodeTree() { DeallocateTree(); }
@@ -650,20 +747,38 @@ class NodeTree {
   bool ResetToPosition(const std::string& starting_fen,
                        const std::vector<std::string>& moves);
   bool ResetToPosition(const GameState& pos);
+  // Returns whether @pos is the current position or follows it, i.e. whether
+  // ResetToPosition() would keep the current tree.
+  bool IsContinuedBy(const GameState& pos) const;
   const Position& HeadPosition() const { return history_.Last(); }
   int GetPlyCount() const { return HeadPosition().GetGamePly(); }
   bool IsBlackToMove() const { return HeadPosition().IsBlackToMove(); }
   Node* GetCurrentHead() const { return current_head_; }
   Node* GetGameBeginNode() const { return gamebegin_node_.get(); }
   const PositionHistory& GetPositionHistory() const { return history_; }
+  const std::vector<Move>& GetMoves() const { return moves_; }
+
+  // Writes the game and the visited part of the subtree of the current head to
+  // @filename. Must not be called while the tree is searched.
+  void SaveSnapshot(const std::string& filename) const;
+  // Restores the subtree of the current head from a file written by
+  // SaveSnapshot(), if it was saved for the same game. The current head is
+  // trimmed first. Returns whether the snapshot was for this game, throws if
+  // it is corrupt.
+  bool LoadSnapshot(const std::string& filename);
 
  private:
   void DeallocateTree();
+  static void SaveNode(const Node& node, std::ostream* out);
+  // Restores @node from @data at @pos, returns the position after it.
+  static size_t LoadNode(std::span<const uint8_t> data, size_t pos, Node* node);
   // A node which to start search from.
   Node* current_head_ = nullptr;
   // Root node of a game tree.
   std::unique_ptr<Node> gamebegin_node_;
   PositionHistory history_;
+  // Moves from the game begin to the current head.
+  std::vector<Move> moves_;
 };
 
 }  // namespace classic
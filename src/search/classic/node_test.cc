@@ -0,0 +1,168 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "search/classic/node.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace lczero {
+namespace classic {
+namespace {
+
+void Visit(Node* node, float v, float d, float m) {
+  ASSERT_TRUE(node->TryStartScoreUpdate());
+  node->FinalizeScoreUpdate(v, d, m, 1);
+}
+
+}  // namespace
+
+TEST(NodeTree, SnapshotRoundTrip) {
+  const std::string filename = testing::TempDir() + "node_test.lc0tree";
+  NodeTree tree;
+  tree.ResetToPosition(ChessBoard::kStartposFen, {"e2e4"});
+  Node* head = tree.GetCurrentHead();
+  Visit(head, 0.1f, 0.3f, 50.0f);
+  head->CreateEdges(tree.HeadPosition().GetBoard().GenerateLegalMoves());
+  int index = 0;
+  for (auto& edge : head->Edges()) {
+    edge.edge()->SetP(0.05f);
+    // Visit two of the children, leave one expanded without visits.
+    if (index == 3 || index == 7 || index == 9) {
+      Node* child = edge.GetOrSpawnNode(head);
+      if (index != 9) Visit(child, -0.2f * index, 0.25f, 40.0f);
+    }
+    ++index;
+  }
+  tree.SaveSnapshot(filename);
+
+  NodeTree restored;
+  restored.ResetToPosition(ChessBoard::kStartposFen, {"d2d4"});
+  EXPECT_FALSE(restored.LoadSnapshot(filename));
+  restored.ResetToPosition(ChessBoard::kStartposFen, {"e2e4"});
+  ASSERT_TRUE(restored.LoadSnapshot(filename));
+  Node* restored_head = restored.GetCurrentHead();
+  EXPECT_EQ(restored_head->GetN(), head->GetN());
+  EXPECT_EQ(restored_head->GetWL(), head->GetWL());
+  EXPECT_EQ(restored_head->GetD(), head->GetD());
+  EXPECT_EQ(restored_head->GetM(), head->GetM());
+  ASSERT_EQ(restored_head->GetNumEdges(), head->GetNumEdges());
+  auto original = head->Edges().begin();
+  int visited = 0;
+  for (const auto& edge : restored_head->Edges()) {
+    EXPECT_EQ(edge.GetMove(), original.GetMove());
+    EXPECT_EQ(edge.GetP(), original.GetP());
+    EXPECT_EQ(edge.GetN(), original.GetN());
+    EXPECT_EQ(edge.GetWL(0.0f), original.GetWL(0.0f));
+    if (edge.HasNode()) ++visited;
+    ++original;
+  }
+  // Nodes without visits are not saved.
+  EXPECT_EQ(visited, 2);
+  std::remove(filename.c_str());
+}
+
+TEST(Node, TruncateAndRestoreEdges) {
+  const MoveList moves =
+      ChessBoard(ChessBoard::kStartposFen).GenerateLegalMoves();
+  Node node(nullptr, 0);
+  node.CreateEdges(moves);
+  // Policy 0.3, 0.2, 0.1, and the rest share 0.4 evenly.
+  int index = 0;
+  for (auto& edge : node.Edges()) {
+    edge.edge()->SetP(index < 3 ? 0.3f - 0.1f * index : 0.4f / 17);
+    ++index;
+  }
+  node.SortEdges();
+  node.TruncateEdges(10, 0.55f);
+  ASSERT_TRUE(node.HasTruncatedEdges());
+  ASSERT_EQ(node.GetNumEdges(), 3);
+  EXPECT_FALSE(node.MayBecomeSolid());
+
+  Node* child = node.Edges().begin().GetOrSpawnNode(&node);
+  node.RestoreTruncatedEdges(moves, nullptr);
+  EXPECT_FALSE(node.HasTruncatedEdges());
+  ASSERT_EQ(node.GetNumEdges(), moves.size());
+  EXPECT_EQ(node.Edges().begin().node(), child);
+  float policy = 0.0f;
+  float last_p = 1.0f;
+  std::vector<Move> restored;
+  for (const auto& edge : node.Edges()) {
+    EXPECT_LE(edge.GetP(), last_p);
+    last_p = edge.GetP();
+    policy += edge.GetP();
+    restored.push_back(edge.GetMove());
+  }
+  EXPECT_NEAR(policy, 1.0f, 1e-3f);
+  EXPECT_TRUE(std::is_permutation(restored.begin(), restored.end(),
+                                  moves.begin(), moves.end()));
+}
+
+TEST(Node, CollectTreeStats) {
+  const MoveList moves =
+      ChessBoard(ChessBoard::kStartposFen).GenerateLegalMoves();
+  Node root(nullptr, 0);
+  Visit(&root, 0.0f, 0.5f, 60.0f);
+  root.CreateEdges(moves);
+  for (auto& edge : root.Edges()) edge.edge()->SetP(1.0f / moves.size());
+  int index = 0;
+  for (auto& edge : root.Edges()) {
+    if (index++ >= 2) break;
+    Node* child = edge.GetOrSpawnNode(&root);
+    Visit(child, 0.1f, 0.5f, 50.0f);
+    Visit(child, 0.1f, 0.5f, 50.0f);
+  }
+  TreeStats stats;
+  CollectTreeStats(&root, &stats);
+  EXPECT_EQ(stats.nodes.count, 3u);
+  EXPECT_EQ(stats.nodes.bytes, 3 * sizeof(Node));
+  EXPECT_EQ(stats.edges.count, moves.size());
+  EXPECT_EQ(stats.solid_blocks.count, 0u);
+  // 20 edges are in the 20-29 bucket.
+  EXPECT_EQ(stats.edges_histogram[5], 1u);
+  EXPECT_EQ(stats.nodes_per_depth, std::vector<uint64_t>({1, 2}));
+  EXPECT_EQ(stats.visits_per_depth, std::vector<uint64_t>({1, 4}));
+
+  ASSERT_TRUE(root.MakeSolid());
+  TreeStats solid_stats;
+  CollectTreeStats(&root, &solid_stats);
+  EXPECT_EQ(solid_stats.solid_blocks.count, 1u);
+  EXPECT_EQ(solid_stats.solid_nodes, moves.size());
+  EXPECT_EQ(solid_stats.nodes.count, 1 + moves.size());
+  EXPECT_EQ(FormatTreeStats(solid_stats).size(), 4u);
+}
+
+}  // namespace classic
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
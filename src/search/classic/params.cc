@@ -31,6 +31,7 @@
 #include <cctype>
 #include <cmath>
 
+#include "neural/memory_budget.h"
 #include "neural/shared_params.h"
 #include "utils/exception.h"
 #include "utils/string.h"
@@ -54,6 +55,13 @@ FillEmptyHistory EncodeHistoryFill(std::string history_fill) {
   return FillEmptyHistory::NO;
 }
 
+ComputationPriority EncodeNNPriority(std::string priority) {
+  if (priority == "low") return ComputationPriority::kLow;
+  if (priority == "high") return ComputationPriority::kHigh;
+  assert(priority == "normal");
+  return ComputationPriority::kNormal;
+}
+
 float GetContempt(std::string name, std::string contempt_str,
                   float uci_rating_adv) {
   float contempt = uci_rating_adv;
@@ -296,6 +304,17 @@ const OptionId BaseSearchParams::kLogLiveStatsId{
      .uci_option = "LogLiveStats",
      .help_text = "Do VerboseMoveStats on every info update.",
      .visibility = OptionId::kProOnly}};
+const OptionId BaseSearchParams::kTreeStatsId{
+    {.long_flag = "tree-stats",
+     .uci_option = "TreeStats",
+     .help_text =
+         "Report what the search tree consists of with 'info string' before "
+         "the bestmove: the number and memory of nodes, edges, solid blocks, "
+         "low nodes and transposition table entries, the garbage collector "
+         "backlog, the NN cache occupancy, and histograms of the edges per "
+         "node and of the nodes and visits per depth. The whole tree is "
+         "walked for that, which delays the bestmove of large searches.",
+     .visibility = OptionId::kProOnly}};
 const OptionId BaseSearchParams::kFpuStrategyId{
     "fpu-strategy", "FpuStrategy",
     "How is an eval of unvisited node determined. \"First Play Urgency\" "
@@ -479,6 +498,11 @@ const OptionId BaseSearchParams::kTaskWorkersPerSearchWorkerId{
     "task-workers", "TaskWorkers",
     "The number of task workers to use to help the search worker. Setting to "
     "-1 will use a heuristic value."};
+const OptionId BaseSearchParams::kGarbageCollectionThreadsId{
+    "gc-threads", "GarbageCollectionThreads",
+    "The number of threads which free the parts of the search tree that are "
+    "no longer needed. More threads release the old tree faster after a move "
+    "in long analysis."};
 const OptionId BaseSearchParams::kMinimumWorkSizeForProcessingId{
     "minimum-processing-work", "MinimumProcessingWork",
     "This many visits need to be gathered before tasks will be used to "
@@ -524,7 +548,14 @@ const OptionId BaseSearchParams::kUCIRatingAdvId{
     "the current opponent, used as the default contempt value."};
 const OptionId BaseSearchParams::kSearchSpinBackoffId{
     "search-spin-backoff", "SearchSpinBackoff",
-    "Enable backoff for the spin lock that acquires available searcher."};
+    "Enable backoff for the spin lock that acquires available searcher, and "
+    "park the thread after a short spin while none is available, instead of "
+    "spinning until one is."};
+const OptionId BaseSearchParams::kNumaBindId{
+    "numa-bind", "NumaBind",
+    "Bind every search thread (and its task workers) to the processors of "
+    "one NUMA node, spreading the threads over the nodes. The search tree "
+    "memory a thread allocates then stays local to it."};
 
 const OptionId SearchParams::kMaxPrefetchBatchId{
     "max-prefetch", "MaxPrefetch",
@@ -535,6 +566,67 @@ const OptionId SearchParams::kSolidTreeThresholdId{
     "solid-tree-threshold", "SolidTreeThreshold",
     "Only nodes with at least this number of visits will be considered for "
     "solidification for improved cache locality."};
+const OptionId SearchParams::kPipelinedMinibatchesId{
+    "pipelined-minibatches", "PipelinedMinibatches",
+    "Keep two minibatches in flight in every search thread: the next minibatch "
+    "is gathered while the backend is still computing the previous one. Gives "
+    "the overlap of extra search threads with less collisions and locking."};
+const OptionId SearchParams::kTreeMemoryLimitId{
+    "tree-memory-limit", "TreeMemoryLimit",
+    "Maximum size of the search tree, in megabytes (estimated the same way as "
+    "for RamLimitMb). When the tree grows larger, the subtrees with the least "
+    "visits outside of the principal variation are pruned and the search "
+    "continues. Search stops only if there is nothing left to prune. When set "
+    "to 0, the tree size is not limited."};
+const OptionId SearchParams::kAdaptiveMinibatchId{
+    "adaptive-minibatch", "AdaptiveMinibatch",
+    "Choose the size of every minibatch from the measured backend latency, the "
+    "collision rate and the remaining time, instead of always gathering "
+    "MinibatchSize nodes. The batches vary between a quarter of MinibatchSize "
+    "and four times it, limited by the maximum batch size of the backend."};
+const OptionId SearchParams::kPhaseTimersId{
+    "phase-timers", "PhaseTimers",
+    "Measure the time every search thread spends in every phase of the search "
+    "iterations (gathering, NN computation, backup etc.) and report it with "
+    "'info string' before the bestmove."};
+const OptionId SearchParams::kMaxStoredEdgesId{
+    "max-stored-edges", "MaxStoredEdges",
+    "Store at most this number of the highest policy edges of every expanded "
+    "node except the root, to save memory. The other moves are added when "
+    "search reaches the last stored edge. When set to 0, all edges are "
+    "stored."};
+const OptionId SearchParams::kStoredEdgesPolicyId{
+    "stored-edges-policy", "StoredEdgesPolicy",
+    "Like MaxStoredEdges, but stops storing the edges of a node once their "
+    "policy adds up to this value."};
+const OptionId SearchParams::kDeterministicSearchId{
+    "deterministic-search", "DeterministicSearch",
+    "Make the search reproducible, e.g. to compare the performance of builds: "
+    "the search threads gather and back up their minibatches in turns, in a "
+    "fixed order, while the NN computations of the threads still overlap. The "
+    "randomness of the search is seeded from the position. The results only "
+    "repeat with node or visit limits, and when the backend doesn't merge the "
+    "batches of the threads (NNCoalesceDeadline is 0)."};
+const OptionId SearchParams::kSyzygyProbeChildrenId{
+    "syzygy-probe-children", "SyzygyProbeChildren",
+    "When extending a node of up to one piece more than the tablebases, probe "
+    "the positions after all its moves. If they decide the result, the node "
+    "is made terminal without NN evaluation, otherwise they set its bounds. "
+    "Saves NN evaluations in long endgames at the cost of more probes."};
+const OptionId SearchParams::kSharedSearchThreadsId{
+    "shared-search-threads", "SharedSearchThreads",
+    "Run the search threads on a pool shared by all the searches of the "
+    "process, which keeps the threads between the moves. Every search gets a "
+    "thread right away, the other search threads wait while as many threads "
+    "as there are processor cores are busy. Avoids oversubscribing the cores "
+    "when many searches run at a time, e.g. in selfplay."};
+const OptionId SearchParams::kDeadlineMinibatchId{
+    "deadline-minibatch", "DeadlineMinibatch",
+    "Shrink the minibatches near the time limit so that their expected backend "
+    "latency fits the remaining time, also without AdaptiveMinibatch. A "
+    "minibatch gathered when the search is already stopped is abandoned "
+    "instead of evaluated, so that the next search starts sooner. Has no "
+    "effect with DeterministicSearch."};
 
 void BaseSearchParams::Populate(OptionsParser* options) {
   // Here the uci optimized defaults" are set.
@@ -560,6 +652,7 @@ void BaseSearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kNoiseAlphaId, 0.0f, 10000000.0f) = 0.3f;
   options->Add<BoolOption>(kVerboseStatsId) = false;
   options->Add<BoolOption>(kLogLiveStatsId) = false;
+  options->Add<BoolOption>(kTreeStatsId) = false;
   std::vector<std::string> fpu_strategy = {"reduction", "absolute"};
   options->Add<ChoiceOption>(kFpuStrategyId, fpu_strategy) = "reduction";
   options->Add<FloatOption>(kFpuValueId, -100.0f, 100.0f) = 0.330f;
@@ -616,6 +709,7 @@ void BaseSearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kWDLBookExitBiasId, -2.0f, 2.0f) = 0.65f;
   options->Add<FloatOption>(kNpsLimitId, 0.0f, 1e6f) = 0.0f;
   options->Add<IntOption>(kTaskWorkersPerSearchWorkerId, -1, 128) = -1;
+  options->Add<IntOption>(kGarbageCollectionThreadsId, 1, 32) = 1;
   options->Add<IntOption>(kMinimumWorkSizeForProcessingId, 2, 100000) = 20;
   options->Add<IntOption>(kMinimumWorkSizeForPickingId, 1, 100000) = 1;
   options->Add<IntOption>(kMinimumRemainingWorkSizeForPickingId, 0, 100000) =
@@ -626,12 +720,23 @@ void BaseSearchParams::Populate(OptionsParser* options) {
   options->Add<StringOption>(kUCIOpponentId);
   options->Add<FloatOption>(kUCIRatingAdvId, -10000.0f, 10000.0f) = 0.0f;
   options->Add<BoolOption>(kSearchSpinBackoffId) = false;
+  options->Add<BoolOption>(kNumaBindId) = false;
 }
 
 void SearchParams::Populate(OptionsParser* options) {
   BaseSearchParams::Populate(options);
   options->Add<IntOption>(kMaxPrefetchBatchId, 0, 1024) = DEFAULT_MAX_PREFETCH;
   options->Add<IntOption>(kSolidTreeThresholdId, 1, 2000000000) = 100;
+  options->Add<BoolOption>(kPipelinedMinibatchesId) = false;
+  options->Add<IntOption>(kTreeMemoryLimitId, 0, 100000000) = 0;
+  options->Add<BoolOption>(kAdaptiveMinibatchId) = false;
+  options->Add<BoolOption>(kPhaseTimersId) = false;
+  options->Add<IntOption>(kMaxStoredEdgesId, 0, 255) = 0;
+  options->Add<FloatOption>(kStoredEdgesPolicyId, 0.0f, 1.0f) = 1.0f;
+  options->Add<BoolOption>(kDeterministicSearchId) = false;
+  options->Add<BoolOption>(kSyzygyProbeChildrenId) = false;
+  options->Add<BoolOption>(kSharedSearchThreadsId) = false;
+  options->Add<BoolOption>(kDeadlineMinibatchId) = false;
 }
 
 BaseSearchParams::BaseSearchParams(const OptionsDict& options)
@@ -670,6 +775,8 @@ BaseSearchParams::BaseSearchParams(const OptionsDict& options)
       kSyzygyFastPlay(options.Get<bool>(kSyzygyFastPlayId)),
       kHistoryFill(EncodeHistoryFill(
           options.Get<std::string>(SharedBackendParams::kHistoryFill))),
+      kNNPriority(EncodeNNPriority(
+          options.Get<std::string>(SharedBackendParams::kNNPriorityId))),
       kMiniBatchSize(options.Get<int>(kMiniBatchSizeId)),
       kMovesLeftMaxEffect(options.Get<float>(kMovesLeftMaxEffectId)),
       kMovesLeftThreshold(options.Get<float>(kMovesLeftThresholdId)),
@@ -703,6 +810,8 @@ BaseSearchParams::BaseSearchParams(const OptionsDict& options)
       kNpsLimit(options.Get<float>(kNpsLimitId)),
       kTaskWorkersPerSearchWorker(
           options.Get<int>(kTaskWorkersPerSearchWorkerId)),
+      kGarbageCollectionThreads(
+          options.Get<int>(kGarbageCollectionThreadsId)),
       kMinimumWorkSizeForProcessing(
           options.Get<int>(kMinimumWorkSizeForProcessingId)),
       kMinimumWorkSizeForPicking(
@@ -719,10 +828,23 @@ BaseSearchParams::BaseSearchParams(const OptionsDict& options)
           options.Get<int>(kMaxCollisionVisitsScalingEndId)),
       kMaxCollisionVisitsScalingPower(
           options.Get<float>(kMaxCollisionVisitsScalingPowerId)),
-      kSearchSpinBackoff(options_.Get<bool>(kSearchSpinBackoffId)) {}
+      kSearchSpinBackoff(options_.Get<bool>(kSearchSpinBackoffId)),
+      kNumaBind(options_.Get<bool>(kNumaBindId)) {}
 
 SearchParams::SearchParams(const OptionsDict& options)
     : BaseSearchParams(options),
-      kSolidTreeThreshold(options.Get<int>(kSolidTreeThresholdId)) {}
+      kSolidTreeThreshold(options.Get<int>(kSolidTreeThresholdId)),
+      kPipelinedMinibatches(options.Get<bool>(kPipelinedMinibatchesId)),
+      kTreeMemoryLimitMb(GetMemoryBudget(options).IsSet()
+                             ? GetMemoryBudget(options).tree_mb
+                             : options.Get<int>(kTreeMemoryLimitId)),
+      kAdaptiveMinibatch(options.Get<bool>(kAdaptiveMinibatchId)),
+      kPhaseTimers(options.Get<bool>(kPhaseTimersId)),
+      kMaxStoredEdges(options.Get<int>(kMaxStoredEdgesId)),
+      kStoredEdgesPolicy(options.Get<float>(kStoredEdgesPolicyId)),
+      kDeterministicSearch(options.Get<bool>(kDeterministicSearchId)),
+      kSyzygyProbeChildren(options.Get<bool>(kSyzygyProbeChildrenId)),
+      kSharedSearchThreads(options.Get<bool>(kSharedSearchThreadsId)),
+      kDeadlineMinibatch(options.Get<bool>(kDeadlineMinibatchId)) {}
 }  // namespace classic
 }  // namespace lczero
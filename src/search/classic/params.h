@@ -28,6 +28,7 @@
 #pragma once
 
 #include "neural/encoder.h"
+#include "neural/network.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
 
@@ -85,6 +86,7 @@ class BaseSearchParams {
   float GetNoiseAlpha() const { return kNoiseAlpha; }
   bool GetVerboseStats() const { return options_.Get<bool>(kVerboseStatsId); }
   bool GetLogLiveStats() const { return options_.Get<bool>(kLogLiveStatsId); }
+  bool GetTreeStats() const { return options_.Get<bool>(kTreeStatsId); }
   bool GetFpuAbsolute(bool at_root) const {
     return at_root ? kFpuAbsoluteAtRoot : kFpuAbsolute;
   }
@@ -104,6 +106,7 @@ class BaseSearchParams {
     return options_.Get<std::string>(kScoreTypeId);
   }
   FillEmptyHistory GetHistoryFill() const { return kHistoryFill; }
+  ComputationPriority GetNNPriority() const { return kNNPriority; }
   float GetMovesLeftMaxEffect() const { return kMovesLeftMaxEffect; }
   float GetMovesLeftThreshold() const { return kMovesLeftThreshold; }
   float GetMovesLeftSlope() const { return kMovesLeftSlope; }
@@ -134,6 +137,7 @@ class BaseSearchParams {
   int GetTaskWorkersPerSearchWorker() const {
     return kTaskWorkersPerSearchWorker;
   }
+  int GetGarbageCollectionThreads() const { return kGarbageCollectionThreads; }
   int GetMinimumWorkSizeForProcessing() const {
     return kMinimumWorkSizeForProcessing;
   }
@@ -158,6 +162,7 @@ class BaseSearchParams {
     return kMaxCollisionVisitsScalingPower;
   }
   bool GetSearchSpinBackoff() const { return kSearchSpinBackoff; }
+  bool GetNumaBind() const { return kNumaBind; }
 
   // Search parameter IDs.
   static const OptionId kMiniBatchSizeId;
@@ -180,6 +185,7 @@ class BaseSearchParams {
   static const OptionId kNoiseAlphaId;
   static const OptionId kVerboseStatsId;
   static const OptionId kLogLiveStatsId;
+  static const OptionId kTreeStatsId;
   static const OptionId kFpuStrategyId;
   static const OptionId kFpuValueId;
   static const OptionId kFpuStrategyAtRootId;
@@ -214,6 +220,7 @@ class BaseSearchParams {
   static const OptionId kMaxOutOfOrderEvalsFactorId;
   static const OptionId kNpsLimitId;
   static const OptionId kTaskWorkersPerSearchWorkerId;
+  static const OptionId kGarbageCollectionThreadsId;
   static const OptionId kMinimumWorkSizeForProcessingId;
   static const OptionId kMinimumWorkSizeForPickingId;
   static const OptionId kMinimumRemainingWorkSizeForPickingId;
@@ -226,6 +233,7 @@ class BaseSearchParams {
   static const OptionId kUCIOpponentId;
   static const OptionId kUCIRatingAdvId;
   static const OptionId kSearchSpinBackoffId;
+  static const OptionId kNumaBindId;
 
  protected:
   const OptionsDict& options_;
@@ -258,6 +266,7 @@ class BaseSearchParams {
   const bool kStickyEndgames;
   const bool kSyzygyFastPlay;
   const FillEmptyHistory kHistoryFill;
+  const ComputationPriority kNNPriority;
   const int kMiniBatchSize;
   const float kMovesLeftMaxEffect;
   const float kMovesLeftThreshold;
@@ -274,6 +283,7 @@ class BaseSearchParams {
   const float kMaxOutOfOrderEvalsFactor;
   const float kNpsLimit;
   const int kTaskWorkersPerSearchWorker;
+  const int kGarbageCollectionThreads;
   const int kMinimumWorkSizeForProcessing;
   const int kMinimumWorkSizeForPicking;
   const int kMinimumRemainingWorkSizeForPicking;
@@ -284,6 +294,7 @@ class BaseSearchParams {
   const int kMaxCollisionVisitsScalingEnd;
   const float kMaxCollisionVisitsScalingPower;
   const bool kSearchSpinBackoff;
+  const bool kNumaBind;
 };
 
 class SearchParams : public BaseSearchParams {
@@ -299,13 +310,43 @@ class SearchParams : public BaseSearchParams {
     return options_.Get<int>(kMaxPrefetchBatchId);
   }
   int GetSolidTreeThreshold() const { return kSolidTreeThreshold; }
+  bool GetPipelinedMinibatches() const { return kPipelinedMinibatches; }
+  int GetTreeMemoryLimitMb() const { return kTreeMemoryLimitMb; }
+  bool GetAdaptiveMinibatch() const { return kAdaptiveMinibatch; }
+  bool GetPhaseTimers() const { return kPhaseTimers; }
+  int GetMaxStoredEdges() const { return kMaxStoredEdges; }
+  float GetStoredEdgesPolicy() const { return kStoredEdgesPolicy; }
+  bool GetDeterministicSearch() const { return kDeterministicSearch; }
+  bool GetSyzygyProbeChildren() const { return kSyzygyProbeChildren; }
+  bool GetSharedSearchThreads() const { return kSharedSearchThreads; }
+  bool GetDeadlineMinibatch() const { return kDeadlineMinibatch; }
 
   // Search parameter IDs.
   static const OptionId kMaxPrefetchBatchId;
   static const OptionId kSolidTreeThresholdId;
+  static const OptionId kPipelinedMinibatchesId;
+  static const OptionId kTreeMemoryLimitId;
+  static const OptionId kAdaptiveMinibatchId;
+  static const OptionId kPhaseTimersId;
+  static const OptionId kMaxStoredEdgesId;
+  static const OptionId kStoredEdgesPolicyId;
+  static const OptionId kDeterministicSearchId;
+  static const OptionId kSyzygyProbeChildrenId;
+  static const OptionId kSharedSearchThreadsId;
+  static const OptionId kDeadlineMinibatchId;
 
  private:
   const int kSolidTreeThreshold;
+  const bool kPipelinedMinibatches;
+  const int kTreeMemoryLimitMb;
+  const bool kAdaptiveMinibatch;
+  const bool kPhaseTimers;
+  const int kMaxStoredEdges;
+  const float kStoredEdgesPolicy;
+  const bool kDeterministicSearch;
+  const bool kSyzygyProbeChildren;
+  const bool kSharedSearchThreads;
+  const bool kDeadlineMinibatch;
 };
 }  // namespace classic
 }  // namespace lczero
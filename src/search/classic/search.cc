@@ -38,10 +38,15 @@
 #include <thread>
 
 #include "neural/encoder.h"
+#include "neural/memcache.h"
 #include "search/classic/node.h"
+#include "search/classic/stoppers/stoppers.h"
 #include "utils/fastmath.h"
+#include "utils/metrics.h"
+#include "utils/numa.h"
 #include "utils/random.h"
 #include "utils/spinhelper.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace classic {
@@ -50,6 +55,15 @@ namespace {
 // Maximum delay between outputting "uci info" when nothing interesting happens.
 const int kUciInfoMinimumFrequencyMs = 5000;
 
+Counter* const kPlayoutsMetric = MetricsRegistry::Get().GetCounter(
+    "lc0_search_playouts_total", "Playouts backed up by the search.");
+Counter* const kCollisionsMetric = MetricsRegistry::Get().GetCounter(
+    "lc0_search_collisions_total", "Visits discarded as collisions.");
+FixedHistogram* const kBatchPlayoutsMetric =
+    MetricsRegistry::Get().GetHistogram(
+        "lc0_search_batch_playouts", "Playouts backed up per search batch.",
+        ExponentialBuckets(1, 2, 12));
+
 MoveList MakeRootMoveFilter(const MoveList& searchmoves,
                             SyzygyTablebase* syzygy_tb,
                             const PositionHistory& history, bool fast_play,
@@ -147,8 +161,80 @@ class MEvaluator {
   bool parent_within_threshold_ = false;
 };
 
+// Returns whether the node is the last stored edge of a parent with truncated
+// edges, so that search needs the other moves of the parent next.
+bool ReachesTruncatedEdges(const Node* node) {
+  const Node* parent = node->GetParent();
+  return parent && parent->HasTruncatedEdges() &&
+         node->Index() + 1 == parent->GetNumEdges();
+}
+
+// Adds back the edges Node::TruncateEdges() left out, with the priors from the
+// backend cache if it still has the position.
+void RestoreTruncatedEdges(Node* node, const PositionHistory& history,
+                           Backend* backend) {
+  const MoveList legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+  const std::optional<EvalResult> cached = backend->GetCachedEvaluation(
+      EvalPosition{history.GetPositions(), legal_moves});
+  node->RestoreTruncatedEdges(
+      legal_moves, cached && cached->p.size() == legal_moves.size()
+                       ? cached->p.data()
+                       : nullptr);
+}
+
 }  // namespace
 
+void SearchPhaseTimes::Add(const SearchPhaseTimes& other) {
+  for (int i = 0; i < kNumPhases; ++i) nanoseconds[i] += other.nanoseconds[i];
+  iterations += other.iterations;
+}
+
+const char* SearchPhaseTimes::GetName(Phase phase) {
+  static constexpr std::array<const char*, kNumPhases> kNames = {
+      "init", "gather", "collisions", "prefetch",
+      "nn",   "fetch",  "backup",     "counters"};
+  return kNames[phase];
+}
+
+void MinibatchStats::Add(const MinibatchStats& other) {
+  for (int i = 0; i < kNumCounters; ++i) counts[i] += other.counts[i];
+}
+
+const char* MinibatchStats::GetName(Counter counter) {
+  static constexpr std::array<const char*, kNumCounters> kNames = {
+      "minibatches", "collision_events", "collision_visits", "out_of_order",
+      "cache_hits",  "nn_evals",         "wasted_slots"};
+  return kNames[counter];
+}
+
+std::string MinibatchStats::ToString() const {
+  const int64_t minibatches = counts[kMinibatches];
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(2) << minibatches
+      << " minibatches, per minibatch:";
+  for (int i = kMinibatches + 1; i < kNumCounters; ++i) {
+    oss << " " << GetName(static_cast<Counter>(i)) << " "
+        << (minibatches > 0 ? 1.0 * counts[i] / minibatches : 0.0)
+        << (i + 1 < kNumCounters ? "," : "");
+  }
+  return oss.str();
+}
+
+std::string SearchPhaseTimes::ToString() const {
+  int64_t total = 0;
+  for (int64_t ns : nanoseconds) total += ns;
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1);
+  for (int i = 0; i < kNumPhases; ++i) {
+    oss << GetName(static_cast<Phase>(i)) << " "
+        << (total > 0 ? 100.0 * nanoseconds[i] / total : 0.0)
+        << (i + 1 < kNumPhases ? "%, " : "% ");
+  }
+  oss << "of " << std::setprecision(2) << total / 1e9 << "s in " << iterations
+      << " iterations";
+  return oss.str();
+}
+
 Search::Search(const NodeTree& tree, Backend* backend,
                std::unique_ptr<UciResponder> uci_responder,
                const MoveList& searchmoves,
@@ -171,10 +257,27 @@ Search::Search(const NodeTree& tree, Backend* backend,
           searchmoves_, syzygy_tb_, played_history_,
           params_.GetSyzygyFastPlay(), &tb_hits_, &root_is_in_dtz_)),
       uci_responder_(std::move(uci_responder)) {
+  SetNodeGcThreads(params_.GetGarbageCollectionThreads());
+  if (params_.GetDeterministicSearch()) {
+    Random::Get().Seed(played_history_.Last().Hash());
+  }
   if (params_.GetMaxConcurrentSearchers() != 0) {
     pending_searchers_.store(params_.GetMaxConcurrentSearchers(),
                              std::memory_order_release);
   }
+  if (!searchmoves_.empty() && root_node_->GetN() > 0) {
+    // The tree is kept between the searches of different searchmoves, but
+    // only the visits to the searched moves count towards the limits.
+    initial_visits_ = 1;
+    for (auto& edge : root_node_->Edges()) {
+      if (std::find(searchmoves_.begin(), searchmoves_.end(),
+                    edge.GetMove()) != searchmoves_.end()) {
+        initial_visits_ += edge.GetN();
+      }
+    }
+    LOGFILE << "Reusing " << initial_visits_ << " of " << root_node_->GetN()
+            << " root visits for the searchmoves.";
+  }
   contempt_mode_ = params_.GetContemptMode();
   // Make sure the contempt mode is never "play" beyond this point.
   if (contempt_mode_ == ContemptMode::PLAY) {
@@ -196,18 +299,18 @@ Search::Search(const NodeTree& tree, Backend* backend,
                            : ContemptMode::WHITE;
     }
   }
+  // The root was an inner node of the previous search, it needs all moves.
+  if (root_node_->HasTruncatedEdges()) {
+    RestoreTruncatedEdges(root_node_, played_history_, backend_);
+  }
 }
 
 namespace {
 void ApplyDirichletNoise(Node* node, float eps, double alpha) {
+  std::vector<float> noise(node->GetNumEdges());
+  Random::Get().GetGammas(alpha, noise.data(), noise.size());
   float total = 0;
-  std::vector<float> noise;
-
-  for (int i = 0; i < node->GetNumEdges(); ++i) {
-    float eta = Random::Get().GetGamma(alpha, 1.0);
-    noise.emplace_back(eta);
-    total += eta;
-  }
+  for (float eta : noise) total += eta;
 
   if (total < std::numeric_limits<float>::min()) return;
 
@@ -219,6 +322,15 @@ void ApplyDirichletNoise(Node* node, float eps, double alpha) {
 }
 }  // namespace
 
+void Search::ApplyNoiseToReusedRoot() {
+  if (!params_.GetNoiseEpsilon() || root_node_->GetN() == 0 ||
+      root_node_->GetNumEdges() == 0 || root_node_->IsTerminal()) {
+    return;
+  }
+  ApplyDirichletNoise(root_node_, params_.GetNoiseEpsilon(),
+                      params_.GetNoiseAlpha());
+}
+
 namespace {
 // WDL conversion formula based on random walk model.
 inline double WDLRescale(float& v, float& d, float wdl_rescale_ratio,
@@ -258,21 +370,18 @@ inline double WDLRescale(float& v, float& d, float wdl_rescale_ratio,
 }
 }  // namespace
 
-void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
+Search::InfoSnapshot Search::SnapshotInfo() REQUIRES_SHARED(nodes_mutex_)
+    REQUIRES(counters_mutex_) {
   const auto max_pv = params_.GetMultiPv();
   const auto edges = GetBestChildrenNoTemperature(root_node_, max_pv, 0);
-  const auto score_type = params_.GetScoreType();
-  const auto per_pv_counters = params_.GetPerPvCounters();
   const auto draw_score = GetDrawScore(false);
 
-  std::vector<ThinkingInfo> uci_infos;
-
-  // Info common for all multipv variants.
-  ThinkingInfo common_info;
+  InfoSnapshot snapshot;
+  ThinkingInfo& common_info = snapshot.common;
   common_info.depth = cum_depth_ / (total_playouts_ ? total_playouts_ : 1);
   common_info.seldepth = max_depth_;
   common_info.time = GetTimeSinceStart();
-  if (!per_pv_counters) {
+  if (!params_.GetPerPvCounters()) {
     common_info.nodes = total_playouts_ + initial_visits_;
   }
   if (nps_start_time_) {
@@ -286,16 +395,67 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
   }
   common_info.tb_hits = tb_hits_.load(std::memory_order_acquire);
 
-  int multipv = 0;
   const auto default_q = -root_node_->GetQ(-draw_score);
   const auto default_wl = -root_node_->GetWL();
   const auto default_d = root_node_->GetD();
+  std::vector<CachedPv> new_pv_cache;
   for (const auto& edge : edges) {
+    auto& line = snapshot.lines.emplace_back();
+    line.wl = edge.GetWL(default_wl);
+    line.d = edge.GetD(default_d);
+    line.q = edge.GetQ(default_q, draw_score);
+    line.m = edge.GetM(0.0f);
+    line.moves_left = edge.GetM(1.0f + root_node_->GetM());
+    line.n = edge.GetN();
+    line.is_terminal = edge.IsTerminal();
+    line.is_tb_terminal = edge.IsTbTerminal();
+    // Every change below the root child goes with a visit to it, so its PV
+    // is only walked again when its visit count changed.
+    auto cached = std::find_if(
+        pv_cache_.begin(), pv_cache_.end(),
+        [&](const CachedPv& pv) { return pv.node == edge.node(); });
+    if (edge.node() && cached != pv_cache_.end() && cached->n == line.n) {
+      line.pv = cached->pv;
+      new_pv_cache.push_back(std::move(*cached));
+      continue;
+    }
+    bool flip = played_history_.IsBlackToMove();
+    int depth = 0;
+    for (auto iter = edge; iter;
+         iter = GetBestChildNoTemperature(iter.node(), depth), flip = !flip) {
+      line.pv.push_back(iter.GetMove(flip));
+      if (!iter.node()) break;  // Last edge was dangling, cannot continue.
+      depth += 1;
+    }
+    if (edge.node()) new_pv_cache.push_back({edge.node(), line.n, line.pv});
+  }
+  pv_cache_ = std::move(new_pv_cache);
+
+  if (!snapshot.lines.empty()) {
+    last_reported_depth_ = common_info.depth;
+    last_reported_seldepth_ = common_info.seldepth;
+    last_reported_time_ = common_info.time;
+  }
+  if (current_best_edge_ && !edges.empty()) {
+    last_reported_edge_ = current_best_edge_.edge();
+  }
+  return snapshot;
+}
+
+std::vector<ThinkingInfo> Search::FormatUciInfo(
+    const InfoSnapshot& snapshot) const {
+  const auto max_pv = params_.GetMultiPv();
+  const auto score_type = params_.GetScoreType();
+  const auto per_pv_counters = params_.GetPerPvCounters();
+
+  std::vector<ThinkingInfo> uci_infos;
+  int multipv = 0;
+  for (const auto& line : snapshot.lines) {
     ++multipv;
-    uci_infos.emplace_back(common_info);
+    uci_infos.emplace_back(snapshot.common);
     auto& uci_info = uci_infos.back();
-    auto wl = edge.GetWL(default_wl);
-    auto d = edge.GetD(default_d);
+    auto wl = line.wl;
+    auto d = line.d;
     float mu_uci = 0.0f;
     if (score_type == "WDL_mu" || (params_.GetWDLRescaleDiff() != 0.0f &&
                                    contempt_mode_ != ContemptMode::NONE)) {
@@ -310,11 +470,10 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
               : params_.GetWDLRescaleDiff() * params_.GetWDLEvalObjectivity(),
           sign, true, params_.GetWDLMaxS());
     }
-    const auto q = edge.GetQ(default_q, draw_score);
-    if (edge.IsTerminal() && wl != 0.0f) {
+    const auto q = line.q;
+    if (line.is_terminal && wl != 0.0f) {
       uci_info.mate = std::copysign(
-          std::round(edge.GetM(0.0f)) / 2 + (edge.IsTbTerminal() ? 101 : 1),
-          wl);
+          std::round(line.m) / 2 + (line.is_tb_terminal ? 101 : 1), wl);
     } else if (score_type == "centipawn_with_drawscore") {
       uci_info.score = 90 * tan(1.5637541897 * q);
     } else if (score_type == "centipawn") {
@@ -356,55 +515,110 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
     }
     uci_info.wdl = ThinkingInfo::WDL{wdl_w, wdl_d, wdl_l};
     if (backend_attributes_.has_mlh) {
-      uci_info.moves_left = static_cast<int>(
-          (1.0f + edge.GetM(1.0f + root_node_->GetM())) / 2.0f);
+      uci_info.moves_left =
+          static_cast<int>((1.0f + line.moves_left) / 2.0f);
     }
     if (max_pv > 1) uci_info.multipv = multipv;
-    if (per_pv_counters) uci_info.nodes = edge.GetN();
-    bool flip = played_history_.IsBlackToMove();
-    int depth = 0;
-    for (auto iter = edge; iter;
-         iter = GetBestChildNoTemperature(iter.node(), depth), flip = !flip) {
-      uci_info.pv.push_back(iter.GetMove(flip));
-      if (!iter.node()) break;  // Last edge was dangling, cannot continue.
-      depth += 1;
-    }
-  }
-
-  if (!uci_infos.empty()) last_outputted_uci_info_ = uci_infos.front();
-  if (current_best_edge_ && !edges.empty()) {
-    last_outputted_info_edge_ = current_best_edge_.edge();
+    if (per_pv_counters) uci_info.nodes = line.n;
+    uci_info.pv = line.pv;
   }
-
-  uci_responder_->OutputThinkingInfo(&uci_infos);
+  return uci_infos;
 }
 
 // Decides whether anything important changed in stats and new info should be
 // shown to a user.
 void Search::MaybeOutputInfo() {
-  SharedMutex::Lock lock(nodes_mutex_);
+  // The reporter is still busy with the previous info, it would be stale
+  // before it's shown anyway.
+  if (report_pending_.load(std::memory_order_acquire)) return;
+  SharedMutex::SharedLock lock(nodes_mutex_);
   Mutex::Lock counters_lock(counters_mutex_);
   if (!bestmove_is_sent_ && current_best_edge_ &&
-      (current_best_edge_.edge() != last_outputted_info_edge_ ||
-       last_outputted_uci_info_.depth !=
+      (current_best_edge_.edge() != last_reported_edge_ ||
+       last_reported_depth_ !=
            static_cast<int>(cum_depth_ /
                             (total_playouts_ ? total_playouts_ : 1)) ||
-       last_outputted_uci_info_.seldepth != max_depth_ ||
-       last_outputted_uci_info_.time + kUciInfoMinimumFrequencyMs <
+       last_reported_seldepth_ != max_depth_ ||
+       last_reported_time_ + kUciInfoMinimumFrequencyMs <
            GetTimeSinceStart())) {
-    SendUciInfo();
-    if (params_.GetLogLiveStats()) {
-      SendMovesStats();
-    }
+    InfoSnapshot snapshot = SnapshotInfo();
+    if (params_.GetLogLiveStats()) SnapshotMovesStats(&snapshot);
     if (stop_.load(std::memory_order_acquire) && !ok_to_respond_bestmove_) {
-      std::vector<ThinkingInfo> info(1);
-      info.back().comment =
-          "WARNING: Search has reached limit and does not make any progress.";
-      uci_responder_->OutputThinkingInfo(&info);
+      snapshot.comments.push_back(
+          "WARNING: Search has reached limit and does not make any progress.");
+    }
+    QueueReport(std::move(snapshot));
+  }
+}
+
+void Search::QueueReport(InfoSnapshot snapshot) {
+  if (!snapshot.best_move) {
+    report_pending_.store(true, std::memory_order_release);
+  }
+  {
+    Mutex::Lock lock(reporter_mutex_);
+    reports_.push_back(std::move(snapshot));
+  }
+  reporter_cv_.notify_one();
+}
+
+void Search::ReporterThread() {
+  while (true) {
+    InfoSnapshot snapshot;
+    {
+      Mutex::Lock lock(reporter_mutex_);
+      reporter_cv_.wait(lock.get_raw(), [this]() REQUIRES(reporter_mutex_) {
+        return !reports_.empty() || reporter_done_;
+      });
+      if (reports_.empty()) break;
+      snapshot = std::move(reports_.front());
+      reports_.pop_front();
+    }
+    OutputReport(snapshot);
+    if (!snapshot.best_move) {
+      report_pending_.store(false, std::memory_order_release);
     }
   }
 }
 
+void Search::OutputReport(const InfoSnapshot& snapshot) {
+  TraceSpan trace_span("uci_output", "search");
+  auto uci_infos = FormatUciInfo(snapshot);
+  uci_responder_->OutputThinkingInfo(&uci_infos);
+  if (snapshot.move_stats) {
+    const auto move_stats = FormatVerboseStats(*snapshot.move_stats);
+    if (params_.GetVerboseStats()) {
+      std::vector<ThinkingInfo> infos;
+      std::transform(move_stats.begin(), move_stats.end(),
+                     std::back_inserter(infos), [](const std::string& line) {
+                       ThinkingInfo info;
+                       info.comment = line;
+                       return info;
+                     });
+      uci_responder_->OutputThinkingInfo(&infos);
+    } else {
+      LOGFILE << "=== Move stats:";
+      for (const auto& line : move_stats) LOGFILE << line;
+    }
+  }
+  if (snapshot.opponent_stats) {
+    LOGFILE << "--- Opponent moves after: "
+            << snapshot.opponent_move.ToString(true);
+    for (const auto& line : FormatVerboseStats(*snapshot.opponent_stats)) {
+      LOGFILE << line;
+    }
+  }
+  for (const auto& comment : snapshot.comments) {
+    std::vector<ThinkingInfo> info(1);
+    info.back().comment = comment;
+    uci_responder_->OutputThinkingInfo(&info);
+  }
+  if (snapshot.best_move) {
+    BestMoveInfo info = *snapshot.best_move;
+    uci_responder_->OutputBestMove(&info);
+  }
+}
+
 int64_t Search::GetTimeSinceStart() const {
   return std::chrono::duration_cast<std::chrono::milliseconds>(
              std::chrono::steady_clock::now() - start_time_)
@@ -453,7 +667,7 @@ inline float ComputeCpuct(const SearchParams& params, uint32_t N,
 }
 }  // namespace
 
-std::vector<std::string> Search::GetVerboseStats(Node* node) const {
+Search::VerboseStats Search::GetVerboseStats(Node* node) const {
   assert(node == root_node_ || node->GetParent() == root_node_);
   const bool is_root = (node == root_node_);
   const bool is_odd_depth = !is_root;
@@ -474,23 +688,74 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
                          b.GetN(), b.GetQ(fpu, draw_score) + b.GetU(U_coeff));
             });
 
+  VerboseStats stats;
+  stats.draw_score = draw_score;
+  stats.fpu = fpu;
+  if (!is_root) stats.path.push_back(node->GetOwnEdge()->GetMove());
+  auto fill_node = [&](VerboseStatsEntry* entry, const Node* n) {
+    if (!n) return;
+    const auto sign = n == node ? -1 : 1;
+    entry->has_node = true;
+    entry->wl = n->GetWL();
+    entry->d = n->GetD();
+    entry->m = n->GetM();
+    if (n->IsTerminal()) entry->terminal_q = n->GetQ(sign * draw_score);
+    entry->bounds = n->GetBounds();
+  };
+
+  const auto m_evaluator =
+      backend_attributes_.has_mlh ? MEvaluator(params_, node) : MEvaluator();
+  for (const auto& edge : edges) {
+    float Q = edge.GetQ(fpu, draw_score);
+    float M = m_evaluator.GetMUtility(edge, Q);
+    auto& entry = stats.entries.emplace_back();
+    // TODO: should this be displaying transformed index?
+    entry.label = edge.GetMove(is_black_to_move).ToString(true);
+    entry.move = edge.GetMove();
+    entry.index = MoveToNNIndex(edge.GetMove(), 0);
+    entry.n = edge.GetN();
+    entry.n_in_flight = edge.GetNInFlight();
+    entry.p = edge.GetP();
+    entry.u = edge.GetU(U_coeff);
+    entry.s = Q + entry.u + M;
+    fill_node(&entry, edge.node());
+  }
+
+  // Include stats about the node in similar format to its children above.
+  auto& entry = stats.entries.emplace_back();
+  entry.label = "node ";
+  entry.index = node->GetNumEdges();
+  entry.n = node->GetN();
+  entry.n_in_flight = node->GetNInFlight();
+  entry.p = node->GetVisitedPolicy();
+  fill_node(&entry, node);
+  return stats;
+}
+
+std::vector<std::string> Search::FormatVerboseStats(
+    const VerboseStats& stats) const {
+  const float draw_score = stats.draw_score;
+  const float fpu = stats.fpu;
+  PositionHistory history(played_history_);
+  for (const Move move : stats.path) history.Append(move);
+
   auto print = [](auto* oss, auto pre, auto v, auto post, auto w, int p = 0) {
     *oss << pre << std::setw(w) << std::setprecision(p) << v << post;
   };
-  auto print_head = [&](auto* oss, auto label, int i, auto n, auto f, auto p) {
+  auto print_head = [&](auto* oss, const VerboseStatsEntry& entry) {
     *oss << std::fixed;
-    print(oss, "", label, " ", 5);
-    print(oss, "(", i, ") ", 4);
+    print(oss, "", entry.label, " ", 5);
+    print(oss, "(", entry.index, ") ", 4);
     *oss << std::right;
-    print(oss, "N: ", n, " ", 7);
-    print(oss, "(+", f, ") ", 2);
-    print(oss, "(P: ", p * 100, "%) ", 5, p >= 0.99995f ? 1 : 2);
+    print(oss, "N: ", entry.n, " ", 7);
+    print(oss, "(+", entry.n_in_flight, ") ", 2);
+    print(oss, "(P: ", entry.p * 100, "%) ", 5, entry.p >= 0.99995f ? 1 : 2);
   };
-  auto print_stats = [&](auto* oss, const auto* n) {
-    const auto sign = n == node ? -1 : 1;
-    if (n) {
-      auto wl = sign * n->GetWL();
-      auto d = n->GetD();
+  auto print_stats = [&](auto* oss, const VerboseStatsEntry& entry) {
+    const auto sign = entry.move ? 1 : -1;
+    if (entry.has_node) {
+      auto wl = sign * entry.wl;
+      auto d = entry.d;
       auto is_perspective = ((contempt_mode_ == ContemptMode::BLACK) ==
                              played_history_.IsBlackToMove())
                                 ? 1.0f
@@ -503,22 +768,22 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
           is_perspective, true, params_.GetWDLMaxS());
       print(oss, "(WL: ", wl, ") ", 8, 5);
       print(oss, "(D: ", d, ") ", 5, 3);
-      print(oss, "(M: ", n->GetM(), ") ", 4, 1);
+      print(oss, "(M: ", entry.m, ") ", 4, 1);
       print(oss, "(Q: ", wl + draw_score * d, ") ", 8, 5);
     } else {
       *oss << "(WL:  -.-----) (D: -.---) (M:  -.-) ";
       print(oss, "(Q: ", fpu, ") ", 8, 5);
     }
   };
-  auto print_tail = [&](auto* oss, const auto* n) {
-    const auto sign = n == node ? -1 : 1;
-    std::optional<float> v;
-    if (n && n->IsTerminal()) {
-      v = n->GetQ(sign * draw_score);
-    } else if (n) {
-      auto history = GetPositionHistoryAtNode(n);
+  auto print_tail = [&](auto* oss, const VerboseStatsEntry& entry) {
+    const auto sign = entry.move ? 1 : -1;
+    std::optional<float> v = entry.terminal_q;
+    if (entry.has_node && !v) {
+      // The cache lookup is done here rather than under the search lock.
+      if (entry.move) history.Append(*entry.move);
       std::optional<EvalResult> nneval = backend_->GetCachedEvaluation(
           EvalPosition{history.GetPositions(), {}});
+      if (entry.move) history.Pop();
       if (nneval) v = -nneval->q;
     }
     if (v) {
@@ -527,8 +792,8 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
       *oss << "(V:  -.----) ";
     }
 
-    if (n) {
-      auto [lo, up] = n->GetBounds();
+    if (entry.has_node) {
+      auto [lo, up] = entry.bounds;
       if (sign == -1) {
         lo = -lo;
         up = -up;
@@ -542,75 +807,35 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
   };
 
   std::vector<std::string> infos;
-  const auto m_evaluator =
-      backend_attributes_.has_mlh ? MEvaluator(params_, node) : MEvaluator();
-  for (const auto& edge : edges) {
-    float Q = edge.GetQ(fpu, draw_score);
-    float M = m_evaluator.GetMUtility(edge, Q);
+  for (const auto& entry : stats.entries) {
     std::ostringstream oss;
-    oss << std::left;
-    // TODO: should this be displaying transformed index?
-    print_head(&oss, edge.GetMove(is_black_to_move).ToString(true),
-               MoveToNNIndex(edge.GetMove(), 0), edge.GetN(),
-               edge.GetNInFlight(), edge.GetP());
-    print_stats(&oss, edge.node());
-    print(&oss, "(U: ", edge.GetU(U_coeff), ") ", 6, 5);
-    print(&oss, "(S: ", Q + edge.GetU(U_coeff) + M, ") ", 8, 5);
-    print_tail(&oss, edge.node());
+    if (entry.move) oss << std::left;
+    print_head(&oss, entry);
+    print_stats(&oss, entry);
+    if (entry.move) {
+      print(&oss, "(U: ", entry.u, ") ", 6, 5);
+      print(&oss, "(S: ", entry.s, ") ", 8, 5);
+    }
+    print_tail(&oss, entry);
     infos.emplace_back(oss.str());
   }
-
-  // Include stats about the node in similar format to its children above.
-  std::ostringstream oss;
-  print_head(&oss, "node ", node->GetNumEdges(), node->GetN(),
-             node->GetNInFlight(), node->GetVisitedPolicy());
-  print_stats(&oss, node);
-  print_tail(&oss, node);
-  infos.emplace_back(oss.str());
   return infos;
 }
 
-void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
-  auto move_stats = GetVerboseStats(root_node_);
-
-  if (params_.GetVerboseStats()) {
-    std::vector<ThinkingInfo> infos;
-    std::transform(move_stats.begin(), move_stats.end(),
-                   std::back_inserter(infos), [](const std::string& line) {
-                     ThinkingInfo info;
-                     info.comment = line;
-                     return info;
-                   });
-    uci_responder_->OutputThinkingInfo(&infos);
-  } else {
-    LOGFILE << "=== Move stats:";
-    for (const auto& line : move_stats) LOGFILE << line;
-  }
+void Search::SnapshotMovesStats(InfoSnapshot* snapshot) const
+    REQUIRES_SHARED(nodes_mutex_) REQUIRES(counters_mutex_) {
+  snapshot->move_stats = GetVerboseStats(root_node_);
   for (auto& edge : root_node_->Edges()) {
     if (!(edge.GetMove(played_history_.IsBlackToMove()) == final_bestmove_)) {
       continue;
     }
     if (edge.HasNode()) {
-      LOGFILE << "--- Opponent moves after: " << final_bestmove_.ToString(true);
-      for (const auto& line : GetVerboseStats(edge.node())) {
-        LOGFILE << line;
-      }
+      snapshot->opponent_stats = GetVerboseStats(edge.node());
+      snapshot->opponent_move = final_bestmove_;
     }
   }
 }
 
-PositionHistory Search::GetPositionHistoryAtNode(const Node* node) const {
-  PositionHistory history(played_history_);
-  std::vector<Move> rmoves;
-  for (const Node* n = node; n != root_node_; n = n->GetParent()) {
-    rmoves.push_back(n->GetOwnEdge()->GetMove());
-  }
-  for (auto it = rmoves.rbegin(); it != rmoves.rend(); it++) {
-    history.Append(*it);
-  }
-  return history;
-}
-
 void Search::MaybeTriggerStop(const IterationStats& stats,
                               StoppersHints* hints) {
   hints->Reset();
@@ -631,11 +856,23 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
   // If we are the first to see that stop is needed.
   if (stop_.load(std::memory_order_acquire) && ok_to_respond_bestmove_ &&
       !bestmove_is_sent_) {
-    SendUciInfo();
+    InfoSnapshot snapshot = SnapshotInfo();
     EnsureBestMoveKnown();
-    SendMovesStats();
-    BestMoveInfo info(final_bestmove_, final_pondermove_);
-    uci_responder_->OutputBestMove(&info);
+    SnapshotMovesStats(&snapshot);
+    const std::string minibatch_stats = GetMinibatchStats().ToString();
+    LOGFILE << "Minibatches: " << minibatch_stats;
+    if (params_.GetPhaseTimers()) {
+      snapshot.comments.push_back("Phase times: " +
+                                  GetPhaseTimes().ToString());
+      snapshot.comments.push_back("Minibatches: " + minibatch_stats);
+    }
+    if (params_.GetTreeStats()) {
+      for (auto& line : FormatTreeStats(GetTreeStats())) {
+        snapshot.comments.push_back(std::move(line));
+      }
+    }
+    snapshot.best_move.emplace(final_bestmove_, final_pondermove_);
+    QueueReport(std::move(snapshot));
     stopper_->OnSearchDone(stats);
     bestmove_is_sent_ = true;
     current_best_edge_ = EdgeAndNode();
@@ -666,6 +903,39 @@ std::pair<Move, Move> Search::GetBestMove() {
   return {final_bestmove_, final_pondermove_};
 }
 
+TreeStats Search::GetTreeStats() const REQUIRES(nodes_mutex_) {
+  TreeStats stats;
+  CollectTreeStats(root_node_, &stats);
+  if (const auto* cache = dynamic_cast<const CachingBackend*>(backend_)) {
+    const CachingBackend::CacheStats cache_stats = cache->GetCacheStats();
+    stats.nn_cache_entries = cache_stats.entries;
+    stats.nn_cache_capacity = cache_stats.capacity;
+  }
+  return stats;
+}
+
+SearchPhaseTimes Search::GetPhaseTimes() const {
+  SearchPhaseTimes times;
+  for (int i = 0; i < SearchPhaseTimes::kNumPhases; ++i) {
+    times.nanoseconds[i] =
+        phase_nanoseconds_[i].load(std::memory_order_relaxed);
+  }
+  times.iterations = phase_iterations_.load(std::memory_order_relaxed);
+  return times;
+}
+
+int64_t Search::GetTotalCollisions() const {
+  return total_collisions_.load(std::memory_order_relaxed);
+}
+
+MinibatchStats Search::GetMinibatchStats() const {
+  MinibatchStats stats;
+  for (int i = 0; i < MinibatchStats::kNumCounters; ++i) {
+    stats.counts[i] = minibatch_counters_[i].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
 std::int64_t Search::GetTotalPlayouts() const {
   SharedMutex::SharedLock lock(nodes_mutex_);
   return total_playouts_;
@@ -720,6 +990,78 @@ void Search::EnsureBestMoveKnown() REQUIRES(nodes_mutex_)
   }
 }
 
+namespace {
+// Returns whether the child @a is preferred to @b as the best move:
+// * Prefer shorter terminal wins / avoid shorter terminal losses.
+// * Largest number of playouts.
+// * If two nodes have equal number:
+//   * If that number is 0, the one with larger prior wins.
+//   * If that number is larger than 0, the one with larger eval wins.
+bool IsPreferredChild(const EdgeAndNode& a, const EdgeAndNode& b,
+                      float draw_score) {
+  // Lists edge types from less desirable to more desirable.
+  enum EdgeRank {
+    kTerminalLoss,
+    kTablebaseLoss,
+    kNonTerminal,  // Non terminal or terminal draw.
+    kTablebaseWin,
+    kTerminalWin,
+  };
+
+  auto GetEdgeRank = [](const EdgeAndNode& edge) {
+    // This default isn't used as wl only checked for case edge is
+    // terminal.
+    const auto wl = edge.GetWL(0.0f);
+    // Not safe to access IsTerminal if GetN is 0.
+    if (edge.GetN() == 0 || !edge.IsTerminal() || !wl) {
+      return kNonTerminal;
+    }
+    if (edge.IsTbTerminal()) {
+      return wl < 0.0 ? kTablebaseLoss : kTablebaseWin;
+    }
+    return wl < 0.0 ? kTerminalLoss : kTerminalWin;
+  };
+
+  // If moves have different outcomes, prefer better outcome.
+  const auto a_rank = GetEdgeRank(a);
+  const auto b_rank = GetEdgeRank(b);
+  if (a_rank != b_rank) return a_rank > b_rank;
+
+  // If both are terminal draws, try to make it shorter.
+  // Not safe to access IsTerminal if GetN is 0.
+  if (a_rank == kNonTerminal && a.GetN() != 0 && b.GetN() != 0 &&
+      a.IsTerminal() && b.IsTerminal()) {
+    if (a.IsTbTerminal() != b.IsTbTerminal()) {
+      // Prefer non-tablebase draws.
+      return a.IsTbTerminal() < b.IsTbTerminal();
+    }
+    // Prefer shorter draws.
+    return a.GetM(0.0f) < b.GetM(0.0f);
+  }
+
+  // Neither is terminal, use standard rule.
+  if (a_rank == kNonTerminal) {
+    // Prefer largest playouts then eval then prior.
+    if (a.GetN() != b.GetN()) return a.GetN() > b.GetN();
+    // Default doesn't matter here so long as they are the same as either
+    // both are N==0 (thus we're comparing equal defaults) or N!=0 and
+    // default isn't used.
+    if (a.GetQ(0.0f, draw_score) != b.GetQ(0.0f, draw_score)) {
+      return a.GetQ(0.0f, draw_score) > b.GetQ(0.0f, draw_score);
+    }
+    return a.GetP() > b.GetP();
+  }
+
+  // Both variants are winning, prefer shortest win.
+  if (a_rank > kNonTerminal) {
+    return a.GetM(0.0f) < b.GetM(0.0f);
+  }
+
+  // Both variants are losing, prefer longest losses.
+  return a.GetM(0.0f) > b.GetM(0.0f);
+}
+}  // namespace
+
 // Returns @count children with most visits.
 std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
                                                               int count,
@@ -729,12 +1071,7 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   if (parent->GetN() == 0) return {};
   const bool is_odd_depth = (depth % 2) == 1;
   const float draw_score = GetDrawScore(is_odd_depth);
-  // Best child is selected using the following criteria:
-  // * Prefer shorter terminal wins / avoid shorter terminal losses.
-  // * Largest number of playouts.
-  // * If two nodes have equal number:
-  //   * If that number is 0, the one with larger prior wins.
-  //   * If that number is larger than 0, the one with larger eval wins.
+  // See IsPreferredChild() for the order.
   std::vector<EdgeAndNode> edges;
   for (auto& edge : parent->Edges()) {
     if (parent == root_node_ && !root_move_filter_.empty() &&
@@ -750,68 +1087,7 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   std::partial_sort(
       edges.begin(), middle, edges.end(),
       [draw_score](const auto& a, const auto& b) {
-        // The function returns "true" when a is preferred to b.
-
-        // Lists edge types from less desirable to more desirable.
-        enum EdgeRank {
-          kTerminalLoss,
-          kTablebaseLoss,
-          kNonTerminal,  // Non terminal or terminal draw.
-          kTablebaseWin,
-          kTerminalWin,
-        };
-
-        auto GetEdgeRank = [](const EdgeAndNode& edge) {
-          // This default isn't used as wl only checked for case edge is
-          // terminal.
-          const auto wl = edge.GetWL(0.0f);
-          // Not safe to access IsTerminal if GetN is 0.
-          if (edge.GetN() == 0 || !edge.IsTerminal() || !wl) {
-            return kNonTerminal;
-          }
-          if (edge.IsTbTerminal()) {
-            return wl < 0.0 ? kTablebaseLoss : kTablebaseWin;
-          }
-          return wl < 0.0 ? kTerminalLoss : kTerminalWin;
-        };
-
-        // If moves have different outcomes, prefer better outcome.
-        const auto a_rank = GetEdgeRank(a);
-        const auto b_rank = GetEdgeRank(b);
-        if (a_rank != b_rank) return a_rank > b_rank;
-
-        // If both are terminal draws, try to make it shorter.
-        // Not safe to access IsTerminal if GetN is 0.
-        if (a_rank == kNonTerminal && a.GetN() != 0 && b.GetN() != 0 &&
-            a.IsTerminal() && b.IsTerminal()) {
-          if (a.IsTbTerminal() != b.IsTbTerminal()) {
-            // Prefer non-tablebase draws.
-            return a.IsTbTerminal() < b.IsTbTerminal();
-          }
-          // Prefer shorter draws.
-          return a.GetM(0.0f) < b.GetM(0.0f);
-        }
-
-        // Neither is terminal, use standard rule.
-        if (a_rank == kNonTerminal) {
-          // Prefer largest playouts then eval then prior.
-          if (a.GetN() != b.GetN()) return a.GetN() > b.GetN();
-          // Default doesn't matter here so long as they are the same as either
-          // both are N==0 (thus we're comparing equal defaults) or N!=0 and
-          // default isn't used.
-          if (a.GetQ(0.0f, draw_score) != b.GetQ(0.0f, draw_score)) {
-            return a.GetQ(0.0f, draw_score) > b.GetQ(0.0f, draw_score);
-          }
-          return a.GetP() > b.GetP();
-        }
-
-        // Both variants are winning, prefer shortest win.
-        if (a_rank > kNonTerminal) {
-          return a.GetM(0.0f) < b.GetM(0.0f);
-        }
-
-        // Both variants are losing, prefer longest losses.
-        return a.GetM(0.0f) > b.GetM(0.0f);
+        return IsPreferredChild(a, b, draw_score);
       });
 
   if (count < static_cast<int>(edges.size())) {
@@ -820,10 +1096,22 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   return edges;
 }
 
-// Returns a child with most visits.
+// Returns a child with most visits. Same as the first of
+// GetBestChildrenNoTemperature(), without collecting and sorting the edges, as
+// it's called for every node of the PVs.
 EdgeAndNode Search::GetBestChildNoTemperature(Node* parent, int depth) const {
-  auto res = GetBestChildrenNoTemperature(parent, 1, depth);
-  return res.empty() ? EdgeAndNode() : res.front();
+  if (parent->GetN() == 0) return {};
+  const float draw_score = GetDrawScore((depth % 2) == 1);
+  EdgeAndNode best;
+  for (auto& edge : parent->Edges()) {
+    if (parent == root_node_ && !root_move_filter_.empty() &&
+        std::find(root_move_filter_.begin(), root_move_filter_.end(),
+                  edge.GetMove()) == root_move_filter_.end()) {
+      continue;
+    }
+    if (!best || IsPreferredChild(edge, best, draw_score)) best = edge;
+  }
+  return best;
 }
 
 // Returns a child of a root chosen according to weighted-by-temperature visit
@@ -892,27 +1180,63 @@ EdgeAndNode Search::GetBestRootChildWithTemperature(float temperature) const {
 
 void Search::StartThreads(size_t how_many) {
   Mutex::Lock lock(threads_mutex_);
-  if (how_many == 0 && threads_.size() == 0) {
+  const bool first_start = threads_.empty() && !tasks_;
+  // With the shared threads, the watchdog and the first worker don't wait for
+  // the other searches (and all of the workers take turns in the deterministic
+  // search).
+  auto start_thread = [&](std::function<void()> fn, bool required)
+                          REQUIRES(threads_mutex_) {
+    if (!params_.GetSharedSearchThreads()) {
+      threads_.emplace_back(std::move(fn));
+      return;
+    }
+    if (!tasks_) {
+      tasks_ =
+          std::make_unique<SharedThreadPool::Group>(SharedThreadPool::Get());
+    }
+    tasks_->Submit(std::move(fn),
+                   required || params_.GetDeterministicSearch());
+  };
+  if (how_many == 0 && first_start) {
     how_many = backend_attributes_.suggested_num_search_threads +
                !backend_attributes_.runs_on_cpu;
   }
   thread_count_.store(how_many, std::memory_order_release);
+  if (params_.GetDeterministicSearch()) {
+    Mutex::Lock turn_lock(turn_mutex_);
+    turn_ = 0;
+    turn_left_.assign(how_many, false);
+  }
   // First thread is a watchdog thread.
-  if (threads_.size() == 0) {
-    threads_.emplace_back([this]() { WatchdogThread(); });
+  if (first_start) {
+    start_thread([this]() { WatchdogThread(); }, true);
+    {
+      Mutex::Lock reporter_lock(reporter_mutex_);
+      reporter_done_ = false;
+    }
+    reporter_thread_ = std::thread([this]() { ReporterThread(); });
   }
   // Start working threads.
   for (size_t i = 0; i < how_many; i++) {
-    threads_.emplace_back([this]() {
-      SearchWorker worker(this, params_);
-      worker.RunBlocking();
-    });
+    start_thread(
+        [this, i]() {
+          Tracer::SetThreadName("search worker " + std::to_string(i));
+          // Task workers are started by the worker, and inherit the binding.
+          if (params_.GetNumaBind()) Numa::BindThread(i);
+          SearchWorker worker(this, params_, i);
+          worker.RunBlocking();
+        },
+        first_start && i == 0);
   }
   LOGFILE << "Search started. "
           << std::chrono::duration_cast<std::chrono::milliseconds>(
                  std::chrono::steady_clock::now() - start_time_)
                  .count()
           << "ms already passed.";
+  const NodeGcStats gc_stats = GetNodeGcStats();
+  LOGFILE << "Node GC: " << gc_stats.pending_subtrees
+          << " subtrees pending, " << gc_stats.freed_nodes
+          << " nodes freed so far.";
 }
 
 void Search::RunBlocking(size_t threads) {
@@ -920,6 +1244,28 @@ void Search::RunBlocking(size_t threads) {
   Wait();
 }
 
+void Search::WaitForTurn(int id) {
+  Mutex::Lock lock(turn_mutex_);
+  turn_cv_.wait(lock.get_raw(),
+                [&]() REQUIRES(turn_mutex_) { return turn_ == id; });
+}
+
+void Search::EndTurn(int id, bool leave) {
+  {
+    Mutex::Lock lock(turn_mutex_);
+    if (leave) turn_left_[id] = true;
+    const int count = static_cast<int>(turn_left_.size());
+    for (int i = 1; i <= count; ++i) {
+      const int next = (id + i) % count;
+      if (!turn_left_[next]) {
+        turn_ = next;
+        break;
+      }
+    }
+  }
+  turn_cv_.notify_all();
+}
+
 bool Search::IsSearchActive() const {
   return !stop_.load(std::memory_order_acquire);
 }
@@ -1005,6 +1351,7 @@ void Search::WatchdogThread() {
     PopulateCommonIterationStats(&stats);
     MaybeTriggerStop(stats, &hints);
     MaybeOutputInfo();
+    MaybePruneTree();
 
     constexpr auto kMaxWaitTimeMs = 100;
     constexpr auto kMinWaitTimeMs = 1;
@@ -1030,6 +1377,84 @@ void Search::WatchdogThread() {
   LOGFILE << "End a watchdog thread.";
 }
 
+namespace {
+// Collects the largest subtrees with at most @threshold visits which can be
+// pruned, and sums up their visits. Never prunes the principal variation and
+// the root children, so that the best move and what's shown stay intact.
+void CollectPruneCandidates(Node* node, int depth, bool on_pv,
+                            uint32_t threshold, std::vector<Node*>* candidates,
+                            uint64_t* visits) {
+  Node* pv_child = nullptr;
+  if (on_pv) {
+    for (Node* child : node->VisitedNodes()) {
+      if (!pv_child || child->GetN() > pv_child->GetN()) pv_child = child;
+    }
+  }
+  for (Node* child : node->VisitedNodes()) {
+    if (child->IsTerminal()) continue;
+    const bool child_on_pv = child == pv_child;
+    // Bounds of the ancestors may depend on the proven ones.
+    const auto bounds = child->GetBounds();
+    if (!child_on_pv && depth >= 1 && child->GetN() <= threshold &&
+        child->GetNInFlight() == 0 &&
+        bounds == Node::Bounds{GameResult::BLACK_WON, GameResult::WHITE_WON}) {
+      candidates->push_back(child);
+      *visits += child->GetN();
+      continue;
+    }
+    CollectPruneCandidates(child, depth + 1, child_on_pv, threshold,
+                           candidates, visits);
+  }
+}
+}  // namespace
+
+void Search::MaybePruneTree() {
+  const int64_t limit_mb = params_.GetTreeMemoryLimitMb();
+  if (limit_mb == 0) return;
+  const size_t kAvgNodeSize =
+      sizeof(Node) + MemoryWatchingStopper::kAvgMovesPerPosition * sizeof(Edge);
+  const uint64_t max_nodes = limit_mb * 1000000 / kAvgNodeSize;
+  {
+    SharedMutex::SharedLock lock(nodes_mutex_);
+    if (root_node_->GetN() <= max_nodes + pruned_visits_) return;
+  }
+  SharedMutex::Lock lock(nodes_mutex_);
+  const uint64_t root_visits = root_node_->GetN();
+  if (root_visits <= max_nodes + pruned_visits_) return;
+  // Prune a bit more than necessary, so that it's not done after every batch.
+  const uint64_t to_free = root_visits - pruned_visits_ - max_nodes * 9 / 10;
+  std::vector<Node*> candidates;
+  uint64_t visits = 0;
+  // Prefer the small subtrees, and look at the larger ones only when there are
+  // not enough of them.
+  for (uint64_t threshold = std::max<uint64_t>(1, to_free / 1024);;
+       threshold *= 4) {
+    candidates.clear();
+    visits = 0;
+    CollectPruneCandidates(root_node_, 0, true,
+                           std::min<uint64_t>(threshold, root_visits),
+                           &candidates, &visits);
+    if (visits >= to_free || threshold >= root_visits) break;
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Node* a, const Node* b) { return a->GetN() < b->GetN(); });
+  uint64_t freed = 0;
+  size_t pruned = 0;
+  for (; pruned < candidates.size() && freed < to_free; ++pruned) {
+    // The visits stay counted in the ancestors, so that the search keeps what
+    // it learned from them and the best move doesn't change.
+    freed += candidates[pruned]->GetN();
+    candidates[pruned]->ResetToUnexpanded();
+  }
+  pruned_visits_ += freed;
+  LOGFILE << "Tree memory limit reached, pruned " << pruned
+          << " subtrees with " << freed << " visits.";
+  if (freed < to_free) {
+    LOGFILE << "Nothing more to prune, stopping search.";
+    FireStopInternal();
+  }
+}
+
 void Search::FireStopInternal() {
   stop_.store(true, std::memory_order_release);
   watchdog_cv_.notify_all();
@@ -1058,6 +1483,19 @@ void Search::Wait() {
     threads_.back().join();
     threads_.pop_back();
   }
+  if (tasks_) {
+    tasks_->Wait();
+    tasks_.reset();
+  }
+  // The reporter outputs what is queued, including the bestmove, and exits.
+  if (reporter_thread_.joinable()) {
+    {
+      Mutex::Lock reporter_lock(reporter_mutex_);
+      reporter_done_ = true;
+    }
+    reporter_cv_.notify_all();
+    reporter_thread_.join();
+  }
 }
 
 void Search::CancelSharedCollisions() REQUIRES(nodes_mutex_) {
@@ -1085,80 +1523,107 @@ Search::~Search() {
 // SearchWorker
 //////////////////////////////////////////////////////////////////////////////
 
+int SearchWorker::TryTakeTask() {
+  int nta = tasks_taken_.load(std::memory_order_acquire);
+  int tc = task_count_.load(std::memory_order_acquire);
+  if (nta >= tc) return -1;
+  int val = 0;
+  if (!task_taking_started_.compare_exchange_weak(
+          val, 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+    return -1;
+  }
+  int id = -1;
+  nta = tasks_taken_.load(std::memory_order_acquire);
+  tc = task_count_.load(std::memory_order_acquire);
+  // We got the spin lock, double check we're still in the clear.
+  if (nta < tc) id = tasks_taken_.fetch_add(1, std::memory_order_acq_rel);
+  task_taking_started_.store(0, std::memory_order_release);
+  return id;
+}
+
+void SearchWorker::RunTask(int id, TaskWorkspace* workspace) {
+  PickTask* task = &picking_tasks_[id];
+  switch (task->task_type) {
+    case PickTask::kGathering: {
+      PickNodesToExtendTask(task->start, task->base_depth,
+                            task->collision_limit, task->moves_to_base,
+                            &(task->results), workspace);
+      break;
+    }
+    case PickTask::kProcessing: {
+      ProcessPickedTask(task->start_idx, task->end_idx, workspace);
+      break;
+    }
+  }
+  task->complete = true;
+  completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
+  completed_tasks_.notify_one();
+}
+
+void SearchWorker::NotifyTaskAdded() {
+  // Pairs with the increment in RunTasks(), that thread either sees the new
+  // task when it rechecks under the lock or is already waiting.
+  if (parked_task_threads_.load() == 0) return;
+  Mutex::Lock lock(picking_tasks_mutex_);
+  task_added_.notify_all();
+}
+
 void SearchWorker::RunTasks(int tid) {
+  // How long to wait for the next task of the current round before parking.
+  constexpr int kSpinsBeforeYield = 512;
+  constexpr int kYieldsBeforePark = 16;
   while (true) {
-    PickTask* task = nullptr;
-    int id = 0;
+    int id = -1;
     {
       int spins = 0;
+      int yields = 0;
       while (true) {
         int nta = tasks_taken_.load(std::memory_order_acquire);
         int tc = task_count_.load(std::memory_order_acquire);
         if (nta < tc) {
-          int val = 0;
-          if (task_taking_started_.compare_exchange_weak(
-                  val, 1, std::memory_order_acq_rel,
-                  std::memory_order_relaxed)) {
-            nta = tasks_taken_.load(std::memory_order_acquire);
-            tc = task_count_.load(std::memory_order_acquire);
-            // We got the spin lock, double check we're still in the clear.
-            if (nta < tc) {
-              id = tasks_taken_.fetch_add(1, std::memory_order_acq_rel);
-              task = &picking_tasks_[id];
-              task_taking_started_.store(0, std::memory_order_release);
-              break;
-            }
-            task_taking_started_.store(0, std::memory_order_release);
-          }
+          id = TryTakeTask();
+          if (id >= 0) break;
           SpinloopPause();
           spins = 0;
+          yields = 0;
           continue;
-        } else if (tc != -1) {
+        } else if (tc != -1 && yields < kYieldsBeforePark) {
           spins++;
-          if (spins >= 512) {
+          if (spins >= kSpinsBeforeYield) {
             std::this_thread::yield();
             spins = 0;
+            yields++;
           } else {
             SpinloopPause();
           }
           continue;
         }
         spins = 0;
+        yields = 0;
         // Looks like sleep time.
         Mutex::Lock lock(picking_tasks_mutex_);
+        parked_task_threads_.fetch_add(1);
         // Refresh them now we have the lock.
-        nta = tasks_taken_.load(std::memory_order_acquire);
-        tc = task_count_.load(std::memory_order_acquire);
-        if (tc != -1) continue;
-        if (nta >= tc && exiting_) return;
-        task_added_.wait(lock.get_raw());
-        // And refresh again now we're awake.
-        nta = tasks_taken_.load(std::memory_order_acquire);
-        tc = task_count_.load(std::memory_order_acquire);
-        if (nta >= tc && exiting_) return;
-      }
-    }
-    if (task != nullptr) {
-      switch (task->task_type) {
-        case PickTask::kGathering: {
-          PickNodesToExtendTask(task->start, task->base_depth,
-                                task->collision_limit, task->moves_to_base,
-                                &(task->results), &(task_workspaces_[tid]));
-          break;
-        }
-        case PickTask::kProcessing: {
-          ProcessPickedTask(task->start_idx, task->end_idx,
-                            &(task_workspaces_[tid]));
-          break;
+        nta = tasks_taken_.load();
+        tc = task_count_.load();
+        if (nta < tc) {
+          parked_task_threads_.fetch_sub(1);
+          continue;
         }
+        if (exiting_) return;
+        task_added_.wait(lock.get_raw());
+        parked_task_threads_.fetch_sub(1);
+        if (exiting_) return;
       }
-      picking_tasks_[id].complete = true;
-      completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
     }
+    RunTask(id, &(task_workspaces_[tid]));
   }
 }
 
 void SearchWorker::ExecuteOneIteration() {
+  if (phase_timers_ || Tracer::IsEnabled()) {
+    phase_start_ = std::chrono::steady_clock::now();
+  }
   // 1. Initialize internal structures.
   InitializeIteration(search_->backend_->CreateComputation());
 
@@ -1185,7 +1650,7 @@ void SearchWorker::ExecuteOneIteration() {
       int available =
           search_->pending_searchers_.load(std::memory_order_acquire);
       if (available == 0) {
-        spin_helper->Wait();
+        spin_helper->WaitWhileEqual(search_->pending_searchers_, 0);
         continue;
       }
 
@@ -1198,33 +1663,66 @@ void SearchWorker::ExecuteOneIteration() {
     }
   }
 
+  EndPhase(SearchPhaseTimes::kInitialize);
+
   // 2. Gather minibatch.
+  UpdateMinibatchTarget();
   GatherMinibatch();
   task_count_.store(-1, std::memory_order_release);
   search_->backend_waiting_counter_.fetch_add(1, std::memory_order_relaxed);
+  EndPhase(SearchPhaseTimes::kGather);
 
   // 2b. Collect collisions.
   CollectCollisions();
+  EndPhase(SearchPhaseTimes::kCollisions);
 
   // 3. Prefetch into cache.
   MaybePrefetchIntoCache();
 
   if (params_.GetMaxConcurrentSearchers() != 0) {
     search_->pending_searchers_.fetch_add(1, std::memory_order_acq_rel);
+    // All, as a woken thread that sees the search stopped leaves the slot.
+    search_->pending_searchers_.notify_all();
   }
+  EndPhase(SearchPhaseTimes::kPrefetch);
 
   // 4. Run NN computation.
-  RunNNComputation();
-  search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+  bool has_results = true;
+  if (!MaybeAbandonMinibatch()) {
+    if (params_.GetPipelinedMinibatches()) {
+      // Send the minibatch to the backend, and while it's being computed,
+      // finish the minibatch sent on the previous iteration (if there is one).
+      StartNNComputation();
+      SwapPendingMinibatch();
+      has_results = computation_ != nullptr;
+      if (has_results) WaitForNNComputation();
+    } else {
+      RunNNComputation();
+    }
+    if (has_results) RecordMinibatchLatency();
+  }
+  EndPhase(SearchPhaseTimes::kCompute);
 
-  // 5. Retrieve NN computations (and terminal values) into nodes.
-  FetchMinibatchResults();
+  if (has_results) {
+    search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
 
-  // 6. Propagate the new nodes' information to all their parents in the tree.
-  DoBackupUpdate();
+    // 5. Retrieve NN computations (and terminal values) into nodes.
+    FetchMinibatchResults();
+    EndPhase(SearchPhaseTimes::kFetch);
 
-  // 7. Update the Search's status and progress information.
-  UpdateCounters();
+    // 6. Propagate the new nodes' information to all their parents in the
+    // tree.
+    DoBackupUpdate();
+    EndPhase(SearchPhaseTimes::kBackup);
+
+    // 7. Update the Search's status and progress information.
+    UpdateCounters();
+    EndPhase(SearchPhaseTimes::kUpdateCounters);
+  }
+  if (phase_timers_) {
+    ++phase_times_.iterations;
+    search_->phase_iterations_.fetch_add(1, std::memory_order_relaxed);
+  }
 
   // If required, waste time to limit nps.
   if (params_.GetNpsLimit() > 0) {
@@ -1247,6 +1745,53 @@ void SearchWorker::ExecuteOneIteration() {
   }
 }
 
+bool SearchWorker::ExecuteDeterministicIteration() {
+  if (phase_timers_ || Tracer::IsEnabled()) {
+    phase_start_ = std::chrono::steady_clock::now();
+  }
+  search_->WaitForTurn(id_);
+  EndPhase(SearchPhaseTimes::kInitialize);
+
+  // Results of the minibatch gathered in the previous turn. The NN cache is
+  // only filled here, so all workers gather from the same cache contents.
+  const bool has_results = computation_ != nullptr;
+  if (has_results) {
+    WaitForNNComputation();
+    search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+    EndPhase(SearchPhaseTimes::kCompute);
+    FetchMinibatchResults();
+    EndPhase(SearchPhaseTimes::kFetch);
+    DoBackupUpdate();
+    EndPhase(SearchPhaseTimes::kBackup);
+    UpdateCounters();
+    EndPhase(SearchPhaseTimes::kUpdateCounters);
+    if (phase_timers_) {
+      ++phase_times_.iterations;
+      search_->phase_iterations_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  // Like in RunBlocking(), at least one iteration runs before exiting.
+  if (has_results && !search_->IsSearchActive()) {
+    search_->EndTurn(id_, true);
+    return false;
+  }
+
+  InitializeIteration(search_->backend_->CreateComputation());
+  UpdateMinibatchTarget();
+  GatherMinibatch();
+  task_count_.store(-1, std::memory_order_release);
+  search_->backend_waiting_counter_.fetch_add(1, std::memory_order_relaxed);
+  EndPhase(SearchPhaseTimes::kGather);
+  CollectCollisions();
+  EndPhase(SearchPhaseTimes::kCollisions);
+  MaybePrefetchIntoCache();
+  EndPhase(SearchPhaseTimes::kPrefetch);
+  search_->EndTurn(id_, false);
+
+  StartNNComputation();
+  return true;
+}
+
 // 1. Initialize internal structures.
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::InitializeIteration(
@@ -1289,6 +1834,9 @@ void SearchWorker::GatherMinibatch() {
     SharedMutex::Lock lock(search_->nodes_mutex_);
     cur_n = search_->root_node_->GetN();
   }
+  // Nothing can be reported before the root is evaluated.
+  computation_->SetPriority(cur_n == 0 ? ComputationPriority::kHigh
+                                       : params_.GetNNPriority());
   // TODO: GetEstimatedRemainingPlayouts has already had smart pruning factor
   // applied, which doesn't clearly make sense to include here...
   int64_t remaining_n =
@@ -1315,7 +1863,9 @@ void SearchWorker::GatherMinibatch() {
     // early exit from every batch since there is never another search thread to
     // be keeping the backend busy. Which would mean that threads=1 has a
     // massive nps drop.
-    if (thread_count > 1 && minibatch_size > 0 &&
+    // Deterministic search can't depend on the timing of the other threads.
+    if (thread_count > 1 && !params_.GetDeterministicSearch() &&
+        minibatch_size > 0 &&
         static_cast<int>(computation_->UsedBatchSize()) >
             params_.GetIdlingMinimumWork() &&
         thread_count - search_->backend_waiting_counter_.load(
@@ -1369,6 +1919,7 @@ void SearchWorker::GatherMinibatch() {
           }
         }
       }
+      NotifyTaskAdded();
     }
     ProcessPickedTask(ppt_start, static_cast<int>(minibatch_.size()),
                       &main_workspace_);
@@ -1383,28 +1934,9 @@ void SearchWorker::GatherMinibatch() {
       }
     }
     if (some_ooo) {
-      SharedMutex::Lock lock(search_->nodes_mutex_);
-      for (int i = static_cast<int>(minibatch_.size()) - 1; i >= new_start;
-           i--) {
-        // If there was any OOO, revert 'all' new collisions - it isn't possible
-        // to identify exactly which ones are afterwards and only prune those.
-        // This may remove too many items, but hopefully most of the time they
-        // will just be added back in the same in the next gather.
-        if (minibatch_[i].IsCollision()) {
-          Node* node = minibatch_[i].node;
-          for (node = node->GetParent();
-               node != search_->root_node_->GetParent();
-               node = node->GetParent()) {
-            node->CancelScoreUpdate(minibatch_[i].multivisit);
-          }
-          minibatch_.erase(minibatch_.begin() + i);
-        } else if (minibatch_[i].ooo_completed) {
-          DoBackupUpdateSingleNode(minibatch_[i]);
-          minibatch_.erase(minibatch_.begin() + i);
-          --minibatch_size;
-          ++number_out_of_order_;
-        }
-      }
+      const int backed_up = BackupOutOfOrderEvals(new_start);
+      minibatch_size -= backed_up;
+      number_out_of_order_ += backed_up;
     }
 
     // Check for stop at the end so we have at least one node.
@@ -1485,12 +2017,22 @@ void SearchWorker::ResetTasks() {
 }
 
 int SearchWorker::WaitForTasks() {
-  // Spin lock, other tasks should be done soon.
+  // How long to wait for the running tasks before parking.
+  constexpr int kSpinsBeforePark = 512;
+  // Rather than idle, help with the tasks nobody has taken yet. The calling
+  // thread is done with its own work by now, so its workspace is free.
   while (true) {
     int completed = completed_tasks_.load(std::memory_order_acquire);
     int todo = task_count_.load(std::memory_order_acquire);
     if (todo == completed) return completed;
-    SpinloopPause();
+    const int id = TryTakeTask();
+    if (id >= 0) {
+      RunTask(id, &main_workspace_);
+    } else {
+      // Every task in flight ends with a notification, including the ones
+      // added while parked.
+      SpinThenWait(completed_tasks_, completed, kSpinsBeforePark);
+    }
   }
 }
 
@@ -1560,7 +2102,28 @@ void SearchWorker::EnsureNodeTwoFoldCorrectForDepth(Node* child_node,
   }
 }
 
-void SearchWorker::PickNodesToExtendTask(
+SearchWorker::PickNodesToExtendTaskFn SearchWorker::GetPickNodesToExtendTask(
+    const SearchParams& params, bool moves_left_support) {
+  const bool draw_score = params.GetDrawScore() != 0.0f;
+  if (moves_left_support) {
+    return draw_score ? &SearchWorker::PickNodesToExtendTaskImpl<true, true>
+                      : &SearchWorker::PickNodesToExtendTaskImpl<true, false>;
+  }
+  return draw_score ? &SearchWorker::PickNodesToExtendTaskImpl<false, true>
+                    : &SearchWorker::PickNodesToExtendTaskImpl<false, false>;
+}
+
+void SearchWorker::PickNodesToExtendTask(Node* node, int base_depth,
+                                         int collision_limit,
+                                         const std::vector<Move>& moves_to_base,
+                                         std::vector<NodeToProcess>* receiver,
+                                         TaskWorkspace* workspace) {
+  (this->*pick_nodes_to_extend_task_)(node, base_depth, collision_limit,
+                                      moves_to_base, receiver, workspace);
+}
+
+template <bool kMovesLeft, bool kDrawScore>
+void SearchWorker::PickNodesToExtendTaskImpl(
     Node* node, int base_depth, int collision_limit,
     const std::vector<Move>& moves_to_base,
     std::vector<NodeToProcess>* receiver,
@@ -1604,7 +2167,7 @@ void SearchWorker::PickNodesToExtendTask(
   const float even_draw_score = search_->GetDrawScore(false);
   const float odd_draw_score = search_->GetDrawScore(true);
   const auto& root_move_filter = search_->root_move_filter_;
-  auto m_evaluator = moves_left_support_ ? MEvaluator(params_) : MEvaluator();
+  auto m_evaluator = kMovesLeft ? MEvaluator(params_) : MEvaluator();
 
   int max_limit = std::numeric_limits<int>::max();
 
@@ -1688,19 +2251,21 @@ void SearchWorker::PickNodesToExtendTask(
       const float draw_score = ((current_path.size() + base_depth) % 2 == 0)
                                    ? odd_draw_score
                                    : even_draw_score;
-      m_evaluator.SetParent(node);
+      if constexpr (kMovesLeft) m_evaluator.SetParent(node);
       float visited_pol = 0.0f;
       for (Node* child : node->VisitedNodes()) {
         int index = child->Index();
         visited_pol += current_pol[index];
-        float q = child->GetQ(draw_score);
-        current_util[index] = q + m_evaluator.GetMUtility(child, q);
+        const float q = kDrawScore ? child->GetQ(draw_score) : child->GetWL();
+        current_util[index] =
+            kMovesLeft ? q + m_evaluator.GetMUtility(child, q) : q;
       }
       const float fpu =
-          GetFpu(params_, node, is_root_node, draw_score, visited_pol);
+          GetFpu(params_, node, is_root_node, draw_score, visited_pol) +
+          (kMovesLeft ? m_evaluator.GetDefaultMUtility() : 0.0f);
       for (int i = 0; i < max_needed; i++) {
         if (current_util[i] == std::numeric_limits<float>::lowest()) {
-          current_util[i] = fpu + m_evaluator.GetDefaultMUtility();
+          current_util[i] = fpu;
         }
       }
 
@@ -1708,6 +2273,29 @@ void SearchWorker::PickNodesToExtendTask(
       const float puct_mult =
           cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
       int cache_filled_idx = -1;
+      // Edges are iterated and their scores computed lazily, in order.
+      auto fill_cache = [&](int idx) {
+        if (idx <= cache_filled_idx) return;
+        if (idx == 0) {
+          cur_iters[idx] = node->Edges();
+        } else {
+          cur_iters[idx] = cur_iters[idx - 1];
+          ++cur_iters[idx];
+        }
+        current_nstarted[idx] = cur_iters[idx].GetNStarted();
+        current_score[idx] = current_pol[idx] * puct_mult /
+                                 (1 + current_nstarted[idx]) +
+                             current_util[idx];
+        cache_filled_idx++;
+      };
+      // Outside of the root, the edges before first_unvisited all have visits
+      // started, and the top two of them are kept between the picks. Only the
+      // picked edge changes its score, so the prefix is rescanned only when
+      // that edge was one of its top two.
+      int first_unvisited = 0;
+      int prefix_best = -1;
+      int prefix_second = -1;
+      bool prefix_stale = false;
       while (cur_limit > 0) {
         // Perform UCT for current node.
         float best = std::numeric_limits<float>::lowest();
@@ -1716,24 +2304,58 @@ void SearchWorker::PickNodesToExtendTask(
         float second_best = std::numeric_limits<float>::lowest();
         bool can_exit = false;
         best_edge.Reset();
-        for (int idx = 0; idx < max_needed; ++idx) {
-          if (idx > cache_filled_idx) {
-            if (idx == 0) {
-              cur_iters[idx] = node->Edges();
-            } else {
-              cur_iters[idx] = cur_iters[idx - 1];
-              ++cur_iters[idx];
+        if (!is_root_node) {
+          // Index order of the scores compared with strict comparisons, so
+          // that ties go to the first edge, like in a single scan.
+          auto consider = [&](int idx, int* first, int* second) {
+            if (*first < 0 || current_score[idx] > current_score[*first]) {
+              *second = *first;
+              *first = idx;
+            } else if (*second < 0 ||
+                       current_score[idx] > current_score[*second]) {
+              *second = idx;
+            }
+          };
+          // Edges which got their first visit join the prefix.
+          while (first_unvisited < max_needed) {
+            fill_cache(first_unvisited);
+            if (current_nstarted[first_unvisited] == 0) break;
+            if (!prefix_stale) {
+              consider(first_unvisited, &prefix_best, &prefix_second);
             }
-            current_nstarted[idx] = cur_iters[idx].GetNStarted();
+            ++first_unvisited;
+          }
+          if (prefix_stale) {
+            FindTopTwo(current_score.data(), first_unvisited, &prefix_best,
+                       &prefix_second);
+            prefix_stale = false;
           }
-          int nstarted = current_nstarted[idx];
-          const float util = current_util[idx];
-          if (idx > cache_filled_idx) {
-            current_score[idx] =
-                current_pol[idx] * puct_mult / (1 + nstarted) + util;
-            cache_filled_idx++;
+          int second_idx = prefix_second;
+          best_idx = prefix_best;
+          // The unvisited edges share the FPU, so with edges sorted in policy
+          // decreasing order, the one after the first unvisited one is enough
+          // to get the second best right.
+          for (int idx = first_unvisited;
+               idx < std::min(max_needed, first_unvisited + 2); ++idx) {
+            fill_cache(idx);
+            consider(idx, &best_idx, &second_idx);
           }
-          if (is_root_node) {
+          best = current_score[best_idx];
+          best_without_u = current_util[best_idx];
+          best_edge = cur_iters[best_idx];
+          if (second_idx >= 0) {
+            second_best = current_score[second_idx];
+            second_best_edge = cur_iters[second_idx];
+          }
+          if (best_idx == prefix_best || best_idx == prefix_second) {
+            prefix_stale = true;
+          }
+        } else {
+          // Some root edges may be excluded, so compare them one by one.
+          for (int idx = 0; idx < max_needed; ++idx) {
+            fill_cache(idx);
+            int nstarted = current_nstarted[idx];
+            const float util = current_util[idx];
             // If there's no chance to catch up to the current best node with
             // remaining playouts, don't consider it.
             // best_move_node_ could have changed since best_node_n was
@@ -1750,26 +2372,26 @@ void SearchWorker::PickNodesToExtendTask(
                           cur_iters[idx].GetMove()) == root_move_filter.end()) {
               continue;
             }
-          }
 
-          float score = current_score[idx];
-          if (score > best) {
-            second_best = best;
-            second_best_edge = best_edge;
-            best = score;
-            best_idx = idx;
-            best_without_u = util;
-            best_edge = cur_iters[idx];
-          } else if (score > second_best) {
-            second_best = score;
-            second_best_edge = cur_iters[idx];
-          }
-          if (can_exit) break;
-          if (nstarted == 0) {
-            // One more loop will get 2 unvisited nodes, which is sufficient to
-            // ensure second best is correct. This relies upon the fact that
-            // edges are sorted in policy decreasing order.
-            can_exit = true;
+            float score = current_score[idx];
+            if (score > best) {
+              second_best = best;
+              second_best_edge = best_edge;
+              best = score;
+              best_idx = idx;
+              best_without_u = util;
+              best_edge = cur_iters[idx];
+            } else if (score > second_best) {
+              second_best = score;
+              second_best_edge = cur_iters[idx];
+            }
+            if (can_exit) break;
+            if (nstarted == 0) {
+              // One more loop will get 2 unvisited nodes, which is sufficient
+              // to ensure second best is correct. This relies upon the fact
+              // that edges are sorted in policy decreasing order.
+              can_exit = true;
+            }
           }
         }
         int new_visits = 0;
@@ -1974,16 +2596,7 @@ void SearchWorker::ExtendNode(Node* node, int depth,
       // Only fail state means the WDL is wrong, probe_wdl may produce correct
       // result with a stat other than OK.
       if (state != FAIL) {
-        // TB nodes don't have NN evaluation, assign M from parent node.
-        float m = 0.0f;
-        // Need a lock to access parent, in case MakeSolid is in progress.
-        {
-          SharedMutex::SharedLock lock(search_->nodes_mutex_);
-          auto parent = node->GetParent();
-          if (parent) {
-            m = std::max(0.0f, parent->GetM() - 1.0f);
-          }
-        }
+        const float m = GetTerminalM(node);
         // If the colors seem backwards, check the checkmate check above.
         if (wdl == WDL_WIN) {
           node->MakeTerminal(GameResult::BLACK_WON, m,
@@ -1998,15 +2611,79 @@ void SearchWorker::ExtendNode(Node* node, int depth,
         return;
       }
     }
+
+    // A capture may bring the position into the tablebases.
+    if (params_.GetSyzygyProbeChildren() && search_->syzygy_tb_ &&
+        !search_->root_is_in_dtz_ &&
+        (board.ours() | board.theirs()).count() <=
+            search_->syzygy_tb_->max_cardinality() + 1 &&
+        ProbeTablebaseChildren(node, legal_moves, history)) {
+      return;
+    }
   }
 
   // Add legal moves as edges of this node.
   node->CreateEdges(legal_moves);
 }
 
+float SearchWorker::GetTerminalM(const Node* node) const {
+  // Terminal nodes don't have NN evaluation, assign M from parent node. Need a
+  // lock to access parent, in case MakeSolid is in progress.
+  SharedMutex::SharedLock lock(search_->nodes_mutex_);
+  const Node* parent = node->GetParent();
+  return parent ? std::max(0.0f, parent->GetM() - 1.0f) : 0.0f;
+}
+
+bool SearchWorker::ProbeTablebaseChildren(Node* node,
+                                          const MoveList& legal_moves,
+                                          PositionHistory* history) {
+  // Bounds of the children as in MaybeSetBounds(), the positions which are not
+  // in the tablebases count as regular children.
+  auto lower = GameResult::BLACK_WON;
+  auto upper = GameResult::BLACK_WON;
+  int probes = 0;
+  for (Move move : legal_moves) {
+    history->Append(move);
+    const Position& pos = history->Last();
+    const ChessBoard& board = pos.GetBoard();
+    ProbeState state = FAIL;
+    WDLScore wdl = WDL_DRAW;
+    if (pos.GetRule50Ply() == 0 && board.castlings().no_legal_castle() &&
+        (board.ours() | board.theirs()).count() <=
+            search_->syzygy_tb_->max_cardinality()) {
+      wdl = search_->syzygy_tb_->probe_wdl(pos, &state);
+    }
+    history->Pop();
+    if (state == FAIL) {
+      upper = GameResult::WHITE_WON;
+      continue;
+    }
+    ++probes;
+    // Same colors and cursed results as for the probes in ExtendNode().
+    const auto result = wdl == WDL_WIN    ? GameResult::BLACK_WON
+                        : wdl == WDL_LOSS ? GameResult::WHITE_WON
+                                          : GameResult::DRAW;
+    lower = std::max(lower, result);
+    upper = std::max(upper, result);
+    // A winning move decides the node.
+    if (lower == GameResult::WHITE_WON) break;
+  }
+  if (probes == 0) return false;
+  search_->tb_hits_.fetch_add(probes, std::memory_order_acq_rel);
+
+  if (lower == upper) {
+    node->MakeTerminal(-upper, GetTerminalM(node), Node::Terminal::Tablebase);
+    return true;
+  }
+  if (lower != GameResult::BLACK_WON || upper != GameResult::WHITE_WON) {
+    node->SetBounds(-upper, -lower);
+  }
+  return false;
+}
+
 // Returns whether node was already in cache.
 bool SearchWorker::AddNodeToComputation(Node* node) {
-  std::vector<Move> moves;
+  MoveList moves;
   if (node && node->HasChildren()) {
     moves.reserve(node->GetNumEdges());
     for (const auto& edge : node->Edges()) moves.emplace_back(edge.GetMove());
@@ -2022,11 +2699,29 @@ bool SearchWorker::AddNodeToComputation(Node* node) {
 void SearchWorker::CollectCollisions() {
   SharedMutex::Lock lock(search_->nodes_mutex_);
 
+  MinibatchStats stats;
+  auto& counts = stats.counts;
   for (const NodeToProcess& node_to_process : minibatch_) {
     if (node_to_process.IsCollision()) {
       search_->shared_collisions_.emplace_back(node_to_process.node,
                                                node_to_process.multivisit);
-    }
+      ++counts[MinibatchStats::kCollisionEvents];
+      counts[MinibatchStats::kCollisionVisits] += node_to_process.multivisit;
+    } else if (node_to_process.is_cache_hit) {
+      ++counts[MinibatchStats::kCacheHits];
+    }
+  }
+  const int64_t collisions = counts[MinibatchStats::kCollisionVisits];
+  search_->total_collisions_.fetch_add(collisions, std::memory_order_relaxed);
+  kCollisionsMetric->Add(collisions);
+  counts[MinibatchStats::kMinibatches] = 1;
+  counts[MinibatchStats::kOutOfOrderEvals] = number_out_of_order_;
+  counts[MinibatchStats::kNNEvals] = computation_->UsedBatchSize();
+  counts[MinibatchStats::kWastedSlots] = std::max<int64_t>(
+      0, target_minibatch_size_ - counts[MinibatchStats::kNNEvals]);
+  for (int i = 0; i < MinibatchStats::kNumCounters; ++i) {
+    search_->minibatch_counters_[i].fetch_add(counts[i],
+                                              std::memory_order_relaxed);
   }
 }
 
@@ -2140,9 +2835,123 @@ int SearchWorker::PrefetchIntoCache(Node* node, int budget, bool is_odd_depth) {
 // 4. Run NN computation.
 // ~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::RunNNComputation() {
+  computation_start_ = std::chrono::steady_clock::now();
   if (computation_->UsedBatchSize() > 0) computation_->ComputeBlocking();
 }
 
+void SearchWorker::StartNNComputation() {
+  computation_start_ = std::chrono::steady_clock::now();
+  if (computation_->UsedBatchSize() > 0) computation_->ComputeAsync();
+}
+
+void SearchWorker::WaitForNNComputation() {
+  if (computation_->UsedBatchSize() > 0) computation_->Wait();
+}
+
+void SearchWorker::SwapPendingMinibatch() {
+  std::swap(minibatch_, pending_minibatch_.minibatch);
+  std::swap(computation_, pending_minibatch_.computation);
+  std::swap(number_out_of_order_, pending_minibatch_.number_out_of_order);
+  std::swap(computation_start_, pending_minibatch_.computation_start);
+}
+
+void SearchWorker::EndPhase(SearchPhaseTimes::Phase phase) {
+  const bool tracing = Tracer::IsEnabled();
+  if (!phase_timers_ && !tracing) return;
+  const auto now = std::chrono::steady_clock::now();
+  if (tracing) {
+    Tracer::RecordSpan(SearchPhaseTimes::GetName(phase), "search",
+                       phase_start_, now);
+  }
+  if (phase_timers_) {
+    const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           now - phase_start_)
+                           .count();
+    phase_times_.nanoseconds[phase] += ns;
+    search_->phase_nanoseconds_[phase].fetch_add(ns,
+                                                 std::memory_order_relaxed);
+  }
+  phase_start_ = now;
+}
+
+void SearchWorker::UpdateMinibatchTarget() {
+  if (!minibatch_controller_) return;
+  const int64_t remaining_time_ms =
+      latest_time_manager_hints_.GetEstimatedRemainingTimeMs();
+  target_minibatch_size_ =
+      params_.GetAdaptiveMinibatch()
+          ? minibatch_controller_->GetTargetSize(remaining_time_ms)
+          : minibatch_controller_->GetDeadlineSize(remaining_time_ms);
+  max_out_of_order_ =
+      std::max(1, static_cast<int>(params_.GetMaxOutOfOrderEvalsFactor() *
+                                   target_minibatch_size_));
+}
+
+bool SearchWorker::MaybeAbandonMinibatch() {
+  // The bestmove is already being sent, the results would only go to the tree
+  // reused by the next search. At least one iteration has to complete.
+  if (!params_.GetDeadlineMinibatch() ||
+      !search_->stop_.load(std::memory_order_acquire) ||
+      search_->GetTotalPlayouts() + search_->initial_visits_ == 0) {
+    return false;
+  }
+  auto needs_eval = [](const NodeToProcess& node_to_process) {
+    return !node_to_process.IsCollision() && node_to_process.nn_queried &&
+           !node_to_process.is_cache_hit;
+  };
+  SharedMutex::Lock lock(search_->nodes_mutex_);
+  // The nodes can only be reset to unexpanded when no other worker has visits
+  // in flight to them, otherwise the minibatch is evaluated as usual.
+  for (const NodeToProcess& node_to_process : minibatch_) {
+    if (needs_eval(node_to_process) &&
+        node_to_process.node->GetNInFlight() !=
+            static_cast<uint32_t>(node_to_process.multivisit)) {
+      return false;
+    }
+  }
+  auto kept = minibatch_.begin();
+  for (auto it = minibatch_.begin(); it != minibatch_.end(); ++it) {
+    if (!needs_eval(*it)) {
+      if (kept != it) *kept = std::move(*it);
+      ++kept;
+      continue;
+    }
+    for (Node* node = it->node; node != search_->root_node_->GetParent();
+         node = node->GetParent()) {
+      node->CancelScoreUpdate(it->multivisit);
+    }
+    // The edges were created when the node was extended.
+    it->node->ResetToUnexpanded();
+  }
+  minibatch_.erase(kept, minibatch_.end());
+  return true;
+}
+
+void SearchWorker::RecordMinibatchLatency() {
+  if (!minibatch_controller_) return;
+  const int evaluated = computation_->UsedBatchSize();
+  if (evaluated == 0) return;
+  const int collisions = std::count_if(
+      minibatch_.begin(), minibatch_.end(),
+      [](const NodeToProcess& node) { return node.IsCollision(); });
+  const float seconds = std::chrono::duration<float>(
+                            std::chrono::steady_clock::now() -
+                            computation_start_)
+                            .count();
+  minibatch_controller_->OnBatchDone(evaluated, collisions, seconds);
+}
+
+void SearchWorker::FinishPendingMinibatch() {
+  if (!pending_minibatch_.computation) return;
+  SwapPendingMinibatch();
+  pending_minibatch_ = PendingMinibatch();
+  WaitForNNComputation();
+  search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+  FetchMinibatchResults();
+  DoBackupUpdate();
+  UpdateCounters();
+}
+
 // 5. Retrieve NN computations (and terminal values) into nodes.
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::FetchMinibatchResults() {
@@ -2189,26 +2998,163 @@ void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process) {
                         params_.GetNoiseAlpha());
   }
   node->SortEdges();
+  if (node != search_->root_node_ && (params_.GetMaxStoredEdges() > 0 ||
+                                      params_.GetStoredEdgesPolicy() < 1.0f)) {
+    node->TruncateEdges(params_.GetMaxStoredEdges() > 0
+                            ? params_.GetMaxStoredEdges()
+                            : std::numeric_limits<int>::max(),
+                        params_.GetStoredEdgesPolicy());
+  }
 }
 
 // 6. Propagate the new nodes' information to all their parents in the tree.
 // ~~~~~~~~~~~~~~
 void SearchWorker::DoBackupUpdate() {
-  // Nodes mutex for doing node updates.
-  SharedMutex::Lock lock(search_->nodes_mutex_);
-
   bool work_done = number_out_of_order_ > 0;
-  for (const NodeToProcess& node_to_process : minibatch_) {
-    DoBackupUpdateSingleNode(node_to_process);
-    if (!node_to_process.IsCollision()) {
+  bool best_edge_outdated = false;
+  int64_t playouts = 0;
+  uint64_t cum_depth = 0;
+  uint16_t max_depth = 0;
+  exclusive_backups_.clear();
+  {
+    // Most backups only update the node stats, which workers can do at the
+    // same time.
+    SharedMutex::SharedLock lock(search_->nodes_mutex_);
+    for (const NodeToProcess& node_to_process : minibatch_) {
+      if (node_to_process.IsCollision()) continue;
       work_done = true;
+      if (!MaybeDoSharedBackupUpdate(node_to_process, &best_edge_outdated)) {
+        exclusive_backups_.push_back(&node_to_process);
+        continue;
+      }
+      playouts += node_to_process.multivisit;
+      cum_depth += node_to_process.depth * node_to_process.multivisit;
+      max_depth = std::max(max_depth, node_to_process.depth);
     }
   }
   if (!work_done) return;
+
+  // Nodes mutex for doing node updates.
+  SharedMutex::Lock lock(search_->nodes_mutex_);
+  for (const NodeToProcess* node_to_process : exclusive_backups_) {
+    DoBackupUpdateSingleNode(*node_to_process);
+  }
+  if (best_edge_outdated) {
+    search_->current_best_edge_ =
+        search_->GetBestChildNoTemperature(search_->root_node_, 0);
+  }
+  search_->total_playouts_ += playouts;
+  kPlayoutsMetric->Add(playouts);
+  kBatchPlayoutsMetric->Add(playouts);
+  search_->cum_depth_ += cum_depth;
+  search_->max_depth_ = std::max(search_->max_depth_, max_depth);
   search_->CancelSharedCollisions();
   search_->total_batches_ += 1;
 }
 
+int SearchWorker::BackupOutOfOrderEvals(int start) {
+  // Like in DoBackupUpdate(), the backups that only update the node stats are
+  // done at once under the shared lock, the rest under the exclusive one.
+  bool best_edge_outdated = false;
+  int64_t playouts = 0;
+  uint64_t cum_depth = 0;
+  uint16_t max_depth = 0;
+  exclusive_backups_.clear();
+  {
+    SharedMutex::SharedLock lock(search_->nodes_mutex_);
+    for (size_t i = start; i < minibatch_.size(); ++i) {
+      const NodeToProcess& node_to_process = minibatch_[i];
+      if (!node_to_process.ooo_completed) continue;
+      if (!MaybeDoSharedBackupUpdate(node_to_process, &best_edge_outdated)) {
+        exclusive_backups_.push_back(&node_to_process);
+        continue;
+      }
+      playouts += node_to_process.multivisit;
+      cum_depth += node_to_process.depth * node_to_process.multivisit;
+      max_depth = std::max(max_depth, node_to_process.depth);
+    }
+  }
+
+  SharedMutex::Lock lock(search_->nodes_mutex_);
+  for (const NodeToProcess* node_to_process : exclusive_backups_) {
+    DoBackupUpdateSingleNode(*node_to_process);
+  }
+  if (best_edge_outdated) {
+    search_->current_best_edge_ =
+        search_->GetBestChildNoTemperature(search_->root_node_, 0);
+  }
+  search_->total_playouts_ += playouts;
+  kPlayoutsMetric->Add(playouts);
+  search_->cum_depth_ += cum_depth;
+  search_->max_depth_ = std::max(search_->max_depth_, max_depth);
+
+  // Revert 'all' new collisions - it isn't possible to identify exactly which
+  // ones are made obsolete by the out of order evals and only prune those.
+  // This may remove too many items, but hopefully most of the time they will
+  // just be added back in the same in the next gather.
+  int backed_up = 0;
+  auto kept = minibatch_.begin() + start;
+  for (auto it = kept; it != minibatch_.end(); ++it) {
+    if (it->IsCollision()) {
+      for (Node* node = it->node->GetParent();
+           node != search_->root_node_->GetParent();
+           node = node->GetParent()) {
+        node->CancelScoreUpdate(it->multivisit);
+      }
+    } else if (it->ooo_completed) {
+      ++backed_up;
+    } else {
+      if (kept != it) *kept = std::move(*it);
+      ++kept;
+    }
+  }
+  minibatch_.erase(kept, minibatch_.end());
+  return backed_up;
+}
+
+bool SearchWorker::MaybeDoSharedBackupUpdate(
+    const NodeToProcess& node_to_process, bool* best_edge_outdated)
+    REQUIRES_SHARED(search_->nodes_mutex_) {
+  Node* node = node_to_process.node;
+  Node* const end = search_->root_node_->GetParent();
+  // The first visit to a terminal may update parent bounds.
+  if (params_.GetStickyEndgames() && node->IsTerminal() && !node->GetN()) {
+    return false;
+  }
+  const uint32_t solid_threshold =
+      static_cast<uint32_t>(params_.GetSolidTreeThreshold());
+  for (Node* n = node; n != end; n = n->GetParent()) {
+    if (n->GetN() + node_to_process.multivisit >= solid_threshold &&
+        n->MayBecomeSolid()) {
+      return false;
+    }
+    if (ReachesTruncatedEdges(n)) return false;
+  }
+
+  // Same as DoBackupUpdateSingleNode() without bounds.
+  float v = node_to_process.eval->q;
+  float d = node_to_process.eval->d;
+  float m = node_to_process.eval->m;
+  for (Node *n = node, *p; n != end; n = p) {
+    p = n->GetParent();
+    if (n->IsTerminal()) {
+      v = n->GetWL();
+      d = n->GetD();
+      m = n->GetM();
+    }
+    n->FinalizeScoreUpdate(v, d, m, node_to_process.multivisit);
+    if (!p) break;
+    v = -v;
+    m++;
+    if (p == search_->root_node_ &&
+        n != search_->current_best_edge_.node() &&
+        search_->current_best_edge_.GetN() <= n->GetN()) {
+      *best_edge_outdated = true;
+    }
+  }
+  return true;
+}
+
 void SearchWorker::DoBackupUpdateSingleNode(
     const NodeToProcess& node_to_process) REQUIRES(search_->nodes_mutex_) {
   Node* node = node_to_process.node;
@@ -2231,8 +3177,11 @@ void SearchWorker::DoBackupUpdateSingleNode(
   float m_delta = 0.0f;
   uint32_t solid_threshold =
       static_cast<uint32_t>(params_.GetSolidTreeThreshold());
+  // Number of moves from the root to p.
+  int parent_ply = node_to_process.moves_to_visit.size();
   for (Node *n = node, *p; n != search_->root_node_->GetParent(); n = p) {
     p = n->GetParent();
+    --parent_ply;
 
     // Current node might have become terminal from some other descendant, so
     // backup the rest of the way with more accurate values.
@@ -2257,6 +3206,14 @@ void SearchWorker::DoBackupUpdateSingleNode(
     // Nothing left to do without ancestors to update.
     if (!p) break;
 
+    if (ReachesTruncatedEdges(n)) {
+      history_.Trim(search_->played_history_.GetLength());
+      for (int i = 0; i < parent_ply; i++) {
+        history_.Append(node_to_process.moves_to_visit[i]);
+      }
+      RestoreTruncatedEdges(p, history_, search_->backend_);
+    }
+
     bool old_update_parent_bounds = update_parent_bounds;
     // If parent already is terminal further adjustment is not required.
     if (p->IsTerminal()) n_to_fix = 0;
@@ -2287,6 +3244,7 @@ void SearchWorker::DoBackupUpdateSingleNode(
     }
   }
   search_->total_playouts_ += node_to_process.multivisit;
+  kPlayoutsMetric->Add(node_to_process.multivisit);
   search_->cum_depth_ += node_to_process.depth * node_to_process.multivisit;
   search_->max_depth_ = std::max(search_->max_depth_, node_to_process.depth);
 }
@@ -2304,8 +3262,10 @@ bool SearchWorker::MaybeSetBounds(Node* p, float m, int* n_to_fix,
   // ( 0, 0) Draw
   // ( 0, 1) Can't Lose
   // ( 1, 1) Win (highest bounds)
+  // Moves left out by Node::TruncateEdges() count as regular children.
   auto lower = GameResult::BLACK_WON;
-  auto upper = GameResult::BLACK_WON;
+  auto upper = p->HasTruncatedEdges() ? GameResult::WHITE_WON
+                                      : GameResult::BLACK_WON;
   for (const auto& edge : p->Edges()) {
     const auto [edge_lower, edge_upper] = edge.GetBounds();
     lower = std::max(edge_lower, lower);
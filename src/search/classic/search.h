@@ -28,25 +28,78 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <optional>
 #include <shared_mutex>
+#include <string>
 #include <thread>
 
 #include "chess/callbacks.h"
 #include "chess/uciloop.h"
 #include "neural/backend.h"
+#include "search/classic/minibatch_controller.h"
 #include "search/classic/node.h"
 #include "search/classic/params.h"
 #include "search/classic/stoppers/timemgr.h"
 #include "syzygy/syzygy.h"
 #include "utils/logging.h"
 #include "utils/mutex.h"
+#include "utils/shared_thread_pool.h"
 
 namespace lczero {
 namespace classic {
 
+// Time spent in the stages of SearchWorker::ExecuteOneIteration(), summed over
+// all search threads. Only collected when PhaseTimers is enabled.
+struct SearchPhaseTimes {
+  enum Phase {
+    kInitialize,  // Also includes waiting for MaxConcurrentSearchers.
+    kGather,      // Picking nodes and encoding them for the backend.
+    kCollisions,
+    kPrefetch,
+    kCompute,  // Waiting for the backend.
+    kFetch,
+    kBackup,
+    kUpdateCounters,
+    kNumPhases
+  };
+  std::array<int64_t, kNumPhases> nanoseconds = {};
+  int64_t iterations = 0;
+
+  void Add(const SearchPhaseTimes& other);
+  // Short name of the phase, e.g. "gather".
+  static const char* GetName(Phase phase);
+  // E.g. "init 0.1%, gather 20.1%, ... counters 1.0% of 2.51s in 310
+  // iterations".
+  std::string ToString() const;
+};
+
+// Aggregate counters of the gathered minibatches, for tuning the collision
+// and out of order eval parameters.
+struct MinibatchStats {
+  enum Counter {
+    kMinibatches,
+    kCollisionEvents,  // Picked nodes which are collisions.
+    kCollisionVisits,  // Visits the collisions stand for.
+    kOutOfOrderEvals,
+    kCacheHits,    // Picked nodes found in the NN cache.
+    kNNEvals,      // Positions sent to the backend.
+    kWastedSlots,  // Minibatch target minus the positions sent.
+    kNumCounters
+  };
+  std::array<int64_t, kNumCounters> counts = {};
+
+  void Add(const MinibatchStats& other);
+  // Short name of the counter, e.g. "collision_events".
+  static const char* GetName(Counter counter);
+  // E.g. "310 minibatches, per minibatch: collision_events 2.5, ...".
+  std::string ToString() const;
+};
+
 class Search {
  public:
   Search(const NodeTree& tree, Backend* network,
@@ -89,14 +142,81 @@ class Search {
   std::int64_t GetTotalPlayouts() const;
   // Returns the search parameters.
   const SearchParams& GetParams() const { return params_; }
+  // Returns the time spent in every phase of the search iterations so far.
+  SearchPhaseTimes GetPhaseTimes() const;
+  // Returns the number of collision visits gathered so far.
+  int64_t GetTotalCollisions() const;
+  // Returns the minibatch counters so far.
+  MinibatchStats GetMinibatchStats() const;
 
   // If called after GetBestMove, another call to GetBestMove will have results
   // from temperature having been applied again.
   void ResetBestMove();
 
+  // Adds the root noise to the priors of the root if it's reused from an
+  // earlier search, as otherwise the noise is only added when the root is
+  // expanded. Must be called at most once per root, before the search starts.
+  void ApplyNoiseToReusedRoot();
+
  private:
+  // Values of a root (or depth 1) child or of the node itself for the verbose
+  // move stats, see GetVerboseStats().
+  struct VerboseStatsEntry {
+    std::string label;
+    // Move of the edge, not flipped. Unset for the node itself.
+    std::optional<Move> move;
+    int index;
+    uint32_t n;
+    uint32_t n_in_flight;
+    float p;
+    // Only for edges.
+    float u = 0.0f;
+    float s = 0.0f;
+    // Of the node the entry is about, if it exists.
+    bool has_node = false;
+    float wl = 0.0f;
+    float d = 0.0f;
+    float m = 0.0f;
+    std::optional<float> terminal_q;
+    Node::Bounds bounds;
+  };
+  struct VerboseStats {
+    // Moves from the root to the node, not flipped.
+    std::vector<Move> path;
+    float draw_score;
+    float fpu;
+    // The edges, followed by the node itself.
+    std::vector<VerboseStatsEntry> entries;
+  };
+  // Everything the UCI output needs, copied from the tree under the lock and
+  // formatted by the reporter thread without holding it.
+  struct InfoSnapshot {
+    struct Line {
+      float wl;
+      float d;
+      float q;
+      float m;
+      float moves_left;
+      uint32_t n;
+      bool is_terminal;
+      bool is_tb_terminal;
+      std::vector<Move> pv;
+    };
+    // Info common for all multipv variants.
+    ThinkingInfo common;
+    std::vector<Line> lines;
+    std::optional<VerboseStats> move_stats;
+    // Stats of the reply to @opponent_move, only logged.
+    std::optional<VerboseStats> opponent_stats;
+    Move opponent_move;
+    std::vector<std::string> comments;
+    std::optional<BestMoveInfo> best_move;
+  };
+
   // Computes the best move, maybe with temperature (according to the settings).
   void EnsureBestMoveKnown();
+  // Walks the tree for the TreeStats report.
+  TreeStats GetTreeStats() const;
 
   // Returns a child with most visits, with or without temperature.
   // NoTemperature is safe to use on non-extended nodes, while WithTemperature
@@ -110,23 +230,42 @@ class Search {
   int64_t GetTimeSinceFirstBatch() const;
   void MaybeTriggerStop(const IterationStats& stats, StoppersHints* hints);
   void MaybeOutputInfo();
-  void SendUciInfo();  // Requires nodes_mutex_ to be held.
+  // Requires nodes_mutex_ (shared is enough) and counters_mutex_ to be held.
+  InfoSnapshot SnapshotInfo();
+  void SnapshotMovesStats(InfoSnapshot* snapshot) const;
+  // Hands the snapshot over to the reporter thread.
+  void QueueReport(InfoSnapshot snapshot);
+  // Formats and outputs the queued snapshots. Runs in its own thread, so that
+  // the search doesn't wait for the string formatting and the output.
+  void ReporterThread();
+  void OutputReport(const InfoSnapshot& snapshot);
+  std::vector<ThinkingInfo> FormatUciInfo(const InfoSnapshot& snapshot) const;
   // Sets stop to true and notifies watchdog thread.
   void FireStopInternal();
+  // When the tree is larger than TreeMemoryLimit, prunes the smallest subtrees
+  // outside of the principal variation. Stops the search if that's not
+  // possible.
+  void MaybePruneTree();
 
-  void SendMovesStats() const;
   // Function which runs in a separate thread and watches for time and
   // uci `stop` command;
   void WatchdogThread();
 
+  // With DeterministicSearch, blocks until it's the turn of the worker @id.
+  void WaitForTurn(int id);
+  // Passes the turn to the next worker which hasn't left. With @leave, the
+  // worker @id takes no more turns.
+  void EndTurn(int id, bool leave);
+
   // Fills IterationStats with global (rather than per-thread) portion of search
   // statistics. Currently all stats there (in IterationStats) are global
   // though.
   void PopulateCommonIterationStats(IterationStats* stats);
 
-  // Returns verbose information about given node, as vector of strings.
-  // Node can only be root or ponder (depth 1).
-  std::vector<std::string> GetVerboseStats(Node* node) const;
+  // Returns verbose information about given node, FormatVerboseStats() turns
+  // it into strings. Node can only be root or ponder (depth 1).
+  VerboseStats GetVerboseStats(Node* node) const;
+  std::vector<std::string> FormatVerboseStats(const VerboseStats& stats) const;
 
   // Returns the draw score at the root of the search. At odd depth pass true to
   // the value of @is_odd_depth to change the sign of the draw score.
@@ -136,8 +275,6 @@ class Search {
   // Ensure that all shared collisions are cancelled and clear them out.
   void CancelSharedCollisions();
 
-  PositionHistory GetPositionHistoryAtNode(const Node* node) const;
-
   mutable Mutex counters_mutex_ ACQUIRED_AFTER(nodes_mutex_);
   // Tells all threads to stop.
   std::atomic<bool> stop_{false};
@@ -158,6 +295,8 @@ class Search {
 
   Mutex threads_mutex_;
   std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
+  // Watchdog and worker tasks when the search threads are shared.
+  std::unique_ptr<SharedThreadPool::Group> tasks_ GUARDED_BY(threads_mutex_);
 
   Node* root_node_;
   SyzygyTablebase* syzygy_tb_;
@@ -178,14 +317,22 @@ class Search {
 
   mutable SharedMutex nodes_mutex_;
   EdgeAndNode current_best_edge_ GUARDED_BY(nodes_mutex_);
-  Edge* last_outputted_info_edge_ GUARDED_BY(nodes_mutex_) = nullptr;
-  ThinkingInfo last_outputted_uci_info_ GUARDED_BY(nodes_mutex_);
   int64_t total_playouts_ GUARDED_BY(nodes_mutex_) = 0;
   int64_t total_batches_ GUARDED_BY(nodes_mutex_) = 0;
   // Maximum search depth = length of longest path taken in PickNodetoExtend.
   uint16_t max_depth_ GUARDED_BY(nodes_mutex_) = 0;
   // Cumulative depth of all paths taken in PickNodetoExtend.
   uint64_t cum_depth_ GUARDED_BY(nodes_mutex_) = 0;
+  // Visits of the subtrees removed by MaybePruneTree(). The ancestors keep
+  // them, so the tree has about this many nodes less than the root visits.
+  uint64_t pruned_visits_ GUARDED_BY(nodes_mutex_) = 0;
+  // Filled by the workers when PhaseTimers is enabled.
+  std::array<std::atomic<int64_t>, SearchPhaseTimes::kNumPhases>
+      phase_nanoseconds_ = {};
+  std::atomic<int64_t> phase_iterations_ = 0;
+  std::atomic<int64_t> total_collisions_ = 0;
+  std::array<std::atomic<int64_t>, MinibatchStats::kNumCounters>
+      minibatch_counters_ = {};
 
   std::optional<std::chrono::steady_clock::time_point> nps_start_time_
       GUARDED_BY(counters_mutex_);
@@ -194,9 +341,38 @@ class Search {
   std::atomic<int> backend_waiting_counter_{0};
   std::atomic<int> thread_count_{0};
 
+  // With DeterministicSearch, the worker whose turn it is, and which workers
+  // have left the search.
+  Mutex turn_mutex_;
+  std::condition_variable turn_cv_;
+  int turn_ GUARDED_BY(turn_mutex_) = 0;
+  std::vector<bool> turn_left_ GUARDED_BY(turn_mutex_);
+
   std::vector<std::pair<Node*, int>> shared_collisions_
       GUARDED_BY(nodes_mutex_);
 
+  // What the last reported info was about, to decide when to report again.
+  Edge* last_reported_edge_ GUARDED_BY(counters_mutex_) = nullptr;
+  int last_reported_depth_ GUARDED_BY(counters_mutex_) = -1;
+  int last_reported_seldepth_ GUARDED_BY(counters_mutex_) = -1;
+  int64_t last_reported_time_ GUARDED_BY(counters_mutex_) = 0;
+  // PVs of the last reported lines, with the visits of their root child.
+  struct CachedPv {
+    Node* node;
+    uint32_t n;
+    std::vector<Move> pv;
+  };
+  std::vector<CachedPv> pv_cache_ GUARDED_BY(counters_mutex_);
+
+  Mutex reporter_mutex_;
+  std::condition_variable reporter_cv_;
+  std::deque<InfoSnapshot> reports_ GUARDED_BY(reporter_mutex_);
+  bool reporter_done_ GUARDED_BY(reporter_mutex_) = false;
+  // While a periodic report waits for the reporter, no new ones are taken.
+  // That throttles the info to the rate the output can keep up with.
+  std::atomic<bool> report_pending_{false};
+  std::thread reporter_thread_;
+
   std::unique_ptr<UciResponder> uci_responder_;
   ContemptMode contempt_mode_;
   friend class SearchWorker;
@@ -207,13 +383,20 @@ class Search {
 // within one thread, have to split into stages.
 class SearchWorker {
  public:
-  SearchWorker(Search* search, const SearchParams& params)
+  SearchWorker(Search* search, const SearchParams& params, int id)
       : search_(search),
+        id_(id),
         history_(search_->played_history_),
         params_(params),
-        moves_left_support_(search_->backend_attributes_.has_mlh) {
+        moves_left_support_(search_->backend_attributes_.has_mlh),
+        pick_nodes_to_extend_task_(
+            GetPickNodesToExtendTask(params, moves_left_support_)),
+        phase_timers_(params.GetPhaseTimers()) {
     task_workers_ = params.GetTaskWorkersPerSearchWorker();
-    if (task_workers_ < 0) {
+    if (params.GetDeterministicSearch()) {
+      // The tasks would pick and extend the nodes in a varying order.
+      task_workers_ = 0;
+    } else if (task_workers_ < 0) {
       if (search_->backend_attributes_.runs_on_cpu) {
         task_workers_ = 0;
       } else {
@@ -235,6 +418,14 @@ class SearchWorker {
     max_out_of_order_ =
         std::max(1, static_cast<int>(params_.GetMaxOutOfOrderEvalsFactor() *
                                      target_minibatch_size_));
+    // Deterministic search can't depend on the measured latency.
+    if ((params_.GetAdaptiveMinibatch() || params_.GetDeadlineMinibatch()) &&
+        !params_.GetDeterministicSearch()) {
+      minibatch_controller_.emplace(
+          target_minibatch_size_,
+          search_->backend_attributes_.maximum_batch_size,
+          search_->backend_attributes_.latency_profile);
+    }
   }
 
   ~SearchWorker() {
@@ -255,9 +446,18 @@ class SearchWorker {
     try {
       // A very early stop may arrive before this point, so the test is at the
       // end to ensure at least one iteration runs before exiting.
-      do {
-        ExecuteOneIteration();
-      } while (search_->IsSearchActive());
+      if (params_.GetDeterministicSearch()) {
+        while (ExecuteDeterministicIteration()) {
+        }
+      } else {
+        do {
+          ExecuteOneIteration();
+        } while (search_->IsSearchActive());
+        FinishPendingMinibatch();
+      }
+      if (phase_timers_) {
+        LOGFILE << "Search thread phase times: " << phase_times_.ToString();
+      }
     } catch (std::exception& e) {
       std::cerr << "Unhandled exception in worker thread: " << e.what()
                 << std::endl;
@@ -275,6 +475,12 @@ class SearchWorker {
   // 7. Update the Search's status and progress information.
   void ExecuteOneIteration();
 
+  // Same as ExecuteOneIteration() with DeterministicSearch. In its turn, the
+  // worker backs up the minibatch computed since its previous turn and
+  // gathers the next one, whose NN computation then runs during the turns of
+  // the other workers. Returns false once the worker has left the search.
+  bool ExecuteDeterministicIteration();
+
   // The same operations one by one:
   // 1. Initialize internal structures.
   // @computation is the computation to use on this iteration.
@@ -292,6 +498,17 @@ class SearchWorker {
   // 4. Run NN computation.
   void RunNNComputation();
 
+  // 4a. With DeadlineMinibatch, a minibatch gathered after the search stopped
+  // is not sent to the backend. Its nodes which need the NN evaluation are
+  // reverted to unexpanded, the ones with results are still backed up.
+  // Returns whether the minibatch was abandoned.
+  bool MaybeAbandonMinibatch();
+
+  // 4b. When minibatches are pipelined, starts the NN computation without
+  // waiting for it, or waits for the computation started earlier.
+  void StartNNComputation();
+  void WaitForNNComputation();
+
   // 5. Retrieve NN computations (and terminal values) into nodes.
   void FetchMinibatchResults();
 
@@ -301,6 +518,10 @@ class SearchWorker {
   // 7. Update the Search's status and progress information.
   void UpdateCounters();
 
+  // Processes the results of the minibatch still in flight when minibatches are
+  // pipelined. Has to be called before the worker is done with the search.
+  void FinishPendingMinibatch();
+
  private:
   struct NodeToProcess {
     bool IsExtendable() const { return !is_collision && !node->IsTerminal(); }
@@ -401,30 +622,92 @@ class SearchWorker {
   bool AddNodeToComputation(Node* node);
   int PrefetchIntoCache(Node* node, int budget, bool is_odd_depth);
   void DoBackupUpdateSingleNode(const NodeToProcess& node_to_process);
+  // Backs up the out of order evaluations among the minibatch entries from
+  // @start and removes them, along with the collisions picked since @start.
+  // Returns the number of backed up entries.
+  int BackupOutOfOrderEvals(int start);
+  // Backs up a visit which only updates the node stats, which can be done by
+  // several workers concurrently under the shared lock. Sets
+  // @best_edge_outdated if the best root edge may have changed. Returns false,
+  // without doing anything, if the backup may change the tree (bounds or solid
+  // children) and needs the exclusive lock.
+  bool MaybeDoSharedBackupUpdate(const NodeToProcess& node_to_process,
+                                 bool* best_edge_outdated);
   // Returns whether a node's bounds were set based on its children.
   bool MaybeSetBounds(Node* p, float m, int* n_to_fix, float* v_delta,
                       float* d_delta, float* m_delta) const;
   void PickNodesToExtend(int collision_limit);
-  void PickNodesToExtendTask(Node* starting_point, int collision_limit,
-                             int base_depth,
+  void PickNodesToExtendTask(Node* starting_point, int base_depth,
+                             int collision_limit,
                              const std::vector<Move>& moves_to_base,
                              std::vector<NodeToProcess>* receiver,
                              TaskWorkspace* workspace);
+  // Specializations of PickNodesToExtendTask() for whether the moves left
+  // utility is used and whether the draw score is non-zero, which are fixed
+  // for the search but would be checked for every child otherwise.
+  template <bool kMovesLeft, bool kDrawScore>
+  void PickNodesToExtendTaskImpl(Node* starting_point, int base_depth,
+                                 int collision_limit,
+                                 const std::vector<Move>& moves_to_base,
+                                 std::vector<NodeToProcess>* receiver,
+                                 TaskWorkspace* workspace);
+  using PickNodesToExtendTaskFn =
+      decltype(&SearchWorker::PickNodesToExtendTask);
+  static PickNodesToExtendTaskFn GetPickNodesToExtendTask(
+      const SearchParams& params, bool moves_left_support);
   void EnsureNodeTwoFoldCorrectForDepth(Node* node, int depth);
   void ProcessPickedTask(int batch_start, int batch_end,
                          TaskWorkspace* workspace);
   void ExtendNode(Node* node, int depth, const std::vector<Move>& moves_to_add,
                   PositionHistory* history);
+  // Moves left estimate of a node which is made terminal without evaluation.
+  float GetTerminalM(const Node* node) const;
+  // With SyzygyProbeChildren, probes the positions after the legal moves of a
+  // node being extended at @history. If they decide the result, makes the node
+  // terminal and returns true. Otherwise sets the node bounds from them.
+  bool ProbeTablebaseChildren(Node* node, const MoveList& legal_moves,
+                              PositionHistory* history);
   void FetchSingleNodeResult(NodeToProcess* node_to_process);
   void RunTasks(int tid);
+  // Claims the next task that nobody has taken yet. Returns its index, or -1
+  // if there is none (or another thread is claiming one at the moment).
+  int TryTakeTask();
+  void RunTask(int id, TaskWorkspace* workspace);
+  // Wakes the task threads that parked while waiting for a new task.
+  void NotifyTaskAdded();
   void ResetTasks();
   // Returns how many tasks there were.
   int WaitForTasks();
+  // Exchanges the current minibatch with the pipelined one.
+  void SwapPendingMinibatch();
+  // Sets the target size of the minibatch about to be gathered.
+  void UpdateMinibatchTarget();
+  // Reports the latency of the minibatch which has just been computed.
+  void RecordMinibatchLatency();
+  // With PhaseTimers, adds the time since the previous phase ended to @phase.
+  void EndPhase(SearchPhaseTimes::Phase phase);
 
   Search* const search_;
+  // Index of the worker, the order of the turns with DeterministicSearch.
+  const int id_;
   // List of nodes to process.
   std::vector<NodeToProcess> minibatch_;
+  // Backups of the minibatch which need the exclusive lock.
+  std::vector<const NodeToProcess*> exclusive_backups_;
   std::unique_ptr<BackendComputation> computation_;
+  // With pipelined minibatches, the minibatch sent to the backend on the
+  // previous iteration, whose results are not processed yet.
+  struct PendingMinibatch {
+    std::vector<NodeToProcess> minibatch;
+    std::unique_ptr<BackendComputation> computation;
+    int number_out_of_order = 0;
+    std::chrono::steady_clock::time_point computation_start;
+  };
+  PendingMinibatch pending_minibatch_;
+  // When the computation of the current minibatch was started.
+  std::chrono::steady_clock::time_point computation_start_;
+  // Set when the minibatch size is adaptive.
+  std::optional<MinibatchSizeController> minibatch_controller_;
   int task_workers_;
   int target_minibatch_size_;
   int max_out_of_order_;
@@ -434,6 +717,11 @@ class SearchWorker {
   const SearchParams& params_;
   std::unique_ptr<Node> precached_node_;
   const bool moves_left_support_;
+  // Specialization of PickNodesToExtendTask() for the search parameters.
+  const PickNodesToExtendTaskFn pick_nodes_to_extend_task_;
+  const bool phase_timers_;
+  std::chrono::steady_clock::time_point phase_start_;
+  SearchPhaseTimes phase_times_;
   IterationStats iteration_stats_;
   StoppersHints latest_time_manager_hints_;
 
@@ -446,6 +734,7 @@ class SearchWorker {
   std::atomic<int> tasks_taken_ = 0;
   std::atomic<int> completed_tasks_ = 0;
   std::condition_variable task_added_;
+  std::atomic<int> parked_task_threads_ = 0;
   std::vector<std::thread> task_threads_;
   std::vector<TaskWorkspace> task_workspaces_;
   TaskWorkspace main_workspace_;
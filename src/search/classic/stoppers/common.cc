@@ -27,7 +27,12 @@
 
 #include "search/classic/stoppers/common.h"
 
+#include <algorithm>
+#include <optional>
+
 #include "neural/shared_params.h"
+#include "utils/logging.h"
+#include "utils/mutex.h"
 
 namespace lczero {
 namespace classic {
@@ -57,6 +62,21 @@ const OptionId kKLDGainAverageIntervalId{
          "Used to decide how frequently to evaluate the average KLDGainPerNode "
          "to check the MinimumKLDGainPerNode, if specified.",
      .visibility = OptionId::kProOnly}};
+const OptionId kBestMoveStabilityId{
+    {.long_flag = "bestmove-stability",
+     .uci_option = "BestMoveStability",
+     .help_text =
+         "If greater than 0, search stops when the projected chance that the "
+         "best move changes before the search ends is below this value. The "
+         "projection extrapolates the visits of the root moves over the last "
+         "BestMoveStabilityWindow milliseconds to the remaining time.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kBestMoveStabilityWindowId{
+    {.long_flag = "bestmove-stability-window",
+     .uci_option = "BestMoveStabilityWindow",
+     .help_text = "Length of the window for BestMoveStability, in "
+                  "milliseconds.",
+     .visibility = OptionId::kProOnly}};
 const OptionId kSmartPruningFactorId{
     {.long_flag = "smart-pruning-factor",
      .uci_option = "SmartPruningFactor",
@@ -88,6 +108,8 @@ const OptionId kNodesAsPlayoutsId{
 void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options) {
   options->Add<IntOption>(kKLDGainAverageIntervalId, 1, 10000000) = 100;
   options->Add<FloatOption>(kMinimumKLDGainPerNodeId, 0.0f, 1.0f) = 0.0f;
+  options->Add<FloatOption>(kBestMoveStabilityId, 0.0f, 1.0f) = 0.0f;
+  options->Add<IntOption>(kBestMoveStabilityWindowId, 100, 600000) = 1000;
   options->Add<FloatOption>(kSmartPruningFactorId, 0.0f, 10.0f) =
       (for_what == RunType::kUci ? 1.33f : 0.00f);
   options->Add<IntOption>(kMinimumSmartPruningBatchesId, 0, 10000) = 0;
@@ -105,6 +127,13 @@ void PopulateIntrinsicStoppers(ChainedSearchStopper* stopper,
         min_kld_gain, options.Get<int>(kKLDGainAverageIntervalId)));
   }
 
+  // Best move stability, uses the remaining time from the time manager.
+  const auto max_change_probability = options.Get<float>(kBestMoveStabilityId);
+  if (max_change_probability > 0.0f) {
+    stopper->AddStopper(std::make_unique<BestMoveStabilityStopper>(
+        max_change_probability, options.Get<int>(kBestMoveStabilityWindowId)));
+  }
+
   // Should be last in the chain.
   const auto smart_pruning_factor = options.Get<float>(kSmartPruningFactorId);
   if (smart_pruning_factor > 0.0f) {
@@ -165,13 +194,43 @@ void PopulateCommonUciStoppers(ChainedSearchStopper* stopper,
   if (!infinite) PopulateIntrinsicStoppers(stopper, options);
 }
 
+// Never stops, reports the search time and the longest gap between the stop
+// checks to the move overhead estimator.
+class MoveOverheadRecorder : public SearchStopper {
+ public:
+  explicit MoveOverheadRecorder(MoveOverheadEstimator* estimator)
+      : estimator_(estimator) {}
+
+  bool ShouldStop(const IterationStats& stats, StoppersHints*) override {
+    Mutex::Lock lock(mutex_);
+    max_gap_ms_ =
+        std::max(max_gap_ms_, stats.time_since_movestart - last_check_ms_);
+    last_check_ms_ = std::max(last_check_ms_, stats.time_since_movestart);
+    return false;
+  }
+
+  void OnSearchDone(const IterationStats& stats) override {
+    Mutex::Lock lock(mutex_);
+    estimator_->OnSearchDone(stats.time_since_movestart, max_gap_ms_);
+  }
+
+ private:
+  MoveOverheadEstimator* const estimator_;
+  Mutex mutex_;
+  int64_t last_check_ms_ GUARDED_BY(mutex_) = 0;
+  int64_t max_gap_ms_ GUARDED_BY(mutex_) = 0;
+};
+
 class CommonTimeManager : public TimeManager {
  public:
   CommonTimeManager(std::unique_ptr<TimeManager> child_mgr,
-                    const OptionsDict& options, int64_t move_overhead)
+                    const OptionsDict& options, int64_t move_overhead,
+                    bool auto_move_overhead)
       : child_mgr_(std::move(child_mgr)),
         options_(options),
-        move_overhead_(move_overhead) {}
+        move_overhead_(move_overhead) {
+    if (auto_move_overhead) estimator_.emplace(move_overhead);
+  }
 
  private:
   std::unique_ptr<SearchStopper> GetStopper(const GoParams& params,
@@ -180,26 +239,50 @@ class CommonTimeManager : public TimeManager {
                                             size_t total_memory,
                                             uint32_t nodes) override {
     auto result = std::make_unique<ChainedSearchStopper>();
-    if (child_mgr_)
-      result->AddStopper(child_mgr_->GetStopper(params, position, avg_node_size,
-                                                total_memory, nodes));
-    PopulateCommonUciStoppers(result.get(), options_, params, avg_node_size,
-                              total_memory, nodes, move_overhead_);
+    if (!estimator_) {
+      PopulateStoppers(result.get(), params, position, avg_node_size,
+                       total_memory, nodes, move_overhead_);
+      return result;
+    }
+    estimator_->OnGo(params, position);
+    const int64_t move_overhead = estimator_->GetOverheadMs();
+    LOGFILE << "Measured move overhead: " << move_overhead << "ms.";
+    // The child managers only know the configured overhead, so the clocks
+    // they see are shifted by the difference.
+    GoParams adjusted = params;
+    for (auto* time : {&adjusted.wtime, &adjusted.btime}) {
+      if (*time) **time += move_overhead_ - move_overhead;
+    }
+    result->AddStopper(std::make_unique<MoveOverheadRecorder>(&*estimator_));
+    PopulateStoppers(result.get(), adjusted, position, avg_node_size,
+                     total_memory, nodes, move_overhead);
     return result;
   }
 
+  void PopulateStoppers(ChainedSearchStopper* stopper, const GoParams& params,
+                        const Position& position, size_t avg_node_size,
+                        size_t total_memory, uint32_t nodes,
+                        int64_t move_overhead) {
+    if (child_mgr_)
+      stopper->AddStopper(child_mgr_->GetStopper(
+          params, position, avg_node_size, total_memory, nodes));
+    PopulateCommonUciStoppers(stopper, options_, params, avg_node_size,
+                              total_memory, nodes, move_overhead);
+  }
+
   const std::unique_ptr<TimeManager> child_mgr_;
   const OptionsDict& options_;
   const int64_t move_overhead_;
+  std::optional<MoveOverheadEstimator> estimator_;
 };
 
 }  // namespace
 
 std::unique_ptr<TimeManager> MakeCommonTimeManager(
     std::unique_ptr<TimeManager> child_manager, const OptionsDict& options,
-    int64_t move_overhead) {
-  return std::make_unique<CommonTimeManager>(std::move(child_manager), options,
-                                             move_overhead);
+    int64_t move_overhead, bool auto_move_overhead) {
+  return std::make_unique<CommonTimeManager>(
+      std::move(child_manager), options, move_overhead, auto_move_overhead);
 }
 
 }  // namespace classic
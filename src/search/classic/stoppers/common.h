@@ -37,13 +37,13 @@ namespace classic {
 enum class RunType { kUci, kSelfplay };
 void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options);
 
-// Populates KLDGain and SmartPruning stoppers.
+// Populates KLDGain, BestMoveStability and SmartPruning stoppers.
 void PopulateIntrinsicStoppers(ChainedSearchStopper* stopper,
                                const OptionsDict& options);
 
 std::unique_ptr<TimeManager> MakeCommonTimeManager(
     std::unique_ptr<TimeManager> child_manager, const OptionsDict& options,
-    int64_t move_overhead);
+    int64_t move_overhead, bool auto_move_overhead = false);
 
 }  // namespace classic
 }  // namespace lczero
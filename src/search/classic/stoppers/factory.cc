@@ -49,6 +49,14 @@ const OptionId kMoveOverheadId{
          "total available time (to compensate for slow connection, "
          "interprocess communication, etc).",
      .visibility = OptionId::kAlwaysVisible}};
+const OptionId kAutoMoveOverheadId{
+    {.long_flag = "auto-move-overhead",
+     .uci_option = "AutoMoveOverhead",
+     .help_text =
+         "Measure the move overhead during the game from the clock times the "
+         "GUI sends, and use it instead of MoveOverheadMs once the first move "
+         "is measured.",
+     .visibility = OptionId::kProOnly}};
 const OptionId kTimeManagerId{
     {.long_flag = "time-manager",
      .uci_option = "TimeManager",
@@ -68,6 +76,7 @@ const OptionId kSlowMoverId{
 void PopulateTimeManagementOptions(RunType for_what, OptionsParser* options) {
   PopulateCommonStopperOptions(for_what, options);
   options->Add<IntOption>(kMoveOverheadId, 0, 100000000) = 200;
+  options->Add<BoolOption>(kAutoMoveOverheadId) = false;
   options->Add<StringOption>(kTimeManagerId) = "legacy";
   options->Add<FloatOption>(kSlowMoverId, 0.0f, 100.0f) = 1.0f;
 }
@@ -112,7 +121,8 @@ std::unique_ptr<TimeManager> MakeTimeManager(const OptionsDict& options) {
   }
   tm_options.CheckAllOptionsRead("");
 
-  return MakeCommonTimeManager(std::move(time_manager), options, move_overhead);
+  return MakeCommonTimeManager(std::move(time_manager), options, move_overhead,
+                               options.Get<bool>(kAutoMoveOverheadId));
 }
 
 }  // namespace classic
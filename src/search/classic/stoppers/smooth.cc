@@ -98,6 +98,9 @@ class Params {
 
   // Force a use of piggybank during the first few milliseconds of the move.
   float force_piggybank_ms() const { return force_piggybank_ms_; }
+  // Fraction of the allocated time left unused by a move which stopped early
+  // (e.g. by smart pruning or best move stability), that goes to piggybank.
+  float early_stop_piggybank() const { return early_stop_piggybank_; }
 
   // Move overhead.
   int64_t move_overhead_ms() const { return move_overhead_ms_; }
@@ -124,6 +127,7 @@ class Params {
   const float bestmove_optimism_;
   const float overtaker_optimism_;
   const float force_piggybank_ms_;
+  const float early_stop_piggybank_;
   const MovesLeftEstimator moves_left_estimator_;
 };
 
@@ -170,6 +174,8 @@ Params::Params(const OptionsDict& params, int64_t move_overhead)
       overtaker_optimism_(
           params.GetOrDefault<float>("overtaker-optimism", 4.0f)),
       force_piggybank_ms_(params.GetOrDefault<int>("force-piggybank-ms", 1000)),
+      early_stop_piggybank_(
+          params.GetOrDefault<float>("early-stop-piggybank", 0.0f)),
       moves_left_estimator_(CreateMovesLeftEstimator(params)) {}
 
 // Returns the updated value of @from, towards @to by the number of halves
@@ -308,9 +314,16 @@ class SmoothTimeManager : public TimeManager {
     const float expected_move_time = move_allocated_time_ms_ * timeuse_;
 
     int64_t piggybank_time_used = 0;
+    int64_t piggybank_time_saved = 0;
     if (used_piggybank) {
       piggybank_time_used = std::max(int64_t(), total_move_time - time_budget);
       piggybank_time_ -= piggybank_time_used;
+    } else if (total_move_time < time_budget) {
+      // Keep the time saved on the settled moves for the hard ones. It's
+      // capped to the maximum piggybank when the next move starts.
+      piggybank_time_saved = (time_budget - total_move_time) *
+                             params_.early_stop_piggybank();
+      piggybank_time_ += piggybank_time_saved;
     }
     // If piggybank was used, time use is 100%.
     timeuse_ =
@@ -331,7 +344,8 @@ class SmoothTimeManager : public TimeManager {
             << "ms. New time_use=" << timeuse_
             << ", update_rate=" << this_move_time_fraction
             << " (avg_move_time=" << avg_ms_per_move_ << "ms)."
-            << " piggybank_used=" << piggybank_time_used << "ms";
+            << " piggybank_used=" << piggybank_time_used << "ms"
+            << " piggybank_saved=" << piggybank_time_saved << "ms";
   }
 
  private:
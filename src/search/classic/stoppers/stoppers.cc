@@ -27,6 +27,7 @@
 
 #include "search/classic/stoppers/stoppers.h"
 
+#include <algorithm>
 #include <cmath>
 
 namespace lczero {
@@ -178,6 +179,97 @@ bool KldGainStopper::ShouldStop(const IterationStats& stats, StoppersHints*) {
   return false;
 }
 
+///////////////////////////
+// BestMoveStabilityStopper
+///////////////////////////
+
+namespace {
+// Samples of the root visits taken per window.
+const int kStabilitySamplesPerWindow = 8;
+// Visits in the window needed for the visit shares to mean anything.
+const int kStabilityMinWindowVisits = 100;
+}  // namespace
+
+BestMoveStabilityStopper::BestMoveStabilityStopper(
+    float max_change_probability, int window_ms)
+    : max_change_probability_(max_change_probability), window_ms_(window_ms) {}
+
+bool BestMoveStabilityStopper::ShouldStop(const IterationStats& stats,
+                                          StoppersHints* hints) {
+  const size_t num_moves = stats.edge_n.size();
+  if (num_moves < 2) return false;
+  Mutex::Lock lock(mutex_);
+  const int64_t now = stats.time_since_movestart;
+  if (!samples_.empty() && samples_.back().edge_n.size() != num_moves) {
+    samples_.clear();
+  }
+  const int64_t sample_interval_ms = window_ms_ / kStabilitySamplesPerWindow;
+  if (samples_.empty() || now >= samples_.back().time_ms + sample_interval_ms) {
+    samples_.push_back({now, stats.total_nodes, stats.edge_n});
+    while (samples_.size() > 2 && samples_[1].time_ms <= now - window_ms_) {
+      samples_.pop_front();
+    }
+  }
+  const Sample& first = samples_.front();
+  const Sample& last = samples_.back();
+  if (last.time_ms - first.time_ms < window_ms_ / 2) return false;
+
+  uint64_t first_total = 0;
+  uint64_t window_visits = 0;
+  size_t best_idx = 0;
+  for (size_t i = 0; i < num_moves; ++i) {
+    first_total += first.edge_n[i];
+    window_visits += last.edge_n[i] - first.edge_n[i];
+    if (last.edge_n[i] > last.edge_n[best_idx]) best_idx = i;
+  }
+  if (first_total == 0 || window_visits < kStabilityMinWindowVisits) {
+    return false;
+  }
+  const uint64_t last_total = first_total + window_visits;
+  double kld = 0.0;
+  for (size_t i = 0; i < num_moves; ++i) {
+    if (first.edge_n[i] == 0) continue;
+    const double o_p = static_cast<double>(first.edge_n[i]) / first_total;
+    const double n_p = static_cast<double>(last.edge_n[i]) / last_total;
+    kld += o_p * std::log(o_p / n_p);
+  }
+
+  const double nps =
+      1000.0 * (last.nodes - first.nodes) / (last.time_ms - first.time_ms);
+  const double remaining_playouts =
+      std::min(std::max<int64_t>(0, hints->GetEstimatedRemainingTimeMs()) *
+                   nps / 1000.0,
+               static_cast<double>(hints->GetEstimatedRemainingPlayouts()));
+  if (remaining_playouts <= 0.0) return false;
+
+  // Probability that some move overtakes the best one (union bound), with the
+  // difference of the visit shares normally distributed around its value in
+  // the window.
+  const double best_share =
+      static_cast<double>(last.edge_n[best_idx] - first.edge_n[best_idx]) /
+      window_visits;
+  double change_probability = 0.0;
+  for (size_t i = 0; i < num_moves; ++i) {
+    if (i == best_idx) continue;
+    const double share =
+        static_cast<double>(last.edge_n[i] - first.edge_n[i]) / window_visits;
+    const double diff = share - best_share;
+    const double variance =
+        (share + best_share - diff * diff) / window_visits + kld;
+    const double lead = last.edge_n[best_idx] - last.edge_n[i];
+    const double z = (lead / remaining_playouts - diff) /
+                     std::sqrt(std::max(variance, 1e-12));
+    change_probability += 0.5 * std::erfc(z / std::sqrt(2.0));
+  }
+  if (change_probability < max_change_probability_) {
+    LOGFILE << "Stopping search: best move is settled, chance of a change is "
+            << change_probability << " with " << remaining_playouts
+            << " playouts remaining (KLD over the window " << kld << ").";
+    return true;
+  }
+  return false;
+}
+
 ///////////////////////////
 // SmartPruningStopper
 ///////////////////////////
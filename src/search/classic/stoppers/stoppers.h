@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <deque>
 #include <optional>
 #include <vector>
 
@@ -136,6 +137,31 @@ class KldGainStopper : public SearchStopper {
   double prev_child_nodes_ GUARDED_BY(mutex_) = 0.0;
 };
 
+// Stops when the best move is unlikely to change before the search ends. The
+// visit shares of the root moves over a sliding window are extrapolated to the
+// remaining playouts (from the remaining time and the NPS over the same
+// window). The KL divergence of the root visit distribution over the window
+// adds to the uncertainty of these shares, as a distribution which still moves
+// doesn't extrapolate well.
+class BestMoveStabilityStopper : public SearchStopper {
+ public:
+  BestMoveStabilityStopper(float max_change_probability, int window_ms);
+  bool ShouldStop(const IterationStats&, StoppersHints*) override;
+
+ private:
+  struct Sample {
+    int64_t time_ms;
+    int64_t nodes;
+    std::vector<uint32_t> edge_n;
+  };
+
+  const double max_change_probability_;
+  const int64_t window_ms_;
+  Mutex mutex_;
+  // The first sample is the last one older than the window.
+  std::deque<Sample> samples_ GUARDED_BY(mutex_);
+};
+
 // Does many things:
 // Computes how many nodes are remaining (from remaining time/nodes, scaled by
 // smart pruning factor). When this amount of nodes is not enough for second
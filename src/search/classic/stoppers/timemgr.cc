@@ -27,7 +27,10 @@
 
 #include "search/classic/stoppers/timemgr.h"
 
+#include <algorithm>
+
 #include "search/classic/stoppers/stoppers.h"
+#include "utils/logging.h"
 
 namespace lczero {
 namespace classic {
@@ -55,6 +58,63 @@ std::optional<float> StoppersHints::GetEstimatedNps() const {
   return estimated_nps_;
 }
 
+namespace {
+// Added to the largest measured overhead, to cover what the last moves didn't
+// show.
+constexpr int64_t kMoveOverheadMarginMs = 10;
+}  // namespace
+
+void MoveOverheadEstimator::OnGo(const GoParams& params,
+                                 const Position& position) {
+  Mutex::Lock lock(mutex_);
+  const bool is_black = position.IsBlackToMove();
+  const auto& time = is_black ? params.btime : params.wtime;
+  const auto& inc = is_black ? params.binc : params.winc;
+  const int ply = position.GetGamePly();
+  if (pending_ && time && pending_->ply + 2 == ply &&
+      pending_->search_time_ms >= 0) {
+    // The clock after the move, with the increment added by the GUI.
+    const int64_t move_time =
+        pending_->clock_ms + pending_->increment_ms - *time;
+    // Otherwise the clock was reset, e.g. by a new time control period.
+    if (move_time >= 0 && move_time <= pending_->clock_ms) {
+      const int64_t overhead =
+          std::max<int64_t>(0, move_time - pending_->search_time_ms) +
+          pending_->max_check_gap_ms;
+      if (samples_.size() < kNumSamples) {
+        samples_.push_back(overhead);
+      } else {
+        samples_[next_sample_] = overhead;
+      }
+      next_sample_ = (next_sample_ + 1) % kNumSamples;
+      LOGFILE << "Move overhead: clock " << move_time << "ms, search "
+              << pending_->search_time_ms << "ms, stop check gap "
+              << pending_->max_check_gap_ms << "ms.";
+    }
+  }
+  pending_.reset();
+  // Pondering and infinite search are not on the clock the same way.
+  if (!time || params.ponder || params.infinite) return;
+  pending_ = PendingMove{.ply = ply,
+                         .clock_ms = *time,
+                         .increment_ms = inc ? std::max<int64_t>(0, *inc) : 0};
+}
+
+void MoveOverheadEstimator::OnSearchDone(int64_t search_time_ms,
+                                         int64_t max_check_gap_ms) {
+  Mutex::Lock lock(mutex_);
+  if (!pending_) return;
+  pending_->search_time_ms = search_time_ms;
+  pending_->max_check_gap_ms = max_check_gap_ms;
+}
+
+int64_t MoveOverheadEstimator::GetOverheadMs() const {
+  Mutex::Lock lock(mutex_);
+  if (samples_.empty()) return initial_overhead_ms_;
+  return *std::max_element(samples_.begin(), samples_.end()) +
+         kMoveOverheadMarginMs;
+}
+
 void StoppersHints::Reset() {
   // Slightly more than 3 years.
   remaining_time_ms_ = 100000000000;
@@ -32,7 +32,9 @@
 #include <optional>
 #include <vector>
 
+#include "chess/position.h"
 #include "chess/uciloop.h"
+#include "utils/mutex.h"
 #include "utils/optionsdict.h"
 
 namespace lczero {
@@ -101,6 +103,48 @@ class SearchStopper {
   virtual void OnSearchDone(const IterationStats&) {}
 };
 
+// Measures the move overhead of the session: the part of a move which is on
+// the clock but not in the search (the engine finishing the move, the
+// communication with the GUI, the GUI itself). It's the time the clock of the
+// engine lost on a move, as the GUI reports it on the next move, minus the
+// time the search took.
+class MoveOverheadEstimator {
+ public:
+  // @initial_overhead_ms is used until the first move is measured.
+  explicit MoveOverheadEstimator(int64_t initial_overhead_ms)
+      : initial_overhead_ms_(initial_overhead_ms) {}
+
+  // Called on every search start. Measures the previous move if this is the
+  // next move of the same side in the game.
+  void OnGo(const GoParams& params, const Position& position);
+  // Called when the search is done after @search_time_ms. @max_check_gap_ms is
+  // the longest time between the stop checks, which is how late the search
+  // may notice it has to stop.
+  void OnSearchDone(int64_t search_time_ms, int64_t max_check_gap_ms);
+  // Returns the move overhead to plan the next move with.
+  int64_t GetOverheadMs() const;
+
+ private:
+  // Number of the last moves the overhead is taken from.
+  static constexpr size_t kNumSamples = 16;
+
+  // The previous move, until it's measured.
+  struct PendingMove {
+    int ply;
+    int64_t clock_ms;
+    int64_t increment_ms;
+    int64_t search_time_ms = -1;
+    int64_t max_check_gap_ms = 0;
+  };
+
+  const int64_t initial_overhead_ms_;
+  mutable Mutex mutex_;
+  // Overheads of the last moves, including the stop check gaps. Ring buffer.
+  std::vector<int64_t> samples_ GUARDED_BY(mutex_);
+  size_t next_sample_ GUARDED_BY(mutex_) = 0;
+  std::optional<PendingMove> pending_ GUARDED_BY(mutex_);
+};
+
 class TimeManager {
  public:
   virtual ~TimeManager() = default;
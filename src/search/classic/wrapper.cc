@@ -25,12 +25,19 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <iomanip>
+#include <sstream>
+
 #include "chess/gamestate.h"
+#include "neural/memory_budget.h"
+#include "search/classic/idle_prefetch.h"
 #include "search/classic/search.h"
 #include "search/classic/stoppers/factory.h"
 #include "search/register.h"
 #include "search/search.h"
 #include "src/neural/shared_params.h"
+#include "utils/filesystem.h"
+#include "utils/hashcat.h"
 
 namespace lczero {
 namespace classic {
@@ -48,13 +55,55 @@ const OptionId kClearTree{
      .uci_option = "ClearTree",
      .help_text = "Clear the tree before the next search.",
      .visibility = OptionId::kProOnly}};
+const OptionId kIdlePrefetchId{
+    {.long_flag = "idle-prefetch",
+     .uci_option = "IdlePrefetch",
+     .help_text =
+         "After a search, evaluate up to this many likely next positions at "
+         "low priority while the engine waits (e.g. for the opponent's move), "
+         "so that they are in the NN cache for the next search. 0 to disable.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kIdleSolidTreeThresholdId{
+    {.long_flag = "idle-solid-tree-threshold",
+     .uci_option = "IdleSolidTreeThreshold",
+     .help_text =
+         "After a search, make the children of the nodes with at least this "
+         "many visits solid (contiguous in memory) while the engine waits, the "
+         "most visited first. Catches the nodes the search couldn't make "
+         "solid because of visits in flight. 0 to disable.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kTreeSnapshotDirId{
+    {.long_flag = "tree-snapshot-dir",
+     .uci_option = "TreeSnapshotDir",
+     .help_text =
+         "Directory to save large search trees to when they are discarded "
+         "(on ucinewgame, when an unrelated position is set, or on exit), and "
+         "to restore them from when the same position is set again. Empty to "
+         "disable.",
+     .visibility = OptionId::kProOnly}};
+const OptionId kTreeSnapshotMinVisitsId{
+    {.long_flag = "tree-snapshot-min-visits",
+     .uci_option = "TreeSnapshotMinVisits",
+     .help_text = "Smallest number of visits of a tree to save it.",
+     .visibility = OptionId::kProOnly}};
 
 class ClassicSearch : public SearchBase {
  public:
   ClassicSearch(UciResponder* responder, const OptionsDict* options)
       : SearchBase(responder), options_(options) {}
+  ~ClassicSearch() {
+    idle_prefetcher_.Stop();
+    search_.reset();
+    MaybeSaveTree();
+  }
 
  private:
+  // Saves the tree to TreeSnapshotDir if it's enabled and the tree is large
+  // enough. The search must be stopped.
+  void MaybeSaveTree();
+  // Restores the tree of the current position from TreeSnapshotDir if there
+  // is one.
+  void MaybeRestoreTree();
   void NewGame() override;
   void SetPosition(const GameState& pos) override;
   void StartSearch(const GoParams&) override;
@@ -69,6 +118,11 @@ class ClassicSearch : public SearchBase {
   }
   void AbortSearch() override {
     if (search_) search_->Abort();
+    idle_prefetcher_.Stop();
+  }
+  void SetBackend(Backend* backend) override {
+    idle_prefetcher_.Stop();
+    SearchBase::SetBackend(backend);
   }
 
   const OptionsDict* options_;
@@ -76,6 +130,8 @@ class ClassicSearch : public SearchBase {
   std::unique_ptr<Search> search_;
   std::unique_ptr<NodeTree> tree_;
   std::optional<std::chrono::steady_clock::time_point> move_start_time_;
+  // Uses search_, tree_ and backend_, so is stopped before they change.
+  IdlePrefetcher idle_prefetcher_;
 };
 
 MoveList StringsToMovelist(const std::vector<std::string>& moves,
@@ -96,25 +152,94 @@ MoveList StringsToMovelist(const std::vector<std::string>& moves,
   return result;
 }
 
+// Snapshot file of the game which leads to the current position of @tree.
+std::string TreeSnapshotPath(const std::string& dir, const NodeTree& tree) {
+  uint64_t hash = tree.GetPositionHistory().Starting().Hash();
+  for (const Move move : tree.GetMoves()) hash = HashCat(hash, move.raw_data());
+  std::ostringstream path;
+  path << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash
+       << ".lc0tree";
+  return path.str();
+}
+
+void ClassicSearch::MaybeSaveTree() {
+  const std::string dir = options_->Get<std::string>(kTreeSnapshotDirId);
+  if (dir.empty() || !tree_ || !tree_->GetCurrentHead()) return;
+  const uint32_t visits = tree_->GetCurrentHead()->GetN();
+  if (visits == 0 ||
+      visits < static_cast<uint32_t>(
+                   options_->Get<int>(kTreeSnapshotMinVisitsId))) {
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const std::string path = TreeSnapshotPath(dir, *tree_);
+  try {
+    CreateDirectory(dir);
+    tree_->SaveSnapshot(path);
+    LOGFILE << "Saved the tree with " << visits << " visits to " << path
+            << " in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << "ms.";
+  } catch (const Exception& e) {
+    CERR << "Failed to save the tree: " << e.what();
+  }
+}
+
+void ClassicSearch::MaybeRestoreTree() {
+  const std::string dir = options_->Get<std::string>(kTreeSnapshotDirId);
+  if (dir.empty()) return;
+  const std::string path = TreeSnapshotPath(dir, *tree_);
+  if (GetFileSize(path) == 0) return;
+  const auto start = std::chrono::steady_clock::now();
+  try {
+    if (!tree_->LoadSnapshot(path)) return;
+    LOGFILE << "Restored the tree with " << tree_->GetCurrentHead()->GetN()
+            << " visits from " << path << " in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << "ms.";
+  } catch (const Exception& e) {
+    CERR << "Failed to restore the tree: " << e.what();
+  }
+}
+
 void ClassicSearch::NewGame() {
+  idle_prefetcher_.Stop();
   search_.reset();
+  MaybeSaveTree();
   tree_.reset();
   time_manager_ = MakeTimeManager(*options_);
 }
 
 void ClassicSearch::SetPosition(const GameState& pos) {
+  idle_prefetcher_.Stop();
   if (!tree_) tree_ = std::make_unique<NodeTree>();
+  if (!tree_->IsContinuedBy(pos)) MaybeSaveTree();
+  const auto start = std::chrono::steady_clock::now();
   const bool is_same_game = tree_->ResetToPosition(pos);
-  if (!is_same_game) time_manager_ = MakeTimeManager(*options_);
+  if (!is_same_game) {
+    time_manager_ = MakeTimeManager(*options_);
+    MaybeRestoreTree();
+  }
+  LOGFILE << "Position set in "
+          << std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+          << "us, reusing " << tree_->GetCurrentHead()->GetN()
+          << " visits of the previous tree.";
 }
 
 void ClassicSearch::StartSearch(const GoParams& params) {
+  idle_prefetcher_.Stop();
   auto forwarder =
       std::make_unique<NonOwningUciRespondForwarder>(uci_responder_);
   if (options_->Get<Button>(kClearTree).TestAndReset()) tree_->TrimTreeAtHead();
 
-  const auto cache_size =
-      options_->Get<int>(SharedBackendParams::kNNCacheSizeId);
+  const MemoryBudget budget = GetMemoryBudget(*options_);
+  const auto cache_size = budget.nn_cache_entries;
   const size_t kAvgNodeSize =
       sizeof(Node) + MemoryWatchingStopper::kAvgMovesPerPosition * sizeof(Edge);
   const size_t kAvgCacheItemSize =
@@ -134,6 +259,9 @@ void ClassicSearch::StartSearch(const GoParams& params) {
   LOGFILE << "Timer started at "
           << FormatTime(SteadyClockToSystemClock(*move_start_time_));
   search_->StartThreads(options_->Get<int>(kThreadsOptionId));
+  idle_prefetcher_.Start(search_.get(), tree_.get(), backend_,
+                         options_->Get<int>(kIdlePrefetchId),
+                         options_->Get<int>(kIdleSolidTreeThresholdId));
 }
 
 class ClassicSearchFactory : public SearchFactory {
@@ -149,6 +277,10 @@ class ClassicSearchFactory : public SearchFactory {
     PopulateTimeManagementOptions(RunType::kUci, parser);
 
     parser->Add<ButtonOption>(kClearTree);
+    parser->Add<IntOption>(kIdlePrefetchId, 0, 100000) = 0;
+    parser->Add<IntOption>(kIdleSolidTreeThresholdId, 0, 2000000000) = 0;
+    parser->Add<StringOption>(kTreeSnapshotDirId);
+    parser->Add<IntOption>(kTreeSnapshotMinVisitsId, 0, 2000000000) = 100000;
   }
 };
 
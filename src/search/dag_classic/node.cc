@@ -31,11 +31,13 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <list>
 #include <sstream>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include "utils/exception.h"
 #include "utils/hashcat.h"
@@ -43,6 +45,153 @@
 namespace lczero {
 namespace dag_classic {
 
+/////////////////////////////////////////////////////////////////////////
+// LowNodePtr
+/////////////////////////////////////////////////////////////////////////
+
+namespace {
+// Free blocks move between the thread caches and the shared pool in batches of
+// this size. New blocks are allocated a batch at a time too.
+constexpr size_t kBlockBatchSize = 256;
+
+// Free blocks shared by all threads. Blocks are never returned to the system.
+template <typename Block>
+class BlockPool {
+ public:
+  // Never destroyed, as blocks may be freed during the static destruction.
+  static BlockPool* Get() {
+    static BlockPool* pool = new BlockPool();
+    return pool;
+  }
+
+  // Moves @count free blocks to @out, allocating new ones if needed.
+  void Take(Block** out, size_t count) {
+    Mutex::Lock lock(mutex_);
+    if (free_.size() < count) {
+      Block* batch = new Block[kBlockBatchSize];
+      for (size_t i = 0; i < kBlockBatchSize; ++i) {
+        free_.push_back(batch + kBlockBatchSize - 1 - i);
+      }
+    }
+    std::copy(free_.end() - count, free_.end(), out);
+    free_.resize(free_.size() - count);
+    in_use_.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  void Put(Block* const* blocks, size_t count) {
+    Mutex::Lock lock(mutex_);
+    free_.insert(free_.end(), blocks, blocks + count);
+    in_use_.fetch_sub(count, std::memory_order_relaxed);
+  }
+
+  size_t GetInUse() const { return in_use_.load(std::memory_order_relaxed); }
+
+ private:
+  Mutex mutex_;
+  std::vector<Block*> free_ GUARDED_BY(mutex_);
+  std::atomic<size_t> in_use_ = 0;
+};
+
+// Free blocks of the thread, up to two batches. Trivially destructible, so
+// that it's still usable while the thread exits.
+template <typename Block>
+struct BlockThreadCache {
+  enum State : char { kUninitialized, kActive, kExited };
+  State state = kUninitialized;
+  size_t count = 0;
+  Block* blocks[2 * kBlockBatchSize];
+};
+template <typename Block>
+thread_local BlockThreadCache<Block> tls_block_cache;
+
+// Returns the cached blocks of the thread to the shared pool on thread exit.
+template <typename Block>
+struct BlockThreadCacheFlusher {
+  ~BlockThreadCacheFlusher() {
+    BlockThreadCache<Block>& cache = tls_block_cache<Block>;
+    BlockPool<Block>::Get()->Put(cache.blocks, cache.count);
+    cache.count = 0;
+    cache.state = BlockThreadCache<Block>::kExited;
+  }
+};
+
+template <typename Block>
+BlockThreadCache<Block>* GetBlockThreadCache() {
+  BlockThreadCache<Block>& cache = tls_block_cache<Block>;
+  if (cache.state == BlockThreadCache<Block>::kActive) return &cache;
+  // Don't cache anything after the thread exits, nothing would return it.
+  if (cache.state == BlockThreadCache<Block>::kExited) return nullptr;
+  thread_local BlockThreadCacheFlusher<Block> flusher;
+  (void)flusher;
+  cache.state = BlockThreadCache<Block>::kActive;
+  return &cache;
+}
+
+template <typename Block>
+Block* AllocateFromPool() {
+  BlockThreadCache<Block>* cache = GetBlockThreadCache<Block>();
+  if (!cache) {
+    Block* block;
+    BlockPool<Block>::Get()->Take(&block, 1);
+    return block;
+  }
+  if (cache->count == 0) {
+    BlockPool<Block>::Get()->Take(cache->blocks, kBlockBatchSize);
+    cache->count = kBlockBatchSize;
+  }
+  return cache->blocks[--cache->count];
+}
+
+template <typename Block>
+void FreeToPool(Block* block) {
+  BlockThreadCache<Block>* cache = GetBlockThreadCache<Block>();
+  if (!cache) {
+    BlockPool<Block>::Get()->Put(&block, 1);
+    return;
+  }
+  if (cache->count == 2 * kBlockBatchSize) {
+    cache->count -= kBlockBatchSize;
+    BlockPool<Block>::Get()->Put(cache->blocks + cache->count,
+                                 kBlockBatchSize);
+  }
+  cache->blocks[cache->count++] = block;
+}
+
+// A pool block holding a Node.
+struct NodeBlock {
+  alignas(Node) unsigned char storage[sizeof(Node)];
+};
+static_assert(sizeof(NodeBlock) == sizeof(Node));
+}  // namespace
+
+size_t LowNodePtr::GetBlocksInUse() {
+  return BlockPool<LowNodeBlock>::Get()->GetInUse();
+}
+
+void* LowNodePtr::AllocateBlock() { return AllocateFromPool<LowNodeBlock>(); }
+
+void LowNodePtr::FreeBlock(void* block) {
+  FreeToPool(static_cast<LowNodeBlock*>(block));
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Node allocation
+/////////////////////////////////////////////////////////////////////////
+
+void* Node::operator new(size_t size) {
+  assert(size == sizeof(Node));
+  (void)size;
+  return AllocateFromPool<NodeBlock>()->storage;
+}
+
+void Node::operator delete(void* ptr) {
+  if (ptr) FreeToPool(reinterpret_cast<NodeBlock*>(ptr));
+}
+
+size_t Node::GetBlocksInUse() {
+  return BlockPool<NodeBlock>::Get()->GetInUse();
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Edge
 /////////////////////////////////////////////////////////////////////////
@@ -420,10 +569,10 @@ void Node::ReleaseChildrenExceptOne(
   }
 }
 
-void Node::SetLowNode(std::shared_ptr<LowNode> low_node) {
+void Node::SetLowNode(LowNodePtr low_node) {
   assert(!low_node_);
   low_node->AddParent();
-  low_node_ = low_node;
+  low_node_ = std::move(low_node);
 }
 void Node::UnsetLowNode() {
   if (low_node_) low_node_->RemoveParent();
@@ -708,6 +857,27 @@ bool NodeTree::ResetToPosition(const std::string& starting_fen,
   return ResetToPosition(state);
 }
 
+void CollectTreeStats(const Node* root, TreeStats* stats) {
+  std::unordered_set<const LowNode*> seen;
+  // Breadth first, so that low nodes are expanded from their smallest depth.
+  std::deque<std::pair<const Node*, size_t>> queue = {{root, 0}};
+  while (!queue.empty()) {
+    const auto [node, depth] = queue.front();
+    queue.pop_front();
+    stats->nodes.Add(1, sizeof(Node));
+    stats->AddNode(depth, node->GetN());
+    const LowNode* low_node = node->GetLowNode().get();
+    if (!low_node || !seen.insert(low_node).second) continue;
+    stats->low_nodes.Add(1, sizeof(LowNodeBlock));
+    stats->edges.Add(low_node->GetNumEdges(), sizeof(Edge));
+    stats->AddExpandedNode(low_node->GetNumEdges());
+    for (const auto& edge : node->Edges()) {
+      if (edge.node() == nullptr) break;
+      queue.emplace_back(edge.node(), depth + 1);
+    }
+  }
+}
+
 void NodeTree::DeallocateTree() {
   released_nodes_.emplace_back(std::move(gamebegin_node_));
   // Free all released nodes.
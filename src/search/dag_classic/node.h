@@ -27,20 +27,22 @@
 
 #pragma once
 
-#include <absl/container/flat_hash_map.h>
-
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstring>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <utility>
 
 #include "chess/board.h"
 #include "chess/callbacks.h"
 #include "chess/gamestate.h"
 #include "chess/position.h"
 #include "neural/backend.h"
+#include "search/tree_stats.h"
 #include "utils/mutex.h"
 
 namespace lczero {
@@ -164,6 +166,55 @@ template <bool is_const>
 class VisitedNode_Iterator;
 
 class LowNode;
+// Owning pointer to a LowNode with an intrusive reference count. Low nodes are
+// allocated from a pool of blocks which are only ever reused for other low
+// nodes, and every block keeps the reference count and a generation next to
+// its low node. So a raw pointer together with the generation can be kept as
+// a weak reference (e.g. in the transposition table), see TryAcquire().
+class LowNodePtr {
+ public:
+  LowNodePtr() = default;
+  LowNodePtr(std::nullptr_t) {}
+  LowNodePtr(const LowNodePtr& other);
+  LowNodePtr(LowNodePtr&& other) noexcept
+      : node_(std::exchange(other.node_, nullptr)) {}
+  LowNodePtr& operator=(LowNodePtr other) noexcept {
+    std::swap(node_, other.node_);
+    return *this;
+  }
+  ~LowNodePtr() { reset(); }
+
+  // Creates a low node in a pool block.
+  template <typename... Args>
+  static LowNodePtr Make(Args&&... args);
+  // Returns a pointer to @node if it's alive and is the same low node which
+  // had @generation, nullptr otherwise.
+  static LowNodePtr TryAcquire(LowNode* node, uint32_t generation);
+  // Same check as TryAcquire(), without taking a reference.
+  static bool IsAlive(const LowNode* node, uint32_t generation);
+  // Number of pool blocks taken by the live low nodes and the thread caches.
+  static size_t GetBlocksInUse();
+
+  LowNode* get() const { return node_; }
+  LowNode* operator->() const { return node_; }
+  LowNode& operator*() const { return *node_; }
+  explicit operator bool() const { return node_ != nullptr; }
+  bool operator==(const LowNodePtr& other) const = default;
+  void reset();
+  // Generation of the block of the low node, which changes when the low node
+  // is destroyed.
+  uint32_t GetGeneration() const;
+
+ private:
+  // Takes over a reference which is already counted.
+  explicit LowNodePtr(LowNode* node) : node_(node) {}
+
+  static void* AllocateBlock();
+  static void FreeBlock(void* block);
+
+  LowNode* node_ = nullptr;
+};
+
 class Node {
  public:
   using Iterator = Edge_Iterator<false>;
@@ -186,6 +237,14 @@ class Node {
         repetition_(false) {}
   ~Node() { UnsetLowNode(); }
 
+  // Nodes are allocated from a pool of blocks, in the same way as low nodes,
+  // as there is one per visited edge. This avoids the allocator overhead per
+  // node and keeps the siblings close together in memory.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+  // Number of pool blocks taken by the live nodes and the thread caches.
+  static size_t GetBlocksInUse();
+
   // Trim node, resetting everything except parent, sibling, edge and index.
   void Trim();
 
@@ -193,8 +252,7 @@ class Node {
   // before that.
   Node* CreateSingleChildNode(Move move) {
     assert(!low_node_);
-    auto low_node = std::make_shared<LowNode>(MoveList({move}), 0);
-    SetLowNode(low_node);
+    SetLowNode(LowNodePtr::Make(MoveList({move}), 0));
     return GetChild();
   }
 
@@ -287,9 +345,9 @@ class Node {
   float GetP() const { return edge_.GetP(); }
   void SetP(float val) { edge_.SetP(val); }
 
-  std::shared_ptr<LowNode> GetLowNode() const { return low_node_; }
+  const LowNodePtr& GetLowNode() const { return low_node_; }
 
-  void SetLowNode(std::shared_ptr<LowNode> low_node);
+  void SetLowNode(LowNodePtr low_node);
   void UnsetLowNode();
 
   // Debug information about the node.
@@ -321,11 +379,10 @@ class Node {
   // padding when new fields are added, we arrange the fields by size, largest
   // to smallest.
 
-  // 16 byte fields on 64-bit platforms, 8 byte on 32-bit.
-  // Shared pointer to the low node.
-  std::shared_ptr<LowNode> low_node_;
-
   // 8 byte fields.
+  // Pointer to the low node.
+  LowNodePtr low_node_;
+
   // Average value (from value head of neural network) of all visited nodes in
   // subtree. For terminal nodes, eval is stored. This is from the perspective
   // of the player who "just" moved to reach this position, rather than from
@@ -560,6 +617,70 @@ class LowNode {
 // Check that LowNode still fits into an expected cache line size.
 static_assert(sizeof(LowNode) <= 64, "LowNode is too large");
 
+// A pool block holding a LowNode. The counters stay valid after the low node
+// is destroyed, as the block memory is never freed or used for anything else.
+struct LowNodeBlock {
+  alignas(LowNode) unsigned char storage[sizeof(LowNode)];
+  std::atomic<uint32_t> ref_count = 0;
+  // Incremented every time the low node in the block is destroyed.
+  std::atomic<uint32_t> generation = 0;
+
+  static LowNodeBlock* Of(const LowNode* node) {
+    return reinterpret_cast<LowNodeBlock*>(const_cast<LowNode*>(node));
+  }
+};
+
+template <typename... Args>
+LowNodePtr LowNodePtr::Make(Args&&... args) {
+  auto* block = static_cast<LowNodeBlock*>(AllocateBlock());
+  LowNode* node = new (block->storage) LowNode(std::forward<Args>(args)...);
+  block->ref_count.store(1, std::memory_order_relaxed);
+  return LowNodePtr(node);
+}
+
+inline LowNodePtr::LowNodePtr(const LowNodePtr& other) : node_(other.node_) {
+  if (node_) {
+    LowNodeBlock::Of(node_)->ref_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline void LowNodePtr::reset() {
+  if (!node_) return;
+  LowNodeBlock* block = LowNodeBlock::Of(node_);
+  if (block->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    node_->~LowNode();
+    block->generation.fetch_add(1, std::memory_order_release);
+    FreeBlock(block);
+  }
+  node_ = nullptr;
+}
+
+inline uint32_t LowNodePtr::GetGeneration() const {
+  return LowNodeBlock::Of(node_)->generation.load(std::memory_order_relaxed);
+}
+
+inline bool LowNodePtr::IsAlive(const LowNode* node, uint32_t generation) {
+  const LowNodeBlock* block = LowNodeBlock::Of(node);
+  return block->ref_count.load(std::memory_order_acquire) > 0 &&
+         block->generation.load(std::memory_order_acquire) == generation;
+}
+
+inline LowNodePtr LowNodePtr::TryAcquire(LowNode* node, uint32_t generation) {
+  LowNodeBlock* block = LowNodeBlock::Of(node);
+  uint32_t refs = block->ref_count.load(std::memory_order_relaxed);
+  do {
+    if (refs == 0) return nullptr;
+  } while (!block->ref_count.compare_exchange_weak(
+      refs, refs + 1, std::memory_order_acquire, std::memory_order_relaxed));
+  LowNodePtr result(node);
+  // The block may have been reused for another low node meanwhile, then the
+  // reference is dropped again.
+  if (block->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  return result;
+}
+
 // Contains Edge and Node pair and set of proxy functions to simplify access
 // to them.
 class EdgeAndNode {
@@ -816,9 +937,10 @@ inline VisitedNode_Iterator<false> Node::VisitedNodes() {
   return {this->GetLowNode().get()};
 }
 
-// Transposition Table type for holding references to all low nodes in DAG.
-typedef absl::flat_hash_map<uint64_t, std::weak_ptr<LowNode>>
-    TranspositionTable;
+// Walks the graph under @root, which must not change meanwhile, and adds its
+// nodes, low nodes and edges to @stats. Low nodes are counted once, at the
+// smallest depth they are reached at.
+void CollectTreeStats(const Node* root, TreeStats* stats);
 
 class NodeTree {
  public:
@@ -0,0 +1,50 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "search/dag_classic/params.h"
+
+#include "neural/memory_budget.h"
+
+namespace lczero {
+namespace dag_classic {
+
+void SearchParams::Populate(OptionsParser* options) {
+  BaseSearchParams::Populate(options);
+  // Same option as in the classic search, the DAG is pruned the same way.
+  options->Add<IntOption>(classic::SearchParams::kTreeMemoryLimitId, 0,
+                          100000000) = 0;
+}
+
+SearchParams::SearchParams(const OptionsDict& options)
+    : BaseSearchParams(options),
+      kTreeMemoryLimitMb(
+          GetMemoryBudget(options).IsSet()
+              ? GetMemoryBudget(options).tree_mb
+              : options.Get<int>(classic::SearchParams::kTreeMemoryLimitId)) {}
+
+}  // namespace dag_classic
+}  // namespace lczero
@@ -33,7 +33,21 @@ namespace lczero {
 namespace dag_classic {
 
 using ContemptMode = classic::ContemptMode;
-using SearchParams = classic::BaseSearchParams;
+
+class SearchParams : public classic::BaseSearchParams {
+ public:
+  SearchParams(const OptionsDict& options);
+  SearchParams(const SearchParams&) = delete;
+
+  // Populates UciOptions with search parameters.
+  static void Populate(OptionsParser* options);
+
+  // Parameter getters.
+  int GetTreeMemoryLimitMb() const { return kTreeMemoryLimitMb; }
+
+ private:
+  const int kTreeMemoryLimitMb;
+};
 
 }  // namespace dag_classic
 }  // namespace lczero
@@ -36,7 +36,10 @@
 #include <iterator>
 #include <sstream>
 #include <thread>
+#include <unordered_set>
 
+#include "neural/memcache.h"
+#include "search/classic/stoppers/stoppers.h"
 #include "search/dag_classic/node.h"
 #include "utils/fastmath.h"
 #include "utils/random.h"
@@ -171,15 +174,23 @@ Search::Search(const NodeTree& tree, Backend* backend,
           searchmoves_, syzygy_tb_, played_history_,
           params_.GetSyzygyFastPlay(), &tb_hits_, &root_is_in_dtz_)),
       uci_responder_(std::move(uci_responder)) {
-  // Evict expired entries from the transposition table.
-  // Garbage collection may lead to expiration at any time so this is not
-  // enough to prevent expired entries later during the search.
-  absl::erase_if(*tt_, [](const auto& item) { return item.second.expired(); });
-
   if (params_.GetMaxConcurrentSearchers() != 0) {
     pending_searchers_.store(params_.GetMaxConcurrentSearchers(),
                              std::memory_order_release);
   }
+  if (!searchmoves_.empty() && root_node_->GetN() > 0) {
+    // The tree is kept between the searches of different searchmoves, but
+    // only the visits to the searched moves count towards the limits.
+    initial_visits_ = 1;
+    for (auto& edge : root_node_->Edges()) {
+      if (std::find(searchmoves_.begin(), searchmoves_.end(),
+                    edge.GetMove()) != searchmoves_.end()) {
+        initial_visits_ += edge.GetN();
+      }
+    }
+    LOGFILE << "Reusing " << initial_visits_ << " of " << root_node_->GetN()
+            << " root visits for the searchmoves.";
+  }
   contempt_mode_ = params_.GetContemptMode();
   // Make sure the contempt mode is never "play" beyond this point.
   if (contempt_mode_ == ContemptMode::PLAY) {
@@ -205,14 +216,10 @@ Search::Search(const NodeTree& tree, Backend* backend,
 
 namespace {
 void ApplyDirichletNoise(Node* node, float eps, double alpha) {
+  std::vector<float> noise(node->GetNumEdges());
+  Random::Get().GetGammas(alpha, noise.data(), noise.size());
   float total = 0;
-  std::vector<float> noise;
-
-  for (int i = 0; i < node->GetNumEdges(); ++i) {
-    float eta = Random::Get().GetGamma(alpha, 1.0);
-    noise.emplace_back(eta);
-    total += eta;
-  }
+  for (float eta : noise) total += eta;
 
   if (total < std::numeric_limits<float>::min()) return;
 
@@ -613,6 +620,25 @@ void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
   }
 }
 
+void Search::SendTreeStats() const REQUIRES(nodes_mutex_) {
+  TreeStats stats;
+  CollectTreeStats(root_node_, &stats);
+  stats.tt_entries.count = tt_->GetSize();
+  stats.tt_entries.bytes =
+      tt_->GetCapacity() * TranspositionTable::BytesPerEntry();
+  stats.tt_capacity = tt_->GetCapacity();
+  if (const auto* cache = dynamic_cast<const CachingBackend*>(backend_)) {
+    const CachingBackend::CacheStats cache_stats = cache->GetCacheStats();
+    stats.nn_cache_entries = cache_stats.entries;
+    stats.nn_cache_capacity = cache_stats.capacity;
+  }
+  std::vector<ThinkingInfo> infos;
+  for (const auto& line : FormatTreeStats(stats)) {
+    infos.emplace_back().comment = line;
+  }
+  uci_responder_->OutputThinkingInfo(&infos);
+}
+
 void Search::MaybeTriggerStop(const classic::IterationStats& stats,
                               classic::StoppersHints* hints) {
   hints->Reset();
@@ -636,6 +662,7 @@ void Search::MaybeTriggerStop(const classic::IterationStats& stats,
     SendUciInfo();
     EnsureBestMoveKnown();
     SendMovesStats();
+    if (params_.GetTreeStats()) SendTreeStats();
     BestMoveInfo info(final_bestmove_, final_pondermove_);
     uci_responder_->OutputBestMove(&info);
     stopper_->OnSearchDone(stats);
@@ -722,6 +749,78 @@ void Search::EnsureBestMoveKnown() REQUIRES(nodes_mutex_)
   }
 }
 
+namespace {
+// Returns whether the child @a is preferred to @b as the best move:
+// * Prefer shorter terminal wins / avoid shorter terminal losses.
+// * Largest number of playouts.
+// * If two nodes have equal number:
+//   * If that number is 0, the one with larger prior wins.
+//   * If that number is larger than 0, the one with larger eval wins.
+bool IsPreferredChild(const EdgeAndNode& a, const EdgeAndNode& b,
+                      float draw_score) {
+  // Lists edge types from less desirable to more desirable.
+  enum EdgeRank {
+    kTerminalLoss,
+    kTablebaseLoss,
+    kNonTerminal,  // Non terminal or terminal draw.
+    kTablebaseWin,
+    kTerminalWin,
+  };
+
+  auto GetEdgeRank = [](const EdgeAndNode& edge) {
+    // This default isn't used as wl only checked for case edge is
+    // terminal.
+    const auto wl = edge.GetWL(0.0f);
+    // Not safe to access IsTerminal if GetN is 0.
+    if (edge.GetN() == 0 || !edge.IsTerminal() || !wl) {
+      return kNonTerminal;
+    }
+    if (edge.IsTbTerminal()) {
+      return wl < 0.0 ? kTablebaseLoss : kTablebaseWin;
+    }
+    return wl < 0.0 ? kTerminalLoss : kTerminalWin;
+  };
+
+  // If moves have different outcomes, prefer better outcome.
+  const auto a_rank = GetEdgeRank(a);
+  const auto b_rank = GetEdgeRank(b);
+  if (a_rank != b_rank) return a_rank > b_rank;
+
+  // If both are terminal draws, try to make it shorter.
+  // Not safe to access IsTerminal if GetN is 0.
+  if (a_rank == kNonTerminal && a.GetN() != 0 && b.GetN() != 0 &&
+      a.IsTerminal() && b.IsTerminal()) {
+    if (a.IsTbTerminal() != b.IsTbTerminal()) {
+      // Prefer non-tablebase draws.
+      return a.IsTbTerminal() < b.IsTbTerminal();
+    }
+    // Prefer shorter draws.
+    return a.GetM(0.0f) < b.GetM(0.0f);
+  }
+
+  // Neither is terminal, use standard rule.
+  if (a_rank == kNonTerminal) {
+    // Prefer largest playouts then eval then prior.
+    if (a.GetN() != b.GetN()) return a.GetN() > b.GetN();
+    // Default doesn't matter here so long as they are the same as either
+    // both are N==0 (thus we're comparing equal defaults) or N!=0 and
+    // default isn't used.
+    if (a.GetQ(0.0f, draw_score) != b.GetQ(0.0f, draw_score)) {
+      return a.GetQ(0.0f, draw_score) > b.GetQ(0.0f, draw_score);
+    }
+    return a.GetP() > b.GetP();
+  }
+
+  // Both variants are winning, prefer shortest win.
+  if (a_rank > kNonTerminal) {
+    return a.GetM(0.0f) < b.GetM(0.0f);
+  }
+
+  // Both variants are losing, prefer longest losses.
+  return a.GetM(0.0f) > b.GetM(0.0f);
+}
+}  // namespace
+
 // Returns @count children with most visits.
 std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
                                                               int count,
@@ -731,12 +830,7 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   if (parent->GetN() == 0) return {};
   const bool is_odd_depth = (depth % 2) == 1;
   const float draw_score = GetDrawScore(is_odd_depth);
-  // Best child is selected using the following criteria:
-  // * Prefer shorter terminal wins / avoid shorter terminal losses.
-  // * Largest number of playouts.
-  // * If two nodes have equal number:
-  //   * If that number is 0, the one with larger prior wins.
-  //   * If that number is larger than 0, the one with larger eval wins.
+  // See IsPreferredChild() for the order.
   std::vector<EdgeAndNode> edges;
   for (auto& edge : parent->Edges()) {
     if (parent == root_node_ && !root_move_filter_.empty() &&
@@ -752,68 +846,7 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   std::partial_sort(
       edges.begin(), middle, edges.end(),
       [draw_score](const auto& a, const auto& b) {
-        // The function returns "true" when a is preferred to b.
-
-        // Lists edge types from less desirable to more desirable.
-        enum EdgeRank {
-          kTerminalLoss,
-          kTablebaseLoss,
-          kNonTerminal,  // Non terminal or terminal draw.
-          kTablebaseWin,
-          kTerminalWin,
-        };
-
-        auto GetEdgeRank = [](const EdgeAndNode& edge) {
-          // This default isn't used as wl only checked for case edge is
-          // terminal.
-          const auto wl = edge.GetWL(0.0f);
-          // Not safe to access IsTerminal if GetN is 0.
-          if (edge.GetN() == 0 || !edge.IsTerminal() || !wl) {
-            return kNonTerminal;
-          }
-          if (edge.IsTbTerminal()) {
-            return wl < 0.0 ? kTablebaseLoss : kTablebaseWin;
-          }
-          return wl < 0.0 ? kTerminalLoss : kTerminalWin;
-        };
-
-        // If moves have different outcomes, prefer better outcome.
-        const auto a_rank = GetEdgeRank(a);
-        const auto b_rank = GetEdgeRank(b);
-        if (a_rank != b_rank) return a_rank > b_rank;
-
-        // If both are terminal draws, try to make it shorter.
-        // Not safe to access IsTerminal if GetN is 0.
-        if (a_rank == kNonTerminal && a.GetN() != 0 && b.GetN() != 0 &&
-            a.IsTerminal() && b.IsTerminal()) {
-          if (a.IsTbTerminal() != b.IsTbTerminal()) {
-            // Prefer non-tablebase draws.
-            return a.IsTbTerminal() < b.IsTbTerminal();
-          }
-          // Prefer shorter draws.
-          return a.GetM(0.0f) < b.GetM(0.0f);
-        }
-
-        // Neither is terminal, use standard rule.
-        if (a_rank == kNonTerminal) {
-          // Prefer largest playouts then eval then prior.
-          if (a.GetN() != b.GetN()) return a.GetN() > b.GetN();
-          // Default doesn't matter here so long as they are the same as either
-          // both are N==0 (thus we're comparing equal defaults) or N!=0 and
-          // default isn't used.
-          if (a.GetQ(0.0f, draw_score) != b.GetQ(0.0f, draw_score)) {
-            return a.GetQ(0.0f, draw_score) > b.GetQ(0.0f, draw_score);
-          }
-          return a.GetP() > b.GetP();
-        }
-
-        // Both variants are winning, prefer shortest win.
-        if (a_rank > kNonTerminal) {
-          return a.GetM(0.0f) < b.GetM(0.0f);
-        }
-
-        // Both variants are losing, prefer longest losses.
-        return a.GetM(0.0f) > b.GetM(0.0f);
+        return IsPreferredChild(a, b, draw_score);
       });
 
   if (count < static_cast<int>(edges.size())) {
@@ -822,10 +855,22 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   return edges;
 }
 
-// Returns a child with most visits.
+// Returns a child with most visits. Same as the first of
+// GetBestChildrenNoTemperature(), without collecting and sorting the edges, as
+// it's called for every node of the PVs.
 EdgeAndNode Search::GetBestChildNoTemperature(Node* parent, int depth) const {
-  auto res = GetBestChildrenNoTemperature(parent, 1, depth);
-  return res.empty() ? EdgeAndNode() : res.front();
+  if (parent->GetN() == 0) return {};
+  const float draw_score = GetDrawScore((depth % 2) == 1);
+  EdgeAndNode best;
+  for (auto& edge : parent->Edges()) {
+    if (parent == root_node_ && !root_move_filter_.empty() &&
+        std::find(root_move_filter_.begin(), root_move_filter_.end(),
+                  edge.GetMove()) == root_move_filter_.end()) {
+      continue;
+    }
+    if (!best || IsPreferredChild(edge, best, draw_score)) best = edge;
+  }
+  return best;
 }
 
 // Returns a child of a root chosen according to weighted-by-temperature visit
@@ -1008,6 +1053,7 @@ void Search::WatchdogThread() {
     PopulateCommonIterationStats(&stats);
     MaybeTriggerStop(stats, &hints);
     MaybeOutputInfo();
+    MaybePruneTree();
 
     constexpr auto kMaxWaitTimeMs = 100;
     constexpr auto kMinWaitTimeMs = 1;
@@ -1033,6 +1079,102 @@ void Search::WatchdogThread() {
   LOGFILE << "End a watchdog thread.";
 }
 
+namespace {
+// Collects the largest subtrees with at most @threshold visits which can be
+// pruned, and sums up their visits. Never prunes the principal variation and
+// the root children, so that the best move and what's shown stay intact. Low
+// nodes with several parents are not pruned, and are walked only once.
+void CollectPruneCandidates(Node* node, int depth, bool on_pv,
+                            uint32_t threshold,
+                            std::unordered_set<const LowNode*>* visited,
+                            std::vector<Node*>* candidates, uint64_t* visits) {
+  Node* pv_child = nullptr;
+  if (on_pv) {
+    for (Node* child : node->VisitedNodes()) {
+      if (!pv_child || child->GetN() > pv_child->GetN()) pv_child = child;
+    }
+  }
+  auto maybe_collect = [&](Node* child) {
+    const LowNode* low_node = child->GetLowNode().get();
+    if (!low_node || child->IsTerminal() || low_node->IsTerminal()) return;
+    const bool child_on_pv = child == pv_child;
+    if (low_node->IsTransposition()) {
+      if (!visited->insert(low_node).second) return;
+    } else if (!child_on_pv && depth >= 1 && child->GetN() <= threshold &&
+               child->GetNInFlight() == 0 &&
+               // Bounds of the ancestors may depend on the proven ones.
+               child->GetBounds() == Bounds{GameResult::BLACK_WON,
+                                            GameResult::WHITE_WON}) {
+      candidates->push_back(child);
+      *visits += child->GetN();
+      return;
+    }
+    CollectPruneCandidates(child, depth + 1, child_on_pv, threshold, visited,
+                           candidates, visits);
+  };
+  // The principal variation goes first, so that the transpositions on it are
+  // walked as a part of it.
+  if (pv_child) maybe_collect(pv_child);
+  for (Node* child : node->VisitedNodes()) {
+    if (child != pv_child) maybe_collect(child);
+  }
+}
+}  // namespace
+
+void Search::MaybePruneTree() {
+  const int64_t limit_mb = params_.GetTreeMemoryLimitMb();
+  if (limit_mb == 0) return;
+  // Every low node comes with the node pointing to it and its edges. The
+  // transposition table doesn't grow, its whole size is taken from the limit.
+  const size_t kAvgLowNodeSize =
+      sizeof(LowNodeBlock) + sizeof(Node) +
+      classic::MemoryWatchingStopper::kAvgMovesPerPosition * sizeof(Edge);
+  const int64_t tt_bytes =
+      tt_->GetCapacity() * TranspositionTable::BytesPerEntry();
+  const uint64_t max_low_nodes =
+      std::max<int64_t>(0, limit_mb * 1000000 - tt_bytes) / kAvgLowNodeSize;
+  if (LowNodePtr::GetBlocksInUse() <= max_low_nodes) return;
+  SharedMutex::Lock lock(nodes_mutex_);
+  const uint64_t low_nodes = LowNodePtr::GetBlocksInUse();
+  if (low_nodes <= max_low_nodes) return;
+  // Prune a bit more than necessary, so that it's not done after every batch.
+  const uint64_t to_free = low_nodes - max_low_nodes * 9 / 10;
+  const uint64_t root_visits = root_node_->GetN();
+  std::unordered_set<const LowNode*> visited;
+  std::vector<Node*> candidates;
+  uint64_t visits = 0;
+  // Prefer the small subtrees, and look at the larger ones only when there are
+  // not enough of them.
+  for (uint64_t threshold = std::max<uint64_t>(1, to_free / 1024);;
+       threshold *= 4) {
+    visited.clear();
+    candidates.clear();
+    visits = 0;
+    CollectPruneCandidates(root_node_, 0, true,
+                           std::min<uint64_t>(threshold, root_visits),
+                           &visited, &candidates, &visits);
+    if (visits >= to_free || threshold >= root_visits) break;
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Node* a, const Node* b) { return a->GetN() < b->GetN(); });
+  uint64_t freed = 0;
+  size_t pruned = 0;
+  for (; pruned < candidates.size() && freed < to_free; ++pruned) {
+    // The visits stay counted in the ancestors, so that the search keeps what
+    // it learned from them and the best move doesn't change. The low nodes
+    // below which are shared with the rest of the DAG stay alive.
+    freed += candidates[pruned]->GetN();
+    candidates[pruned]->Trim();
+  }
+  LOGFILE << "Tree memory limit reached, pruned " << pruned
+          << " subtrees with " << freed << " visits, "
+          << low_nodes - LowNodePtr::GetBlocksInUse() << " low nodes freed.";
+  if (freed < to_free) {
+    LOGFILE << "Nothing more to prune, stopping search.";
+    FireStopInternal();
+  }
+}
+
 void Search::FireStopInternal() {
   stop_.store(true, std::memory_order_release);
   watchdog_cv_.notify_all();
@@ -1157,6 +1299,7 @@ void SearchWorker::RunTasks(int tid) {
       }
       picking_tasks_[id].complete = true;
       completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
+      completed_tasks_.notify_one();
     }
   }
 }
@@ -1188,7 +1331,7 @@ void SearchWorker::ExecuteOneIteration() {
       int available =
           search_->pending_searchers_.load(std::memory_order_acquire);
       if (available == 0) {
-        spin_helper->Wait();
+        spin_helper->WaitWhileEqual(search_->pending_searchers_, 0);
         continue;
       }
 
@@ -1211,6 +1354,8 @@ void SearchWorker::ExecuteOneIteration() {
 
   if (params_.GetMaxConcurrentSearchers() != 0) {
     search_->pending_searchers_.fetch_add(1, std::memory_order_acq_rel);
+    // All, as a woken thread that sees the search stopped leaves the slot.
+    search_->pending_searchers_.notify_all();
   }
 
   // 4. Run NN computation.
@@ -1289,6 +1434,9 @@ void SearchWorker::GatherMinibatch() {
     SharedMutex::Lock lock(search_->nodes_mutex_);
     cur_n = search_->root_node_->GetN();
   }
+  // Nothing can be reported before the root is evaluated.
+  computation_->SetPriority(cur_n == 0 ? ComputationPriority::kHigh
+                                       : params_.GetNNPriority());
   // TODO: GetEstimatedRemainingPlayouts has already had smart pruning factor
   // applied, which doesn't clearly make sense to include here...
   int64_t remaining_n =
@@ -1465,12 +1613,13 @@ void SearchWorker::ResetTasks() {
 }
 
 int SearchWorker::WaitForTasks() {
-  // Spin lock, other tasks should be done soon.
+  // How long to wait for the running tasks before parking.
+  constexpr int kSpinsBeforePark = 512;
   while (true) {
     int completed = completed_tasks_.load(std::memory_order_acquire);
     int todo = task_count_.load(std::memory_order_acquire);
     if (todo == completed) return completed;
-    SpinloopPause();
+    SpinThenWait(completed_tasks_, completed, kSpinsBeforePark);
   }
 }
 
@@ -1717,6 +1866,29 @@ void SearchWorker::PickNodesToExtendTask(
       const float puct_mult =
           cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
       int cache_filled_idx = -1;
+      // Edges are iterated and their scores computed lazily, in order.
+      auto fill_cache = [&](int idx) {
+        if (idx <= cache_filled_idx) return;
+        if (idx == 0) {
+          cur_iters[idx] = node->Edges();
+        } else {
+          cur_iters[idx] = cur_iters[idx - 1];
+          ++cur_iters[idx];
+        }
+        current_nstarted[idx] = cur_iters[idx].GetNStarted();
+        current_score[idx] = cur_iters[idx].GetP() * puct_mult /
+                                 (1 + current_nstarted[idx]) +
+                             current_util[idx];
+        cache_filled_idx++;
+      };
+      // Outside of the root, the edges before first_unvisited all have visits
+      // started, and the top two of them are kept between the picks. Only the
+      // picked edge changes its score, so the prefix is rescanned only when
+      // that edge was one of its top two.
+      int first_unvisited = 0;
+      int prefix_best = -1;
+      int prefix_second = -1;
+      bool prefix_stale = false;
       while (cur_limit > 0) {
         // Perform UCT for current node.
         float best = std::numeric_limits<float>::lowest();
@@ -1725,24 +1897,58 @@ void SearchWorker::PickNodesToExtendTask(
         float second_best = std::numeric_limits<float>::lowest();
         bool can_exit = false;
         best_edge.Reset();
-        for (int idx = 0; idx < max_needed; ++idx) {
-          if (idx > cache_filled_idx) {
-            if (idx == 0) {
-              cur_iters[idx] = node->Edges();
-            } else {
-              cur_iters[idx] = cur_iters[idx - 1];
-              ++cur_iters[idx];
+        if (!is_root_node) {
+          // Index order of the scores compared with strict comparisons, so
+          // that ties go to the first edge, like in a single scan.
+          auto consider = [&](int idx, int* first, int* second) {
+            if (*first < 0 || current_score[idx] > current_score[*first]) {
+              *second = *first;
+              *first = idx;
+            } else if (*second < 0 ||
+                       current_score[idx] > current_score[*second]) {
+              *second = idx;
+            }
+          };
+          // Edges which got their first visit join the prefix.
+          while (first_unvisited < max_needed) {
+            fill_cache(first_unvisited);
+            if (current_nstarted[first_unvisited] == 0) break;
+            if (!prefix_stale) {
+              consider(first_unvisited, &prefix_best, &prefix_second);
             }
-            current_nstarted[idx] = cur_iters[idx].GetNStarted();
+            ++first_unvisited;
           }
-          int nstarted = current_nstarted[idx];
-          const float util = current_util[idx];
-          if (idx > cache_filled_idx) {
-            current_score[idx] =
-                cur_iters[idx].GetP() * puct_mult / (1 + nstarted) + util;
-            cache_filled_idx++;
+          if (prefix_stale) {
+            FindTopTwo(current_score.data(), first_unvisited, &prefix_best,
+                       &prefix_second);
+            prefix_stale = false;
           }
-          if (is_root_node) {
+          int second_idx = prefix_second;
+          best_idx = prefix_best;
+          // The unvisited edges share the FPU, so with edges sorted in policy
+          // decreasing order, the one after the first unvisited one is enough
+          // to get the second best right.
+          for (int idx = first_unvisited;
+               idx < std::min(max_needed, first_unvisited + 2); ++idx) {
+            fill_cache(idx);
+            consider(idx, &best_idx, &second_idx);
+          }
+          best = current_score[best_idx];
+          best_without_u = current_util[best_idx];
+          best_edge = cur_iters[best_idx];
+          if (second_idx >= 0) {
+            second_best = current_score[second_idx];
+            second_best_edge = cur_iters[second_idx];
+          }
+          if (best_idx == prefix_best || best_idx == prefix_second) {
+            prefix_stale = true;
+          }
+        } else {
+          // Some root edges may be excluded, so compare them one by one.
+          for (int idx = 0; idx < max_needed; ++idx) {
+            fill_cache(idx);
+            int nstarted = current_nstarted[idx];
+            const float util = current_util[idx];
             // If there's no chance to catch up to the current best node with
             // remaining playouts, don't consider it.
             // best_move_node_ could have changed since best_node_n was
@@ -1759,26 +1965,26 @@ void SearchWorker::PickNodesToExtendTask(
                           cur_iters[idx].GetMove()) == root_move_filter.end()) {
               continue;
             }
-          }
 
-          float score = current_score[idx];
-          if (score > best) {
-            second_best = best;
-            second_best_edge = best_edge;
-            best = score;
-            best_idx = idx;
-            best_without_u = util;
-            best_edge = cur_iters[idx];
-          } else if (score > second_best) {
-            second_best = score;
-            second_best_edge = cur_iters[idx];
-          }
-          if (can_exit) break;
-          if (nstarted == 0) {
-            // One more loop will get 2 unvisited nodes, which is sufficient to
-            // ensure second best is correct. This relies upon the fact that
-            // edges are sorted in policy decreasing order.
-            can_exit = true;
+            float score = current_score[idx];
+            if (score > best) {
+              second_best = best;
+              second_best_edge = best_edge;
+              best = score;
+              best_idx = idx;
+              best_without_u = util;
+              best_edge = cur_iters[idx];
+            } else if (score > second_best) {
+              second_best = score;
+              second_best_edge = cur_iters[idx];
+            }
+            if (can_exit) break;
+            if (nstarted == 0) {
+              // One more loop will get 2 unvisited nodes, which is sufficient
+              // to ensure second best is correct. This relies upon the fact
+              // that edges are sorted in policy decreasing order.
+              can_exit = true;
+            }
           }
         }
         int new_visits = 0;
@@ -1926,7 +2132,7 @@ void SearchWorker::ExtendNode(NodeToProcess& picked_node) {
   // We don't need the mutex because other threads will see that N=0 and
   // N-in-flight=1 and will not touch this node.
   const auto& board = history.Last().GetBoard();
-  std::vector<Move> legal_moves = board.GenerateLegalMoves();
+  MoveList legal_moves = board.GenerateLegalMoves();
 
   // Check whether it's a draw/lose by position. Importantly, we must check
   // these before doing the by-rule checks below.
@@ -1996,16 +2202,11 @@ void SearchWorker::ExtendNode(NodeToProcess& picked_node) {
   // Check the transposition table first and NN cache second before asking for
   // NN evaluation.
   picked_node.hash = history.HashLast(params_.GetCacheHistoryLength() + 1);
-  auto tt_iter = search_->tt_->find(picked_node.hash);
-  // Transposition table entry might be expired.
-  if (tt_iter != search_->tt_->end()) {
-    picked_node.tt_low_node = tt_iter->second.lock();
-  }
+  picked_node.tt_low_node = search_->tt_->Find(picked_node.hash);
   if (picked_node.tt_low_node) {
-    assert(!tt_iter->second.expired());
     picked_node.is_tt_hit = true;
   } else {
-    picked_node.tt_low_node = std::make_shared<LowNode>(legal_moves);
+    picked_node.tt_low_node = LowNodePtr::Make(legal_moves);
     picked_node.nn_queried = true;
     picked_node.eval->p.resize(legal_moves.size());
     picked_node.is_cache_hit = computation_->AddInput(
@@ -2039,6 +2240,11 @@ void SearchWorker::RunNNComputation() {
 // 5. Retrieve NN computations (and terminal values) into nodes.
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::FetchMinibatchResults() {
+  // The low nodes of the new positions are not in the tree yet, so they are
+  // filled and put into the transposition table without holding the lock.
+  for (auto& node_to_process : minibatch_) {
+    PublishLowNode(&node_to_process);
+  }
   SharedMutex::Lock nodes_lock(search_->nodes_mutex_);
   // Populate NN/cached results, or terminal results, into nodes.
   for (auto& node_to_process : minibatch_) {
@@ -2046,55 +2252,39 @@ void SearchWorker::FetchMinibatchResults() {
   }
 }
 
+void SearchWorker::PublishLowNode(NodeToProcess* node_to_process) {
+  if (!node_to_process->nn_queried || node_to_process->is_tt_hit) return;
+  if (params_.GetWDLRescaleRatio() != 1.0f ||
+      (params_.GetWDLRescaleDiff() != 0.0f &&
+       search_->contempt_mode_ != ContemptMode::NONE)) {
+    // Check whether root moves are from the set perspective.
+    bool root_stm = search_->contempt_mode_ == ContemptMode::WHITE;
+    auto sign =
+        (root_stm ^ node_to_process->history.IsBlackToMove()) ? 1.0f : -1.0f;
+    WDLRescale(node_to_process->eval->q, node_to_process->eval->d,
+               params_.GetWDLRescaleRatio(),
+               search_->contempt_mode_ == ContemptMode::NONE
+                   ? 0
+                   : params_.GetWDLRescaleDiff(),
+               sign, false, params_.GetWDLMaxS());
+  }
+  node_to_process->tt_low_node->SetNNEval(node_to_process->eval.get());
+  node_to_process->tt_low_node->SortEdges();
+  // Another thread may have evaluated the same position meanwhile, then its
+  // low node is used.
+  node_to_process->tt_low_node = search_->tt_->Insert(
+      node_to_process->hash, node_to_process->tt_low_node);
+}
+
 void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process)
     REQUIRES(search_->nodes_mutex_) {
   if (!node_to_process->nn_queried) return;
 
-  if (!node_to_process->is_tt_hit) {
-    auto [tt_iter, is_tt_miss] = search_->tt_->insert(
-        {node_to_process->hash, node_to_process->tt_low_node});
-    auto wdl_rescale = [&]() {
-      if (params_.GetWDLRescaleRatio() != 1.0f ||
-          (params_.GetWDLRescaleDiff() != 0.0f &&
-           search_->contempt_mode_ != ContemptMode::NONE)) {
-        // Check whether root moves are from the set perspective.
-        bool root_stm = search_->contempt_mode_ == ContemptMode::WHITE;
-        auto sign = (root_stm ^ node_to_process->history.IsBlackToMove())
-                        ? 1.0f
-                        : -1.0f;
-        WDLRescale(node_to_process->eval->q, node_to_process->eval->d,
-                   params_.GetWDLRescaleRatio(),
-                   search_->contempt_mode_ == ContemptMode::NONE
-                       ? 0
-                       : params_.GetWDLRescaleDiff(),
-                   sign, false, params_.GetWDLMaxS());
-      }
-    };
-    if (is_tt_miss) {
-      assert(!tt_iter->second.expired());
-      wdl_rescale();
-      node_to_process->tt_low_node->SetNNEval(node_to_process->eval.get());
-      node_to_process->tt_low_node->SortEdges();
-    } else {
-      auto tt_low_node = tt_iter->second.lock();
-      if (!tt_low_node) {
-        tt_iter->second = node_to_process->tt_low_node;
-        wdl_rescale();
-        node_to_process->tt_low_node->SetNNEval(node_to_process->eval.get());
-        node_to_process->tt_low_node->SortEdges();
-      } else {
-        assert(!tt_iter->second.expired());
-        node_to_process->tt_low_node = tt_iter->second.lock();
-      }
-    }
-  }
-
   // Add NN results to node.
   Node* node = node_to_process->node;
   // Add Dirichlet noise if enabled and at root.
   if (params_.GetNoiseEpsilon() && node == search_->root_node_) {
-    node->SetLowNode(
-        std::make_shared<LowNode>(*node_to_process->tt_low_node.get()));
+    node->SetLowNode(LowNodePtr::Make(*node_to_process->tt_low_node));
     ApplyDirichletNoise(node, params_.GetNoiseEpsilon(),
                         params_.GetNoiseAlpha());
     node->SortEdges();
@@ -2122,7 +2312,7 @@ void SearchWorker::DoBackupUpdate() {
 }
 
 bool SearchWorker::MaybeAdjustForTerminalOrTransposition(
-    Node* n, const std::shared_ptr<LowNode>& nl, float& v, float& d, float& m,
+    Node* n, const LowNodePtr& nl, float& v, float& d, float& m,
     uint32_t& n_to_fix, float& v_delta, float& d_delta, float& m_delta,
     bool& update_parent_bounds) const {
   if (n->IsTerminal()) {
@@ -42,6 +42,7 @@
 #include "search/classic/stoppers/timemgr.h"
 #include "search/dag_classic/node.h"
 #include "search/dag_classic/params.h"
+#include "search/dag_classic/transposition_table.h"
 #include "syzygy/syzygy.h"
 #include "utils/logging.h"
 #include "utils/mutex.h"
@@ -120,8 +121,14 @@ class Search {
   void SendUciInfo();  // Requires nodes_mutex_ to be held.
   // Sets stop to true and notifies watchdog thread.
   void FireStopInternal();
+  // When the DAG is larger than TreeMemoryLimit, prunes the smallest subtrees
+  // outside of the principal variation. Stops the search if that's not
+  // possible.
+  void MaybePruneTree();
 
   void SendMovesStats() const;
+  // Walks the graph and sends the TreeStats report.
+  void SendTreeStats() const;
   // Function which runs in a separate thread and watches for time and
   // uci `stop` command;
   void WatchdogThread();
@@ -334,7 +341,7 @@ class SearchWorker {
 
     // Details that are filled in as we go.
     uint64_t hash;
-    std::shared_ptr<LowNode> tt_low_node;
+    LowNodePtr tt_low_node;
     PositionHistory history;
     bool ooo_completed = false;
 
@@ -364,7 +371,7 @@ class SearchWorker {
         auto nl = n->GetLowNode();
         oss << n << ":" << n->GetNInFlight();
         if (nl) {
-          oss << "(" << nl << ")";
+          oss << "(" << nl.get() << ")";
         }
       }
       oss << " --- " << std::get<0>(path.back())->DebugString();
@@ -446,7 +453,7 @@ class SearchWorker {
   // terminal status of node @n using information from its child low node.
   // Return true if adjustment happened.
   bool MaybeAdjustForTerminalOrTransposition(Node* n,
-                                             const std::shared_ptr<LowNode>& nl,
+                                             const LowNodePtr& nl,
                                              float& v, float& d, float& m,
                                              uint32_t& n_to_fix, float& v_delta,
                                              float& d_delta, float& m_delta,
@@ -469,6 +476,9 @@ class SearchWorker {
   bool ShouldStopPickingHere(Node* node, bool is_root_node, int repetitions);
   void ProcessPickedTask(int batch_start, int batch_end);
   void ExtendNode(NodeToProcess& picked_node);
+  // Sets the NN eval of a new low node and puts it into the transposition
+  // table. Doesn't need the nodes lock.
+  void PublishLowNode(NodeToProcess* node_to_process);
   void FetchSingleNodeResult(NodeToProcess* node_to_process);
   void RunTasks(int tid);
   void ResetTasks();
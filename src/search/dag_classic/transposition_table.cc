@@ -0,0 +1,187 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "search/dag_classic/transposition_table.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+
+#include "search/dag_classic/node.h"
+
+namespace lczero {
+namespace dag_classic {
+
+LowNodePtr TranspositionTable::Find(uint64_t key) {
+  if (slots_.empty()) return nullptr;
+  key = NonZeroKey(key);
+  for (size_t probe = 0; probe < kMaxProbes; ++probe) {
+    Slot& slot = slots_[GetSlotIndex(key, probe)];
+    const uint64_t slot_key = slot.key.load(std::memory_order_acquire);
+    // Slots are never emptied, so the key can't be further.
+    if (slot_key == 0) return nullptr;
+    if (slot_key != key) continue;
+    SpinMutex::Lock lock(slot.mutex);
+    // The slot may have been reused for another key in the meantime.
+    if (slot.key.load(std::memory_order_relaxed) != key) return nullptr;
+    if (!slot.node) return nullptr;
+    LowNodePtr node = LowNodePtr::TryAcquire(slot.node, slot.generation);
+    if (!node) slot.node = nullptr;
+    return node;
+  }
+  return nullptr;
+}
+
+LowNodePtr TranspositionTable::Insert(uint64_t key, const LowNodePtr& node) {
+  if (slots_.empty()) return node;
+  key = NonZeroKey(key);
+  for (size_t probe = 0; probe < kMaxProbes; ++probe) {
+    Slot& slot = slots_[GetSlotIndex(key, probe)];
+    uint64_t slot_key = slot.key.load(std::memory_order_acquire);
+    if (slot_key == 0 &&
+        slot.key.compare_exchange_strong(slot_key, key,
+                                         std::memory_order_acq_rel)) {
+      size_.fetch_add(1, std::memory_order_relaxed);
+      slot_key = key;
+    }
+    if (slot_key != key) continue;
+    SpinMutex::Lock lock(slot.mutex);
+    if (slot.key.load(std::memory_order_relaxed) != key) continue;
+    if (slot.node) {
+      if (auto existing = LowNodePtr::TryAcquire(slot.node, slot.generation)) {
+        return existing;
+      }
+    }
+    slot.node = node.get();
+    slot.generation = node.GetGeneration();
+    return node;
+  }
+  // The key is not in the table and all its slots are taken, reuse the first
+  // one whose low node is gone.
+  for (size_t probe = 0; probe < kMaxProbes; ++probe) {
+    Slot& slot = slots_[GetSlotIndex(key, probe)];
+    SpinMutex::Lock lock(slot.mutex);
+    if (slot.node) {
+      auto existing = LowNodePtr::TryAcquire(slot.node, slot.generation);
+      // Another thread may have added the key meanwhile.
+      if (existing && slot.key.load(std::memory_order_relaxed) == key) {
+        return existing;
+      }
+      if (existing) continue;
+    }
+    slot.key.store(key, std::memory_order_release);
+    slot.node = node.get();
+    slot.generation = node.GetGeneration();
+    return node;
+  }
+  return node;
+}
+
+void TranspositionTable::Reserve(size_t capacity) {
+  if (capacity == 0) return;
+  Mutex::Lock sweep_lock(sweep_mutex_);
+  const size_t new_size = std::bit_ceil(capacity);
+  if (new_size <= slots_.size()) return;
+  decltype(slots_) old_slots(new_size);
+  old_slots.swap(slots_);
+  size_.store(0, std::memory_order_relaxed);
+  for (Slot& slot : old_slots) {
+    const uint64_t key = slot.key.load(std::memory_order_relaxed);
+    if (key == 0) continue;
+    SpinMutex::Lock lock(slot.mutex);
+    if (!slot.node) continue;
+    if (auto node = LowNodePtr::TryAcquire(slot.node, slot.generation)) {
+      Insert(key, node);
+    }
+  }
+}
+
+void TranspositionTable::Clear() {
+  Mutex::Lock sweep_lock(sweep_mutex_);
+  for (Slot& slot : slots_) {
+    SpinMutex::Lock lock(slot.mutex);
+    slot.key.store(0, std::memory_order_relaxed);
+    slot.node = nullptr;
+  }
+  size_.store(0, std::memory_order_relaxed);
+}
+
+size_t TranspositionTable::SweepExpired(size_t max_slots) {
+  Mutex::Lock lock(sweep_mutex_);
+  return SweepExpiredLocked(max_slots);
+}
+
+size_t TranspositionTable::SweepExpiredLocked(size_t max_slots) {
+  if (slots_.empty()) return 0;
+  size_t cleared = 0;
+  max_slots = std::min(max_slots, slots_.size());
+  for (size_t i = 0; i < max_slots; ++i) {
+    if (sweep_cursor_ >= slots_.size()) sweep_cursor_ = 0;
+    Slot& slot = slots_[sweep_cursor_++];
+    if (slot.key.load(std::memory_order_relaxed) == 0) continue;
+    SpinMutex::Lock slot_lock(slot.mutex);
+    if (!slot.node || LowNodePtr::IsAlive(slot.node, slot.generation)) {
+      continue;
+    }
+    slot.node = nullptr;
+    ++cleared;
+  }
+  return cleared;
+}
+
+void TranspositionTable::StartSweeper() {
+  StopSweeper();
+  {
+    Mutex::Lock lock(sweep_mutex_);
+    stop_sweeper_ = false;
+  }
+  sweeper_ = std::thread([this]() { Sweeper(); });
+}
+
+void TranspositionTable::StopSweeper() {
+  if (!sweeper_.joinable()) return;
+  {
+    Mutex::Lock lock(sweep_mutex_);
+    stop_sweeper_ = true;
+  }
+  sweep_cv_.notify_all();
+  sweeper_.join();
+}
+
+void TranspositionTable::Sweeper() {
+  Mutex::Lock lock(sweep_mutex_);
+  while (!stop_sweeper_) {
+    sweep_cv_.wait_for(lock.get_raw(),
+                       std::chrono::milliseconds(kSweepIntervalMs));
+    if (stop_sweeper_) break;
+    SweepExpiredLocked(kSweepSlotsPerTick);
+  }
+}
+
+}  // namespace dag_classic
+}  // namespace lczero
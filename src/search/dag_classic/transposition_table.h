@@ -0,0 +1,128 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "utils/large_pages.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+namespace dag_classic {
+
+class LowNode;
+class LowNodePtr;
+
+// Transposition table holding weak references to all low nodes in the DAG,
+// keyed by position hash. Thread-safe, and doesn't need the search locks.
+// Open addressing over a slot array which is allocated up front (in large
+// pages when they are enabled). Every slot holds the full key, empty slots are
+// claimed with a CAS on the key, so probing for a key doesn't lock. The weak
+// reference (a low node pointer and its generation, see LowNodePtr) is
+// guarded by a per-slot spin lock, which is only taken when the key matches.
+// Slots are never emptied during the search. A slot whose low node has
+// expired is reused for a new key when all the slots of its probe sequence
+// are taken, and if there is no such slot Insert() doesn't store the node.
+// Expired references are cleared when a lookup comes across them, or by the
+// background sweeper which goes over a few slots at a time.
+class TranspositionTable {
+ public:
+  explicit TranspositionTable(size_t capacity = 0) { Reserve(capacity); }
+  ~TranspositionTable() { StopSweeper(); }
+
+  // Returns the low node stored under @key, or nullptr if there is none or it
+  // has expired.
+  LowNodePtr Find(uint64_t key);
+
+  // Stores @node under @key, unless there is already a live low node for that
+  // key. Returns the low node which is in the table for @key after the call
+  // (@node itself if the table is full).
+  LowNodePtr Insert(uint64_t key, const LowNodePtr& node);
+
+  // Grows the table to hold at least @capacity entries, keeping the live
+  // ones. Never shrinks. Not thread-safe.
+  void Reserve(size_t capacity);
+
+  // Drops all entries. Not thread-safe.
+  void Clear();
+
+  // Clears the expired entries among the next @max_slots slots, continuing
+  // where the previous call stopped. Returns the number of cleared entries.
+  size_t SweepExpired(size_t max_slots);
+  // Starts a thread which calls SweepExpired() every few milliseconds.
+  void StartSweeper();
+  void StopSweeper();
+
+  // Number of slots which were ever used (including the expired ones).
+  size_t GetSize() const { return size_.load(std::memory_order_relaxed); }
+  size_t GetCapacity() const { return slots_.size(); }
+
+  static constexpr size_t BytesPerEntry() { return sizeof(Slot); }
+
+ private:
+  // Number of slots probed for a key, starting from its home slot.
+  static constexpr size_t kMaxProbes = 8;
+  // The sweeper goes over this many slots every kSweepIntervalMs.
+  static constexpr size_t kSweepSlotsPerTick = 16384;
+  static constexpr int kSweepIntervalMs = 10;
+
+  struct Slot {
+    // Zero means the slot is empty.
+    std::atomic<uint64_t> key = 0;
+    SpinMutex mutex;
+    uint32_t generation GUARDED_BY(mutex) = 0;
+    LowNode* node GUARDED_BY(mutex) = nullptr;
+  };
+
+  // Zero is reserved for empty slots.
+  static uint64_t NonZeroKey(uint64_t key) { return key ? key : 1; }
+  size_t GetSlotIndex(uint64_t key, size_t probe) const {
+    return ((key ^ (key >> 32)) + probe) & (slots_.size() - 1);
+  }
+  size_t SweepExpiredLocked(size_t max_slots) REQUIRES(sweep_mutex_);
+  void Sweeper();
+
+  std::vector<Slot, LargePageAllocator<Slot>> slots_;
+  std::atomic<size_t> size_ = 0;
+
+  // Keeps Reserve() and Clear() from running during a sweep.
+  Mutex sweep_mutex_;
+  std::condition_variable sweep_cv_;
+  size_t sweep_cursor_ GUARDED_BY(sweep_mutex_) = 0;
+  bool stop_sweeper_ GUARDED_BY(sweep_mutex_) = false;
+  std::thread sweeper_;
+};
+
+}  // namespace dag_classic
+}  // namespace lczero
@@ -0,0 +1,165 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "search/dag_classic/transposition_table.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "search/dag_classic/node.h"
+
+namespace lczero {
+namespace dag_classic {
+
+namespace {
+LowNodePtr MakeLowNode() { return LowNodePtr::Make(MoveList()); }
+}  // namespace
+
+TEST(TranspositionTable, InsertAndFind) {
+  TranspositionTable tt(64);
+  auto node = MakeLowNode();
+  EXPECT_EQ(tt.Find(123), nullptr);
+  EXPECT_EQ(tt.Insert(123, node), node);
+  EXPECT_EQ(tt.Find(123), node);
+  EXPECT_EQ(tt.Find(124), nullptr);
+  // An existing live entry wins.
+  auto other = MakeLowNode();
+  EXPECT_EQ(tt.Insert(123, other), node);
+  EXPECT_EQ(tt.GetSize(), 1u);
+}
+
+TEST(TranspositionTable, ExpiredEntryIsReplaced) {
+  TranspositionTable tt(64);
+  tt.Insert(5, MakeLowNode());
+  EXPECT_EQ(tt.Find(5), nullptr);
+  auto node = MakeLowNode();
+  EXPECT_EQ(tt.Insert(5, node), node);
+  EXPECT_EQ(tt.Find(5), node);
+}
+
+TEST(TranspositionTable, ReusedLowNodeBlockIsNotFound) {
+  TranspositionTable tt(64);
+  LowNode* address;
+  {
+    auto node = MakeLowNode();
+    address = node.get();
+    tt.Insert(9, node);
+  }
+  // The thread cache hands the freed block out again.
+  auto reused = MakeLowNode();
+  EXPECT_EQ(reused.get(), address);
+  EXPECT_EQ(tt.Find(9), nullptr);
+}
+
+TEST(TranspositionTable, FullProbeSequenceReusesExpiredSlots) {
+  TranspositionTable tt(8);
+  std::vector<LowNodePtr> nodes;
+  for (uint64_t key = 1; key <= 8; ++key) {
+    nodes.push_back(MakeLowNode());
+    EXPECT_EQ(tt.Insert(key, nodes.back()), nodes.back());
+  }
+  // No free or expired slot, the node is not stored.
+  auto node = MakeLowNode();
+  EXPECT_EQ(tt.Insert(100, node), node);
+  EXPECT_EQ(tt.Find(100), nullptr);
+  nodes[3].reset();
+  EXPECT_EQ(tt.Insert(100, node), node);
+  EXPECT_EQ(tt.Find(100), node);
+  EXPECT_EQ(tt.Find(4), nullptr);
+  EXPECT_EQ(tt.Find(5), nodes[4]);
+}
+
+TEST(TranspositionTable, ReserveKeepsLiveEntries) {
+  TranspositionTable tt(16);
+  auto node = MakeLowNode();
+  tt.Insert(7, node);
+  tt.Insert(8, MakeLowNode());
+  tt.Reserve(1000);
+  EXPECT_EQ(tt.GetCapacity(), 1024u);
+  EXPECT_EQ(tt.Find(7), node);
+  EXPECT_EQ(tt.GetSize(), 1u);
+}
+
+TEST(TranspositionTable, SweepClearsExpiredEntries) {
+  TranspositionTable tt(64);
+  auto node = MakeLowNode();
+  tt.Insert(1, node);
+  for (uint64_t key = 2; key <= 6; ++key) tt.Insert(key, MakeLowNode());
+  // Continues from where the previous sweep stopped.
+  size_t cleared = tt.SweepExpired(4);
+  cleared += tt.SweepExpired(60);
+  EXPECT_EQ(cleared, 5u);
+  EXPECT_EQ(tt.SweepExpired(64), 0u);
+  EXPECT_EQ(tt.Find(1), node);
+  // The keys stay, so the slots are reused for the same positions.
+  auto other = MakeLowNode();
+  EXPECT_EQ(tt.Insert(3, other), other);
+  EXPECT_EQ(tt.GetSize(), 6u);
+}
+
+TEST(TranspositionTable, SweeperThread) {
+  TranspositionTable tt(64);
+  tt.StartSweeper();
+  tt.Insert(1, MakeLowNode());
+  tt.Reserve(1024);
+  tt.Clear();
+  tt.StopSweeper();
+  EXPECT_EQ(tt.GetSize(), 0u);
+}
+
+TEST(TranspositionTable, ConcurrentInsertsAgree) {
+  TranspositionTable tt(1 << 12);
+  constexpr int kThreads = 4;
+  constexpr uint64_t kKeys = 1000;
+  std::vector<std::vector<LowNodePtr>> results(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (uint64_t key = 0; key < kKeys; ++key) {
+        results[t].push_back(
+            tt.Insert(key * 0x9E3779B97F4A7C15, MakeLowNode()));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (uint64_t key = 0; key < kKeys; ++key) {
+    for (int t = 1; t < kThreads; ++t) {
+      EXPECT_EQ(results[t][key], results[0][key]);
+    }
+    EXPECT_EQ(tt.Find(key * 0x9E3779B97F4A7C15), results[0][key]);
+  }
+}
+
+}  // namespace dag_classic
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
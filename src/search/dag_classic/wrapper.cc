@@ -26,6 +26,7 @@
 */
 
 #include "chess/gamestate.h"
+#include "neural/memory_budget.h"
 #include "search/classic/stoppers/factory.h"
 #include "search/dag_classic/search.h"
 #include "search/register.h"
@@ -49,10 +50,15 @@ const OptionId kClearTree{
      .help_text = "Clear the tree before the next search.",
      .visibility = OptionId::kProOnly}};
 
+// Smallest transposition table, in entries.
+constexpr size_t kMinTranspositionTableSize = 1 << 20;
+
 class DagClassicSearch : public SearchBase {
  public:
   DagClassicSearch(UciResponder* responder, const OptionsDict* options)
-      : SearchBase(responder), options_(options) {}
+      : SearchBase(responder), options_(options) {
+    tt_.StartSweeper();
+  }
   ~DagClassicSearch() { search_.reset(); }
 
  private:
@@ -100,7 +106,7 @@ MoveList StringsToMovelist(const std::vector<std::string>& moves,
 
 void DagClassicSearch::NewGame() {
   search_.reset();
-  tt_.clear();
+  tt_.Clear();
   tree_.reset();
   time_manager_ = classic::MakeTimeManager(*options_);
 }
@@ -116,17 +122,24 @@ void DagClassicSearch::StartSearch(const GoParams& params) {
       std::make_unique<NonOwningUciRespondForwarder>(uci_responder_);
   if (options_->Get<Button>(kClearTree).TestAndReset()) tree_->TrimTreeAtHead();
 
-  const auto cache_size =
-      options_->Get<int>(SharedBackendParams::kNNCacheSizeId);
+  const MemoryBudget budget = GetMemoryBudget(*options_);
+  const auto cache_size = budget.nn_cache_entries;
   // FIXME: This is too conservative.
   const size_t kAvgNodeSize =
-      sizeof(Node) + sizeof(LowNode) + sizeof(TranspositionTable::slot_type) +
+      sizeof(Node) + sizeof(LowNode) + TranspositionTable::BytesPerEntry() +
       classic::MemoryWatchingStopper::kAvgMovesPerPosition * sizeof(Edge);
   const size_t kAvgCacheItemSize =
       3 * sizeof(float) + sizeof(std::unique_ptr<float[]>) +
       sizeof(float[classic::MemoryWatchingStopper::kAvgMovesPerPosition]);
   size_t total_memory = tree_.get()->GetCurrentHead()->GetN() * kAvgNodeSize +
                         cache_size * kAvgCacheItemSize;
+  // The transposition table doesn't grow during the search. It takes its part
+  // of the tree memory limit (the search prunes the DAG to stay within it), or
+  // is kept twice as large as the number of entries used so far.
+  const size_t tree_limit_mb = SearchParams(*options_).GetTreeMemoryLimitMb();
+  tt_.Reserve(tree_limit_mb > 0
+                  ? tree_limit_mb * 1000000 / kAvgNodeSize
+                  : std::max(kMinTranspositionTableSize, 2 * tt_.GetSize()));
   auto stopper = time_manager_->GetStopper(
       params, tree_.get()->HeadPosition(), total_memory, kAvgNodeSize,
       tree_.get()->GetCurrentHead()->GetN());
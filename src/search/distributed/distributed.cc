@@ -0,0 +1,638 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chess/gamestate.h"
+#include "chess/position.h"
+#include "chess/uciloop.h"
+#include "neural/remote/protocol.h"
+#include "search/register.h"
+#include "search/search.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+using remote::Socket;
+
+const OptionId kWorkersId{
+    {.long_flag = "workers",
+     .uci_option = "Workers",
+     .help_text =
+         "Comma-separated host:port list of the analysis servers (see the "
+         "analysisserver mode) to search on. The root moves are split between "
+         "them, the most promising moves get a worker of their own.",
+     .visibility = OptionId::kAlwaysVisible}};
+const OptionId kRoundTimeId{
+    {.long_flag = "round-time",
+     .uci_option = "RoundTime",
+     .help_text =
+         "Time in milliseconds between the exchanges of the root statistics. "
+         "After every round the root moves are reassigned to the workers."}};
+const OptionId kMultiPvId{
+    {.long_flag = "multipv",
+     .uci_option = "MultiPV",
+     .help_text = "Number of the best root moves to show."}};
+
+constexpr auto kPollInterval = std::chrono::milliseconds(50);
+constexpr auto kInfoInterval = std::chrono::seconds(1);
+constexpr auto kBestMoveTimeout = std::chrono::seconds(30);
+
+// Root move statistics, as reported by a worker.
+struct MoveStats {
+  int depth = -1;
+  int seldepth = -1;
+  int64_t nodes = 0;
+  std::optional<int> score;
+  std::optional<int> mate;
+  std::optional<ThinkingInfo::WDL> wdl;
+  // Starts with the root move, in UCI notation.
+  std::vector<std::string> pv;
+};
+
+// Higher is better for the side to move. Moves without a score rank last.
+double RankOf(const MoveStats& stats) {
+  if (stats.mate) {
+    return *stats.mate > 0 ? 1e6 - *stats.mate : -1e6 - *stats.mate;
+  }
+  if (stats.score) return *stats.score;
+  return -std::numeric_limits<double>::infinity();
+}
+
+// Parses "info ... multipv N ... pv <moves>" line, returns nullopt for other
+// lines.
+std::optional<MoveStats> ParseInfoLine(const std::string& line) {
+  std::istringstream iss(line);
+  std::string token;
+  if (!(iss >> token) || token != "info") return std::nullopt;
+  MoveStats stats;
+  while (iss >> token) {
+    if (token == "string") return std::nullopt;
+    if (token == "depth") {
+      iss >> stats.depth;
+    } else if (token == "seldepth") {
+      iss >> stats.seldepth;
+    } else if (token == "nodes") {
+      iss >> stats.nodes;
+    } else if (token == "score") {
+      std::string type;
+      int value = 0;
+      iss >> type >> value;
+      if (type == "cp") stats.score = value;
+      if (type == "mate") stats.mate = value;
+    } else if (token == "wdl") {
+      ThinkingInfo::WDL wdl;
+      iss >> wdl.w >> wdl.d >> wdl.l;
+      stats.wdl = wdl;
+    } else if (token == "pv") {
+      while (iss >> token) stats.pv.push_back(token);
+    }
+  }
+  if (stats.pv.empty()) return std::nullopt;
+  return stats;
+}
+
+// Connection to one analysis server session.
+class Worker {
+ public:
+  explicit Worker(const std::string& address) : address_(address) {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+      throw Exception("Worker address must be host:port: " + address);
+    }
+    socket_ = Socket::Connect(address.substr(0, colon),
+                              std::stoi(address.substr(colon + 1)));
+    reader_ = std::thread([this]() { ReadLoop(); });
+    // Every root move is reported on its own line, with its own node count.
+    Send("setoption name MultiPV value 500");
+    Send("setoption name PerPVCounters value true");
+    Send("setoption name UCI_ShowWDL value true");
+  }
+
+  ~Worker() {
+    socket_.Shutdown();
+    reader_.join();
+    socket_.Close();
+  }
+
+  const std::string& address() const { return address_; }
+
+  void Send(const std::string& line) {
+    LOGFILE << address_ << " << " << line;
+    const std::string text = line + '\n';
+    try {
+      socket_.WriteAll(text.data(), text.size());
+    } catch (const Exception& ex) {
+      CERR << "Worker " << address_ << ": " << ex.what();
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+  }
+
+  void StartSearch(const std::string& position,
+                   const std::vector<std::string>& moves) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      searching_ = true;
+    }
+    Send(position);
+    Send("go infinite searchmoves " + StrJoin(moves, " "));
+  }
+
+  // Blocks until the worker responds with the bestmove to the current search.
+  void WaitBestMove() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cv_.wait_for(lock, kBestMoveTimeout,
+                      [this]() { return !searching_ || closed_; })) {
+      CERR << "Worker " << address_ << " doesn't respond, giving up on it.";
+      closed_ = true;
+    }
+  }
+
+  bool closed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+  }
+
+  // Statistics of all root moves the worker has reported, keyed by move.
+  std::map<std::string, MoveStats> GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void ClearStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.clear();
+  }
+
+ private:
+  void ReadLoop() {
+    std::string buffer;
+    char data[4096];
+    try {
+      while (size_t size = socket_.ReadSome(data, sizeof(data))) {
+        buffer.append(data, size);
+        size_t eol;
+        while ((eol = buffer.find('\n')) != std::string::npos) {
+          std::string line = buffer.substr(0, eol);
+          buffer.erase(0, eol + 1);
+          if (!line.empty() && line.back() == '\r') line.pop_back();
+          ProcessLine(line);
+        }
+      }
+    } catch (const Exception&) {
+      // Connection closed.
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cv_.notify_all();
+  }
+
+  void ProcessLine(const std::string& line) {
+    if (line.starts_with("bestmove")) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      searching_ = false;
+      cv_.notify_all();
+    } else if (auto stats = ParseInfoLine(line)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const std::string move = stats->pv[0];
+      stats_[move] = std::move(*stats);
+    } else if (line.starts_with("error")) {
+      CERR << "Worker " << address_ << ": " << line;
+    }
+  }
+
+  const std::string address_;
+  Socket socket_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<std::string, MoveStats> stats_;
+  bool searching_ = false;
+  bool closed_ = false;
+  std::thread reader_;
+};
+
+// Root-parallel search. Root moves are split between remote workers which
+// search them with "go searchmoves". After every round the root statistics are
+// collected, and the moves are reassigned: every one of the best moves gets a
+// worker of its own, the rest of the moves share the last worker.
+class DistributedSearch : public SearchBase {
+ public:
+  DistributedSearch(UciResponder* responder, const OptionsDict* options)
+      : SearchBase(responder), options_(options) {}
+
+  ~DistributedSearch() {
+    AbortSearch();
+    WaitSearch();
+  }
+
+ private:
+  void NewGame() override {
+    for (auto& worker : workers_) {
+      worker->Send("ucinewgame");
+      worker->ClearStats();
+    }
+  }
+
+  void SetPosition(const GameState& game_state) override {
+    game_state_ = game_state;
+    for (auto& worker : workers_) worker->ClearStats();
+  }
+
+  void StartClock() override {
+    start_time_ = std::chrono::steady_clock::now();
+  }
+
+  void StartSearch(const GoParams& params) override {
+    WaitSearch();
+    ConnectWorkers();
+    const ChessBoard& board = game_state_.CurrentPosition().GetBoard();
+    const bool black = game_state_.CurrentPosition().IsBlackToMove();
+    std::vector<std::string> root_moves;
+    for (Move move : board.GenerateLegalMoves()) {
+      if (black) move.Flip();
+      const std::string str = move.ToString(false);
+      if (params.searchmoves.empty() ||
+          std::find(params.searchmoves.begin(), params.searchmoves.end(),
+                    str) != params.searchmoves.end()) {
+        root_moves.push_back(str);
+      }
+    }
+    if (root_moves.empty()) throw Exception("No legal moves to search.");
+
+    position_command_ = "position fen " +
+                        PositionToFen(game_state_.startpos);
+    if (!game_state_.moves.empty()) {
+      position_command_ += " moves";
+      PositionHistory history;
+      history.Reset(game_state_.startpos);
+      for (Move move : game_state_.moves) {
+        Move absolute = move;
+        if (history.IsBlackToMove()) absolute.Flip();
+        position_command_ += " " + absolute.ToString(false);
+        history.Append(move);
+      }
+    }
+
+    params_ = params;
+    stop_ = false;
+    abort_ = false;
+    thread_ = std::thread(
+        [this, root_moves]() { SearchThread(root_moves); });
+  }
+
+  void WaitSearch() override {
+    if (thread_.joinable()) thread_.join();
+  }
+
+  void StopSearch() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_all();
+  }
+
+  void AbortSearch() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    abort_ = true;
+    cv_.notify_all();
+  }
+
+  void ConnectWorkers() {
+    const std::string addresses = options_->Get<std::string>(kWorkersId);
+    if (addresses == workers_option_ && !workers_.empty()) {
+      std::erase_if(workers_, [](const auto& w) { return w->closed(); });
+      if (!workers_.empty()) return;
+    }
+    workers_.clear();
+    workers_option_ = addresses;
+    for (const std::string& address : StrSplit(addresses, ",")) {
+      const std::string trimmed = Trim(address);
+      if (trimmed.empty()) continue;
+      workers_.push_back(std::make_unique<Worker>(trimmed));
+    }
+    if (workers_.empty()) {
+      throw Exception("Distributed search needs --workers=host:port,...");
+    }
+  }
+
+  // Time the move is allowed to take, or nullopt when unlimited.
+  std::optional<std::chrono::milliseconds> GetTimeBudget() const {
+    if (params_.infinite || params_.ponder) return std::nullopt;
+    if (params_.movetime) {
+      return std::chrono::milliseconds(*params_.movetime);
+    }
+    const bool black = game_state_.CurrentPosition().IsBlackToMove();
+    const auto time = black ? params_.btime : params_.wtime;
+    if (!time) return std::nullopt;
+    const int64_t increment = (black ? params_.binc : params_.winc).value_or(0);
+    const int64_t moves_to_go = params_.movestogo.value_or(30);
+    return std::chrono::milliseconds(std::min(
+        *time / 2, *time / std::max<int64_t>(moves_to_go, 1) + increment));
+  }
+
+  // For every root move, picks the statistics of the worker which has
+  // searched it the most.
+  std::map<std::string, MoveStats> MergeStats(
+      const std::vector<std::string>& root_moves,
+      std::map<std::string, size_t>* home) const {
+    std::map<std::string, MoveStats> merged;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      for (auto& [move, stats] : workers_[i]->GetStats()) {
+        if (std::find(root_moves.begin(), root_moves.end(), move) ==
+            root_moves.end()) {
+          continue;
+        }
+        auto iter = merged.find(move);
+        if (iter != merged.end() && iter->second.nodes >= stats.nodes) {
+          continue;
+        }
+        merged[move] = stats;
+        if (home) (*home)[move] = i;
+      }
+    }
+    return merged;
+  }
+
+  std::vector<std::string> RankMoves(
+      const std::vector<std::string>& root_moves,
+      const std::map<std::string, MoveStats>& merged) const {
+    std::vector<std::string> ranked = root_moves;
+    auto rank = [&merged](const std::string& move) {
+      auto iter = merged.find(move);
+      return iter == merged.end() ? -std::numeric_limits<double>::infinity()
+                                  : RankOf(iter->second);
+    };
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [&](const std::string& a, const std::string& b) {
+                       return rank(a) > rank(b);
+                     });
+    return ranked;
+  }
+
+  // Splits the moves between the workers. Each of the best moves is searched
+  // by a worker of its own, preferably the one which searched it before.
+  std::vector<std::vector<std::string>> AssignMoves(
+      const std::vector<std::string>& root_moves) const {
+    const size_t num_workers = workers_.size();
+    std::vector<std::vector<std::string>> assignment(num_workers);
+    std::map<std::string, size_t> home;
+    const auto merged = MergeStats(root_moves, &home);
+    if (merged.empty()) {
+      // Nothing is known yet, round robin.
+      for (size_t i = 0; i < root_moves.size(); ++i) {
+        assignment[i % num_workers].push_back(root_moves[i]);
+      }
+      return assignment;
+    }
+    const std::vector<std::string> ranked = RankMoves(root_moves, merged);
+    const size_t num_singles = ranked.size() <= num_workers
+                                   ? ranked.size()
+                                   : num_workers - 1;
+    std::vector<bool> taken(num_workers, false);
+    std::vector<std::string> unplaced;
+    for (size_t i = 0; i < num_singles; ++i) {
+      auto iter = home.find(ranked[i]);
+      if (iter != home.end() && !taken[iter->second]) {
+        taken[iter->second] = true;
+        assignment[iter->second].push_back(ranked[i]);
+      } else {
+        unplaced.push_back(ranked[i]);
+      }
+    }
+    for (const std::string& move : unplaced) {
+      const size_t idx =
+          std::find(taken.begin(), taken.end(), false) - taken.begin();
+      taken[idx] = true;
+      assignment[idx].push_back(move);
+    }
+    if (num_singles < ranked.size()) {
+      const size_t idx =
+          std::find(taken.begin(), taken.end(), false) - taken.begin();
+      assignment[idx].assign(ranked.begin() + num_singles, ranked.end());
+    }
+    return assignment;
+  }
+
+  void SearchThread(std::vector<std::string> root_moves) {
+    const auto budget = GetTimeBudget();
+    const auto deadline =
+        budget ? std::make_optional(start_time_ + *budget) : std::nullopt;
+    const auto round_time =
+        std::chrono::milliseconds(options_->Get<int>(kRoundTimeId));
+    auto last_info = std::chrono::steady_clock::now();
+    bool done = false;
+    while (!done) {
+      const auto assignment = AssignMoves(root_moves);
+      std::vector<Worker*> active;
+      for (size_t i = 0; i < workers_.size(); ++i) {
+        if (assignment[i].empty()) continue;
+        LOGFILE << "Round: " << workers_[i]->address() << " searches "
+                << StrJoin(assignment[i], " ");
+        workers_[i]->StartSearch(position_command_, assignment[i]);
+        active.push_back(workers_[i].get());
+      }
+      const auto round_end = std::chrono::steady_clock::now() + round_time;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          cv_.wait_for(lock, kPollInterval, [this]() { return stop_; });
+          if (stop_) {
+            done = true;
+            break;
+          }
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (deadline && now >= *deadline) {
+          done = true;
+          break;
+        }
+        if (params_.nodes && GetTotalNodes(root_moves) >= *params_.nodes) {
+          done = true;
+          break;
+        }
+        if (now - last_info >= kInfoInterval) {
+          last_info = now;
+          OutputInfo(root_moves);
+        }
+        if (now >= round_end) break;
+      }
+      for (Worker* worker : active) worker->Send("stop");
+      for (Worker* worker : active) worker->WaitBestMove();
+      // Lost workers are dropped, their moves go to the others.
+      if (std::any_of(workers_.begin(), workers_.end(),
+                      [](const auto& w) { return w->closed(); })) {
+        std::erase_if(workers_, [](const auto& w) { return w->closed(); });
+        if (workers_.empty()) {
+          CERR << "All workers are lost.";
+          done = true;
+        }
+      }
+    }
+    // Infinite and ponder searches wait for the stop before the bestmove.
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stop_ || !infinite_wait(); });
+      if (abort_) return;
+    }
+    OutputInfo(root_moves);
+    OutputBestMove(root_moves);
+  }
+
+  // True if the search has to wait for the stop command after the limits are
+  // reached.
+  bool infinite_wait() const { return params_.infinite || params_.ponder; }
+
+  int64_t GetTotalNodes(const std::vector<std::string>& root_moves) const {
+    int64_t total = 0;
+    for (const auto& [move, stats] : MergeStats(root_moves, nullptr)) {
+      total += stats.nodes;
+    }
+    return total;
+  }
+
+  // Converts the UCI moves to moves from the white perspective, stopping at
+  // the first illegal one.
+  std::vector<Move> ParsePv(const std::vector<std::string>& pv) const {
+    std::vector<Move> result;
+    ChessBoard board = game_state_.CurrentPosition().GetBoard();
+    for (const std::string& str : pv) {
+      try {
+        const Move move = board.ParseMove(str);
+        const MoveList legal_moves = board.GenerateLegalMoves();
+        if (std::find(legal_moves.begin(), legal_moves.end(), move) ==
+            legal_moves.end()) {
+          break;
+        }
+        Move absolute = move;
+        if (board.flipped()) absolute.Flip();
+        result.push_back(absolute);
+        board.ApplyMove(move);
+        board.Mirror();
+      } catch (const Exception&) {
+        break;
+      }
+    }
+    return result;
+  }
+
+  void OutputInfo(const std::vector<std::string>& root_moves) {
+    const auto merged = MergeStats(root_moves, nullptr);
+    if (merged.empty()) return;
+    const std::vector<std::string> ranked = RankMoves(root_moves, merged);
+    const int64_t elapsed = std::max<int64_t>(
+        1, std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start_time_)
+               .count());
+    int64_t total_nodes = 0;
+    int depth = 0;
+    int seldepth = 0;
+    for (const auto& [move, stats] : merged) {
+      total_nodes += stats.nodes;
+      depth = std::max(depth, stats.depth);
+      seldepth = std::max(seldepth, stats.seldepth);
+    }
+    const size_t multipv =
+        std::min<size_t>(options_->Get<int>(kMultiPvId), merged.size());
+    std::vector<ThinkingInfo> infos;
+    for (size_t i = 0; i < multipv; ++i) {
+      const MoveStats& stats = merged.at(ranked[i]);
+      ThinkingInfo info;
+      info.depth = depth;
+      info.seldepth = seldepth;
+      info.time = elapsed;
+      info.nodes = total_nodes;
+      info.nps = total_nodes * 1000 / elapsed;
+      info.score = stats.score;
+      info.mate = stats.mate;
+      info.wdl = stats.wdl;
+      info.pv = ParsePv(stats.pv);
+      if (multipv > 1) info.multipv = i + 1;
+      infos.push_back(std::move(info));
+    }
+    uci_responder_->OutputThinkingInfo(&infos);
+  }
+
+  void OutputBestMove(const std::vector<std::string>& root_moves) {
+    const auto merged = MergeStats(root_moves, nullptr);
+    const std::vector<std::string> ranked = RankMoves(root_moves, merged);
+    auto iter = merged.find(ranked[0]);
+    std::vector<Move> pv =
+        ParsePv(iter == merged.end() ? std::vector<std::string>{ranked[0]}
+                                     : iter->second.pv);
+    BestMoveInfo info{pv.empty() ? Move() : pv[0]};
+    if (pv.size() > 1) info.ponder = pv[1];
+    uci_responder_->OutputBestMove(&info);
+  }
+
+  const OptionsDict* const options_;
+  GameState game_state_;
+  GoParams params_;
+  std::string position_command_;
+  std::chrono::steady_clock::time_point start_time_ =
+      std::chrono::steady_clock::now();
+  std::string workers_option_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  bool abort_ = false;
+  std::thread thread_;
+};
+
+class DistributedFactory : public SearchFactory {
+  std::string_view GetName() const override { return "distributed"; }
+  void PopulateParams(OptionsParser* parser) const override {
+    parser->Add<StringOption>(kWorkersId) = "";
+    parser->Add<IntOption>(kRoundTimeId, 100, 600000) = 5000;
+    parser->Add<IntOption>(kMultiPvId, 1, 500) = 1;
+  }
+  std::unique_ptr<SearchBase> CreateSearch(
+      UciResponder* responder, const OptionsDict* options) const override {
+    return std::make_unique<DistributedSearch>(responder, options);
+  }
+};
+
+REGISTER_SEARCH(DistributedFactory)
+
+}  // namespace
+}  // namespace lczero
@@ -0,0 +1,114 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "search/tree_stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace lczero {
+namespace {
+
+std::string FormatCount(const char* name, const TreeStats::Count& count) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1) << count.count << " " << name
+      << " (" << count.bytes / (1024.0 * 1024.0) << " MiB)";
+  return oss.str();
+}
+
+}  // namespace
+
+void TreeStats::AddNode(size_t depth, uint32_t n) {
+  if (nodes_per_depth.size() <= depth) {
+    nodes_per_depth.resize(depth + 1);
+    visits_per_depth.resize(depth + 1);
+  }
+  ++nodes_per_depth[depth];
+  visits_per_depth[depth] += n;
+}
+
+void TreeStats::AddExpandedNode(int num_edges) {
+  const auto bucket =
+      std::upper_bound(kEdgesBuckets.begin(), kEdgesBuckets.end(), num_edges) -
+      kEdgesBuckets.begin() - 1;
+  ++edges_histogram[bucket];
+}
+
+std::vector<std::string> FormatTreeStats(const TreeStats& stats) {
+  std::vector<std::string> lines;
+  const uint64_t total_bytes = stats.nodes.bytes + stats.edges.bytes +
+                               stats.low_nodes.bytes + stats.tt_entries.bytes;
+  std::ostringstream oss;
+  oss << "Tree: " << FormatCount("nodes", stats.nodes) << ", "
+      << FormatCount("edges", stats.edges) << ", "
+      << FormatCount("solid blocks", stats.solid_blocks) << " with "
+      << stats.solid_nodes << " nodes";
+  if (stats.low_nodes.count > 0) {
+    oss << ", " << FormatCount("low nodes", stats.low_nodes);
+  }
+  if (stats.tt_capacity > 0) {
+    oss << ", " << FormatCount("TT entries", stats.tt_entries) << " of "
+        << stats.tt_capacity;
+  }
+  oss << ", " << std::fixed << std::setprecision(1)
+      << total_bytes / (1024.0 * 1024.0) << " MiB total.";
+  lines.push_back(oss.str());
+
+  oss.str("");
+  oss << "GC backlog: " << stats.gc_pending_subtrees << " subtrees. NN cache: "
+      << stats.nn_cache_entries << " of " << stats.nn_cache_capacity
+      << " entries.";
+  lines.push_back(oss.str());
+
+  oss.str("");
+  oss << "Edges per node:";
+  for (size_t i = 0; i < stats.edges_histogram.size(); ++i) {
+    if (stats.edges_histogram[i] == 0) continue;
+    const int begin = TreeStats::kEdgesBuckets[i];
+    oss << " " << begin;
+    if (i + 1 == stats.edges_histogram.size()) {
+      oss << "+";
+    } else if (TreeStats::kEdgesBuckets[i + 1] > begin + 1) {
+      oss << "-" << TreeStats::kEdgesBuckets[i + 1] - 1;
+    }
+    oss << ":" << stats.edges_histogram[i];
+  }
+  lines.push_back(oss.str());
+
+  oss.str("");
+  oss << "Nodes/visits per depth:";
+  for (size_t depth = 0; depth < stats.nodes_per_depth.size(); ++depth) {
+    oss << " " << depth << ":" << stats.nodes_per_depth[depth] << "/"
+        << stats.visits_per_depth[depth];
+  }
+  lines.push_back(oss.str());
+  return lines;
+}
+
+}  // namespace lczero
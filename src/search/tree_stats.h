@@ -0,0 +1,82 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lczero {
+
+// What a search tree consists of, to tune the memory limits. Collected by
+// walking the tree, so it's only done on request (the TreeStats option).
+struct TreeStats {
+  struct Count {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    void Add(uint64_t n, size_t size) {
+      count += n;
+      bytes += n * size;
+    }
+  };
+  Count nodes;
+  Count edges;
+  // Solid children arrays, and their nodes which are also counted in @nodes.
+  Count solid_blocks;
+  uint64_t solid_nodes = 0;
+  // DAG search only. The bytes of @tt_entries are those of the whole table.
+  Count low_nodes;
+  Count tt_entries;
+  uint64_t tt_capacity = 0;
+  // Subtrees waiting for the garbage collector.
+  uint64_t gc_pending_subtrees = 0;
+  uint64_t nn_cache_entries = 0;
+  uint64_t nn_cache_capacity = 0;
+
+  // Expanded nodes by the number of their edges, the buckets start at
+  // kEdgesBuckets[i].
+  static constexpr std::array<int, 10> kEdgesBuckets = {0,  1,  2,  5,  10,
+                                                        20, 30, 40, 60, 80};
+  std::array<uint64_t, kEdgesBuckets.size()> edges_histogram = {};
+  // Nodes and the sum of their visits by the depth from the root.
+  std::vector<uint64_t> nodes_per_depth;
+  std::vector<uint64_t> visits_per_depth;
+
+  // Add a node at @depth with @n visits, and an expanded node with @num_edges
+  // edges to the histograms.
+  void AddNode(size_t depth, uint32_t n);
+  void AddExpandedNode(int num_edges);
+};
+
+// Returns the report as lines of 'info string'.
+std::vector<std::string> FormatTreeStats(const TreeStats& stats);
+
+}  // namespace lczero
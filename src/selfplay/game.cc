@@ -36,8 +36,11 @@
 namespace lczero {
 
 namespace {
-const OptionId kReuseTreeId{"reuse-tree", "ReuseTree",
-                            "Reuse the search tree between moves."};
+const OptionId kReuseTreeId{
+    "reuse-tree", "ReuseTree",
+    "Reuse the search tree between moves. When the tree is shared between the "
+    "players, the subtree searched by the opponent is reused. The root noise "
+    "is added to the priors of the reused root."};
 const OptionId kResignPercentageId{
     "resign-percentage", "ResignPercentage",
     "Resign when win percentage drops below specified value."};
@@ -155,13 +158,18 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
     }
     // Initialize search.
     const int idx = blacks_move ? 1 : 0;
+    bool fast_move = false;
     if (!options_[idx].uci_options->Get<bool>(kReuseTreeId)) {
       tree_[idx]->TrimTreeAtHead();
     }
     {
       std::lock_guard<std::mutex> lock(mutex_);
       if (abort_) break;
-      auto stoppers = options_[idx].search_limits.MakeSearchStopper();
+      fast_move = options_[idx].search_limits.fast_probability > 0.0f &&
+                  Random::Get().GetFloat(1.0f) <
+                      options_[idx].search_limits.fast_probability;
+      auto stoppers =
+          options_[idx].search_limits.MakeSearchStopper(fast_move);
       classic::PopulateIntrinsicStoppers(stoppers.get(),
                                          *options_[idx].uci_options);
 
@@ -174,6 +182,9 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
           /* searchmoves */ MoveList(), std::chrono::steady_clock::now(),
           std::move(stoppers), /* infinite */ false, /* ponder */ false,
           *options_[idx].uci_options, syzygy_tb);
+      if (options_[idx].uci_options->Get<bool>(kReuseTreeId)) {
+        search_->ApplyNoiseToReusedRoot();
+      }
     }
 
     // Do search.
@@ -262,12 +273,15 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
       if (history_copy.ComputeGameResult() == GameResult::UNDECIDED) {
         auto move_list_to_discard = GetMoves();
         move_list_to_discard.push_back(move);
-        options_[idx].discarded_callback({orig_fen_, move_list_to_discard});
+        options_[idx].discarded_callback(
+            {orig_fen_, MoveList(move_list_to_discard.begin(),
+                                 move_list_to_discard.end())});
       }
       search_->ResetBestMove();
     }
 
-    if (training) {
+    // Only the fully searched moves give the training targets.
+    if (training && !fast_move) {
       bool best_is_proof = best_is_terminal;  // But check for better moves.
       if (best_is_proof && best_eval.wl < 1) {
         auto best =
@@ -281,7 +295,7 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
         }
       }
       // Append training data. The GameResult is later overwritten.
-      std::vector<Move> legal_moves = tree_[idx]
+      MoveList legal_moves = tree_[idx]
                                           ->GetPositionHistory()
                                           .Last()
                                           .GetBoard()
@@ -353,8 +367,13 @@ void SelfPlayGame::WriteTrainingData(TrainingDataWriter* writer) const {
 }
 
 std::unique_ptr<classic::ChainedSearchStopper>
-SelfPlayLimits::MakeSearchStopper() const {
+SelfPlayLimits::MakeSearchStopper(bool fast) const {
   auto result = std::make_unique<classic::ChainedSearchStopper>();
+  if (fast) {
+    result->AddStopper(
+        std::make_unique<classic::VisitsStopper>(fast_visits, false));
+    return result;
+  }
 
   // always set VisitsStopper to avoid exceeding the limit 4000000000, the
   // default value when visits = 0
@@ -42,8 +42,14 @@ struct SelfPlayLimits {
   std::int64_t visits = -1;
   std::int64_t playouts = -1;
   std::int64_t movetime = -1;
-
-  std::unique_ptr<classic::ChainedSearchStopper> MakeSearchStopper() const;
+  // Playout cap randomization: the moves are searched with only @fast_visits
+  // with this probability, and are not used for training then.
+  float fast_probability = 0.0f;
+  std::int64_t fast_visits = 0;
+
+  // Returns the stopper of a full search, or of a fast one if @fast.
+  std::unique_ptr<classic::ChainedSearchStopper> MakeSearchStopper(
+      bool fast = false) const;
 };
 
 struct PlayerOptions {
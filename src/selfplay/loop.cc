@@ -151,6 +151,11 @@ void SelfPlayLoop::SendTournament(const TournamentInfo& info) {
                                   info.move_count_);
   oss << " nodes " + std::to_string(info.nodes_total_);
   oss << " moves " + std::to_string(info.move_count_);
+  for (int i : {0, 1}) {
+    if (info.nn_cache_lookups[i] == 0) continue;
+    oss << " P" << (i + 1) << "-cache: " << std::fixed << std::setprecision(2)
+        << (100.0 * info.nn_cache_hits[i] / info.nn_cache_lookups[i]) << "%";
+  }
   uci_responder_->SendRawResponse(oss.str());
 }
 
@@ -27,50 +27,64 @@
 
 #include "selfplay/multigame.h"
 
+#include <cmath>
+#include <limits>
+
 namespace lczero {
 
+// The moves and results are kept per tree, as all the trees are evaluated in
+// one batch.
 class PolicyEvaluator : public Evaluator {
  public:
   void Reset(const PlayerOptions& player) override {
     comp_ = player.backend->CreateComputation();
+    moves_.clear();
+    p_.clear();
+    next_tree_ = 0;
   }
   void Gather(classic::NodeTree* tree) override {
     const auto& history = tree->GetPositionHistory();
-    moves_.clear();
+    auto& moves = moves_.emplace_back();
     for (auto edge : tree->GetCurrentHead()->Edges()) {
-      moves_.push_back(edge.GetMove());
+      moves.push_back(edge.GetMove());
     }
-    p_.resize(moves_.size());
+    auto& p = p_.emplace_back(moves.size());
     comp_->AddInput(
         EvalPosition{
             .pos = history.GetPositions(),
-            .legal_moves = moves_,
+            .legal_moves = moves,
         },
-        EvalResultPtr{.p = p_});
+        EvalResultPtr{.p = p});
   }
   void Run() override { comp_->ComputeBlocking(); }
   void MakeBestMove(classic::NodeTree* tree) override {
-    size_t best_idx = std::max_element(p_.begin(), p_.end()) - p_.begin();
-    tree->MakeMove(moves_[best_idx]);
+    const auto& p = p_[next_tree_];
+    size_t best_idx = std::max_element(p.begin(), p.end()) - p.begin();
+    tree->MakeMove(moves_[next_tree_++][best_idx]);
   }
 
   std::unique_ptr<BackendComputation> comp_;
-  std::vector<Move> moves_;
-  std::vector<float> p_;
+  std::vector<std::vector<Move>> moves_;
+  std::vector<std::vector<float>> p_;
+  size_t next_tree_ = 0;
 };
 
 class ValueEvaluator : public Evaluator {
  public:
   void Reset(const PlayerOptions& player) override {
     comp_ = player.backend->CreateComputation();
+    moves_.clear();
+    q_.clear();
+    next_tree_ = 0;
   }
   void Gather(classic::NodeTree* tree) override {
     PositionHistory history = tree->GetPositionHistory();
-    q_.clear();
-    q_.reserve(tree->GetCurrentHead()->GetNumEdges());
-    moves_.clear();
+    auto& q = q_.emplace_back();
+    // The results are fetched into q, it must not be reallocated.
+    q.reserve(tree->GetCurrentHead()->GetNumEdges());
+    auto& moves = moves_.emplace_back();
     for (auto edge : tree->GetCurrentHead()->Edges()) {
-      moves_.push_back(edge.GetMove());
+      moves.push_back(edge.GetMove());
       history.Append(edge.GetMove());
       auto result = history.ComputeGameResult();
       if (result == GameResult::UNDECIDED) {
@@ -79,37 +93,210 @@ class ValueEvaluator : public Evaluator {
                 .pos = history.GetPositions(),
                 .legal_moves = {},
             },
-            EvalResultPtr{.q = &q_.emplace_back()});
+            EvalResultPtr{.q = &q.emplace_back()});
       } else if (result == GameResult::DRAW) {
-        q_.push_back(0);
+        q.push_back(0);
       } else {
         // A legal move to a non-drawn terminal without tablebases must be a
         // win.
-        q_.push_back(1);
+        q.push_back(1);
       }
       history.Pop();
     }
   }
   void Run() override { comp_->ComputeBlocking(); }
   void MakeBestMove(classic::NodeTree* tree) override {
-    size_t best_idx = std::max_element(q_.begin(), q_.end()) - q_.begin();
-    tree->MakeMove(moves_[best_idx]);
+    const auto& q = q_[next_tree_];
+    size_t best_idx = std::max_element(q.begin(), q.end()) - q.begin();
+    tree->MakeMove(moves_[next_tree_++][best_idx]);
   }
 
   std::unique_ptr<BackendComputation> comp_;
-  std::vector<Move> moves_;
-  std::vector<float> q_;
+  std::vector<std::vector<Move>> moves_;
+  std::vector<std::vector<float>> q_;
+  size_t next_tree_ = 0;
 };
 
-MultiSelfPlayGames::MultiSelfPlayGames(PlayerOptions player1,
-                                       PlayerOptions player2,
-                                       const std::vector<Opening>& openings,
-                                       SyzygyTablebase* syzygy_tb,
-                                       bool use_value)
+// MCTS of all the trees at once. Every tree adds a few leaves to each backend
+// batch, so that one thread keeps a large batch full. Virtual loss (visits in
+// flight) spreads the leaves of one tree apart.
+class SearchEvaluator : public Evaluator {
+ public:
+  explicit SearchEvaluator(const MultiGameSearchParams& params)
+      : params_(params) {}
+
+  void Reset(const PlayerOptions& player) override {
+    backend_ = player.backend;
+    visits_ = player.search_limits.visits;
+    trees_.clear();
+  }
+  void Gather(classic::NodeTree* tree) override {
+    // The players may use different networks, so the subtree searched for the
+    // previous move is not reused.
+    tree->TrimTreeAtHead();
+    trees_.push_back(tree);
+  }
+  void Run() override {
+    std::vector<classic::NodeTree*> active = trees_;
+    while (!active.empty()) {
+      auto comp = backend_->CreateComputation();
+      leaves_.clear();
+      // The inputs point into the leaves, they must not be reallocated.
+      leaves_.reserve(active.size() * params_.leaves_per_tree);
+      for (auto* tree : active) {
+        for (int i = 0; i < params_.leaves_per_tree && NeedsVisits(tree);
+             ++i) {
+          if (!PickLeaf(tree, comp.get())) break;
+        }
+      }
+      comp->ComputeBlocking();
+      for (auto& leaf : leaves_) ProcessLeaf(leaf);
+      std::erase_if(active, [&](auto* tree) { return !NeedsVisits(tree); });
+    }
+  }
+  void MakeBestMove(classic::NodeTree* tree) override {
+    classic::EdgeAndNode best;
+    for (auto edge : tree->GetCurrentHead()->Edges()) {
+      if (!best || edge.GetN() > best.GetN() ||
+          (edge.GetN() == best.GetN() && edge.GetP() > best.GetP())) {
+        best = edge;
+      }
+    }
+    tree->MakeMove(best.GetMove());
+  }
+
+ private:
+  struct Leaf {
+    classic::Node* head;
+    classic::Node* node;
+    PositionHistory history;
+    MoveList moves;
+    float q;
+    float d;
+    float m;
+    std::vector<float> p;
+  };
+
+  bool NeedsVisits(classic::NodeTree* tree) const {
+    const classic::Node* head = tree->GetCurrentHead();
+    return head->GetNStarted() < visits_;
+  }
+
+  // Descends from the head to a leaf. Terminal leaves are backed up right
+  // away, others are added to @comp. Returns false if the leaf is already
+  // waiting for its evaluation.
+  bool PickLeaf(classic::NodeTree* tree, BackendComputation* comp) {
+    classic::Node* const head = tree->GetCurrentHead();
+    PositionHistory history = tree->GetPositionHistory();
+    classic::Node* node = head;
+    while (true) {
+      if (!node->TryStartScoreUpdate()) {
+        if (node != head) CancelVisit(node->GetParent(), head);
+        return false;
+      }
+      if (node->IsTerminal()) {
+        Backup(node, head, node->GetWL(), node->GetD(), node->GetM());
+        return true;
+      }
+      if (node->GetN() == 0) break;
+      auto edge = SelectChild(node);
+      history.Append(edge.GetMove());
+      node = edge.GetOrSpawnNode(node);
+    }
+    // The game isn't over at the head.
+    if (node != head) {
+      const GameResult result = history.ComputeGameResult();
+      if (result != GameResult::UNDECIDED) {
+        // A decisive result is a checkmate, i.e. a win of the side which just
+        // moved.
+        node->MakeTerminal(result == GameResult::DRAW ? GameResult::DRAW
+                                                      : GameResult::WHITE_WON);
+        Backup(node, head, node->GetWL(), node->GetD(), node->GetM());
+        return true;
+      }
+    }
+    Leaf& leaf = leaves_.emplace_back();
+    leaf.head = head;
+    leaf.node = node;
+    leaf.history = std::move(history);
+    leaf.moves = leaf.history.Last().GetBoard().GenerateLegalMoves();
+    leaf.p.resize(leaf.moves.size());
+    comp->AddInput(
+        EvalPosition{
+            .pos = leaf.history.GetPositions(),
+            .legal_moves = leaf.moves,
+        },
+        EvalResultPtr{.q = &leaf.q, .d = &leaf.d, .m = &leaf.m, .p = leaf.p});
+    return true;
+  }
+
+  classic::Node::Iterator SelectChild(classic::Node* node) const {
+    // Values are from the point of view of the side to move in @node.
+    const float fpu = -node->GetWL() - params_.fpu_reduction *
+                                           std::sqrt(node->GetVisitedPolicy());
+    const float numerator =
+        params_.cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
+    classic::Node::Iterator best;
+    float best_score = std::numeric_limits<float>::lowest();
+    for (auto edge : node->Edges()) {
+      const float score = edge.GetWL(fpu) + edge.GetU(numerator);
+      if (score > best_score) {
+        best_score = score;
+        best = edge;
+      }
+    }
+    return best;
+  }
+
+  void ProcessLeaf(const Leaf& leaf) {
+    classic::Node* node = leaf.node;
+    node->CreateEdges(leaf.moves);
+    size_t idx = 0;
+    for (auto edge : node->Edges()) edge.edge()->SetP(leaf.p[idx++]);
+    // Node values are from the point of view of the side which moved into it.
+    Backup(node, leaf.head, -leaf.q, leaf.d, leaf.m);
+  }
+
+  static void Backup(classic::Node* node, classic::Node* head, float v,
+                     float d, float m) {
+    for (classic::Node* n = node;; n = n->GetParent()) {
+      n->FinalizeScoreUpdate(v, d, m, 1);
+      if (n == head) break;
+      v = -v;
+      m += 1.0f;
+    }
+  }
+
+  static void CancelVisit(classic::Node* node, classic::Node* head) {
+    for (classic::Node* n = node;; n = n->GetParent()) {
+      n->CancelScoreUpdate(1);
+      if (n == head) break;
+    }
+  }
+
+  const MultiGameSearchParams params_;
+  Backend* backend_ = nullptr;
+  int64_t visits_ = 0;
+  std::vector<classic::NodeTree*> trees_;
+  std::vector<Leaf> leaves_;
+};
+
+MultiSelfPlayGames::MultiSelfPlayGames(
+    PlayerOptions player1, PlayerOptions player2,
+    const std::vector<Opening>& openings, SyzygyTablebase* syzygy_tb,
+    MultiGameMode mode, const MultiGameSearchParams& search_params)
     : options_{player1, player2}, syzygy_tb_(syzygy_tb) {
-  eval_ = use_value
-              ? std::unique_ptr<Evaluator>(std::make_unique<ValueEvaluator>())
-              : std::unique_ptr<Evaluator>(std::make_unique<PolicyEvaluator>());
+  switch (mode) {
+    case MultiGameMode::kPolicy:
+      eval_ = std::make_unique<PolicyEvaluator>();
+      break;
+    case MultiGameMode::kValue:
+      eval_ = std::make_unique<ValueEvaluator>();
+      break;
+    case MultiGameMode::kSearch:
+      eval_ = std::make_unique<SearchEvaluator>(search_params);
+      break;
+  }
   trees_.reserve(openings.size());
   for (auto opening : openings) {
     trees_.push_back(std::make_shared<classic::NodeTree>());
@@ -117,6 +304,8 @@ MultiSelfPlayGames::MultiSelfPlayGames(PlayerOptions player1,
     results_.push_back(GameResult::UNDECIDED);
 
     for (Move m : opening.moves) {
+      // Opening moves are from white's point of view.
+      if (trees_.back()->IsBlackToMove()) m.Flip();
       trees_.back()->MakeMove(m);
     }
   }
@@ -185,8 +374,10 @@ void MultiSelfPlayGames::Play() {
       }
       if (((tree->GetPlyCount() % 2) == 1) != blacks_move) continue;
       const auto& board = tree->GetPositionHistory().Last().GetBoard();
-      auto legal_moves = board.GenerateLegalMoves();
-      tree->GetCurrentHead()->CreateEdges(legal_moves);
+      // The head may be expanded already by the search of the previous move.
+      if (!tree->GetCurrentHead()->HasChildren()) {
+        tree->GetCurrentHead()->CreateEdges(board.GenerateLegalMoves());
+      }
       eval_->Gather(tree.get());
     }
     eval_->Run();
@@ -44,13 +44,33 @@ class Evaluator {
   virtual void MakeBestMove(classic::NodeTree* tree) = 0;
 };
 
+enum class MultiGameMode {
+  // Plays the move with the highest policy.
+  kPolicy,
+  // Plays the move to the position with the best value.
+  kValue,
+  // Full MCTS, with the leaves of all the trees evaluated in shared batches.
+  kSearch,
+};
+
+// Parameters of MultiGameMode::kSearch. The visits per move are taken from
+// the search limits of the players.
+struct MultiGameSearchParams {
+  // Leaves every tree adds to a backend batch. More fill the batch faster, but
+  // make the search less selective.
+  int leaves_per_tree = 2;
+  float cpuct = 1.745f;
+  float fpu_reduction = 0.330f;
+};
+
 // Plays a bunch of games vs itself.
 class MultiSelfPlayGames {
  public:
   // Player options may point to the same network/cache/etc.
   MultiSelfPlayGames(PlayerOptions player1, PlayerOptions player2,
                      const std::vector<Opening>& openings,
-                     SyzygyTablebase* syzygy_tb, bool use_value);
+                     SyzygyTablebase* syzygy_tb, MultiGameMode mode,
+                     const MultiGameSearchParams& search_params = {});
 
   // Starts the games and blocks until all games are finished.
   void Play();
@@ -27,29 +27,50 @@
 
 #include "selfplay/tournament.h"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <numeric>
+#include <sstream>
+#include <unordered_set>
 
-#include "chess/pgn.h"
+#include "chess/opening_book.h"
+#include "neural/coalesce.h"
 #include "neural/memcache.h"
 #include "neural/shared_params.h"
 #include "search/classic/search.h"
 #include "search/classic/stoppers/factory.h"
 #include "selfplay/game.h"
 #include "selfplay/multigame.h"
+#include "trainingdata/streamer.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
 #include "utils/optionsparser.h"
 #include "utils/random.h"
 
 namespace lczero {
 namespace {
-const OptionId kShareTreesId{"share-trees", "ShareTrees",
-                             "When on, game tree is shared for two players; "
-                             "when off, each side has a separate tree."};
+const OptionId kShareTreesId{
+    "share-trees", "ShareTrees",
+    "When on, game tree is shared for two players if they use the same "
+    "backend; when off, each side has a separate tree. Together with "
+    "reuse-tree, each side reuses the subtree searched by the opponent."};
 const OptionId kTotalGamesId{
     "games", "Games",
     "Number of games to play. -1 to play forever, -2 to play equal to book "
     "length, or double book length if mirrored."};
 const OptionId kParallelGamesId{"parallelism", "Parallelism",
                                 "Number of games to play in parallel."};
+const OptionId kMaxParallelGamesId{
+    "max-parallelism", "MaxParallelism",
+    "Maximum number of games to play in parallel. When above parallelism, the "
+    "number of games is adjusted at runtime between the two to keep the "
+    "backend batches filled to target-batch-fill. Requires the backends to "
+    "coalesce the batches (non-zero nn-coalesce-deadline)."};
+const OptionId kTargetBatchFillId{
+    "target-batch-fill", "TargetBatchFill",
+    "Average batch size to aim for when adjusting the number of games played "
+    "in parallel, as a fraction of the maximum batch size."};
 const OptionId kThreadsId{
     "threads", "Threads",
     "Number of (CPU) worker threads to use for every game,", 't'};
@@ -59,10 +80,30 @@ const OptionId kVisitsId{"visits", "Visits",
                          "Number of visits per move to search."};
 const OptionId kTimeMsId{"movetime", "MoveTime",
                          "Time per move, in milliseconds."};
+const OptionId kFastMoveProbabilityId{
+    "fast-move-probability", "FastMoveProbability",
+    "Playout cap randomization: probability of a move being searched with "
+    "only fast-visits visits. Such moves are not written to the training "
+    "data."};
+const OptionId kFastVisitsId{"fast-visits", "FastVisits",
+                             "Number of visits of the fast moves."};
 const OptionId kTrainingId{
     "training", "Training",
     "Enables writing training data. The training data is stored into a "
     "temporary subdirectory that the engine creates."};
+const OptionId kTrainingWriterThreadsId{
+    "training-writer-threads", "TrainingWriterThreads",
+    "Number of background threads that compress and write the training data. "
+    "0 writes it from the game threads."};
+const OptionId kTrainingStreamId{
+    "training-stream", "TrainingStream",
+    "host:port of a server to stream the training data to, instead of writing "
+    "a file per game. The games which can't be delivered are written to the "
+    "files as usual."};
+const OptionId kTrainingStreamBacklogId{
+    "training-stream-backlog", "TrainingStreamBacklog",
+    "Number of games kept in memory while the training data stream server is "
+    "unreachable. The older ones are written to the files."};
 const OptionId kVerboseThinkingId{"verbose-thinking", "VerboseThinking",
                                   "Show verbose thinking messages."};
 const OptionId kPolicyModeSizeId{"policy-mode-size", "PolicyModeSize",
@@ -71,6 +112,13 @@ const OptionId kPolicyModeSizeId{"policy-mode-size", "PolicyModeSize",
 const OptionId kValueModeSizeId{"value-mode-size", "ValueModeSize",
                                 "Number of games per thread in value only "
                                 "mode. Set to 0 to not use value only mode."};
+const OptionId kSearchModeSizeId{
+    "search-mode-size", "SearchModeSize",
+    "Number of games per thread searched together, with the leaves of all the "
+    "games evaluated in one batch. Set to 0 to play the games separately."};
+const OptionId kSearchModeLeavesId{
+    "search-mode-leaves-per-game", "SearchModeLeavesPerGame",
+    "Number of leaves every game adds to a batch in search mode."};
 const OptionId kTournamentResultsFileId{
     "tournament-results-file", "TournamentResultsFile",
     "Name of file to append the tournament results in fake pgn format."};
@@ -85,7 +133,14 @@ const OptionId kDiscardedStartChanceId{
     "discarded due to not getting enough visits."};
 const OptionId kOpeningsFileId{
     "openings-pgn", "OpeningsPgnFile",
-    "A path name to a pgn file containing openings to use."};
+    "A path name to a pgn or epd (.epd) file containing openings to use, or "
+    "to an opening book made from them with the compilebook command, which "
+    "loads instantly."};
+const OptionId kCacheWarmupPliesId{
+    "cache-warmup-plies", "CacheWarmupPlies",
+    "Before the games start, the positions of the first this many plies of "
+    "the openings which will be played are evaluated in batches of the "
+    "maximum size, to fill the NN cache. 0 disables."};
 const OptionId kOpeningsMirroredId{
     "mirror-openings", "MirrorOpenings",
     "If true, each opening will be played in pairs. "
@@ -118,18 +173,28 @@ void SelfPlayTournament::PopulateOptions(OptionsParser* options) {
   options->Add<BoolOption>(kShareTreesId) = true;
   options->Add<IntOption>(kTotalGamesId, -2, 999999) = -1;
   options->Add<IntOption>(kParallelGamesId, 1, 256) = 8;
+  options->Add<IntOption>(kMaxParallelGamesId, 0, 1024) = 0;
+  options->Add<FloatOption>(kTargetBatchFillId, 0.1f, 1.0f) = 0.9f;
   options->Add<IntOption>(kPlayoutsId, -1, 999999999) = -1;
   options->Add<IntOption>(kVisitsId, -1, 999999999) = -1;
   options->Add<IntOption>(kTimeMsId, -1, 999999999) = -1;
+  options->Add<FloatOption>(kFastMoveProbabilityId, 0.0f, 1.0f) = 0.0f;
+  options->Add<IntOption>(kFastVisitsId, 0, 999999999) = 0;
   options->Add<BoolOption>(kTrainingId) = false;
+  options->Add<IntOption>(kTrainingWriterThreadsId, 0, 16) = 1;
+  options->Add<StringOption>(kTrainingStreamId);
+  options->Add<IntOption>(kTrainingStreamBacklogId, 0, 1000000) = 1000;
   options->Add<BoolOption>(kVerboseThinkingId) = false;
   options->Add<IntOption>(kPolicyModeSizeId, 0, 1024) = 0;
   options->Add<IntOption>(kValueModeSizeId, 0, 64) = 0;
+  options->Add<IntOption>(kSearchModeSizeId, 0, 1024) = 0;
+  options->Add<IntOption>(kSearchModeLeavesId, 1, 64) = 2;
   options->Add<StringOption>(kTournamentResultsFileId) = "";
   options->Add<BoolOption>(kMoveThinkingId) = false;
   options->Add<FloatOption>(kResignPlaythroughId, 0.0f, 100.0f) = 0.0f;
   options->Add<FloatOption>(kDiscardedStartChanceId, 0.0f, 100.0f) = 0.0f;
   options->Add<StringOption>(kOpeningsFileId) = "";
+  options->Add<IntOption>(kCacheWarmupPliesId, 0, 100) = 0;
   options->Add<BoolOption>(kOpeningsMirroredId) = false;
   std::vector<std::string> openings_modes = {"sequential", "shuffled",
                                              "random"};
@@ -152,9 +217,11 @@ void SelfPlayTournament::PopulateOptions(OptionsParser* options) {
   defaults->Set<float>(classic::SearchParams::kFpuValueId, 0.0f);
   defaults->Set<std::string>(SharedBackendParams::kHistoryFill, "no");
   defaults->Set<std::string>(SharedBackendParams::kBackendId, "multiplexing");
+  defaults->Set<bool>(SharedBackendParams::kNNCoalesceDeduplicateId, true);
   defaults->Set<bool>(classic::SearchParams::kStickyEndgamesId, false);
   defaults->Set<bool>(classic::SearchParams::kTwoFoldDrawsId, false);
   defaults->Set<int>(classic::SearchParams::kTaskWorkersPerSearchWorkerId, 0);
+  defaults->Set<bool>(classic::SearchParams::kSharedSearchThreadsId, true);
 }
 
 SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
@@ -171,27 +238,40 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
       kTotalGames(options.Get<int>(kTotalGamesId)),
       kShareTree(options.Get<bool>(kShareTreesId)),
       kParallelism(options.Get<int>(kParallelGamesId)),
+      kMaxParallelism(std::max<size_t>(options.Get<int>(kMaxParallelGamesId),
+                                       kParallelism)),
+      kTargetBatchFill(options.Get<float>(kTargetBatchFillId)),
       kTraining(options.Get<bool>(kTrainingId)),
       kResignPlaythrough(options.Get<float>(kResignPlaythroughId)),
       kPolicyGamesSize(options.Get<int>(kPolicyModeSizeId)),
       kValueGamesSize(options.Get<int>(kValueModeSizeId)),
+      kSearchGamesSize(options.Get<int>(kSearchModeSizeId)),
       kTournamentResultsFile(
           options.Get<std::string>(kTournamentResultsFileId)),
-      kDiscardedStartChance(options.Get<float>(kDiscardedStartChanceId)) {
-  multi_games_size_ = std::max(kPolicyGamesSize, kValueGamesSize);
+      kDiscardedStartChance(options.Get<float>(kDiscardedStartChanceId)),
+      kCacheWarmupPlies(options.Get<int>(kCacheWarmupPliesId)) {
+  multi_games_size_ =
+      std::max({kPolicyGamesSize, kValueGamesSize, kSearchGamesSize});
+  search_params_.leaves_per_tree = options.Get<int>(kSearchModeLeavesId);
   std::string book = options.Get<std::string>(kOpeningsFileId);
   if (!book.empty()) {
-    PgnReader book_reader;
-    book_reader.AddPgnFile(book);
-    openings_ = book_reader.ReleaseGames();
+    openings_ = OpeningBook::IsBookFile(book)
+                    ? std::make_unique<OpeningBook>(book)
+                    : std::make_unique<OpeningBook>(ReadOpeningFile(book, 0));
     if (options.Get<std::string>(kOpeningsModeId) == "shuffled") {
-      Random::Get().Shuffle(openings_.begin(), openings_.end());
+      opening_order_.resize(openings_->size());
+      std::iota(opening_order_.begin(), opening_order_.end(), 0);
+      Random::Get().Shuffle(opening_order_.begin(), opening_order_.end());
     }
   }
-  if (kPolicyGamesSize > 0 && kValueGamesSize > 0) {
-    throw Exception("Can't do both policy and value games at the same time.");
+  if ((kPolicyGamesSize > 0) + (kValueGamesSize > 0) +
+          (kSearchGamesSize > 0) >
+      1) {
+    throw Exception(
+        "Can't do more than one of policy, value and search games at the same "
+        "time.");
   }
-  if (multi_games_size_ > 0 && openings_.size() == 0) {
+  if (multi_games_size_ > 0 && NumOpenings() == 0) {
     throw Exception(
         "Policy/Value games are deterministic, needs opening book to be "
         "useful.");
@@ -199,12 +279,21 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
   if (multi_games_size_ > 0 &&
       (kTotalGames == -1 ||
        (kTotalGames > 0 &&
-        static_cast<size_t>(kTotalGames) > openings_.size() * 2))) {
+        static_cast<size_t>(kTotalGames) > NumOpenings() * 2))) {
     throw Exception(
         "Policy/Value games are deterministic, you do not want to go through "
         "the "
         "opening book more than once.");
   }
+  if (kTraining && !options.Get<std::string>(kTrainingStreamId).empty()) {
+    training_sink_ = std::make_unique<TrainingDataStreamer>(
+        options.Get<std::string>(kTrainingStreamId),
+        options.Get<int>(kTrainingStreamBacklogId),
+        TrainingDataPackWriter::Options{});
+  } else if (kTraining && options.Get<int>(kTrainingWriterThreadsId) > 0) {
+    training_sink_ = std::make_unique<TrainingDataWriterPool>(
+        options.Get<int>(kTrainingWriterThreadsId), kMaxQueuedTrainingChunks);
+  }
   // If playing just one game, the player1 is white, otherwise randomize.
   if (kTotalGames != 1) {
     first_game_black_ = Random::Get().GetBool();
@@ -214,7 +303,9 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
   static constexpr const char* kPlayerColors[2] = {"white", "black"};
 
   // Initializing networks.
-  std::vector<std::shared_ptr<Backend>> backend_list;
+  // Players and colors with the same backend configuration share the backend,
+  // and so the NN cache, across all the tournament threads.
+  std::vector<std::shared_ptr<CachingBackend>> backend_list;
   for (int name_idx : {0, 1}) {
     for (int color_idx : {0, 1}) {
       const auto& name = kPlayerNames[name_idx];
@@ -227,9 +318,11 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
         }
       }
       if (!backends_[name_idx][color_idx]) {
+        auto coalescer = CreateCoalescingBackend(
+            BackendManager::Get()->CreateFromParams(opts), opts);
+        coalescers_.push_back(coalescer.get());
         backends_[name_idx][color_idx] =
-            CreateMemCache(BackendManager::Get()->CreateFromParams(opts),
-                           options.GetSubdict(name));
+            CreateMemCache(std::move(coalescer), options.GetSubdict(name));
         backend_list.emplace_back(backends_[name_idx][color_idx]);
       }
     }
@@ -244,13 +337,22 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
       limits.playouts = dict.Get<int>(kPlayoutsId);
       limits.visits = dict.Get<int>(kVisitsId);
       limits.movetime = dict.Get<int>(kTimeMsId);
+      limits.fast_probability = dict.Get<float>(kFastMoveProbabilityId);
+      limits.fast_visits = dict.Get<int>(kFastVisitsId);
+      if (limits.fast_probability > 0.0f && limits.fast_visits == 0) {
+        throw Exception("Fast moves need --fast-visits.");
+      }
 
       if (multi_games_size_ == 0 && limits.playouts == -1 &&
           limits.visits == -1 && limits.movetime == -1) {
         throw Exception(
             "Please define --visits, --playouts or --movetime, otherwise it's "
             "not clear when to stop search.");
-      } else if (multi_games_size_ > 0 &&
+      } else if (kSearchGamesSize > 0 &&
+                 (limits.visits <= 0 || limits.playouts != -1 ||
+                  limits.movetime != -1)) {
+        throw Exception("Search mode needs --visits and only it.");
+      } else if (kSearchGamesSize == 0 && multi_games_size_ > 0 &&
                  (limits.playouts != -1 || limits.visits != -1 ||
                   limits.movetime != -1)) {
         throw Exception(
@@ -272,20 +374,104 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
   }
 }
 
+size_t SelfPlayTournament::NumOpenings() const {
+  return openings_ ? openings_->size() : 0;
+}
+
+Opening SelfPlayTournament::GetOpening(size_t idx) const {
+  return openings_->Get(opening_order_.empty() ? idx : opening_order_[idx]);
+}
+
+void SelfPlayTournament::WarmUpCaches() {
+  if (kCacheWarmupPlies == 0 || NumOpenings() == 0) return;
+  const auto start = std::chrono::steady_clock::now();
+  // Only the openings which the games will get to, unless they are random.
+  size_t num_openings = NumOpenings();
+  if (kTotalGames > 0 &&
+      player_options_[0][0].Get<std::string>(kOpeningsModeId) != "random") {
+    const bool mirrored = player_options_[0][0].Get<bool>(kOpeningsMirroredId);
+    num_openings = std::min<size_t>(
+        num_openings, mirrored ? (kTotalGames + 1) / 2 : kTotalGames);
+  }
+  // Positions with their history, every history once.
+  std::vector<std::vector<Position>> histories;
+  std::vector<MoveList> legal_moves;
+  std::unordered_set<uint64_t> seen;
+  for (size_t idx = 0; idx < num_openings; ++idx) {
+    const Opening opening = GetOpening(idx);
+    PositionHistory history;
+    history.Reset(Position::FromFen(opening.start_fen));
+    uint64_t hash = 0;
+    for (int ply = 0;; ++ply) {
+      hash = HashCat(hash, history.Last().Hash());
+      MoveList moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (moves.empty()) break;
+      if (seen.insert(hash).second) {
+        const auto positions = history.GetPositions();
+        histories.emplace_back(positions.begin(), positions.end());
+        legal_moves.push_back(std::move(moves));
+      }
+      if (ply + 1 >= kCacheWarmupPlies ||
+          ply >= static_cast<int>(opening.moves.size())) {
+        break;
+      }
+      Move move = opening.moves[ply];
+      if (history.IsBlackToMove()) move.Flip();
+      history.Append(move);
+    }
+  }
+
+  std::vector<CachingBackend*> backends;
+  for (const auto& player : backends_) {
+    for (const auto& backend : player) {
+      if (std::find(backends.begin(), backends.end(), backend.get()) ==
+          backends.end()) {
+        backends.push_back(backend.get());
+      }
+    }
+  }
+  for (CachingBackend* backend : backends) {
+    const BackendAttributes attrs = backend->GetAttributes();
+    const size_t batch_size = std::max(
+        attrs.maximum_batch_size > 0 ? attrs.maximum_batch_size
+                                     : attrs.recommended_batch_size,
+        1);
+    std::vector<float> q(batch_size), d(batch_size), m(batch_size), p;
+    std::vector<size_t> p_offsets(batch_size + 1);
+    for (size_t begin = 0; begin < histories.size(); begin += batch_size) {
+      const size_t end = std::min(begin + batch_size, histories.size());
+      std::vector<EvalPosition> batch;
+      size_t moves = 0;
+      for (size_t i = begin; i < end; ++i) {
+        batch.push_back({histories[i], legal_moves[i]});
+        moves += legal_moves[i].size();
+      }
+      if (p.size() < moves) p.resize(moves);
+      backend->EvaluateBatch(batch, {q, d, m, p, p_offsets});
+    }
+  }
+  LOGFILE << "Warmed up the NN cache with " << histories.size()
+          << " positions of " << num_openings << " openings in "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+          << "ms.";
+}
+
 void SelfPlayTournament::PlayOneGame(int game_number) {
   bool player1_black;  // Whether player1 will player as black in this game.
   Opening opening;
   {
     Mutex::Lock lock(mutex_);
     player1_black = ((game_number % 2) == 1) != first_game_black_;
-    if (!openings_.empty()) {
+    if (NumOpenings() > 0) {
       if (player_options_[0][0].Get<bool>(kOpeningsMirroredId)) {
-        opening = openings_[(game_number / 2) % openings_.size()];
+        opening = GetOpening((game_number / 2) % NumOpenings());
       } else if (player_options_[0][0].Get<std::string>(kOpeningsModeId) ==
                  "random") {
-        opening = openings_[Random::Get().GetInt(0, openings_.size() - 1)];
+        opening = GetOpening(Random::Get().GetInt(0, NumOpenings() - 1));
       } else {
-        opening = openings_[game_number % openings_.size()];
+        opening = GetOpening(game_number % NumOpenings());
       }
     }
     if (discard_pile_.size() > 0 &&
@@ -376,8 +562,11 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
   SyzygyTablebase* syzygy_tb;
   {
     Mutex::Lock lock(mutex_);
+    // The evaluations in a shared tree must come from the same network.
+    const bool share_tree =
+        kShareTree && options[0].backend == options[1].backend;
     games_.emplace_front(std::make_unique<SelfPlayGame>(options[0], options[1],
-                                                        kShareTree, opening));
+                                                        share_tree, opening));
     game_iter = games_.begin();
     syzygy_tb = syzygy_tb_.get();
   }
@@ -409,12 +598,17 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
     }
     if (kTraining &&
         game_info.play_start_ply < static_cast<int>(game_info.moves.size())) {
-      TrainingDataWriter writer(game_number);
+      TrainingDataWriter writer(game_number, training_sink_.get());
       game.WriteTrainingData(&writer);
-      writer.Finalize();
-      game_info.training_filename = writer.GetFileName();
+      // The game is reported once it's stored, with the file it went into.
+      writer.Finalize(
+          [this, game_info](const std::string& filename) mutable {
+            game_info.training_filename = filename;
+            ReportGame(game_info);
+          });
+    } else {
+      ReportGame(game_info);
     }
-    game_callback_(game_info);
 
     // Update tournament stats.
     {
@@ -426,7 +620,7 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
       ++tournament_info_.results[result][player1_black ? 1 : 0];
       tournament_info_.move_count_ += game.move_count_;
       tournament_info_.nodes_total_ += game.nodes_total_;
-      tournament_callback_(tournament_info_);
+      ReportTournamentInfo();
     }
   }
 
@@ -437,27 +631,32 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
 }
 
 void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
-  bool use_value = kValueGamesSize > 0;
+  const MultiGameMode mode = kSearchGamesSize > 0  ? MultiGameMode::kSearch
+                             : kValueGamesSize > 0 ? MultiGameMode::kValue
+                                                   : MultiGameMode::kPolicy;
   std::vector<Opening> openings;
   openings.reserve(game_count / 2);
   size_t opening_basis = game_id / 2;
   {
     Mutex::Lock lock(mutex_);
     for (size_t i = 0; i < game_count / 2; i++) {
-      openings.push_back(openings_[(opening_basis + i) % openings_.size()]);
+      openings.push_back(GetOpening((opening_basis + i) % NumOpenings()));
     }
   }
 
   PlayerOptions options[2];
   options[0].backend = backends_[0][0].get();
+  options[0].search_limits = search_limits_[0][0];
   options[1].backend = backends_[1][1].get();
+  options[1].search_limits = search_limits_[1][1];
 
   std::list<std::unique_ptr<MultiSelfPlayGames>>::iterator game1_iter;
   auto aborted = false;
   {
     Mutex::Lock lock(mutex_);
     multigames_.emplace_front(std::make_unique<MultiSelfPlayGames>(
-        options[0], options[1], openings, syzygy_tb_.get(), use_value));
+        options[0], options[1], openings, syzygy_tb_.get(), mode,
+        search_params_));
     game1_iter = multigames_.begin();
     aborted = abort_;
   }
@@ -467,13 +666,16 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
   if (!aborted) game1.Play();
 
   options[0].backend = backends_[0][1].get();
+  options[0].search_limits = search_limits_[0][1];
   options[1].backend = backends_[1][0].get();
+  options[1].search_limits = search_limits_[1][0];
 
   std::list<std::unique_ptr<MultiSelfPlayGames>>::iterator game2_iter;
   {
     Mutex::Lock lock(mutex_);
     multigames_.emplace_front(std::make_unique<MultiSelfPlayGames>(
-        options[1], options[0], openings, syzygy_tb_.get(), use_value));
+        options[1], options[0], openings, syzygy_tb_.get(), mode,
+        search_params_));
     game2_iter = multigames_.begin();
     aborted = abort_;
   }
@@ -492,7 +694,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
       game_info.moves = game1.GetMoves(i);
       game_info.initial_fen = openings[i].start_fen;
       game_info.play_start_ply = openings[i].moves.size();
-      game_callback_(game_info);
+      ReportGame(game_info);
 
       // Update tournament stats.
       {
@@ -501,7 +703,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
                      : game1_res == GameResult::WHITE_WON ? 0
                                                           : 2;
         ++tournament_info_.results[result][0];
-        tournament_callback_(tournament_info_);
+        ReportTournamentInfo();
       }
     }
     auto game2_res = game2.GetGameResult(i);
@@ -514,7 +716,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
       game_info.moves = game2.GetMoves(i);
       game_info.initial_fen = openings[i].start_fen;
       game_info.play_start_ply = openings[i].moves.size();
-      game_callback_(game_info);
+      ReportGame(game_info);
 
       // Update tournament stats.
       {
@@ -523,7 +725,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
                      : game2_res == GameResult::WHITE_WON ? 2
                                                           : 0;
         ++tournament_info_.results[result][1];
-        tournament_callback_(tournament_info_);
+        ReportTournamentInfo();
       }
     }
   }
@@ -537,6 +739,14 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
 void SelfPlayTournament::Worker() {
   // Play games while game limit is not reached (or while not aborted).
   while (true) {
+    {
+      // Leave if the parallelism controller wants fewer games.
+      Mutex::Lock lock(threads_mutex_);
+      if (running_workers_ > target_workers_) {
+        --running_workers_;
+        return;
+      }
+    }
     int game_id;
     int count = 0;
     {
@@ -556,7 +766,7 @@ void SelfPlayTournament::Worker() {
         int to_take = 2 * multi_games_size_;
         int max_take = 2 * multi_games_size_;
         if (kTotalGames != -1) {
-          int cap = kTotalGames == -2 ? openings_.size() * 2 : kTotalGames;
+          int cap = kTotalGames == -2 ? NumOpenings() * 2 : kTotalGames;
           to_take = std::min(max_take, cap - games_count_);
         }
         if (to_take <= 0) {
@@ -568,9 +778,9 @@ void SelfPlayTournament::Worker() {
       } else {
         bool mirrored = player_options_[0][0].Get<bool>(kOpeningsMirroredId);
         if ((kTotalGames >= 0 && games_count_ >= kTotalGames) ||
-            (kTotalGames == -2 && !openings_.empty() &&
+            (kTotalGames == -2 && NumOpenings() > 0 &&
              games_count_ >=
-                 static_cast<int>(openings_.size()) * (mirrored ? 2 : 1)))
+                 static_cast<int>(NumOpenings()) * (mirrored ? 2 : 1)))
           break;
         game_id = games_count_++;
       }
@@ -581,25 +791,169 @@ void SelfPlayTournament::Worker() {
       PlayOneGame(game_id);
     }
   }
+  Mutex::Lock lock(threads_mutex_);
+  --running_workers_;
+}
+
+void SelfPlayTournament::StartWorker() {
+  ++running_workers_;
+  threads_.emplace_back([this]() { Worker(); });
 }
 
 void SelfPlayTournament::StartAsync() {
+  WarmUpCaches();
   Mutex::Lock lock(threads_mutex_);
-  while (threads_.size() < kParallelism) {
-    threads_.emplace_back([&]() { Worker(); });
+  target_workers_ = kParallelism;
+  while (threads_.size() < kParallelism) StartWorker();
+  if (kMaxParallelism > kParallelism) {
+    controller_thread_ = std::thread([this]() { ControlParallelism(); });
+  }
+}
+
+void SelfPlayTournament::ControlParallelism() {
+  // Batch fill outside of target +/- this is corrected.
+  constexpr float kFillTolerance = 0.05f;
+  uint64_t last_positions = 0;
+  uint64_t last_capacity = 0;
+  std::unique_lock<std::mutex> lock(controller_mutex_);
+  while (!controller_cv_.wait_for(lock, kControllerInterval,
+                                  [this]() { return stop_controller_; })) {
+    uint64_t positions = 0;
+    uint64_t capacity = 0;
+    for (const auto* coalescer : coalescers_) {
+      const auto stats = coalescer->GetStats();
+      positions += stats.positions;
+      capacity += stats.batches * stats.max_batch_size;
+    }
+    const uint64_t interval_positions = positions - last_positions;
+    const uint64_t interval_capacity = capacity - last_capacity;
+    last_positions = positions;
+    last_capacity = capacity;
+    // No batches, or the batches are not coalesced.
+    if (interval_capacity == 0) continue;
+    const float fill = static_cast<float>(interval_positions) /
+                       static_cast<float>(interval_capacity);
+
+    Mutex::Lock threads_lock(threads_mutex_);
+    if (workers_done_) break;
+    // Step by an eighth, so that large configurations converge quickly.
+    const size_t step = std::max<size_t>(1, target_workers_ / 8);
+    const size_t old_target = target_workers_;
+    if (fill < kTargetBatchFill - kFillTolerance) {
+      target_workers_ = std::min(kMaxParallelism, target_workers_ + step);
+    } else if (fill > kTargetBatchFill + kFillTolerance) {
+      target_workers_ = std::max(kParallelism, target_workers_ - step);
+    }
+    if (target_workers_ > old_target) {
+      while (running_workers_ < target_workers_) StartWorker();
+    }
+    if (target_workers_ != old_target) {
+      LOGFILE << "Batch fill " << fill << ", games in parallel "
+              << old_target << " -> " << target_workers_;
+    }
+  }
+}
+
+void SelfPlayTournament::ReportTournamentInfo() {
+  for (int name_idx : {0, 1}) {
+    CachingBackend::CacheStats stats;
+    for (int color_idx : {0, 1}) {
+      // Don't count the backend shared by both colors twice.
+      if (color_idx == 1 &&
+          backends_[name_idx][1] == backends_[name_idx][0]) {
+        continue;
+      }
+      const auto color_stats = backends_[name_idx][color_idx]->GetCacheStats();
+      stats.l1_hits += color_stats.l1_hits;
+      stats.l2_hits += color_stats.l2_hits;
+      stats.host_hits += color_stats.host_hits;
+      stats.misses += color_stats.misses;
+    }
+    const uint64_t hits = stats.l1_hits + stats.l2_hits + stats.host_hits;
+    tournament_info_.nn_cache_hits[name_idx] = hits;
+    tournament_info_.nn_cache_lookups[name_idx] = hits + stats.misses;
+  }
+  {
+    std::lock_guard<std::mutex> lock(reporter_mutex_);
+    StartReporterIfNeeded();
+    pending_tournament_info_ = tournament_info_;
   }
+  reporter_cv_.notify_one();
+}
+
+void SelfPlayTournament::ReportGame(const GameInfo& game_info) {
+  {
+    std::lock_guard<std::mutex> lock(reporter_mutex_);
+    StartReporterIfNeeded();
+    pending_games_.push_back(game_info);
+  }
+  reporter_cv_.notify_one();
+}
+
+void SelfPlayTournament::Reporter() {
+  std::unique_lock<std::mutex> lock(reporter_mutex_);
+  while (true) {
+    reporter_cv_.wait(lock, [&]() {
+      return stop_reporter_ || !pending_games_.empty() ||
+             pending_tournament_info_ || !pending_results_.empty();
+    });
+    if (pending_games_.empty() && !pending_tournament_info_ &&
+        pending_results_.empty()) {
+      return;
+    }
+    // Everything queued so far goes out at once.
+    std::vector<GameInfo> games;
+    games.swap(pending_games_);
+    std::optional<TournamentInfo> tournament_info;
+    tournament_info.swap(pending_tournament_info_);
+    std::string results;
+    results.swap(pending_results_);
+    lock.unlock();
+    for (const GameInfo& game_info : games) game_callback_(game_info);
+    if (!results.empty()) {
+      std::ofstream output(kTournamentResultsFile, std::ios_base::app);
+      output << results;
+    }
+    if (tournament_info) tournament_callback_(*tournament_info);
+    lock.lock();
+  }
+}
+
+void SelfPlayTournament::StartReporterIfNeeded() {
+  if (!reporter_thread_.joinable() && !stop_reporter_) {
+    reporter_thread_ = std::thread([this]() { Reporter(); });
+  }
+}
+
+void SelfPlayTournament::StopReporter() {
+  {
+    std::lock_guard<std::mutex> lock(reporter_mutex_);
+    stop_reporter_ = true;
+  }
+  reporter_cv_.notify_one();
+  if (reporter_thread_.joinable()) reporter_thread_.join();
 }
 
 void SelfPlayTournament::RunBlocking() {
-  if (kParallelism == 1) {
+  if (kParallelism == 1 && kMaxParallelism == 1) {
     // No need for multiple threads if there is one worker.
+    WarmUpCaches();
+    {
+      Mutex::Lock lock(threads_mutex_);
+      target_workers_ = 1;
+      running_workers_ = 1;
+    }
     Worker();
-    Mutex::Lock lock(mutex_);
-    if (!abort_) {
-      SaveResults();
-      tournament_info_.finished = true;
-      tournament_callback_(tournament_info_);
+    if (training_sink_) training_sink_->Wait();
+    {
+      Mutex::Lock lock(mutex_);
+      if (!abort_) {
+        SaveResults();
+        tournament_info_.finished = true;
+        ReportTournamentInfo();
+      }
     }
+    StopReporter();
   } else {
     StartAsync();
     Wait();
@@ -607,21 +961,39 @@ void SelfPlayTournament::RunBlocking() {
 }
 
 void SelfPlayTournament::Wait() {
-  {
-    Mutex::Lock lock(threads_mutex_);
-    while (!threads_.empty()) {
-      threads_.back().join();
+  // The parallelism controller may start workers while the others are joined,
+  // so the lock is not held across the joins.
+  while (true) {
+    std::thread thread;
+    {
+      Mutex::Lock lock(threads_mutex_);
+      if (threads_.empty()) {
+        workers_done_ = true;
+        break;
+      }
+      thread = std::move(threads_.back());
       threads_.pop_back();
     }
+    thread.join();
   }
+  if (controller_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(controller_mutex_);
+      stop_controller_ = true;
+    }
+    controller_cv_.notify_all();
+    controller_thread_.join();
+  }
+  if (training_sink_) training_sink_->Wait();
   {
     Mutex::Lock lock(mutex_);
     if (!abort_) {
       SaveResults();
       tournament_info_.finished = true;
-      tournament_callback_(tournament_info_);
+      ReportTournamentInfo();
     }
   }
+  StopReporter();
 }
 
 void SelfPlayTournament::Abort() {
@@ -645,12 +1017,12 @@ SelfPlayTournament::~SelfPlayTournament() {
 
 void SelfPlayTournament::SaveResults() {
   if (kTournamentResultsFile.empty()) return;
-  std::ofstream output(kTournamentResultsFile, std::ios_base::app);
   auto p1name =
       player_options_[0][0].Get<std::string>(SharedBackendParams::kWeightsId);
   auto p2name =
       player_options_[1][0].Get<std::string>(SharedBackendParams::kWeightsId);
 
+  std::ostringstream output;
   output << std::endl;
   output << "[White \"" << p1name << "\"]" << std::endl;
   output << "[Black \"" << p2name << "\"]" << std::endl;
@@ -663,6 +1035,12 @@ void SelfPlayTournament::SaveResults() {
   output << "[Results \"" << tournament_info_.results[2][1] << " "
          << tournament_info_.results[0][1] << " "
          << tournament_info_.results[1][1] << "\"]" << std::endl;
+  {
+    std::lock_guard<std::mutex> lock(reporter_mutex_);
+    StartReporterIfNeeded();
+    pending_results_ += output.str();
+  }
+  reporter_cv_.notify_one();
 }
 
 }  // namespace lczero
@@ -27,13 +27,23 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
-#include "chess/pgn.h"
+#include "chess/opening_book.h"
 #include "neural/backend.h"
+#include "neural/coalesce.h"
+#include "neural/memcache.h"
 #include "neural/register.h"
 #include "selfplay/game.h"
 #include "selfplay/multigame.h"
+#include "trainingdata/writer.h"
 #include "utils/mutex.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
@@ -70,9 +80,29 @@ class SelfPlayTournament {
 
  private:
   void Worker();
+  void StartWorker() REQUIRES(threads_mutex_);
+  // Adds or removes workers to keep the backend batches filled to the target,
+  // see max-parallelism option.
+  void ControlParallelism();
+  // Evaluates the first plies of the openings to fill the NN caches, see
+  // cache-warmup-plies option.
+  void WarmUpCaches();
+  size_t NumOpenings() const;
+  // Gets the opening with the given index, in the order of the openings mode.
+  Opening GetOpening(size_t idx) const;
   void PlayOneGame(int game_id);
   void PlayMultiGames(int game_id, size_t game_count);
   void SaveResults() REQUIRES(mutex_);
+  // Updates the NN cache stats and queues the tournament callback.
+  void ReportTournamentInfo() REQUIRES(mutex_);
+  // Queues the game callback.
+  void ReportGame(const GameInfo& game_info);
+  // Calls the callbacks and writes the results file for the queued reports,
+  // so that the game threads don't wait for the output.
+  void Reporter();
+  void StartReporterIfNeeded();
+  // Sends the remaining reports and stops the reporter thread.
+  void StopReporter();
 
   Mutex mutex_;
   // Whether first game will be black for player1.
@@ -82,7 +112,10 @@ class SelfPlayTournament {
   // Number of games which already started.
   int games_count_ GUARDED_BY(mutex_) = 0;
   bool abort_ GUARDED_BY(mutex_) = false;
-  std::vector<Opening> openings_ GUARDED_BY(mutex_);
+  // Immutable once the tournament is constructed.
+  std::unique_ptr<OpeningBook> openings_;
+  // Permutation of the book in the shuffled openings mode, empty otherwise.
+  std::vector<size_t> opening_order_;
   // Games in progress. Exposed here to be able to abort them in case if
   // Abort(). Stored as list and not vector so that threads can keep iterators
   // to them and not worry that it becomes invalid.
@@ -93,9 +126,34 @@ class SelfPlayTournament {
 
   Mutex threads_mutex_;
   std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
+  // Workers which are playing games, and the number of them the parallelism
+  // controller wants. Extra workers leave before starting the next game.
+  size_t running_workers_ GUARDED_BY(threads_mutex_) = 0;
+  size_t target_workers_ GUARDED_BY(threads_mutex_) = 0;
+  // Set once all the workers are joined, no more workers are started then.
+  bool workers_done_ GUARDED_BY(threads_mutex_) = false;
+
+  // Parallelism controller, only started if max-parallelism is above
+  // parallelism.
+  static constexpr std::chrono::seconds kControllerInterval{5};
+  std::thread controller_thread_;
+  std::mutex controller_mutex_;
+  std::condition_variable controller_cv_;
+  bool stop_controller_ = false;
+  // Reports queued for the reporter thread, which is started with the first
+  // one. Only the latest tournament info is kept.
+  std::thread reporter_thread_;
+  std::mutex reporter_mutex_;
+  std::condition_variable reporter_cv_;
+  std::vector<GameInfo> pending_games_;
+  std::optional<TournamentInfo> pending_tournament_info_;
+  std::string pending_results_;
+  bool stop_reporter_ = false;
+  // Owned by backends_, the source of the batch fill stats.
+  std::vector<CoalescingBackend*> coalescers_;
 
   // [player1 or player2][white or black].
-  std::shared_ptr<Backend> backends_[2][2];
+  std::shared_ptr<CachingBackend> backends_[2][2];
   const OptionsDict player_options_[2][2];
   SelfPlayLimits search_limits_[2][2];
 
@@ -105,13 +163,23 @@ class SelfPlayTournament {
   const int kTotalGames;
   const bool kShareTree;
   const size_t kParallelism;
+  const size_t kMaxParallelism;
+  const float kTargetBatchFill;
   const bool kTraining;
   const float kResignPlaythrough;
   const int kPolicyGamesSize;
   const int kValueGamesSize;
+  const int kSearchGamesSize;
   int multi_games_size_;
+  MultiGameSearchParams search_params_;
   const std::string kTournamentResultsFile;
   const float kDiscardedStartChance;
+  const int kCacheWarmupPlies;
+  // Training data chunks buffered for writing, about 8KiB each.
+  static constexpr size_t kMaxQueuedTrainingChunks = 8192;
+  // Writes or streams the training data off the game threads, if enabled.
+  // Declared last so that the games are stored before the rest is destroyed.
+  std::unique_ptr<TrainingDataSink> training_sink_;
 };
 
 }  // namespace lczero
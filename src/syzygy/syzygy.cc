@@ -34,6 +34,7 @@
 #include "syzygy/syzygy.h"
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -43,6 +44,7 @@
 #include <random>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "utils/exception.h"
 #include "utils/logging.h"
@@ -130,8 +132,11 @@ struct EncInfo {
 
 struct BaseEntry {
   Key key;
+  // File name of the table, without the suffix.
+  char name[16];
   uint8_t* data[3];
   map_t mapping[3];
+  size_t size[3];
   std::atomic<bool> ready[3];
   uint8_t num;
   bool symmetric;
@@ -236,26 +241,6 @@ bool is_capture(const ChessBoard& pos, const Move& move) {
 
 constexpr char kPieceToChar[] = " PNBRQK  pnbrqk";
 
-// Given a position, produce a text string of the form KQPvKRP, where
-// "KQP" represents the white pieces if flip == false and the black pieces
-// if flip == true.
-void prt_str(const ChessBoard& pos, char* str, bool flip) {
-  const bool first_theirs = flip ^ pos.flipped();
-
-  for (int pt = KING; pt >= PAWN; pt--) {
-    for (int i = count_pieces(pos, pt, first_theirs); i > 0; i--) {
-      *str++ = kPieceToChar[pt];
-    }
-  }
-  *str++ = 'v';
-  for (int pt = KING; pt >= PAWN; pt--) {
-    for (int i = count_pieces(pos, pt, !first_theirs); i > 0; i--) {
-      *str++ = kPieceToChar[pt];
-    }
-  }
-  *str++ = 0;
-}
-
 #define pchr(i) kPieceToChar[QUEEN - (i)]
 #define Swap(a, b) \
   {                \
@@ -1009,6 +994,51 @@ class SyzygyTablebaseImpl {
 
   int max_cardinality() const { return max_cardinality_; }
 
+  // Maps the WDL and DTZ tables with up to @max_pieces pieces and reads them
+  // into memory, so that the first probes don't wait for the disk. Returns
+  // early when @stop is set.
+  void preload(int max_pieces, const std::atomic<bool>& stop) {
+    size_t bytes = 0;
+    auto preload_entry = [&](BaseEntry* be) {
+      if (be->num > max_pieces) return;
+      for (const int type : {WDL, DTZ}) {
+        if (stop.load(std::memory_order_relaxed)) return;
+        if (type == DTZ && !be->hasDtz) continue;
+        if (!ensure_ready(be, type)) continue;
+        read_into_memory(be->data[type], be->size[type], stop);
+        bytes += be->size[type];
+      }
+    };
+    for (int i = 0; i < num_piece_entries_; i++) {
+      preload_entry(&piece_entries_[i]);
+    }
+    for (int i = 0; i < num_pawn_entries_; i++) {
+      preload_entry(&pawn_entries_[i]);
+    }
+    LOGFILE << "Preloaded " << bytes / (1024 * 1024)
+            << " MiB of Syzygy tables with up to " << max_pieces
+            << " pieces.";
+  }
+
+  // Returns the total size of the mapped tables, and how much of it is
+  // resident in memory.
+  void get_memory_stats(size_t* mapped, size_t* resident) {
+    *mapped = 0;
+    *resident = 0;
+    auto add_entry = [&](BaseEntry* be) {
+      for (int type = 0; type < 3; type++) {
+        if (!atomic_load_explicit(&be->ready[type],
+                                  std::memory_order_acquire)) {
+          continue;
+        }
+        *mapped += be->size[type];
+        *resident += get_resident_size(be->data[type], be->size[type]);
+      }
+    };
+    for (int i = 0; i < num_piece_entries_; i++) add_entry(&piece_entries_[i]);
+    for (int i = 0; i < num_pawn_entries_; i++) add_entry(&pawn_entries_[i]);
+  }
+
   int probe_wdl_table(const ChessBoard& pos, int* success) {
     return probe_table(pos, 0, success, WDL);
   }
@@ -1038,7 +1068,8 @@ class SyzygyTablebaseImpl {
     return !name_for_tb(str, suffix).empty();
   }
 
-  void* map_tb(const char* name, const char* suffix, map_t* mapping) {
+  void* map_tb(const char* name, const char* suffix, map_t* mapping,
+               size_t* size) {
     std::string fname = name_for_tb(name, suffix);
     void* base_address;
 #ifndef _WIN32
@@ -1050,6 +1081,7 @@ class SyzygyTablebaseImpl {
       throw Exception("Corrupt tablebase file " + fname);
     }
     *mapping = statbuf.st_size;
+    *size = statbuf.st_size;
     base_address = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
 #if defined(MADV_RANDOM)
     // For context: <https://github.com/official-stockfish/Stockfish/pull/1829>
@@ -1077,6 +1109,7 @@ class SyzygyTablebaseImpl {
       throw Exception("CreateFileMapping() failed");
     }
     *mapping = mmap;
+    *size = (static_cast<uint64_t>(size_high) << 32) | size_low;
     base_address = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
     if (!base_address) {
       throw Exception("MapViewOfFile() failed, name = " + fname +
@@ -1136,6 +1169,7 @@ class SyzygyTablebaseImpl {
             : static_cast<BaseEntry*>(&piece_entries_[num_piece_entries_++]);
     be->hasPawns = has_pawns;
     be->key = key;
+    snprintf(be->name, sizeof(be->name), "%s", str);
     be->symmetric = key == key2;
     be->num = 0;
     for (int i = 0; i < 16; i++) be->num += pcs[i];
@@ -1185,9 +1219,74 @@ class SyzygyTablebaseImpl {
     }
   }
 
+  // Maps the table if it's not mapped yet. Returns false if it can't be
+  // loaded.
+  bool ensure_ready(BaseEntry* be, int type) {
+    // Use double-checked locking to reduce locking overhead
+    if (atomic_load_explicit(&be->ready[type], std::memory_order_acquire)) {
+      return true;
+    }
+    Mutex::Lock lock(ready_mutex_);
+    if (atomic_load_explicit(&be->ready[type], std::memory_order_relaxed)) {
+      return true;
+    }
+    if (!init_table(be, be->name, type)) return false;
+    atomic_store_explicit(&be->ready[type], true, std::memory_order_release);
+    return true;
+  }
+
+  static size_t get_page_size() {
+#ifndef _WIN32
+    return sysconf(_SC_PAGESIZE);
+#else
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#endif
+  }
+
+  // Touches every page of the mapping.
+  static void read_into_memory(const uint8_t* data, size_t size,
+                               const std::atomic<bool>& stop) {
+#if defined(MADV_WILLNEED)
+    madvise(const_cast<uint8_t*>(data), size, MADV_WILLNEED);
+#endif
+    const size_t page_size = get_page_size();
+    uint8_t sum = 0;
+    for (size_t offset = 0; offset < size; offset += page_size) {
+      sum += *static_cast<const volatile uint8_t*>(data + offset);
+      if (offset % (1 << 20) == 0 && stop.load(std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    // The loads are volatile, this only silences the unused variable warning.
+    (void)sum;
+  }
+
+  static size_t get_resident_size(const uint8_t* data, size_t size) {
+#ifndef _WIN32
+    const size_t page_size = get_page_size();
+    const size_t num_pages = (size + page_size - 1) / page_size;
+#if defined(__APPLE__)
+    std::vector<char> pages(num_pages);
+#else
+    std::vector<unsigned char> pages(num_pages);
+#endif
+    if (mincore(const_cast<uint8_t*>(data), size, pages.data()) != 0) return 0;
+    size_t resident = 0;
+    for (const auto page : pages) resident += page & 1;
+    return resident * page_size;
+#else
+    // Not measured on Windows.
+    (void)data;
+    return size;
+#endif
+  }
+
   bool init_table(BaseEntry* be, const char* str, int type) {
     uint8_t* data =
-        static_cast<uint8_t*>(map_tb(str, kSuffix[type], &be->mapping[type]));
+        static_cast<uint8_t*>(map_tb(str, kSuffix[type], &be->mapping[type],
+                                     &be->size[type]));
     if (!data) return false;
 
     if (read_le_u32(data) != kMagic[type]) {
@@ -1348,20 +1447,10 @@ class SyzygyTablebaseImpl {
       return 0;
     }
 
-    // Use double-checked locking to reduce locking overhead
-    if (!atomic_load_explicit(&be->ready[type], std::memory_order_acquire)) {
-      Mutex::Lock lock(ready_mutex_);
-      if (!atomic_load_explicit(&be->ready[type], std::memory_order_relaxed)) {
-        char str[16];
-        prt_str(pos, str, be->key != key);
-        if (!init_table(be, str, type)) {
-          tb_hash_[hash_idx].ptr = nullptr;  // mark as deleted
-          *success = 0;
-          return 0;
-        }
-        atomic_store_explicit(&be->ready[type], true,
-                              std::memory_order_release);
-      }
+    if (!ensure_ready(be, type)) {
+      tb_hash_[hash_idx].ptr = nullptr;  // mark as deleted
+      *success = 0;
+      return 0;
     }
 
     bool bside, flip;
@@ -1471,9 +1560,69 @@ class SyzygyTablebaseImpl {
 
 SyzygyTablebase::SyzygyTablebase() : max_cardinality_(0) {}
 
-SyzygyTablebase::~SyzygyTablebase() = default;
+SyzygyTablebase::~SyzygyTablebase() { stop_preload(); }
+
+void SyzygyTablebase::set_probe_cache_size(int entries) {
+  probe_cache_.SetCapacity(entries);
+}
+
+SyzygyTablebase::ProbeCacheStats SyzygyTablebase::probe_cache_stats() const {
+  return {.probes = probe_cache_probes_.load(std::memory_order_relaxed),
+          .hits = probe_cache_hits_.load(std::memory_order_relaxed),
+          .size = probe_cache_.GetSize(),
+          .capacity = probe_cache_.GetCapacity()};
+}
+
+bool SyzygyTablebase::lookup_probe(uint64_t key, int* value,
+                                   ProbeState* result) {
+  if (probe_cache_.GetCapacity() == 0) return false;
+  probe_cache_probes_.fetch_add(1, std::memory_order_relaxed);
+  const bool found = probe_cache_.Lookup(key, [&](const CachedProbe& probe) {
+    *value = probe.value;
+    *result = static_cast<ProbeState>(probe.state);
+    return true;
+  });
+  if (found) probe_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+  return found;
+}
+
+void SyzygyTablebase::insert_probe(uint64_t key, int value,
+                                   ProbeState result) {
+  if (result == FAIL) return;
+  probe_cache_.Insert(key, CachedProbe{static_cast<int16_t>(value),
+                                       static_cast<int8_t>(result)});
+}
+
+void SyzygyTablebase::set_root_probe_limits(int threads, int time_limit_ms) {
+  root_probe_threads_ = std::max(threads, 1);
+  root_probe_time_limit_ms_ = std::max(time_limit_ms, 0);
+}
+
+void SyzygyTablebase::start_preload(int max_pieces) {
+  stop_preload();
+  if (!impl_ || max_pieces <= 2) return;
+  preload_thread_ = std::thread([this, max_pieces]() {
+    impl_->preload(max_pieces, preload_stop_);
+  });
+}
+
+void SyzygyTablebase::stop_preload() {
+  if (!preload_thread_.joinable()) return;
+  preload_stop_.store(true, std::memory_order_relaxed);
+  preload_thread_.join();
+  preload_stop_.store(false, std::memory_order_relaxed);
+}
+
+SyzygyTablebase::MemoryStats SyzygyTablebase::memory_stats() const {
+  MemoryStats stats{};
+  if (impl_) {
+    impl_->get_memory_stats(&stats.mapped_bytes, &stats.resident_bytes);
+  }
+  return stats;
+}
 
 bool SyzygyTablebase::init(const std::string& paths) {
+  stop_preload();
   paths_ = paths;
   impl_.reset(new SyzygyTablebaseImpl(paths_));
   max_cardinality_ = impl_->max_cardinality();
@@ -1555,8 +1704,66 @@ WDLScore SyzygyTablebase::search(const Position& pos, ProbeState* result) {
 //  1 : win, but draw under 50-move rule
 //  2 : win
 WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
+  const uint64_t key = pos.GetBoard().Hash();
+  if (int value; lookup_probe(key, &value, result)) {
+    return static_cast<WDLScore>(value);
+  }
   *result = OK;
-  return search(pos, result);
+  const WDLScore wdl = search(pos, result);
+  insert_probe(key, wdl, *result);
+  return wdl;
+}
+
+template <class Probe, class Copy>
+void SyzygyTablebase::run_sorted(std::span<const Position* const> positions,
+                                 Probe&& probe, Copy&& copy) {
+  struct Item {
+    Key material;
+    uint64_t hash;
+    size_t idx;
+  };
+  std::vector<Item> items;
+  items.reserve(positions.size());
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const ChessBoard& board = positions[i]->GetBoard();
+    items.push_back({calc_key_from_position(board), board.Hash(), i});
+  }
+  std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+    return std::tie(a.material, a.hash) < std::tie(b.material, b.hash);
+  });
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (i > 0 && items[i].hash == items[i - 1].hash &&
+        positions[items[i].idx]->GetBoard() ==
+            positions[items[i - 1].idx]->GetBoard()) {
+      copy(items[i - 1].idx, items[i].idx);
+    } else {
+      probe(items[i].idx);
+    }
+  }
+}
+
+void SyzygyTablebase::probe_wdl_batch(
+    std::span<const Position* const> positions, std::span<WDLScore> results,
+    std::span<ProbeState> states) {
+  run_sorted(
+      positions,
+      [&](size_t i) { results[i] = probe_wdl(*positions[i], &states[i]); },
+      [&](size_t from, size_t to) {
+        results[to] = results[from];
+        states[to] = states[from];
+      });
+}
+
+void SyzygyTablebase::probe_dtz_batch(
+    std::span<const Position* const> positions, std::span<int> results,
+    std::span<ProbeState> states) {
+  run_sorted(
+      positions,
+      [&](size_t i) { results[i] = probe_dtz(*positions[i], &states[i]); },
+      [&](size_t from, size_t to) {
+        results[to] = results[from];
+        states[to] = states[from];
+      });
 }
 
 // Probe the DTZ table for a particular position.
@@ -1585,6 +1792,16 @@ WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
 // In short, if a move is available resulting in dtz + 50-move-counter <= 99,
 // then do not accept moves leading to dtz + 50-move-counter == 100.
 int SyzygyTablebase::probe_dtz(const Position& pos, ProbeState* result) {
+  // Different keys than for WDL.
+  const uint64_t key = ~pos.GetBoard().Hash();
+  if (int value; lookup_probe(key, &value, result)) return value;
+  const int dtz = probe_dtz_uncached(pos, result);
+  insert_probe(key, dtz, *result);
+  return dtz;
+}
+
+int SyzygyTablebase::probe_dtz_uncached(const Position& pos,
+                                        ProbeState* result) {
   *result = OK;
   const WDLScore wdl = search<true>(pos, result);
   if (*result == FAIL || wdl == WDL_DRAW) {  // DTZ tables don't store draws
@@ -1616,7 +1833,7 @@ int SyzygyTablebase::probe_dtz(const Position& pos, ProbeState* result) {
                   : -probe_dtz(next_pos, result);
     // If the move mates, force minDTZ to 1
     if (dtz == 1 && next_pos.GetBoard().IsUnderCheck() &&
-        next_pos.GetBoard().GenerateLegalMoves().empty()) {
+        next_pos.GetBoard().CountLegalMoves() == 0) {
       min_DTZ = 1;
     }
     // Convert result from 1-ply search. Zeroing moves are already accounted by
@@ -1633,22 +1850,49 @@ int SyzygyTablebase::probe_dtz(const Position& pos, ProbeState* result) {
 // Use the DTZ tables to rank root moves.
 //
 // A return value false indicates that not all probes were successful.
+template <class F>
+bool SyzygyTablebase::probe_root_moves(size_t count, F&& probe_move) {
+  using Clock = std::chrono::steady_clock;
+  const auto deadline =
+      Clock::now() + std::chrono::milliseconds(root_probe_time_limit_ms_);
+  std::atomic<size_t> next_idx = 0;
+  std::atomic<bool> failed = false;
+  auto worker = [&]() {
+    while (!failed.load(std::memory_order_relaxed)) {
+      // The probes in flight can't be interrupted, the time limit is only
+      // checked between the moves.
+      if (root_probe_time_limit_ms_ > 0 && Clock::now() > deadline) {
+        failed.store(true, std::memory_order_relaxed);
+        break;
+      }
+      const size_t idx = next_idx.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= count) break;
+      if (!probe_move(idx)) failed.store(true, std::memory_order_relaxed);
+    }
+  };
+  const size_t num_threads =
+      std::min(count, static_cast<size_t>(root_probe_threads_));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+  return !failed.load(std::memory_order_relaxed);
+}
+
 bool SyzygyTablebase::root_probe(const Position& pos, bool has_repeated,
-                                 bool win_only, std::vector<Move>* safe_moves) {
-  ProbeState result;
+                                 bool win_only, MoveList* safe_moves) {
   auto root_moves = pos.GetBoard().GenerateLegalMoves();
   // Obtain 50-move counter for the root position
   const int cnt50 = pos.GetRule50Ply();
   // Check whether a position was repeated since the last zeroing move.
   const bool rep = has_repeated;
-  int dtz;
-  std::vector<int> ranks;
-  ranks.reserve(root_moves.size());
-  int best_rank = (win_only ? 1 : -1000);
-  // Probe and rank each move
-  for (auto& m : root_moves) {
-    Position next_pos = Position(pos, m);
-    // Calculate dtz for the current move counting from the root position
+  std::vector<int> dtzs(root_moves.size());
+  std::vector<ProbeState> results(root_moves.size(), FAIL);
+  // Calculates dtz for the move counting from the root position.
+  auto probe_move = [&](size_t idx) {
+    ProbeState& result = results[idx];
+    Position next_pos = Position(pos, root_moves[idx]);
+    int dtz;
     if (next_pos.GetRule50Ply() == 0) {
       // In case of a zeroing move, dtz is one of -101/-1/0/1/101
       const WDLScore wdl = static_cast<WDLScore>(-probe_wdl(next_pos, &result));
@@ -1660,10 +1904,19 @@ bool SyzygyTablebase::root_probe(const Position& pos, bool has_repeated,
     }
     // Make sure that a mating move is assigned a dtz value of 1
     if (next_pos.GetBoard().IsUnderCheck() && dtz == 2 &&
-        next_pos.GetBoard().GenerateLegalMoves().size() == 0) {
+        next_pos.GetBoard().CountLegalMoves() == 0) {
       dtz = 1;
     }
-    if (result == FAIL) return false;
+    dtzs[idx] = dtz;
+    // Stop early as the whole root probe fails anyway.
+    return result != FAIL;
+  };
+  if (!probe_root_moves(root_moves.size(), probe_move)) return false;
+  std::vector<int> ranks;
+  ranks.reserve(root_moves.size());
+  int best_rank = (win_only ? 1 : -1000);
+  // Rank each move
+  for (const int dtz : dtzs) {
     // Better moves are ranked higher. Certain wins are ranked equally.
     // Losing moves are ranked equally unless a 50-move draw is in sight.
     int r = dtz > 0 ? (dtz + cnt50 <= 99 && !rep ? 1000 : 1000 - (dtz + cnt50))
@@ -1689,7 +1942,7 @@ bool SyzygyTablebase::root_probe(const Position& pos, bool has_repeated,
 //
 // A return value false indicates that not all probes were successful.
 bool SyzygyTablebase::root_probe_wdl(const Position& pos,
-                                     std::vector<Move>* safe_moves) {
+                                     MoveList* safe_moves) {
   static const int WDL_to_rank[] = {-1000, -899, 0, 899, 1000};
   auto root_moves = pos.GetBoard().GenerateLegalMoves();
   ProbeState result;
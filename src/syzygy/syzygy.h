@@ -31,9 +31,12 @@
 #include <atomic>
 #include <deque>
 #include <memory>
+#include <span>
+#include <thread>
 #include <tuple>
 #include <vector>
 #include "chess/position.h"
+#include "utils/clock_cache.h"
 
 namespace lczero {
 
@@ -71,6 +74,32 @@ class SyzygyTablebase {
   // running. All other thread safe method calls must be strictly ordered with
   // respect to this method.
   bool init(const std::string& paths);
+  // Sets the number of probe results to cache, 0 disables the cache. Not
+  // thread safe, same as init().
+  void set_probe_cache_size(int entries);
+  struct ProbeCacheStats {
+    uint64_t probes;
+    uint64_t hits;
+    int size;
+    int capacity;
+  };
+  // Thread safe.
+  ProbeCacheStats probe_cache_stats() const;
+  // Sets the number of threads that probe the root moves in root_probe(),
+  // and the time after which root_probe() gives up, 0 means no limit. Not
+  // thread safe, same as init().
+  void set_root_probe_limits(int threads, int time_limit_ms);
+  // Starts reading the WDL and DTZ tables with up to @max_pieces pieces into
+  // memory in a background thread, so that the first probes of the search
+  // don't stall on disk reads. Not thread safe, same as init().
+  void start_preload(int max_pieces);
+  struct MemoryStats {
+    size_t mapped_bytes;
+    size_t resident_bytes;
+  };
+  // Sizes of the tables mapped so far, and how much of them is in RAM.
+  // Thread safe.
+  MemoryStats memory_stats() const;
   // Probes WDL tables for the given position to determine a WDLScore.
   // Thread safe.
   // Result is only strictly valid for positions with 0 ply 50 move counter.
@@ -81,6 +110,17 @@ class SyzygyTablebase {
   // Thread safe.
   // Probe state will return FAIL if the position is not in the tablebase.
   int probe_dtz(const Position& pos, ProbeState* result);
+  // Batch versions of probe_wdl() and probe_dtz(), for tools that probe many
+  // positions at once. Results and states are written at the same index as
+  // the position. The positions are probed grouped by table, so that the
+  // table data stays hot in the CPU and page caches, and repeated positions
+  // are probed once.
+  // Thread safe.
+  void probe_wdl_batch(std::span<const Position* const> positions,
+                       std::span<WDLScore> results,
+                       std::span<ProbeState> states);
+  void probe_dtz_batch(std::span<const Position* const> positions,
+                       std::span<int> results, std::span<ProbeState> states);
   // Probes DTZ tables to determine which moves are on the optimal play path.
   // Assumes the position is one reached such that the side to move has been
   // performing optimal play moves since the last 50 move counter reset.
@@ -89,24 +129,59 @@ class SyzygyTablebase {
   // Thread safe.
   // Returns false if the position is not in the tablebase.
   // Safe moves are added to the safe_moves output paramater.
+  // Also returns false if the root moves are not probed within the time limit,
+  // see set_root_probe_limits().
   bool root_probe(const Position& pos, bool has_repeated, bool win_only,
-                  std::vector<Move>* safe_moves);
+                  MoveList* safe_moves);
   // Probes WDL tables to determine which moves might be on the optimal play
   // path. If 50 move ply counter is non-zero some (or maybe even all) of the
   // returned safe moves in a 'winning' position, may actually be draws.
   // Returns false if the position is not in the tablebase.
   // Safe moves are added to the safe_moves output paramater.
-  bool root_probe_wdl(const Position& pos, std::vector<Move>* safe_moves);
+  bool root_probe_wdl(const Position& pos, MoveList* safe_moves);
 
  private:
   template <bool CheckZeroingMoves = false>
   WDLScore search(const Position& pos, ProbeState* result);
 
+  // Result of a successful WDL or DTZ probe.
+  struct CachedProbe {
+    int16_t value;
+    int8_t state;
+  };
+  // Looks up the probe result with the given key. Returns false if it isn't
+  // cached.
+  bool lookup_probe(uint64_t key, int* value, ProbeState* result);
+  int probe_dtz_uncached(const Position& pos, ProbeState* result);
+  void insert_probe(uint64_t key, int value, ProbeState result);
+  void stop_preload();
+  // Calls @probe_move(idx) for every root move index on up to
+  // root_probe_threads_ threads, until one of the calls returns false. Returns
+  // false if it happens or the time limit is hit.
+  template <class F>
+  bool probe_root_moves(size_t count, F&& probe_move);
+  // Calls @probe(i) for every position index, in the order of the material
+  // key and the board hash. Duplicate boards only get one call, @copy(from,
+  // to) is called for the rest.
+  template <class Probe, class Copy>
+  static void run_sorted(std::span<const Position* const> positions,
+                         Probe&& probe, Copy&& copy);
+
   std::string paths_;
   // Caches the max_cardinality from the impl, as max_cardinality may be a hot
   // path.
   int max_cardinality_;
   std::unique_ptr<SyzygyTablebaseImpl> impl_;
+  // Keyed by the board hash, separately for WDL and DTZ. The boards fully
+  // determine the probe results, the 50 move counter is not taken into
+  // account by the probes.
+  ClockCache<CachedProbe> probe_cache_{0};
+  std::atomic<uint64_t> probe_cache_probes_ = 0;
+  std::atomic<uint64_t> probe_cache_hits_ = 0;
+  int root_probe_threads_ = 1;
+  int root_probe_time_limit_ms_ = 0;
+  std::thread preload_thread_;
+  std::atomic<bool> preload_stop_ = false;
 };
 
 }  // namespace lczero
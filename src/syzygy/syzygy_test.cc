@@ -131,6 +131,42 @@ TEST(Syzygy, Simple3PieceProbes) {
                        -8);
 }
 
+TEST(Syzygy, BatchProbes) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  // Includes a duplicate and a position of a different table in between.
+  const std::vector<std::string> fens = {
+      "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", "6k1/8/8/8/8/5p2/8/2K5 b - - 0 1",
+      "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", "8/2p5/8/8/8/5k2/8/2K5 w - - 0 1"};
+  std::vector<PositionHistory> histories(fens.size());
+  std::vector<const Position*> positions;
+  for (size_t i = 0; i < fens.size(); ++i) {
+    ChessBoard board;
+    board.SetFromFen(fens[i]);
+    histories[i].Reset(board, 0, 1);
+    positions.push_back(&histories[i].Last());
+  }
+  std::vector<WDLScore> wdl(fens.size());
+  std::vector<int> dtz(fens.size());
+  std::vector<ProbeState> wdl_states(fens.size());
+  std::vector<ProbeState> dtz_states(fens.size());
+  tablebase.probe_wdl_batch(positions, wdl, wdl_states);
+  tablebase.probe_dtz_batch(positions, dtz, dtz_states);
+  for (size_t i = 0; i < fens.size(); ++i) {
+    ProbeState state;
+    EXPECT_NE(wdl_states[i], FAIL);
+    EXPECT_EQ(wdl[i], tablebase.probe_wdl(*positions[i], &state));
+    EXPECT_NE(dtz_states[i], FAIL);
+    EXPECT_EQ(dtz[i], tablebase.probe_dtz(*positions[i], &state));
+  }
+  EXPECT_EQ(dtz[0], -32);
+  EXPECT_EQ(dtz[2], -32);
+}
+
 TEST(Syzygy, Root3PieceProbes) {
   SyzygyTablebase tablebase;
   tablebase.init(kPaths);
@@ -248,6 +284,5 @@ TEST(Syzygy, Root5PieceProbes) {
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
-  lczero::InitializeMagicBitboards();
   return RUN_ALL_TESTS();
 }
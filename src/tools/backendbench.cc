@@ -27,6 +27,14 @@
 
 #include "tools/backendbench.h"
 
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
 #include "chess/board.h"
 #include "neural/register.h"
 #include "neural/shared_params.h"
@@ -37,10 +45,11 @@ namespace lczero {
 namespace {
 const int kDefaultThreads = 1;
 
-const OptionId kThreadsOptionId{"threads", "Threads",
-                                "Number of (CPU) worker threads to use.", 't'};
-const OptionId kBatchesId{"batches", "",
-                          "Number of batches to run as a benchmark."};
+const OptionId kThreadsOptionId{
+    "threads", "Threads",
+    "Number of threads submitting batches to the backend concurrently.", 't'};
+const OptionId kBatchesId{
+    "batches", "", "Number of batches to run as a benchmark, per thread."};
 const OptionId kStartBatchSizeId{"start-batch-size", "",
                                  "Start benchmark from this batch size."};
 const OptionId kMaxBatchSizeId{"max-batch-size", "",
@@ -48,9 +57,120 @@ const OptionId kMaxBatchSizeId{"max-batch-size", "",
 const OptionId kBatchStepId{"batch-step", "",
                             "Step of batch size in benchmark."};
 const OptionId kFenId{"fen", "", "Benchmark initial position FEN."};
+const OptionId kWarmupBatchesId{
+    "warmup-batches", "",
+    "Number of untimed batches to run before measuring every batch size."};
+const OptionId kCsvId{
+    "csv", "", "CSV file to write the results to, a row per batch size."};
+const OptionId kJsonId{
+    "json", "", "JSONL file to write the results to, a line per batch size."};
 
 const OptionId kClippyId{"clippy", "", "Enable helpful assistant."};
 
+// Host side time to add the inputs (encoding them), and the time of the
+// computation itself (including the decoding of the outputs), in milliseconds.
+struct BatchTiming {
+  double add_ms;
+  double compute_ms;
+  double total_ms() const { return add_ms + compute_ms; }
+};
+
+struct BatchSizeStats {
+  int batch_size;
+  int threads;
+  int64_t batches;
+  double nps;
+  double mean_ms;
+  double p50_ms;
+  double p95_ms;
+  double p99_ms;
+  double max_ms;
+  double add_ms;
+  double compute_ms;
+};
+
+// Nearest-rank percentile of sorted values.
+double Percentile(const std::vector<double>& sorted, double p) {
+  const size_t rank = std::ceil(p / 100.0 * sorted.size());
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+BatchSizeStats ComputeStats(int batch_size, int threads,
+                            const std::vector<BatchTiming>& timings,
+                            double seconds) {
+  std::vector<double> latencies;
+  double add_ms = 0;
+  double compute_ms = 0;
+  for (const auto& timing : timings) {
+    latencies.push_back(timing.total_ms());
+    add_ms += timing.add_ms;
+    compute_ms += timing.compute_ms;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const double n = timings.size();
+  return {.batch_size = batch_size,
+          .threads = threads,
+          .batches = static_cast<int64_t>(timings.size()),
+          .nps = batch_size * n / seconds,
+          .mean_ms = std::accumulate(latencies.begin(), latencies.end(), 0.0) /
+                     n,
+          .p50_ms = Percentile(latencies, 50),
+          .p95_ms = Percentile(latencies, 95),
+          .p99_ms = Percentile(latencies, 99),
+          .max_ms = latencies.back(),
+          .add_ms = add_ms / n,
+          .compute_ms = compute_ms / n};
+}
+
+constexpr const char* kCsvHeader =
+    "batch_size,threads,batches,nps,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,"
+    "add_ms,compute_ms";
+
+std::string ToCsv(const BatchSizeStats& s) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(3) << s.batch_size << "," << s.threads
+      << "," << s.batches << "," << s.nps << "," << s.mean_ms << ","
+      << s.p50_ms << "," << s.p95_ms << "," << s.p99_ms << "," << s.max_ms
+      << "," << s.add_ms << "," << s.compute_ms;
+  return oss.str();
+}
+
+std::string ToJson(const BatchSizeStats& s) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(3) << "{\"batch_size\":"
+      << s.batch_size << ",\"threads\":" << s.threads
+      << ",\"batches\":" << s.batches << ",\"nps\":" << s.nps
+      << ",\"mean_ms\":" << s.mean_ms << ",\"p50_ms\":" << s.p50_ms
+      << ",\"p95_ms\":" << s.p95_ms << ",\"p99_ms\":" << s.p99_ms
+      << ",\"max_ms\":" << s.max_ms << ",\"add_ms\":" << s.add_ms
+      << ",\"compute_ms\":" << s.compute_ms << "}";
+  return oss.str();
+}
+
+// Runs @batches computations of @batch_size copies of the position, returns
+// their timings.
+std::vector<BatchTiming> RunBatches(Backend* backend, const EvalPosition& pos,
+                                    int batch_size, int batches) {
+  std::vector<BatchTiming> timings;
+  timings.reserve(batches);
+  std::vector<EvalResult> results(batch_size);
+  for (auto& result : results) result.p.resize(pos.legal_moves.size());
+  for (int j = 0; j < batches; j++) {
+    const auto start = std::chrono::steady_clock::now();
+    auto computation = backend->CreateComputation();
+    for (int k = 0; k < batch_size; k++) {
+      computation->AddInput(pos, results[k].AsPtr());
+    }
+    const auto added = std::chrono::steady_clock::now();
+    computation->ComputeBlocking();
+    const auto end = std::chrono::steady_clock::now();
+    timings.push_back(
+        {std::chrono::duration<double, std::milli>(added - start).count(),
+         std::chrono::duration<double, std::milli>(end - added).count()});
+  }
+  return timings;
+}
+
 void Clippy(std::string title, std::string msg3, std::string best3,
             std::string msg2, std::string best2, std::string msg,
             std::string best) {
@@ -85,6 +205,9 @@ void BackendBenchmark::Run() {
   options.Add<IntOption>(kMaxBatchSizeId, 1, 1024) = 256;
   options.Add<IntOption>(kBatchStepId, 1, 256) = 1;
   options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<IntOption>(kWarmupBatchesId, 0, 999999999) = 0;
+  options.Add<StringOption>(kCsvId) = "";
+  options.Add<StringOption>(kJsonId) = "";
   options.Add<BoolOption>(kClippyId) = false;
 
   if (!options.ProcessAllFlags()) return;
@@ -96,7 +219,9 @@ void BackendBenchmark::Run() {
 
     classic::NodeTree tree;
     tree.ResetToPosition(option_dict.Get<std::string>(kFenId), {});
-    EvalPosition pos{tree.GetPositionHistory().GetPositions(), {}};
+    const MoveList legal_moves =
+        tree.GetPositionHistory().Last().GetBoard().GenerateLegalMoves();
+    EvalPosition pos{tree.GetPositionHistory().GetPositions(), legal_moves};
 
     // Do any backend initialization outside the loop.
     auto warmup = backend->CreateComputation();
@@ -104,6 +229,22 @@ void BackendBenchmark::Run() {
     warmup->ComputeBlocking();
 
     const int batches = option_dict.Get<int>(kBatchesId);
+    const int threads = option_dict.Get<int>(kThreadsOptionId);
+    const int warmup_batches = option_dict.Get<int>(kWarmupBatchesId);
+
+    std::ofstream csv;
+    if (const auto filename = option_dict.Get<std::string>(kCsvId);
+        !filename.empty()) {
+      csv.open(filename);
+      if (!csv) throw Exception("Unable to open " + filename);
+      csv << kCsvHeader << std::endl;
+    }
+    std::ofstream json;
+    if (const auto filename = option_dict.Get<std::string>(kJsonId);
+        !filename.empty()) {
+      json.open(filename);
+      if (!json) throw Exception("Unable to open " + filename);
+    }
 
     int best = 1;
     int best2 = 1;
@@ -116,25 +257,37 @@ void BackendBenchmark::Run() {
     for (int i = option_dict.Get<int>(kStartBatchSizeId);
          i <= option_dict.Get<int>(kMaxBatchSizeId);
          i += option_dict.Get<int>(kBatchStepId)) {
+      if (warmup_batches > 0) RunBatches(backend.get(), pos, i, warmup_batches);
+      // Every thread submits its own batches, so with more than one thread
+      // the latencies include the waiting for the backend.
+      std::vector<std::vector<BatchTiming>> thread_timings(threads);
       const auto start = std::chrono::steady_clock::now();
-      // TODO: support threads not equal to 1 to be able to more sensibly test
-      // multiplexing backend.
-      for (int j = 0; j < batches; j++) {
-        // Put i copies of tree root node into computation and compute.
-        auto computation = backend->CreateComputation();
-        for (int k = 0; k < i; k++) {
-          computation->AddInput(pos, {});
-        }
-        computation->ComputeBlocking();
+      std::vector<std::thread> workers;
+      for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+          thread_timings[t] = RunBatches(backend.get(), pos, i, batches);
+        });
       }
-
+      for (auto& worker : workers) worker.join();
       const auto end = std::chrono::steady_clock::now();
       std::chrono::duration<double> time = end - start;
-      const auto nps = i * batches / time.count();
+
+      std::vector<BatchTiming> timings;
+      for (const auto& t : thread_timings) {
+        timings.insert(timings.end(), t.begin(), t.end());
+      }
+      const BatchSizeStats stats =
+          ComputeStats(i, threads, timings, time.count());
+      const auto nps = stats.nps;
       std::cout << "Benchmark batch size " << i
-                << " with inference average time "
-                << time.count() / batches * 1000 << "ms - throughput " << nps
-                << " nps." << std::endl;
+                << " with inference average time " << stats.mean_ms
+                << "ms - throughput " << nps << " nps." << std::endl;
+      std::cout << "  latency p50 " << stats.p50_ms << "ms, p95 "
+                << stats.p95_ms << "ms, p99 " << stats.p99_ms << "ms, max "
+                << stats.max_ms << "ms; add inputs " << stats.add_ms
+                << "ms, compute " << stats.compute_ms << "ms." << std::endl;
+      if (csv.is_open()) csv << ToCsv(stats) << std::endl;
+      if (json.is_open()) json << ToJson(stats) << std::endl;
 
       if (option_dict.Get<bool>(kClippyId)) {
         float nps_ingame = std::pow((nps + best_nps) / 2, 1.085);
@@ -0,0 +1,356 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "tools/backendserver.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "neural/coalesce.h"
+#include "neural/register.h"
+#include "neural/remote/protocol.h"
+#include "neural/shared_params.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+using namespace remote;
+
+const OptionId kHostId{"host", "",
+                       "Address to listen on, all interfaces if empty."};
+const OptionId kPortId{"port", "", "TCP port to listen on."};
+const OptionId kStatsIntervalId{
+    "stats-interval", "",
+    "Interval in seconds between the reports of the throughput of every "
+    "client, 0 to disable them."};
+
+using Clock = std::chrono::steady_clock;
+
+// The reader of a connection stops reading further requests while that many
+// are in flight, the client waits in its writes then.
+constexpr size_t kMaxInFlightRequests = 64;
+
+// Request of a client, in flight in the backend.
+struct Job {
+  uint32_t request_id;
+  bool compress;
+  // Clock::time_point::max() if the client didn't set one.
+  Clock::time_point deadline;
+  std::vector<DecodedPosition> positions;
+  std::vector<EvalResult> results;
+  std::unique_ptr<BackendComputation> computation;
+  std::string error;
+};
+
+// What a client got from the server since the last report.
+struct ClientStats {
+  std::string name;
+  uint64_t requests = 0;
+  uint64_t positions = 0;
+  // Responses sent after the deadline the client asked for.
+  uint64_t late = 0;
+  uint64_t errors = 0;
+};
+
+// Serves one client. The reader thread starts the computations as soon as the
+// requests arrive, the writer thread sends the responses in the request order.
+class ServerConnection {
+ public:
+  ServerConnection(Socket socket, CoalescingBackend* backend, int id)
+      : socket_(std::move(socket)),
+        backend_(backend),
+        name_("client " + std::to_string(id)),
+        stats_{.name = name_},
+        reader_([this]() { ReaderLoop(); }),
+        writer_([this]() { WriterLoop(); }) {}
+
+  ~ServerConnection() {
+    socket_.Shutdown();
+    reader_.join();
+    writer_.join();
+  }
+
+  bool finished() const { return finished_; }
+
+  // Returns the statistics and starts counting again.
+  ClientStats TakeStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ClientStats stats = stats_;
+    stats_ = ClientStats{.name = stats_.name};
+    return stats;
+  }
+
+ private:
+  void ReaderLoop() {
+    try {
+      Frame frame;
+      while (ReadFrame(&socket_, &frame)) {
+        if (frame.type == MessageType::kHello) {
+          PayloadReader hello(frame.payload);
+          if (hello.Get<uint32_t>() != kProtocolVersion) {
+            Write(MessageType::kError, frame.request_id,
+                  "Protocol version mismatch", false);
+            break;
+          }
+          const std::string_view name = hello.GetString();
+          {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.name = name.empty() ? name_ : std::string(name);
+          }
+          PayloadWriter writer;
+          EncodeAttributes(backend_->GetAttributes(), &writer);
+          Write(MessageType::kAttributes, frame.request_id, writer.data(),
+                false);
+        } else if (frame.type == MessageType::kEvalRequest) {
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_cv_.wait(lock, [this]() {
+              return jobs_.size() < kMaxInFlightRequests;
+            });
+          }
+          auto job = StartJob(frame);
+          std::lock_guard<std::mutex> lock(mutex_);
+          jobs_.push_back(std::move(job));
+          cv_.notify_one();
+        } else {
+          throw Exception("Unexpected remote message");
+        }
+      }
+    } catch (const std::exception&) {
+      // The client is gone or misbehaves (including frames too large to
+      // allocate), drop the connection.
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cv_.notify_one();
+  }
+
+  std::unique_ptr<Job> StartJob(const Frame& frame) {
+    auto job = std::make_unique<Job>();
+    job->request_id = frame.request_id;
+    job->compress = frame.compressed;
+    job->deadline = Clock::time_point::max();
+    try {
+      PayloadReader reader(frame.payload);
+      const auto priority =
+          static_cast<ComputationPriority>(reader.Get<uint8_t>());
+      const uint32_t deadline_us = reader.Get<uint32_t>();
+      if (deadline_us > 0) {
+        job->deadline = Clock::now() + std::chrono::microseconds(deadline_us);
+      }
+      while (!reader.empty()) {
+        job->positions.emplace_back();
+        DecodeEvalPosition(&reader, &job->positions.back());
+      }
+      // Results are only sized after all positions are decoded, the backend
+      // keeps pointers into them.
+      job->results.resize(job->positions.size());
+      job->computation =
+          deadline_us > 0
+              ? backend_->CreateComputationWithDeadline(job->deadline)
+              : backend_->CreateComputation();
+      job->computation->SetPriority(priority);
+      for (size_t i = 0; i < job->positions.size(); ++i) {
+        EvalResult& result = job->results[i];
+        result.p.resize(job->positions[i].legal_moves.size());
+        job->computation->AddInput(job->positions[i].AsEvalPosition(),
+                                   result.AsPtr());
+      }
+      job->computation->ComputeAsync();
+    } catch (const std::exception& e) {
+      job->error = e.what();
+    }
+    return job;
+  }
+
+  void WriterLoop() {
+    while (true) {
+      std::unique_ptr<Job> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return closed_ || !jobs_.empty(); });
+        if (jobs_.empty()) break;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      space_cv_.notify_one();
+      if (job->error.empty()) {
+        try {
+          job->computation->Wait();
+        } catch (const std::exception& e) {
+          job->error = e.what();
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        ++stats_.requests;
+        stats_.positions += job->positions.size();
+        if (!job->error.empty()) ++stats_.errors;
+        if (Clock::now() > job->deadline) ++stats_.late;
+      }
+      try {
+        if (!job->error.empty()) {
+          Write(MessageType::kError, job->request_id, job->error, false);
+          continue;
+        }
+        PayloadWriter writer;
+        for (const EvalResult& result : job->results) {
+          EncodeEvalResult(result, &writer);
+        }
+        Write(MessageType::kEvalResponse, job->request_id, writer.data(),
+              job->compress);
+      } catch (const Exception&) {
+        // Keep draining the computations until the reader notices.
+        socket_.Shutdown();
+      }
+    }
+    finished_ = true;
+  }
+
+  void Write(MessageType type, uint32_t request_id, std::string_view payload,
+             bool compress) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    WriteFrame(&socket_, type, request_id, payload, compress);
+  }
+
+  Socket socket_;
+  CoalescingBackend* const backend_;
+  const std::string name_;
+  std::mutex stats_mutex_;
+  ClientStats stats_;
+  std::mutex write_mutex_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Signalled when the writer takes a job off jobs_.
+  std::condition_variable space_cv_;
+  std::deque<std::unique_ptr<Job>> jobs_;
+  bool closed_ = false;
+  std::atomic<bool> finished_ = false;
+  std::thread reader_;
+  std::thread writer_;
+};
+
+// Reports the throughput of every client every @interval.
+class StatsReporter {
+ public:
+  StatsReporter(std::chrono::seconds interval) : interval_(interval) {
+    if (interval_.count() > 0) thread_ = std::thread([this]() { Loop(); });
+  }
+
+  ~StatsReporter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  void Add(std::unique_ptr<ServerConnection> connection) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.remove_if([](const std::unique_ptr<ServerConnection>& c) {
+      return c->finished();
+    });
+    connections_.push_back(std::move(connection));
+  }
+
+ private:
+  void Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, interval_, [this]() { return stop_; })) {
+      const double seconds = interval_.count();
+      for (const auto& connection : connections_) {
+        const ClientStats stats = connection->TakeStats();
+        if (stats.requests == 0) continue;
+        CERR << stats.name << ": " << stats.requests << " requests, "
+             << std::lround(stats.positions / seconds) << " positions/s"
+             << (stats.late ? ", " + std::to_string(stats.late) + " late" : "")
+             << (stats.errors ? ", " + std::to_string(stats.errors) + " errors"
+                              : "")
+             << ".";
+      }
+    }
+  }
+
+  const std::chrono::seconds interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::list<std::unique_ptr<ServerConnection>> connections_;
+  std::thread thread_;
+};
+
+}  // namespace
+
+void BackendServer::Run() {
+  OptionsParser options;
+  SharedBackendParams::Populate(&options);
+  options.Add<StringOption>(kHostId) = "";
+  options.Add<IntOption>(kPortId, 1, 65535) = kDefaultPort;
+  options.Add<IntOption>(kStatsIntervalId, 0, 86400) = 60;
+  // Merging the requests of the clients is the point of a shared server.
+  options.GetMutableDefaultsOptions()->Set(
+      SharedBackendParams::kNNCoalesceDeadlineId, 1000);
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    std::unique_ptr<CoalescingBackend> backend = CreateCoalescingBackend(
+        BackendManager::Get()->CreateFromParams(option_dict), option_dict);
+
+    const int port = option_dict.Get<int>(kPortId);
+    Socket listener =
+        Socket::Listen(option_dict.Get<std::string>(kHostId), port);
+    CERR << "Serving backend "
+         << option_dict.Get<std::string>(SharedBackendParams::kBackendId)
+         << " on port " << port << ".";
+
+    StatsReporter connections(
+        std::chrono::seconds(option_dict.Get<int>(kStatsIntervalId)));
+    for (int id = 1;; ++id) {
+      Socket socket = listener.Accept();
+      connections.Add(std::make_unique<ServerConnection>(std::move(socket),
+                                                         backend.get(), id));
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,285 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/batchanalysis.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "chess/opening_book.h"
+#include "engine.h"
+#include "neural/coalesce.h"
+#include "neural/memcache.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "utils/files.h"
+#include "utils/filesystem.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputId{
+    "input", "",
+    "Positions to analyze: PGN (the position after the moves of every game), "
+    "EPD (.epd), possibly gzipped, or an opening book from compilebook."};
+const OptionId kOutputId{
+    "output", "",
+    "JSONL file to write the results to. Positions which already have results "
+    "in the file are skipped, so an interrupted run continues where it "
+    "stopped."};
+const OptionId kNodesId{"nodes", "", "Number of nodes to search per position."};
+const OptionId kSearchesId{
+    "searches", "",
+    "Number of searches running concurrently. Their evaluations are merged "
+    "into shared backend batches."};
+const OptionId kFlushEveryId{
+    "flush-every", "", "Flush the output file every this many results."};
+
+// Collects the final search output of one search.
+class ResultCollector : public UciResponder {
+ public:
+  void OutputBestMove(BestMoveInfo* info) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bestmove_ = info->bestmove;
+    ponder_ = info->ponder;
+  }
+  void OutputThinkingInfo(std::vector<ThinkingInfo>* infos) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& info : *infos) {
+      if (info.multipv <= 1 && info.nodes >= 0) info_ = info;
+    }
+  }
+
+  void Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bestmove_ = ponder_ = Move();
+    info_ = ThinkingInfo();
+  }
+  // Appends the JSON fields of the search result.
+  void AppendJson(std::ostream* out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *out << ",\"bestmove\":\"" << bestmove_.ToString(false) << "\"";
+    if (!ponder_.is_null()) {
+      *out << ",\"ponder\":\"" << ponder_.ToString(false) << "\"";
+    }
+    *out << ",\"nodes\":" << info_.nodes;
+    if (info_.score) *out << ",\"cp\":" << *info_.score;
+    if (info_.mate) *out << ",\"mate\":" << *info_.mate;
+    if (info_.wdl) {
+      *out << ",\"wdl\":[" << info_.wdl->w << "," << info_.wdl->d << ","
+           << info_.wdl->l << "]";
+    }
+    *out << ",\"pv\":[";
+    for (size_t i = 0; i < info_.pv.size(); ++i) {
+      *out << (i ? "," : "") << "\"" << info_.pv[i].ToString(false) << "\"";
+    }
+    *out << "]";
+  }
+
+ private:
+  std::mutex mutex_;
+  Move bestmove_;
+  Move ponder_;
+  ThinkingInfo info_;
+};
+
+// Appends the root policy of the position, which after the search is in the
+// NN cache.
+void AppendPolicyJson(Backend* backend, const GameState& state,
+                      std::ostream* out) {
+  const std::vector<Position> positions = state.GetPositions();
+  const Position& root = positions.back();
+  const MoveList legal_moves = root.GetBoard().GenerateLegalMoves();
+  if (legal_moves.empty()) return;
+  const EvalPosition eval_position{positions, legal_moves};
+  const auto results = backend->EvaluateBatch({&eval_position, 1});
+  *out << ",\"policy\":{";
+  for (size_t i = 0; i < legal_moves.size(); ++i) {
+    Move move = legal_moves[i];
+    if (root.IsBlackToMove()) move.Flip();
+    *out << (i ? "," : "") << "\"" << move.ToString(false)
+         << "\":" << results[0].p[i];
+  }
+  *out << "}";
+}
+
+// Counts the complete results in the output file, and drops a partially
+// written last line.
+size_t ResumeOutput(const std::string& filename) {
+  if (GetFileSize(filename) == 0) return 0;
+  std::string content = ReadFileToString(filename);
+  const size_t end = content.rfind('\n') + 1;
+  if (end != content.size()) {
+    content.resize(end);
+    WriteStringToFile(filename, content);
+  }
+  return std::count(content.begin(), content.end(), '\n');
+}
+
+// Writes the results in the order of the positions, as they complete.
+class OrderedWriter {
+ public:
+  OrderedWriter(const std::string& filename, size_t next, int flush_every)
+      : file_(filename, std::ios::app), next_(next), flush_every_(flush_every) {
+    if (!file_) throw Exception("Unable to open " + filename);
+  }
+
+  void Write(size_t idx, std::string line) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace(idx, std::move(line));
+    while (!pending_.empty() && pending_.begin()->first == next_) {
+      file_ << pending_.begin()->second << '\n';
+      pending_.erase(pending_.begin());
+      if (++next_ % flush_every_ == 0) file_.flush();
+    }
+  }
+
+  size_t written() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::ofstream file_;
+  std::map<size_t, std::string> pending_;
+  size_t next_;
+  const int flush_every_;
+};
+
+}  // namespace
+
+void RunBatchAnalysis(SearchFactory* factory) {
+  OptionsParser options;
+  Engine::PopulateOptions(&options);
+  factory->PopulateParams(&options);
+  SharedBackendParams::Populate(&options);
+  options.Add<StringOption>(kInputId);
+  options.Add<StringOption>(kOutputId);
+  options.Add<IntOption>(kNodesId, 1, 999999999) = 800;
+  options.Add<IntOption>(kSearchesId, 1, 1024) = 16;
+  options.Add<IntOption>(kFlushEveryId, 1, 1000000) = 100;
+  // Merging the evaluations of the searches is the point.
+  options.GetMutableDefaultsOptions()->Set(
+      SharedBackendParams::kNNCoalesceDeadlineId, 1000);
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const OptionsDict& dict = options.GetOptionsDict();
+    dict.EnsureExists<std::string>(kInputId);
+    dict.EnsureExists<std::string>(kOutputId);
+    const std::string input = dict.Get<std::string>(kInputId);
+    const std::string output = dict.Get<std::string>(kOutputId);
+    const OpeningBook book = OpeningBook::IsBookFile(input)
+                                 ? OpeningBook(input)
+                                 : OpeningBook(ReadOpeningFile(input, 0));
+    const size_t done = ResumeOutput(output);
+    if (done >= book.size()) {
+      CERR << "All " << book.size() << " positions are already analyzed.";
+      return;
+    }
+    CERR << "Analyzing " << book.size() - done << " of " << book.size()
+         << " positions.";
+
+    std::unique_ptr<CachingBackend> backend = CreateMemCache(
+        CreateCoalescingBackend(BackendManager::Get()->CreateFromParams(dict),
+                                dict),
+        dict);
+    OrderedWriter writer(output, done, dict.Get<int>(kFlushEveryId));
+    GoParams go_params;
+    go_params.nodes = dict.Get<int>(kNodesId);
+
+    std::mutex mutex;
+    size_t next = done;
+    auto work = [&]() {
+      ResultCollector collector;
+      Engine engine(*factory, dict, backend.get());
+      engine.RegisterUciResponder(&collector);
+      while (true) {
+        size_t idx;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next >= book.size()) break;
+          idx = next++;
+        }
+        const Opening opening = book.Get(idx);
+        std::vector<std::string> moves;
+        for (const Move move : opening.moves) {
+          moves.push_back(move.ToString(false));
+        }
+        const GameState state = OpeningToGameState(opening);
+        std::ostringstream line;
+        line << std::setprecision(4) << "{\"index\":" << idx << ",\"fen\":\""
+             << PositionToFen(state.CurrentPosition()) << "\"";
+        if (state.CurrentPosition().GetBoard().GenerateLegalMoves().empty()) {
+          // Mate or stalemate, nothing to search.
+          line << "}";
+        } else {
+          try {
+            collector.Reset();
+            engine.SetPosition(opening.start_fen, moves);
+            engine.Go(go_params);
+            engine.Wait();
+            collector.AppendJson(&line);
+            AppendPolicyJson(backend.get(), state, &line);
+          } catch (const Exception& ex) {
+            line << ",\"error\":\"" << ex.what() << "\"";
+          }
+          line << "}";
+        }
+        writer.Write(idx, line.str());
+      }
+      engine.UnregisterUciResponder(&collector);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < dict.Get<int>(kSearchesId); ++i) {
+      threads.emplace_back(work);
+    }
+    for (auto& thread : threads) thread.join();
+    const float seconds = std::chrono::duration<float>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    CERR << "Analyzed " << writer.written() - done << " positions in "
+         << seconds << "s, "
+         << (writer.written() - done) / std::max(seconds, 1e-3f)
+         << " positions/s.";
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -27,6 +27,7 @@
 
 #include "tools/benchmark.h"
 
+#include <ctime>
 #include <numeric>
 
 #include "neural/memcache.h"
@@ -83,6 +84,9 @@ void Benchmark::Run(bool run_shorter_benchmark) {
 
     std::vector<std::double_t> times;
     std::vector<std::int64_t> playouts;
+    // Process CPU time, which shows what waiting for the backend costs.
+    std::clock_t cpu_time = 0;
+    classic::SearchPhaseTimes phase_times;
     std::uint64_t cnt = 1;
 
     if (fen.length() > 0) {
@@ -115,6 +119,7 @@ void Benchmark::Run(bool run_shorter_benchmark) {
       tree.ResetToPosition(position, moves);
 
       const auto start = std::chrono::steady_clock::now();
+      const std::clock_t cpu_start = std::clock();
       auto search = std::make_unique<classic::Search>(
           tree, backend.get(),
           std::make_unique<CallbackUciResponder>(
@@ -125,11 +130,13 @@ void Benchmark::Run(bool run_shorter_benchmark) {
       search->StartThreads(option_dict.Get<int>(kThreadsOptionId));
       search->Wait();
       const auto end = std::chrono::steady_clock::now();
+      cpu_time += std::clock() - cpu_start;
 
       const auto time =
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
       times.push_back(time.count());
       playouts.push_back(search->GetTotalPlayouts());
+      phase_times.Add(search->GetPhaseTimes());
     }
 
     const auto total_playouts =
@@ -140,7 +147,15 @@ void Benchmark::Run(bool run_shorter_benchmark) {
               << "\nNodes searched  : " << total_playouts
               << "\nNodes/second    : "
               << std::lround(1000.0 * total_playouts / (total_time + 1))
+              << "\nCPU time (ms)   : "
+              << std::lround(1000.0 * cpu_time / CLOCKS_PER_SEC)
+              << "\nNodes/CPU second: "
+              << std::lround(total_playouts * double(CLOCKS_PER_SEC) /
+                             (cpu_time + 1))
               << std::endl;
+    if (option_dict.Get<bool>(classic::SearchParams::kPhaseTimersId)) {
+      std::cout << "Phase times     : " << phase_times.ToString() << std::endl;
+    }
   } catch (Exception& ex) {
     std::cerr << ex.what() << std::endl;
   }
@@ -151,6 +166,10 @@ void Benchmark::OnBestMove(const BestMoveInfo& move) {
 }
 
 void Benchmark::OnInfo(const std::vector<ThinkingInfo>& infos) {
+  if (!infos[0].comment.empty()) {
+    std::cout << infos[0].comment << std::endl;
+    return;
+  }
   std::string line = "Benchmark time " + std::to_string(infos[0].time);
   line += " ms, " + std::to_string(infos[0].nodes) + " nodes, ";
   line += std::to_string(infos[0].nps) + " nps";
@@ -0,0 +1,400 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/benchsuite.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <sstream>
+
+#include "neural/memcache.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "search/classic/search.h"
+#include "search/classic/stoppers/stoppers.h"
+#include "tools/benchmark.h"
+#include "utils/optionsparser.h"
+#include "utils/random.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kPositionsId{
+    "positions", "",
+    "File with the benchmark positions, one FEN per line, optionally followed "
+    "by \"moves ...\". Empty lines and lines starting with # are skipped. The "
+    "positions of the benchmark mode are used by default."};
+const OptionId kNumPositionsId{
+    "num-positions", "", "The number of positions to run, 0 for all of them."};
+const OptionId kNodesId{"nodes", "", "Number of nodes to search per position."};
+const OptionId kMovetimeId{
+    "movetime", "",
+    "Time to search per position, in milliseconds. Time limited runs are not "
+    "reproducible, fixed nodes are preferred."};
+const OptionId kThreadsId{"threads", "",
+                          "Comma-separated thread counts to sweep."};
+const OptionId kMiniBatchSizesId{
+    "minibatch-sizes", "",
+    "Comma-separated minibatch sizes to sweep, 0 for the backend's "
+    "recommended size. The MiniBatchSize option is used when empty."};
+const OptionId kRepeatsId{"repeats", "",
+                          "Number of times every configuration is run."};
+const OptionId kSeedId{
+    "seed", "",
+    "Seed of the search randomness (noise, temperature), reset before every "
+    "run."};
+const OptionId kJsonId{
+    "json", "", "JSONL file to write the results to, one line per "
+                "configuration."};
+const OptionId kBaselineId{
+    "baseline", "",
+    "JSONL results of an earlier run to compare the median NPS with."};
+const OptionId kThresholdId{
+    "threshold", "",
+    "The comparison fails if the median NPS of a configuration is this many "
+    "percent below the baseline."};
+
+struct Config {
+  int threads;
+  int minibatch_size;
+  std::string name;
+};
+
+struct RunResult {
+  int64_t time_ms = 0;
+  int64_t nodes = 0;
+  int64_t collisions = 0;
+  CachingBackend::CacheStats cache;
+  classic::SearchPhaseTimes phases;
+  classic::MinibatchStats minibatches;
+
+  double nps() const { return 1000.0 * nodes / std::max<int64_t>(time_ms, 1); }
+};
+
+std::vector<std::string> LoadPositions(const std::string& filename) {
+  if (filename.empty()) return Benchmark().positions;
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to open " + filename);
+  std::vector<std::string> positions;
+  std::string line;
+  while (std::getline(file, line)) {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#') continue;
+    positions.push_back(line);
+  }
+  if (positions.empty()) throw Exception("No positions in " + filename);
+  return positions;
+}
+
+RunResult RunPositions(const std::vector<std::string>& positions,
+                       CachingBackend* backend, const OptionsDict& options,
+                       int threads) {
+  const int nodes = options.Get<int>(kNodesId);
+  const int movetime = options.Get<int>(kMovetimeId);
+  backend->ClearCache();
+  Random::Get().Seed(options.Get<int>(kSeedId));
+  RunResult result;
+  for (std::string position : positions) {
+    auto stopper = std::make_unique<classic::ChainedSearchStopper>();
+    if (movetime > -1) {
+      stopper->AddStopper(
+          std::make_unique<classic::TimeLimitStopper>(movetime));
+    }
+    if (nodes > -1) {
+      stopper->AddStopper(
+          std::make_unique<classic::VisitsStopper>(nodes, false));
+    }
+    classic::NodeTree tree;
+    std::vector<std::string> moves;
+    if (auto iter = position.find("moves "); iter != std::string::npos) {
+      moves = StrSplitAtWhitespace(position.substr(iter + 6));
+      position = position.substr(0, iter);
+    }
+    tree.ResetToPosition(position, moves);
+
+    const auto start = std::chrono::steady_clock::now();
+    auto search = std::make_unique<classic::Search>(
+        tree, backend,
+        std::make_unique<CallbackUciResponder>(
+            [](const BestMoveInfo&) {},
+            [](const std::vector<ThinkingInfo>&) {}),
+        MoveList(), start, std::move(stopper), false, false, options, nullptr);
+    search->StartThreads(threads);
+    search->Wait();
+    const auto end = std::chrono::steady_clock::now();
+
+    result.time_ms +=
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+            .count();
+    result.nodes += search->GetTotalPlayouts();
+    result.collisions += search->GetTotalCollisions();
+    result.phases.Add(search->GetPhaseTimes());
+    result.minibatches.Add(search->GetMinibatchStats());
+  }
+  result.cache = backend->GetCacheStats();
+  return result;
+}
+
+double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Writes the statistics of the runs of one configuration as a JSON object.
+std::string ResultsToJson(const Config& config,
+                          const std::vector<RunResult>& runs) {
+  std::vector<double> nps;
+  for (const RunResult& run : runs) nps.push_back(run.nps());
+  const double mean =
+      std::accumulate(nps.begin(), nps.end(), 0.0) / nps.size();
+  double variance = 0;
+  for (double x : nps) variance += (x - mean) * (x - mean);
+  variance /= nps.size();
+
+  RunResult total;
+  for (const RunResult& run : runs) {
+    total.time_ms += run.time_ms;
+    total.nodes += run.nodes;
+    total.collisions += run.collisions;
+    total.cache.l1_hits += run.cache.l1_hits;
+    total.cache.l2_hits += run.cache.l2_hits;
+    total.cache.host_hits += run.cache.host_hits;
+    total.cache.misses += run.cache.misses;
+    total.phases.Add(run.phases);
+    total.minibatches.Add(run.minibatches);
+  }
+  const uint64_t hits =
+      total.cache.l1_hits + total.cache.l2_hits + total.cache.host_hits;
+  const uint64_t lookups = hits + total.cache.misses;
+
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1);
+  oss << "{\"name\":\"" << config.name << "\",\"threads\":" << config.threads
+      << ",\"minibatch_size\":" << config.minibatch_size
+      << ",\"repeats\":" << runs.size() << ",\"nps_median\":" << Median(nps)
+      << ",\"nps_mean\":" << mean << ",\"nps_stddev\":" << std::sqrt(variance)
+      << ",\"nps_min\":" << *std::min_element(nps.begin(), nps.end())
+      << ",\"nps_max\":" << *std::max_element(nps.begin(), nps.end())
+      << ",\"nps_runs\":[";
+  for (size_t i = 0; i < nps.size(); ++i) oss << (i ? "," : "") << nps[i];
+  oss << "],\"nodes\":" << total.nodes / runs.size()
+      << ",\"time_ms\":" << total.time_ms / runs.size()
+      << ",\"collisions\":" << total.collisions / runs.size()
+      << ",\"collisions_per_node\":" << std::setprecision(4)
+      << static_cast<double>(total.collisions) / std::max<int64_t>(
+                                                     total.nodes, 1)
+      << ",\"cache_l1_hits\":" << total.cache.l1_hits / runs.size()
+      << ",\"cache_l2_hits\":" << total.cache.l2_hits / runs.size()
+      << ",\"cache_host_hits\":" << total.cache.host_hits / runs.size()
+      << ",\"cache_misses\":" << total.cache.misses / runs.size()
+      << ",\"cache_hit_rate\":"
+      << (lookups ? 1.0 * hits / lookups : 0.0)
+      << ",\"iterations\":" << total.phases.iterations / runs.size()
+      << ",\"phase_ms\":{";
+  oss << std::setprecision(1);
+  for (int i = 0; i < classic::SearchPhaseTimes::kNumPhases; ++i) {
+    const auto phase = static_cast<classic::SearchPhaseTimes::Phase>(i);
+    oss << (i ? "," : "") << "\""
+        << classic::SearchPhaseTimes::GetName(phase)
+        << "\":" << total.phases.nanoseconds[i] / 1e6 / runs.size();
+  }
+  // Minibatches per run, the other counters per minibatch.
+  const int64_t minibatches =
+      total.minibatches.counts[classic::MinibatchStats::kMinibatches];
+  oss << "},\"minibatch_stats\":{\"minibatches\":" << minibatches / runs.size()
+      << std::setprecision(2);
+  for (int i = classic::MinibatchStats::kMinibatches + 1;
+       i < classic::MinibatchStats::kNumCounters; ++i) {
+    oss << ",\""
+        << classic::MinibatchStats::GetName(
+               static_cast<classic::MinibatchStats::Counter>(i))
+        << "\":"
+        << (minibatches > 0
+                ? 1.0 * total.minibatches.counts[i] / minibatches
+                : 0.0);
+  }
+  oss << "}}";
+  return oss.str();
+}
+
+// Extracts a numeric field from a JSON line written by ResultsToJson().
+std::optional<double> GetJsonNumber(const std::string& line,
+                                    const std::string& field) {
+  const std::string key = "\"" + field + "\":";
+  const size_t pos = line.find(key);
+  if (pos == std::string::npos) return std::nullopt;
+  return std::stod(line.substr(pos + key.size()));
+}
+
+std::optional<std::string> GetJsonString(const std::string& line,
+                                         const std::string& field) {
+  const std::string key = "\"" + field + "\":\"";
+  const size_t pos = line.find(key);
+  if (pos == std::string::npos) return std::nullopt;
+  const size_t end = line.find('"', pos + key.size());
+  if (end == std::string::npos) return std::nullopt;
+  return line.substr(pos + key.size(), end - pos - key.size());
+}
+
+// Median NPS of the configurations in the baseline file, by name.
+std::map<std::string, double> LoadBaseline(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to open " + filename);
+  std::map<std::string, double> baseline;
+  std::string line;
+  while (std::getline(file, line)) {
+    const auto name = GetJsonString(line, "name");
+    const auto nps = GetJsonNumber(line, "nps_median");
+    if (name && nps) baseline[*name] = *nps;
+  }
+  return baseline;
+}
+
+}  // namespace
+
+bool RunBenchmarkSuite() {
+  OptionsParser options;
+  SharedBackendParams::Populate(&options);
+  options.GetMutableDefaultsOptions()->Set(SharedBackendParams::kNNCacheSizeId,
+                                           200000);
+  classic::SearchParams::Populate(&options);
+  options.Add<StringOption>(kPositionsId) = "";
+  options.Add<IntOption>(kNumPositionsId, 0, 100000) = 0;
+  options.Add<IntOption>(kNodesId, -1, 999999999) = 10000;
+  options.Add<IntOption>(kMovetimeId, -1, 999999999) = -1;
+  options.Add<StringOption>(kThreadsId) = "2";
+  options.Add<StringOption>(kMiniBatchSizesId) = "";
+  options.Add<IntOption>(kRepeatsId, 1, 1000) = 3;
+  options.Add<IntOption>(kSeedId, 0, 999999999) = 1;
+  options.Add<StringOption>(kJsonId) = "";
+  options.Add<StringOption>(kBaselineId) = "";
+  options.Add<FloatOption>(kThresholdId, 0.0f, 100.0f) = 5.0f;
+  if (!options.ProcessAllFlags()) return true;
+
+  try {
+    const OptionsDict& option_dict = options.GetOptionsDict();
+    // Per-phase timings are a part of the report.
+    OptionsDict search_dict(&option_dict);
+    search_dict.Set<bool>(classic::SearchParams::kPhaseTimersId, true);
+    auto backend = CreateMemCache(
+        BackendManager::Get()->CreateFromParams(option_dict), option_dict);
+
+    std::vector<std::string> positions =
+        LoadPositions(option_dict.Get<std::string>(kPositionsId));
+    const size_t num_positions = option_dict.Get<int>(kNumPositionsId);
+    if (num_positions > 0 && num_positions < positions.size()) {
+      positions.resize(num_positions);
+    }
+
+    const std::string minibatch_list =
+        option_dict.Get<std::string>(kMiniBatchSizesId);
+    std::vector<int> minibatch_sizes;
+    if (!minibatch_list.empty()) {
+      minibatch_sizes = ParseIntList(minibatch_list);
+    } else {
+      minibatch_sizes = {
+          option_dict.Get<int>(classic::SearchParams::kMiniBatchSizeId)};
+    }
+    std::vector<Config> configs;
+    const std::vector<int> thread_counts =
+        ParseIntList(option_dict.Get<std::string>(kThreadsId));
+    for (int threads : thread_counts) {
+      for (int minibatch_size : minibatch_sizes) {
+        configs.push_back({threads, minibatch_size,
+                           "threads=" + std::to_string(threads) +
+                               ",minibatch=" + std::to_string(minibatch_size)});
+      }
+    }
+    if (configs.empty()) throw Exception("No thread counts to run.");
+
+    std::ofstream json;
+    if (const auto filename = option_dict.Get<std::string>(kJsonId);
+        !filename.empty()) {
+      json.open(filename);
+      if (!json) throw Exception("Unable to open " + filename);
+    }
+    std::map<std::string, double> baseline;
+    if (const auto filename = option_dict.Get<std::string>(kBaselineId);
+        !filename.empty()) {
+      baseline = LoadBaseline(filename);
+    }
+    const float threshold = option_dict.Get<float>(kThresholdId);
+    const int repeats = option_dict.Get<int>(kRepeatsId);
+
+    bool passed = true;
+    for (const Config& config : configs) {
+      OptionsDict config_dict(&search_dict);
+      config_dict.Set<int>(classic::SearchParams::kMiniBatchSizeId,
+                           config.minibatch_size);
+      std::vector<RunResult> runs;
+      std::vector<double> nps;
+      for (int i = 0; i < repeats; ++i) {
+        runs.push_back(RunPositions(positions, backend.get(), config_dict,
+                                    config.threads));
+        nps.push_back(runs.back().nps());
+        std::cout << config.name << " run " << i + 1 << "/" << repeats << ": "
+                  << runs.back().nodes << " nodes in " << runs.back().time_ms
+                  << " ms, " << std::lround(nps.back()) << " nps" << std::endl;
+      }
+      const std::string line = ResultsToJson(config, runs);
+      if (json.is_open()) json << line << std::endl;
+
+      const double median = Median(nps);
+      std::cout << config.name << ": median " << std::lround(median) << " nps";
+      if (auto iter = baseline.find(config.name); iter != baseline.end()) {
+        const double change = 100.0 * (median - iter->second) / iter->second;
+        const bool ok = change >= -threshold;
+        passed &= ok;
+        std::cout << ", baseline " << std::lround(iter->second) << " nps, "
+                  << std::showpos << std::fixed << std::setprecision(1)
+                  << change << std::noshowpos << "% " << (ok ? "PASS" : "FAIL");
+      } else if (!baseline.empty()) {
+        std::cout << ", not in the baseline";
+      }
+      std::cout << std::endl;
+    }
+    if (!baseline.empty()) {
+      std::cout << "Comparison with the baseline: "
+                << (passed ? "PASS" : "FAIL") << std::endl;
+    }
+    return passed;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return false;
+  }
+}
+
+}  // namespace lczero
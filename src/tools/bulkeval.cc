@@ -0,0 +1,356 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/bulkeval.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <sstream>
+#include <thread>
+
+#include "chess/opening_book.h"
+#include "neural/decoder.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "trainingdata/reader.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputId{
+    "input", "",
+    "Comma separated input files. Positions: PGN (the position after the "
+    "moves of every game), EPD (.epd) or an opening book from compilebook. "
+    "Training: training data files (one game each) or packs."};
+const OptionId kInputTypeId{"input-type", "",
+                            "Whether the input files are positions or "
+                            "training data."};
+const OptionId kOutputId{"output", "", "JSONL file to write the results to."};
+const OptionId kBatchSizeId{
+    "batch-size", "",
+    "Number of positions per backend batch, 0 for the maximum batch size of "
+    "the backend."};
+const OptionId kThreadsId{
+    "threads", "",
+    "Number of threads decoding the input and running the batches, 0 for all "
+    "the cores. More than one keeps several batches in flight."};
+const OptionId kTopKId{"top-k", "",
+                       "Number of the most likely moves of the policy to "
+                       "write, 0 for the full policy."};
+
+// Results of a job buffered for writing.
+constexpr size_t kMaxPendingJobs = 64;
+
+// Position to evaluate, with its history.
+struct Item {
+  std::vector<Position> history;
+  MoveList legal_moves;
+};
+
+// A unit of work: a range of positions or a training game.
+struct Job {
+  size_t file;
+  size_t begin;
+  size_t end;
+};
+
+// Writes the output of the jobs from a background thread, in the job order.
+class OrderedWriter {
+ public:
+  explicit OrderedWriter(const std::string& filename)
+      : file_(filename), thread_([this]() { Loop(); }) {
+    if (!file_) throw Exception("Unable to open " + filename);
+  }
+
+  ~OrderedWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // Blocks while too many jobs after the next one to write are buffered.
+  void Write(size_t job, std::string text) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return job < next_ + kMaxPendingJobs; });
+    pending_.emplace(job, std::move(text));
+    cv_.notify_all();
+  }
+
+ private:
+  void Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&]() {
+        return done_ || (!pending_.empty() && pending_.begin()->first == next_);
+      });
+      if (pending_.empty() || pending_.begin()->first != next_) return;
+      std::string text = std::move(pending_.begin()->second);
+      pending_.erase(pending_.begin());
+      ++next_;
+      cv_.notify_all();
+      lock.unlock();
+      file_ << text;
+      lock.lock();
+    }
+  }
+
+  std::ofstream file_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<size_t, std::string> pending_;
+  size_t next_ = 0;
+  bool done_ = false;
+  std::thread thread_;
+};
+
+// Decodes a training game into positions with history.
+std::vector<Item> DecodeGame(const std::vector<V6TrainingData>& chunks) {
+  std::vector<Item> items;
+  if (chunks.empty()) return items;
+  ChessBoard board;
+  int rule50ply;
+  int gameply;
+  const auto input_format = static_cast<pblczero::NetworkFormat::InputFormat>(
+      chunks[0].input_format);
+  PopulateBoard(input_format, PlanesFromTrainingData(chunks[0]), &board,
+                &rule50ply, &gameply);
+  PositionHistory history;
+  history.Reset(board, rule50ply, gameply);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (i > 0) {
+      Move move = DecodeMoveFromInput(PlanesFromTrainingData(chunks[i]),
+                                      PlanesFromTrainingData(chunks[i - 1]));
+      // Decoded from the point of view of the side after the move.
+      move.Flip();
+      history.Append(move);
+    }
+    const auto positions = history.GetPositions();
+    items.push_back({{positions.begin(), positions.end()},
+                     history.Last().GetBoard().GenerateLegalMoves()});
+  }
+  return items;
+}
+
+void AppendResult(const Item& item, float q, float d, float m,
+                  std::span<const float> p, int top_k, std::ostream* out) {
+  const Position& position = item.history.back();
+  *out << "{\"fen\":\"" << PositionToFen(position) << "\",\"q\":" << q
+       << ",\"d\":" << d << ",\"m\":" << m << ",\"policy\":{";
+  std::vector<size_t> order(item.legal_moves.size());
+  std::iota(order.begin(), order.end(), 0);
+  size_t count = order.size();
+  if (top_k > 0) {
+    count = std::min<size_t>(count, top_k);
+    std::partial_sort(
+        order.begin(), order.begin() + count, order.end(),
+        [&](size_t a, size_t b) { return p[a] > p[b]; });
+  }
+  for (size_t i = 0; i < count; ++i) {
+    Move move = item.legal_moves[order[i]];
+    if (position.IsBlackToMove()) move.Flip();
+    *out << (i ? "," : "") << "\"" << move.ToString(false)
+         << "\":" << p[order[i]];
+  }
+  *out << "}}\n";
+}
+
+}  // namespace
+
+void RunBulkEvaluation() {
+  OptionsParser options;
+  SharedBackendParams::Populate(&options);
+  options.Add<StringOption>(kInputId);
+  options.Add<ChoiceOption>(kInputTypeId,
+                            std::vector<std::string>{"positions",
+                                                     "training"}) =
+      "positions";
+  options.Add<StringOption>(kOutputId);
+  options.Add<IntOption>(kBatchSizeId, 0, 65536) = 0;
+  options.Add<IntOption>(kThreadsId, 0, 256) = 2;
+  options.Add<IntOption>(kTopKId, 0, 256) = 5;
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const OptionsDict& dict = options.GetOptionsDict();
+    dict.EnsureExists<std::string>(kInputId);
+    dict.EnsureExists<std::string>(kOutputId);
+    const bool training = dict.Get<std::string>(kInputTypeId) == "training";
+    const std::vector<std::string> files =
+        StrSplit(dict.Get<std::string>(kInputId), ",");
+    int threads = dict.Get<int>(kThreadsId);
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const int top_k = dict.Get<int>(kTopKId);
+
+    // No NN cache, every position is evaluated once anyway.
+    std::unique_ptr<Backend> backend =
+        BackendManager::Get()->CreateFromParams(dict);
+    const auto attributes = backend->GetAttributes();
+    size_t batch_size = dict.Get<int>(kBatchSizeId);
+    if (batch_size == 0) batch_size = attributes.maximum_batch_size;
+    if (batch_size == 0) batch_size = attributes.recommended_batch_size;
+    batch_size = std::max<size_t>(batch_size, 1);
+
+    // Position inputs are split into batches, training inputs into games.
+    std::vector<std::unique_ptr<OpeningBook>> books;
+    std::vector<std::unique_ptr<TrainingDataPackReader>> packs;
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < files.size(); ++i) {
+      const std::string& file = files[i];
+      if (!training) {
+        books.push_back(OpeningBook::IsBookFile(file)
+                            ? std::make_unique<OpeningBook>(file)
+                            : std::make_unique<OpeningBook>(
+                                  ReadOpeningFile(file, threads)));
+        for (size_t begin = 0; begin < books.back()->size();
+             begin += batch_size) {
+          jobs.push_back(
+              {i, begin, std::min(begin + batch_size, books.back()->size())});
+        }
+      } else if (TrainingDataPackReader::IsPackFile(file)) {
+        packs.push_back(std::make_unique<TrainingDataPackReader>(file));
+        for (size_t game = 0; game < packs.back()->GetNumGames(); ++game) {
+          jobs.push_back({i, game, game + 1});
+        }
+      } else {
+        packs.push_back(nullptr);
+        jobs.push_back({i, 0, 1});
+      }
+    }
+    CERR << "Evaluating " << files.size() << " files in batches of "
+         << batch_size << ".";
+
+    OrderedWriter writer(dict.Get<std::string>(kOutputId));
+    std::mutex mutex;
+    size_t next_job = 0;
+    std::atomic<size_t> evaluated = 0;
+    std::vector<std::exception_ptr> errors(threads);
+    auto work = [&](int thread_idx) {
+      // Result buffers, reused for all the batches of the thread.
+      std::vector<float> q(batch_size), d(batch_size), m(batch_size), p;
+      std::vector<size_t> p_offsets(batch_size + 1);
+      while (true) {
+        size_t job_idx;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next_job >= jobs.size()) break;
+          job_idx = next_job++;
+        }
+        try {
+          const Job& job = jobs[job_idx];
+          std::vector<Item> items;
+          if (!training) {
+            for (size_t i = job.begin; i < job.end; ++i) {
+              const auto positions =
+                  OpeningToGameState(books[job.file]->Get(i)).GetPositions();
+              items.push_back(
+                  {positions,
+                   positions.back().GetBoard().GenerateLegalMoves()});
+            }
+          } else if (packs[job.file]) {
+            items = DecodeGame(packs[job.file]->ReadGame(job.begin));
+          } else {
+            TrainingDataReader reader(files[job.file]);
+            std::vector<V6TrainingData> chunks;
+            V6TrainingData chunk;
+            while (reader.ReadChunk(&chunk)) chunks.push_back(chunk);
+            items = DecodeGame(chunks);
+          }
+          // Mates and stalemates have no policy to evaluate.
+          std::erase_if(items, [](const Item& item) {
+            return item.legal_moves.empty();
+          });
+
+          std::ostringstream out;
+          out << std::setprecision(5);
+          for (size_t begin = 0; begin < items.size(); begin += batch_size) {
+            const size_t end = std::min(begin + batch_size, items.size());
+            std::vector<EvalPosition> batch;
+            size_t moves = 0;
+            for (size_t i = begin; i < end; ++i) {
+              batch.push_back({items[i].history, items[i].legal_moves});
+              moves += items[i].legal_moves.size();
+            }
+            if (p.size() < moves) p.resize(moves);
+            backend->EvaluateBatch(batch, {q, d, m, p, p_offsets});
+            for (size_t i = begin; i < end; ++i) {
+              const size_t idx = i - begin;
+              AppendResult(items[i], q[idx], d[idx], m[idx],
+                           std::span<const float>(p).subspan(
+                               p_offsets[idx],
+                               p_offsets[idx + 1] - p_offsets[idx]),
+                           top_k, &out);
+            }
+          }
+          evaluated += items.size();
+          writer.Write(job_idx, out.str());
+        } catch (...) {
+          errors[thread_idx] = std::current_exception();
+          // Stop handing out jobs. The empty write lets the jobs already in
+          // flight get through the writer.
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            next_job = jobs.size();
+          }
+          writer.Write(job_idx, "");
+          break;
+        }
+      }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) workers.emplace_back(work, i);
+    for (auto& worker : workers) worker.join();
+    for (const auto& error : errors) {
+      if (error) std::rethrow_exception(error);
+    }
+    const float seconds = std::chrono::duration<float>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    CERR << "Evaluated " << evaluated << " positions in " << seconds << "s, "
+         << evaluated / std::max(seconds, 1e-3f) << " positions/s.";
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
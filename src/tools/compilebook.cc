@@ -0,0 +1,87 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/compilebook.h"
+
+#include <chrono>
+
+#include "chess/opening_book.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputFilenameId{
+    "input", "",
+    "Comma separated paths of the input PGN or EPD (.epd) files, possibly "
+    "gzipped (or zstd compressed, .zst). With one thread, the files are "
+    "streamed instead of being read into memory."};
+const OptionId kOutputFilenameId{"output", "",
+                                 "Path of the output opening book."};
+const OptionId kThreadsId{
+    "threads", "", "Number of threads to parse with, 0 for all the cores."};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kInputFilenameId);
+  options->Add<StringOption>(kOutputFilenameId);
+  options->Add<IntOption>(kThreadsId, 0, 256) = 0;
+  if (!options->ProcessAllFlags()) return false;
+
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kInputFilenameId);
+  dict.EnsureExists<std::string>(kOutputFilenameId);
+  return true;
+}
+
+}  // namespace
+
+void CompileOpeningBook() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<Opening> openings;
+  for (const auto& filename :
+       StrSplit(dict.Get<std::string>(kInputFilenameId), ",")) {
+    auto file_openings = ReadOpeningFile(filename, dict.Get<int>(kThreadsId));
+    COUT << "Read " << file_openings.size() << " openings from " << filename;
+    openings.insert(openings.end(),
+                    std::make_move_iterator(file_openings.begin()),
+                    std::make_move_iterator(file_openings.end()));
+  }
+  const std::string output = dict.Get<std::string>(kOutputFilenameId);
+  OpeningBook(openings).Save(output);
+  COUT << "Wrote " << openings.size() << " openings to " << output << " in "
+       << std::chrono::duration<float>(std::chrono::steady_clock::now() - start)
+              .count()
+       << "s.";
+}
+
+}  // namespace lczero
@@ -27,18 +27,44 @@
 
 #include "tools/describenet.h"
 
+#include <algorithm>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+
 #include "neural/loader.h"
+#include "neural/network_legacy.h"
 #include "neural/onnx/onnx.pb.h"
 #include "utils/optionsparser.h"
+#include "utils/string.h"
 
 namespace lczero {
 namespace {
 
 const OptionId kWeightsFilenameId{"weights", "WeightsFile",
                                   "Path of the input Lc0 weights file.", 'w'};
+const OptionId kBatchSizesId{
+    "batch-sizes", "",
+    "Comma-separated batch sizes to estimate the activation memory for."};
+const OptionId kActivationBytesId{
+    "activation-bytes", "",
+    "Bytes per activation value, 2 for fp16/bf16 backends and 4 for fp32."};
+const OptionId kTflopsId{
+    "tflops", "",
+    "Peak TFLOPS of the device in the activation precision. When set, the NPS "
+    "is predicted from the FLOPs per position."};
+const OptionId kEfficiencyId{
+    "efficiency", "",
+    "Fraction of the peak TFLOPS the backend achieves, for the NPS "
+    "prediction. Measure it once per device class with backendbench and a "
+    "known net."};
 
 bool ProcessParameters(OptionsParser* options) {
   options->Add<StringOption>(kWeightsFilenameId);
+  options->Add<StringOption>(kBatchSizesId) = "1,64,256";
+  options->Add<IntOption>(kActivationBytesId, 1, 8) = 2;
+  options->Add<FloatOption>(kTflopsId, 0.0f, 100000.0f) = 0.0f;
+  options->Add<FloatOption>(kEfficiencyId, 0.01f, 1.0f) = 0.4f;
   if (!options->ProcessAllFlags()) return false;
   const OptionsDict& dict = options->GetOptionsDict();
   dict.EnsureExists<std::string>(kWeightsFilenameId);
@@ -54,6 +80,201 @@ std::string Justify(std::string str, size_t length = 30) {
   return str;
 }
 
+// Cost of a part of the network, per position. FLOPs count a multiply-add as
+// two, activations are the number of values the part outputs.
+struct LayerCost {
+  std::string name;
+  int64_t params = 0;
+  int64_t flops = 0;
+  int64_t activations = 0;
+};
+
+using Vec = BaseWeights::Vec;
+constexpr int kSquares = 64;
+
+// Cost estimate of the network from the layer sizes, the way the backends
+// compute it. Elementwise operations (activations, layer norms, softmax) are
+// not counted.
+class CostModel {
+ public:
+  explicit CostModel(const MultiHeadWeights& w) {
+    if (w.encoder.empty()) {
+      AddConvBody(w);
+    } else {
+      AddAttentionBody(w);
+    }
+    // Only the heads used by default are computed.
+    if (auto iter = w.policy_heads.find("vanilla");
+        iter != w.policy_heads.end()) {
+      AddPolicyHead(iter->second);
+    }
+    if (auto iter = w.value_heads.find("winner"); iter != w.value_heads.end()) {
+      AddValueHead(iter->second);
+    }
+    if (!w.ip2_mov_w.empty()) {
+      LayerCost cost{"Moves left head"};
+      AddConv(w.moves_left, &cost);
+      AddDense(w.ip_mov_w, w.ip_mov_b, kSquares, &cost);
+      AddDense(w.ip1_mov_w, w.ip1_mov_b, 1, &cost);
+      AddDense(w.ip2_mov_w, w.ip2_mov_b, 1, &cost);
+      layers_.push_back(cost);
+    }
+  }
+
+  const std::vector<LayerCost>& layers() const { return layers_; }
+
+  LayerCost Total() const {
+    LayerCost total{"Total"};
+    for (const auto& layer : layers_) {
+      total.params += layer.params;
+      total.flops += layer.flops;
+      total.activations = std::max(total.activations, layer.activations);
+    }
+    return total;
+  }
+
+ private:
+  // Dense layer applied to every one of @tokens inputs.
+  static void AddDense(const Vec& w, const Vec& b, int tokens,
+                       LayerCost* cost) {
+    cost->params += w.size() + b.size();
+    cost->flops += 2 * static_cast<int64_t>(tokens) * w.size();
+    cost->activations =
+        std::max<int64_t>(cost->activations, tokens * b.size());
+  }
+  static void AddConv(const BaseWeights::ConvBlock& conv, LayerCost* cost) {
+    AddDense(conv.weights, conv.biases, kSquares, cost);
+    cost->params += conv.bn_gammas.size() + conv.bn_betas.size() +
+                    conv.bn_means.size() + conv.bn_stddivs.size();
+  }
+  static void AddEncoders(
+      const std::vector<BaseWeights::EncoderLayer>& encoders, int heads,
+      const Vec& smolgen_w, const std::string& name,
+      std::vector<LayerCost>* layers) {
+    if (encoders.empty()) return;
+    const std::string suffix = " (x" + std::to_string(encoders.size()) + ")";
+    LayerCost mha{name + " attention" + suffix};
+    LayerCost smolgen{name + " smolgen" + suffix};
+    LayerCost ffn{name + " FFN" + suffix};
+    for (const auto& layer : encoders) {
+      const auto& m = layer.mha;
+      AddDense(m.q_w, m.q_b, kSquares, &mha);
+      AddDense(m.k_w, m.k_b, kSquares, &mha);
+      AddDense(m.v_w, m.v_b, kSquares, &mha);
+      // Q*K^T and the attention weights times V.
+      mha.flops += 2 * 2 * kSquares * kSquares * m.q_b.size();
+      mha.activations = std::max<int64_t>(mha.activations,
+                                          kSquares * kSquares * heads);
+      AddDense(m.dense_w, m.dense_b, kSquares, &mha);
+      mha.params += layer.ln1_gammas.size() + layer.ln1_betas.size();
+      if (m.has_smolgen) {
+        const auto& sg = m.smolgen;
+        AddDense(sg.compress, {}, kSquares, &smolgen);
+        AddDense(sg.dense1_w, sg.dense1_b, 1, &smolgen);
+        AddDense(sg.dense2_w, sg.dense2_b, 1, &smolgen);
+        // The shared weights generate the attention bias of every head.
+        smolgen.flops += 2 * static_cast<int64_t>(heads) * smolgen_w.size();
+        smolgen.activations = std::max<int64_t>(
+            smolgen.activations, kSquares * kSquares * heads);
+      }
+      AddDense(layer.ffn.dense1_w, layer.ffn.dense1_b, kSquares, &ffn);
+      AddDense(layer.ffn.dense2_w, layer.ffn.dense2_b, kSquares, &ffn);
+      ffn.params += layer.ln2_gammas.size() + layer.ln2_betas.size();
+    }
+    layers->push_back(mha);
+    if (smolgen.flops > 0) {
+      smolgen.params += smolgen_w.size();
+      layers->push_back(smolgen);
+    }
+    layers->push_back(ffn);
+  }
+
+  void AddConvBody(const MultiHeadWeights& w) {
+    LayerCost input{"Input convolution"};
+    AddConv(w.input, &input);
+    layers_.push_back(input);
+    if (w.residual.empty()) return;
+    LayerCost residual{"Residual blocks (x" +
+                       std::to_string(w.residual.size()) + ")"};
+    for (const auto& block : w.residual) {
+      AddConv(block.conv1, &residual);
+      AddConv(block.conv2, &residual);
+      if (block.has_se) {
+        AddDense(block.se.w1, block.se.b1, 1, &residual);
+        AddDense(block.se.w2, block.se.b2, 1, &residual);
+      }
+    }
+    layers_.push_back(residual);
+  }
+
+  void AddAttentionBody(const MultiHeadWeights& w) {
+    LayerCost embedding{"Embedding"};
+    AddDense(w.ip_emb_preproc_w, w.ip_emb_preproc_b, 1, &embedding);
+    AddDense(w.ip_emb_w, w.ip_emb_b, kSquares, &embedding);
+    AddDense(w.ip_emb_ffn.dense1_w, w.ip_emb_ffn.dense1_b, kSquares,
+             &embedding);
+    AddDense(w.ip_emb_ffn.dense2_w, w.ip_emb_ffn.dense2_b, kSquares,
+             &embedding);
+    embedding.params += w.ip_emb_ln_gammas.size() + w.ip_emb_ln_betas.size() +
+                        w.ip_mult_gate.size() + w.ip_add_gate.size() +
+                        w.ip_emb_ffn_ln_gammas.size() +
+                        w.ip_emb_ffn_ln_betas.size();
+    layers_.push_back(embedding);
+    AddEncoders(w.encoder, w.encoder_head_count, w.smolgen_w, "Encoder",
+                &layers_);
+  }
+
+  void AddPolicyHead(const MultiHeadWeights::PolicyHead& head) {
+    LayerCost cost{"Policy head"};
+    if (!head.policy1.weights.empty()) {
+      AddConv(head.policy1, &cost);
+      AddConv(head.policy, &cost);
+    } else if (!head.ip2_pol_w.empty()) {
+      AddDense(head.ip_pol_w, head.ip_pol_b, kSquares, &cost);
+      AddEncoders(head.pol_encoder, head.pol_encoder_head_count, {},
+                  "Policy encoder", &layers_);
+      AddDense(head.ip2_pol_w, head.ip2_pol_b, kSquares, &cost);
+      AddDense(head.ip3_pol_w, head.ip3_pol_b, kSquares, &cost);
+      // Query-key logits of all the moves, and the promotion logits.
+      cost.flops += 2 * kSquares * kSquares * head.ip2_pol_b.size();
+      cost.activations =
+          std::max<int64_t>(cost.activations, kSquares * kSquares);
+      AddDense(head.ip4_pol_w, {}, 8, &cost);
+    } else {
+      AddConv(head.policy, &cost);
+      AddDense(head.ip_pol_w, head.ip_pol_b, 1, &cost);
+    }
+    layers_.push_back(cost);
+  }
+
+  void AddValueHead(const MultiHeadWeights::ValueHead& head) {
+    LayerCost cost{"Value head"};
+    AddConv(head.value, &cost);
+    AddDense(head.ip_val_w, head.ip_val_b, kSquares, &cost);
+    AddDense(head.ip1_val_w, head.ip1_val_b, 1, &cost);
+    AddDense(head.ip2_val_w, head.ip2_val_b, 1, &cost);
+    AddDense(head.ip_val_err_w, head.ip_val_err_b, 1, &cost);
+    layers_.push_back(cost);
+  }
+
+  std::vector<LayerCost> layers_;
+};
+
+std::string FormatCount(double value) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(value >= 1e9 ? 2 : 1);
+  if (value >= 1e9) {
+    oss << value / 1e9 << "G";
+  } else if (value >= 1e6) {
+    oss << value / 1e6 << "M";
+  } else if (value >= 1e3) {
+    oss << value / 1e3 << "K";
+  } else {
+    oss << std::setprecision(0) << value;
+  }
+  return oss.str();
+}
+
 }  // namespace
 
 void ShowNetworkGenericInfo(const pblczero::Net& weights) {
@@ -291,6 +512,46 @@ void ShowNetworkOnnxInfo(const pblczero::Net& weights,
   }
 }
 
+void ShowNetworkCostInfo(const pblczero::Net& weights,
+                         const std::vector<int>& batch_sizes,
+                         int activation_bytes, float tflops,
+                         float efficiency) {
+  if (!weights.has_weights()) return;
+  std::optional<CostModel> model;
+  try {
+    model.emplace(MultiHeadWeights(weights.weights()));
+  } catch (const Exception& ex) {
+    COUT << "\nCost estimate is not available: " << ex.what();
+    return;
+  }
+  COUT << "\nCost per position";
+  COUT << "~~~~~~~~~~~~~~~~~";
+  const LayerCost total = model->Total();
+  auto show = [](const LayerCost& cost) {
+    COUT << Justify(cost.name, 36) << FormatCount(cost.params) << " params, "
+         << FormatCount(cost.flops) << "FLOPs, "
+         << FormatCount(cost.activations) << " activations";
+  };
+  for (const auto& layer : model->layers()) show(layer);
+  show(total);
+
+  // Every layer's input and output are alive at the same time.
+  for (int batch_size : batch_sizes) {
+    const double bytes =
+        2.0 * total.activations * activation_bytes * batch_size;
+    COUT << Justify("Activations, batch " + std::to_string(batch_size), 36)
+         << FormatCount(bytes) << "B";
+  }
+  COUT << Justify("Weights", 36)
+       << FormatCount(static_cast<double>(total.params) * activation_bytes)
+       << "B";
+  if (tflops > 0.0f && total.flops > 0) {
+    COUT << Justify("Predicted NPS", 36)
+         << FormatCount(1e12 * tflops * efficiency / total.flops) << " (at "
+         << tflops << " TFLOPS, " << efficiency * 100 << "% efficiency)";
+  }
+}
+
 void ShowAllNetworkInfo(const pblczero::Net& weights) {
   ShowNetworkGenericInfo(weights);
   ShowNetworkFormatInfo(weights);
@@ -307,5 +568,11 @@ void DescribeNetworkCmd() {
   auto weights_file =
       LoadWeightsFromFile(dict.Get<std::string>(kWeightsFilenameId));
   ShowAllNetworkInfo(weights_file);
+  const std::string batch_sizes = dict.Get<std::string>(kBatchSizesId);
+  ShowNetworkCostInfo(
+      weights_file,
+      batch_sizes.empty() ? std::vector<int>{} : ParseIntList(batch_sizes),
+      dict.Get<int>(kActivationBytesId), dict.Get<float>(kTflopsId),
+      dict.Get<float>(kEfficiencyId));
 }
 }  // namespace lczero
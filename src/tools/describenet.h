@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "proto/net.pb.h"
 
 namespace lczero {
@@ -38,6 +40,11 @@ void ShowNetworkTrainingInfo(const pblczero::Net& weights);
 void ShowNetworkWeightsInfo(const pblczero::Net& weights);
 void ShowNetworkOnnxInfo(const pblczero::Net& weights,
                          bool show_onnx_internals);
+// Shows parameter counts, FLOPs and activation sizes of the parts of the
+// network, and the predicted NPS for the device with @tflops if it's set.
+void ShowNetworkCostInfo(const pblczero::Net& weights,
+                         const std::vector<int>& batch_sizes,
+                         int activation_bytes, float tflops, float efficiency);
 void ShowAllNetworkInfo(const pblczero::Net& weights);
 
 }  // namespace lczero
\ No newline at end of file
@@ -47,10 +47,8 @@ const OptionId kHloTextOutputFilenameId = {"hlo-text-output", "",
 const OptionId kHloProtoOutputFilenameId = {
     "hlo-proto-output", "", "Path of the output HLO proto file."};
 const OptionId kOnnxBatchSizeId{
-    {.long_flag = "onnx-batch-size",
-     .uci_option = "",
-     .help_text = "Batch size to use for ONNX conversion.",
-     .visibility = OptionId::kProOnly}};
+    "onnx-batch-size", "",
+    "Batch size to use for ONNX conversion, -1 for a dynamic batch dimension."};
 const OptionId kHloBatchSizeId{"hlo-batch-size", "",
                                "Batch size to use for HLO conversion."};
 const OptionId kOnnxDataTypeId{"onnx-data-type", "",
@@ -78,6 +76,14 @@ const OptionId kOutputMlh{"mlh-head-name", "MlhHeadName",
 const OptionId kOnnxToPytorch{
     "onnx2pytorch", "",
     "Only use layer definitions supported by onnx2pytorch."};
+const OptionId kOnnxFusedAttention{
+    "onnx-fused-attention", "",
+    "Use the onnxruntime MultiHeadAttention contrib operator for the encoder "
+    "attention. The resulting model only runs on onnxruntime."};
+const OptionId kOnnxInt8Weights{
+    "onnx-int8-weights", "",
+    "Store the encoder matmul weights as int8 with per-channel scales, using "
+    "DequantizeLinear (QDQ) nodes. Requires opset 13 or later."};
 const OptionId kValueHead{
     "value-head", "",
     "Value head to be used in the generated model. Typical values are "
@@ -105,6 +111,8 @@ bool ProcessParameters(OptionsParser* options) {
   options->Add<StringOption>(kOutputValue) = "/output/value";
   options->Add<StringOption>(kOutputMlh) = "/output/mlh";
   options->Add<BoolOption>(kOnnxToPytorch) = false;
+  options->Add<BoolOption>(kOnnxFusedAttention) = false;
+  options->Add<BoolOption>(kOnnxInt8Weights) = false;
   options->Add<StringOption>(kValueHead) = "winner";
   options->Add<StringOption>(kPolicyHead) = "vanilla";
   if (!options->ProcessAllFlags()) return false;
@@ -149,6 +157,8 @@ void ConvertLeelaToOnnx() {
     // onnx2pytorch only needs an alternate layernorm-implementation, so it's
     // currently only enables that. Might need to be extended in the future.
     onnx_options.alt_layernorm = dict.Get<bool>(kOnnxToPytorch);
+    onnx_options.fused_attention = dict.Get<bool>(kOnnxFusedAttention);
+    onnx_options.int8_weights = dict.Get<bool>(kOnnxInt8Weights);
     onnx_options.value_head = dict.Get<std::string>(kValueHead);
     onnx_options.policy_head = dict.Get<std::string>(kPolicyHead);
     weights_file = ConvertWeightsToOnnx(weights_file, onnx_options);
@@ -0,0 +1,287 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/perft.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chess/board.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+const OptionId kThreadsOptionId{"threads", "Threads",
+                                "Number of (CPU) worker threads to use.", 't'};
+const OptionId kDepthId{
+    "depth", "",
+    "Perft depth. With 0, every suite position uses its own default depth."};
+const OptionId kFenId{"fen", "",
+                      "Position FEN to run perft on instead of the suite."};
+const OptionId kDivideId{"divide", "",
+                         "Print the node counts of every root move to stderr."};
+const OptionId kHashId{"hash", "",
+                       "Also compute the board hash of every visited node."};
+const OptionId kJsonId{"json", "", "Print the results as JSON."};
+
+struct SuitePosition {
+  const char* fen;
+  bool is_chess960;
+  int default_depth;
+  // Node counts for depths 1 to 6.
+  uint64_t perft[6];
+};
+
+const SuitePosition kSuite[] = {
+    {ChessBoard::kStartposFen,
+     false,
+     5,
+     {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 1 1",
+     false,
+     4,
+     {48, 2039, 97862, 4085603, 193690690, 8031647685}},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 1 1",
+     false,
+     6,
+     {14, 191, 2812, 43238, 674624, 11030083}},
+    {"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+     false,
+     5,
+     {6, 264, 9467, 422333, 15833292, 706045033}},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     false,
+     4,
+     {44, 1486, 62379, 2103487, 89941194, 3048196529}},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 "
+     "10",
+     false,
+     4,
+     {46, 2079, 89890, 3894594, 164075551, 6923051137}},
+    {"bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9",
+     true,
+     5,
+     {21, 528, 12189, 326672, 8146062, 227689589}},
+    {"qn1rkrbb/pp1p1ppp/2p1p3/3n4/4P2P/2NP4/PPP2PP1/Q1NRKRBB w FDfd - 1 9",
+     true,
+     5,
+     {24, 585, 14769, 356950, 9482310, 233468620}},
+    {"bnqnrbkr/1pp2pp1/p7/3pP2p/4P1P1/8/PPPP3P/BNQNRBKR w HEhe d6 0 9",
+     true,
+     5,
+     {31, 984, 28677, 962591, 29032175, 1008880643}},
+};
+
+#if defined(NO_PEXT)
+constexpr const char* kMagicPath = "multiply";
+#else
+constexpr const char* kMagicPath = "pext";
+#endif
+
+// Without hashing, the last ply is only counted, not applied.
+uint64_t Perft(const ChessBoard& board, int depth, bool hash,
+               uint64_t* hash_sum) {
+  if (hash) *hash_sum += board.Hash();
+  if (depth == 0) return 1;
+  if (depth == 1 && !hash) return board.CountLegalMoves();
+  uint64_t nodes = 0;
+  for (const Move move : board.GenerateLegalMoves()) {
+    ChessBoard child = board;
+    child.ApplyMove(move);
+    child.Mirror();
+    nodes += Perft(child, depth - 1, hash, hash_sum);
+  }
+  return nodes;
+}
+
+struct PerftResult {
+  std::string fen;
+  int depth;
+  uint64_t nodes;
+  std::optional<uint64_t> expected;
+  double seconds;
+};
+
+// Splits the root moves between the threads.
+PerftResult RunPerft(const std::string& fen, int depth, int threads,
+                     bool hash, bool divide, bool is_chess960) {
+  const ChessBoard board(fen);
+  const MoveList moves = board.GenerateLegalMoves();
+  std::vector<uint64_t> move_nodes(moves.size());
+  std::atomic<size_t> next_move = 0;
+  std::atomic<uint64_t> total_hash_sum = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+  auto worker = [&]() {
+    uint64_t hash_sum = 0;
+    for (size_t i = next_move++; i < moves.size(); i = next_move++) {
+      ChessBoard child = board;
+      child.ApplyMove(moves[i]);
+      child.Mirror();
+      move_nodes[i] = Perft(child, depth - 1, hash, &hash_sum);
+    }
+    total_hash_sum += hash_sum;
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers) thread.join();
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+
+  PerftResult result{.fen = fen,
+                     .depth = depth,
+                     .nodes = 0,
+                     .expected = std::nullopt,
+                     .seconds = time.count()};
+  for (size_t i = 0; i < moves.size(); ++i) {
+    result.nodes += move_nodes[i];
+    if (!divide) continue;
+    Move move = moves[i];
+    if (board.flipped()) move.Flip();
+    std::cerr << move.ToString(is_chess960) << ": " << move_nodes[i]
+              << std::endl;
+  }
+  // Keeps the hashing from being optimized away.
+  if (hash && total_hash_sum == 0) std::cerr << "Zero hash sum." << std::endl;
+  return result;
+}
+
+double GetMnps(uint64_t nodes, double seconds) {
+  return seconds > 0 ? nodes / seconds / 1e6 : 0.0;
+}
+
+void PrintJson(const std::vector<PerftResult>& results, int threads,
+               bool hash) {
+  uint64_t total_nodes = 0;
+  double total_seconds = 0;
+  bool all_ok = true;
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3);
+  out << "{\n  \"magic\": \"" << kMagicPath << "\",\n  \"threads\": "
+      << threads << ",\n  \"hash\": " << (hash ? "true" : "false")
+      << ",\n  \"positions\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    const bool ok = !result.expected || *result.expected == result.nodes;
+    all_ok &= ok;
+    total_nodes += result.nodes;
+    total_seconds += result.seconds;
+    out << (i ? "," : "") << "\n    {\"fen\": \"" << result.fen
+        << "\", \"depth\": " << result.depth << ", \"nodes\": " << result.nodes;
+    if (result.expected) out << ", \"expected\": " << *result.expected;
+    out << ", \"ok\": " << (ok ? "true" : "false")
+        << ", \"time_ms\": " << result.seconds * 1000
+        << ", \"mnps\": " << GetMnps(result.nodes, result.seconds) << "}";
+  }
+  out << "\n  ],\n  \"total_nodes\": " << total_nodes
+      << ",\n  \"total_time_ms\": " << total_seconds * 1000
+      << ",\n  \"mnps\": " << GetMnps(total_nodes, total_seconds)
+      << ",\n  \"ok\": " << (all_ok ? "true" : "false") << "\n}";
+  std::cout << out.str() << std::endl;
+}
+}  // namespace
+
+void PerftBenchmark::Run() {
+  OptionsParser options;
+  options.Add<IntOption>(kThreadsOptionId, 1, 128) = 1;
+  options.Add<IntOption>(kDepthId, 0, 6) = 0;
+  options.Add<StringOption>(kFenId) = "";
+  options.Add<BoolOption>(kDivideId) = false;
+  options.Add<BoolOption>(kHashId) = false;
+  options.Add<BoolOption>(kJsonId) = false;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    const int threads = option_dict.Get<int>(kThreadsOptionId);
+    const int depth = option_dict.Get<int>(kDepthId);
+    const std::string fen = option_dict.Get<std::string>(kFenId);
+    const bool divide = option_dict.Get<bool>(kDivideId);
+    const bool hash = option_dict.Get<bool>(kHashId);
+    const bool json = option_dict.Get<bool>(kJsonId);
+
+    std::vector<PerftResult> results;
+    uint64_t total_nodes = 0;
+    double total_seconds = 0;
+    int failed = 0;
+    auto run = [&](const std::string& fen, int depth, bool is_chess960,
+                   std::optional<uint64_t> expected) {
+      if (!json) std::cout << "\nPosition: " << fen << std::endl;
+      results.push_back(
+          RunPerft(fen, depth, threads, hash, divide, is_chess960));
+      auto& result = results.back();
+      result.expected = expected;
+      total_nodes += result.nodes;
+      total_seconds += result.seconds;
+      const bool ok = !expected || *expected == result.nodes;
+      if (!ok) ++failed;
+      if (json) return;
+      std::cout << "Depth " << result.depth << ": " << result.nodes
+                << " nodes, " << std::lround(result.seconds * 1000) << " ms, "
+                << GetMnps(result.nodes, result.seconds) << " MNPS";
+      if (!ok) std::cout << ", EXPECTED " << *expected;
+      std::cout << std::endl;
+    };
+    if (!fen.empty()) {
+      run(fen, depth ? depth : 5, false, std::nullopt);
+    } else {
+      for (const auto& position : kSuite) {
+        const int position_depth = depth ? depth : position.default_depth;
+        run(position.fen, position_depth, position.is_chess960,
+            position.perft[position_depth - 1]);
+      }
+    }
+
+    if (json) {
+      PrintJson(results, threads, hash);
+      return;
+    }
+    std::cout << "\n==========================="
+              << "\nMagic bitboards : " << kMagicPath
+              << "\nTotal time (ms) : " << std::lround(total_seconds * 1000)
+              << "\nNodes           : " << total_nodes
+              << "\nMNPS            : " << GetMnps(total_nodes, total_seconds)
+              << std::endl;
+    if (failed) std::cout << failed << " position(s) FAILED." << std::endl;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
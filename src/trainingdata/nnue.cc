@@ -0,0 +1,215 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "trainingdata/nnue.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+void AppendInt(int value, std::string* out) {
+  char buf[16];
+  const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+  out->append(buf, res.ptr);
+}
+
+void AppendPlain(const Position& p, Move m, float q, int result,
+                 std::string* out) {
+  out->append("fen ");
+  out->append(PositionToFen(p));
+  if (p.IsBlackToMove()) m.Flip();
+  out->append("\nmove ");
+  out->append(m.ToString(false));
+  out->append("\nscore ");
+  AppendInt(NnueScore(q), out);
+  out->append("\nply ");
+  AppendInt(p.GetGamePly(), out);
+  out->append("\nresult ");
+  AppendInt(result, out);
+  out->append("\ne\n");
+}
+
+// Little endian bit stream, as in Stockfish's sfen packer.
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* data) : data_(data) {}
+  void Write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; ++i, ++cursor_) {
+      if (value & (1u << i)) data_[cursor_ / 8] |= 1 << (cursor_ % 8);
+    }
+  }
+
+ private:
+  uint8_t* const data_;
+  int cursor_ = 0;
+};
+
+// Encodes the position as Stockfish's 256 bit PackedSfen.
+void PackSfen(const Position& p, uint8_t* data) {
+  ChessBoard board = p.GetBoard();
+  const bool black_to_move = board.flipped();
+  // From white's point of view, "ours" are white pieces.
+  if (black_to_move) board.Mirror();
+  BitWriter stream(data);
+  stream.Write(black_to_move, 1);
+  stream.Write((*(board.kings() & board.ours()).begin()).as_idx(), 6);
+  stream.Write((*(board.kings() & board.theirs()).begin()).as_idx(), 6);
+  for (Rank rank = kRank8; rank.IsValid(); --rank) {
+    for (File file = kFileA; file <= kFileH; ++file) {
+      const Square sq(file, rank);
+      if (board.kings().get(sq)) continue;
+      // Huffman codes of the piece types, 0 for an empty square.
+      uint32_t code;
+      if (board.pawns().get(sq)) {
+        code = 0b0001;
+      } else if (board.knights().get(sq)) {
+        code = 0b0011;
+      } else if (board.bishops().get(sq)) {
+        code = 0b0101;
+      } else if (board.rooks().get(sq)) {
+        code = 0b0111;
+      } else if (board.queens().get(sq)) {
+        code = 0b1001;
+      } else {
+        stream.Write(0, 1);
+        continue;
+      }
+      stream.Write(code, 4);
+      stream.Write(board.theirs().get(sq), 1);
+    }
+  }
+  const auto& castlings = board.castlings();
+  stream.Write(castlings.we_can_00(), 1);
+  stream.Write(castlings.we_can_000(), 1);
+  stream.Write(castlings.they_can_00(), 1);
+  stream.Write(castlings.they_can_000(), 1);
+  if (board.en_passant().empty()) {
+    stream.Write(0, 1);
+  } else {
+    const Square sq = *board.en_passant().begin();
+    stream.Write(1, 1);
+    stream.Write(
+        Square(sq.file(), black_to_move ? kRank3 : kRank6).as_idx(), 6);
+  }
+  const int rule50 = p.GetRule50Ply();
+  const int fullmove = 1 + (p.GetGamePly() - black_to_move) / 2;
+  stream.Write(rule50, 6);
+  stream.Write(fullmove, 8);
+  stream.Write(fullmove >> 8, 8);
+  stream.Write(rule50 >> 6, 1);
+}
+
+// Stockfish's 16 bit move encoding, in absolute coordinates.
+uint16_t SfMove(const Position& p, Move m) {
+  const ChessBoard& board = p.GetBoard();
+  uint16_t special = 0;
+  if (m.is_promotion()) {
+    // Knight, bishop, rook, queen.
+    static constexpr uint16_t kPromotion[] = {0, 3, 2, 1};
+    special = (1 << 14) | (kPromotion[m.promotion().idx] << 12);
+  } else if (board.kings().get(m.from()) && board.ours().get(m.to())) {
+    // King takes rook, same as ours.
+    special = 3 << 14;
+  } else if (board.pawns().get(m.from()) &&
+             m.from().file() != m.to().file() && !board.theirs().get(m.to())) {
+    special = 2 << 14;
+  }
+  Square from = m.from();
+  Square to = m.to();
+  if (p.IsBlackToMove()) {
+    from.Flip();
+    to.Flip();
+  }
+  return special | (from.as_idx() << 6) | to.as_idx();
+}
+
+void AppendBin(const Position& p, Move m, float q, int result,
+               std::string* out) {
+  // PackedSfenValue: sfen[32], int16 score, uint16 move, uint16 ply,
+  // int8 result, padding.
+  uint8_t record[40] = {};
+  PackSfen(p, record);
+  const int16_t score = std::clamp(NnueScore(q), -32000, 32000);
+  const uint16_t move = SfMove(p, m);
+  const uint16_t ply = p.GetGamePly();
+  const int8_t game_result = result;
+  std::memcpy(record + 32, &score, sizeof(score));
+  std::memcpy(record + 34, &move, sizeof(move));
+  std::memcpy(record + 36, &ply, sizeof(ply));
+  std::memcpy(record + 38, &game_result, sizeof(game_result));
+  out->append(reinterpret_cast<const char*>(record), sizeof(record));
+}
+
+}  // namespace
+
+int NnueScore(float q) {
+  // Formula from PR1477 adjusted for SF PawnValueEg.
+  return std::round(660.6 * q / (1 - 0.9751875 * std::pow(q, 10)));
+}
+
+void AppendNnueRecord(NnueFormat format, const Position& p, Move m, float q,
+                      int result, std::string* out) {
+  switch (format) {
+    case NnueFormat::kPlain:
+      AppendPlain(p, m, q, result, out);
+      return;
+    case NnueFormat::kBin:
+      AppendBin(p, m, q, result, out);
+      return;
+  }
+}
+
+NnueOutputFile::NnueOutputFile(const std::string& filename)
+    : file_(fopen(filename.c_str(), "ab")) {
+  if (!file_) throw Exception("Unable to open " + filename);
+}
+
+NnueOutputFile::~NnueOutputFile() {
+  Mutex::Lock lock(mutex_);
+  fclose(file_);
+}
+
+void NnueOutputFile::Append(std::string* buffer) {
+  if (buffer->empty()) return;
+  {
+    Mutex::Lock lock(mutex_);
+    if (fwrite(buffer->data(), 1, buffer->size(), file_) != buffer->size()) {
+      throw Exception("Unable to write NNUE data");
+    }
+  }
+  buffer->clear();
+}
+
+}  // namespace lczero
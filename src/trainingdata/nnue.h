@@ -0,0 +1,73 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "chess/position.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Training data export for the Stockfish NNUE trainer.
+enum class NnueFormat {
+  // "plain" text, a few lines per position.
+  kPlain,
+  // "bin", 40 byte PackedSfenValue records with the position Huffman coded.
+  kBin,
+};
+
+// Centipawn-like score in Stockfish units for the expected score @q.
+int NnueScore(float q);
+
+// Appends the record for position @p, move @m (in the board coordinates of
+// @p, i.e. flipped for black), score @q and game @result from the side to
+// move point of view.
+void AppendNnueRecord(NnueFormat format, const Position& p, Move m, float q,
+                      int result, std::string* out);
+
+// Output file shared by the threads. Every thread formats records into its own
+// buffer and appends it as a whole, so records are never interleaved but the
+// order of the buffers is arbitrary.
+class NnueOutputFile {
+ public:
+  // Appends to @filename, creates it if it doesn't exist.
+  explicit NnueOutputFile(const std::string& filename);
+  ~NnueOutputFile();
+
+  // Writes and clears @buffer.
+  void Append(std::string* buffer);
+
+ private:
+  Mutex mutex_;
+  FILE* file_ GUARDED_BY(mutex_);
+};
+
+}  // namespace lczero
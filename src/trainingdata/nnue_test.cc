@@ -0,0 +1,103 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "trainingdata/nnue.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+namespace lczero {
+namespace {
+
+uint16_t BinMove(const std::string& record) {
+  uint16_t move;
+  std::memcpy(&move, record.data() + 34, sizeof(move));
+  return move;
+}
+
+int SfenBits(const std::string& record, int offset, int bits) {
+  int value = 0;
+  for (int i = 0; i < bits; ++i) {
+    const int bit = offset + i;
+    if (record[bit / 8] & (1 << (bit % 8))) value |= 1 << i;
+  }
+  return value;
+}
+
+TEST(NnueExport, Plain) {
+  const Position pos(ChessBoard::kStartposBoard, 0, 0);
+  std::string out;
+  AppendNnueRecord(NnueFormat::kPlain, pos,
+                   Move::White(Square::Parse("e2"), Square::Parse("e4")),
+                   0.0f, 1, &out);
+  EXPECT_EQ(out,
+            "fen rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1\n"
+            "move e2e4\nscore 0\nply 0\nresult 1\ne\n");
+}
+
+TEST(NnueExport, Bin) {
+  const Position pos(ChessBoard::kStartposBoard, 0, 0);
+  const Move e2e4 = Move::White(Square::Parse("e2"), Square::Parse("e4"));
+  std::string out;
+  AppendNnueRecord(NnueFormat::kBin, pos, e2e4, 0.5f, -1, &out);
+  ASSERT_EQ(out.size(), 40u);
+  EXPECT_EQ(SfenBits(out, 0, 1), 0);
+  EXPECT_EQ(SfenBits(out, 1, 6), 4);
+  EXPECT_EQ(SfenBits(out, 7, 6), 60);
+  EXPECT_EQ(BinMove(out), (12 << 6) | 28);
+  int16_t score;
+  std::memcpy(&score, out.data() + 32, sizeof(score));
+  EXPECT_EQ(score, NnueScore(0.5f));
+  EXPECT_EQ(static_cast<int8_t>(out[38]), -1);
+
+  // Black moves are stored in absolute coordinates.
+  const Position black(pos, e2e4);
+  out.clear();
+  AppendNnueRecord(NnueFormat::kBin, black, e2e4, 0.0f, 0, &out);
+  EXPECT_EQ(SfenBits(out, 0, 1), 1);
+  EXPECT_EQ(BinMove(out), (52 << 6) | 36);
+}
+
+TEST(NnueExport, BinCastling) {
+  const Position pos(ChessBoard("r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1"), 0,
+                     0);
+  std::string out;
+  AppendNnueRecord(NnueFormat::kBin, pos,
+                   Move::White(Square::Parse("e1"), Square::Parse("h1")),
+                   0.0f, 0, &out);
+  EXPECT_EQ(BinMove(out), (3 << 14) | (4 << 6) | 7);
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
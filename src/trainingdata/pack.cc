@@ -0,0 +1,225 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "trainingdata/pack.h"
+
+#include <zlib.h>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+bool IsPackCodecSupported(PackCodec codec) {
+  switch (codec) {
+    case PackCodec::kDeflate:
+      return true;
+    case PackCodec::kZstd:
+#ifdef USE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+PackCodec DefaultPackCodec() {
+  return IsPackCodecSupported(PackCodec::kZstd) ? PackCodec::kZstd
+                                                : PackCodec::kDeflate;
+}
+
+struct PackCompressor::Context {
+  PackCodec codec;
+  std::string dictionary;
+  z_stream zs{};
+#ifdef USE_ZSTD
+  ZSTD_CCtx* cctx = nullptr;
+  ZSTD_CDict* cdict = nullptr;
+  int level;
+#endif
+};
+
+PackCompressor::PackCompressor(PackCodec codec, int level,
+                               std::string dictionary)
+    : context_(std::make_unique<Context>()) {
+  if (!IsPackCodecSupported(codec)) {
+    throw Exception("Pack codec is not supported by this build.");
+  }
+  context_->codec = codec;
+  context_->dictionary = std::move(dictionary);
+  if (codec == PackCodec::kDeflate) {
+    if (deflateInit(&context_->zs, level == 0 ? Z_DEFAULT_COMPRESSION
+                                              : level) != Z_OK) {
+      throw Exception("Unable to initialize deflate.");
+    }
+    return;
+  }
+#ifdef USE_ZSTD
+  context_->level = level;
+  context_->cctx = ZSTD_createCCtx();
+  if (!context_->dictionary.empty()) {
+    context_->cdict =
+        ZSTD_createCDict(context_->dictionary.data(),
+                         context_->dictionary.size(), level);
+  }
+#endif
+}
+
+PackCompressor::~PackCompressor() {
+  if (context_->codec == PackCodec::kDeflate) {
+    deflateEnd(&context_->zs);
+    return;
+  }
+#ifdef USE_ZSTD
+  ZSTD_freeCDict(context_->cdict);
+  ZSTD_freeCCtx(context_->cctx);
+#endif
+}
+
+std::string PackCompressor::Compress(std::span<const uint8_t> data) {
+  std::string result;
+  if (context_->codec == PackCodec::kDeflate) {
+    z_stream& zs = context_->zs;
+    deflateReset(&zs);
+    if (!context_->dictionary.empty()) {
+      deflateSetDictionary(
+          &zs, reinterpret_cast<const Bytef*>(context_->dictionary.data()),
+          context_->dictionary.size());
+    }
+    result.resize(deflateBound(&zs, data.size()));
+    zs.next_in = const_cast<Bytef*>(data.data());
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(result.data());
+    zs.avail_out = result.size();
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+      throw Exception("Unable to compress a pack frame.");
+    }
+    result.resize(zs.total_out);
+    return result;
+  }
+#ifdef USE_ZSTD
+  result.resize(ZSTD_compressBound(data.size()));
+  const size_t size =
+      context_->cdict
+          ? ZSTD_compress_usingCDict(context_->cctx, result.data(),
+                                     result.size(), data.data(), data.size(),
+                                     context_->cdict)
+          : ZSTD_compressCCtx(context_->cctx, result.data(), result.size(),
+                              data.data(), data.size(), context_->level);
+  if (ZSTD_isError(size)) {
+    throw Exception(std::string("Unable to compress a pack frame: ") +
+                    ZSTD_getErrorName(size));
+  }
+  result.resize(size);
+#endif
+  return result;
+}
+
+struct PackDecompressor::Context {
+  PackCodec codec;
+  std::string dictionary;
+  z_stream zs{};
+#ifdef USE_ZSTD
+  ZSTD_DCtx* dctx = nullptr;
+  ZSTD_DDict* ddict = nullptr;
+#endif
+};
+
+PackDecompressor::PackDecompressor(PackCodec codec, std::string dictionary)
+    : context_(std::make_unique<Context>()) {
+  if (!IsPackCodecSupported(codec)) {
+    throw Exception("Pack codec is not supported by this build.");
+  }
+  context_->codec = codec;
+  context_->dictionary = std::move(dictionary);
+  if (codec == PackCodec::kDeflate) {
+    if (inflateInit(&context_->zs) != Z_OK) {
+      throw Exception("Unable to initialize inflate.");
+    }
+    return;
+  }
+#ifdef USE_ZSTD
+  context_->dctx = ZSTD_createDCtx();
+  if (!context_->dictionary.empty()) {
+    context_->ddict = ZSTD_createDDict(context_->dictionary.data(),
+                                       context_->dictionary.size());
+  }
+#endif
+}
+
+PackDecompressor::~PackDecompressor() {
+  if (context_->codec == PackCodec::kDeflate) {
+    inflateEnd(&context_->zs);
+    return;
+  }
+#ifdef USE_ZSTD
+  ZSTD_freeDDict(context_->ddict);
+  ZSTD_freeDCtx(context_->dctx);
+#endif
+}
+
+void PackDecompressor::Decompress(std::span<const uint8_t> frame,
+                                  std::span<uint8_t> out) {
+  if (context_->codec == PackCodec::kDeflate) {
+    z_stream& zs = context_->zs;
+    inflateReset(&zs);
+    zs.next_in = const_cast<Bytef*>(frame.data());
+    zs.avail_in = frame.size();
+    zs.next_out = out.data();
+    zs.avail_out = out.size();
+    int ret = inflate(&zs, Z_FINISH);
+    if (ret == Z_NEED_DICT) {
+      inflateSetDictionary(
+          &zs, reinterpret_cast<const Bytef*>(context_->dictionary.data()),
+          context_->dictionary.size());
+      ret = inflate(&zs, Z_FINISH);
+    }
+    if (ret != Z_STREAM_END || zs.total_out != out.size()) {
+      throw Exception("Corrupt pack frame.");
+    }
+    return;
+  }
+#ifdef USE_ZSTD
+  const size_t size =
+      context_->ddict
+          ? ZSTD_decompress_usingDDict(context_->dctx, out.data(), out.size(),
+                                       frame.data(), frame.size(),
+                                       context_->ddict)
+          : ZSTD_decompressDCtx(context_->dctx, out.data(), out.size(),
+                                frame.data(), frame.size());
+  if (ZSTD_isError(size) || size != out.size()) {
+    throw Exception("Corrupt pack frame.");
+  }
+#endif
+}
+
+}  // namespace lczero
@@ -0,0 +1,120 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace lczero {
+
+// Training data pack is a container of many games in one file. Every game is
+// compressed separately, and the index of the games at the end of the file
+// allows reading them in any order.
+//
+// Layout (integers are in the native byte order, little endian in practice,
+// same as the chunks themselves):
+//   PackHeader
+//   Dictionary, PackHeader::dictionary_size bytes.
+//   Compressed games, the V6TrainingData chunks of one game per frame. With
+//     kPackFlagSparsePolicy, the chunks are in the sparse form, see
+//     AppendSparseTrainingData().
+//   PackIndexEntry for every game.
+//   PackFooter
+// The dictionary (e.g. trained with `zstd --train` on uncompressed games) is
+// used for every frame, it helps a lot as a single game is small.
+
+enum class PackCodec : uint32_t {
+  kDeflate = 0,
+  kZstd = 1,
+};
+
+struct PackHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t codec;
+  uint32_t dictionary_size;
+  uint32_t flags;
+};
+
+struct PackIndexEntry {
+  uint64_t offset;
+  uint32_t compressed_size;
+  uint32_t uncompressed_size;
+  uint32_t num_chunks;
+  uint32_t reserved;
+};
+
+struct PackFooter {
+  uint64_t index_offset;
+  uint64_t num_games;
+  char magic[8];
+};
+
+constexpr char kPackHeaderMagic[8] = {'L', 'C', '0', 'P', 'A', 'C', 'K', '1'};
+constexpr char kPackFooterMagic[8] = {'L', 'C', '0', 'I', 'N', 'D', 'E', 'X'};
+constexpr uint32_t kPackVersion = 2;
+constexpr uint32_t kPackFlagSparsePolicy = 1;
+
+// Whether the codec is compiled in. Deflate always is.
+bool IsPackCodecSupported(PackCodec codec);
+// Zstd when it's compiled in, deflate otherwise.
+PackCodec DefaultPackCodec();
+
+// Compresses frames of a pack. Not thread safe, reuses the codec context.
+class PackCompressor {
+ public:
+  // Level 0 is the default level of the codec.
+  PackCompressor(PackCodec codec, int level, std::string dictionary);
+  ~PackCompressor();
+
+  std::string Compress(std::span<const uint8_t> data);
+
+ private:
+  struct Context;
+  std::unique_ptr<Context> context_;
+};
+
+// Decompresses frames of a pack. Not thread safe, reuses the codec context.
+class PackDecompressor {
+ public:
+  PackDecompressor(PackCodec codec, std::string dictionary);
+  ~PackDecompressor();
+
+  // Decompresses @frame into @out, which must have exactly the uncompressed
+  // size. Throws on corrupt data.
+  void Decompress(std::span<const uint8_t> frame, std::span<uint8_t> out);
+
+ private:
+  struct Context;
+  std::unique_ptr<Context> context_;
+};
+
+}  // namespace lczero
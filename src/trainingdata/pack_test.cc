@@ -0,0 +1,159 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "trainingdata/reader.h"
+#include "trainingdata/writer.h"
+#include "utils/exception.h"
+#include "utils/files.h"
+
+namespace lczero {
+namespace {
+
+std::vector<V6TrainingData> MakeGame(int game, int num_chunks) {
+  std::vector<V6TrainingData> chunks(num_chunks);
+  for (int i = 0; i < num_chunks; ++i) {
+    std::memset(&chunks[i], 0, sizeof(V6TrainingData));
+    chunks[i].version = 6;
+    chunks[i].input_format = 1;
+    chunks[i].rule50_count = i;
+    chunks[i].visits = game * 1000 + i;
+    // Illegal moves are -1, a few legal ones get the probability mass.
+    float policy[1858];
+    std::fill(std::begin(policy), std::end(policy), -1.0f);
+    for (int j = 0; j < 20; ++j) policy[(i * 37 + j * 91) % 1858] = j / 190.0f;
+    std::memcpy(chunks[i].probabilities, policy, sizeof(policy));
+  }
+  return chunks;
+}
+
+bool SameChunks(const std::vector<V6TrainingData>& a,
+                const std::vector<V6TrainingData>& b) {
+  return a.size() == b.size() &&
+         std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0;
+}
+
+void RoundTrip(const TrainingDataPackWriter::Options& options) {
+  const std::string filename = testing::TempDir() + "pack_test.lc0pack";
+  std::vector<std::vector<V6TrainingData>> games;
+  {
+    TrainingDataPackWriter writer(filename, options);
+    for (int i = 0; i < 5; ++i) {
+      games.push_back(MakeGame(i, 10 + i * 7));
+      writer.WriteGame(games.back());
+    }
+    writer.Finalize();
+  }
+  ASSERT_TRUE(TrainingDataPackReader::IsPackFile(filename));
+  TrainingDataPackReader pack(filename);
+  ASSERT_EQ(pack.GetNumGames(), games.size());
+  // Random access.
+  EXPECT_TRUE(SameChunks(pack.ReadGame(3), games[3]));
+  EXPECT_TRUE(SameChunks(pack.ReadGame(0), games[0]));
+  // Sequential reading through the generic reader.
+  TrainingDataReader reader(filename);
+  std::vector<V6TrainingData> all;
+  V6TrainingData chunk;
+  while (reader.ReadChunk(&chunk)) all.push_back(chunk);
+  std::vector<V6TrainingData> expected;
+  for (const auto& game : games) {
+    expected.insert(expected.end(), game.begin(), game.end());
+  }
+  EXPECT_TRUE(SameChunks(all, expected));
+  std::remove(filename.c_str());
+}
+
+}  // namespace
+
+TEST(TrainingDataPack, RoundTripDefault) { RoundTrip({}); }
+
+TEST(TrainingDataPack, RoundTripDense) {
+  TrainingDataPackWriter::Options options;
+  options.sparse_policy = false;
+  RoundTrip(options);
+}
+
+TEST(TrainingDataPack, SparseChunkIsExact) {
+  std::vector<V6TrainingData> chunks = MakeGame(1, 3);
+  // Mostly zeros, with unusual values that only survive bit exact copies.
+  float policy[1858] = {};
+  policy[5] = -0.0f;
+  policy[6] = std::numeric_limits<float>::quiet_NaN();
+  policy[1857] = -1.0f;
+  std::memcpy(chunks[1].probabilities, policy, sizeof(policy));
+  std::string sparse;
+  for (const auto& chunk : chunks) AppendSparseTrainingData(chunk, &sparse);
+  EXPECT_LT(sparse.size(), chunks.size() * sizeof(V6TrainingData) / 5);
+  std::span<const uint8_t> in{reinterpret_cast<const uint8_t*>(sparse.data()),
+                              sparse.size()};
+  std::vector<V6TrainingData> expanded;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    expanded.push_back(ExpandSparseTrainingData(&in));
+  }
+  EXPECT_TRUE(in.empty());
+  EXPECT_TRUE(SameChunks(expanded, chunks));
+  in = {reinterpret_cast<const uint8_t*>(sparse.data()), sparse.size() - 1};
+  for (size_t i = 0; i + 1 < chunks.size(); ++i) ExpandSparseTrainingData(&in);
+  EXPECT_THROW(ExpandSparseTrainingData(&in), Exception);
+}
+
+TEST(TrainingDataPack, RoundTripDeflateWithDictionary) {
+  TrainingDataPackWriter::Options options;
+  options.codec = PackCodec::kDeflate;
+  // Any bytes which occur in the data work as a dictionary.
+  const auto game = MakeGame(0, 2);
+  options.dictionary.assign(reinterpret_cast<const char*>(game.data()),
+                            sizeof(V6TrainingData));
+  RoundTrip(options);
+}
+
+TEST(TrainingDataPack, DetectsTruncatedFile) {
+  const std::string filename = testing::TempDir() + "pack_test_bad.lc0pack";
+  {
+    TrainingDataPackWriter writer(filename, {});
+    writer.WriteGame(MakeGame(0, 4));
+  }
+  std::string content = ReadFileToString(filename);
+  content.resize(content.size() - 1);
+  WriteStringToFile(filename, content);
+  EXPECT_THROW(TrainingDataPackReader{filename}, Exception);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
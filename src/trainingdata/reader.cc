@@ -27,24 +27,29 @@
 
 #include "trainingdata/reader.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "utils/files.h"
+
 namespace lczero {
 
-InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
-  InputPlanes result;
+namespace {
+// Writes the kInputPlanes planes of @data to @result.
+void FillPlanes(const V6TrainingData& data, InputPlane* result) {
+  std::fill(result, result + kInputPlanes, InputPlane());
   for (int i = 0; i < 104; i++) {
-    result.emplace_back();
-    result.back().mask = ReverseBitsInBytes(data.planes[i]);
+    result[i].mask = ReverseBitsInBytes(data.planes[i]);
   }
+  InputPlane* aux = result + 104;
   switch (data.input_format) {
     case pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE: {
-      result.emplace_back();
-      result.back().mask = data.castling_us_ooo != 0 ? ~0LL : 0LL;
-      result.emplace_back();
-      result.back().mask = data.castling_us_oo != 0 ? ~0LL : 0LL;
-      result.emplace_back();
-      result.back().mask = data.castling_them_ooo != 0 ? ~0LL : 0LL;
-      result.emplace_back();
-      result.back().mask = data.castling_them_oo != 0 ? ~0LL : 0LL;
+      aux[0].mask = data.castling_us_ooo != 0 ? ~0LL : 0LL;
+      aux[1].mask = data.castling_us_oo != 0 ? ~0LL : 0LL;
+      aux[2].mask = data.castling_them_ooo != 0 ? ~0LL : 0LL;
+      aux[3].mask = data.castling_them_oo != 0 ? ~0LL : 0LL;
       break;
     }
     case pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE:
@@ -55,16 +60,11 @@ InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
     case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2:
     case pblczero::NetworkFormat::
         INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON: {
-      result.emplace_back();
-      result.back().mask =
-          data.castling_us_ooo |
-          (static_cast<uint64_t>(data.castling_them_ooo) << 56);
-      result.emplace_back();
-      result.back().mask = data.castling_us_oo |
-                           (static_cast<uint64_t>(data.castling_them_oo) << 56);
+      aux[0].mask = data.castling_us_ooo |
+                    (static_cast<uint64_t>(data.castling_them_ooo) << 56);
+      aux[1].mask = data.castling_us_oo |
+                    (static_cast<uint64_t>(data.castling_them_oo) << 56);
       // 2 empty planes in this format.
-      result.emplace_back();
-      result.emplace_back();
       break;
     }
 
@@ -72,154 +72,370 @@ InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
       throw Exception("Unsupported input plane encoding " +
                       std::to_string(data.input_format));
   }
-  result.emplace_back();
   auto typed_format =
       static_cast<pblczero::NetworkFormat::InputFormat>(data.input_format);
   if (IsCanonicalFormat(typed_format)) {
-    result.back().mask = static_cast<uint64_t>(data.side_to_move_or_enpassant)
-                         << 56;
+    aux[4].mask = static_cast<uint64_t>(data.side_to_move_or_enpassant) << 56;
   } else {
-    result.back().mask = data.side_to_move_or_enpassant != 0 ? ~0LL : 0LL;
+    aux[4].mask = data.side_to_move_or_enpassant != 0 ? ~0LL : 0LL;
   }
-  result.emplace_back();
   if (IsHectopliesFormat(typed_format)) {
-    result.back().Fill(data.rule50_count / 100.0f);
+    aux[5].Fill(data.rule50_count / 100.0f);
   } else {
-    result.back().Fill(data.rule50_count);
+    aux[5].Fill(data.rule50_count);
   }
-  result.emplace_back();
   // Empty plane, except for canonical armageddon.
   if (IsCanonicalArmageddonFormat(typed_format) &&
       data.invariance_info >= 128) {
-    result.back().SetAll();
+    aux[6].SetAll();
   }
-  result.emplace_back();
   // All ones plane.
-  result.back().SetAll();
+  aux[7].SetAll();
   if (IsCanonicalFormat(typed_format) && data.invariance_info != 0) {
-    // Undo transformation here as it makes the calling code simpler.
-    int transform = data.invariance_info;
-    for (size_t i = 0; i <= result.size(); i++) {
+    // Undo transformation here as it makes the calling code simpler. The
+    // transform is the same for all the planes, so each step goes over all of
+    // them in turn.
+    const int transform = data.invariance_info;
+    const bool transpose = (transform & TransposeTransform) != 0;
+    const bool mirror = (transform & MirrorTransform) != 0;
+    const bool flip = (transform & FlipTransform) != 0;
+    for (int i = 0; i < kInputPlanes; i++) {
       auto v = result[i].mask;
       if (v == 0 || v == ~0ULL) continue;
-      if ((transform & TransposeTransform) != 0) {
-        v = TransposeBitsInBytes(v);
-      }
-      if ((transform & MirrorTransform) != 0) {
-        v = ReverseBytesInBytes(v);
-      }
-      if ((transform & FlipTransform) != 0) {
-        v = ReverseBitsInBytes(v);
-      }
+      if (transpose) v = TransposeBitsInBytes(v);
+      if (mirror) v = ReverseBytesInBytes(v);
+      if (flip) v = ReverseBitsInBytes(v);
       result[i].mask = v;
     }
   }
+}
+}  // namespace
+
+InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
+  InputPlanes result(kInputPlanes);
+  FillPlanes(data, result.data());
   return result;
 }
 
+void PlanesFromTrainingData(std::span<const V6TrainingData> data,
+                            InputPlane* planes) {
+  for (const V6TrainingData& record : data) {
+    FillPlanes(record, planes);
+    planes += kInputPlanes;
+  }
+}
+
+namespace {
+// Sizes of the older records, they differ from V6 in the tail.
+constexpr size_t kV6Extra = 48;
+constexpr size_t kV5Extra = 16;
+constexpr size_t kV4Extra = 16;
+constexpr size_t kV3Size =
+    sizeof(V6TrainingData) - kV4Extra - kV5Extra - kV6Extra;
+
+size_t RecordSize(uint32_t version) {
+  switch (version) {
+    case 3:
+      return kV3Size;
+    case 4:
+      return kV3Size + kV4Extra;
+    case 5:
+      return kV3Size + kV4Extra + kV5Extra;
+    case 6:
+      return sizeof(V6TrainingData);
+    default:
+      throw Exception("Unknown format.");
+  }
+}
+
+// Upgrades the record of an older version, read to the start of @data, in
+// place.
+void UpgradeToV6(V6TrainingData* data) {
+  switch (data->version) {
+    case 3: {
+      data->version = 4;
+      // First convert 3 to 4 to reduce code duplication.
+      char* v4_extra_start = reinterpret_cast<char*>(data) + kV3Size;
+      // Write 0 bytes for 16 extra bytes - corresponding to 4 floats of 0.0f.
+      for (size_t i = 0; i < kV4Extra; i++) {
+        v4_extra_start[i] = 0;
+      }
+      [[fallthrough]];
+    }
+    case 4: {
+      data->version = 5;
+      char* data_ptr = reinterpret_cast<char*>(data);
+      // Shift data after version back 4 bytes.
+      memmove(data_ptr + 2 * sizeof(uint32_t), data_ptr + sizeof(uint32_t),
+              kV3Size + kV4Extra - sizeof(uint32_t));
+      data->input_format = pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE;
+      data->root_m = 0.0f;
+      data->best_m = 0.0f;
+      data->plies_left = 0.0f;
+      [[fallthrough]];
+    }
+    case 5: {
+      data->version = 6;
+      // Type of dummy was changed from signed to unsigned - which means -1 on
+      // disk is read in as 255.
+      if (data->dummy > 1 && data->dummy < 255) {
+        throw Exception("Invalid result read in v5 data before upgrade.");
+      }
+      data->result_q =
+          data->dummy == 255 ? -1.0f : (data->dummy == 0 ? 0.0f : 1.0f);
+      data->result_d = data->dummy == 0 ? 1.0f : 0.0f;
+      data->dummy = 0;
+      data->played_q = 0.0f;
+      data->played_d = 0.0f;
+      data->played_m = 0.0f;
+      // Mark orig as NaN since scripts further downstream already have to
+      // handle that case.
+      data->orig_q = std::numeric_limits<float>::quiet_NaN();
+      data->orig_d = std::numeric_limits<float>::quiet_NaN();
+      data->orig_m = std::numeric_limits<float>::quiet_NaN();
+      data->visits = 0;
+      data->played_idx = 0;
+      data->best_idx = 0;
+      data->policy_kld = 0.0f;
+      data->reserved = 0;
+      return;
+    }
+    default:
+      throw Exception("Unknown format.");
+  }
+}
+
+}  // namespace
+
+TrainingDataPackReader::TrainingDataPackReader(const std::string& filename)
+    : filename_(filename), file_(filename) {
+  const auto data = file_.data();
+  PackHeader header;
+  PackFooter footer;
+  if (data.size() < sizeof(header) + sizeof(footer)) {
+    throw Exception("Truncated pack file " + filename_);
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  std::memcpy(&footer, data.data() + data.size() - sizeof(footer),
+              sizeof(footer));
+  if (std::memcmp(header.magic, kPackHeaderMagic, sizeof(header.magic)) ||
+      std::memcmp(footer.magic, kPackFooterMagic, sizeof(footer.magic))) {
+    throw Exception("Not a complete pack file " + filename_);
+  }
+  if (header.version != kPackVersion) {
+    throw Exception("Unsupported pack version in " + filename_);
+  }
+  const size_t index_size = footer.num_games * sizeof(PackIndexEntry);
+  if (sizeof(header) + header.dictionary_size > footer.index_offset ||
+      footer.index_offset + index_size + sizeof(footer) != data.size()) {
+    throw Exception("Corrupt pack index in " + filename_);
+  }
+  sparse_policy_ = header.flags & kPackFlagSparsePolicy;
+  index_.resize(footer.num_games);
+  std::memcpy(index_.data(), data.data() + footer.index_offset, index_size);
+  for (const auto& entry : index_) {
+    if (entry.offset + entry.compressed_size > footer.index_offset) {
+      throw Exception("Corrupt pack index in " + filename_);
+    }
+  }
+  decompressor_ = std::make_unique<PackDecompressor>(
+      static_cast<PackCodec>(header.codec),
+      std::string(reinterpret_cast<const char*>(data.data()) + sizeof(header),
+                  header.dictionary_size));
+}
+
+bool TrainingDataPackReader::IsPackFile(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  char magic[sizeof(kPackHeaderMagic)];
+  if (!file.read(magic, sizeof(magic))) return false;
+  return std::memcmp(magic, kPackHeaderMagic, sizeof(magic)) == 0;
+}
+
+std::vector<V6TrainingData> TrainingDataPackReader::ReadGame(size_t idx) {
+  const PackIndexEntry& entry = index_.at(idx);
+  const auto frame = file_.data().subspan(entry.offset, entry.compressed_size);
+  std::vector<V6TrainingData> chunks;
+  if (!sparse_policy_) {
+    if (entry.uncompressed_size != entry.num_chunks * sizeof(V6TrainingData)) {
+      throw Exception("Corrupt pack index in " + filename_);
+    }
+    chunks.resize(entry.num_chunks);
+    decompressor_->Decompress(frame,
+                              {reinterpret_cast<uint8_t*>(chunks.data()),
+                               chunks.size() * sizeof(V6TrainingData)});
+    return chunks;
+  }
+  std::vector<uint8_t> sparse(entry.uncompressed_size);
+  decompressor_->Decompress(frame, sparse);
+  std::span<const uint8_t> in = sparse;
+  chunks.reserve(entry.num_chunks);
+  for (uint32_t i = 0; i < entry.num_chunks; ++i) {
+    chunks.push_back(ExpandSparseTrainingData(&in));
+  }
+  if (!in.empty()) throw Exception("Corrupt pack frame in " + filename_);
+  return chunks;
+}
+
 TrainingDataReader::TrainingDataReader(std::string filename)
     : filename_(filename) {
+  if (TrainingDataPackReader::IsPackFile(filename_)) {
+    pack_ = std::make_unique<TrainingDataPackReader>(filename_);
+    return;
+  }
   fin_ = gzopen(filename_.c_str(), "rb");
   if (!fin_) {
     throw Exception("Cannot open gzip file " + filename_);
   }
 }
 
-TrainingDataReader::~TrainingDataReader() { gzclose(fin_); }
+TrainingDataReader::~TrainingDataReader() {
+  if (fin_) gzclose(fin_);
+}
 
 bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
+  if (pack_) {
+    while (next_chunk_ >= game_.size()) {
+      if (next_game_ >= pack_->GetNumGames()) return false;
+      game_ = pack_->ReadGame(next_game_++);
+      next_chunk_ = 0;
+    }
+    *data = game_[next_chunk_++];
+    return true;
+  }
   if (format_v6) {
     int read_size = gzread(fin_, reinterpret_cast<void*>(data), sizeof(*data));
     if (read_size < 0) throw Exception("Corrupt read.");
     return read_size == sizeof(*data);
-  } else {
-    int v6_extra = 48;
-    int v5_extra = 16;
-    int v4_extra = 16;
-    int v3_size = sizeof(*data) - v4_extra - v5_extra - v6_extra;
-    int read_size = gzread(fin_, reinterpret_cast<void*>(data), v3_size);
+  }
+  int read_size = gzread(fin_, reinterpret_cast<void*>(data), kV3Size);
+  if (read_size < 0) throw Exception("Corrupt read.");
+  if (read_size != static_cast<int>(kV3Size)) return false;
+  const int version = data->version;
+  const size_t extra = RecordSize(version) - kV3Size;
+  if (extra > 0) {
+    read_size = gzread(
+        fin_, reinterpret_cast<void*>(reinterpret_cast<char*>(data) + kV3Size),
+        extra);
     if (read_size < 0) throw Exception("Corrupt read.");
-    if (read_size != v3_size) return false;
-    auto orig_version = data->version;
-    switch (data->version) {
-      case 3: {
-        data->version = 4;
-        // First convert 3 to 4 to reduce code duplication.
-        char* v4_extra_start = reinterpret_cast<char*>(data) + v3_size;
-        // Write 0 bytes for 16 extra bytes - corresponding to 4 floats of 0.0f.
-        for (int i = 0; i < v4_extra; i++) {
-          v4_extra_start[i] = 0;
-        }
-        [[fallthrough]];
-      }
-      case 4: {
-        // If actually 4, we need to read the additional data first.
-        if (orig_version == 4) {
-          read_size = gzread(
-              fin_,
-              reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-              v4_extra);
-          if (read_size < 0) throw Exception("Corrupt read.");
-          if (read_size != v4_extra) return false;
-        }
-        data->version = 5;
-        char* data_ptr = reinterpret_cast<char*>(data);
-        // Shift data after version back 4 bytes.
-        memmove(data_ptr + 2 * sizeof(uint32_t), data_ptr + sizeof(uint32_t),
-                v3_size + v4_extra - sizeof(uint32_t));
-        data->input_format = pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE;
-        data->root_m = 0.0f;
-        data->best_m = 0.0f;
-        data->plies_left = 0.0f;
-        [[fallthrough]];
-      }
-      case 5: {
-        // If actually 5, we need to read the additional data first.
-        if (orig_version == 5) {
-          read_size = gzread(
-              fin_,
-              reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-              v4_extra + v5_extra);
-          if (read_size < 0) throw Exception("Corrupt read.");
-          if (read_size != v4_extra + v5_extra) return false;
-        }
-        data->version = 6;
-        // Type of dummy was changed from signed to unsigned - which means -1 on
-        // disk is read in as 255.
-        if (data->dummy > 1 && data->dummy < 255) {
-          throw Exception("Invalid result read in v5 data before upgrade.");
-        }
-        data->result_q =
-            data->dummy == 255 ? -1.0f : (data->dummy == 0 ? 0.0f : 1.0f);
-        data->result_d = data->dummy == 0 ? 1.0f : 0.0f;
-        data->dummy = 0;
-        data->played_q = 0.0f;
-        data->played_d = 0.0f;
-        data->played_m = 0.0f;
-        // Mark orig as NaN since scripts further downstream already have to
-        // handle that case.
-        data->orig_q = std::numeric_limits<float>::quiet_NaN();
-        data->orig_d = std::numeric_limits<float>::quiet_NaN();
-        data->orig_m = std::numeric_limits<float>::quiet_NaN();
-        data->visits = 0;
-        data->played_idx = 0;
-        data->best_idx = 0;
-        data->policy_kld = 0.0f;
-        data->reserved = 0;
-        return true;
-      }
-      case 6: {
-        format_v6 = true;
-        read_size = gzread(
-            fin_,
-            reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-            v4_extra + v5_extra + v6_extra);
-        if (read_size < 0) throw Exception("Corrupt read.");
-        return read_size == v4_extra + v5_extra + v6_extra;
-      }
-      default:
-        throw Exception("Unknown format.");
+    if (read_size != static_cast<int>(extra)) return false;
+  }
+  if (version == 6) {
+    format_v6 = true;
+    return true;
+  }
+  UpgradeToV6(data);
+  return true;
+}
+
+std::vector<V6TrainingData> ReadTrainingDataFile(const std::string& filename) {
+  std::vector<V6TrainingData> chunks;
+  if (TrainingDataPackReader::IsPackFile(filename)) {
+    TrainingDataPackReader pack(filename);
+    for (size_t i = 0; i < pack.GetNumGames(); ++i) {
+      const auto game = pack.ReadGame(i);
+      chunks.insert(chunks.end(), game.begin(), game.end());
+    }
+    return chunks;
+  }
+  std::string raw;
+  {
+    MappedFile file(filename);
+    const auto data = file.data();
+    if (data.size() >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+      raw = GunzipBuffer(data);
+    } else {
+      // Like gzread(), accept uncompressed files.
+      raw.assign(data.begin(), data.end());
+    }
+  }
+  size_t pos = 0;
+  while (raw.size() - pos >= kV3Size) {
+    uint32_t version;
+    std::memcpy(&version, raw.data() + pos, sizeof(version));
+    if (version == 6) {
+      // Everything from the first V6 record on is V6, as in ReadChunk().
+      const size_t count = (raw.size() - pos) / sizeof(V6TrainingData);
+      const size_t old_size = chunks.size();
+      chunks.resize(old_size + count);
+      std::memcpy(chunks.data() + old_size, raw.data() + pos,
+                  count * sizeof(V6TrainingData));
+      break;
+    }
+    const size_t size = RecordSize(version);
+    if (raw.size() - pos < size) break;
+    V6TrainingData& chunk = chunks.emplace_back();
+    std::memcpy(&chunk, raw.data() + pos, size);
+    UpgradeToV6(&chunk);
+    pos += size;
+  }
+  return chunks;
+}
+
+TrainingDataPrefetcher::TrainingDataPrefetcher(
+    std::vector<std::string> filenames, int num_threads, int max_prefetch)
+    : filenames_(std::move(filenames)),
+      max_prefetch_(std::max(max_prefetch, 1)) {
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this]() { Worker(); });
+  }
+}
+
+TrainingDataPrefetcher::~TrainingDataPrefetcher() {
+  {
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+bool TrainingDataPrefetcher::Next(File* file) {
+  Mutex::Lock lock(mutex_);
+  if (next_to_return_ >= filenames_.size()) return false;
+  if (threads_.empty()) {
+    // Nothing to prefetch with, load here.
+    *file = Load(next_to_return_++);
+    return true;
+  }
+  cv_.wait(lock.get_raw(), [&]() REQUIRES(mutex_) {
+    return loaded_.count(next_to_return_) > 0;
+  });
+  *file = std::move(loaded_[next_to_return_]);
+  loaded_.erase(next_to_return_);
+  ++next_to_return_;
+  cv_.notify_all();
+  return true;
+}
+
+TrainingDataPrefetcher::File TrainingDataPrefetcher::Load(size_t idx) const {
+  File file;
+  file.filename = filenames_[idx];
+  try {
+    file.chunks = ReadTrainingDataFile(file.filename);
+  } catch (const Exception& e) {
+    file.error = e.what();
+  }
+  return file;
+}
+
+void TrainingDataPrefetcher::Worker() {
+  while (true) {
+    size_t idx;
+    {
+      Mutex::Lock lock(mutex_);
+      cv_.wait(lock.get_raw(), [&]() REQUIRES(mutex_) {
+        return stop_ || next_to_load_ >= filenames_.size() ||
+               next_to_load_ < next_to_return_ + max_prefetch_;
+      });
+      if (stop_ || next_to_load_ >= filenames_.size()) return;
+      idx = next_to_load_++;
+    }
+    File file = Load(idx);
+    {
+      Mutex::Lock lock(mutex_);
+      loaded_[idx] = std::move(file);
     }
+    cv_.notify_all();
   }
 }
 
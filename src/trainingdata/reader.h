@@ -27,7 +27,17 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "trainingdata/pack.h"
 #include "trainingdata/trainingdata.h"
+#include "utils/filesystem.h"
+#include "utils/mutex.h"
 
 namespace lczero {
 
@@ -38,10 +48,37 @@ namespace lczero {
 // will be used with DecodeMoveFromInput or PopulateBoard which assume the
 // InputPlanes are not transformed.
 InputPlanes PlanesFromTrainingData(const V6TrainingData& data);
+// Same for a batch of records, without allocating: the kInputPlanes planes of
+// every record are written one after another to @planes, which must have room
+// for data.size() * kInputPlanes planes. For feeding a network with whole
+// batches of the stored positions.
+void PlanesFromTrainingData(std::span<const V6TrainingData> data,
+                            InputPlane* planes);
+
+// Reads games of a training data pack (see trainingdata/pack.h) in any order.
+class TrainingDataPackReader {
+ public:
+  explicit TrainingDataPackReader(const std::string& filename);
+
+  // Checks the magic at the start of the file.
+  static bool IsPackFile(const std::string& filename);
+
+  size_t GetNumGames() const { return index_.size(); }
+  // Reads all chunks of the game @idx. Throws if the data is corrupt.
+  std::vector<V6TrainingData> ReadGame(size_t idx);
+
+ private:
+  std::string filename_;
+  MappedFile file_;
+  std::vector<PackIndexEntry> index_;
+  bool sparse_policy_;
+  std::unique_ptr<PackDecompressor> decompressor_;
+};
 
 class TrainingDataReader {
  public:
-  // Opens the given file to read chunk data from.
+  // Opens the given file to read chunk data from. Both gzip files and training
+  // data packs are supported, the games of a pack are read one after another.
   TrainingDataReader(std::string filename);
 
   ~TrainingDataReader();
@@ -54,8 +91,54 @@ class TrainingDataReader {
 
  private:
   std::string filename_;
-  gzFile fin_;
+  gzFile fin_ = nullptr;
   bool format_v6 = false;
+  // Only for packs.
+  std::unique_ptr<TrainingDataPackReader> pack_;
+  std::vector<V6TrainingData> game_;
+  size_t next_game_ = 0;
+  size_t next_chunk_ = 0;
+};
+
+// Reads all chunks of a gzip file or of a pack at once, and upgrades records
+// of older versions to V6. Much faster than TrainingDataReader: the file is
+// decompressed in one go (the gzip members written by WriteStringToGzFile() in
+// parallel), and V6 data is copied in bulk. Throws on error.
+std::vector<V6TrainingData> ReadTrainingDataFile(const std::string& filename);
+
+// Loads training data files with ReadTrainingDataFile() on background threads,
+// ahead of the consumer.
+class TrainingDataPrefetcher {
+ public:
+  // At most @max_prefetch files are loaded or being loaded ahead of the one
+  // returned last. With 0 threads, Next() loads the files itself.
+  TrainingDataPrefetcher(std::vector<std::string> filenames, int num_threads,
+                         int max_prefetch);
+  ~TrainingDataPrefetcher();
+
+  struct File {
+    std::string filename;
+    std::vector<V6TrainingData> chunks;
+    // Set if the file failed to load.
+    std::string error;
+  };
+  // Returns the files in the order of @filenames, blocking until the next one
+  // is loaded. Returns false after the last file.
+  bool Next(File* file);
+
+ private:
+  File Load(size_t idx) const;
+  void Worker();
+
+  const std::vector<std::string> filenames_;
+  const size_t max_prefetch_;
+  Mutex mutex_;
+  std::condition_variable cv_;
+  size_t next_to_load_ GUARDED_BY(mutex_) = 0;
+  size_t next_to_return_ GUARDED_BY(mutex_) = 0;
+  std::map<size_t, File> loaded_ GUARDED_BY(mutex_);
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
 };
 
 }  // namespace lczero
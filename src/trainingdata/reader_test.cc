@@ -0,0 +1,164 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "trainingdata/reader.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "trainingdata/writer.h"
+
+namespace lczero {
+namespace {
+
+V6TrainingData MakeChunk(int i) {
+  V6TrainingData chunk;
+  std::memset(&chunk, 0, sizeof(chunk));
+  chunk.version = 6;
+  chunk.input_format = 1;
+  chunk.rule50_count = i;
+  chunk.visits = 100 + i;
+  return chunk;
+}
+
+std::string WriteGzFile(const std::string& name, int num_chunks) {
+  const std::string filename = testing::TempDir() + name;
+  TrainingDataWriter writer(filename);
+  for (int i = 0; i < num_chunks; ++i) writer.WriteChunk(MakeChunk(i));
+  writer.Finalize();
+  return filename;
+}
+
+std::vector<V6TrainingData> ReadChunks(const std::string& filename) {
+  TrainingDataReader reader(filename);
+  std::vector<V6TrainingData> chunks;
+  V6TrainingData chunk;
+  while (reader.ReadChunk(&chunk)) chunks.push_back(chunk);
+  return chunks;
+}
+
+bool SameChunks(const std::vector<V6TrainingData>& a,
+                const std::vector<V6TrainingData>& b) {
+  return a.size() == b.size() &&
+         std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0;
+}
+
+}  // namespace
+
+TEST(TrainingDataReader, WholeFileMatchesChunkReader) {
+  const std::string filename = WriteGzFile("reader_test_v6.gz", 17);
+  const auto chunks = ReadTrainingDataFile(filename);
+  EXPECT_EQ(chunks.size(), 17u);
+  EXPECT_TRUE(SameChunks(chunks, ReadChunks(filename)));
+  std::remove(filename.c_str());
+}
+
+TEST(TrainingDataReader, UpgradesOldVersions) {
+  // A V5 record is V6 without the last 48 bytes.
+  const std::string filename = testing::TempDir() + "reader_test_v5.gz";
+  {
+    gzFile f = gzopen(filename.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    for (int i = 0; i < 3; ++i) {
+      V6TrainingData chunk = MakeChunk(i);
+      chunk.version = 5;
+      chunk.dummy = i == 1 ? 255 : 0;
+      gzwrite(f, &chunk, sizeof(chunk) - 48);
+    }
+    gzclose(f);
+  }
+  const auto chunks = ReadTrainingDataFile(filename);
+  ASSERT_EQ(chunks.size(), 3u);
+  EXPECT_EQ(chunks[0].version, 6u);
+  EXPECT_EQ(chunks[1].result_q, -1.0f);
+  EXPECT_EQ(chunks[2].result_d, 1.0f);
+  EXPECT_EQ(chunks[2].rule50_count, 2);
+  // NaNs don't compare equal, so compare the bytes.
+  EXPECT_TRUE(SameChunks(chunks, ReadChunks(filename)));
+  std::remove(filename.c_str());
+}
+
+TEST(PlanesFromTrainingData, BatchMatchesSingleRecords) {
+  std::vector<V6TrainingData> chunks;
+  for (int i = 0; i < 3; ++i) {
+    V6TrainingData chunk = MakeChunk(i);
+    chunk.input_format =
+        pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2;
+    for (int plane = 0; plane < 104; ++plane) {
+      chunk.planes[plane] = 0x0123456789abcdefULL * (plane + 1) + i;
+    }
+    chunk.castling_us_oo = 1 << i;
+    chunk.invariance_info = i;
+    chunks.push_back(chunk);
+  }
+  std::vector<InputPlane> planes(chunks.size() * kInputPlanes);
+  PlanesFromTrainingData(chunks, planes.data());
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const InputPlanes expected = PlanesFromTrainingData(chunks[i]);
+    ASSERT_EQ(expected.size(), static_cast<size_t>(kInputPlanes));
+    for (int plane = 0; plane < kInputPlanes; ++plane) {
+      EXPECT_EQ(planes[i * kInputPlanes + plane].mask, expected[plane].mask);
+      EXPECT_EQ(planes[i * kInputPlanes + plane].value, expected[plane].value);
+    }
+  }
+  // The transposed record goes back to the stored orientation.
+  EXPECT_NE(planes[kInputPlanes].mask, ReverseBitsInBytes(chunks[1].planes[0]));
+  EXPECT_EQ(planes[0].mask, ReverseBitsInBytes(chunks[0].planes[0]));
+}
+
+TEST(TrainingDataReader, PrefetcherKeepsOrder) {
+  std::vector<std::string> filenames;
+  for (int i = 0; i < 6; ++i) {
+    filenames.push_back(
+        WriteGzFile("reader_test_" + std::to_string(i) + ".gz", i + 1));
+  }
+  filenames.push_back(testing::TempDir() + "reader_test_missing.gz");
+  TrainingDataPrefetcher prefetcher(filenames, 3, 2);
+  TrainingDataPrefetcher::File file;
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    ASSERT_TRUE(prefetcher.Next(&file));
+    EXPECT_EQ(file.filename, filenames[i]);
+    if (i + 1 < filenames.size()) {
+      EXPECT_TRUE(file.error.empty());
+      EXPECT_EQ(file.chunks.size(), i + 1);
+    } else {
+      EXPECT_FALSE(file.error.empty());
+    }
+  }
+  EXPECT_FALSE(prefetcher.Next(&file));
+  for (const auto& filename : filenames) std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
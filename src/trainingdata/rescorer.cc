@@ -27,15 +27,23 @@
 
 #include "trainingdata/rescorer.h"
 
+#include <chrono>
+#include <fstream>
 #include <optional>
 #include <sstream>
+#include <unordered_set>
 
 #include "gtb-probe.h"
 #include "neural/decoder.h"
 #include "syzygy/syzygy.h"
+#include "trainingdata/nnue.h"
 #include "trainingdata/reader.h"
+#include "trainingdata/writer.h"
 #include "utils/filesystem.h"
+#include "utils/bloom_filter.h"
+#include "utils/hashcat.h"
 #include "utils/optionsparser.h"
+#include "utils/random.h"
 
 namespace lczero {
 
@@ -52,6 +60,32 @@ const OptionId kPolicySubsDirId{"policy-substitutions", "",
 const OptionId kOutputDirId{"output", "", "Directory to write rescored files."};
 const OptionId kThreadsId{"threads", "",
                           "Number of concurrent threads to rescore with.", 't'};
+const OptionId kPrefetchFilesId{
+    "prefetch-files", "",
+    "Number of files read ahead in the background per rescoring thread. 0 "
+    "reads them in the rescoring threads."};
+const OptionId kReaderThreadsId{
+    "reader-threads", "",
+    "Number of threads reading the files ahead of rescoring."};
+const OptionId kWriterThreadsId{
+    "writer-threads", "",
+    "Number of threads compressing and writing the rescored files. 0 writes "
+    "them in the rescoring threads."};
+const OptionId kManifestId{
+    "manifest", "",
+    "File to record the processed input files in. Files already listed there "
+    "are skipped, so an interrupted run can be resumed."};
+const OptionId kDedupFilterSizeId{
+    "dedup-filter-size", "",
+    "Size in MiB of the filter of the positions seen, to drop the duplicates "
+    "from the output. About 1 MiB per 800k positions. 0 disables dedup."};
+const OptionId kDedupFilterId{
+    "dedup-filter", "",
+    "File to keep the dedup filter in between runs, so that positions are "
+    "deduplicated across input sets."};
+const OptionId kDedupKeepRateId{
+    "dedup-keep-rate", "",
+    "Share of the duplicate positions to keep in the output anyway."};
 const OptionId kTempId{"temperature", "",
                        "Additional temperature to apply to policy target."};
 const OptionId kDistributionOffsetId{
@@ -76,8 +110,12 @@ const OptionId kDeblunderQBlunderWidth{
     "deblunder-q-blunder-width", "",
     "Width of the transition between accepted temp moves and blunders."};
 const OptionId kNnuePlainFileId{"nnue-plain-file", "",
-                                "Append SF plain format training data to this "
-                                "file. Will be generated if not there."};
+                                "Append SF training data to this file, in the "
+                                "nnue-format. Will be generated if not there."};
+const OptionId kNnueFormatId{
+    "nnue-format", "",
+    "Format of the SF training data: plain text or the binary \"bin\" "
+    "format."};
 const OptionId kNnueBestScoreId{"nnue-best-score", "",
                                 "For the SF training data use the score of the "
                                 "best move instead of the played one."};
@@ -112,12 +150,85 @@ std::atomic<int> policy_nobump_total_hist[11];
 std::atomic<int> policy_bump_total_hist[11];
 std::atomic<int> policy_dtm_bump(0);
 std::atomic<int> gaviota_dtm_rescores(0);
+// Time spent in the stages of the pipeline, summed over the threads.
+std::atomic<int64_t> read_wait_us(0);
+std::atomic<int64_t> rescore_us(0);
+std::atomic<int64_t> write_wait_us(0);
+std::atomic<int> files_written(0);
+std::atomic<int64_t> duplicates(0);
+// Rescored chunks buffered for writing, about 8KiB each.
+constexpr size_t kMaxQueuedChunks = 8192;
 std::map<uint64_t, PolicySubNode> policy_subs;
 bool gaviotaEnabled = false;
 bool deblunderEnabled = false;
 float deblunderQBlunderThreshold = 2.0f;
 float deblunderQBlunderWidth = 0.0f;
 
+int64_t MicrosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// List of the input files that are fully processed, one per line.
+class RescoreManifest {
+ public:
+  explicit RescoreManifest(const std::string& filename) {
+    std::ifstream in(filename);
+    std::string line;
+    while (std::getline(in, line)) {
+      if (!line.empty()) done_.insert(line);
+    }
+    out_.open(filename, std::ios_base::app);
+    if (!out_.is_open()) throw Exception("Unable to open " + filename);
+  }
+
+  // Not thread-safe with Add(), only to be used before processing starts.
+  bool Contains(const std::string& file) const {
+    return done_.count(file) > 0;
+  }
+
+  void Add(const std::string& file) {
+    Mutex::Lock lock(mutex_);
+    // Flushed right away, so that the entry survives the run being killed.
+    out_ << file << std::endl;
+  }
+
+ private:
+  std::unordered_set<std::string> done_;
+  Mutex mutex_;
+  std::ofstream out_ GUARDED_BY(mutex_);
+};
+
+// The stages around the rescoring, all optional.
+struct RescorePipeline {
+  // Writes the rescored files in the background.
+  TrainingDataWriterPool* writer = nullptr;
+  RescoreManifest* manifest = nullptr;
+  // Receives the NNUE training data.
+  NnueOutputFile* nnue = nullptr;
+  NnueFormat nnue_format = NnueFormat::kPlain;
+  // Positions already seen.
+  BloomFilter* dedup = nullptr;
+  float dedup_keep_rate = 0.0f;
+};
+
+// Key of the position of the chunk for the dedup, the history is ignored.
+uint64_t DedupKey(const V6TrainingData& chunk) {
+  uint64_t hash = HashCat(
+      {chunk.input_format, chunk.castling_us_ooo, chunk.castling_us_oo,
+       chunk.castling_them_ooo, chunk.castling_them_oo,
+       chunk.side_to_move_or_enpassant,
+       static_cast<uint64_t>(chunk.invariance_info & 128)});
+  // Pieces of the current position.
+  for (int i = 0; i < 12; ++i) hash = HashCat(hash, chunk.planes[i]);
+  return hash;
+}
+
+// NNUE data formatted by a thread is appended to the file in pieces of about
+// this size.
+constexpr size_t kNnueFlushBytes = 1 << 20;
+
 void DataAssert(bool check_result) {
   if (!check_result) throw Exception("Range Violation");
 }
@@ -433,45 +544,40 @@ int ResultForData(const V6TrainingData& data) {
   return static_cast<int>(data.result_q);
 }
 
-std::string AsNnueString(const Position& p, Move m, float q, int result) {
-  std::ostringstream out;
-  out << "fen " << PositionToFen(p) << std::endl;
-  if (p.IsBlackToMove()) m.Flip();
-  out << "move " << m.ToString(false) << std::endl;
-  // Formula from PR1477 adjusted for SF PawnValueEg.
-  out << "score " << round(660.6 * q / (1 - 0.9751875 * std::pow(q, 10)))
-      << std::endl;
-  out << "ply " << p.GetGamePly() << std::endl;
-  out << "result " << result << std::endl;
-  out << "e" << std::endl;
-  return out.str();
-}
-
 struct ProcessFileFlags {
   bool delete_files : 1;
   bool nnue_best_score : 1;
   bool nnue_best_move : 1;
 };
 
-void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
-                 std::string outputDir, float distTemp, float distOffset,
-                 float dtzBoost, int newInputFormat,
-                 std::string nnue_plain_file, ProcessFileFlags flags) {
-  // Scope to ensure reader and writer are closed before deleting source file.
+void ProcessFile(TrainingDataPrefetcher::File loaded,
+                 SyzygyTablebase* tablebase, std::string outputDir,
+                 float distTemp, float distOffset, float dtzBoost,
+                 int newInputFormat, std::string* nnue_buffer,
+                 ProcessFileFlags flags, const RescorePipeline& pipeline) {
+  const auto start = std::chrono::steady_clock::now();
+  int64_t write_us = 0;
+  const std::string file = loaded.filename;
+  // The source file is only deleted once its output is complete.
+  auto finish = [file, flags, manifest = pipeline.manifest]() {
+    if (flags.delete_files) remove(file.c_str());
+    if (manifest) manifest->Add(file);
+  };
+  bool queued = false;
+  // To drop the NNUE records of the file if it fails.
+  const size_t nnue_size = nnue_buffer ? nnue_buffer->size() : 0;
+  // Scope to ensure writer is closed before deleting source file.
   {
     try {
-      TrainingDataReader reader(file);
-      std::vector<V6TrainingData> fileContents;
-      V6TrainingData data;
-      while (reader.ReadChunk(&data)) {
-        fileContents.push_back(data);
-      }
+      if (!loaded.error.empty()) throw Exception(loaded.error);
+      std::vector<V6TrainingData> fileContents = std::move(loaded.chunks);
       Validate(fileContents);
       MoveList moves;
+      InputPlanes prev_planes = PlanesFromTrainingData(fileContents[0]);
       for (size_t i = 1; i < fileContents.size(); i++) {
-        moves.push_back(
-            DecodeMoveFromInput(PlanesFromTrainingData(fileContents[i]),
-                                PlanesFromTrainingData(fileContents[i - 1])));
+        InputPlanes planes = PlanesFromTrainingData(fileContents[i]);
+        moves.push_back(DecodeMoveFromInput(planes, prev_planes));
+        prev_planes = std::move(planes);
         // All moves decoded are from the point of view of the side after the
         // move so need to mirror them all to be applicable to apply to the
         // position before.
@@ -548,6 +654,36 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
         }
       }
 
+      // Probe the WDL of all the tablebase positions of the game in one batch,
+      // the passes below look the results up by the move index.
+      std::vector<WDLScore> tb_scores(moves.size());
+      std::vector<ProbeState> tb_states(moves.size(), FAIL);
+      {
+        PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                      &board, &rule50ply, &gameply);
+        history.Reset(board, rule50ply, gameply);
+        for (const Move move : moves) history.Append(move);
+        std::vector<const Position*> tb_positions;
+        std::vector<size_t> tb_indices;
+        for (size_t i = 0; i < moves.size(); i++) {
+          const Position& pos = history.GetPositionAt(i + 1);
+          const auto& board = pos.GetBoard();
+          if (board.castlings().no_legal_castle() &&
+              (board.ours() | board.theirs()).count() <=
+                  tablebase->max_cardinality()) {
+            tb_positions.push_back(&pos);
+            tb_indices.push_back(i);
+          }
+        }
+        std::vector<WDLScore> scores(tb_positions.size());
+        std::vector<ProbeState> states(tb_positions.size());
+        tablebase->probe_wdl_batch(tb_positions, scores, states);
+        for (size_t i = 0; i < tb_indices.size(); i++) {
+          tb_scores[tb_indices[i]] = scores[i];
+          tb_states[tb_indices[i]] = states[i];
+        }
+      }
+
       PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
                     &board, &rule50ply, &gameply);
       history.Reset(board, rule50ply, gameply);
@@ -561,8 +697,8 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
             history.Last().GetRule50Ply() == 0 &&
             (board.ours() | board.theirs()).count() <=
                 tablebase->max_cardinality()) {
-          ProbeState state;
-          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+          ProbeState state = tb_states[i];
+          WDLScore wdl = tb_scores[i];
           // Only fail state means the WDL is wrong, probe_wdl may produce
           // correct result with a stat other than OK.
           if (state != FAIL) {
@@ -617,8 +753,8 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
             history.Last().GetRule50Ply() != 0 &&
             (board.ours() | board.theirs()).count() <=
                 tablebase->max_cardinality()) {
-          ProbeState state;
-          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+          ProbeState state = tb_states[i];
+          WDLScore wdl = tb_scores[i];
           // Only fail state means the WDL is wrong, probe_wdl may produce
           // correct result with a stat other than OK.
           if (state != FAIL) {
@@ -899,8 +1035,8 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
           if (board.castlings().no_legal_castle() &&
               (board.ours() | board.theirs()).count() <= 3 &&
               board.pawns().empty()) {
-            ProbeState state;
-            WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+            ProbeState state = tb_states[i];
+            WDLScore wdl = tb_scores[i];
             // Only fail state means the WDL is wrong, probe_wdl may produce
             // correct result with a stat other than OK.
             if (state != FAIL) {
@@ -1038,21 +1174,53 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
         }
       }
 
+      // Positions seen before are dropped, except for the keep rate share.
+      std::vector<bool> dropped(fileContents.size());
+      if (pipeline.dedup) {
+        for (size_t i = 0; i < fileContents.size(); i++) {
+          if (fileContents[i].invariance_info & 64) continue;
+          if (pipeline.dedup->TestAndInsert(DedupKey(fileContents[i])) &&
+              Random::Get().GetFloat(1.0f) >= pipeline.dedup_keep_rate) {
+            dropped[i] = true;
+            duplicates += 1;
+          }
+        }
+      }
+
+      std::vector<V6TrainingData> output;
       if (!outputDir.empty()) {
-        std::string fileName = file.substr(file.find_last_of("/\\") + 1);
-        TrainingDataWriter writer(outputDir + "/" + fileName);
-        for (auto chunk : fileContents) {
+        output.reserve(fileContents.size());
+        for (size_t i = 0; i < fileContents.size(); i++) {
           // Don't save chunks that just provide move history.
-          if ((chunk.invariance_info & 64) == 0) {
-            writer.WriteChunk(chunk);
+          if ((fileContents[i].invariance_info & 64) == 0 && !dropped[i]) {
+            output.push_back(fileContents[i]);
           }
         }
       }
+      // Nothing is written if all the positions are dropped.
+      if (!output.empty()) {
+        std::string fileName = file.substr(file.find_last_of("/\\") + 1);
+        const auto write_start = std::chrono::steady_clock::now();
+        if (pipeline.writer) {
+          // Blocks while the writers are behind.
+          pipeline.writer->Enqueue(outputDir + "/" + fileName,
+                                   std::move(output),
+                                   [finish](const std::string&) {
+                                     files_written += 1;
+                                     finish();
+                                   });
+          queued = true;
+        } else {
+          TrainingDataWriter writer(outputDir + "/" + fileName);
+          for (const auto& chunk : output) writer.WriteChunk(chunk);
+          writer.Finalize();
+          files_written += 1;
+        }
+        write_us = MicrosecondsSince(write_start);
+      }
 
-      // Output data in Stockfish plain format.
-      if (!nnue_plain_file.empty()) {
-        static Mutex mutex;
-        std::ostringstream out;
+      // Output data in Stockfish plain or bin format.
+      if (nnue_buffer) {
         pblczero::NetworkFormat::InputFormat format;
         if (newInputFormat != -1) {
           format =
@@ -1066,30 +1234,27 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
         for (size_t i = 0; i < fileContents.size(); i++) {
           auto chunk = fileContents[i];
           Position p = history.Last();
-          if (chunk.visits > 0) {
+          if (dropped[i]) {
+            // Duplicate.
+          } else if (chunk.visits > 0) {
             // Format is v6 and position is evaluated.
             Move m = MoveFromNNIndex(
                 flags.nnue_best_move ? chunk.best_idx : chunk.played_idx,
                 TransformForPosition(format, history));
             float q = flags.nnue_best_score ? chunk.best_q : chunk.played_q;
-            out << AsNnueString(p, m, q, round(chunk.result_q));
+            AppendNnueRecord(pipeline.nnue_format, p, m, q,
+                             round(chunk.result_q), nnue_buffer);
           } else if (i < moves.size()) {
-            out << AsNnueString(p, moves[i], chunk.best_q,
-                                round(chunk.result_q));
+            AppendNnueRecord(pipeline.nnue_format, p, moves[i], chunk.best_q,
+                             round(chunk.result_q), nnue_buffer);
           }
           if (i < moves.size()) {
             history.Append(moves[i]);
           }
         }
-        std::ofstream file;
-        Mutex::Lock lock(mutex);
-        file.open(nnue_plain_file, std::ios_base::app);
-        if (file.is_open()) {
-          file << out.str();
-          file.close();
-        }
       }
     } catch (Exception& ex) {
+      if (nnue_buffer) nnue_buffer->resize(nnue_size);
       std::cerr << "While processing: " << file
                 << " - Exception thrown: " << ex.what() << std::endl;
       if (flags.delete_files) {
@@ -1097,35 +1262,38 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
       }
     }
   }
-  if (flags.delete_files) {
-    remove(file.c_str());
-  }
+  if (!queued) finish();
+  write_wait_us += write_us;
+  rescore_us += MicrosecondsSince(start) - write_us;
 }
 
-void ProcessFiles(const std::vector<std::string>& files,
-                  SyzygyTablebase* tablebase, std::string outputDir,
-                  float distTemp, float distOffset, float dtzBoost,
-                  int newInputFormat, int offset, int mod,
-                  std::string nnue_plain_file, ProcessFileFlags flags) {
-  std::cerr << "Thread: " << offset << " starting" << std::endl;
-  for (size_t i = offset; i < files.size(); i += mod) {
-    if (files[i].rfind(".gz") != files[i].size() - 3) {
-      std::cerr << "Skipping: " << files[i] << std::endl;
-      continue;
+// Rescoring threads take the next loaded file whenever they are done with the
+// previous one, so a long game doesn't hold back the files behind it.
+void ProcessFiles(TrainingDataPrefetcher* reader,
+                  const RescorePipeline& pipeline, SyzygyTablebase* tablebase,
+                  std::string outputDir, float distTemp, float distOffset,
+                  float dtzBoost, int newInputFormat, int thread_id,
+                  ProcessFileFlags flags) {
+  std::cerr << "Thread: " << thread_id << " starting" << std::endl;
+  std::string nnue_buffer;
+  TrainingDataPrefetcher::File loaded;
+  while (true) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!reader->Next(&loaded)) break;
+    read_wait_us += MicrosecondsSince(start);
+    ProcessFile(std::move(loaded), tablebase, outputDir, distTemp, distOffset,
+                dtzBoost, newInputFormat,
+                pipeline.nnue ? &nnue_buffer : nullptr, flags, pipeline);
+    if (nnue_buffer.size() >= kNnueFlushBytes) {
+      pipeline.nnue->Append(&nnue_buffer);
     }
-    ProcessFile(files[i], tablebase, outputDir, distTemp, distOffset, dtzBoost,
-                newInputFormat, nnue_plain_file, flags);
   }
+  if (pipeline.nnue) pipeline.nnue->Append(&nnue_buffer);
 }
 
 void BuildSubs(const std::vector<std::string>& files) {
   for (auto& file : files) {
-    TrainingDataReader reader(file);
-    std::vector<V6TrainingData> fileContents;
-    V6TrainingData data;
-    while (reader.ReadChunk(&data)) {
-      fileContents.push_back(data);
-    }
+    std::vector<V6TrainingData> fileContents = ReadTrainingDataFile(file);
     Validate(fileContents);
     MoveList moves;
     for (size_t i = 1; i < fileContents.size(); i++) {
@@ -1195,6 +1363,13 @@ void RunRescorer() {
   options.Add<StringOption>(kOutputDirId);
   options.Add<StringOption>(kPolicySubsDirId);
   options.Add<IntOption>(kThreadsId, 1, 20) = 1;
+  options.Add<IntOption>(kPrefetchFilesId, 0, 64) = 4;
+  options.Add<IntOption>(kReaderThreadsId, 1, 16) = 1;
+  options.Add<IntOption>(kWriterThreadsId, 0, 16) = 1;
+  options.Add<StringOption>(kManifestId);
+  options.Add<IntOption>(kDedupFilterSizeId, 0, 1 << 20) = 0;
+  options.Add<StringOption>(kDedupFilterId);
+  options.Add<FloatOption>(kDedupKeepRateId, 0.0f, 1.0f) = 0.0f;
   options.Add<FloatOption>(kTempId, 0.001, 100) = 1;
   // Positive dist offset requires knowing the legal move set, so not supported
   // for now.
@@ -1205,6 +1380,8 @@ void RunRescorer() {
   options.Add<FloatOption>(kDeblunderQBlunderThreshold, 0.0f, 2.0f) = 2.0f;
   options.Add<FloatOption>(kDeblunderQBlunderWidth, 0.0f, 2.0f) = 0.0f;
   options.Add<StringOption>(kNnuePlainFileId);
+  std::vector<std::string> nnue_formats = {"plain", "bin"};
+  options.Add<ChoiceOption>(kNnueFormatId, nnue_formats) = "plain";
   options.Add<BoolOption>(kNnueBestScoreId) = true;
   options.Add<BoolOption>(kNnueBestMoveId) = false;
   options.Add<BoolOption>(kDeleteFilesId) = true;
@@ -1274,41 +1451,96 @@ void RunRescorer() {
   }
   float dtz_boost = options.GetOptionsDict().Get<float>(kMinDTZBoostId);
   unsigned int threads = options.GetOptionsDict().Get<int>(kThreadsId);
+  const int prefetch = options.GetOptionsDict().Get<int>(kPrefetchFilesId);
   ProcessFileFlags flags;
   flags.delete_files = options.GetOptionsDict().Get<bool>(kDeleteFilesId);
   flags.nnue_best_score = options.GetOptionsDict().Get<bool>(kNnueBestScoreId);
   flags.nnue_best_move = options.GetOptionsDict().Get<bool>(kNnueBestMoveId);
-  if (threads > 1) {
-    std::vector<std::thread> threads_;
-    int offset = 0;
-    while (threads_.size() < threads) {
-      int offset_val = offset;
-      offset++;
-      threads_.emplace_back([&options, offset_val, files, &tablebase, threads,
-                             dtz_boost, flags]() {
-        ProcessFiles(
-            files, &tablebase,
-            options.GetOptionsDict().Get<std::string>(kOutputDirId),
-            options.GetOptionsDict().Get<float>(kTempId),
-            options.GetOptionsDict().Get<float>(kDistributionOffsetId),
-            dtz_boost, options.GetOptionsDict().Get<int>(kNewInputFormatId),
-            offset_val, threads,
-            options.GetOptionsDict().Get<std::string>(kNnuePlainFileId), flags);
-      });
+
+  std::optional<RescoreManifest> manifest;
+  const auto manifest_file =
+      options.GetOptionsDict().Get<std::string>(kManifestId);
+  if (!manifest_file.empty()) manifest.emplace(manifest_file);
+  std::vector<std::string> inputs;
+  for (const auto& file : files) {
+    if (file.rfind(".gz") != file.size() - 3) {
+      std::cerr << "Skipping: " << file << std::endl;
+      continue;
+    }
+    if (manifest && manifest->Contains(file)) continue;
+    inputs.push_back(file);
+  }
+  if (inputs.size() < files.size()) {
+    std::cerr << "Files already processed or skipped: "
+              << files.size() - inputs.size() << std::endl;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const size_t num_inputs = inputs.size();
+  const auto output_dir =
+      options.GetOptionsDict().Get<std::string>(kOutputDirId);
+  {
+    // Reading the next files overlaps with the tablebase probes of the
+    // current ones.
+    TrainingDataPrefetcher reader(
+        std::move(inputs),
+        prefetch > 0 ? options.GetOptionsDict().Get<int>(kReaderThreadsId) : 0,
+        prefetch * threads);
+    std::optional<TrainingDataWriterPool> writer;
+    const int writer_threads =
+        options.GetOptionsDict().Get<int>(kWriterThreadsId);
+    if (writer_threads > 0 && !output_dir.empty()) {
+      writer.emplace(writer_threads, kMaxQueuedChunks);
     }
-    for (size_t i = 0; i < threads_.size(); i++) {
-      threads_[i].join();
+    RescorePipeline pipeline;
+    pipeline.writer = writer ? &*writer : nullptr;
+    pipeline.manifest = manifest ? &*manifest : nullptr;
+    std::unique_ptr<BloomFilter> dedup;
+    const auto dedup_file =
+        options.GetOptionsDict().Get<std::string>(kDedupFilterId);
+    if (options.GetOptionsDict().Get<int>(kDedupFilterSizeId) > 0) {
+      dedup = std::make_unique<BloomFilter>(
+          options.GetOptionsDict().Get<int>(kDedupFilterSizeId) * 8ULL *
+          1024 * 1024);
+      if (!dedup_file.empty() && dedup->Load(dedup_file)) {
+        std::cerr << "Loaded dedup filter " << dedup_file << std::endl;
+      }
+      pipeline.dedup = dedup.get();
+      pipeline.dedup_keep_rate =
+          options.GetOptionsDict().Get<float>(kDedupKeepRateId);
     }
-
-  } else {
-    ProcessFiles(
-        files, &tablebase,
-        options.GetOptionsDict().Get<std::string>(kOutputDirId),
-        options.GetOptionsDict().Get<float>(kTempId),
-        options.GetOptionsDict().Get<float>(kDistributionOffsetId), dtz_boost,
-        options.GetOptionsDict().Get<int>(kNewInputFormatId), 0, 1,
-        options.GetOptionsDict().Get<std::string>(kNnuePlainFileId), flags);
+    std::optional<NnueOutputFile> nnue;
+    const auto nnue_file =
+        options.GetOptionsDict().Get<std::string>(kNnuePlainFileId);
+    if (!nnue_file.empty()) {
+      nnue.emplace(nnue_file);
+      pipeline.nnue = &*nnue;
+      if (options.GetOptionsDict().Get<std::string>(kNnueFormatId) == "bin") {
+        pipeline.nnue_format = NnueFormat::kBin;
+      }
+    }
+    auto run = [&](int thread_id) {
+      ProcessFiles(&reader, pipeline, &tablebase, output_dir,
+                   options.GetOptionsDict().Get<float>(kTempId),
+                   options.GetOptionsDict().Get<float>(kDistributionOffsetId),
+                   dtz_boost,
+                   options.GetOptionsDict().Get<int>(kNewInputFormatId),
+                   thread_id, flags);
+    };
+    if (threads > 1) {
+      std::vector<std::thread> threads_;
+      while (threads_.size() < threads) {
+        threads_.emplace_back(run, threads_.size());
+      }
+      for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+      }
+    } else {
+      run(0);
+    }
+    if (writer) writer->Wait();
+    if (dedup && !dedup_file.empty()) dedup->Save(dedup_file);
   }
+  const double seconds = MicrosecondsSince(start) / 1e6;
   std::cout << "Games processed: " << games << std::endl;
   std::cout << "Positions processed: " << positions << std::endl;
   std::cout << "Rescores performed: " << rescored << std::endl;
@@ -1344,6 +1576,14 @@ void RunRescorer() {
             << " W: " << fixed_counts[2] << std::endl;
   std::cout << "Gaviota DTM move_count rescores: " << gaviota_dtm_rescores
             << std::endl;
+  std::cout << "Files: " << num_inputs << " read, " << files_written
+            << " written in " << std::setprecision(4) << seconds << "s ("
+            << (seconds > 0 ? num_inputs / seconds : 0.0) << " files/s)"
+            << std::endl;
+  std::cout << "Duplicate positions dropped: " << duplicates << std::endl;
+  std::cout << "Thread seconds waiting for reads: " << read_wait_us / 1e6
+            << ", rescoring: " << rescore_us / 1e6
+            << ", waiting for writes: " << write_wait_us / 1e6 << std::endl;
 }
 
 }  // namespace lczero
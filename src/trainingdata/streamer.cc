@@ -0,0 +1,211 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/streamer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+constexpr auto kMinRetryDelay = std::chrono::milliseconds(100);
+constexpr auto kMaxRetryDelay = std::chrono::seconds(30);
+}  // namespace
+
+TrainingDataStreamer::TrainingDataStreamer(
+    const std::string& address, size_t max_backlog_games,
+    const TrainingDataPackWriter::Options& options)
+    : max_backlog_games_(max_backlog_games), options_(options) {
+  const size_t colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    throw Exception("Training data stream address must be host:port: " +
+                    address);
+  }
+  host_ = address.substr(0, colon);
+  port_ = std::stoi(address.substr(colon + 1));
+  thread_ = std::thread([this]() { Worker(); });
+}
+
+TrainingDataStreamer::~TrainingDataStreamer() {
+  {
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+  }
+  game_added_.notify_all();
+  thread_.join();
+}
+
+void TrainingDataStreamer::Enqueue(std::string spill_filename,
+                                   std::vector<V6TrainingData> chunks,
+                                   OnWritten on_written) {
+  {
+    Mutex::Lock lock(mutex_);
+    ++pending_games_;
+    games_.push_back(
+        {std::move(spill_filename), std::move(chunks), std::move(on_written)});
+  }
+  game_added_.notify_one();
+}
+
+void TrainingDataStreamer::Wait() {
+  Mutex::Lock lock(mutex_);
+  game_done_.wait(lock.get_raw(),
+                  [&]() REQUIRES(mutex_) { return pending_games_ == 0; });
+}
+
+void TrainingDataStreamer::Connect() {
+  socket_ = remote::Socket::Connect(host_, port_);
+  compressor_ = std::make_unique<PackCompressor>(options_.codec, options_.level,
+                                                 options_.dictionary);
+  games_sent_ = 0;
+  PackHeader header{};
+  std::memcpy(header.magic, kPackHeaderMagic, sizeof(header.magic));
+  header.version = kPackVersion;
+  header.codec = static_cast<uint32_t>(options_.codec);
+  header.dictionary_size = options_.dictionary.size();
+  header.flags = options_.sparse_policy ? kPackFlagSparsePolicy : 0;
+  socket_.WriteAll(&header, sizeof(header));
+  socket_.WriteAll(options_.dictionary.data(), options_.dictionary.size());
+  LOGFILE << "Streaming training data to " << host_ << ":" << port_;
+}
+
+void TrainingDataStreamer::Send(const Game& game) {
+  std::string sparse;
+  std::span<const uint8_t> data{
+      reinterpret_cast<const uint8_t*>(game.chunks.data()),
+      game.chunks.size() * sizeof(V6TrainingData)};
+  if (options_.sparse_policy) {
+    for (const auto& chunk : game.chunks) {
+      AppendSparseTrainingData(chunk, &sparse);
+    }
+    data = {reinterpret_cast<const uint8_t*>(sparse.data()), sparse.size()};
+  }
+  const std::string frame = compressor_->Compress(data);
+  const PackIndexEntry entry{
+      .offset = games_sent_,
+      .compressed_size = static_cast<uint32_t>(frame.size()),
+      .uncompressed_size = static_cast<uint32_t>(data.size()),
+      .num_chunks = static_cast<uint32_t>(game.chunks.size()),
+      .reserved = 0};
+  socket_.WriteAll(&entry, sizeof(entry));
+  socket_.WriteAll(frame.data(), frame.size());
+  uint64_t stored;
+  if (!socket_.ReadAll(&stored, sizeof(stored))) {
+    throw Exception("Ingest server closed the connection");
+  }
+  if (stored <= games_sent_) {
+    throw Exception("Ingest server didn't store the game");
+  }
+  ++games_sent_;
+}
+
+void TrainingDataStreamer::Spill(const Game& game) {
+  try {
+    TrainingDataWriter writer(game.spill_filename);
+    for (const auto& chunk : game.chunks) writer.WriteChunk(chunk);
+    writer.Finalize();
+  } catch (const Exception& e) {
+    CERR << "Failed to write training data: " << e.what();
+    return;
+  }
+  if (game.on_written) game.on_written(game.spill_filename);
+}
+
+void TrainingDataStreamer::Worker() {
+  while (true) {
+    Game game;
+    bool stopping;
+    {
+      Mutex::Lock lock(mutex_);
+      game_added_.wait(lock.get_raw(), [&]() REQUIRES(mutex_) {
+        return stop_ || !games_.empty();
+      });
+      if (games_.empty()) return;
+      game = std::move(games_.front());
+      games_.pop_front();
+      stopping = stop_;
+    }
+
+    bool delivered = false;
+    // While the server is down, the connection is only retried after the
+    // backoff delay, and the games wait in the backlog meanwhile.
+    if (socket_.is_open() ||
+        std::chrono::steady_clock::now() >= next_attempt_) {
+      try {
+        if (!socket_.is_open()) Connect();
+        Send(game);
+        delivered = true;
+        if (failures_ > 0) {
+          CERR << "Training data stream to " << host_ << ":" << port_
+               << " restored.";
+        }
+        failures_ = 0;
+      } catch (const Exception& e) {
+        if (failures_ == 0) {
+          CERR << "Training data stream to " << host_ << ":" << port_
+               << " failed, retrying: " << e.what();
+        }
+        socket_.Close();
+        const auto delay = std::min<std::chrono::milliseconds>(
+            kMinRetryDelay * (1 << std::min(failures_, 16)), kMaxRetryDelay);
+        next_attempt_ = std::chrono::steady_clock::now() + delay;
+        ++failures_;
+      }
+    }
+
+    if (delivered) {
+      if (game.on_written) game.on_written("");
+    } else {
+      bool spill;
+      {
+        Mutex::Lock lock(mutex_);
+        // The oldest game is spilled once the backlog is full.
+        spill = stopping || games_.size() >= max_backlog_games_;
+        if (!spill) {
+          games_.push_front(std::move(game));
+          game_added_.wait_until(lock.get_raw(), next_attempt_,
+                                 [&]() REQUIRES(mutex_) {
+                                   return stop_ ||
+                                          games_.size() > max_backlog_games_;
+                                 });
+          continue;
+        }
+      }
+      Spill(game);
+    }
+    {
+      Mutex::Lock lock(mutex_);
+      --pending_games_;
+    }
+    game_done_.notify_all();
+  }
+}
+
+}  // namespace lczero
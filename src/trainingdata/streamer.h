@@ -0,0 +1,111 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "neural/remote/protocol.h"
+#include "trainingdata/trainingdata.h"
+#include "trainingdata/writer.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Streams finished games to an ingest server over a persistent TCP
+// connection, rather than writing a file per game to the local disk.
+//
+// The stream uses the training data pack container (see trainingdata/pack.h):
+// it starts with a PackHeader and the dictionary, then every game is a
+// PackIndexEntry followed by the compressed frame of its chunks. The offset
+// field of the entry holds the number of the game in the connection instead.
+// After every game the server replies with an uint64_t, the number of games
+// of the connection it has stored, and the game counts as delivered once that
+// covers it.
+//
+// When the server can't be reached, the games wait in a backlog and the
+// connection is retried with exponential backoff. Games beyond the backlog
+// limit, and the ones left when the streamer is destroyed, are spilled to
+// their files on the local disk as usual.
+class TrainingDataStreamer : public TrainingDataSink {
+ public:
+  // @address is host:port.
+  TrainingDataStreamer(const std::string& address, size_t max_backlog_games,
+                       const TrainingDataPackWriter::Options& options);
+  // Delivers or spills the remaining games.
+  ~TrainingDataStreamer() override;
+
+  // Queues the chunks of one game, @spill_filename is where they go if they
+  // can't be delivered. @on_written gets an empty filename for the delivered
+  // games.
+  void Enqueue(std::string spill_filename, std::vector<V6TrainingData> chunks,
+               OnWritten on_written) override;
+  // Blocks until all the queued games are delivered or spilled.
+  void Wait() override;
+
+ private:
+  struct Game {
+    std::string spill_filename;
+    std::vector<V6TrainingData> chunks;
+    OnWritten on_written;
+  };
+
+  void Worker();
+  // Throws Exception if the connection fails.
+  void Connect();
+  void Send(const Game& game);
+  void Spill(const Game& game);
+
+  std::string host_;
+  int port_;
+  const size_t max_backlog_games_;
+  const TrainingDataPackWriter::Options options_;
+  // Only used by the worker thread.
+  remote::Socket socket_;
+  std::unique_ptr<PackCompressor> compressor_;
+  uint64_t games_sent_ = 0;
+  int failures_ = 0;
+  std::chrono::steady_clock::time_point next_attempt_;
+
+  Mutex mutex_;
+  std::condition_variable game_added_;
+  std::condition_variable game_done_;
+  std::deque<Game> games_ GUARDED_BY(mutex_);
+  // Games queued or being sent.
+  size_t pending_games_ GUARDED_BY(mutex_) = 0;
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace lczero
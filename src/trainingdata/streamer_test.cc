@@ -0,0 +1,125 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/streamer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trainingdata/reader.h"
+
+namespace lczero {
+namespace {
+
+constexpr int kPort = 17851;
+
+std::vector<V6TrainingData> MakeGame(int num_chunks) {
+  std::vector<V6TrainingData> chunks(num_chunks);
+  for (int i = 0; i < num_chunks; ++i) {
+    std::memset(&chunks[i], 0, sizeof(V6TrainingData));
+    chunks[i].version = 6;
+    chunks[i].input_format = 1;
+    chunks[i].rule50_count = i;
+    chunks[i].visits = 100 + i;
+  }
+  return chunks;
+}
+
+}  // namespace
+
+TEST(TrainingDataStreamer, DeliversGames) {
+  remote::Socket listener = remote::Socket::Listen("127.0.0.1", kPort);
+  std::vector<uint32_t> received_chunks;
+  std::thread server([&]() {
+    remote::Socket socket = listener.Accept();
+    PackHeader header;
+    ASSERT_TRUE(socket.ReadAll(&header, sizeof(header)));
+    EXPECT_EQ(std::memcmp(header.magic, kPackHeaderMagic, 8), 0);
+    std::string dictionary(header.dictionary_size, '\0');
+    socket.ReadAll(dictionary.data(), dictionary.size());
+    PackDecompressor decompressor(static_cast<PackCodec>(header.codec),
+                                  dictionary);
+    PackIndexEntry entry;
+    uint64_t stored = 0;
+    while (socket.ReadAll(&entry, sizeof(entry))) {
+      EXPECT_EQ(entry.offset, stored);
+      std::vector<uint8_t> frame(entry.compressed_size);
+      std::vector<uint8_t> data(entry.uncompressed_size);
+      socket.ReadAll(frame.data(), frame.size());
+      decompressor.Decompress(frame, data);
+      received_chunks.push_back(entry.num_chunks);
+      ++stored;
+      socket.WriteAll(&stored, sizeof(stored));
+    }
+  });
+
+  std::vector<std::string> written;
+  {
+    TrainingDataStreamer streamer("127.0.0.1:" + std::to_string(kPort), 10,
+                                  TrainingDataPackWriter::Options{});
+    for (int i = 1; i <= 3; ++i) {
+      streamer.Enqueue(testing::TempDir() + "streamer_unused.gz", MakeGame(i),
+                       [&](const std::string& filename) {
+                         written.push_back(filename);
+                       });
+    }
+    streamer.Wait();
+  }
+  server.join();
+  EXPECT_EQ(received_chunks, (std::vector<uint32_t>{1, 2, 3}));
+  EXPECT_EQ(written, (std::vector<std::string>{"", "", ""}));
+}
+
+TEST(TrainingDataStreamer, SpillsWhenUnreachable) {
+  const std::string filename = testing::TempDir() + "streamer_spill.gz";
+  std::string written;
+  {
+    // Nothing listens there, and there is no backlog.
+    TrainingDataStreamer streamer("127.0.0.1:" + std::to_string(kPort + 1), 0,
+                                  TrainingDataPackWriter::Options{});
+    streamer.Enqueue(filename, MakeGame(7),
+                     [&](const std::string& name) { written = name; });
+    streamer.Wait();
+  }
+  EXPECT_EQ(written, filename);
+  const auto chunks = ReadTrainingDataFile(filename);
+  ASSERT_EQ(chunks.size(), 7u);
+  EXPECT_EQ(chunks[6].visits, 106u);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -27,6 +27,9 @@
 
 #include "trainingdata/trainingdata.h"
 
+#include <cstddef>
+#include <cstring>
+
 namespace lczero {
 
 namespace {
@@ -75,8 +78,81 @@ std::tuple<float, float> DriftCorrect(float q, float d) {
   }
   return {q, d};
 }
+constexpr size_t kPolicyOffset = offsetof(V6TrainingData, probabilities);
+constexpr size_t kPolicySize = sizeof(V6TrainingData::probabilities);
+constexpr size_t kPolicyEnd = kPolicyOffset + kPolicySize;
+constexpr size_t kNumPolicyEntries = kPolicySize / sizeof(float);
+
+uint32_t FloatBits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
 }  // namespace
 
+void AppendSparseTrainingData(const V6TrainingData& data, std::string* out) {
+  const char* raw = reinterpret_cast<const char*>(&data);
+  // Copied as the struct is packed.
+  float policy[kNumPolicyEntries];
+  std::memcpy(policy, raw + kPolicyOffset, kPolicySize);
+  // Comparing the bits keeps -0.0 and NaN exact.
+  size_t num_zeros = 0;
+  size_t num_illegal = 0;
+  for (const float p : policy) {
+    if (FloatBits(p) == FloatBits(0.0f)) ++num_zeros;
+    if (FloatBits(p) == FloatBits(-1.0f)) ++num_illegal;
+  }
+  const float fill = num_zeros > num_illegal ? 0.0f : -1.0f;
+  uint16_t count = 0;
+  for (const float p : policy) count += FloatBits(p) != FloatBits(fill);
+
+  out->append(raw, kPolicyOffset);
+  out->append(raw + kPolicyEnd, sizeof(V6TrainingData) - kPolicyEnd);
+  out->append(reinterpret_cast<const char*>(&fill), sizeof(fill));
+  out->append(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (uint16_t i = 0; i < kNumPolicyEntries; ++i) {
+    if (FloatBits(policy[i]) == FloatBits(fill)) continue;
+    out->append(reinterpret_cast<const char*>(&i), sizeof(i));
+    out->append(reinterpret_cast<const char*>(&policy[i]), sizeof(float));
+  }
+}
+
+V6TrainingData ExpandSparseTrainingData(std::span<const uint8_t>* in) {
+  constexpr size_t kFixedSize = sizeof(V6TrainingData) - kPolicySize +
+                                sizeof(float) + sizeof(uint16_t);
+  constexpr size_t kEntrySize = sizeof(uint16_t) + sizeof(float);
+  if (in->size() < kFixedSize) throw Exception("Truncated sparse chunk.");
+  V6TrainingData data;
+  char* raw = reinterpret_cast<char*>(&data);
+  const uint8_t* pos = in->data();
+  std::memcpy(raw, pos, kPolicyOffset);
+  pos += kPolicyOffset;
+  std::memcpy(raw + kPolicyEnd, pos, sizeof(V6TrainingData) - kPolicyEnd);
+  pos += sizeof(V6TrainingData) - kPolicyEnd;
+  float fill;
+  uint16_t count;
+  std::memcpy(&fill, pos, sizeof(fill));
+  pos += sizeof(fill);
+  std::memcpy(&count, pos, sizeof(count));
+  pos += sizeof(count);
+  if (in->size() < kFixedSize + count * kEntrySize) {
+    throw Exception("Truncated sparse chunk.");
+  }
+  float policy[kNumPolicyEntries];
+  std::fill(std::begin(policy), std::end(policy), fill);
+  for (uint16_t i = 0; i < count; ++i) {
+    uint16_t idx;
+    std::memcpy(&idx, pos, sizeof(idx));
+    if (idx >= kNumPolicyEntries) throw Exception("Invalid sparse chunk.");
+    std::memcpy(&policy[idx], pos + sizeof(idx), sizeof(float));
+    pos += kEntrySize;
+  }
+  std::memcpy(raw + kPolicyOffset, policy, kPolicySize);
+  *in = in->subspan(pos - in->data());
+  return data;
+}
+
 void V6TrainingDataArray::Write(TrainingDataWriter* writer, GameResult result,
                                 bool adjudicated) const {
   if (training_data_.empty()) return;
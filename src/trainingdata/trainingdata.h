@@ -88,6 +88,15 @@ static_assert(sizeof(V6TrainingData) == 8356, "Wrong struct size");
 
 #pragma pack(pop)
 
+// Sparse form of V6TrainingData, for storage. The probabilities array is
+// replaced with the list of entries that differ from the fill value (-1, the
+// value of illegal moves, unless most entries are 0) as (uint16 index, float
+// probability) pairs. The expansion restores the chunk bit for bit.
+void AppendSparseTrainingData(const V6TrainingData& data, std::string* out);
+// Expands the sparse chunk at the front of @in and advances it. Throws on
+// truncated or invalid data.
+V6TrainingData ExpandSparseTrainingData(std::span<const uint8_t>* in);
+
 class V6TrainingDataArray {
  public:
   V6TrainingDataArray(FillEmptyHistory white_fill_empty_history,
@@ -27,9 +27,12 @@
 
 #include "trainingdata/writer.h"
 
+#include <cstring>
+
 #include "trainingdata/trainingdata.h"
 #include "utils/exception.h"
 #include "utils/filesystem.h"
+#include "utils/logging.h"
 #include "utils/random.h"
 
 namespace lczero {
@@ -43,9 +46,7 @@ std::string GetLc0CacheDirectory() {
   return user_cache_path;
 }
 
-}  // namespace
-
-TrainingDataWriter::TrainingDataWriter(int game_id) {
+std::string GetGameFileName(int game_id) {
   static std::string directory =
       GetLc0CacheDirectory() + "data-" + Random::Get().GetString(12);
   // It's fine if it already exists.
@@ -54,19 +55,36 @@ TrainingDataWriter::TrainingDataWriter(int game_id) {
   std::ostringstream oss;
   oss << directory << '/' << "game_" << std::setfill('0') << std::setw(6)
       << game_id << ".gz";
+  return oss.str();
+}
+
+}  // namespace
 
-  filename_ = oss.str();
+TrainingDataWriter::TrainingDataWriter(int game_id)
+    : TrainingDataWriter(game_id, nullptr) {}
+
+TrainingDataWriter::TrainingDataWriter(std::string filename)
+    : filename_(filename) {
   fout_ = gzopen(filename_.c_str(), "wb");
   if (!fout_) throw Exception("Cannot create gzip file " + filename_);
 }
 
-TrainingDataWriter::TrainingDataWriter(std::string filename)
-    : filename_(filename) {
+TrainingDataWriter::TrainingDataWriter(int game_id, TrainingDataSink* sink)
+    : filename_(GetGameFileName(game_id)), sink_(sink) {
+  if (sink_) return;
   fout_ = gzopen(filename_.c_str(), "wb");
   if (!fout_) throw Exception("Cannot create gzip file " + filename_);
 }
 
+TrainingDataWriter::~TrainingDataWriter() {
+  if (fout_ || sink_) Finalize();
+}
+
 void TrainingDataWriter::WriteChunk(const V6TrainingData& data) {
+  if (sink_) {
+    chunks_.push_back(data);
+    return;
+  }
   auto bytes_written =
       gzwrite(fout_, reinterpret_cast<const char*>(&data), sizeof(data));
   if (bytes_written != sizeof(data)) {
@@ -74,9 +92,152 @@ void TrainingDataWriter::WriteChunk(const V6TrainingData& data) {
   }
 }
 
-void TrainingDataWriter::Finalize() {
+void TrainingDataWriter::Finalize(TrainingDataSink::OnWritten on_written) {
+  if (sink_) {
+    sink_->Enqueue(filename_, std::move(chunks_), std::move(on_written));
+    sink_ = nullptr;
+    return;
+  }
   gzclose(fout_);
   fout_ = nullptr;
+  if (on_written) on_written(filename_);
+}
+
+TrainingDataPackWriter::TrainingDataPackWriter(const std::string& filename,
+                                               const Options& options)
+    : filename_(filename),
+      fout_(filename, std::ios::binary),
+      compressor_(options.codec, options.level, options.dictionary),
+      sparse_policy_(options.sparse_policy) {
+  if (!fout_) throw Exception("Cannot create pack file " + filename_);
+  PackHeader header{};
+  std::memcpy(header.magic, kPackHeaderMagic, sizeof(header.magic));
+  header.version = kPackVersion;
+  header.codec = static_cast<uint32_t>(options.codec);
+  header.dictionary_size = options.dictionary.size();
+  header.flags = sparse_policy_ ? kPackFlagSparsePolicy : 0;
+  Write(&header, sizeof(header));
+  Write(options.dictionary.data(), options.dictionary.size());
+}
+
+TrainingDataPackWriter::~TrainingDataPackWriter() {
+  if (!fout_.is_open()) return;
+  try {
+    Finalize();
+  } catch (const Exception& e) {
+    CERR << e.what();
+  }
+}
+
+void TrainingDataPackWriter::WriteGame(
+    std::span<const V6TrainingData> chunks) {
+  std::string sparse;
+  std::span<const uint8_t> data{reinterpret_cast<const uint8_t*>(chunks.data()),
+                                chunks.size_bytes()};
+  if (sparse_policy_) {
+    for (const auto& chunk : chunks) AppendSparseTrainingData(chunk, &sparse);
+    data = {reinterpret_cast<const uint8_t*>(sparse.data()), sparse.size()};
+  }
+  const std::string frame = compressor_.Compress(data);
+  index_.push_back({.offset = offset_,
+                    .compressed_size = static_cast<uint32_t>(frame.size()),
+                    .uncompressed_size = static_cast<uint32_t>(data.size()),
+                    .num_chunks = static_cast<uint32_t>(chunks.size()),
+                    .reserved = 0});
+  Write(frame.data(), frame.size());
+}
+
+void TrainingDataPackWriter::Finalize() {
+  PackFooter footer{};
+  footer.index_offset = offset_;
+  footer.num_games = index_.size();
+  std::memcpy(footer.magic, kPackFooterMagic, sizeof(footer.magic));
+  Write(index_.data(), index_.size() * sizeof(PackIndexEntry));
+  Write(&footer, sizeof(footer));
+  fout_.close();
+  if (!fout_) throw Exception("Unable to write into " + filename_);
+}
+
+void TrainingDataPackWriter::Write(const void* data, size_t size) {
+  fout_.write(static_cast<const char*>(data), size);
+  if (!fout_) throw Exception("Unable to write into " + filename_);
+  offset_ += size;
+}
+
+TrainingDataWriterPool::TrainingDataWriterPool(int num_threads,
+                                               size_t max_queued_chunks)
+    : max_queued_chunks_(max_queued_chunks) {
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this]() { Worker(); });
+  }
+}
+
+TrainingDataWriterPool::~TrainingDataWriterPool() {
+  {
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+  }
+  job_added_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+void TrainingDataWriterPool::Enqueue(std::string filename,
+                                     std::vector<V6TrainingData> chunks,
+                                     OnWritten on_written) {
+  {
+    Mutex::Lock lock(mutex_);
+    // A file bigger than the whole queue still goes in when the queue is
+    // empty.
+    job_done_.wait(lock.get_raw(), [&]() REQUIRES(mutex_) {
+      return queued_chunks_ == 0 ||
+             queued_chunks_ + chunks.size() <= max_queued_chunks_;
+    });
+    queued_chunks_ += chunks.size();
+    ++pending_files_;
+    jobs_.push_back(
+        {std::move(filename), std::move(chunks), std::move(on_written)});
+  }
+  job_added_.notify_one();
+}
+
+void TrainingDataWriterPool::Wait() {
+  Mutex::Lock lock(mutex_);
+  job_done_.wait(lock.get_raw(),
+                 [&]() REQUIRES(mutex_) { return pending_files_ == 0; });
+}
+
+void TrainingDataWriterPool::Worker() {
+  while (true) {
+    Job job;
+    {
+      Mutex::Lock lock(mutex_);
+      job_added_.wait(lock.get_raw(), [&]() REQUIRES(mutex_) {
+        return stop_ || !jobs_.empty();
+      });
+      // Remaining jobs are written before stopping.
+      if (jobs_.empty()) return;
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+      queued_chunks_ -= job.chunks.size();
+    }
+    // Room in the queue.
+    job_done_.notify_all();
+    bool written = false;
+    try {
+      TrainingDataWriter writer(job.filename);
+      for (const auto& chunk : job.chunks) writer.WriteChunk(chunk);
+      writer.Finalize();
+      written = true;
+    } catch (const Exception& e) {
+      CERR << "Failed to write training data: " << e.what();
+    }
+    if (written && job.on_written) job.on_written(job.filename);
+    {
+      Mutex::Lock lock(mutex_);
+      --pending_files_;
+    }
+    job_done_.notify_all();
+  }
 }
 
 }  // namespace lczero
@@ -27,36 +27,140 @@
 
 #pragma once
 
-#include <fstream>
 #include <zlib.h>
 
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "trainingdata/pack.h"
+#include "utils/mutex.h"
+
 namespace lczero {
 
 struct V6TrainingData;
 
+// Takes over the chunks of finished games and stores them off the game
+// threads.
+class TrainingDataSink {
+ public:
+  // Called with the name of the file the game went into, or with an empty
+  // name if it wasn't stored in a file.
+  using OnWritten = std::function<void(const std::string& filename)>;
+
+  virtual ~TrainingDataSink() = default;
+  // Stores @chunks, normally into @filename. @on_written is not called for
+  // the games that fail to be stored.
+  virtual void Enqueue(std::string filename, std::vector<V6TrainingData> chunks,
+                       OnWritten on_written) = 0;
+  // Blocks until all the queued games are stored.
+  virtual void Wait() = 0;
+};
+
 class TrainingDataWriter {
  public:
   // Creates a new file to write in data directory. It will has @game_id
   // somewhere in the filename.
   TrainingDataWriter(int game_id);
   TrainingDataWriter(std::string filename);
+  // Same as the first one, but if @sink is not null, the chunks are only
+  // collected in memory, and handed to @sink on Finalize().
+  TrainingDataWriter(int game_id, TrainingDataSink* sink);
 
-  ~TrainingDataWriter() {
-    if (fout_) Finalize();
-  }
+  ~TrainingDataWriter();
 
   // Writes a chunk.
   void WriteChunk(const V6TrainingData& data);
 
-  // Flushes file and closes it.
-  void Finalize();
+  // Flushes file and closes it. @on_written is called once the game is
+  // stored, which is from a sink thread if the writer has a sink.
+  void Finalize(TrainingDataSink::OnWritten on_written = nullptr);
 
   // Gets full filename of the file written.
   std::string GetFileName() const { return filename_; }
 
  private:
   std::string filename_;
-  gzFile fout_;
+  gzFile fout_ = nullptr;
+  TrainingDataSink* sink_ = nullptr;
+  std::vector<V6TrainingData> chunks_;
+};
+
+// Writes many games into one training data pack file, see trainingdata/pack.h.
+class TrainingDataPackWriter {
+ public:
+  struct Options {
+    PackCodec codec = DefaultPackCodec();
+    // 0 is the default level of the codec.
+    int level = 0;
+    // Compression dictionary, none if empty.
+    std::string dictionary;
+    // Store the chunks in the sparse form.
+    bool sparse_policy = true;
+  };
+  TrainingDataPackWriter(const std::string& filename, const Options& options);
+  ~TrainingDataPackWriter();
+
+  // Compresses and writes the chunks of one game.
+  void WriteGame(std::span<const V6TrainingData> chunks);
+
+  // Writes the index and closes the file.
+  void Finalize();
+
+  size_t GetNumGames() const { return index_.size(); }
+  std::string GetFileName() const { return filename_; }
+
+ private:
+  void Write(const void* data, size_t size);
+
+  std::string filename_;
+  std::ofstream fout_;
+  PackCompressor compressor_;
+  const bool sparse_policy_;
+  uint64_t offset_ = 0;
+  std::vector<PackIndexEntry> index_;
+};
+
+// Compresses and writes training data files on background threads, so that
+// the game threads don't spend their time in zlib.
+class TrainingDataWriterPool : public TrainingDataSink {
+ public:
+  // At most @max_queued_chunks chunks wait in the queue, Enqueue() blocks
+  // when it's full.
+  TrainingDataWriterPool(int num_threads, size_t max_queued_chunks);
+  // Writes the remaining files.
+  ~TrainingDataWriterPool() override;
+
+  // Queues @chunks to be written into @filename, @on_written is called after
+  // the file is closed. Files that fail to be written are logged and
+  // @on_written is not called for them.
+  void Enqueue(std::string filename, std::vector<V6TrainingData> chunks,
+               OnWritten on_written) override;
+  // Blocks until all the queued files are written.
+  void Wait() override;
+
+ private:
+  struct Job {
+    std::string filename;
+    std::vector<V6TrainingData> chunks;
+    OnWritten on_written;
+  };
+  void Worker();
+
+  const size_t max_queued_chunks_;
+  Mutex mutex_;
+  std::condition_variable job_added_;
+  std::condition_variable job_done_;
+  std::deque<Job> jobs_ GUARDED_BY(mutex_);
+  // Chunks in the queue, and files that are queued or being written.
+  size_t queued_chunks_ GUARDED_BY(mutex_) = 0;
+  int pending_files_ GUARDED_BY(mutex_) = 0;
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
 };
 
 }  // namespace lczero
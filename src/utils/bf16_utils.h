@@ -25,6 +25,11 @@
   Program grant you additional permission to convey the resulting work.
 */
 #pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
 namespace lczero {
 
 static inline uint16_t FP32toBF16(float f32) {
@@ -46,4 +51,16 @@ static inline float BF16toFP32(uint16_t bf16) {
   return f32;
 }
 
+// Bulk conversions of @count values. Plain loops, which the compilers
+// vectorize.
+static inline void ConvertFP32toBF16(const float* in, uint16_t* out,
+                                     size_t count) {
+  for (size_t i = 0; i < count; ++i) out[i] = FP32toBF16(in[i]);
+}
+
+static inline void ConvertBF16toFP32(const uint16_t* in, float* out,
+                                     size_t count) {
+  for (size_t i = 0; i < count; ++i) out[i] = BF16toFP32(in[i]);
+}
+
 }  // namespace lczero
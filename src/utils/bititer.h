@@ -88,6 +88,45 @@ inline uint64_t TransposeBitsInBytes(uint64_t v) {
   return v;
 }
 
+namespace detail {
+template <int transform>
+inline void TransformBitBoards(uint64_t* v, int n) {
+  // Separate passes with no branches inside, so that they vectorize.
+  if constexpr ((transform & FlipTransform) != 0) {
+    for (int i = 0; i < n; ++i) v[i] = ReverseBitsInBytes(v[i]);
+  }
+  if constexpr ((transform & MirrorTransform) != 0) {
+    for (int i = 0; i < n; ++i) v[i] = ReverseBytesInBytes(v[i]);
+  }
+  if constexpr ((transform & TransposeTransform) != 0) {
+    for (int i = 0; i < n; ++i) v[i] = TransposeBitsInBytes(v[i]);
+  }
+}
+}  // namespace detail
+
+// Applies the BoardTransform combination @transform to @n bitboards in place,
+// flip first, then mirror, then transpose.
+inline void TransformBitBoards(uint64_t* v, int n, int transform) {
+  switch (transform) {
+    case 0:
+      return;
+    case 1:
+      return detail::TransformBitBoards<1>(v, n);
+    case 2:
+      return detail::TransformBitBoards<2>(v, n);
+    case 3:
+      return detail::TransformBitBoards<3>(v, n);
+    case 4:
+      return detail::TransformBitBoards<4>(v, n);
+    case 5:
+      return detail::TransformBitBoards<5>(v, n);
+    case 6:
+      return detail::TransformBitBoards<6>(v, n);
+    case 7:
+      return detail::TransformBitBoards<7>(v, n);
+  }
+}
+
 // Iterates over all set bits of the value, lower to upper. The value of
 // dereferenced iterator is bit number (lower to upper, 0 bazed)
 template <typename T, typename Convert = std::identity>
@@ -0,0 +1,230 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/block_pool.h"
+
+#include <new>
+#include <vector>
+
+#include "utils/large_pages.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+namespace {
+
+constexpr int kNumClasses = BlockPool::kMaxBlockSize / BlockPool::kGranularity;
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+// A list of at most kBatchSize free blocks.
+struct Magazine {
+  FreeBlock* head = nullptr;
+  int count = 0;
+
+  void Push(void* ptr) {
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = head;
+    head = block;
+    ++count;
+  }
+  void* Pop() {
+    FreeBlock* block = head;
+    head = block->next;
+    --count;
+    return block;
+  }
+};
+
+std::align_val_t GetAlignment(size_t block_size) {
+  return std::align_val_t(block_size % BlockPool::kCacheLineSize == 0
+                              ? BlockPool::kCacheLineSize
+                              : BlockPool::kGranularity);
+}
+
+// Full (or, from exited threads, partially full) magazines shared by all
+// threads.
+class SharedPool {
+ public:
+  // Takes a magazine from the pool, or carves a new one from a new chunk.
+  Magazine Get(int size_class) {
+    {
+      Mutex::Lock lock(mutex_);
+      auto& magazines = magazines_[size_class];
+      if (!magazines.empty()) {
+        const Magazine result = magazines.back();
+        magazines.pop_back();
+        return result;
+      }
+    }
+    const size_t block_size = (size_class + 1) * BlockPool::kGranularity;
+    // When the chunk is aligned to the cache line, so are the blocks which
+    // are multiples of the cache line.
+    char* chunk = GetLargePagesEnabled()
+                      ? CarveChunk(block_size * BlockPool::kBatchSize)
+                      : static_cast<char*>(::operator new(
+                            block_size * BlockPool::kBatchSize,
+                            GetAlignment(block_size)));
+    // Pushed in reverse, so that the blocks are handed out in address order.
+    Magazine result;
+    for (int i = BlockPool::kBatchSize - 1; i >= 0; --i) {
+      result.Push(chunk + i * block_size);
+    }
+    return result;
+  }
+
+  void Put(int size_class, const Magazine& magazine) {
+    if (magazine.count == 0) return;
+    Mutex::Lock lock(mutex_);
+    magazines_[size_class].push_back(magazine);
+  }
+
+ private:
+  // Cuts a chunk from a large page region. The chunk sizes are multiples of
+  // the cache line, so the chunks stay aligned.
+  char* CarveChunk(size_t size) {
+    Mutex::Lock lock(mutex_);
+    if (region_left_ < size) {
+      region_ = static_cast<char*>(AllocateLargePages(kLargePageSize));
+      region_left_ = kLargePageSize;
+    }
+    char* result = region_;
+    region_ += size;
+    region_left_ -= size;
+    return result;
+  }
+
+  Mutex mutex_;
+  std::vector<Magazine> magazines_[kNumClasses] GUARDED_BY(mutex_);
+  char* region_ GUARDED_BY(mutex_) = nullptr;
+  size_t region_left_ GUARDED_BY(mutex_) = 0;
+};
+
+SharedPool* GetSharedPool() {
+  // Never destroyed, as blocks may be freed during the static destruction.
+  static SharedPool* pool = new SharedPool();
+  return pool;
+}
+
+// Free blocks cached by the thread. Every size class has a current magazine
+// which is used for allocations and frees, and a spare one to avoid moving
+// magazines to and from the shared pool when a thread alternates between
+// allocating and freeing at a magazine boundary.
+struct ThreadCache {
+  enum State : char { kUninitialized, kActive, kExited };
+  State state = kUninitialized;
+  Magazine current[kNumClasses];
+  Magazine spare[kNumClasses];
+};
+
+// Trivially destructible, so that it's still usable while the thread exits.
+thread_local ThreadCache tls_cache;
+
+// Returns the cached blocks of the thread to the shared pool on thread exit.
+struct ThreadCacheFlusher {
+  ~ThreadCacheFlusher() {
+    SharedPool* pool = GetSharedPool();
+    for (int i = 0; i < kNumClasses; ++i) {
+      pool->Put(i, tls_cache.current[i]);
+      pool->Put(i, tls_cache.spare[i]);
+      tls_cache.current[i] = Magazine();
+      tls_cache.spare[i] = Magazine();
+    }
+    tls_cache.state = ThreadCache::kExited;
+  }
+};
+
+void InitThreadCache() {
+  thread_local ThreadCacheFlusher flusher;
+  (void)flusher;
+  tls_cache.state = ThreadCache::kActive;
+}
+
+int GetSizeClass(size_t size) {
+  return size == 0 ? 0 : (size - 1) / BlockPool::kGranularity;
+}
+
+}  // namespace
+
+void* BlockPool::Allocate(size_t size) {
+  if (size > kMaxBlockSize) {
+    return ::operator new(size, GetAlignment(size));
+  }
+  const int size_class = GetSizeClass(size);
+  ThreadCache& cache = tls_cache;
+  if (cache.state != ThreadCache::kActive) {
+    if (cache.state == ThreadCache::kExited) {
+      // Don't cache anything anymore, as nothing would return it to the pool.
+      Magazine magazine = GetSharedPool()->Get(size_class);
+      void* result = magazine.Pop();
+      GetSharedPool()->Put(size_class, magazine);
+      return result;
+    }
+    InitThreadCache();
+  }
+  Magazine& current = cache.current[size_class];
+  if (current.count == 0) {
+    Magazine& spare = cache.spare[size_class];
+    if (spare.count > 0) {
+      std::swap(current, spare);
+    } else {
+      current = GetSharedPool()->Get(size_class);
+    }
+  }
+  return current.Pop();
+}
+
+void BlockPool::Free(void* ptr, size_t size) {
+  if (ptr == nullptr) return;
+  if (size > kMaxBlockSize) {
+    ::operator delete(ptr, GetAlignment(size));
+    return;
+  }
+  const int size_class = GetSizeClass(size);
+  ThreadCache& cache = tls_cache;
+  if (cache.state != ThreadCache::kActive) {
+    if (cache.state == ThreadCache::kExited) {
+      Magazine magazine;
+      magazine.Push(ptr);
+      GetSharedPool()->Put(size_class, magazine);
+      return;
+    }
+    InitThreadCache();
+  }
+  Magazine& current = cache.current[size_class];
+  if (current.count == kBatchSize) {
+    Magazine& spare = cache.spare[size_class];
+    if (spare.count > 0) GetSharedPool()->Put(size_class, spare);
+    spare = current;
+    current = Magazine();
+  }
+  current.Push(ptr);
+}
+
+}  // namespace lczero
@@ -0,0 +1,66 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+
+namespace lczero {
+
+// Allocator of small memory blocks, for objects which are created and
+// destroyed at very high rate from many threads (e.g. search tree nodes).
+//
+// Sizes are rounded up to a multiple of kGranularity, and every such size
+// class has its own free lists. Every thread keeps a cache of free blocks of
+// every class, which it allocates from and frees to without locking. The
+// blocks move between the thread caches and a shared pool in batches of
+// kBatchSize, so the blocks freed by one thread (e.g. a garbage collector)
+// are reused by the others. Memory is taken from the system in chunks of a
+// batch (cut from large pages when they are enabled, see
+// utils/large_pages.h), and is never returned to it.
+//
+// Blocks with size divisible by kCacheLineSize are aligned to the cache line,
+// so that e.g. 64 byte search tree nodes never straddle two lines and the
+// nodes of a solid children array take one line each.
+//
+// Blocks larger than kMaxBlockSize are passed to the global operator new.
+class BlockPool {
+ public:
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kCacheLineSize = 64;
+  static constexpr size_t kMaxBlockSize = 1024;
+  static constexpr int kBatchSize = 256;
+
+  // Returns a block of at least @size bytes, aligned to kGranularity (or to
+  // kCacheLineSize, see above).
+  static void* Allocate(size_t size);
+  // Frees a block returned by Allocate(@size). Can be called from any thread.
+  static void Free(void* ptr, size_t size);
+};
+
+}  // namespace lczero
@@ -0,0 +1,110 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/block_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(BlockPool, BlocksAreDistinctAndAligned) {
+  std::vector<void*> blocks;
+  std::set<void*> unique;
+  for (int i = 0; i < 3 * BlockPool::kBatchSize; ++i) {
+    void* ptr = BlockPool::Allocate(24);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % BlockPool::kGranularity, 0u);
+    std::memset(ptr, i & 0xFF, 24);
+    blocks.push_back(ptr);
+    unique.insert(ptr);
+  }
+  EXPECT_EQ(unique.size(), blocks.size());
+  for (void* ptr : blocks) BlockPool::Free(ptr, 24);
+}
+
+TEST(BlockPool, CacheLineSizedBlocksAreAligned) {
+  for (size_t size : {BlockPool::kCacheLineSize, 3 * BlockPool::kCacheLineSize,
+                      32 * BlockPool::kCacheLineSize}) {
+    std::vector<void*> blocks;
+    for (int i = 0; i < 10; ++i) {
+      void* ptr = BlockPool::Allocate(size);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % BlockPool::kCacheLineSize,
+                0u);
+      blocks.push_back(ptr);
+    }
+    for (void* ptr : blocks) BlockPool::Free(ptr, size);
+  }
+}
+
+TEST(BlockPool, FreedBlockIsReused) {
+  void* ptr = BlockPool::Allocate(64);
+  BlockPool::Free(ptr, 64);
+  EXPECT_EQ(BlockPool::Allocate(60), ptr);
+  BlockPool::Free(ptr, 60);
+}
+
+TEST(BlockPool, LargeBlocks) {
+  void* ptr = BlockPool::Allocate(BlockPool::kMaxBlockSize + 1);
+  std::memset(ptr, 0, BlockPool::kMaxBlockSize + 1);
+  BlockPool::Free(ptr, BlockPool::kMaxBlockSize + 1);
+}
+
+TEST(BlockPool, FreeFromAnotherThread) {
+  constexpr int kCount = 10 * BlockPool::kBatchSize;
+  std::vector<void*> blocks;
+  std::thread allocator([&]() {
+    for (int i = 0; i < kCount; ++i) blocks.push_back(BlockPool::Allocate(48));
+  });
+  allocator.join();
+  std::thread freer([&]() {
+    for (void* ptr : blocks) BlockPool::Free(ptr, 48);
+  });
+  freer.join();
+  // The blocks freed by the exited thread are available to other threads.
+  std::set<void*> freed(blocks.begin(), blocks.end());
+  int reused = 0;
+  std::vector<void*> again;
+  for (int i = 0; i < kCount; ++i) {
+    again.push_back(BlockPool::Allocate(48));
+    reused += freed.count(again.back());
+  }
+  EXPECT_EQ(reused, kCount);
+  for (void* ptr : again) BlockPool::Free(ptr, 48);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
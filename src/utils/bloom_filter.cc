@@ -0,0 +1,133 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/bloom_filter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "utils/exception.h"
+#include "utils/hashcat.h"
+
+namespace lczero {
+namespace {
+// File layout: magic, number of bits, bits per key, then the words.
+constexpr char kMagic[8] = {'L', 'C', '0', 'B', 'L', 'O', 'O', 'M'};
+}  // namespace
+
+BloomFilter::BloomFilter(uint64_t num_bits, int bits_per_key)
+    : num_words_(std::max<uint64_t>(1, (num_bits + 63) / 64)),
+      bits_per_key_(bits_per_key),
+      words_(new std::atomic<uint64_t>[num_words_]) {
+  for (uint64_t i = 0; i < num_words_; ++i) words_[i] = 0;
+}
+
+template <class F>
+void BloomFilter::ForEachBit(uint64_t key, F&& fn) const {
+  // Double hashing, the bits are h1 + i * h2 modulo the size.
+  const uint64_t num_bits = GetNumBits();
+  const uint64_t h1 = key % num_bits;
+  const uint64_t h2 = Hash(key) % num_bits | 1;
+  uint64_t bit = h1;
+  for (int i = 0; i < bits_per_key_; ++i) {
+    fn(words_[bit / 64], 1ULL << (bit % 64));
+    bit += h2;
+    if (bit >= num_bits) bit -= num_bits;
+  }
+}
+
+bool BloomFilter::TestAndInsert(uint64_t key) {
+  bool present = true;
+  ForEachBit(key, [&](std::atomic<uint64_t>& word, uint64_t mask) {
+    if ((word.fetch_or(mask, std::memory_order_relaxed) & mask) == 0) {
+      present = false;
+    }
+  });
+  return present;
+}
+
+bool BloomFilter::Contains(uint64_t key) const {
+  bool present = true;
+  ForEachBit(key, [&](const std::atomic<uint64_t>& word, uint64_t mask) {
+    if ((word.load(std::memory_order_relaxed) & mask) == 0) present = false;
+  });
+  return present;
+}
+
+bool BloomFilter::Load(const std::string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) return false;
+  char magic[sizeof(kMagic)];
+  uint64_t num_bits;
+  int32_t bits_per_key;
+  const bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+                  fread(&num_bits, sizeof(num_bits), 1, file) == 1 &&
+                  fread(&bits_per_key, sizeof(bits_per_key), 1, file) == 1;
+  if (!ok || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      num_bits != GetNumBits() || bits_per_key != bits_per_key_) {
+    fclose(file);
+    throw Exception("Incompatible bloom filter file " + filename);
+  }
+  std::vector<uint64_t> buffer(1 << 16);
+  for (uint64_t i = 0; i < num_words_;) {
+    const size_t count = std::min<uint64_t>(buffer.size(), num_words_ - i);
+    if (fread(buffer.data(), sizeof(uint64_t), count, file) != count) {
+      fclose(file);
+      throw Exception("Truncated bloom filter file " + filename);
+    }
+    for (size_t j = 0; j < count; ++j, ++i) words_[i] |= buffer[j];
+  }
+  fclose(file);
+  return true;
+}
+
+void BloomFilter::Save(const std::string& filename) const {
+  // Written next to the old file first, so that it's never left truncated.
+  const std::string tmp_filename = filename + ".tmp";
+  FILE* file = fopen(tmp_filename.c_str(), "wb");
+  if (!file) throw Exception("Unable to create " + tmp_filename);
+  const uint64_t num_bits = GetNumBits();
+  const int32_t bits_per_key = bits_per_key_;
+  bool ok = fwrite(kMagic, sizeof(kMagic), 1, file) == 1 &&
+            fwrite(&num_bits, sizeof(num_bits), 1, file) == 1 &&
+            fwrite(&bits_per_key, sizeof(bits_per_key), 1, file) == 1;
+  std::vector<uint64_t> buffer(1 << 16);
+  for (uint64_t i = 0; ok && i < num_words_;) {
+    const size_t count = std::min<uint64_t>(buffer.size(), num_words_ - i);
+    for (size_t j = 0; j < count; ++j, ++i) buffer[j] = words_[i];
+    ok = fwrite(buffer.data(), sizeof(uint64_t), count, file) == count;
+  }
+  if (fclose(file) != 0) ok = false;
+  if (!ok || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    throw Exception("Unable to write " + filename);
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,71 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace lczero {
+
+// Bloom filter of 64-bit keys (which are expected to be hashes already), to
+// remember very many keys in a fixed amount of memory. Thread-safe except
+// Load() and Save(). With 6 bits set per key, about 10 bits of the filter per
+// key give 1% of false positives.
+class BloomFilter {
+ public:
+  // The size is rounded up to a multiple of 64 bits.
+  BloomFilter(uint64_t num_bits, int bits_per_key = kDefaultBitsPerKey);
+
+  // Inserts @key, returns whether it (probably) was there already.
+  bool TestAndInsert(uint64_t key);
+  // Returns whether @key (probably) was inserted before.
+  bool Contains(uint64_t key) const;
+
+  uint64_t GetNumBits() const { return num_words_ * 64; }
+
+  // Adds the keys of a filter saved to @filename. Returns false if there is no
+  // such file, throws if it's a filter of a different size.
+  bool Load(const std::string& filename);
+  void Save(const std::string& filename) const;
+
+  static constexpr int kDefaultBitsPerKey = 6;
+
+ private:
+  // Calls @fn(word, mask) for every bit of @key.
+  template <class F>
+  void ForEachBit(uint64_t key, F&& fn) const;
+
+  const uint64_t num_words_;
+  const int bits_per_key_;
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+};
+
+}  // namespace lczero
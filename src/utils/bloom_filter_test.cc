@@ -0,0 +1,79 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/bloom_filter.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "utils/exception.h"
+#include "utils/hashcat.h"
+
+namespace lczero {
+
+TEST(BloomFilter, NoFalseNegatives) {
+  BloomFilter filter(1 << 16);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    EXPECT_FALSE(filter.TestAndInsert(Hash(i)));
+  }
+  for (uint64_t i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(filter.Contains(Hash(i)));
+    EXPECT_TRUE(filter.TestAndInsert(Hash(i)));
+  }
+  int false_positives = 0;
+  for (uint64_t i = 1000; i < 11000; ++i) {
+    false_positives += filter.Contains(Hash(i));
+  }
+  // About 0.1% expected at 65 bits per key.
+  EXPECT_LT(false_positives, 100);
+}
+
+TEST(BloomFilter, SaveAndLoad) {
+  const std::string filename = testing::TempDir() + "bloom_filter_test";
+  BloomFilter filter(1 << 12);
+  filter.TestAndInsert(Hash(1));
+  filter.Save(filename);
+
+  BloomFilter loaded(1 << 12);
+  EXPECT_FALSE(loaded.Load(filename + ".missing"));
+  EXPECT_TRUE(loaded.Load(filename));
+  EXPECT_TRUE(loaded.Contains(Hash(1)));
+  EXPECT_FALSE(loaded.Contains(Hash(2)));
+
+  BloomFilter other_size(1 << 13);
+  EXPECT_THROW(other_size.Load(filename), Exception);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
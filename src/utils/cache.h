@@ -29,9 +29,12 @@
 
 #include <cassert>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "utils/large_pages.h"
 #include "utils/mutex.h"
 
 namespace lczero {
@@ -175,7 +178,7 @@ class HashKeyedCache {
     EvictToCapacity(capacity);
     capacity_.store(capacity);
 
-    std::vector<Entry> new_hash(
+    decltype(hash_) new_hash(
         static_cast<size_t>(capacity * kLoadFactor + 1));
 
     if (size_ != 0) {
@@ -202,6 +205,16 @@ class HashKeyedCache {
     EvictToCapacity(0);
   }
 
+  // Calls @fn(key, const V&) for every element in the cache, holding the lock
+  // for the whole iteration.
+  template <class F>
+  void ForEach(F&& fn) const {
+    SpinMutex::Lock lock(mutex_);
+    for (const Entry& item : hash_) {
+      if (item.in_use) fn(item.key, *item.value);
+    }
+  }
+
   int GetSize() const {
     SpinMutex::Lock lock(mutex_);
     return size_;
@@ -279,11 +292,88 @@ class HashKeyedCache {
   // Fresh in back, stale at front.
   std::deque<uint64_t> GUARDED_BY(mutex_) insertion_order_;
   std::vector<Entry> GUARDED_BY(mutex_) evicted_;
-  std::vector<Entry> GUARDED_BY(mutex_) hash_;
+  std::vector<Entry, LargePageAllocator<Entry>> GUARDED_BY(mutex_) hash_;
 
   mutable SpinMutex mutex_;
 };
 
+// HashKeyedCache split into shards with independent locks, to reduce lock
+// contention when the cache is used by many threads at once. Every shard has
+// its own part of the capacity and its own FIFO eviction order. Pinning is done
+// on the shard which holds the key, e.g.
+//   HashKeyedCacheLock<V> lock(cache.GetShard(key), key);
+template <class V>
+class ShardedHashKeyedCache {
+ public:
+  ShardedHashKeyedCache(int capacity = 128, int num_shards = 1)
+      : capacity_(capacity) {
+    MakeShards(num_shards);
+  }
+
+  // Returns the shard responsible for the key.
+  HashKeyedCache<V>* GetShard(uint64_t key) {
+    // Lower bits of the key are used for the index within the shard, so use
+    // the upper ones to select the shard.
+    return shards_[(key >> 32) % shards_.size()].get();
+  }
+
+  void Insert(uint64_t key, std::unique_ptr<V> val) {
+    GetShard(key)->Insert(key, std::move(val));
+  }
+
+  bool ContainsKey(uint64_t key) { return GetShard(key)->ContainsKey(key); }
+
+  // Sets the total capacity of the cache, which is split evenly between the
+  // shards.
+  void SetCapacity(int capacity) {
+    capacity_.store(capacity);
+    for (auto& shard : shards_) shard->SetCapacity(GetShardCapacity());
+  }
+
+  // Changes the number of shards, dropping all the entries. Unlike other
+  // functions, is not thread-safe and no values may be pinned.
+  void SetNumShards(int num_shards) {
+    if (static_cast<size_t>(num_shards) == shards_.size()) return;
+    MakeShards(num_shards);
+  }
+
+  void Clear() {
+    for (auto& shard : shards_) shard->Clear();
+  }
+
+  // Calls @fn(key, const V&) for every element, one shard at a time.
+  template <class F>
+  void ForEach(F&& fn) const {
+    for (const auto& shard : shards_) shard->ForEach(fn);
+  }
+
+  int GetSize() const {
+    int size = 0;
+    for (const auto& shard : shards_) size += shard->GetSize();
+    return size;
+  }
+  int GetCapacity() const { return capacity_.load(std::memory_order_relaxed); }
+  int GetNumShards() const { return shards_.size(); }
+
+ private:
+  int GetShardCapacity() const {
+    const int num_shards = shards_.size();
+    return (GetCapacity() + num_shards - 1) / num_shards;
+  }
+
+  void MakeShards(int num_shards) {
+    assert(num_shards > 0);
+    shards_.clear();
+    shards_.resize(num_shards);
+    for (auto& shard : shards_) {
+      shard = std::make_unique<HashKeyedCache<V>>(GetShardCapacity());
+    }
+  }
+
+  std::atomic<int> capacity_;
+  std::vector<std::unique_ptr<HashKeyedCache<V>>> shards_;
+};
+
 // Convenience class for pinning cache items.
 template <class V>
 class HashKeyedCacheLock {
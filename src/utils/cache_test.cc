@@ -0,0 +1,130 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/cache.h"
+#include "utils/clock_cache.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+
+TEST(HashKeyedCache, InsertAndLookup) {
+  HashKeyedCache<int> cache(10);
+  cache.Insert(1, std::make_unique<int>(10));
+  cache.Insert(2, std::make_unique<int>(20));
+  EXPECT_TRUE(cache.ContainsKey(1));
+  EXPECT_FALSE(cache.ContainsKey(3));
+  HashKeyedCacheLock<int> lock(&cache, 2);
+  ASSERT_TRUE(lock.holds_value());
+  EXPECT_EQ(**lock, 20);
+}
+
+TEST(HashKeyedCache, FifoEviction) {
+  HashKeyedCache<int> cache(3);
+  for (int i = 0; i < 5; ++i) cache.Insert(i, std::make_unique<int>(i));
+  EXPECT_EQ(cache.GetSize(), 3);
+  EXPECT_FALSE(cache.ContainsKey(0));
+  EXPECT_FALSE(cache.ContainsKey(1));
+  EXPECT_TRUE(cache.ContainsKey(4));
+}
+
+TEST(ShardedHashKeyedCache, InsertAndLookup) {
+  ShardedHashKeyedCache<int> cache(1000, 8);
+  EXPECT_EQ(cache.GetNumShards(), 8);
+  for (uint64_t i = 0; i < 100; ++i) {
+    const uint64_t key = i * 0x9E3779B97F4A7C15ULL;
+    cache.Insert(key, std::make_unique<int>(i));
+  }
+  EXPECT_EQ(cache.GetSize(), 100);
+  for (uint64_t i = 0; i < 100; ++i) {
+    const uint64_t key = i * 0x9E3779B97F4A7C15ULL;
+    HashKeyedCacheLock<int> lock(cache.GetShard(key), key);
+    ASSERT_TRUE(lock.holds_value());
+    EXPECT_EQ(**lock, static_cast<int>(i));
+  }
+}
+
+TEST(ShardedHashKeyedCache, CapacityIsSplitBetweenShards) {
+  ShardedHashKeyedCache<int> cache(40, 4);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    cache.Insert(i * 0x9E3779B97F4A7C15ULL, std::make_unique<int>(i));
+  }
+  EXPECT_LE(cache.GetSize(), 40);
+  cache.SetCapacity(8);
+  EXPECT_LE(cache.GetSize(), 8);
+  cache.Clear();
+  EXPECT_EQ(cache.GetSize(), 0);
+}
+
+TEST(ShardedHashKeyedCache, SetNumShardsDropsEntries) {
+  ShardedHashKeyedCache<int> cache(100, 2);
+  cache.Insert(42, std::make_unique<int>(42));
+  cache.SetNumShards(2);
+  EXPECT_TRUE(cache.ContainsKey(42));
+  cache.SetNumShards(4);
+  EXPECT_EQ(cache.GetNumShards(), 4);
+  EXPECT_FALSE(cache.ContainsKey(42));
+  EXPECT_EQ(cache.GetCapacity(), 100);
+}
+
+TEST(ClockCache, InsertAndLookup) {
+  ClockCache<int> cache(100);
+  cache.Insert(7, 70);
+  cache.Insert(7, 71);
+  EXPECT_EQ(cache.GetSize(), 1);
+  int value = 0;
+  EXPECT_TRUE(cache.Lookup(7, [&](const int& v) {
+    value = v;
+    return true;
+  }));
+  EXPECT_EQ(value, 70);
+  EXPECT_FALSE(cache.ContainsKey(8));
+  cache.Clear();
+  EXPECT_FALSE(cache.ContainsKey(7));
+  EXPECT_EQ(cache.GetSize(), 0);
+}
+
+TEST(ClockCache, ReferencedEntriesSurviveEviction) {
+  // A single bucket, so that all keys compete for the same slots.
+  ClockCache<int> cache(1);
+  const uint64_t kStride = 1ULL << 32;
+  cache.Insert(0, 0);
+  for (uint64_t i = 1; i < 100; ++i) {
+    EXPECT_TRUE(cache.ContainsKey(0));
+    cache.Insert(i * kStride, i);
+  }
+  EXPECT_TRUE(cache.ContainsKey(0));
+  EXPECT_FALSE(cache.ContainsKey(1 * kStride));
+  EXPECT_LE(cache.GetSize(), cache.GetCapacity() + 13);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,196 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "utils/large_pages.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// A hash-keyed, set-associative cache. Thread-safe.
+// Keys are hashed into cache-line sized buckets, every bucket has its own lock
+// and holds fingerprints of the keys stored in its slots. Values are stored by
+// value in a slab preallocated for the full capacity, the slot index in the
+// slab is implied by the bucket and slot number, so lookups don't chase
+// pointers and inserts don't allocate. The slab and the buckets use large
+// pages when they are enabled.
+// Values are only accessible under the bucket lock, through Lookup() callback.
+// Eviction is CLOCK (second chance) within a bucket.
+// Does not support delete, and inserts to existing keys are silently ignored.
+template <class V>
+class ClockCache {
+ public:
+  ClockCache(int capacity = 128) { SetCapacity(capacity); }
+
+  // Inserts the element under key @key with value @val. Unless the key is
+  // already in the cache.
+  void Insert(uint64_t key, V&& val) {
+    if (buckets_.empty()) return;
+    const size_t bucket_idx = GetBucketIndex(key);
+    Bucket& bucket = buckets_[bucket_idx];
+    const uint32_t fingerprint = GetFingerprint(key);
+    SpinMutex::Lock lock(bucket.mutex);
+    int free_slot = -1;
+    for (int i = 0; i < kSlotsPerBucket; ++i) {
+      if (bucket.fingerprints[i] == fingerprint &&
+          slab_[bucket_idx * kSlotsPerBucket + i].key == key) {
+        // Already exists.
+        return;
+      }
+      if (free_slot < 0 && bucket.fingerprints[i] == 0) free_slot = i;
+    }
+    if (free_slot < 0) {
+      // Sweep the clock hand until an entry without a second chance is found.
+      while (bucket.referenced & (1u << bucket.hand)) {
+        bucket.referenced &= ~(1u << bucket.hand);
+        bucket.hand = (bucket.hand + 1) % kSlotsPerBucket;
+      }
+      free_slot = bucket.hand;
+      bucket.hand = (bucket.hand + 1) % kSlotsPerBucket;
+    } else {
+      size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    bucket.fingerprints[free_slot] = fingerprint;
+    bucket.referenced &= ~(1u << free_slot);
+    Slot& slot = slab_[bucket_idx * kSlotsPerBucket + free_slot];
+    slot.key = key;
+    slot.value = std::move(val);
+  }
+
+  // Checks whether a key exists. Of course the next moment the key may be
+  // evicted.
+  bool ContainsKey(uint64_t key) {
+    return Lookup(key, [](const V&) { return true; });
+  }
+
+  // Looks up the value by key, and if it's found, calls @fn(const V&) while
+  // holding the bucket lock. Returns false if key is not found, the return
+  // value of @fn otherwise.
+  template <class F>
+  bool Lookup(uint64_t key, F&& fn) {
+    if (buckets_.empty()) return false;
+    const size_t bucket_idx = GetBucketIndex(key);
+    Bucket& bucket = buckets_[bucket_idx];
+    const uint32_t fingerprint = GetFingerprint(key);
+    SpinMutex::Lock lock(bucket.mutex);
+    for (int i = 0; i < kSlotsPerBucket; ++i) {
+      if (bucket.fingerprints[i] != fingerprint) continue;
+      const Slot& slot = slab_[bucket_idx * kSlotsPerBucket + i];
+      if (slot.key != key) continue;
+      bucket.referenced |= 1u << i;
+      return fn(slot.value);
+    }
+    return false;
+  }
+
+  // Sets the capacity of the cache (rounded up to the whole number of
+  // buckets). All entries are dropped if the capacity changes. Unlike other
+  // functions, is not thread-safe.
+  void SetCapacity(int capacity) {
+    if (capacity < 0) capacity = 0;
+    const size_t num_buckets =
+        (capacity + kSlotsPerBucket - 1) / kSlotsPerBucket;
+    if (num_buckets == buckets_.size()) return;
+    decltype(buckets_)(num_buckets).swap(buckets_);
+    decltype(slab_)(num_buckets * kSlotsPerBucket).swap(slab_);
+    capacity_ = capacity;
+    size_.store(0, std::memory_order_relaxed);
+  }
+
+  // Clears the cache.
+  void Clear() {
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+      Bucket& bucket = buckets_[i];
+      SpinMutex::Lock lock(bucket.mutex);
+      for (int j = 0; j < kSlotsPerBucket; ++j) {
+        if (bucket.fingerprints[j] == 0) continue;
+        bucket.fingerprints[j] = 0;
+        // Release the memory possibly owned by the value.
+        slab_[i * kSlotsPerBucket + j].value = V();
+      }
+      bucket.referenced = 0;
+    }
+    size_.store(0, std::memory_order_relaxed);
+  }
+
+  // Calls @fn(key, const V&) for every element, holding the lock of one bucket
+  // at a time.
+  template <class F>
+  void ForEach(F&& fn) {
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+      Bucket& bucket = buckets_[i];
+      SpinMutex::Lock lock(bucket.mutex);
+      for (int j = 0; j < kSlotsPerBucket; ++j) {
+        if (bucket.fingerprints[j] == 0) continue;
+        const Slot& slot = slab_[i * kSlotsPerBucket + j];
+        fn(slot.key, slot.value);
+      }
+    }
+  }
+
+  int GetSize() const { return size_.load(std::memory_order_relaxed); }
+  int GetCapacity() const { return capacity_; }
+
+ private:
+  static constexpr int kSlotsPerBucket = 14;
+
+  struct alignas(64) Bucket {
+    // Zero means the slot is empty.
+    uint32_t fingerprints[kSlotsPerBucket] = {};
+    SpinMutex mutex;
+    // Bit per slot, set when the slot was accessed since the clock hand passed
+    // it last time.
+    uint16_t referenced = 0;
+    uint8_t hand = 0;
+  };
+  static_assert(sizeof(Bucket) == 64);
+
+  struct Slot {
+    uint64_t key = 0;
+    V value = V();
+  };
+
+  size_t GetBucketIndex(uint64_t key) const { return key % buckets_.size(); }
+  // Upper bits are independent from the bucket index. Never zero.
+  static uint32_t GetFingerprint(uint64_t key) {
+    return static_cast<uint32_t>(key >> 32) | 1;
+  }
+
+  int capacity_ = 0;
+  std::atomic<int> size_ = 0;
+  std::vector<Bucket, LargePageAllocator<Bucket>> buckets_;
+  std::vector<Slot, LargePageAllocator<Slot>> slab_;
+};
+
+}  // namespace lczero
@@ -27,9 +27,19 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <limits>
+
+// Define NO_SIMD to use the scalar softmax only.
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#include <immintrin.h>
+#elif !defined(NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace lczero {
 // These stunts are performed by trained professionals, do not try this at home.
@@ -104,4 +114,224 @@ inline float FastSign(const float a) {
 #endif
 }
 
+namespace fastmath_internal {
+
+// Vector versions of FastExp2() for the softmax below, bit-exact with the
+// scalar one. Every ISA provides the same set of static functions, which are
+// also used by the cpu kernels when they are built without ISPC.
+#if !defined(NO_SIMD) && defined(__AVX512F__)
+struct VecOps {
+  using V = __m512;
+  static constexpr size_t kWidth = 16;
+  static V Load(const float* p) { return _mm512_loadu_ps(p); }
+  static void Store(float* p, V v) { _mm512_storeu_ps(p, v); }
+  static V Set1(float a) { return _mm512_set1_ps(a); }
+  static V Add(V a, V b) { return _mm512_add_ps(a, b); }
+  static V Sub(V a, V b) { return _mm512_sub_ps(a, b); }
+  static V Mul(V a, V b) { return _mm512_mul_ps(a, b); }
+  static V Max(V a, V b) { return _mm512_max_ps(a, b); }
+  static float ReduceAdd(V v) { return _mm512_reduce_add_ps(v); }
+  static float ReduceMax(V v) { return _mm512_reduce_max_ps(v); }
+  static V Exp2(V a) {
+    const __mmask16 neg = _mm512_cmp_ps_mask(a, Set1(0.0f), _CMP_LT_OQ);
+    const __m512i exp =
+        _mm512_cvttps_epi32(_mm512_mask_sub_ps(a, neg, a, Set1(1.0f)));
+    const V f = Sub(a, _mm512_cvtepi32_ps(exp));
+    const V out = Add(Set1(1.0f),
+                      Mul(f, Add(Set1(0.6602339f), Mul(Set1(0.33976606f), f))));
+    const __m512i bits =
+        _mm512_add_epi32(_mm512_castps_si512(out), _mm512_slli_epi32(exp, 23));
+    const __mmask16 underflow =
+        _mm512_cmp_ps_mask(a, Set1(-126.0f), _CMP_LT_OQ);
+    return _mm512_maskz_mov_ps(~underflow, _mm512_castsi512_ps(bits));
+  }
+};
+#elif !defined(NO_SIMD) && defined(__AVX2__)
+struct VecOps {
+  using V = __m256;
+  static constexpr size_t kWidth = 8;
+  static V Load(const float* p) { return _mm256_loadu_ps(p); }
+  static void Store(float* p, V v) { _mm256_storeu_ps(p, v); }
+  static V Set1(float a) { return _mm256_set1_ps(a); }
+  static V Add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V Sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V Mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V Max(V a, V b) { return _mm256_max_ps(a, b); }
+  static float ReduceAdd(V v) {
+    __m128 x =
+        _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_add_ps(x, _mm_shuffle_ps(x, x, 1)));
+  }
+  static float ReduceMax(V v) {
+    __m128 x =
+        _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_max_ps(x, _mm_shuffle_ps(x, x, 1)));
+  }
+  static V Exp2(V a) {
+    const V neg = _mm256_cmp_ps(a, Set1(0.0f), _CMP_LT_OQ);
+    const __m256i exp =
+        _mm256_cvttps_epi32(Sub(a, _mm256_and_ps(neg, Set1(1.0f))));
+    const V f = Sub(a, _mm256_cvtepi32_ps(exp));
+    const V out = Add(Set1(1.0f),
+                      Mul(f, Add(Set1(0.6602339f), Mul(Set1(0.33976606f), f))));
+    const __m256i bits =
+        _mm256_add_epi32(_mm256_castps_si256(out), _mm256_slli_epi32(exp, 23));
+    const V underflow = _mm256_cmp_ps(a, Set1(-126.0f), _CMP_LT_OQ);
+    return _mm256_andnot_ps(underflow, _mm256_castsi256_ps(bits));
+  }
+};
+#elif !defined(NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+// SSE2 is always available on x86-64.
+struct VecOps {
+  using V = __m128;
+  static constexpr size_t kWidth = 4;
+  static V Load(const float* p) { return _mm_loadu_ps(p); }
+  static void Store(float* p, V v) { _mm_storeu_ps(p, v); }
+  static V Set1(float a) { return _mm_set1_ps(a); }
+  static V Add(V a, V b) { return _mm_add_ps(a, b); }
+  static V Sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V Mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V Max(V a, V b) { return _mm_max_ps(a, b); }
+  static float ReduceAdd(V v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ps(v, _mm_shuffle_ps(v, v, 1)));
+  }
+  static float ReduceMax(V v) {
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_max_ps(v, _mm_shuffle_ps(v, v, 1)));
+  }
+  static V Exp2(V a) {
+    const V neg = _mm_cmplt_ps(a, Set1(0.0f));
+    const __m128i exp = _mm_cvttps_epi32(Sub(a, _mm_and_ps(neg, Set1(1.0f))));
+    const V f = Sub(a, _mm_cvtepi32_ps(exp));
+    const V out = Add(Set1(1.0f),
+                      Mul(f, Add(Set1(0.6602339f), Mul(Set1(0.33976606f), f))));
+    const __m128i bits =
+        _mm_add_epi32(_mm_castps_si128(out), _mm_slli_epi32(exp, 23));
+    const V underflow = _mm_cmplt_ps(a, Set1(-126.0f));
+    return _mm_andnot_ps(underflow, _mm_castsi128_ps(bits));
+  }
+};
+#elif !defined(NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+struct VecOps {
+  using V = float32x4_t;
+  static constexpr size_t kWidth = 4;
+  static V Load(const float* p) { return vld1q_f32(p); }
+  static void Store(float* p, V v) { vst1q_f32(p, v); }
+  static V Set1(float a) { return vdupq_n_f32(a); }
+  static V Add(V a, V b) { return vaddq_f32(a, b); }
+  static V Sub(V a, V b) { return vsubq_f32(a, b); }
+  static V Mul(V a, V b) { return vmulq_f32(a, b); }
+  static V Max(V a, V b) { return vmaxq_f32(a, b); }
+  static float ReduceAdd(V v) { return vaddvq_f32(v); }
+  static float ReduceMax(V v) { return vmaxvq_f32(v); }
+  static V Exp2(V a) {
+    const uint32x4_t neg = vcltq_f32(a, Set1(0.0f));
+    const int32x4_t exp = vcvtq_s32_f32(
+        Sub(a, vreinterpretq_f32_u32(
+                   vandq_u32(neg, vreinterpretq_u32_f32(Set1(1.0f))))));
+    const V f = Sub(a, vcvtq_f32_s32(exp));
+    const V out = Add(Set1(1.0f),
+                      Mul(f, Add(Set1(0.6602339f), Mul(Set1(0.33976606f), f))));
+    const int32x4_t bits =
+        vaddq_s32(vreinterpretq_s32_f32(out), vshlq_n_s32(exp, 23));
+    const uint32x4_t underflow = vcltq_f32(a, Set1(-126.0f));
+    return vreinterpretq_f32_u32(
+        vbicq_u32(vreinterpretq_u32_s32(bits), underflow));
+  }
+};
+#else
+#define LCZERO_SCALAR_SOFTMAX
+#endif
+
+}  // namespace fastmath_internal
+
+// Returns the maximum of @n values, or the lowest float if @n is zero.
+inline float FastMax(const float* values, size_t n) {
+  size_t i = 0;
+  float result = std::numeric_limits<float>::lowest();
+#ifndef LCZERO_SCALAR_SOFTMAX
+  using Ops = fastmath_internal::VecOps;
+  constexpr size_t kWidth = Ops::kWidth;
+  const size_t vec_n = n - n % kWidth;
+  if (vec_n > 0) {
+    Ops::V vmax = Ops::Load(values);
+    for (i = kWidth; i < vec_n; i += kWidth) {
+      vmax = Ops::Max(vmax, Ops::Load(values + i));
+    }
+    result = Ops::ReduceMax(vmax);
+  }
+#endif
+  for (; i < n; ++i) result = std::max(result, values[i]);
+  return result;
+}
+
+// Finds the index of the largest of @n values (@best) and of the largest of
+// the rest (@second, or -1 if @n is 1), the first ones in case of ties. Same
+// result as a single scalar pass with strict comparisons, but without its
+// unpredictable branches. @n must be positive.
+inline void FindTopTwo(const float* values, int n, int* best, int* second) {
+  const float best_value = FastMax(values, n);
+  *best = 0;
+  while (*best < n - 1 && values[*best] != best_value) ++*best;
+  *second = -1;
+  if (n == 1) return;
+  const float second_value =
+      std::max(FastMax(values, *best),
+               FastMax(values + *best + 1, n - *best - 1));
+  *second = *best == 0 ? 1 : 0;
+  while (*second < n - 1 &&
+         (values[*second] != second_value || *second == *best)) {
+    ++*second;
+  }
+}
+
+// In-place softmax of @n values with the inverse temperature @inv_temperature,
+// using FastExp(). Values are scaled to sum to 1, unless they all underflow.
+inline void FastSoftmax(float* values, size_t n, float inv_temperature) {
+  size_t i = 0;
+  float max_p = -std::numeric_limits<float>::infinity();
+#ifndef LCZERO_SCALAR_SOFTMAX
+  using Ops = fastmath_internal::VecOps;
+  constexpr size_t kWidth = Ops::kWidth;
+  const size_t vec_n = n - n % kWidth;
+  if (vec_n > 0) {
+    Ops::V vmax = Ops::Load(values);
+    for (i = kWidth; i < vec_n; i += kWidth) {
+      vmax = Ops::Max(vmax, Ops::Load(values + i));
+    }
+    max_p = Ops::ReduceMax(vmax);
+  }
+#endif
+  for (; i < n; ++i) max_p = std::max(max_p, values[i]);
+
+  i = 0;
+  float total = 0.0f;
+  // 1/ln(2) is folded into the temperature, so that FastExp2() can be used.
+  const float scale = 1.442695040f * inv_temperature;
+#ifndef LCZERO_SCALAR_SOFTMAX
+  if (vec_n > 0) {
+    const Ops::V vscale = Ops::Set1(scale);
+    const Ops::V voffset = Ops::Set1(max_p);
+    Ops::V vtotal = Ops::Set1(0.0f);
+    for (; i < vec_n; i += kWidth) {
+      const Ops::V val =
+          Ops::Exp2(Ops::Mul(Ops::Sub(Ops::Load(values + i), voffset), vscale));
+      Ops::Store(values + i, val);
+      vtotal = Ops::Add(vtotal, val);
+    }
+    total = Ops::ReduceAdd(vtotal);
+  }
+#endif
+  for (; i < n; ++i) {
+    total += (values[i] = FastExp2((values[i] - max_p) * scale));
+  }
+
+  const float norm = total > 0.0f ? 1.0f / total : 1.0f;
+  // Simple enough for the compiler to vectorize.
+  for (i = 0; i < n; ++i) values[i] *= norm;
+}
+
 }  // namespace lczero
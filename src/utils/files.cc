@@ -25,13 +25,182 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "utils/files.h"
+
 #include <zlib.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <thread>
+#include <vector>
 
 #include "utils/exception.h"
 
 namespace lczero {
+namespace {
+
+// Size of the uncompressed content of a gzip member.
+constexpr size_t kGzipChunkSize = 16 * 1024 * 1024;
+// Gzip header with the FEXTRA flag set, and the extra field with a single
+// "LC" subfield holding the size of the whole member.
+constexpr size_t kMemberHeaderSize = 10 + 2 + 4 + 4;
+constexpr size_t kMemberTrailerSize = 8;
+
+void StoreLE32(uint32_t value, uint8_t* out) {
+  for (int i = 0; i < 4; ++i) out[i] = (value >> (8 * i)) & 0xff;
+}
+
+uint32_t LoadLE32(const uint8_t* in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) |
+         (static_cast<uint32_t>(in[3]) << 24);
+}
+
+// Calls @fn(i) for i in [0, n) from multiple threads.
+template <typename F>
+void ParallelFor(size_t n, F&& fn) {
+  const size_t num_threads =
+      std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    for (size_t i = next++; i < n; i = next++) fn(i);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+}
+
+std::vector<uint8_t> CompressMember(std::string_view chunk) {
+  z_stream strm = {};
+  if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw Exception("Cannot initialize compression");
+  }
+  std::vector<uint8_t> out(kMemberHeaderSize +
+                           deflateBound(&strm, chunk.size()) +
+                           kMemberTrailerSize);
+  strm.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(chunk.data()));
+  strm.avail_in = chunk.size();
+  strm.next_out = out.data() + kMemberHeaderSize;
+  strm.avail_out = out.size() - kMemberHeaderSize - kMemberTrailerSize;
+  const int ret = deflate(&strm, Z_FINISH);
+  const size_t compressed_size = strm.total_out;
+  deflateEnd(&strm);
+  if (ret != Z_STREAM_END) throw Exception("Cannot compress data");
+  out.resize(kMemberHeaderSize + compressed_size + kMemberTrailerSize);
+
+  // ID1, ID2, deflate, FEXTRA, no mtime, no extra flags, unknown OS.
+  const uint8_t header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255,
+                            8,    0,    'L', 'C', 4, 0};
+  std::copy(std::begin(header), std::end(header), out.begin());
+  StoreLE32(out.size(), out.data() + sizeof(header));
+  uint8_t* trailer = out.data() + out.size() - kMemberTrailerSize;
+  StoreLE32(crc32(0, reinterpret_cast<const Bytef*>(chunk.data()),
+                  chunk.size()),
+            trailer);
+  StoreLE32(chunk.size(), trailer + 4);
+  return out;
+}
+
+struct GzipMember {
+  std::span<const uint8_t> data;
+  size_t raw_offset;
+  size_t raw_size;
+};
+
+// Splits the data into members written by CompressMember(). Returns an empty
+// vector if the data is not entirely made of such members.
+std::vector<GzipMember> FindMembers(std::span<const uint8_t> data) {
+  std::vector<GzipMember> members;
+  size_t raw_offset = 0;
+  while (!data.empty()) {
+    if (data.size() < kMemberHeaderSize + kMemberTrailerSize ||
+        data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 || data[3] != 4 ||
+        data[10] != 8 || data[11] != 0 || data[12] != 'L' || data[13] != 'C' ||
+        data[14] != 4 || data[15] != 0) {
+      return {};
+    }
+    const size_t size = LoadLE32(data.data() + 16);
+    if (size < kMemberHeaderSize + kMemberTrailerSize || size > data.size()) {
+      return {};
+    }
+    const size_t raw_size = LoadLE32(data.data() + size - 4);
+    members.push_back({data.first(size), raw_offset, raw_size});
+    raw_offset += raw_size;
+    data = data.subspan(size);
+  }
+  return members;
+}
+
+void InflateMember(const GzipMember& member, uint8_t* out) {
+  const std::span<const uint8_t> compressed = member.data.subspan(
+      kMemberHeaderSize,
+      member.data.size() - kMemberHeaderSize - kMemberTrailerSize);
+  z_stream strm = {};
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+    throw Exception("Cannot initialize decompression");
+  }
+  strm.next_in = const_cast<Bytef*>(compressed.data());
+  strm.avail_in = compressed.size();
+  strm.next_out = out;
+  strm.avail_out = member.raw_size;
+  const int ret = inflate(&strm, Z_FINISH);
+  const size_t raw_size = strm.total_out;
+  inflateEnd(&strm);
+  if (ret != Z_STREAM_END || raw_size != member.raw_size ||
+      crc32(0, out, raw_size) !=
+          LoadLE32(member.data.data() + member.data.size() - 8)) {
+    throw Exception("Corrupted gzip data");
+  }
+}
+
+// Decompresses any gzip data, one member after another.
+std::string GunzipSequential(std::span<const uint8_t> data) {
+  z_stream strm = {};
+  if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+    throw Exception("Cannot initialize decompression");
+  }
+  std::string result;
+  // The size of the last member is a good guess for single member files.
+  // Deflate can't compress more than ~1032:1, so a bogus size is capped.
+  const size_t isize =
+      data.size() >= 4 ? LoadLE32(data.data() + data.size() - 4) : 0;
+  result.resize(std::max(data.size() * 2, std::min(isize, data.size() * 1032)));
+  strm.next_in = const_cast<Bytef*>(data.data());
+  strm.avail_in = data.size();
+  while (true) {
+    if (strm.total_out == result.size()) result.resize(result.size() * 2);
+    strm.next_out = reinterpret_cast<Bytef*>(result.data()) + strm.total_out;
+    strm.avail_out = result.size() - strm.total_out;
+    const int ret = inflate(&strm, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      // Concatenated members, unless it's trailing garbage.
+      if (strm.avail_in < 2 || strm.next_in[0] != 0x1f ||
+          strm.next_in[1] != 0x8b) {
+        break;
+      }
+      const size_t total_out = strm.total_out;
+      inflateReset(&strm);
+      strm.total_out = total_out;
+      continue;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      inflateEnd(&strm);
+      throw Exception("Corrupted gzip data");
+    }
+    if (ret == Z_BUF_ERROR && strm.avail_out > 0) {
+      inflateEnd(&strm);
+      throw Exception("Truncated gzip data");
+    }
+  }
+  result.resize(strm.total_out);
+  inflateEnd(&strm);
+  return result;
+}
+
+}  // namespace
 
 std::string ReadFileToString(const std::string& filename) {
   std::string result;
@@ -71,14 +240,36 @@ void WriteStringToFile(const std::string& filename,
 
 void WriteStringToGzFile(const std::string& filename,
                          std::string_view content) {
-  gzFile f = gzopen(filename.c_str(), "wb");
+  std::vector<std::vector<uint8_t>> members(
+      std::max<size_t>(1, (content.size() + kGzipChunkSize - 1) /
+                              kGzipChunkSize));
+  ParallelFor(members.size(), [&](size_t i) {
+    members[i] = CompressMember(content.substr(i * kGzipChunkSize,
+                                               kGzipChunkSize));
+  });
+  std::FILE* f = std::fopen(filename.c_str(), "wb");
   if (f == nullptr)
     throw Exception("Cannot open gzfile for write: " + filename);
-  if (gzwrite(f, content.data(), content.size()) !=
-      static_cast<int>(content.size())) {
-    throw Exception("Cannot write to file: " + filename);
+  for (const auto& member : members) {
+    if (std::fwrite(member.data(), member.size(), 1, f) != 1) {
+      std::fclose(f);
+      throw Exception("Cannot write to file: " + filename);
+    }
   }
-  gzclose(f);
+  if (std::fclose(f) != 0) throw Exception("Cannot write to file: " + filename);
+}
+
+std::string GunzipBuffer(std::span<const uint8_t> data) {
+  const std::vector<GzipMember> members = FindMembers(data);
+  if (members.empty()) return GunzipSequential(data);
+  std::string result;
+  result.resize(members.back().raw_offset + members.back().raw_size);
+  ParallelFor(members.size(), [&](size_t i) {
+    InflateMember(members[i],
+                  reinterpret_cast<uint8_t*>(result.data()) +
+                      members[i].raw_offset);
+  });
+  return result;
 }
 
 }  // namespace lczero
\ No newline at end of file
@@ -25,7 +25,10 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
 
 namespace lczero {
 
@@ -37,6 +40,15 @@ void WriteStringToFile(const std::string& filename,
                          std::string_view  content);
 
 // Writes string to gz-compressed file. Throws on error.
+// The file is written as a sequence of independently compressed gzip members,
+// each of them recording its compressed size in the gzip extra field, so that
+// GunzipBuffer() can decompress them in parallel. Standard gzip tools read it
+// as usual.
 void WriteStringToGzFile(const std::string& filename,
                          std::string_view  content);
+
+// Decompresses gzip data (possibly of multiple members) held in memory.
+// Members written by WriteStringToGzFile() are decompressed in parallel.
+// Throws on error.
+std::string GunzipBuffer(std::span<const uint8_t> data);
 }  // namespace lczero
@@ -0,0 +1,96 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/files.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <cstdio>
+
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+
+namespace lczero {
+namespace {
+
+std::string MakeContent(size_t size) {
+  std::string content(size, '\0');
+  uint32_t x = 12345;
+  for (auto& c : content) {
+    x = x * 1103515245 + 12345;
+    // Low entropy, so that it compresses.
+    c = 'a' + (x >> 28);
+  }
+  return content;
+}
+
+std::string GunzipFile(const std::string& filename) {
+  MappedFile file(filename);
+  return GunzipBuffer(file.data());
+}
+
+}  // namespace
+
+TEST(Gzip, RoundTripMultipleMembers) {
+  const std::string filename = testing::TempDir() + "files_test_members.gz";
+  const std::string content = MakeContent(40 * 1024 * 1024 + 123);
+  WriteStringToGzFile(filename, content);
+  EXPECT_EQ(GunzipFile(filename), content);
+  // Standard readers see the concatenation of the members.
+  EXPECT_EQ(ReadFileToString(filename), content);
+  std::remove(filename.c_str());
+}
+
+TEST(Gzip, ReadsStandardGzip) {
+  const std::string filename = testing::TempDir() + "files_test_plain.gz";
+  const std::string content = MakeContent(100000);
+  gzFile f = gzopen(filename.c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  gzwrite(f, content.data(), content.size());
+  gzclose(f);
+  EXPECT_EQ(GunzipFile(filename), content);
+  std::remove(filename.c_str());
+}
+
+TEST(Gzip, DetectsCorruption) {
+  const std::string filename = testing::TempDir() + "files_test_bad.gz";
+  WriteStringToGzFile(filename, MakeContent(100000));
+  MappedFile file(filename);
+  std::vector<uint8_t> data(file.data().begin(), file.data().end());
+  data[data.size() / 2] ^= 0xff;
+  EXPECT_THROW(GunzipBuffer(data), Exception);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
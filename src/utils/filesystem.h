@@ -29,6 +29,7 @@
 
 #include <cstdint>
 #include <ctime>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -48,6 +49,23 @@ uint64_t GetFileSize(const std::string& filename);
 // Returns modification time of a file, 0 if file doesn't exist or can't be read.
 time_t GetFileTime(const std::string& filename);
 
+// Read-only memory mapping of a whole file. Throws exception if the file cannot
+// be mapped.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::span<const uint8_t> data() const { return {data_, size_}; }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  void* mapping_ = nullptr;  // Only used on Windows.
+};
+
 // Returns the base directory relative to which user specific non-essential data
 // files are stored or an empty string if unspecified.
 std::string GetUserCacheDirectory();
@@ -31,7 +31,10 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 namespace lczero {
 
@@ -85,6 +88,30 @@ time_t GetFileTime(const std::string& filename) {
 #endif
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) throw Exception("Cannot open file: " + filename);
+  struct stat s;
+  if (fstat(fd, &s) < 0) {
+    ::close(fd);
+    throw Exception("Cannot stat file: " + filename);
+  }
+  size_ = s.st_size;
+  if (size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      throw Exception("Could not mmap() " + filename);
+    }
+    data_ = static_cast<const uint8_t*>(data);
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+}
+
 namespace {
 bool CheckDir(const std::string& dirname) {
   struct stat s;
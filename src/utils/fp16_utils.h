@@ -26,6 +26,7 @@
 */
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
@@ -38,6 +39,10 @@
 #define NO_F16C
 #endif
 
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
 namespace lczero {
 
 #if defined(NO_POPCNT) || defined(NO_F16C) || \
@@ -92,6 +97,27 @@ inline float FP16toFP32(uint16_t f16) {
   return f;
 }
 
+// Bulk conversions of @count values.
+inline void ConvertFP32toFP16(const float* in, uint16_t* out, size_t count) {
+  size_t i = 0;
+#if defined(__aarch64__) || defined(_M_ARM64)
+  for (; i + 4 <= count; i += 4) {
+    vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + i))));
+  }
+#endif
+  for (; i < count; ++i) out[i] = FP32toFP16(in[i]);
+}
+
+inline void ConvertFP16toFP32(const uint16_t* in, float* out, size_t count) {
+  size_t i = 0;
+#if defined(__aarch64__) || defined(_M_ARM64)
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(out + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + i))));
+  }
+#endif
+  for (; i < count; ++i) out[i] = FP16toFP32(in[i]);
+}
+
 #else
 
 inline uint16_t FP32toFP16(float f32) {
@@ -107,6 +133,37 @@ inline float FP16toFP32(uint16_t f16) {
   return _mm_cvtss_f32(A);
 }
 
+// Bulk conversions of @count values.
+inline void ConvertFP32toFP16(const float* in, uint16_t* out, size_t count) {
+  size_t i = 0;
+#ifdef __AVX512F__
+  for (; i + 16 <= count; i += 16) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm512_cvtps_ph(_mm512_loadu_ps(in + i), 0));
+  }
+#endif
+  for (; i + 8 <= count; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(in + i), 0));
+  }
+  for (; i < count; ++i) out[i] = FP32toFP16(in[i]);
+}
+
+inline void ConvertFP16toFP32(const uint16_t* in, float* out, size_t count) {
+  size_t i = 0;
+#ifdef __AVX512F__
+  for (; i + 16 <= count; i += 16) {
+    _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256(
+                                  reinterpret_cast<const __m256i*>(in + i))));
+  }
+#endif
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                                  reinterpret_cast<const __m128i*>(in + i))));
+  }
+  for (; i < count; ++i) out[i] = FP16toFP32(in[i]);
+}
+
 #endif
 
 }  // namespace lczero
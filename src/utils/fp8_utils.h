@@ -27,6 +27,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
@@ -97,6 +98,11 @@ inline float FP8E5M2toFP32(uint8_t f8) {
   return f;
 }
 
+// Bulk conversion of @count values.
+inline void ConvertFP8E5M2toFP32(const uint8_t* in, float* out, size_t count) {
+  for (size_t i = 0; i < count; ++i) out[i] = FP8E5M2toFP32(in[i]);
+}
+
 #else
 
 inline float FP8E5M2toFP32(uint8_t f8) {
@@ -106,6 +112,18 @@ inline float FP8E5M2toFP32(uint8_t f8) {
   return _mm_cvtss_f32(A);
 }
 
+// Bulk conversion of @count values. E5M2 is the upper byte of an fp16.
+inline void ConvertFP8E5M2toFP32(const uint8_t* in, float* out, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i bytes =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i halves = _mm_unpacklo_epi8(_mm_setzero_si128(), bytes);
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(halves));
+  }
+  for (; i < count; ++i) out[i] = FP8E5M2toFP32(in[i]);
+}
+
 #endif
 
 inline uint8_t FP32toFP8E4M3FN(float f32, bool saturate = true) {
@@ -137,6 +155,10 @@ inline uint8_t FP32toFP8E4M3FN(float f32, bool saturate = true) {
   return x | sign;
 }
 
+inline uint8_t FP32toFP8E4M3FN_Saturate(float f32) {
+  return FP32toFP8E4M3FN(f32, true);
+}
+
 inline float FP8E4M3FNtoFP32(uint8_t f8) {
   unsigned int x;
   float f;
@@ -154,4 +176,10 @@ inline float FP8E4M3FNtoFP32(uint8_t f8) {
   return f;
 }
 
+// Bulk conversion of @count values.
+inline void ConvertFP8E4M3FNtoFP32(const uint8_t* in, float* out,
+                                   size_t count) {
+  for (size_t i = 0; i < count; ++i) out[i] = FP8E4M3FNtoFP32(in[i]);
+}
+
 }  // namespace lczero
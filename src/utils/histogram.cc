@@ -66,6 +66,7 @@ Histogram::Histogram(int min_exp, int max_exp, int minor_scales)
 void Histogram::Clear() {
   std::fill(buckets_.begin(), buckets_.end(), 0);
   total_ = 0;
+  sum_ = 0;
   max_ = 0;
 }
 
@@ -73,9 +74,27 @@ void Histogram::Add(double value) {
   const int index = GetIndex(std::abs(value));
   const int count = ++buckets_[index];
   total_++;
+  sum_ += value;
   if (count > max_) max_ = count;
 }
 
+double Histogram::GetQuantile(double q) const {
+  if (total_ == 0) return 0;
+  double count = 0;
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    count += buckets_[i];
+    if (count >= q * total_) return GetBucketUpperBound(i);
+  }
+  return GetBucketUpperBound(buckets_.size() - 1);
+}
+
+double Histogram::GetBucketUpperBound(size_t idx) const {
+  // Inverse of GetIndex(), first two buckets hold everything below the scale.
+  if (idx + 1 >= buckets_.size()) return INFINITY;
+  const int index = std::max<int>(idx, 1) - 2;
+  return std::pow(10.0, min_exp_ + (index - 1.5) / minor_scales_);
+}
+
 void Histogram::Dump() const {
   const double ymax = 0.02 + max_ / (double)total_;
   for (int i = 0; i < 100; i++) {
@@ -70,6 +70,20 @@ class Histogram {
   // Dumps the histogram to stderr.
   void Dump() const;
 
+  // Number of samples and their sum.
+  double GetCount() const { return total_; }
+  double GetSum() const { return sum_; }
+
+  // Returns the upper bound of the bucket holding the q-quantile sample, or 0
+  // for an empty histogram.
+  double GetQuantile(double q) const;
+
+  // Buckets in the increasing order of values, for the export. The upper bound
+  // of the last bucket is infinity.
+  size_t GetNumBuckets() const { return buckets_.size(); }
+  double GetBucketCount(size_t idx) const { return buckets_[idx]; }
+  double GetBucketUpperBound(size_t idx) const;
+
  private:
   int GetIndex(double val) const;
 
@@ -84,6 +98,7 @@ class Histogram {
   const int total_scales_;
   std::vector<double> buckets_;
   double total_;
+  double sum_;
   double max_;
 };
 
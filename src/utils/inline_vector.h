@@ -0,0 +1,211 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+namespace lczero {
+
+// Vector which keeps up to N elements inline, without a heap allocation, and
+// moves them to the heap only when it grows beyond that. Only for trivially
+// copyable types, which are moved around with memcpy. Supports the subset of
+// the std::vector interface that the code uses.
+template <typename T, size_t N>
+class InlineVector {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  using value_type = T;
+  using size_type = size_t;
+  using difference_type = ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  InlineVector() = default;
+  explicit InlineVector(size_t size, const T& value = T()) {
+    resize(size, value);
+  }
+  InlineVector(std::initializer_list<T> values)
+      : InlineVector(values.begin(), values.end()) {}
+  template <typename InputIt,
+            typename = typename std::iterator_traits<InputIt>::value_type>
+  InlineVector(InputIt first, InputIt last) {
+    for (; first != last; ++first) push_back(*first);
+  }
+  InlineVector(const InlineVector& other) { *this = other; }
+  InlineVector(InlineVector&& other) noexcept { *this = std::move(other); }
+  ~InlineVector() { FreeHeap(); }
+
+  InlineVector& operator=(const InlineVector& other) {
+    if (this == &other) return *this;
+    size_ = 0;
+    reserve(other.size_);
+    std::memcpy(static_cast<void*>(data_), other.data_, other.size_ * sizeof(T));
+    size_ = other.size_;
+    return *this;
+  }
+  InlineVector& operator=(InlineVector&& other) noexcept {
+    if (this == &other) return *this;
+    if (!other.is_inline()) {
+      // Steal the heap buffer.
+      FreeHeap();
+      data_ = other.data_;
+      capacity_ = other.capacity_;
+      size_ = other.size_;
+      other.data_ = other.inline_data();
+      other.capacity_ = N;
+      other.size_ = 0;
+      return *this;
+    }
+    *this = static_cast<const InlineVector&>(other);
+    other.size_ = 0;
+    return *this;
+  }
+
+  bool operator==(const InlineVector& other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+  bool operator!=(const InlineVector& other) const { return !(*this == other); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return capacity_; }
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+
+  iterator begin() { return data_; }
+  iterator end() { return data_ + size_; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+
+  T& operator[](size_t idx) { return data_[idx]; }
+  const T& operator[](size_t idx) const { return data_[idx]; }
+  T& front() { return data_[0]; }
+  const T& front() const { return data_[0]; }
+  T& back() { return data_[size_ - 1]; }
+  const T& back() const { return data_[size_ - 1]; }
+
+  void reserve(size_t capacity) {
+    if (capacity <= capacity_) return;
+    capacity = std::max(capacity, 2 * capacity_);
+    T* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+    std::memcpy(static_cast<void*>(data), data_, size_ * sizeof(T));
+    FreeHeap();
+    data_ = data;
+    capacity_ = capacity;
+  }
+  void clear() { size_ = 0; }
+  void resize(size_t size, const T& value = T()) {
+    reserve(size);
+    std::uninitialized_fill(data_ + std::min(size, size_), data_ + size,
+                            value);
+    size_ = size;
+  }
+
+  void push_back(const T& value) {
+    if (size_ == capacity_) {
+      // @value may point into the vector.
+      const T copy = value;
+      reserve(size_ + 1);
+      data_[size_++] = copy;
+      return;
+    }
+    data_[size_++] = value;
+  }
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    push_back(T(std::forward<Args>(args)...));
+    return back();
+  }
+  void pop_back() { --size_; }
+
+  iterator insert(const_iterator pos, const T& value) {
+    return insert(pos, &value, &value + 1);
+  }
+  template <typename InputIt>
+  iterator insert(const_iterator pos, InputIt first, InputIt last) {
+    const size_t idx = pos - data_;
+    // Copied first, as the range may point into the vector.
+    const InlineVector values(first, last);
+    reserve(size_ + values.size());
+    std::memmove(static_cast<void*>(data_ + idx + values.size()), data_ + idx,
+                 (size_ - idx) * sizeof(T));
+    std::memcpy(static_cast<void*>(data_ + idx), values.data(),
+                values.size() * sizeof(T));
+    size_ += values.size();
+    return data_ + idx;
+  }
+  iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+  iterator erase(const_iterator first, const_iterator last) {
+    const size_t idx = first - data_;
+    const size_t count = last - first;
+    std::memmove(static_cast<void*>(data_ + idx), last,
+                 (end() - last) * sizeof(T));
+    size_ -= count;
+    return data_ + idx;
+  }
+
+ private:
+  T* inline_data() { return reinterpret_cast<T*>(inline_); }
+  bool is_inline() const {
+    return data_ == reinterpret_cast<const T*>(inline_);
+  }
+  void FreeHeap() {
+    if (!is_inline()) ::operator delete(data_);
+  }
+
+  T* data_ = inline_data();
+  size_t size_ = 0;
+  size_t capacity_ = N;
+  alignas(T) unsigned char inline_[N * sizeof(T)];
+};
+
+}  // namespace lczero
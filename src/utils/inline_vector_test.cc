@@ -0,0 +1,96 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/inline_vector.h"
+
+#include <gtest/gtest.h>
+
+#include <iterator>
+#include <numeric>
+
+namespace lczero {
+
+using SmallVector = InlineVector<int, 4>;
+
+TEST(InlineVector, StaysInline) {
+  SmallVector vec = {1, 2, 3};
+  const int* data = vec.data();
+  vec.push_back(4);
+  EXPECT_EQ(vec.data(), data);
+  EXPECT_EQ(vec.capacity(), 4u);
+  EXPECT_EQ(vec, SmallVector({1, 2, 3, 4}));
+}
+
+TEST(InlineVector, SpillsToHeap) {
+  SmallVector vec;
+  for (int i = 0; i < 100; ++i) vec.push_back(i);
+  ASSERT_EQ(vec.size(), 100u);
+  EXPECT_GE(vec.capacity(), 100u);
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(vec[i], i);
+  // Pushing an element of the vector itself while it grows.
+  SmallVector small = {7, 8, 9, 10};
+  small.push_back(small[0]);
+  EXPECT_EQ(small, SmallVector({7, 8, 9, 10, 7}));
+}
+
+TEST(InlineVector, CopyAndMove) {
+  for (size_t size : {3, 10}) {
+    SmallVector vec(size);
+    std::iota(vec.begin(), vec.end(), 0);
+    SmallVector copy = vec;
+    EXPECT_EQ(copy, vec);
+    SmallVector moved = std::move(copy);
+    EXPECT_EQ(moved, vec);
+    EXPECT_TRUE(copy.empty());
+    copy = moved;
+    EXPECT_EQ(copy, vec);
+    moved = SmallVector{42};
+    EXPECT_EQ(moved, SmallVector({42}));
+  }
+}
+
+TEST(InlineVector, InsertAndErase) {
+  SmallVector vec = {1, 5};
+  const int values[] = {2, 3, 4};
+  vec.insert(vec.begin() + 1, std::begin(values), std::end(values));
+  EXPECT_EQ(vec, SmallVector({1, 2, 3, 4, 5}));
+  vec.insert(vec.end(), vec.begin(), vec.begin() + 2);
+  EXPECT_EQ(vec, SmallVector({1, 2, 3, 4, 5, 1, 2}));
+  vec.erase(vec.begin(), vec.begin() + 4);
+  EXPECT_EQ(vec, SmallVector({5, 1, 2}));
+  vec.erase(vec.begin() + 1);
+  EXPECT_EQ(vec, SmallVector({5, 2}));
+  vec.resize(4, 9);
+  EXPECT_EQ(vec, SmallVector({5, 2, 9, 9}));
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,177 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/large_pages.h"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+#include "utils/logging.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace lczero {
+namespace {
+
+std::atomic<bool> large_pages_enabled = false;
+
+enum class PageKind { kHugeTlb, kTransparent, kRegular };
+
+void ReportPageKind(PageKind kind) {
+  static std::atomic<int> reported = 0;
+  const int bit = 1 << static_cast<int>(kind);
+  if (reported.fetch_or(bit, std::memory_order_relaxed) & bit) return;
+  switch (kind) {
+    case PageKind::kHugeTlb:
+      CERR << "Using large pages.";
+      break;
+    case PageKind::kTransparent:
+      CERR << "Large pages are not reserved, using transparent huge pages.";
+      break;
+    case PageKind::kRegular:
+      CERR << "Large pages are not available, using regular pages.";
+      break;
+  }
+}
+
+size_t RoundUp(size_t size) {
+  return (size + kLargePageSize - 1) / kLargePageSize * kLargePageSize;
+}
+
+#ifdef _WIN32
+// Large pages need the "Lock pages in memory" privilege, which has to be
+// enabled in the process token even when the user has it.
+bool EnableLockMemoryPrivilege() {
+  static const bool enabled = []() {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(),
+                          TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+      return false;
+    }
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool result =
+        LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME,
+                             &privileges.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr,
+                              nullptr) &&
+        GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return result;
+  }();
+  return enabled;
+}
+#endif
+
+}  // namespace
+
+void SetLargePagesEnabled(bool enabled) {
+  large_pages_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool GetLargePagesEnabled() {
+  return large_pages_enabled.load(std::memory_order_relaxed);
+}
+
+void* AllocateLargePages(size_t size) {
+  size = RoundUp(size);
+  const bool enabled = GetLargePagesEnabled();
+#if defined(__linux__)
+  if (enabled) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      ReportPageKind(PageKind::kHugeTlb);
+      return ptr;
+    }
+  }
+  // Over-allocate to align the memory, so that transparent huge pages can
+  // back all of it.
+  const size_t padded = size + kLargePageSize;
+  void* raw = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) throw std::bad_alloc();
+  char* begin = static_cast<char*>(raw);
+  char* ptr = begin + RoundUp(reinterpret_cast<uintptr_t>(begin)) -
+              reinterpret_cast<uintptr_t>(begin);
+  if (ptr != begin) munmap(begin, ptr - begin);
+  if (ptr + size != begin + padded) {
+    munmap(ptr + size, begin + padded - (ptr + size));
+  }
+  if (enabled) {
+    ReportPageKind(madvise(ptr, size, MADV_HUGEPAGE) == 0
+                       ? PageKind::kTransparent
+                       : PageKind::kRegular);
+  }
+  return ptr;
+#elif defined(_WIN32)
+  if (enabled) {
+    const size_t minimum = GetLargePageMinimum();
+    if (minimum != 0 && size % minimum == 0 && EnableLockMemoryPrivilege()) {
+      void* ptr = VirtualAlloc(nullptr, size,
+                               MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                               PAGE_READWRITE);
+      if (ptr != nullptr) {
+        ReportPageKind(PageKind::kHugeTlb);
+        return ptr;
+      }
+    }
+    ReportPageKind(PageKind::kRegular);
+  }
+  void* ptr =
+      VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+#else
+  if (enabled) ReportPageKind(PageKind::kRegular);
+  return ::operator new(size, std::align_val_t(kLargePageSize));
+#endif
+}
+
+void FreeLargePages(void* ptr, size_t size) {
+  if (ptr == nullptr) return;
+#if defined(__linux__)
+  munmap(ptr, RoundUp(size));
+#elif defined(_WIN32)
+  (void)size;
+  VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+  (void)size;
+  ::operator delete(ptr, std::align_val_t(kLargePageSize));
+#endif
+}
+
+}  // namespace lczero
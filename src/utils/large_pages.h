@@ -0,0 +1,82 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+namespace lczero {
+
+// Large (huge) pages for big, randomly accessed allocations, to save TLB
+// misses. Allocations of at least kLargePageSize bytes are taken directly from
+// the system rounded up to the whole number of large pages; when large pages
+// are enabled, they are requested for them (hugetlb or transparent huge pages
+// on Linux, MEM_LARGE_PAGES on Windows), falling back to regular pages if the
+// system doesn't give them. Whether they were obtained is logged once.
+constexpr size_t kLargePageSize = 2 * 1024 * 1024;
+
+// Off by default. Only affects the allocations done after the call.
+void SetLargePagesEnabled(bool enabled);
+bool GetLargePagesEnabled();
+
+// Allocates @size bytes aligned to kLargePageSize. Throws std::bad_alloc.
+void* AllocateLargePages(size_t size);
+// Frees memory returned by AllocateLargePages(@size).
+void FreeLargePages(void* ptr, size_t size);
+
+// Allocator for containers which are large, e.g. hash tables. Allocations
+// smaller than a large page are passed to std::allocator.
+template <class T>
+class LargePageAllocator {
+ public:
+  using value_type = T;
+
+  LargePageAllocator() = default;
+  template <class U>
+  LargePageAllocator(const LargePageAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if (n * sizeof(T) < kLargePageSize) return std::allocator<T>().allocate(n);
+    return static_cast<T*>(AllocateLargePages(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t n) {
+    if (n * sizeof(T) < kLargePageSize) {
+      std::allocator<T>().deallocate(ptr, n);
+    } else {
+      FreeLargePages(ptr, n * sizeof(T));
+    }
+  }
+
+  template <class U>
+  bool operator==(const LargePageAllocator<U>&) const {
+    return true;
+  }
+};
+
+}  // namespace lczero
@@ -0,0 +1,73 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/large_pages.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace lczero {
+
+TEST(LargePages, AllocationsAreAlignedAndUsable) {
+  for (bool enabled : {false, true}) {
+    SetLargePagesEnabled(enabled);
+    for (size_t size : {kLargePageSize, 3 * kLargePageSize + 100}) {
+      char* ptr = static_cast<char*>(AllocateLargePages(size));
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kLargePageSize, 0u);
+      std::memset(ptr, 0x55, size);
+      EXPECT_EQ(ptr[size - 1], 0x55);
+      FreeLargePages(ptr, size);
+    }
+  }
+  SetLargePagesEnabled(false);
+}
+
+TEST(LargePages, AllocatorWorksWithContainers) {
+  SetLargePagesEnabled(true);
+  std::vector<uint64_t, LargePageAllocator<uint64_t>> small(10, 1);
+  std::vector<uint64_t, LargePageAllocator<uint64_t>> large(
+      kLargePageSize / sizeof(uint64_t) * 2, 2);
+  // Growing moves the elements from a small allocation to a large one.
+  for (size_t i = 0; i < kLargePageSize / sizeof(uint64_t); ++i) {
+    small.push_back(3);
+  }
+  EXPECT_EQ(small[9], 1u);
+  EXPECT_EQ(small.back(), 3u);
+  EXPECT_EQ(large.back(), 2u);
+  SetLargePagesEnabled(false);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -27,6 +27,8 @@
 
 #include "utils/logging.h"
 
+#include <cstdlib>
+#include <exception>
 #include <iomanip>
 #include <iostream>
 #include <thread>
@@ -43,20 +45,105 @@ Logging& Logging::Get() {
   return logging;
 }
 
-void Logging::WriteLineRaw(const std::string& line) {
+Logging::~Logging() {
+  if (!writer_.joinable()) return;
+  stop_writer_.store(true, std::memory_order_release);
+  pushed_lines_.fetch_add(1, std::memory_order_release);
+  pushed_lines_.notify_one();
+  writer_.join();
+  Flush();
+}
+
+void Logging::WriteLineRaw(std::string line) {
+  if (async_.load(std::memory_order_acquire)) {
+    while (!queue_->TryPush(std::move(line))) {
+      if (drop_when_full_) {
+        dropped_lines_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      std::this_thread::yield();
+    }
+    pushed_lines_.fetch_add(1, std::memory_order_release);
+    pushed_lines_.notify_one();
+    return;
+  }
   Mutex::Lock lock_(mutex_);
+  WriteLineLocked(line);
+  if (!filename_.empty()) {
+    auto& file = (filename_ == kStderrFilename) ? std::cerr : file_;
+    file.flush();
+  }
+}
+
+void Logging::WriteLineLocked(const std::string& line) {
   if (filename_.empty()) {
     buffer_.push_back(line);
     if (buffer_.size() > kBufferSizeLines) buffer_.pop_front();
   } else {
     auto& file = (filename_ == kStderrFilename) ? std::cerr : file_;
-    file << line << std::endl;
+    file << line << '\n';
+  }
+}
+
+bool Logging::DrainLocked() {
+  if (!queue_) return false;
+  bool any = false;
+  std::string line;
+  while (queue_->TryPop(&line)) {
+    WriteLineLocked(line);
+    any = true;
+  }
+  if (const uint64_t dropped =
+          dropped_lines_.exchange(0, std::memory_order_relaxed)) {
+    WriteLineLocked(std::to_string(dropped) +
+                    " log lines dropped, the async buffer was full.");
+    any = true;
+  }
+  if (any && !filename_.empty()) {
+    auto& file = (filename_ == kStderrFilename) ? std::cerr : file_;
+    file.flush();
   }
+  return any;
+}
+
+void Logging::Flush() {
+  Mutex::Lock lock_(mutex_);
+  DrainLocked();
+}
+
+void Logging::WriterThread() {
+  while (!stop_writer_.load(std::memory_order_acquire)) {
+    // Read before draining, so that a line pushed after the drain makes the
+    // wait return immediately.
+    const uint32_t pushed = pushed_lines_.load(std::memory_order_acquire);
+    {
+      Mutex::Lock lock_(mutex_);
+      DrainLocked();
+    }
+    pushed_lines_.wait(pushed, std::memory_order_acquire);
+  }
+}
+
+void Logging::StartAsync(size_t capacity, bool drop_when_full) {
+  Mutex::Lock lock_(mutex_);
+  if (queue_ || capacity == 0) return;
+  queue_ = std::make_unique<MpscRingBuffer<std::string>>(capacity);
+  drop_when_full_ = drop_when_full;
+  writer_ = std::thread([this]() { WriterThread(); });
+  // Don't lose the queued lines if the process goes down on an exception.
+  static std::terminate_handler previous_handler = nullptr;
+  previous_handler = std::set_terminate([]() {
+    Logging::Get().Flush();
+    if (previous_handler) previous_handler();
+    std::abort();
+  });
+  async_.store(true, std::memory_order_release);
 }
 
 void Logging::SetFilename(const std::string& filename) {
   Mutex::Lock lock_(mutex_);
   if (filename_ == filename) return;
+  DrainLocked();
   filename_ = filename;
   if (filename.empty() || filename == kStderrFilename) {
     file_.close();
@@ -27,13 +27,18 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <deque>
 #include <fstream>
 #include <iomanip>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
+#include "utils/mpsc_ring_buffer.h"
 #include "utils/mutex.h"
 
 namespace lczero {
@@ -45,15 +50,42 @@ class Logging {
   // Sets the name of the log. Empty name disables logging.
   void SetFilename(const std::string& filename);
 
+  // From now on, queues the lines in a ring buffer of @capacity lines, which a
+  // background thread writes out, so that the logging threads don't wait for
+  // the disk. When the buffer is full, the new lines are dropped if
+  // @drop_when_full, and otherwise the logging thread waits for space. Only
+  // the first call has any effect.
+  void StartAsync(size_t capacity, bool drop_when_full);
+
+  // Writes out the lines queued so far. Called on exit and on std::terminate.
+  void Flush();
+
  private:
+  ~Logging();
+
   // Writes line to the log, and appends new line character.
-  void WriteLineRaw(const std::string& line);
+  void WriteLineRaw(std::string line);
+  void WriteLineLocked(const std::string& line) REQUIRES(mutex_);
+  // Writes out the queued lines, returns whether there were any.
+  bool DrainLocked() REQUIRES(mutex_);
+  void WriterThread();
 
   Mutex mutex_;
   std::string filename_ GUARDED_BY(mutex_);
   std::ofstream file_ GUARDED_BY(mutex_);
   std::deque<std::string> buffer_ GUARDED_BY(mutex_);
 
+  // Set once by StartAsync(). Pushed to by the logging threads, popped from by
+  // whoever holds mutex_.
+  std::unique_ptr<MpscRingBuffer<std::string>> queue_;
+  std::atomic<bool> async_ = false;
+  bool drop_when_full_ = false;
+  // Incremented after each push, the writer thread waits on it.
+  std::atomic<uint32_t> pushed_lines_ = 0;
+  std::atomic<uint64_t> dropped_lines_ = 0;
+  std::atomic<bool> stop_writer_ = false;
+  std::thread writer_;
+
   Logging() = default;
   friend class LogMessage;
 };
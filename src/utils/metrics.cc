@@ -0,0 +1,296 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include "utils/exception.h"
+#include "utils/files.h"
+
+namespace lczero {
+
+namespace metrics_internal {
+int GetShardIndex() {
+  static std::atomic<int> next_shard = 0;
+  thread_local const int shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+  return shard;
+}
+}  // namespace metrics_internal
+
+uint64_t Counter::Value() const {
+  uint64_t result = 0;
+  for (const auto& shard : shards_) {
+    result += shard.value.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+void Counter::Reset() {
+  for (auto& shard : shards_) shard.value.store(0, std::memory_order_relaxed);
+}
+
+void Gauge::Add(double value) {
+  value_.fetch_add(value, std::memory_order_relaxed);
+}
+
+FixedHistogram::FixedHistogram(std::vector<double> upper_bounds)
+    : upper_bounds_(std::move(upper_bounds)) {
+  if (!std::is_sorted(upper_bounds_.begin(), upper_bounds_.end())) {
+    throw Exception("Histogram bucket bounds must be sorted.");
+  }
+  for (auto& shard : shards_) {
+    shard.counts.reset(new std::atomic<uint64_t>[upper_bounds_.size() + 1]);
+    for (size_t i = 0; i <= upper_bounds_.size(); ++i) shard.counts[i] = 0;
+  }
+}
+
+void FixedHistogram::Add(double value) {
+  const size_t idx =
+      std::lower_bound(upper_bounds_.begin(), upper_bounds_.end(), value) -
+      upper_bounds_.begin();
+  Shard& shard = shards_[metrics_internal::GetShardIndex()];
+  shard.counts[idx].fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> FixedHistogram::BucketCounts() const {
+  std::vector<uint64_t> result(upper_bounds_.size() + 1);
+  for (const auto& shard : shards_) {
+    for (size_t i = 0; i < result.size(); ++i) {
+      result[i] += shard.counts[i].load(std::memory_order_relaxed);
+    }
+  }
+  return result;
+}
+
+double FixedHistogram::Sum() const {
+  double result = 0.0;
+  for (const auto& shard : shards_) {
+    result += shard.sum.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+void FixedHistogram::Reset() {
+  for (auto& shard : shards_) {
+    for (size_t i = 0; i <= upper_bounds_.size(); ++i) {
+      shard.counts[i].store(0, std::memory_order_relaxed);
+    }
+    shard.sum.store(0.0, std::memory_order_relaxed);
+  }
+}
+
+std::vector<double> ExponentialBuckets(double start, double factor,
+                                       int count) {
+  std::vector<double> result;
+  result.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    result.push_back(start);
+    start *= factor;
+  }
+  return result;
+}
+
+std::string MetricsSnapshot::ToPrometheus() const {
+  std::ostringstream oss;
+  for (const auto& metric : metrics) {
+    oss << "# HELP " << metric.name << " " << metric.help << "\n";
+    switch (metric.type) {
+      case Type::kCounter:
+        oss << "# TYPE " << metric.name << " counter\n";
+        oss << metric.name << " " << metric.value << "\n";
+        break;
+      case Type::kGauge:
+        oss << "# TYPE " << metric.name << " gauge\n";
+        oss << metric.name << " " << metric.value << "\n";
+        break;
+      case Type::kHistogram: {
+        oss << "# TYPE " << metric.name << " histogram\n";
+        uint64_t count = 0;
+        for (size_t i = 0; i < metric.bucket_counts.size(); ++i) {
+          count += metric.bucket_counts[i];
+          oss << metric.name << "_bucket{le=\"";
+          if (i < metric.upper_bounds.size()) {
+            oss << metric.upper_bounds[i];
+          } else {
+            oss << "+Inf";
+          }
+          oss << "\"} " << count << "\n";
+        }
+        oss << metric.name << "_sum " << metric.sum << "\n";
+        oss << metric.name << "_count " << count << "\n";
+        break;
+      }
+    }
+  }
+  return oss.str();
+}
+
+std::vector<std::string> MetricsSnapshot::ToInfoStrings() const {
+  std::vector<std::string> result;
+  for (const auto& metric : metrics) {
+    if (metric.value == 0) continue;
+    std::ostringstream oss;
+    oss.precision(4);
+    oss << metric.name << " ";
+    if (metric.type != Type::kHistogram) {
+      oss << metric.value;
+    } else {
+      // Bucket upper bound of the quantile, like Histogram::GetQuantile().
+      auto quantile = [&](double q) -> std::string {
+        const double threshold = q * metric.value;
+        uint64_t count = 0;
+        for (size_t i = 0; i < metric.bucket_counts.size(); ++i) {
+          count += metric.bucket_counts[i];
+          if (count < threshold) continue;
+          if (i == metric.upper_bounds.size()) return "+Inf";
+          std::ostringstream bound;
+          bound.precision(4);
+          bound << metric.upper_bounds[i];
+          return bound.str();
+        }
+        return "+Inf";
+      };
+      oss << "count " << metric.value << " mean "
+          << metric.sum / metric.value << " p50 " << quantile(0.5) << " p99 "
+          << quantile(0.99);
+    }
+    result.push_back(oss.str());
+  }
+  return result;
+}
+
+MetricsRegistry& MetricsRegistry::Get() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsRegistry::Entry* MetricsRegistry::FindOrAdd(
+    const std::string& name, const std::string& help,
+    MetricsSnapshot::Type type) {
+  for (auto& entry : entries_) {
+    if (entry->name != name) continue;
+    if (entry->type != type) {
+      throw Exception("Metric " + name + " registered with different types.");
+    }
+    return entry.get();
+  }
+  entries_.push_back(std::make_unique<Entry>());
+  Entry* entry = entries_.back().get();
+  entry->name = name;
+  entry->help = help;
+  entry->type = type;
+  return entry;
+}
+
+Counter* MetricsRegistry::GetCounter(const std::string& name,
+                                     const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry* entry = FindOrAdd(name, help, MetricsSnapshot::Type::kCounter);
+  if (!entry->counter) entry->counter = std::make_unique<Counter>();
+  return entry->counter.get();
+}
+
+Gauge* MetricsRegistry::GetGauge(const std::string& name,
+                                 const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry* entry = FindOrAdd(name, help, MetricsSnapshot::Type::kGauge);
+  if (!entry->gauge) entry->gauge = std::make_unique<Gauge>();
+  return entry->gauge.get();
+}
+
+FixedHistogram* MetricsRegistry::GetHistogram(
+    const std::string& name, const std::string& help,
+    const std::vector<double>& upper_bounds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry* entry = FindOrAdd(name, help, MetricsSnapshot::Type::kHistogram);
+  if (!entry->histogram) {
+    entry->histogram = std::make_unique<FixedHistogram>(upper_bounds);
+  } else if (entry->histogram->upper_bounds() != upper_bounds) {
+    throw Exception("Metric " + name + " registered with different buckets.");
+  }
+  return entry->histogram.get();
+}
+
+MetricsSnapshot MetricsRegistry::Snapshot() const {
+  MetricsSnapshot snapshot;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& entry : entries_) {
+    MetricsSnapshot::Metric metric{.name = entry->name,
+                                   .help = entry->help,
+                                   .type = entry->type,
+                                   .value = 0.0,
+                                   .upper_bounds = {},
+                                   .bucket_counts = {},
+                                   .sum = 0.0};
+    switch (entry->type) {
+      case MetricsSnapshot::Type::kCounter:
+        metric.value = entry->counter->Value();
+        break;
+      case MetricsSnapshot::Type::kGauge:
+        metric.value = entry->gauge->Value();
+        break;
+      case MetricsSnapshot::Type::kHistogram:
+        metric.upper_bounds = entry->histogram->upper_bounds();
+        metric.bucket_counts = entry->histogram->BucketCounts();
+        metric.sum = entry->histogram->Sum();
+        for (uint64_t count : metric.bucket_counts) metric.value += count;
+        break;
+    }
+    snapshot.metrics.push_back(std::move(metric));
+  }
+  return snapshot;
+}
+
+void MetricsRegistry::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& entry : entries_) {
+    if (entry->counter) entry->counter->Reset();
+    if (entry->gauge) entry->gauge->Reset();
+    if (entry->histogram) entry->histogram->Reset();
+  }
+}
+
+void MetricsRegistry::WriteToFile(const std::string& filename) const {
+  // Write to a temporary file and rename it, so that the scraper never sees a
+  // partially written file.
+  const std::string tmp_file = filename + ".tmp";
+  WriteStringToFile(tmp_file, Snapshot().ToPrometheus());
+#ifdef _WIN32
+  // Unlike POSIX, rename doesn't replace the existing file on Windows.
+  std::remove(filename.c_str());
+#endif
+  std::rename(tmp_file.c_str(), filename.c_str());
+}
+
+}  // namespace lczero
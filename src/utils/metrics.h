@@ -0,0 +1,168 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lczero {
+
+// Process-wide registry of named metrics: counters, gauges and histograms with
+// fixed buckets. Metrics are created once (usually into a static pointer) and
+// never destroyed, so the pointers can be cached freely. Updates are lock-free;
+// counters and histograms are sharded by thread, so that search threads
+// updating the same metric don't bounce the cache line between them.
+//
+// Usage:
+//   Counter* const kPlayouts = MetricsRegistry::Get().GetCounter(
+//       "lc0_search_playouts_total", "Playouts done by the search.");
+//   ...
+//   kPlayouts->Add(n);
+
+namespace metrics_internal {
+inline constexpr int kNumShards = 16;
+// Shard of the calling thread, threads are assigned to shards round robin.
+int GetShardIndex();
+}  // namespace metrics_internal
+
+// Monotonically increasing counter.
+class Counter {
+ public:
+  void Add(uint64_t value = 1) {
+    shards_[metrics_internal::GetShardIndex()].value.fetch_add(
+        value, std::memory_order_relaxed);
+  }
+  uint64_t Value() const;
+  void Reset();
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value = 0;
+  };
+  Shard shards_[metrics_internal::kNumShards];
+};
+
+// Value which can go up and down, e.g. the current tree size.
+class Gauge {
+ public:
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  void Add(double value);
+  double Value() const { return value_.load(std::memory_order_relaxed); }
+  void Reset() { Set(0.0); }
+
+ private:
+  std::atomic<double> value_ = 0.0;
+};
+
+// Histogram with fixed bucket upper bounds. Values above the last bound go to
+// the implicit +Inf bucket.
+class FixedHistogram {
+ public:
+  explicit FixedHistogram(std::vector<double> upper_bounds);
+  void Add(double value);
+  // Returns per-bucket (not cumulative) counts, the last one is +Inf bucket.
+  std::vector<uint64_t> BucketCounts() const;
+  double Sum() const;
+  const std::vector<double>& upper_bounds() const { return upper_bounds_; }
+  void Reset();
+
+ private:
+  struct alignas(64) Shard {
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<double> sum = 0.0;
+  };
+  const std::vector<double> upper_bounds_;
+  Shard shards_[metrics_internal::kNumShards];
+};
+
+// Returns @count bucket bounds: start, start*factor, start*factor^2, ...
+std::vector<double> ExponentialBuckets(double start, double factor, int count);
+
+// Point in time copy of all metrics.
+struct MetricsSnapshot {
+  enum class Type { kCounter, kGauge, kHistogram };
+  struct Metric {
+    std::string name;
+    std::string help;
+    Type type;
+    // Counter or gauge value, the sample count for histograms.
+    double value;
+    // Histograms only, same meaning as in FixedHistogram.
+    std::vector<double> upper_bounds;
+    std::vector<uint64_t> bucket_counts;
+    double sum;
+  };
+  std::vector<Metric> metrics;
+
+  // Prometheus text exposition format.
+  std::string ToPrometheus() const;
+  // One short line per metric, to output as UCI info strings. Metrics which
+  // were never updated are skipped.
+  std::vector<std::string> ToInfoStrings() const;
+};
+
+class MetricsRegistry {
+ public:
+  static MetricsRegistry& Get();
+
+  // Return the metric with the given name, creating it on the first call.
+  // Throws if the metric exists with a different type.
+  Counter* GetCounter(const std::string& name, const std::string& help);
+  Gauge* GetGauge(const std::string& name, const std::string& help);
+  FixedHistogram* GetHistogram(const std::string& name,
+                               const std::string& help,
+                               const std::vector<double>& upper_bounds);
+
+  MetricsSnapshot Snapshot() const;
+  // Sets all metrics to zero. Updates concurrent to the reset may be lost.
+  void Reset();
+  // Writes the Prometheus text to the file atomically (through a rename).
+  void WriteToFile(const std::string& filename) const;
+
+ private:
+  struct Entry {
+    std::string name;
+    std::string help;
+    MetricsSnapshot::Type type;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<FixedHistogram> histogram;
+  };
+  Entry* FindOrAdd(const std::string& name, const std::string& help,
+                   MetricsSnapshot::Type type);
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,82 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+TEST(Metrics, CounterIsSummedOverThreads) {
+  Counter* counter =
+      MetricsRegistry::Get().GetCounter("test_counter_total", "Test counter.");
+  EXPECT_EQ(counter, MetricsRegistry::Get().GetCounter("test_counter_total",
+                                                       "Test counter."));
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([counter]() {
+      for (int j = 0; j < 10000; ++j) counter->Add();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(counter->Value(), 80000u);
+  MetricsRegistry::Get().Reset();
+  EXPECT_EQ(counter->Value(), 0u);
+  EXPECT_THROW(MetricsRegistry::Get().GetGauge("test_counter_total", ""),
+               Exception);
+}
+
+TEST(Metrics, HistogramPrometheusOutput) {
+  FixedHistogram* histogram = MetricsRegistry::Get().GetHistogram(
+      "test_histogram", "Test histogram.", {1, 10});
+  histogram->Add(0.5);
+  histogram->Add(5);
+  histogram->Add(5);
+  histogram->Add(50);
+  EXPECT_EQ(histogram->BucketCounts(), (std::vector<uint64_t>{1, 2, 1}));
+  const std::string text = MetricsRegistry::Get().Snapshot().ToPrometheus();
+  EXPECT_NE(text.find("# TYPE test_histogram histogram\n"), std::string::npos);
+  EXPECT_NE(text.find("test_histogram_bucket{le=\"10\"} 3\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("test_histogram_bucket{le=\"+Inf\"} 4\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("test_histogram_sum 60.5\n"), std::string::npos);
+  EXPECT_NE(text.find("test_histogram_count 4\n"), std::string::npos);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
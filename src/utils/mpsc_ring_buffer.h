@@ -0,0 +1,109 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace lczero {
+
+// Bounded lock-free queue with any number of producers and a single consumer.
+// Every slot carries a sequence number which tells whose turn it is: the
+// producer which claimed position p may fill the slot when it reads p, and
+// the consumer may take it when it reads p + 1. The capacity is rounded up to
+// a power of two.
+template <typename T>
+class MpscRingBuffer {
+ public:
+  explicit MpscRingBuffer(size_t capacity)
+      : mask_(RoundUpToPowerOfTwo(capacity) - 1),
+        slots_(std::make_unique<Slot[]>(mask_ + 1)) {
+    for (size_t i = 0; i <= mask_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Returns false, leaving @value untouched, if the buffer is full.
+  bool TryPush(T&& value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[pos & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          slot.value = std::move(value);
+          slot.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The consumer hasn't taken the value of the previous lap yet.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer only. Returns false if the next value isn't pushed yet.
+  bool TryPop(T* value) {
+    Slot& slot = slots_[dequeue_pos_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+      return false;
+    }
+    *value = std::move(slot.value);
+    slot.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    ++dequeue_pos_;
+    return true;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) result *= 2;
+    return result;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<size_t> enqueue_pos_ = 0;
+  alignas(64) size_t dequeue_pos_ = 0;
+};
+
+}  // namespace lczero
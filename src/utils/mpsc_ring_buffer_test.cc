@@ -0,0 +1,88 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/mpsc_ring_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(MpscRingBuffer, FifoAndFull) {
+  MpscRingBuffer<std::string> buffer(3);
+  EXPECT_EQ(buffer.capacity(), 4u);
+  for (int i = 0; i < 4; ++i) EXPECT_TRUE(buffer.TryPush(std::to_string(i)));
+  std::string value = "kept";
+  EXPECT_FALSE(buffer.TryPush(std::move(value)));
+  EXPECT_EQ(value, "kept");
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(buffer.TryPop(&value));
+    EXPECT_EQ(value, std::to_string(i));
+  }
+  EXPECT_FALSE(buffer.TryPop(&value));
+  // The slots are reusable after a lap.
+  EXPECT_TRUE(buffer.TryPush("again"));
+  ASSERT_TRUE(buffer.TryPop(&value));
+  EXPECT_EQ(value, "again");
+}
+
+TEST(MpscRingBuffer, ConcurrentProducers) {
+  constexpr int kProducers = 4;
+  constexpr int kValuesPerProducer = 20000;
+  MpscRingBuffer<int> buffer(64);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&buffer, p]() {
+      for (int i = 0; i < kValuesPerProducer; ++i) {
+        int value = p * kValuesPerProducer + i;
+        while (!buffer.TryPush(std::move(value))) std::this_thread::yield();
+      }
+    });
+  }
+  // Values of every producer come out in the order they were pushed.
+  std::vector<int> next(kProducers, 0);
+  for (int received = 0; received < kProducers * kValuesPerProducer;) {
+    int value;
+    if (!buffer.TryPop(&value)) continue;
+    const int p = value / kValuesPerProducer;
+    EXPECT_EQ(value % kValuesPerProducer, next[p]);
+    ++next[p];
+    ++received;
+  }
+  for (auto& producer : producers) producer.join();
+  for (int p = 0; p < kProducers; ++p) EXPECT_EQ(next[p], kValuesPerProducer);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
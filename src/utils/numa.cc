@@ -27,6 +27,9 @@
 
 #include "utils/numa.h"
 
+#include <algorithm>
+#include <mutex>
+
 #include "chess/bitboard.h"
 #include "utils/logging.h"
 
@@ -34,11 +37,89 @@
 #include <windows.h>
 #endif
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#endif
+
 namespace lczero {
 
 int Numa::threads_per_core_ = 1;
+std::vector<std::vector<int>> Numa::node_cpus_;
+
+#ifdef __linux__
+namespace {
+// Parses a sysfs cpu list, e.g. "0-3,8-11".
+std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::istringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty()) continue;
+    const auto dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last =
+        dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::string FormatCpuList(const std::vector<int>& cpus) {
+  std::string result;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+    if (!result.empty()) result += ",";
+    result += std::to_string(cpus[i]);
+    if (j > i) result += "-" + std::to_string(cpus[j]);
+    i = j;
+  }
+  return result;
+}
+}  // namespace
+#endif
 
 void Numa::Init() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+#ifdef __linux__
+    // Node numbers may have gaps, stop after a long run of missing ones.
+    for (int node = 0, missing = 0; missing < 64; node++) {
+      std::ifstream file("/sys/devices/system/node/node" +
+                         std::to_string(node) + "/cpulist");
+      std::string list;
+      if (!file || !std::getline(file, list)) {
+        missing++;
+        continue;
+      }
+      missing = 0;
+      auto cpus = ParseCpuList(list);
+      if (!cpus.empty()) node_cpus_.push_back(std::move(cpus));
+    }
+    if (node_cpus_.size() > 1) {
+      CERR << "Detected " << node_cpus_.size() << " NUMA node(s).";
+      for (size_t node = 0; node < node_cpus_.size(); node++) {
+        CERR << "Node " << node << " has " << node_cpus_[node].size()
+             << " thread(s): " << FormatCpuList(node_cpus_[node]) << ".";
+      }
+    }
+#endif
+    InitProcessorGroups();
+  });
+}
+
+int Numa::GetNodeCount() {
+  Init();
+  return std::max<int>(1, node_cpus_.size());
+}
+
+void Numa::InitProcessorGroups() {
 #if defined(_WIN64) && _WIN32_WINNT >= 0x0601
   SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* buffer;
   DWORD len = 0;
@@ -85,10 +166,43 @@ void Numa::BindThread(int id) {
     }
     core_id -= group_cores;
   }
+#elif defined(__linux__)
+  Init();
+  if (node_cpus_.size() <= 1) return;
+  // Same as above: fill the nodes in order, one thread per logical processor,
+  // and distribute the remaining threads to all nodes.
+  size_t cpu_count = 0;
+  for (const auto& cpus : node_cpus_) cpu_count += cpus.size();
+  size_t node = 0;
+  if (static_cast<size_t>(id) < cpu_count) {
+    for (size_t cpu_id = id; cpu_id >= node_cpus_[node].size(); node++) {
+      cpu_id -= node_cpus_[node].size();
+    }
+  } else {
+    node = (id - cpu_count) % node_cpus_.size();
+  }
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int cpu : node_cpus_[node]) CPU_SET(cpu, &cpuset);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0) {
+    LOGFILE << "Thread " << id << " bound to NUMA node " << node << ".";
+  }
 #else
   // Silence warning.
   (void)id;
 #endif
 }
 
+void Numa::BindThreadToCpu(int cpu) {
+#ifdef __linux__
+  const int num_cpus = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu % num_cpus, &cpuset);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+#else
+  BindThread(cpu);
+#endif
+}
+
 }  // namespace lczero
@@ -27,20 +27,36 @@
 
 #pragma once
 
+#include <vector>
+
 namespace lczero {
 
 class Numa {
  public:
   Numa() = delete;
 
-  // Initialize and display statistics about processor configuration.
+  // Initialize and display statistics about processor configuration. Only
+  // does the work on the first call.
   static void Init();
 
-  // Bind thread to processor group.
+  // Bind thread to processor group (on Linux, to the processors of a NUMA
+  // node). Does nothing if there is only one.
   static void BindThread(int id);
 
+  // Number of NUMA nodes found by Init(), at least 1.
+  static int GetNodeCount();
+
+  // Bind thread to a single logical processor, wrapping around if there are
+  // fewer of them. Falls back to BindThread() where not supported.
+  static void BindThreadToCpu(int cpu);
+
  private:
+  // Windows processor group part of Init().
+  static void InitProcessorGroups();
+
   static int threads_per_core_;
+  // Logical processors of every NUMA node, as listed by sysfs. Linux only.
+  static std::vector<std::vector<int>> node_cpus_;
 };
 
 }  // namespace lczero
@@ -26,35 +26,75 @@
 */
 
 #include "random.h"
+
+#include <atomic>
 #include <random>
 
+#include "utils/mutex.h"
+
 namespace lczero {
 
-Random::Random() : gen_(std::random_device()()) {}
+namespace {
+uint64_t SplitMix64(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Incremented by every Seed() call, so that the threads notice it.
+std::atomic<uint64_t> seed_epoch{0};
+Mutex seed_mutex;
+uint64_t seed_value GUARDED_BY(seed_mutex) = 0;
+uint64_t next_stream GUARDED_BY(seed_mutex) = 0;
+}  // namespace
+
+void Xoshiro256::Seed(uint64_t seed) {
+  for (auto& word : s_) word = SplitMix64(&seed);
+}
+
+Random::Random()
+    : gen_((uint64_t{std::random_device()()} << 32) ^ std::random_device()()) {
+}
 
 Random& Random::Get() {
-  static Random rand;
+  thread_local Random rand;
   return rand;
 }
 
+Xoshiro256& Random::Gen() {
+  const uint64_t epoch = seed_epoch.load(std::memory_order_acquire);
+  if (epoch != epoch_) {
+    Mutex::Lock lock(seed_mutex);
+    epoch_ = seed_epoch.load(std::memory_order_relaxed);
+    uint64_t stream = seed_value ^ (next_stream++ * 0xd1b54a32d192ed03ULL);
+    gen_.Seed(SplitMix64(&stream));
+  }
+  return gen_;
+}
+
+void Random::Seed(uint64_t seed) {
+  Mutex::Lock lock(seed_mutex);
+  seed_value = seed;
+  next_stream = 0;
+  seed_epoch.fetch_add(1, std::memory_order_release);
+}
+
 int Random::GetInt(int min, int max) {
-  Mutex::Lock lock(mutex_);
   std::uniform_int_distribution<> dist(min, max);
-  return dist(gen_);
+  return dist(Gen());
 }
 
 bool Random::GetBool() { return GetInt(0, 1) != 0; }
 
 double Random::GetDouble(double maxval) {
-  Mutex::Lock lock(mutex_);
   std::uniform_real_distribution<> dist(0.0, maxval);
-  return dist(gen_);
+  return dist(Gen());
 }
 
 float Random::GetFloat(float maxval) {
-  Mutex::Lock lock(mutex_);
   std::uniform_real_distribution<> dist(0.0, maxval);
-  return dist(gen_);
+  return dist(Gen());
 }
 
 std::string Random::GetString(int length) {
@@ -66,9 +106,14 @@ std::string Random::GetString(int length) {
 }
 
 double Random::GetGamma(double alpha, double beta) {
-  Mutex::Lock lock(mutex_);
   std::gamma_distribution<double> dist(alpha, beta);
-  return dist(gen_);
+  return dist(Gen());
+}
+
+void Random::GetGammas(double alpha, float* out, int count) {
+  std::gamma_distribution<double> dist(alpha, 1.0);
+  Xoshiro256& gen = Gen();
+  for (int i = 0; i < count; ++i) out[i] = dist(gen);
 }
 
 }  // namespace lczero
@@ -28,36 +28,80 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <random>
 #include <string>
-#include "utils/mutex.h"
 
 namespace lczero {
 
+// xoshiro256** generator. Much cheaper than std::mt19937, both in time and in
+// state, and it satisfies UniformRandomBitGenerator so that the std
+// distributions work with it.
+class Xoshiro256 {
+ public:
+  using result_type = uint64_t;
+
+  explicit Xoshiro256(uint64_t seed = 0) { Seed(seed); }
+  // Expands @seed into the full state using splitmix64.
+  void Seed(uint64_t seed);
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+  result_type operator()() {
+    const uint64_t result = Rotl(s_[1] * 5, 7) * 9;
+    const uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = Rotl(s_[3], 45);
+    return result;
+  }
+
+ private:
+  static uint64_t Rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+  uint64_t s_[4];
+};
+
+// Every thread has its own generator, so there is no locking.
 class Random {
  public:
+  // Returns the generator of the calling thread.
   static Random& Get();
   double GetDouble(double max_val);
   float GetFloat(float max_val);
   double GetGamma(double alpha, double beta);
+  // Fills @out with @count samples of Gamma(@alpha, 1), e.g. to be normalized
+  // into Dirichlet noise.
+  void GetGammas(double alpha, float* out, int count);
   // Both sides are included.
   int GetInt(int min, int max);
   std::string GetString(int length);
   bool GetBool();
   template <class RandomAccessIterator>
   void Shuffle(RandomAccessIterator s, RandomAccessIterator e);
+  // Restarts the sequences of all threads, for reproducible runs. Each thread
+  // then draws from its own stream of @seed, numbered in the order in which
+  // the threads first use their generator after the call.
+  void Seed(uint64_t seed);
 
  private:
   Random();
+  // Reseeds the generator if Seed() was called since it was last used.
+  Xoshiro256& Gen();
 
-  Mutex mutex_;
-  std::mt19937 gen_ GUARDED_BY(mutex_);
+  uint64_t epoch_ = 0;
+  Xoshiro256 gen_;
 };
 
 template <class RandomAccessIterator>
 void Random::Shuffle(RandomAccessIterator s, RandomAccessIterator e) {
-  Mutex::Lock lock(mutex_);
-  std::shuffle(s, e, gen_);
+  std::shuffle(s, e, Gen());
 }
 
 }  // namespace lczero
@@ -0,0 +1,87 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+
+namespace lczero {
+
+// A value of T which may be updated by several threads at once. All
+// operations are atomic with relaxed memory ordering, and compound
+// assignments are atomic read-modify-writes. Unlike std::atomic, it's
+// copyable and movable (non-atomically with respect to the source), so that
+// it can be a member of otherwise movable objects.
+template <typename T>
+class RelaxedAtomic {
+ public:
+  RelaxedAtomic(T value = T()) : value_(value) {}
+  RelaxedAtomic(const RelaxedAtomic& other) : value_(other.load()) {}
+  RelaxedAtomic& operator=(const RelaxedAtomic& other) {
+    store(other.load());
+    return *this;
+  }
+  RelaxedAtomic& operator=(T value) {
+    store(value);
+    return *this;
+  }
+
+  T load() const { return value_.load(std::memory_order_relaxed); }
+  void store(T value) { value_.store(value, std::memory_order_relaxed); }
+  operator T() const { return load(); }
+
+  // Returns the old value.
+  T fetch_add(T delta) {
+    return value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+  RelaxedAtomic& operator+=(T delta) {
+    fetch_add(delta);
+    return *this;
+  }
+  RelaxedAtomic& operator-=(T delta) {
+    value_.fetch_sub(delta, std::memory_order_relaxed);
+    return *this;
+  }
+  RelaxedAtomic& operator++() { return *this += 1; }
+  RelaxedAtomic& operator--() { return *this -= 1; }
+
+  // Atomically replaces the value with @fn(old value), retrying if it was
+  // changed concurrently.
+  template <typename F>
+  void Update(F&& fn) {
+    T old_value = load();
+    while (!value_.compare_exchange_weak(old_value, fn(old_value),
+                                         std::memory_order_relaxed)) {
+    }
+  }
+
+ private:
+  std::atomic<T> value_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,125 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/shared_thread_pool.h"
+
+#include <algorithm>
+
+namespace lczero {
+
+SharedThreadPool::SharedThreadPool(int max_running)
+    : max_running_(std::max(max_running, 1)) {}
+
+SharedThreadPool::~SharedThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+SharedThreadPool* SharedThreadPool::Get() {
+  // Never destroyed, the idle threads just wait until the process exits.
+  static SharedThreadPool* pool =
+      new SharedThreadPool(std::thread::hardware_concurrency());
+  return pool;
+}
+
+void SharedThreadPool::Group::Submit(std::function<void()> task,
+                                     bool required) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++pending_;
+  }
+  pool_->Submit({std::move(task), this, required});
+}
+
+void SharedThreadPool::Group::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [&]() { return pending_ == 0; });
+}
+
+void SharedThreadPool::Group::Done() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--pending_ == 0) cv_.notify_all();
+}
+
+void SharedThreadPool::Submit(Task task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!task.required) {
+    if (running_ >= max_running_) {
+      waiting_.push_back(std::move(task));
+      return;
+    }
+    ++running_;
+  }
+  Start(std::move(task));
+}
+
+void SharedThreadPool::Start(Task task) {
+  if (idle_ > static_cast<int>(ready_.size())) {
+    ready_.push_back(std::move(task));
+    cv_.notify_one();
+    return;
+  }
+  threads_.emplace_back(
+      [this, task = std::move(task)]() mutable { Worker(std::move(task)); });
+}
+
+void SharedThreadPool::Worker(Task task) {
+  while (true) {
+    task.fn();
+    // The group may be gone once it's done, so it's notified last.
+    Group* group = task.group;
+    const bool required = task.required;
+    task = {};
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!required) --running_;
+    if (!waiting_.empty() && running_ < max_running_) {
+      // Run the next waiting task on this thread.
+      ++running_;
+      task = std::move(waiting_.front());
+      waiting_.pop_front();
+      lock.unlock();
+      group->Done();
+      continue;
+    }
+    ++idle_;
+    lock.unlock();
+    group->Done();
+    lock.lock();
+    cv_.wait(lock, [&]() { return stop_ || !ready_.empty(); });
+    --idle_;
+    if (ready_.empty()) return;
+    task = std::move(ready_.front());
+    ready_.pop_front();
+  }
+}
+
+}  // namespace lczero
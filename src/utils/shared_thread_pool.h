@@ -0,0 +1,105 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+// Pool of threads for long running tasks like the search workers, shared by
+// concurrent searches so that the threads are reused between the moves
+// instead of created for every search. At most a fixed number of the tasks
+// which are not required run at a time, the others wait for their turn in the
+// order they were submitted. Required tasks start immediately, so that every
+// search makes progress even when the pool is busy.
+class SharedThreadPool {
+ public:
+  // @max_running is the number of tasks which are not required that can run
+  // at a time.
+  explicit SharedThreadPool(int max_running);
+  ~SharedThreadPool();
+
+  // The process-wide pool, sized to the number of processor cores.
+  static SharedThreadPool* Get();
+
+  // Tasks of one submitter, which are waited for together.
+  class Group {
+   public:
+    explicit Group(SharedThreadPool* pool) : pool_(pool) {}
+    ~Group() { Wait(); }
+
+    // Queues @task, or starts it immediately if @required.
+    void Submit(std::function<void()> task, bool required = false);
+    // Blocks until all the submitted tasks are finished.
+    void Wait();
+
+   private:
+    friend class SharedThreadPool;
+    void Done();
+
+    SharedThreadPool* const pool_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int pending_ = 0;
+  };
+
+  int GetMaxRunning() const { return max_running_; }
+
+ private:
+  struct Task {
+    std::function<void()> fn;
+    Group* group;
+    bool required;
+  };
+
+  void Submit(Task task);
+  // Hands @task to an idle thread or starts a new one.
+  void Start(Task task);
+  void Worker(Task task);
+
+  const int max_running_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Started tasks which are not picked up by an idle thread yet.
+  std::deque<Task> ready_;
+  // Tasks waiting for the number of running tasks to drop below the limit.
+  std::deque<Task> waiting_;
+  // Running tasks which are not required.
+  int running_ = 0;
+  int idle_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace lczero
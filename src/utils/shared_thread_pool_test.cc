@@ -0,0 +1,96 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/shared_thread_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+
+namespace lczero {
+
+TEST(SharedThreadPool, LimitsRunningTasks) {
+  SharedThreadPool pool(2);
+  std::atomic<int> running = 0;
+  std::atomic<int> max_running = 0;
+  std::atomic<int> done = 0;
+  {
+    SharedThreadPool::Group group(&pool);
+    for (int i = 0; i < 8; ++i) {
+      group.Submit([&]() {
+        const int now = ++running;
+        int max = max_running.load();
+        while (now > max && !max_running.compare_exchange_weak(max, now)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        --running;
+        ++done;
+      });
+    }
+    group.Wait();
+  }
+  EXPECT_EQ(done.load(), 8);
+  EXPECT_LE(max_running.load(), 2);
+}
+
+TEST(SharedThreadPool, RequiredTasksDontWait) {
+  SharedThreadPool pool(1);
+  std::atomic<bool> released = false;
+  SharedThreadPool::Group blocked(&pool);
+  // Takes the only slot until the required task releases it.
+  blocked.Submit([&]() {
+    while (!released) std::this_thread::yield();
+  });
+  SharedThreadPool::Group group(&pool);
+  group.Submit([&]() { released = true; }, true);
+  group.Wait();
+  blocked.Wait();
+  EXPECT_TRUE(released);
+}
+
+TEST(SharedThreadPool, GroupsShareThePool) {
+  SharedThreadPool pool(2);
+  std::atomic<int> done = 0;
+  SharedThreadPool::Group a(&pool);
+  SharedThreadPool::Group b(&pool);
+  for (int i = 0; i < 20; ++i) {
+    a.Submit([&]() { ++done; });
+    b.Submit([&]() { ++done; }, i == 0);
+  }
+  a.Wait();
+  b.Wait();
+  EXPECT_EQ(done.load(), 40);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,173 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/shm_table.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "utils/exception.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace lczero {
+namespace {
+
+#ifndef _WIN32
+// The process which creates the table sets its size right after creating it,
+// the others wait for that at most this long.
+constexpr auto kSizeTimeout = std::chrono::seconds(1);
+
+// Tables are private to the user, the user id in the name keeps the users from
+// colliding with each other.
+std::string ShmName(const std::string& name) {
+  return "/" + name + "." + std::to_string(getuid());
+}
+
+std::string ErrnoMessage(const std::string& what, const std::string& name) {
+  return what + " shared memory table " + name + ": " + std::strerror(errno);
+}
+#endif
+
+}  // namespace
+
+#ifdef _WIN32
+SharedMemoryTable::SharedMemoryTable(const std::string&, size_t) {
+  throw Exception("Shared memory tables are not supported on this platform");
+}
+
+SharedMemoryTable::~SharedMemoryTable() {}
+
+void SharedMemoryTable::Remove(const std::string&) {}
+#else
+SharedMemoryTable::SharedMemoryTable(const std::string& name, size_t size) {
+  const std::string shm_name = ShmName(name);
+  size = std::max(size / kSlotSize, size_t{1}) * kSlotSize;
+  int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0) {
+    // Freshly created tables are zero-filled, i.e. have all slots empty.
+    if (ftruncate(fd, size) != 0) {
+      const std::string message = ErrnoMessage("Cannot size", name);
+      close(fd);
+      shm_unlink(shm_name.c_str());
+      throw Exception(message);
+    }
+  } else if (errno == EEXIST) {
+    fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) throw Exception(ErrnoMessage("Cannot open", name));
+  } else {
+    throw Exception(ErrnoMessage("Cannot create", name));
+  }
+  struct stat st;
+  const auto deadline = std::chrono::steady_clock::now() + kSizeTimeout;
+  while (true) {
+    if (fstat(fd, &st) != 0) {
+      const std::string message = ErrnoMessage("Cannot stat", name);
+      close(fd);
+      throw Exception(message);
+    }
+    if (st.st_size > 0 || std::chrono::steady_clock::now() > deadline) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  num_slots_ = st.st_size / kSlotSize;
+  if (num_slots_ == 0) {
+    close(fd);
+    throw Exception("Shared memory table " + name + " is empty");
+  }
+  void* ptr = mmap(nullptr, num_slots_ * kSlotSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  const std::string message = ErrnoMessage("Cannot map", name);
+  close(fd);
+  if (ptr == MAP_FAILED) throw Exception(message);
+  slots_ = static_cast<Slot*>(ptr);
+}
+
+SharedMemoryTable::~SharedMemoryTable() {
+  munmap(slots_, num_slots_ * kSlotSize);
+}
+
+void SharedMemoryTable::Remove(const std::string& name) {
+  shm_unlink(ShmName(name).c_str());
+}
+#endif
+
+bool SharedMemoryTable::Lookup(uint64_t key, Value* out) const {
+  const Slot& slot = GetSlot(key);
+  const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+  if (sequence == 0 || (sequence & 1)) return false;
+  if (slot.key.load(std::memory_order_relaxed) != key) return false;
+  const uint64_t header = slot.header.load(std::memory_order_relaxed);
+  out->size = static_cast<uint32_t>(header);
+  out->tag = header >> 32;
+  if (out->size > kMaxValueSize) return false;
+  for (size_t i = 0, offset = 0; offset < out->size;
+       ++i, offset += sizeof(uint64_t)) {
+    const uint64_t word = slot.data[i].load(std::memory_order_relaxed);
+    std::memcpy(out->data + offset, &word,
+                std::min(sizeof(uint64_t), out->size - offset));
+  }
+  // Seqlock: the value is only valid if nobody started writing the slot
+  // before it was copied.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+void SharedMemoryTable::Insert(uint64_t key, uint32_t tag,
+                               std::span<const uint8_t> value) {
+  if (value.size() > kMaxValueSize) return;
+  Slot& slot = GetSlot(key);
+  uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) ||
+      !slot.sequence.compare_exchange_strong(sequence, sequence + 1,
+                                             std::memory_order_relaxed)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.key.store(key, std::memory_order_relaxed);
+  slot.header.store(uint64_t{tag} << 32 | value.size(),
+                    std::memory_order_relaxed);
+  for (size_t i = 0, offset = 0; offset < value.size();
+       ++i, offset += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    std::memcpy(&word, value.data() + offset,
+                std::min(sizeof(uint64_t), value.size() - offset));
+    slot.data[i].store(word, std::memory_order_relaxed);
+  }
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+}  // namespace lczero
@@ -0,0 +1,106 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace lczero {
+
+// Fixed-size hash table of small values keyed by 64-bit hashes, placed in
+// shared memory, so that all the processes on the host which open it with the
+// same name share the values. It's direct-mapped and lock-free: every slot has
+// a sequence number which is odd while the slot is being written, a lookup
+// which sees the number change misses instead of waiting, and so does an
+// insert into a slot being written. Slots are always overwritten, the key is
+// stored in full so that other positions mapped to the slot are never
+// returned. Tables are only shared between processes of the same user. A table
+// outlives the processes which use it (on Linux it's in /dev/shm), a slot left
+// half-written by a crashed process is just lost.
+class SharedMemoryTable {
+ public:
+  static constexpr size_t kSlotSize = 256;
+  // Room for the value in a slot, the rest is the slot header.
+  static constexpr size_t kMaxValueSize = kSlotSize - 3 * sizeof(uint64_t);
+
+  struct Value {
+    // Caller-defined bits stored along with the value.
+    uint32_t tag;
+    size_t size;
+    uint8_t data[kMaxValueSize];
+  };
+
+  // Opens the table @name, or creates it with @size bytes if it doesn't exist
+  // yet. An existing table keeps its size. Throws Exception if shared memory
+  // can't be used.
+  SharedMemoryTable(const std::string& name, size_t size);
+  ~SharedMemoryTable();
+
+  SharedMemoryTable(const SharedMemoryTable&) = delete;
+  SharedMemoryTable& operator=(const SharedMemoryTable&) = delete;
+
+  // Copies the value stored for @key into @out. Returns false if there is
+  // none, or if the slot is being written.
+  bool Lookup(uint64_t key, Value* out) const;
+  // Stores the value for @key, replacing what its slot held. Values larger
+  // than kMaxValueSize are not stored.
+  void Insert(uint64_t key, uint32_t tag, std::span<const uint8_t> value);
+
+  size_t num_slots() const { return num_slots_; }
+
+  // Deletes the table @name. Processes which have it open keep using it.
+  static void Remove(const std::string& name);
+
+ private:
+  static constexpr size_t kValueWords = kMaxValueSize / sizeof(uint64_t);
+
+  // Every field is accessed atomically, as other processes may write the slot
+  // while it's read.
+  struct alignas(64) Slot {
+    // Even when the slot is stable, zero when it was never written.
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> key;
+    // Value size in the low 32 bits and the tag in the high ones.
+    std::atomic<uint64_t> header;
+    std::atomic<uint64_t> data[kValueWords];
+  };
+  static_assert(sizeof(Slot) == kSlotSize);
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Slots are shared between processes.");
+
+  Slot& GetSlot(uint64_t key) const { return slots_[key % num_slots_]; }
+
+  Slot* slots_ = nullptr;
+  size_t num_slots_ = 0;
+};
+
+}  // namespace lczero
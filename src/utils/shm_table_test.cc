@@ -0,0 +1,75 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/shm_table.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <numeric>
+#include <vector>
+
+namespace lczero {
+
+TEST(SharedMemoryTable, ValuesAreSharedBetweenOpenings) {
+  const std::string name = "lc0-shm-table-test-" + std::to_string(getpid());
+  SharedMemoryTable::Remove(name);
+  SharedMemoryTable table(name, 64 * SharedMemoryTable::kSlotSize);
+  // Opening it again keeps the size of the existing table.
+  SharedMemoryTable other(name, 1);
+  ASSERT_EQ(table.num_slots(), 64u);
+  ASSERT_EQ(other.num_slots(), 64u);
+
+  std::vector<uint8_t> value(13);
+  std::iota(value.begin(), value.end(), 1);
+  SharedMemoryTable::Value out;
+  EXPECT_FALSE(other.Lookup(5, &out));
+  table.Insert(5, 42, value);
+  ASSERT_TRUE(other.Lookup(5, &out));
+  EXPECT_EQ(out.tag, 42u);
+  EXPECT_EQ(std::vector<uint8_t>(out.data, out.data + out.size), value);
+
+  // A key mapped to the same slot replaces the value.
+  EXPECT_FALSE(table.Lookup(5 + 64, &out));
+  other.Insert(5 + 64, 7, std::span<const uint8_t>(value).first(3));
+  EXPECT_FALSE(table.Lookup(5, &out));
+  ASSERT_TRUE(table.Lookup(5 + 64, &out));
+  EXPECT_EQ(out.size, 3u);
+
+  // Too large values are not stored.
+  table.Insert(6, 0, std::vector<uint8_t>(SharedMemoryTable::kMaxValueSize + 1));
+  EXPECT_FALSE(table.Lookup(6, &out));
+  SharedMemoryTable::Remove(name);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
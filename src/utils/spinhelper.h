@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <random>
 
@@ -38,13 +40,31 @@ class SpinHelper {
  public:
   virtual ~SpinHelper() = default;
   virtual void Backoff() {}
-  virtual void Wait() {}
+  // Called in a loop while @value equals @old. The thread that changes @value
+  // must call notify_all() on it.
+  virtual void WaitWhileEqual(const std::atomic<int>& /*value*/,
+                              int /*old*/) {}
 };
 
+// Spins up to @spins times for @value to change from @old, then parks the
+// thread on it (a futex on Linux) until it does. The thread that changes
+// @value must call notify_*() on it. Returns whether the thread had to park.
+template <typename T>
+bool SpinThenWait(const std::atomic<T>& value, T old, int spins) {
+  for (int i = 0; i < spins; i++) {
+    if (value.load(std::memory_order_acquire) != old) return false;
+    SpinloopPause();
+  }
+  while (value.load(std::memory_order_acquire) == old) {
+    value.wait(old, std::memory_order_acquire);
+  }
+  return true;
+}
+
 class ExponentialBackoffSpinHelper : public SpinHelper {
  public:
   ExponentialBackoffSpinHelper()
-      : backoff_iters_(kMinBackoffIters), spin_to_sleep_iters_(0) {}
+      : backoff_iters_(kMinBackoffIters), wait_spins_(kMaxWaitSpins) {}
 
   virtual void Backoff() {
     thread_local std::uniform_int_distribution<size_t> distribution;
@@ -55,28 +75,27 @@ class ExponentialBackoffSpinHelper : public SpinHelper {
     for (size_t i = 0; i < spin_count; i++) SpinloopPause();
 
     backoff_iters_ = std::min(2 * backoff_iters_, kMaxBackoffIters);
-    spin_to_sleep_iters_ = 0;
   }
 
-  // Spin to sleep
-  virtual void Wait() {
-    if (spin_to_sleep_iters_ < kMaxSpinToSleepIters) {
-      spin_to_sleep_iters_++;
-      SpinloopPause();
+  // Spin, then park. The spin phase adapts to how long the waits turn out to
+  // be: it grows when spinning was enough and shrinks when the thread parked
+  // anyway.
+  virtual void WaitWhileEqual(const std::atomic<int>& value, int old) {
+    if (SpinThenWait(value, old, wait_spins_)) {
+      wait_spins_ = std::max(wait_spins_ / 2, kMinWaitSpins);
     } else {
-      spin_to_sleep_iters_ = 0;
-      std::this_thread::sleep_for(kSleepDuration);
+      wait_spins_ = std::min(2 * wait_spins_, kMaxWaitSpins);
     }
   }
 
  private:
-  static constexpr size_t kMaxSpinToSleepIters = 0x10000;
   static constexpr size_t kMinBackoffIters = 0x20;
   static constexpr size_t kMaxBackoffIters = 0x400;
-  static constexpr std::chrono::microseconds kSleepDuration{1000};
+  static constexpr int kMinWaitSpins = 0x40;
+  static constexpr int kMaxWaitSpins = 0x2000;
 
   size_t backoff_iters_;
-  size_t spin_to_sleep_iters_;
+  int wait_spins_;
 };
 
 }  // namespace lczero
@@ -0,0 +1,200 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+struct Event {
+  const char* name;
+  const char* category;
+  Tracer::Clock::time_point start;
+  Tracer::Clock::time_point end;
+};
+
+// Events of one thread. The mutex is only contended while the trace is
+// written.
+struct ThreadBuffer {
+  std::mutex mutex;
+  int tid;
+  std::string name;
+  std::vector<Event> events;
+  // Index of the next event to write, grows beyond events.size() when the
+  // buffer wraps around.
+  size_t next = 0;
+  uint64_t generation = 0;
+};
+
+struct TracerState {
+  std::mutex mutex;
+  // Buffers are kept after their threads exit, so that their events still get
+  // into the trace.
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  // Updated under the mutex, read without it.
+  std::atomic<uint64_t> generation = 0;
+  std::atomic<size_t> events_per_thread = 0;
+  std::atomic<Tracer::Clock::rep> enabled_time = 0;
+};
+
+TracerState& GetState() {
+  static TracerState state;
+  return state;
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+    auto result = std::make_shared<ThreadBuffer>();
+    TracerState& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    result->tid = state.buffers.size() + 1;
+    state.buffers.push_back(result);
+    return result;
+  }();
+  return buffer.get();
+}
+
+// Prepares the buffer for the current tracing session, dropping the events of
+// the previous one. The buffer mutex must be held.
+void SyncBuffer(ThreadBuffer* buffer, uint64_t generation, size_t capacity) {
+  if (buffer->generation == generation) return;
+  buffer->generation = generation;
+  buffer->events.clear();
+  buffer->events.reserve(capacity);
+  buffer->next = 0;
+}
+
+void AppendJsonString(std::ofstream* out, const std::string& str) {
+  *out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') *out << '\\';
+    if (static_cast<unsigned char>(c) >= 0x20) *out << c;
+  }
+  *out << '"';
+}
+
+}  // namespace
+
+std::atomic<bool> Tracer::enabled_ = false;
+
+void Tracer::Enable(size_t events_per_thread) {
+  TracerState& state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.events_per_thread.store(std::max<size_t>(events_per_thread, 1),
+                                std::memory_order_relaxed);
+  state.enabled_time.store(Clock::now().time_since_epoch().count(),
+                           std::memory_order_relaxed);
+  state.generation.fetch_add(1, std::memory_order_relaxed);
+  enabled_.store(true, std::memory_order_release);
+}
+
+void Tracer::Disable() { enabled_.store(false, std::memory_order_release); }
+
+void Tracer::RecordSpan(const char* name, const char* category,
+                        Clock::time_point start, Clock::time_point end) {
+  TracerState& state = GetState();
+  if (start.time_since_epoch().count() <
+      state.enabled_time.load(std::memory_order_relaxed)) {
+    return;
+  }
+  ThreadBuffer* buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  const uint64_t generation = state.generation.load(std::memory_order_relaxed);
+  const size_t capacity =
+      state.events_per_thread.load(std::memory_order_relaxed);
+  SyncBuffer(buffer, generation, capacity);
+  const Event event{name, category, start, end};
+  if (buffer->events.size() < capacity) {
+    buffer->events.push_back(event);
+  } else {
+    buffer->events[buffer->next % capacity] = event;
+  }
+  ++buffer->next;
+}
+
+void Tracer::SetThreadName(const std::string& name) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  buffer->name = name;
+}
+
+void Tracer::WriteChromeTrace(const std::string& filename) {
+  std::ofstream out(filename);
+  if (!out) throw Exception("Cannot write trace to " + filename);
+  TracerState& state = GetState();
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  Clock::time_point epoch;
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    buffers = state.buffers;
+    epoch = Clock::time_point(Clock::duration(
+        state.enabled_time.load(std::memory_order_relaxed)));
+    generation = state.generation.load(std::memory_order_relaxed);
+  }
+  auto to_us = [&](Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) out << ",";
+    first = false;
+    out << "\n";
+  };
+  for (const auto& buffer : buffers) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    if (!buffer->name.empty()) {
+      separator();
+      out << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+          << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+      AppendJsonString(&out, buffer->name);
+      out << "}}";
+    }
+    if (buffer->generation != generation) continue;
+    for (const Event& event : buffer->events) {
+      separator();
+      out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+          << ",\"name\":\"" << event.name << "\",\"cat\":\""
+          << event.category << "\",\"ts\":" << to_us(event.start - epoch)
+          << ",\"dur\":" << to_us(event.end - event.start) << "}";
+    }
+  }
+  out << "\n]}\n";
+  if (!out) throw Exception("Cannot write trace to " + filename);
+}
+
+}  // namespace lczero
@@ -0,0 +1,91 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace lczero {
+
+// Timeline tracing of the search and backend, written in the Chrome trace
+// event JSON format (loads in chrome://tracing and ui.perfetto.dev).
+// Every thread records its spans into its own ring buffer, so that only the
+// most recent events are kept. When tracing is off, a span costs one relaxed
+// atomic load.
+//
+// Event names and categories must be string literals (or otherwise outlive
+// the tracer), they are stored as pointers.
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+  // Clears the buffers and starts recording, keeping up to @events_per_thread
+  // most recent events of every thread.
+  static void Enable(size_t events_per_thread);
+  static void Disable();
+  // Records a complete span of the calling thread. Spans started before
+  // tracing was enabled are dropped.
+  static void RecordSpan(const char* name, const char* category,
+                         Clock::time_point start, Clock::time_point end);
+  // Names the calling thread in the trace.
+  static void SetThreadName(const std::string& name);
+  // Writes all buffered events. Throws Exception if the file can't be written.
+  static void WriteChromeTrace(const std::string& filename);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// Records the span from the construction to the destruction.
+class TraceSpan {
+ public:
+  TraceSpan(const char* name, const char* category)
+      : name_(name), category_(category), enabled_(Tracer::IsEnabled()) {
+    if (enabled_) start_ = Tracer::Clock::now();
+  }
+  ~TraceSpan() {
+    if (enabled_) {
+      Tracer::RecordSpan(name_, category_, start_, Tracer::Clock::now());
+    }
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char* const name_;
+  const char* const category_;
+  const bool enabled_;
+  Tracer::Clock::time_point start_;
+};
+
+}  // namespace lczero
@@ -40,7 +40,13 @@ LayerAdapter::LayerAdapter(const pblczero::Weights::Layer& layer)
       range_(layer.max_val() - min_) {}
 
 std::vector<float> LayerAdapter::as_vector() const {
-  return std::vector<float>(begin(), end());
+  // A plain loop over the raw data rather than going through the iterators,
+  // so that the compilers vectorize it. Same arithmetic as ExtractValue().
+  std::vector<float> result(size_);
+  for (size_t i = 0; i < size_; ++i) {
+    result[i] = data_[i] / static_cast<float>(0xffff) * range_ + min_;
+  }
+  return result;
 }
 float LayerAdapter::Iterator::operator*() const {
   return ExtractValue(data_, adapter_);
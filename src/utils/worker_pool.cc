@@ -0,0 +1,90 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "utils/worker_pool.h"
+
+#include <cassert>
+
+namespace lczero {
+
+WorkerPool::WorkerPool(int num_workers, std::function<void(int)> init) {
+  threads_.reserve(num_workers);
+  for (int i = 0; i < num_workers; i++) {
+    threads_.emplace_back([this, i, init]() { Worker(i, init); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+void WorkerPool::Run(int count, const std::function<void(int)>& fn) {
+  assert(count <= GetSize());
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_ = &fn;
+  job_count_ = count;
+  pending_ = count;
+  exception_ = nullptr;
+  generation_++;
+  work_cv_.notify_all();
+  done_cv_.wait(lock, [&]() { return pending_ == 0; });
+  job_ = nullptr;
+  if (exception_) std::rethrow_exception(exception_);
+}
+
+void WorkerPool::Worker(int id, const std::function<void(int)>& init) {
+  if (init) init(id);
+  uint64_t seen_generation = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_cv_.wait(lock,
+                  [&]() { return stop_ || generation_ != seen_generation; });
+    if (stop_) return;
+    seen_generation = generation_;
+    if (id >= job_count_) continue;
+    const auto* job = job_;
+    lock.unlock();
+    std::exception_ptr exception;
+    try {
+      (*job)(id);
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    lock.lock();
+    if (exception && !exception_) exception_ = exception;
+    if (--pending_ == 0) done_cv_.notify_all();
+  }
+}
+
+}  // namespace lczero
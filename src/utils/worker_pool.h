@@ -0,0 +1,73 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+// A fixed set of persistent threads running parts of one job at a time.
+// Every worker gets a stable id, so that it can be bound to a processor and
+// keep its own scratch memory local to it.
+class WorkerPool {
+ public:
+  // @init is called once on every worker thread with its id before any job.
+  WorkerPool(int num_workers, std::function<void(int)> init);
+  ~WorkerPool();
+
+  int GetSize() const { return static_cast<int>(threads_.size()); }
+
+  // Calls @fn(worker_id) on the first @count workers and waits until all of
+  // them are done. Rethrows the first exception thrown by @fn. Concurrent
+  // callers are serialized.
+  void Run(int count, const std::function<void(int)>& fn);
+
+ private:
+  void Worker(int id, const std::function<void(int)>& init);
+
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(int)>* job_ = nullptr;
+  int job_count_ = 0;
+  int pending_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+  std::exception_ptr exception_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace lczero